@@ -16,6 +16,9 @@ extern "C"
 #include "libavutil/opt.h"
 }
 #include <chrono>
+#include <memory>
+#include <vector>
+#include <algorithm>
 
 #include <iostream>
 #include <omp.h>
@@ -29,18 +32,20 @@ class Frame
 {
 public:
 	Frame(void) : m_framePtr(nullptr), m_time_base{ 0,0 }, m_haveFrame(false),
-		m_timeOffset(0)
+		m_timeOffset(0), m_seekEpoch(0)
 	{
 		m_framePtr = av_frame_alloc();
 	}
 
 	virtual ~Frame(void)
 	{
-		if (IsValid())
+		if (m_framePtr != nullptr)
 		{
-			av_freep(&m_framePtr->data[0]);
+			// merged images are owned by the frame, decoded pictures by the codec buffers
+			if (m_framePtr->buf[0] == nullptr)
+				av_freep(&m_framePtr->data[0]);
 			av_frame_unref(m_framePtr);
-			m_haveFrame = -1;
+			m_haveFrame = false;
 			av_frame_free(&m_framePtr);
 			m_framePtr = nullptr;
 		}
@@ -52,8 +57,13 @@ public:
 	auto GetDisplayTimestamp(void) const {	if (IsValid()) return std::chrono::system_clock::time_point(std::chrono::milliseconds(long(frameOffset))); else	return std::chrono::system_clock::time_point(std::chrono::milliseconds(-1)); }
 	uint8_t** GetDataPtr(void) const { if (IsValid()) { return m_framePtr->data; } else { return nullptr; } }
 	int* GetLinesizePtr(void) const { if (IsValid()) { return m_framePtr->linesize; } else { return nullptr; } }
+	int GetFormat(void) const { return m_framePtr->format; }
+	int64_t GetPts(void) const { if (IsValid()) { return m_framePtr->pts; } else { return AV_NOPTS_VALUE; } }
 	size_t GetDisplayPictureNumber(void) const { if (IsValid()) { return m_framePtr->display_picture_number; } else { return -1; } }
 	void SetFrameOffset(double offset) { frameOffset = offset; }
+	//seek of the reader the frame was decoded after
+	void SetSeekEpoch(size_t epoch) { m_seekEpoch = epoch; }
+	size_t GetSeekEpoch(void) const { return m_seekEpoch; }
 protected:
 	bool m_haveFrame;
 	AVFrame* m_framePtr;
@@ -64,6 +74,7 @@ private:
 	AVRational m_time_base;
 	std::chrono::milliseconds m_timeOffset;
 	double frameOffset;
+	size_t m_seekEpoch;
 };
 
 
@@ -71,8 +82,15 @@ private:
 class VideoFrame final : public Frame
 {
 public:
-	VideoFrame(void) : Frame() {}
-	virtual ~VideoFrame(void) = default;
+	VideoFrame(void) : Frame(), m_numTiles(0), m_ownedImage(nullptr), m_ownedWidth(0), m_ownedHeight(0), m_pboSlot(-1), m_useTiles(false) {}
+	virtual ~VideoFrame(void)
+	{
+		// data may point into a pixel buffer, only the owned image is freed
+		if (m_framePtr != nullptr && m_framePtr->buf[0] == nullptr)
+			m_framePtr->data[0] = nullptr;
+		if (m_ownedImage != nullptr)
+			av_freep(&m_ownedImage);
+	}
 
 	auto AvCodecReceiveFrame(AVCodecContext* codecCtx)
 	{
@@ -81,92 +99,256 @@ public:
 		return ret;
 	}
 
+	// replace the decoded hardware surface by a system memory copy, swFrame is scratch space
+	int TransferFromHardware(AVFrame* swFrame)
+	{
+		av_frame_unref(swFrame);
+		auto ret = av_hwframe_transfer_data(swFrame, m_framePtr, 0);
+		if (ret < 0)
+		{
+			m_haveFrame = false;
+			return ret;
+		}
+		av_frame_copy_props(swFrame, m_framePtr);
+		av_frame_unref(m_framePtr);
+		av_frame_move_ref(m_framePtr, swFrame);
+		return 0;
+	}
+
+	// share the decoded picture of other, no pixels are copied
+	void ReferenceFrom(const VideoFrame& other)
+	{
+		av_frame_unref(m_framePtr);
+		m_haveFrame = other.m_haveFrame && av_frame_ref(m_framePtr, other.m_framePtr) == 0;
+	}
+
 	void mergeTilesToFrame(const VideoFrame* tiles, const VideoTileStream* streams, size_t numTiles)
+	{
+		prepareMerge(streams);
+		for (int t = 0; t < numTiles; t++)
+			mergeTile(tiles[t], streams[t]);
+		finishMerge();
+	}
+
+	// size of a merged YUV420P image
+	static size_t mergedImageSize(const VideoTileStream* streams)
+	{
+		const DASH::SRD& srd = streams->getSRD();
+		return av_image_get_buffer_size(AV_PIX_FMT_YUV420P, srd.w * srd.th, srd.h * srd.tv, 1);
+	}
+
+	// set up the equirectangular image, pooled frames keep their image between uses.
+	// If external is given the frame is merged into that memory (a mapped pixel buffer slot)
+	void prepareMerge(const VideoTileStream* streams, uint8_t* external = nullptr, int pboSlot = -1)
 	{
 		const DASH::SRD& srd = streams->getSRD();
 
 		int dstWidth = srd.w * srd.th;
 		int dstHeight = srd.h * srd.tv;
 
-		av_image_alloc(m_framePtr->data, m_framePtr->linesize, dstWidth, dstHeight, AV_PIX_FMT_YUV420P, 1);
+		m_haveFrame = false;
+		m_pboSlot = pboSlot;
+		m_useTiles = false;
+		ReleasePicture();
+		if (external != nullptr)
+		{
+			av_image_fill_arrays(m_framePtr->data, m_framePtr->linesize, external, AV_PIX_FMT_YUV420P, dstWidth, dstHeight, 1);
+		}
+		else
+		{
+			if (m_ownedImage == nullptr || m_ownedWidth != dstWidth || m_ownedHeight != dstHeight)
+			{
+				if (m_ownedImage != nullptr)
+					av_freep(&m_ownedImage);
+				av_image_alloc(m_ownedData, m_ownedLinesize, dstWidth, dstHeight, AV_PIX_FMT_YUV420P, 1);
+				m_ownedImage = m_ownedData[0];
+				m_ownedWidth = dstWidth;
+				m_ownedHeight = dstHeight;
+			}
+			for (int i = 0; i < 4; i++)
+			{
+				m_framePtr->data[i] = m_ownedData[i];
+				m_framePtr->linesize[i] = m_ownedLinesize[i];
+			}
+		}
 
 		m_framePtr->width = dstWidth;
 		m_framePtr->height = dstHeight;
+		m_tileScales.assign(2 * srd.th * srd.tv, 1.0f);
+	}
+
+	// share of its region every tile of the grid fills, row by row: a tile of a reduced resolution representation
+	// is merged into the top left of its region at its own size and the shader stretches it
+	const std::vector<float>& GetTileScales(void) const { return m_tileScales; }
 
+	// pixel buffer slot the image was merged into, -1 for client memory
+	int GetPboSlot(void) const { return m_pboSlot; }
+
+	// copy the rows of one decoded tile, tiles do not overlap so they can be merged concurrently
+	void mergeTile(const VideoFrame& tile, const VideoTileStream& stream)
+	{
+		DASH::SRD srd = stream.getSRD();
+		size_t scaleIndex = 2 * (srd.y / srd.h * srd.th + srd.x / srd.w);
+
+		// the demo colours the whole region
 		if (Config::instance()->demo)
 		{
-			for (int t = 0; t < numTiles; t++)
+			auto timestamp = tile.GetDisplayTimestamp().time_since_epoch().count();
+			auto quality = stream.getQualityAtTime(timestamp / 1000);
+			fillRegion(srd.x, srd.y, srd.w, srd.h, quality * (255 / 3));
+			return;
+		}
+
+		srd.w = std::min(srd.w, tile.GetWidth());
+		srd.h = std::min(srd.h, tile.GetHeight());
+		m_tileScales[scaleIndex] = (float)srd.w / stream.getSRD().w;
+		m_tileScales[scaleIndex + 1] = (float)srd.h / stream.getSRD().h;
+		copyRegion(tile, srd.x, srd.y, srd.w, srd.h);
+	}
+
+	// copy the picture of a decoder that decoded all tiles at once, into a pixel buffer or from a hardware surface
+	void mergePicture(const VideoFrame& picture)
+	{
+		copyRegion(picture, 0, 0, std::min(m_framePtr->width, picture.GetWidth()), std::min(m_framePtr->height, picture.GetHeight()));
+	}
+
+	void finishMerge(void)
+	{
+		m_haveFrame = true;
+	}
+
+	// the picture of a decoder that decoded all tiles at once is shown as it is, without a merged copy
+	void preparePicture(const VideoTileStream* streams, const VideoFrame& picture)
+	{
+		const DASH::SRD& srd = streams->getSRD();
+		m_pboSlot = -1;
+		m_useTiles = false;
+		// the owned image stays allocated for the next merge
+		ReferenceFrom(picture);
+		m_tileScales.assign(2 * srd.th * srd.tv, 1.0f);
+	}
+
+	// direct tile upload: the frame keeps the decoded tiles instead of a merged image
+	void prepareTiles(const VideoTileStream* streams, size_t numTiles)
+	{
+		const DASH::SRD& srd = streams->getSRD();
+
+		m_haveFrame = false;
+		m_pboSlot = -1;
+		m_useTiles = true;
+		ReleasePicture();
+		if (m_numTiles != numTiles)
+		{
+			m_tiles.reset(new VideoFrame[numTiles]);
+			m_numTiles = numTiles;
+		}
+		m_framePtr->width = srd.w * srd.th;
+		m_framePtr->height = srd.h * srd.tv;
+	}
+
+	VideoFrame& GetTile(size_t tile) { return m_tiles[tile]; }
+	const VideoFrame& GetTile(size_t tile) const { return m_tiles[tile]; }
+	bool HasTiles(void) const { return m_useTiles; }
+	size_t GetNbTiles(void) const { return m_numTiles; }
+
+	int* GetRowLength(void) { if (IsValid()) { return m_framePtr->linesize; } else { return nullptr; } }
+	int GetWidth(void) const { if (IsValid()) { return m_framePtr->width; } else { return -1; } }
+	int GetHeight(void) const { if (IsValid()) { return m_framePtr->height; } else { return -1; } }
+
+private:
+	// rows of the top left w x h of src to x, y of the image
+	void copyRegion(const VideoFrame& src, int x, int y, int w, int h)
+	{
+		uint8_t* dstPtrBaseY = m_framePtr->data[0] + y * m_framePtr->linesize[0] + x;
+		uint8_t* dstPtrBaseU = m_framePtr->data[1] + y / 2 * m_framePtr->linesize[1] + x / 2;
+		uint8_t* dstPtrBaseV = m_framePtr->data[2] + y / 2 * m_framePtr->linesize[2] + x / 2;
+		uint8_t** srcData = src.GetDataPtr();
+		const int* srcLinesize = src.GetLinesizePtr();
+
+		if (src.GetFormat() == AV_PIX_FMT_NV12) for (int l = 0; l < h; l++)
+		{
+			// downloaded hardware frames have interleaved chroma
+			memcpy(dstPtrBaseY + l * m_framePtr->linesize[0], srcData[0] + l * srcLinesize[0], w); // Y
+
+			if (l % 2)
 			{
-				auto timestamp = tiles[t].GetDisplayTimestamp().time_since_epoch().count();
-				auto quality = streams[t].getQualityAtTime(timestamp / 1000);
-
-				int srcX = streams[t].getSRD().x;
-				int srcY = streams[t].getSRD().y;
-				uint8_t* dstPtrBaseY = m_framePtr->data[0] + srcY * m_framePtr->linesize[0] + srcX;
-				uint8_t* dstPtrBaseU = m_framePtr->data[1] + srcY / 2 * m_framePtr->linesize[1] + srcX / 2;
-				uint8_t* dstPtrBaseV = m_framePtr->data[2] + srcY / 2 * m_framePtr->linesize[2] + srcX / 2;
-				uint8_t** srcData = tiles[t].GetDataPtr();
-				const int* srcLinesize = tiles[t].GetLinesizePtr();
-
-				for (int l = 0; l < srd.h; l++)
+				int lh = l >> 1;
+				int wh = w >> 1;
+
+				uint8_t* dstU = dstPtrBaseU + lh * m_framePtr->linesize[1];
+				uint8_t* dstV = dstPtrBaseV + lh * m_framePtr->linesize[2];
+				const uint8_t* srcUV = srcData[1] + lh * srcLinesize[1];
+				for (int i = 0; i < wh; i++)
 				{
-					void* dst = dstPtrBaseY + l * m_framePtr->linesize[0];
-					const void* src = srcData[0] + l * srcLinesize[0];
-					memset(dst, 127, srd.w); // Y
-
-					if (l % 2)
-					{
-						int lh = l >> 1;
-						int wh = srd.w >> 1;
-
-						dst = dstPtrBaseU + lh * m_framePtr->linesize[1];
-						src = srcData[1] + lh * srcLinesize[1];
-						memset(dst, 0, wh); // U
-
-						dst = dstPtrBaseV + lh * m_framePtr->linesize[2];
-						src = srcData[2] + lh * srcLinesize[2];
-						memset(dst, quality * (255 / 3), wh); // V
-					}
+					dstU[i] = srcUV[2 * i];
+					dstV[i] = srcUV[2 * i + 1];
 				}
 			}
 		}
-		else for (int t = 0; t < numTiles; t++)
+		else for (int l = 0; l < h; l++)
 		{
-			int srcX = streams[t].getSRD().x;
-			int srcY = streams[t].getSRD().y;
-			uint8_t* dstPtrBaseY = m_framePtr->data[0] + srcY * m_framePtr->linesize[0] + srcX;
-			uint8_t* dstPtrBaseU = m_framePtr->data[1] + srcY / 2 * m_framePtr->linesize[1] + srcX / 2;
-			uint8_t* dstPtrBaseV = m_framePtr->data[2] + srcY / 2 * m_framePtr->linesize[2] + srcX / 2;
-			uint8_t** srcData = tiles[t].GetDataPtr();
-			const int* srcLinesize = tiles[t].GetLinesizePtr();
-
-			for (int l = 0; l < srd.h; l++)
+			void* dst = dstPtrBaseY + l * m_framePtr->linesize[0];
+			const void* srcRow = srcData[0] + l * srcLinesize[0];
+			memcpy(dst, srcRow, w); // Y
+
+			if (l % 2)
 			{
-				void* dst = dstPtrBaseY + l * m_framePtr->linesize[0];
-				const void* src = srcData[0] + l * srcLinesize[0];
-				memcpy(dst, src, srd.w); // Y
+				int lh = l >> 1;
+				int wh = w >> 1;
 
-				if (l % 2)
-				{
-					int lh = l >> 1;
-					int wh = srd.w >> 1;
+				dst = dstPtrBaseU + lh * m_framePtr->linesize[1];
+				srcRow = srcData[1] + lh * srcLinesize[1];
+				memcpy(dst, srcRow, wh); // U
+
+				dst = dstPtrBaseV + lh * m_framePtr->linesize[2];
+				srcRow = srcData[2] + lh * srcLinesize[2];
+				memcpy(dst, srcRow, wh); // V
+			}
+		}
+	}
 
-					dst = dstPtrBaseU + lh * m_framePtr->linesize[1];
-					src = srcData[1] + lh * srcLinesize[1];
-					memcpy(dst, src, wh); // U
+	// grey with the value v in V, the demo marks the quality of a tile with it
+	void fillRegion(int x, int y, int w, int h, int v)
+	{
+		uint8_t* dstPtrBaseY = m_framePtr->data[0] + y * m_framePtr->linesize[0] + x;
+		uint8_t* dstPtrBaseU = m_framePtr->data[1] + y / 2 * m_framePtr->linesize[1] + x / 2;
+		uint8_t* dstPtrBaseV = m_framePtr->data[2] + y / 2 * m_framePtr->linesize[2] + x / 2;
+		for (int l = 0; l < h; l++)
+		{
+			void* dst = dstPtrBaseY + l * m_framePtr->linesize[0];
+			memset(dst, 127, w); // Y
 
-					dst = dstPtrBaseV + lh * m_framePtr->linesize[2];
-					src = srcData[2] + lh * srcLinesize[2];
-					memcpy(dst, src, wh); // V
-				}
+			if (l % 2)
+			{
+				int lh = l >> 1;
+				int wh = w >> 1;
+
+				dst = dstPtrBaseU + lh * m_framePtr->linesize[1];
+				memset(dst, 0, wh); // U
+
+				dst = dstPtrBaseV + lh * m_framePtr->linesize[2];
+				memset(dst, v, wh); // V
 			}
 		}
-		m_haveFrame = true;
 	}
 
-	int* GetRowLength(void) { if (IsValid()) { return m_framePtr->linesize; } else { return nullptr; } }
-	int GetWidth(void) const { if (IsValid()) { return m_framePtr->width; } else { return -1; } }
-	int GetHeight(void) const { if (IsValid()) { return m_framePtr->height; } else { return -1; } }
+	// a decoded picture the frame shares is given back to its decoder before the frame is reused
+	void ReleasePicture(void)
+	{
+		if (m_framePtr->buf[0] != nullptr)
+			av_frame_unref(m_framePtr);
+	}
+
+	std::unique_ptr<VideoFrame[]> m_tiles;
+	size_t m_numTiles;
+	std::vector<float> m_tileScales;
+	uint8_t* m_ownedImage;
+	uint8_t* m_ownedData[4];
+	int m_ownedLinesize[4];
+	int m_ownedWidth;
+	int m_ownedHeight;
+	int m_pboSlot;
+	bool m_useTiles;
 };
 }
 }
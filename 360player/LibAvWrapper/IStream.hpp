@@ -11,5 +11,10 @@ class IStream
 {
 public:
 	virtual int read(char* buf, int buf_size) = 0;
+	// whence is SEEK_SET, SEEK_CUR or SEEK_END
 	virtual int64_t seek(int64_t offset, int whence) = 0;
+	// bytes the stream holds so far, -1 if it does not know
+	virtual int64_t size() { return -1; }
+	// bytes the demuxer asks for per read, 0 for the default of the I/O context
+	virtual int readSize() const { return 0; }
 };
\ No newline at end of file
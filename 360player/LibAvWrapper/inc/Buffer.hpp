@@ -2,26 +2,25 @@
   Author: Xavier Corbillon
   IMT Atlantique
 
-  Multi-thread protected Buffer class to store in a queue objects
-  (not copyable but movable)
+  Bounded single-producer/single-consumer ring buffer to store objects
+  (not copyable but movable). Only the producer may wait, the getter
+  thread only takes the lock to wake a waiting producer.
 */
 #pragma once
 
 //standard includes
-#include <queue>
-#include <mutex>
-#include <condition_variable>
+#include <vector>
 #include <memory>
 #include <atomic>
+#include <mutex>
+#include <condition_variable>
 #include <iostream>
 
-#define DEBUG_BUFFER 0
-#if DEBUG_BUFFER == 1
-#include <iostream>
-#define PRINT_DEBUG_BUFFER(x) {std::cout << "[Debug buffer]: " << x << "\n";}
-#else
-#define PRINT_DEBUG_BUFFER(x) {}
-#endif
+#include "Log.hpp"
+
+#define PRINT_DEBUG_BUFFER(x) LOG_DEBUG("[Debug buffer]: " << x)
+
+#define BUFFER_CACHE_LINE 64
 
 namespace IMT
 {
@@ -29,147 +28,134 @@ namespace IMT
 	class Buffer
 	{
 	public:
-		Buffer(size_t bufferSize) : m_mutex(), m_cv(), m_queue(), m_nbSeenObjects(0), m_totalAllowedObjects(0), m_stopped(false), m_maxQueueSize(bufferSize), m_workerDone(false) {};
+		Buffer(size_t bufferSize) : m_capacity(bufferSize + 1), m_ring(bufferSize + 1), m_head(0), m_tail(0), m_nbSeenObjects(0), m_totalAllowedObjects(0), m_stopped(false), m_workerDone(false), m_producerWaiting(false) {};
 		Buffer(const Buffer&) = delete;
 		Buffer& operator=(const Buffer&) = delete;
-		Buffer(Buffer&&) noexcept = default;
-		Buffer& operator=(Buffer&&) noexcept = default;
-		~Buffer(void) { std::lock_guard<std::mutex> locker(m_mutex); }
+		~Buffer(void) {}
 
-		//Add element t in the queue when queue size < m_maxQueueSize. Return false if will not add anything anymore
+		//Add element t in the ring when it is not full. Return false if will not add anything anymore [from the producer thread]
 		bool Add(std::shared_ptr<T> t)
 		{
-			std::unique_lock<std::mutex> locker(m_mutex);
 			while (true)
 			{
 				if (!StillAcceptAdd())
 				{
 					//No more work accepted
-					if (m_queue_producer.empty())
-					{
-						//no more work accepted and no object left in the m_queue_producer
-						m_workerDone = true;
-					}
+					m_workerDone = true;
 					return false;
 				}
-				if (m_queue_producer.size() <= m_maxQueueSize)
+				auto tail = m_tail.load(std::memory_order_relaxed);
+				if (tail - m_head.load(std::memory_order_acquire) < m_capacity)
 				{
-					m_queue_producer.push(std::move(t));
+					m_ring[tail % m_capacity] = std::move(t);
+					m_tail.store(tail + 1, std::memory_order_release);
 					++m_nbSeenObjects;
 					return true;
 				}
-				else
-				{
-					m_cv.wait(locker, [this]() {return m_queue_producer.size() <= m_maxQueueSize || !StillAcceptAdd(); });
-				}
+				//ring is full, sleep until the getter thread popped an element
+				std::unique_lock<std::mutex> locker(m_mutex);
+				m_producerWaiting = true;
+				m_cvNotFull.wait(locker, [&]() { return m_stopped || m_tail.load(std::memory_order_relaxed) - m_head.load() < m_capacity; });
+				m_producerWaiting = false;
 			}
 		}
 
-		//Access first element from the queue
+		//Remove first element from the ring [from the getter thread]
 		void Pop(void)
 		{
-			while (!IsAllDones())
+			auto head = m_head.load(std::memory_order_relaxed);
+			if (head != m_tail.load(std::memory_order_acquire))
 			{
-				if (!m_queue.empty())
-				{
-					m_queue.pop();
-					PRINT_DEBUG_BUFFER("Poped a frame");
-					return;
-				}
-				else
-				{
-					PRINT_DEBUG_BUFFER("Pop: swap queues")
-						SwapQueues();
-				}
+				m_ring[head % m_capacity].reset();
+				m_head.store(head + 1, std::memory_order_seq_cst);
+				//seq_cst pairs with the flag of the producer, either it sees the new head or we see it waiting
+				if (m_producerWaiting)
+					WakeProducer();
+				PRINT_DEBUG_BUFFER("Poped a frame");
+			}
+			else
+			{
+				PRINT_DEBUG_BUFFER("No more frame to pop")
+				UpdateWorkerDone();
 			}
-			PRINT_DEBUG_BUFFER("No more frame to pop")
 		}
 
-		//Access first element from the queue
+		//Access first element from the ring, nullptr if nothing is available yet [from the getter thread]
 		std::shared_ptr<T> Get(void)
 		{
-			while (!IsAllDones())
+			auto head = m_head.load(std::memory_order_relaxed);
+			if (head != m_tail.load(std::memory_order_acquire))
 			{
-				if (!m_queue.empty())
-				{
-					PRINT_DEBUG_BUFFER("Get a frame");
-					return m_queue.front();;
-				}
-				else
-				{
-					PRINT_DEBUG_BUFFER("Get: swap queues")
-						SwapQueues();
-					if (m_queue.empty() && !IsAllDones())
-					{
-						PRINT_DEBUG_BUFFER("Get: nothing to get yet")
-							return nullptr;
-					}
-				}
+				PRINT_DEBUG_BUFFER("Get a frame");
+				return m_ring[head % m_capacity];
 			}
-			PRINT_DEBUG_BUFFER("No frame to get")
-				return nullptr;
+			PRINT_DEBUG_BUFFER("Get: nothing to get yet")
+			UpdateWorkerDone();
+			return nullptr;
 		}
 
-		//Set the total number of object that will transit through the queue [thread safe]
+		//Set the total number of object that will transit through the ring [thread safe]
 		void SetTotal(size_t total)
 		{
-			std::lock_guard<std::mutex> locker(m_mutex);
 			PRINT_DEBUG_BUFFER("Set total frame to see: " << total);
 			m_totalAllowedObjects = total;
-			m_cv.notify_all();
 		}
 
 		//Return true if the buffer will never output any object anymore [from the getter thread]
 		bool IsAllDones(void)
 		{
-			//return false;
-			//std::lock_guard<std::mutex> locker(m_mutex);
-			return m_workerDone && m_queue.empty();
+			return m_workerDone && IsEmpty();
 		}
 
-		//wake up all waiting thread and stop this buffer [thread safe]
+		//stop this buffer, a waiting producer returns on its next try [thread safe]
 		void Stop(void)
 		{
-			//std::lock_guard<std::mutex> locker(m_mutex);
 			PRINT_DEBUG_BUFFER("Stop the buffer")
-				m_stopped = true;
-			m_cv.notify_all();
+			m_stopped = true;
+			WakeProducer();
 		}
 	private:
-		std::mutex m_mutex;
-		std::condition_variable m_cv;
-		//not thread safe queue used by the getter thread
-		std::queue<std::shared_ptr<T>> m_queue;
-		//thread safe queue used by the producer
-		std::queue<std::shared_ptr<T>> m_queue_producer;
-		size_t m_nbSeenObjects;
-		size_t m_totalAllowedObjects;
+		const size_t m_capacity;
+		std::vector<std::shared_ptr<T>> m_ring;
+		//next slot to read, written by the getter thread only
+		std::atomic<size_t> m_head;
+		char m_padHead[BUFFER_CACHE_LINE - sizeof(std::atomic<size_t>)];
+		//next slot to write, written by the producer thread only
+		std::atomic<size_t> m_tail;
+		char m_padTail[BUFFER_CACHE_LINE - sizeof(std::atomic<size_t>)];
+		//written by the producer thread only
+		std::atomic<size_t> m_nbSeenObjects;
+		std::atomic<size_t> m_totalAllowedObjects;
 		//m_stopped is true if the buffer has been stopped
 		std::atomic_bool m_stopped;
-		//m_workerDone is true if the m_queue_producer buffer is empty and the buffer is not
-		//allowed to add more object
+		//m_workerDone is true if the buffer is not allowed to add more object
 		std::atomic_bool m_workerDone;
-		const size_t m_maxQueueSize;
+		//a full ring parks the producer on the condition variable
+		std::mutex m_mutex;
+		std::condition_variable m_cvNotFull;
+		std::atomic_bool m_producerWaiting;
 
-		//swap the content from the getter and producer queues [from the getter thread]
-		void SwapQueues(void)
+		void WakeProducer(void)
 		{
-			if (m_queue.empty())
 			{
-				{
-					std::lock_guard<std::mutex> locker(m_mutex);
-					std::swap(m_queue, m_queue_producer);
-					if (m_queue_producer.empty() && !StillAcceptAdd())
-					{
-						m_workerDone = true;
-					}
-					PRINT_DEBUG_BUFFER("Swap: new buffer size = " << m_queue.size() << std::endl)
-				}
-				m_cv.notify_all();
+				std::lock_guard<std::mutex> locker(m_mutex);
 			}
+			m_cvNotFull.notify_one();
+		}
+
+		bool IsEmpty(void) const
+		{
+			return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+		}
+
+		//the producer finished if nothing is left and no more add is allowed [from the getter thread]
+		void UpdateWorkerDone(void)
+		{
+			if (IsEmpty() && (m_nbSeenObjects >= m_totalAllowedObjects || m_stopped))
+				m_workerDone = true;
 		}
 
-		//Return true if the Add function is still allowed to add object to its queue [called from producer thread]
+		//Return true if the Add function is still allowed to add object to its ring [called from producer thread]
 		bool StillAcceptAdd(void)
 		{
 			return m_nbSeenObjects < m_totalAllowedObjects && !m_stopped;
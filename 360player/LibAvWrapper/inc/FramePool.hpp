@@ -0,0 +1,64 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Fixed set of frames that are reused by the decoder thread.
+	A frame is free again as soon as the pool holds the only
+	reference, so handing frames out does not allocate.
+*/
+#pragma once
+
+//standard includes
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+namespace IMT
+{
+	template <class T>
+	class FramePool
+	{
+	public:
+		FramePool(size_t poolSize) : m_frames(), m_next(0), m_stopped(false)
+		{
+			m_frames.reserve(poolSize);
+			for (size_t i = 0; i < poolSize; ++i)
+				m_frames.push_back(std::make_shared<T>());
+		}
+		FramePool(const FramePool&) = delete;
+		FramePool& operator=(const FramePool&) = delete;
+
+		//Return a frame nobody else references, wait while all frames are in use. nullptr once stopped [from the decoder thread]
+		std::shared_ptr<T> Acquire(void)
+		{
+			while (!m_stopped)
+			{
+				for (size_t i = 0; i < m_frames.size(); ++i)
+				{
+					auto& frame = m_frames[(m_next + i) % m_frames.size()];
+					if (frame.use_count() == 1)
+					{
+						//make the last reads of the getter thread visible before the frame is overwritten
+						std::atomic_thread_fence(std::memory_order_acquire);
+						m_next = (m_next + i + 1) % m_frames.size();
+						return frame;
+					}
+				}
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+			return nullptr;
+		}
+
+		size_t Size(void) const { return m_frames.size(); }
+
+		//wake up a waiting decoder thread [thread safe]
+		void Stop(void) { m_stopped = true; }
+
+	private:
+		std::vector<std::shared_ptr<T>> m_frames;
+		size_t m_next;
+		std::atomic_bool m_stopped;
+	};
+}
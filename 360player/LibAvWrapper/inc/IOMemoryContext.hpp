@@ -2,7 +2,8 @@
 	Author: Arne-Tobias Rak
 	TU Darmstadt
 
-	Custom I/O context for ffmpeg
+	Custom I/O context for ffmpeg. The buffer size comes from the
+	stream, so tiles of a high bitrate are demuxed with fewer reads.
 */
 
 #pragma once
@@ -25,7 +26,7 @@ private:
 public:
 	IOMemoryContext(IStream* inputStream)
 		: inputStream(inputStream)
-		, bufferSize(kBufferSize)
+		, bufferSize(inputStream->readSize() > 0 ? inputStream->readSize() : kBufferSize)
 		, buf((unsigned char*)av_malloc(bufferSize + AV_INPUT_BUFFER_PADDING_SIZE)) 
 	{
 		avioCtx = avio_alloc_context(buf, bufferSize, 0, this, &IOMemoryContext::read, NULL, &IOMemoryContext::seek);
@@ -48,13 +49,15 @@ public:
 	static int64_t seek(void* opaque, int64_t offset, int whence)
 	{
 		IOMemoryContext* ioCtx = (IOMemoryContext*)opaque;
-		auto out = ioCtx->inputStream->seek(offset, whence);
-		return out;
+		if (whence & AVSEEK_SIZE)
+			return ioCtx->inputStream->size();
+		// every position of the stream is in memory, forcing a seek changes nothing
+		return ioCtx->inputStream->seek(offset, whence & ~AVSEEK_FORCE);
 	}
 
 	int read()
 	{
-		return inputStream->read((char*)buf, kBufferSize);
+		return inputStream->read((char*)buf, bufferSize);
 	}
 
 	int64_t seek(int64_t offset, int whence)
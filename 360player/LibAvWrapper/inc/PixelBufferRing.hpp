@@ -0,0 +1,172 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Ring of persistently mapped pixel buffer objects. The decoder
+	thread merges frames straight into a mapped slot, the render
+	thread only binds the slot and starts an asynchronous upload.
+	A slot is reused once the fence of its upload has signaled.
+*/
+#pragma once
+
+#include <GL/glew.h>
+
+//standard includes
+#include <vector>
+#include <atomic>
+#include <memory>
+
+namespace IMT
+{
+	class PixelBufferRing
+	{
+	public:
+		enum SlotState { Free, Filling, Ready, InFlight };
+
+		PixelBufferRing(void) : m_numSlots(0), m_slotSize(0), m_ready(false) {}
+		PixelBufferRing(const PixelBufferRing&) = delete;
+		PixelBufferRing& operator=(const PixelBufferRing&) = delete;
+
+		~PixelBufferRing(void) { Release(); }
+
+		//Create the buffers, needs a current GL context. False if persistent mapping is not supported [render thread]
+		bool Init(size_t slotSize, size_t numSlots)
+		{
+			if (!GLEW_ARB_buffer_storage)
+				return false;
+
+			m_slotSize = slotSize;
+			m_slots.reset(new Slot[numSlots]);
+			m_numSlots = numSlots;
+
+			const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			for (size_t i = 0; i < numSlots; i++)
+			{
+				glGenBuffers(1, &m_slots[i].pbo);
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_slots[i].pbo);
+				glBufferStorage(GL_PIXEL_UNPACK_BUFFER, slotSize, nullptr, flags);
+				m_slots[i].data = static_cast<uint8_t*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, slotSize, flags));
+				if (m_slots[i].data == nullptr)
+				{
+					glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+					Release();
+					return false;
+				}
+			}
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+			m_ready = true;
+			return true;
+		}
+
+		bool IsReady(void) const { return m_ready; }
+		size_t GetSlotSize(void) const { return m_slotSize; }
+
+		//Reserve a free slot for owner to merge a frame into, -1 if all slots are busy [decoder thread]
+		int AcquireSlot(const void* owner)
+		{
+			if (!m_ready)
+				return -1;
+			for (size_t i = 0; i < m_numSlots; i++)
+			{
+				int expected = Free;
+				if (m_slots[i].state.compare_exchange_strong(expected, Filling))
+				{
+					m_slots[i].owner = owner;
+					return int(i);
+				}
+			}
+			return -1;
+		}
+
+		uint8_t* GetSlotData(int slot) { return m_slots[slot].data; }
+
+		//The slot content is complete and can be uploaded
+		void SetSlotReady(int slot) { m_slots[slot].state = Ready; }
+
+		//Give back a slot whose frame was skipped and never uploaded [decoder thread]
+		void DropSlot(int slot, const void* owner)
+		{
+			if (slot < 0 || m_slots[slot].owner != owner)
+				return;
+			int expected = Ready;
+			m_slots[slot].state.compare_exchange_strong(expected, Free);
+		}
+
+		//Bind the slot as unpack buffer, texture uploads read from it until Unbind [render thread]
+		bool Bind(int slot)
+		{
+			int expected = Ready;
+			if (!m_slots[slot].state.compare_exchange_strong(expected, InFlight))
+				return false;
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_slots[slot].pbo);
+			return true;
+		}
+
+		//Fence the uploads of the bound slot [render thread]
+		void Unbind(int slot)
+		{
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			m_slots[slot].fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		}
+
+		//Free the slots whose uploads finished, never blocks [render thread]
+		void Reclaim(void)
+		{
+			for (size_t i = 0; i < m_numSlots; i++)
+			{
+				auto& slot = m_slots[i];
+				if (slot.state != InFlight || slot.fence == nullptr)
+					continue;
+				auto ret = glClientWaitSync(slot.fence, 0, 0);
+				if (ret == GL_ALREADY_SIGNALED || ret == GL_CONDITION_SATISFIED)
+				{
+					glDeleteSync(slot.fence);
+					slot.fence = nullptr;
+					slot.state = Free;
+				}
+			}
+		}
+
+	private:
+		struct Slot
+		{
+			Slot(void) : pbo(0), data(nullptr), fence(nullptr), owner(nullptr), state(Free) {}
+			GLuint pbo;
+			uint8_t* data;
+			GLsync fence;
+			//frame the slot was handed to, only written by the decoder thread
+			const void* owner;
+			std::atomic<int> state;
+		};
+
+		std::unique_ptr<Slot[]> m_slots;
+		size_t m_numSlots;
+		size_t m_slotSize;
+		std::atomic_bool m_ready;
+
+		void Release(void)
+		{
+			m_ready = false;
+			if (m_numSlots == 0)
+				return;
+			for (size_t i = 0; i < m_numSlots; i++)
+			{
+				if (m_slots[i].fence != nullptr)
+					glDeleteSync(m_slots[i].fence);
+				if (m_slots[i].pbo != 0)
+				{
+					if (m_slots[i].data != nullptr)
+					{
+						glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_slots[i].pbo);
+						glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+					}
+					glDeleteBuffers(1, &m_slots[i].pbo);
+				}
+			}
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			m_slots.reset();
+			m_numSlots = 0;
+		}
+	};
+}
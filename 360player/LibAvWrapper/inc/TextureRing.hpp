@@ -0,0 +1,123 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Ring of texture sets the frames are uploaded into. All sets are
+	layers of two array textures with immutable storage: the luma
+	and the chroma, whose layers hold U and V of a set one after the
+	other. A frame goes into the set after the one being displayed,
+	which the GPU may still sample from, so the upload does not wait
+	for the draws of the previous frame. A set is written again once
+	the fence placed when the ring moved past it has signaled.
+*/
+#pragma once
+
+#include <GL/glew.h>
+
+//standard includes
+#include <vector>
+#include <cstddef>
+
+namespace IMT
+{
+	class TextureRing
+	{
+	public:
+		enum Plane { Y = 0, U = 1, V = 2 };
+
+		TextureRing(void) : m_luma(0), m_chroma(0), m_current(-1) {}
+		TextureRing(const TextureRing&) = delete;
+		TextureRing& operator=(const TextureRing&) = delete;
+
+		~TextureRing(void) { Release(); }
+
+		//Allocate numSets sets for YUV420 images of width x height, needs a current GL context [render thread]
+		void Init(int width, int height, size_t numSets)
+		{
+			Release();
+			m_fences.assign(numSets, nullptr);
+
+			glGenTextures(1, &m_luma);
+			glGenTextures(1, &m_chroma);
+			Allocate(m_luma, width, height, GLsizei(numSets));
+			Allocate(m_chroma, width / 2, height / 2, GLsizei(2 * numSets));
+			m_current = -1;
+		}
+
+		bool IsReady(void) const { return m_luma != 0; }
+
+		//Move on to the next set and wait until the GPU is done with it. The set displayed so far is fenced behind
+		//every draw issued with it [render thread]
+		void Advance(void)
+		{
+			if (m_current >= 0)
+				m_fences[m_current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			m_current = (m_current + 1) % int(m_fences.size());
+
+			auto& fence = m_fences[m_current];
+			if (fence != nullptr)
+			{
+				// only waits if the GPU is a whole ring of frames behind
+				glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(1000000000));
+				glDeleteSync(fence);
+				fence = nullptr;
+			}
+		}
+
+		//Set the uploads of Upload go to and the draws sample from, -1 before the first Advance
+		int Current(void) const { return m_current; }
+		size_t Size(void) const { return m_fences.size(); }
+
+		//Write a rectangle of a plane of the current set, in pixels of that plane. data is an offset into the bound
+		//unpack buffer if there is one [render thread]
+		void Upload(Plane plane, int x, int y, int width, int height, const void* data)
+		{
+			glBindTexture(GL_TEXTURE_2D_ARRAY, plane == Y ? m_luma : m_chroma);
+			GLint layer = plane == Y ? m_current : 2 * m_current + (plane == V);
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, x, y, layer, width, height, 1, GL_RED, GL_UNSIGNED_BYTE, data);
+		}
+
+		//Bind the luma to texture unit lumaUnit and the chroma to chromaUnit for drawing [render thread]
+		void Bind(GLenum lumaUnit, GLenum chromaUnit) const
+		{
+			glActiveTexture(lumaUnit);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, m_luma);
+			glActiveTexture(chromaUnit);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, m_chroma);
+		}
+
+	private:
+		GLuint m_luma;
+		GLuint m_chroma;
+		int m_current;
+		std::vector<GLsync> m_fences;
+
+		static void Allocate(GLuint texture, int width, int height, GLsizei layers)
+		{
+			glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
+			// immutable storage, the content is always uploaded
+			if (GLEW_ARB_texture_storage)
+				glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_R8, width, height, layers);
+			else
+				glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R8, width, height, layers, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
+		}
+
+		void Release(void)
+		{
+			for (auto& fence : m_fences)
+				if (fence != nullptr)
+					glDeleteSync(fence);
+			m_fences.clear();
+			if (m_luma != 0)
+				glDeleteTextures(1, &m_luma);
+			if (m_chroma != 0)
+				glDeleteTextures(1, &m_chroma);
+			m_luma = m_chroma = 0;
+			m_current = -1;
+		}
+	};
+}
@@ -0,0 +1,133 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Joins the packets of HEVC motion constrained tiles into the access
+	unit of one picture. The tiles of a frame are coded as slices of a
+	single tiled picture and each tile stream carries only its own
+	slices, with the addresses they have in that picture. Their slice
+	NAL units are appended in tile order, the parameter sets and SEI
+	are taken from the first tile only. The NAL units keep the framing
+	of the streams, length prefixed as in mp4 or with Annex B start
+	codes.
+*/
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace IMT {
+namespace LibAv {
+
+class TileBitstreamMerger
+{
+public:
+	// nalLengthSize bytes before every NAL unit, 0 for Annex B start codes
+	explicit TileBitstreamMerger(int nalLengthSize = 4) : nalLengthSize(nalLengthSize), slices(0) {}
+
+	// length field size of the NAL units of an hvcC decoder configuration, 0 if extradata holds Annex B parameter sets
+	static int LengthSize(const uint8_t* extradata, size_t size)
+	{
+		if (size >= 23 && extradata[0] == 1)
+			return (extradata[21] & 3) + 1;
+		return 0;
+	}
+
+	void Begin(void)
+	{
+		merged.clear();
+		slices = 0;
+	}
+
+	// append the packet of the next tile in tile order, false if it holds no slice or its slices do not fit where
+	// they are appended: only the first slice of the picture may start it
+	bool Add(const uint8_t* data, size_t size)
+	{
+		bool firstTile = merged.empty();
+		bool sliceFound = false;
+		bool fits = true;
+		size_t pos = 0;
+		const uint8_t* nal;
+		size_t nalSize, unitSize;
+		while (Next(data, size, pos, nal, nalSize, unitSize))
+		{
+			if (nalSize < 2)
+				continue;
+			int type = (nal[0] >> 1) & 0x3f;
+			bool vcl = type < 32;
+			if (vcl)
+			{
+				// first_slice_segment_in_pic_flag
+				bool startsPicture = nalSize > 2 && (nal[2] & 0x80) != 0;
+				fits = fits && startsPicture == (slices == 0);
+				sliceFound = true;
+				slices++;
+			}
+			// parameter sets and SEI of the other tiles would be repeated inside the picture
+			if (vcl || firstTile)
+				merged.insert(merged.end(), nal + nalSize - unitSize, nal + nalSize);
+		}
+		return sliceFound && fits;
+	}
+
+	const std::vector<uint8_t>& Data(void) const { return merged; }
+	size_t Slices(void) const { return slices; }
+
+private:
+	int nalLengthSize;
+	std::vector<uint8_t> merged;
+	size_t slices;
+
+	// the NAL unit at pos, unitSize counts it with its length field or start code
+	bool Next(const uint8_t* data, size_t size, size_t& pos, const uint8_t*& nal, size_t& nalSize, size_t& unitSize) const
+	{
+		if (nalLengthSize > 0)
+		{
+			if (pos + nalLengthSize > size)
+				return false;
+			size_t length = 0;
+			for (int i = 0; i < nalLengthSize; i++)
+				length = (length << 8) | data[pos + i];
+			if (length > size - pos - nalLengthSize)
+				return false;
+			nal = data + pos + nalLengthSize;
+			nalSize = length;
+			unitSize = nalLengthSize + length;
+			pos += unitSize;
+			return true;
+		}
+
+		// the unit runs from its start code to the next one
+		size_t start = FindStartCode(data, size, pos);
+		if (start == size)
+			return false;
+		size_t begin = start + 3;
+		size_t end = FindStartCode(data, size, begin);
+		// zero bytes at the end are the four byte form of the next start code or trailing padding, a NAL unit ends
+		// with its stop bit
+		size_t nalEnd = end;
+		while (nalEnd > begin && data[nalEnd - 1] == 0)
+			nalEnd--;
+		// the four byte form of this start code is kept with it
+		size_t unitStart = start > pos && data[start - 1] == 0 ? start - 1 : start;
+		nal = data + begin;
+		nalSize = nalEnd - begin;
+		unitSize = nalEnd - unitStart;
+		pos = nalEnd;
+		return true;
+	}
+
+	// index of the next 00 00 01 at or after from, size if there is none
+	static size_t FindStartCode(const uint8_t* data, size_t size, size_t from)
+	{
+		for (size_t i = from; i + 2 < size; i++)
+			if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1)
+				return i;
+		return size;
+	}
+};
+
+}
+}
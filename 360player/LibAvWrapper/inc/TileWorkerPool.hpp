@@ -0,0 +1,152 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Worker threads that run one task per tile and return once
+	every tile of the current frame has been processed.
+*/
+#pragma once
+
+//standard includes
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace IMT
+{
+	class TileWorkerPool
+	{
+	public:
+		typedef std::function<void(size_t)> Task;
+
+		typedef std::function<void(size_t)> Start;
+
+		//numThreads additional workers, the thread calling Run works on the tasks as well. Worker i calls start(i) first
+		TileWorkerPool(size_t numThreads, bool pinThreads, Start start = Start()) : m_start(start), m_job(nullptr), m_generation(0), m_busyWorkers(0), m_stopped(false)
+		{
+			for (size_t i = 0; i < numThreads; ++i)
+			{
+				m_workers.emplace_back(&TileWorkerPool::Worker, this, i);
+				if (pinThreads)
+					PinThread(m_workers.back(), (i + 1) % std::max(1u, std::thread::hardware_concurrency()));
+			}
+		}
+		TileWorkerPool(const TileWorkerPool&) = delete;
+		TileWorkerPool& operator=(const TileWorkerPool&) = delete;
+
+		~TileWorkerPool(void)
+		{
+			{
+				std::lock_guard<std::mutex> locker(m_mutex);
+				m_stopped = true;
+			}
+			m_cv.notify_all();
+			for (auto& w : m_workers)
+				if (w.joinable())
+					w.join();
+		}
+
+		//call task(i) for every i in [0, count) and wait until all calls returned
+		void Run(size_t count, const Task& task)
+		{
+			Job job(count, task);
+			{
+				std::lock_guard<std::mutex> locker(m_mutex);
+				m_job = &job;
+				++m_generation;
+			}
+			m_cv.notify_all();
+
+			Process(job);
+
+			std::unique_lock<std::mutex> locker(m_mutex);
+			m_cvDone.wait(locker, [&]() { return job.remaining == 0 && m_busyWorkers == 0; });
+			m_job = nullptr;
+		}
+
+		size_t GetNbThreads(void) const { return m_workers.size() + 1; }
+
+	private:
+		struct Job
+		{
+			Job(size_t count, const Task& task) : count(count), task(task), next(0), remaining(count) {}
+			const size_t count;
+			const Task& task;
+			std::atomic<size_t> next;
+			std::atomic<size_t> remaining;
+		};
+
+		Start m_start;
+		std::vector<std::thread> m_workers;
+		std::mutex m_mutex;
+		std::condition_variable m_cv;
+		std::condition_variable m_cvDone;
+		Job* m_job;
+		size_t m_generation;
+		size_t m_busyWorkers;
+		bool m_stopped;
+
+		void Process(Job& job)
+		{
+			size_t i;
+			while ((i = job.next++) < job.count)
+			{
+				job.task(i);
+				--job.remaining;
+			}
+		}
+
+		void Worker(size_t index)
+		{
+			if (m_start)
+				m_start(index);
+			size_t seenGeneration = 0;
+			while (true)
+			{
+				Job* job;
+				{
+					std::unique_lock<std::mutex> locker(m_mutex);
+					m_cv.wait(locker, [&]() { return m_stopped || (m_job != nullptr && m_generation != seenGeneration); });
+					if (m_stopped)
+						return;
+					seenGeneration = m_generation;
+					job = m_job;
+					++m_busyWorkers;
+				}
+
+				Process(*job);
+
+				{
+					std::lock_guard<std::mutex> locker(m_mutex);
+					--m_busyWorkers;
+				}
+				m_cvDone.notify_all();
+			}
+		}
+
+		static void PinThread(std::thread& thread, unsigned core)
+		{
+#ifdef _WIN32
+			SetThreadAffinityMask(thread.native_handle(), DWORD_PTR(1) << core);
+#else
+			cpu_set_t cpuset;
+			CPU_ZERO(&cpuset);
+			CPU_SET(core, &cpuset);
+			pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set_t), &cpuset);
+#endif
+		}
+	};
+}
@@ -15,6 +15,8 @@
 #include <memory>
 #include <chrono>
 #include <thread>
+#include <atomic>
+#include <mutex>
 
 extern "C"
 {
@@ -23,13 +25,20 @@ extern "C"
 #include <libavformat/avio.h>
 #include <libavutil/file.h>
 #include <libswscale/swscale.h>
+#include <libavutil/hwcontext.h>
 }
 #include <GL/glew.h>
 
 #include "Buffer.hpp"
+#include "FramePool.hpp"
+#include "TileWorkerPool.hpp"
+#include "PixelBufferRing.hpp"
+#include "TextureRing.hpp"
+#include "TileBitstreamMerger.hpp"
 #include "DisplayFrameInfo.hpp"
 #include "IOMemoryContext.hpp"
 #include "VideoTileStream.hpp"
+#include "TileVisibility.hpp"
 
 namespace IMT {
 namespace LibAv {
@@ -40,7 +49,7 @@ class AudioFrame;
 class VideoReader
 {
     public:
-        VideoReader(VideoTileStream* inputStreams, size_t numInputStreams, size_t bufferSize = 10, float startOffsetInSecond = 102);
+        VideoReader(VideoTileStream* inputStreams, size_t numInputStreams, size_t bufferSize = 10);
         VideoReader(const VideoReader&) = delete;
         VideoReader& operator=(const VideoReader&) = delete;
 
@@ -48,12 +57,49 @@ class VideoReader
 
         void Init(unsigned nbFrames);
 
-        //Update the current binded OpenGL Texture object with the content of the next picture (if right deadline)
+        //Upload the next picture into the next texture set of the ring (if right deadline)
         //return the current frame info
-        IMT::DisplayFrameInfo SetNextPictureToOpenGLTexture(std::chrono::system_clock::time_point deadline, GLuint textureIds[3]);
+        IMT::DisplayFrameInfo SetNextPictureToOpenGLTexture(std::chrono::system_clock::time_point deadline);
+
+        //Bind the luma and chroma array textures for drawing, GetTextureSet is the layer set of the last picture
+        void BindTextures(GLenum lumaUnit, GLenum chromaUnit) const {textures.Bind(lumaUnit, chromaUnit);}
+        int GetTextureSet(void) const {return textures.Current() < 0 ? 0 : textures.Current();}
+
+        //take the picture due at deadline without uploading it, for playback without OpenGL
+        IMT::DisplayFrameInfo ConsumeNextPicture(std::chrono::system_clock::time_point deadline);
+
+        //decoded frames and their timings since Init, the stalls are counted by the display thread
+        struct DecodeStats
+        {
+            size_t framesDecoded;
+            //wall time of decoding all tiles of the frames, early merges included
+            double decodeMs;
+            //summed time of the tile merges
+            double mergeMs;
+            //rebuffering: a tile stream had consumed everything it received
+            size_t stalls;
+            double stallingMs;
+            //the data was there but the decoder was late
+            size_t lateFrames;
+            double lateMs;
+            //decoded but neither merged nor uploaded because they would have been late, counted as dropped too
+            size_t skippedFrames;
+        };
+        DecodeStats GetStats(void) const;
 
         unsigned GetNbStream(void) const {return videoStreamIds.size();}
 
+        //Tiles outside of visibility are only decoded on keyframes, has to be set before Init
+        void SetTileVisibility(const TileVisibility* visibility) {tileVisibility = visibility;}
+
+        //continue with the init and first segment of another position per tile: the streams are restarted with them,
+        //the decoder reopens every tile and the frames decoded before are dropped instead of displayed
+        void Seek(const std::vector<std::string>& inits, std::vector<std::string>&& segments);
+
+        //share of its texture region every tile of the grid fills in the picture uploaded last, row by row
+        //[render thread]
+        const std::vector<float>& GetTileScales(void) const {return tileScales;}
+
     protected:
 
     private:
@@ -63,16 +109,103 @@ class VideoReader
         AVFormatContext** fmtCtx;
         std::vector<unsigned int> videoStreamIds;
         IMT::Buffer<VideoFrame> outputFrames;
+        IMT::FramePool<VideoFrame> framePool;
         unsigned nbFrames;
-        float startOffsetInSecond;
 		double frameDurationMs;
         std::thread decodingThread;
         size_t lastDisplayedPictureNumber;
         size_t videoStreamId;
 		std::chrono::system_clock::time_point currentTimestamp;
+		//the display clock is held back by every stall, rebuffering and late decoding together
 		std::chrono::duration<double, std::milli> stallingTime;
+		std::chrono::duration<double, std::milli> rebufferingTime;
+		std::chrono::duration<double, std::milli> lateTime;
+		size_t stalls;
+		size_t lateFrames;
+		bool stalled;
+		//the current stall is rebuffering
+		bool starved;
+		std::atomic<size_t> framesDecoded;
+		std::atomic<long long> decodeUs;
+		std::atomic<long long> mergeUs;
+		AVBufferRef* hwDeviceCtx;
+		AVHWDeviceType hwDeviceType;
+		AVPixelFormat hwPixFmt;
+		//per tile frames the hardware surfaces are downloaded into
+		std::vector<AVFrame*> hwTransferFrames;
+		IMT::TileWorkerPool* decoderPool;
+		//merge the rows of every tile right after it was decoded
+		bool mergeEarly;
+		//upload the decoded tiles into their sub-rectangle of the textures instead of merging them
+		bool directTileUpload;
+		//pts of every tile the sets of the ring hold
+		std::vector<std::vector<int64_t>> lastUploadedPts;
+		//each picture is uploaded into the set after the one the GPU may still sample from
+		static const size_t kTextureSets = 3;
+		IMT::TextureRing textures;
+		std::vector<float> tileScales;
+		//merge frames into persistently mapped pixel buffers and upload them asynchronously
+		bool pboUpload;
+		IMT::PixelBufferRing pixelBuffers;
+		//viewport tiles written by the render thread, nullptr decodes every tile
+		const TileVisibility* tileVisibility;
+		std::vector<char> tileFastPath;
+		//incremented by every seek, frames of an older one are dropped. Seek restarts the streams under seekMtx
+		std::atomic<size_t> seekEpoch;
+		std::mutex seekMtx;
+		//[decoder thread] the seek the tiles were opened for
+		size_t decoderEpoch;
+		//display offset of the last frame taken, frames decoded after a seek follow it
+		std::atomic<double> displayedMs;
+		//display clock minus the steady clock in ms at the last TakeDueFrame, the decoder projects from it when its
+		//frame will be ready. Not running before the first picture was asked for
+		std::atomic<double> clockOffsetMs;
+		std::atomic<bool> clockRunning;
+		//skip the merge of frames that would be late, see frameSkipping of the config
+		bool frameSkipping;
+		//at least every that many frames one is merged and shown
+		static const size_t kMaxSkippedInRow = 4;
+		std::atomic<size_t> skippedFrames;
+		//[getter thread] skipped frames already reported as dropped
+		size_t reportedSkips;
+		//[decoder thread] the loop filter of non-reference frames is skipped while decoding can not keep up
+		bool degradedDecode;
+		//the tiles are the motion constrained tiles of one HEVC picture: the tile streams are only demuxed, their
+		//packets of a frame are merged into one access unit and mergedCodecCtx decodes the whole picture
+		bool mergedDecode;
+		AVCodecContext* mergedCodecCtx;
+		TileBitstreamMerger merger;
+		//streams in the order of their tiles in the picture
+		std::vector<size_t> tileOrder;
+
+        enum TileResult { TileDecoded, TileReused, TileEnded };
 
         void RunDecoderThread(void);
+        //format context of one tile over its stream and its decoder if openDecoder, false if it has no video stream
+        bool OpenTile(size_t tile, bool openDecoder);
+        void OpenTileDecoder(size_t tile);
+        //the streams carry HEVC slices of one picture with the same parameter sets, see mergedDecode
+        bool TilesFormOnePicture(void) const;
+        bool OpenMergedDecoder(size_t threads);
+        void CloseTile(size_t tile);
+        //[decoder thread] reopen every tile at the position of the last seek
+        void ReopenTiles(void);
+        //first frame of the ring decoded after the last seek, older ones are popped [getter thread]
+        std::shared_ptr<VideoFrame> GetCurrentFrame(void);
+        //pop every frame due at deadline and return the newest of them, nullptr if none is due
+        std::shared_ptr<VideoFrame> TakeDueFrame(std::chrono::system_clock::time_point deadline, std::chrono::system_clock::time_point& pts, size_t& nbUsed);
+        void InitHwDecoder(AVCodecContext* codecCtx, AVCodec* decoder);
+        static AVPixelFormat GetHwFormat(AVCodecContext* codecCtx, const AVPixelFormat* formats);
+        //decode the next picture of one tile, skipped tiles keep their last picture
+        TileResult DecodeNextTileFrame(size_t tile, VideoFrame& tileFrame, double frameOffset);
+        //merge the next packet of every tile and decode the picture they form [decoder thread]
+        TileResult DecodeNextMergedFrame(VideoFrame& picture, double frameOffset);
+        //[decoder thread] switch the loop filter of non-reference frames of every tile off or back on
+        void SetDegradedDecode(bool degraded);
+        //[getter thread] frames skipped by the decoder since the last call
+        size_t TakeSkippedFrames(void);
+        void UploadTiles(const VideoFrame& frame);
+        void UploadPixelBuffer(const VideoFrame& frame);
 };
 }
 }
@@ -23,13 +23,15 @@ extern "C"
 
 #include <iostream>
 #include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include "Log.hpp"
+#include "Trace.hpp"
+#include "DecodeCostModel.hpp"
+#include "SessionLog.hpp"
+#include "ThreadTopology.hpp"
 
-#define DEBUG_VideoReader 0
-#if DEBUG_VideoReader
-#define PRINT_DEBUG_VideoReader(s) std::cout <<"DEC -- " << s << std::endl
-#else
-#define PRINT_DEBUG_VideoReader(s) {}
-#endif // DEBUG_VideoReader
+#define PRINT_DEBUG_VideoReader(s) LOG_DEBUG("DEC -- " << s)
 
 extern "C"
 {
@@ -41,11 +43,18 @@ constexpr size_t SDL_AUDIO_BUFFER_SIZE = 1024;
 
 using namespace IMT::LibAv;
 
-VideoReader::VideoReader(VideoTileStream* inputStreams, size_t numInputStreams, size_t bufferSize, float startOffsetInSecond)
+VideoReader::VideoReader(VideoTileStream* inputStreams, size_t numInputStreams, size_t bufferSize)
 	: inputStreams(inputStreams), numInputStreams(numInputStreams), fmtCtx(nullptr), videoStreamIds(), outputFrames(bufferSize)
-	, nbFrames(0), startOffsetInSecond(startOffsetInSecond)
+	// frames in the buffer, one being displayed and one being merged
+	, framePool(bufferSize + 3)
+	, nbFrames(0)
 	, decodingThread(), lastDisplayedPictureNumber(-1), stallingTime(std::chrono::milliseconds(0))
-	, videoStreamId(-1)
+	, rebufferingTime(std::chrono::milliseconds(0)), lateTime(std::chrono::milliseconds(0)), stalls(0), lateFrames(0), stalled(false)
+	, starved(false)
+	, framesDecoded(0), decodeUs(0), mergeUs(0)
+	, videoStreamId(-1), hwDeviceCtx(nullptr), hwDeviceType(AV_HWDEVICE_TYPE_NONE), hwPixFmt(AV_PIX_FMT_NONE), decoderPool(nullptr), mergeEarly(false), directTileUpload(false), pboUpload(false), tileVisibility(nullptr)
+	, seekEpoch(0), decoderEpoch(0), displayedMs(0), clockOffsetMs(0), clockRunning(false), frameSkipping(false), skippedFrames(0)
+	, reportedSkips(0), degradedDecode(false), mergedDecode(false), mergedCodecCtx(nullptr)
 {
 }
 
@@ -54,11 +63,19 @@ VideoReader::~VideoReader()
 	SDL_PauseAudio(1);
 	if (decodingThread.joinable())
 	{
-		std::cout << "Join decoding thread\n";
+		LOG_INFO("Join decoding thread");
 		outputFrames.Stop();
+		framePool.Stop();
 		decodingThread.join();
-		std::cout << "Join decoding thread: done\n";
+		LOG_INFO("Join decoding thread: done");
 	}
+	delete decoderPool;
+	if (mergedCodecCtx != nullptr)
+		avcodec_free_context(&mergedCodecCtx);
+	for (auto& f : hwTransferFrames)
+		av_frame_free(&f);
+	if (hwDeviceCtx != nullptr)
+		av_buffer_unref(&hwDeviceCtx);
 	if (fmtCtx != nullptr)
 	{
 		for (int i = 0; i < numInputStreams; i++)
@@ -100,149 +117,418 @@ void VideoReader::Init(unsigned nbFrames)
 	PRINT_DEBUG_VideoReader("Register codecs");
 	av_register_all();
 
-	int ret = 0;
+	auto config = Config::instance();
+	mergeEarly = config->mergeEarly;
+	frameSkipping = config->frameSkipping;
+
+	// opt-in hardware decoding, one device is shared by all tile decoders
+	if (!config->hwaccel.empty() && config->hwaccel != "none")
+	{
+		hwDeviceType = av_hwdevice_find_type_by_name(config->hwaccel.c_str());
+		if (hwDeviceType == AV_HWDEVICE_TYPE_NONE || av_hwdevice_ctx_create(&hwDeviceCtx, hwDeviceType, nullptr, nullptr, 0) < 0)
+		{
+			LOG_WARNING("Could not create hwaccel device " << config->hwaccel << ", using software decoding");
+			hwDeviceCtx = nullptr;
+		}
+		else
+		{
+			for (int i = 0; i < numInputStreams; i++)
+				hwTransferFrames.push_back(av_frame_alloc());
+		}
+	}
+
+	// the demo colouring is drawn into the merged image, hardware frames arrive as NV12
+	directTileUpload = config->directTileUpload && !config->demo && hwDeviceCtx == nullptr;
+	tileFastPath.assign(numInputStreams, 1);
+	pboUpload = config->pboUpload;
 
 	ioCtx = new IOMemoryContext*[numInputStreams];
 
 	fmtCtx = new AVFormatContext*[numInputStreams];
 
+	// the inputs are probed before any decoder is opened, the tiles of one tiled picture get a single decoder
 	for (int i = 0; i < numInputStreams; i++)
+		if (OpenTile(i, false))
+			videoStreamIds.push_back(i);
+
+	// libav starts the threads of a codec when it is opened, they are decoder threads wherever Init is called
+	ThreadTopology::Scope decoderScope("decoder");
+	size_t decoderThreads = config->decoderThreads > 0 ? config->decoderThreads : std::thread::hardware_concurrency();
+	if (TilesFormOnePicture())
+	{
+		// the decoder threads internally, the pool only reopens the tiles after a seek
+		decoderPool = new IMT::TileWorkerPool(0, false);
+		mergedDecode = OpenMergedDecoder(std::max<size_t>(1, decoderThreads));
+	}
+	if (!mergedDecode)
 	{
-		ioCtx[i] = new IOMemoryContext(inputStreams + i);
+		decoderThreads = std::max<size_t>(1, std::min(decoderThreads, numInputStreams));
+		delete decoderPool;
+		decoderPool = new IMT::TileWorkerPool(decoderThreads - 1, false, [](size_t i) { ThreadTopology::apply("decoderWorkers", int(i)); });
+		for (auto i : videoStreamIds)
+			OpenTileDecoder(i);
+	}
 
-		PRINT_DEBUG_VideoReader("Allocate format context");
-		if (!(fmtCtx[i] = avformat_alloc_context())) {
-			ret = AVERROR(ENOMEM);
-			std::cout << "Error while allocating the format context" << std::endl;
-		}
+	outputFrames.SetTotal(nbFrames);
+	PRINT_DEBUG_VideoReader("Nb frames = " << nbFrames);
 
-		fmtCtx[i]->pb = ioCtx[i]->getAvioContext();
+	frameDurationMs = 1000.0 / (double(fmtCtx[0]->streams[videoStreamId]->r_frame_rate.num) / fmtCtx[0]->streams[videoStreamId]->r_frame_rate.den);
+	// the merged decoder reports the wall time of whole pictures, its threads are in it already
+	DecodeCostModel::instance().setCapacity(frameDurationMs, mergedDecode ? 1 : decoderPool->GetNbThreads());
 
-		ret = avformat_open_input(&fmtCtx[i], "", nullptr, nullptr);
-		if (ret < 0) {
-			std::cout << "Could not open input" << std::endl;
-		}
+	PRINT_DEBUG_VideoReader("Start decoding thread");
+	decodingThread = std::thread(&VideoReader::RunDecoderThread, this);
+}
 
-		//if (i > 0)
-		//	m_fmt_ctx[i]->iformat = m_fmt_ctx[0]->iformat;
-		//else
-		//{
-		PRINT_DEBUG_VideoReader("Find streams info");
-		ret = avformat_find_stream_info(fmtCtx[i], nullptr);
-		if (ret < 0) {
-			std::cout << "Could not find stream information" << std::endl;
-		}
-		//}
+bool VideoReader::OpenTile(size_t i, bool openDecoder)
+{
+	ioCtx[i] = new IOMemoryContext(inputStreams + i);
+
+	PRINT_DEBUG_VideoReader("Allocate format context");
+	if (!(fmtCtx[i] = avformat_alloc_context())) {
+		LOG_WARNING("Error while allocating the format context");
+		return false;
+	}
+
+	fmtCtx[i]->pb = ioCtx[i]->getAvioContext();
+
+	// a failed open frees the context
+	if (avformat_open_input(&fmtCtx[i], "", nullptr, nullptr) < 0) {
+		LOG_WARNING("Could not open input");
+		return false;
+	}
 
-		//PRINT_DEBUG_VideoReader("Dump format context");
-		//av_dump_format(m_fmt_ctx, 0, m_inputPath.c_str(), 0);
-		//printA(m_fmt_ctx[i]);
+	PRINT_DEBUG_VideoReader("Find streams info");
+	if (avformat_find_stream_info(fmtCtx[i], nullptr) < 0) {
+		LOG_WARNING("Could not find stream information");
+	}
+
+	if (fmtCtx[i]->nb_streams > 2)
+	{
+		throw(std::invalid_argument("Support only video with one video stream and one audio stream"));
+	}
 
-		PRINT_DEBUG_VideoReader("Init video stream decoders");
-		if (fmtCtx[i]->nb_streams > 2)
+	bool video = false;
+	for (unsigned j = 0; j < fmtCtx[i]->nb_streams; ++j)
+	{
+		if (fmtCtx[i]->streams[j]->codec->codec_type == AVMEDIA_TYPE_VIDEO)
 		{
-			throw(std::invalid_argument("Support only video with one video stream and one audio stream"));
+			videoStreamId = j;
+			video = true;
 		}
+	}
+	if (video && openDecoder)
+		OpenTileDecoder(i);
+	return video;
+}
 
-		AVDictionary *opts_multithread = NULL;
-		av_dict_set(&opts_multithread, "threads", "2", 0);
+void VideoReader::OpenTileDecoder(size_t i)
+{
+	PRINT_DEBUG_VideoReader("Init video stream decoders");
+	// tiles are already decoded in parallel, frame threads inside a codec would only add latency
+	int threads = Config::instance()->tileDecoderThreads > 0 ? Config::instance()->tileDecoderThreads : decoderPool->GetNbThreads() > 1 ? 1 : 2;
+	AVDictionary *opts_multithread = NULL;
+	av_dict_set(&opts_multithread, "threads", std::to_string(threads).c_str(), 0);
+
+	auto* codecCtx = fmtCtx[i]->streams[videoStreamId]->codec;
+	codecCtx->refcounted_frames = 1;
+	auto* decoder = avcodec_find_decoder(codecCtx->codec_id);
+	if (!decoder)
+	{
+		LOG_WARNING("Could not find the decoder for stream id " << videoStreamId);
+	}
+	if (hwDeviceCtx != nullptr && decoder)
+		InitHwDecoder(codecCtx, decoder);
+	PRINT_DEBUG_VideoReader("Init decoder for stream id " << videoStreamId);
+	if (avcodec_open2(codecCtx, decoder, &opts_multithread) < 0)
+	{
+		LOG_WARNING("Could not open the decoder for stream id " << videoStreamId);
+	}
+	av_dict_free(&opts_multithread);
+}
 
-		for (unsigned j = 0; j < fmtCtx[i]->nb_streams; ++j)
+bool VideoReader::TilesFormOnePicture(void) const
+{
+	if (numInputStreams < 2 || videoStreamIds.size() != numInputStreams)
+		return false;
+
+	// an independently coded tile has the size of its region, a motion constrained one the size of the picture
+	const DASH::SRD& srd = inputStreams->getSRD();
+	const auto* first = fmtCtx[0]->streams[videoStreamId]->codecpar;
+	if (first->codec_id != AV_CODEC_ID_HEVC || first->width != srd.w * srd.th || first->height != srd.h * srd.tv)
+		return false;
+	for (size_t i = 1; i < numInputStreams; i++)
+	{
+		const auto* par = fmtCtx[i]->streams[videoStreamId]->codecpar;
+		if (par->codec_id != first->codec_id || par->width != first->width || par->height != first->height
+			|| par->extradata_size != first->extradata_size || memcmp(par->extradata, first->extradata, first->extradata_size) != 0)
 		{
-			if (fmtCtx[i]->streams[j]->codec->codec_type == AVMEDIA_TYPE_VIDEO)
-			{
-				videoStreamId = j;
-				fmtCtx[i]->streams[j]->codec->refcounted_frames = 1;
-				//m_outputFrames.emplace_back();
-				//m_streamIdToVecId[i] = m_videoStreamIds.size();
-				videoStreamIds.push_back(i);
-				auto* decoder = avcodec_find_decoder(fmtCtx[i]->streams[j]->codec->codec_id);
-				if (!decoder)
-				{
-					std::cout << "Could not find the decoder for stream id " << j << std::endl;
-				}
-				PRINT_DEBUG_VideoReader("Init decoder for stream id " << j);
-				if ((ret = avcodec_open2(fmtCtx[i]->streams[j]->codec, decoder, &opts_multithread)) < 0)
-				{
-					std::cout << "Could not open the decoder for stream id " << j << std::endl;
-				}
-			}
+			LOG_WARNING("Tile " << i << " is part of a tiled picture but its parameter sets differ, decoding every tile on its own");
+			return false;
 		}
 	}
+	return true;
+}
 
-	outputFrames.SetTotal(nbFrames);
-	PRINT_DEBUG_VideoReader("Nb frames = " << nbFrames);
+bool VideoReader::OpenMergedDecoder(size_t threads)
+{
+	const auto* par = fmtCtx[0]->streams[videoStreamId]->codecpar;
+	auto* decoder = avcodec_find_decoder(par->codec_id);
+	mergedCodecCtx = decoder ? avcodec_alloc_context3(decoder) : nullptr;
+	if (mergedCodecCtx == nullptr || avcodec_parameters_to_context(mergedCodecCtx, par) < 0)
+	{
+		LOG_WARNING("Could not create the decoder of the merged tiles");
+		avcodec_free_context(&mergedCodecCtx);
+		return false;
+	}
+	mergedCodecCtx->refcounted_frames = 1;
+	if (hwDeviceCtx != nullptr)
+		InitHwDecoder(mergedCodecCtx, decoder);
+
+	AVDictionary *opts_multithread = NULL;
+	av_dict_set(&opts_multithread, "threads", std::to_string(threads).c_str(), 0);
+	int ret = avcodec_open2(mergedCodecCtx, decoder, &opts_multithread);
+	av_dict_free(&opts_multithread);
+	if (ret < 0)
+	{
+		LOG_WARNING("Could not open the decoder of the merged tiles");
+		avcodec_free_context(&mergedCodecCtx);
+		return false;
+	}
 
-	frameDurationMs = 1000.0 / (double(fmtCtx[0]->streams[videoStreamId]->r_frame_rate.num) / fmtCtx[0]->streams[videoStreamId]->r_frame_rate.den);
+	merger = TileBitstreamMerger(TileBitstreamMerger::LengthSize(par->extradata, par->extradata_size));
+	// the tiles of a uniform grid are coded row by row
+	tileOrder.resize(numInputStreams);
+	for (size_t i = 0; i < numInputStreams; i++)
+		tileOrder[i] = i;
+	std::sort(tileOrder.begin(), tileOrder.end(), [&](size_t a, size_t b)
+	{
+		const auto& sa = inputStreams[a].getSRD();
+		const auto& sb = inputStreams[b].getSRD();
+		return sa.y != sb.y ? sa.y < sb.y : sa.x < sb.x;
+	});
+	LOG_INFO("The " << numInputStreams << " tiles form one HEVC picture, decoding them merged with " << threads << " threads");
+	return true;
+}
 
-	PRINT_DEBUG_VideoReader("Start decoding thread");
-	decodingThread = std::thread(&VideoReader::RunDecoderThread, this);
+void VideoReader::CloseTile(size_t i)
+{
+	if (fmtCtx[i] != nullptr)
+	{
+		for (unsigned j = 0; j < fmtCtx[i]->nb_streams; ++j)
+			avcodec_close(fmtCtx[i]->streams[j]->codec);
+		// the custom I/O context is not closed with the input
+		avformat_close_input(&fmtCtx[i]);
+	}
+	delete ioCtx[i];
+	ioCtx[i] = nullptr;
+}
+
+void VideoReader::Seek(const std::vector<std::string>& inits, std::vector<std::string>&& segments)
+{
+	// the decoder reads the epoch under the lock, so it never reopens a tile before its stream was restarted
+	std::lock_guard<std::mutex> l(seekMtx);
+	++seekEpoch;
+	for (size_t i = 0; i < numInputStreams && i < segments.size(); i++)
+		inputStreams[i].restart(inits[i], std::move(segments[i]));
+}
+
+void VideoReader::ReopenTiles(void)
+{
+	TRACE_SPAN("seek");
+	{
+		std::lock_guard<std::mutex> l(seekMtx);
+		decoderEpoch = seekEpoch;
+	}
+	decoderPool->Run(numInputStreams, [&](size_t i)
+	{
+		CloseTile(i);
+		inputStreams[i].resume();
+		OpenTile(i, !mergedDecode);
+		tileFastPath[i] = 1;
+	});
+	// the merged pictures start over with the keyframes of the new position
+	if (mergedCodecCtx != nullptr)
+		avcodec_flush_buffers(mergedCodecCtx);
+}
+
+std::shared_ptr<VideoFrame> VideoReader::GetCurrentFrame(void)
+{
+	auto frame = outputFrames.Get();
+	while (frame != nullptr && frame->GetSeekEpoch() != seekEpoch)
+	{
+		outputFrames.Pop();
+		frame = outputFrames.Get();
+	}
+	return frame;
 }
 
 void VideoReader::RunDecoderThread(void)
 {
-	AVPacket pkt;
+	Trace::nameThread("decoder");
+	ThreadTopology::apply("decoder");
 	VideoFrame* tileFrames = new VideoFrame[numInputStreams];
+	VideoFrame* lastTileFrames = new VideoFrame[numInputStreams];
 
-	int ret = -1;
+	// the streams start with the segment the player chose, positions elsewhere are reached with Seek
 	PRINT_DEBUG_VideoReader("Read next pkt");
-	std::cout << "[DEBUG] start offset: " << startOffsetInSecond << std::endl;
-	std::chrono::milliseconds m_timeOffset(long(startOffsetInSecond * 1000));
-	int64_t seekTimeBasedUnit = startOffsetInSecond * double(fmtCtx[0]->streams[videoStreamId]->time_base.num) / fmtCtx[0]->streams[videoStreamId]->time_base.den;
-	seekTimeBasedUnit = 0;
-
-	for (int i = 0; i < numInputStreams; i++)
-		av_seek_frame(fmtCtx[i], videoStreamId, seekTimeBasedUnit, 0);
-
 	double frameOffset = 0.0;
 	int framenum = 1;
+	// wall time of decoding and merging one frame, smoothed
+	double frameCostMs = 0.0;
+	size_t skippedInRow = 0;
 
 	AVFrame* testFrame = av_frame_alloc();
 
+	std::vector<char> tileHasFrame(numInputStreams);
+
 	while (true)
 	{
-		for (int i = 0; i < numInputStreams; i++)
+		if (decoderEpoch != seekEpoch)
 		{
-			bool hasFrame = false;
-			while ((ret = av_read_frame(fmtCtx[i], &pkt)) >= 0)
-			{
-				unsigned streamId = pkt.stream_index;
-				if (streamId == videoStreamId)
-				{
-					auto* codecCtx = fmtCtx[i]->streams[streamId]->codec;
-					ret = avcodec_send_packet(codecCtx, &pkt);
+			ReopenTiles();
+			// the frames of the new position follow the last one displayed, the dropped ones are skipped
+			frameOffset = displayedMs + frameDurationMs;
+			// the new codec contexts decode fully until told otherwise
+			if (degradedDecode)
+				SetDegradedDecode(true);
+		}
 
-					if (ret == 0)
-					{
-						ret = tileFrames[i].AvCodecReceiveFrame(codecCtx);
-						tileFrames[i].SetFrameOffset(frameOffset);
-
-						if (ret == 0)
-						{
-							hasFrame = true;
-							break;
-						}
-					}
-				}
-				av_packet_unref(&pkt);
+		auto frame = framePool.Acquire();
+		if (frame == nullptr)
+		{
+			LOG_INFO("Decoding thread stopped: frame pool stopped");
+			delete[] tileFrames;
+			delete[] lastTileFrames;
+			return;
+		}
+		frame->SetFrameOffset(frameOffset);
+		frame->SetSeekEpoch(decoderEpoch);
+
+		// a frame that is only ready once its successor is due is decoded for the frames referencing it, but
+		// neither merged nor uploaded. Every few frames one is shown anyway, so a slow machine drops frames instead
+		// of stalling on every one
+		bool skip = false;
+		if (frameSkipping && clockRunning && skippedInRow < kMaxSkippedInRow)
+		{
+			double readyMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count()
+				+ clockOffsetMs + frameCostMs;
+			skip = frameOffset + frameDurationMs < readyMs;
+		}
+		skippedInRow = skip ? skippedInRow + 1 : 0;
+
+		// merge into a mapped pixel buffer once the render thread created them
+		pixelBuffers.DropSlot(frame->GetPboSlot(), frame.get());
+		int pboSlot = pboUpload && !skip ? pixelBuffers.AcquireSlot(frame.get()) : -1;
+		bool direct = directTileUpload && !mergedDecode && pboSlot < 0 && !skip;
+		if (pboSlot >= 0)
+			frame->prepareMerge(inputStreams, pixelBuffers.GetSlotData(pboSlot), pboSlot);
+		else if (direct)
+			frame->prepareTiles(inputStreams, numInputStreams);
+		else if (!skip && !mergedDecode)
+			frame->prepareMerge(inputStreams);
+
+		// one task per tile, each tile has its own format and codec context
+		auto decodeStart = std::chrono::steady_clock::now();
+		Trace::Span decodeSpan("decode");
+		if (mergedDecode)
+		{
+			auto result = DecodeNextMergedFrame(tileFrames[0], frameOffset);
+			std::fill(tileHasFrame.begin(), tileHasFrame.end(), result != TileEnded);
+		}
+		else decoderPool->Run(numInputStreams, [&](size_t i)
+		{
+			// for direct upload the tile is decoded straight into the pooled frame
+			auto& tileFrame = direct ? frame->GetTile(i) : tileFrames[i];
+			auto result = DecodeNextTileFrame(i, tileFrame, frameOffset);
+			tileHasFrame[i] = result != TileEnded;
+			// skipped tiles keep their last picture, pooled frames need a reference to it
+			if ((direct || (skip && directTileUpload)) && tileVisibility != nullptr)
+			{
+				if (result == TileReused && direct)
+					tileFrame.ReferenceFrom(lastTileFrames[i]);
+				else if (result == TileDecoded)
+					lastTileFrames[i].ReferenceFrom(tileFrame);
+			}
+			if (!direct && !skip && mergeEarly && tileHasFrame[i])
+			{
+				auto mergeStart = std::chrono::steady_clock::now();
+				frame->mergeTile(tileFrame, inputStreams[i]);
+				mergeUs += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - mergeStart).count();
 			}
-			if (!hasFrame)
+		});
+		decodeSpan.end();
+		decodeUs += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - decodeStart).count();
+
+		// the streams of a seek end the old position for the demuxers
+		if (decoderEpoch != seekEpoch)
+			continue;
+		for (int i = 0; i < numInputStreams; i++)
+		{
+			if (!tileHasFrame[i])
 			{
-				std::cout << "Decoding thread stopped: video done" << std::endl;
+				LOG_INFO("Decoding thread stopped: video done");
 				outputFrames.SetTotal(0);
 				delete[] tileFrames;
+				delete[] lastTileFrames;
 				return;
 			}
 		}
 
-		auto frame = std::make_shared<VideoFrame>();
-		frame->SetFrameOffset(frameOffset);
 		frameOffset += frameDurationMs;
-		frame->mergeTilesToFrame(tileFrames, inputStreams, numInputStreams);
+		framesDecoded++;
+		if (skip)
+		{
+			skippedFrames++;
+			continue;
+		}
+		if (mergedDecode)
+		{
+			// the decoded picture is shown as it is, unless it goes into a pixel buffer, comes from a hardware
+			// surface or the demo colours it
+			auto& picture = tileFrames[0];
+			if (pboSlot < 0 && !Config::instance()->demo && picture.GetFormat() == AV_PIX_FMT_YUV420P)
+			{
+				frame->preparePicture(inputStreams, picture);
+			}
+			else
+			{
+				TRACE_SPAN("merge");
+				auto mergeStart = std::chrono::steady_clock::now();
+				if (pboSlot < 0)
+					frame->prepareMerge(inputStreams);
+				if (Config::instance()->demo)
+					for (int i = 0; i < numInputStreams; i++)
+						frame->mergeTile(picture, inputStreams[i]);
+				else
+					frame->mergePicture(picture);
+				mergeUs += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - mergeStart).count();
+			}
+		}
+		else if (!direct && !mergeEarly)
+		{
+			TRACE_SPAN("merge");
+			auto mergeStart = std::chrono::steady_clock::now();
+			for (int i = 0; i < numInputStreams; i++)
+				frame->mergeTile(tileFrames[i], inputStreams[i]);
+			mergeUs += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - mergeStart).count();
+		}
+		frame->finishMerge();
+
+		// the loop filter of non-reference frames is skipped while a frame takes nearly its display time, until it
+		// takes well below again. Nothing references these frames, the error does not spread
+		double costMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - decodeStart).count();
+		frameCostMs += (frameCostMs == 0.0 ? 1.0 : 0.1) * (costMs - frameCostMs);
+		if (frameSkipping && degradedDecode != (frameCostMs > (degradedDecode ? 0.6 : 0.9) * frameDurationMs))
+			SetDegradedDecode(!degradedDecode);
+
+		if (pboSlot >= 0)
+			pixelBuffers.SetSlotReady(pboSlot);
 		if (!outputFrames.Add(std::move(frame)))
 		{
-			std::cout << "Decoding thread stopped: frame limit exceeded" << std::endl;
+			LOG_INFO("Decoding thread stopped: frame limit exceeded");
 			delete[] tileFrames;
+			delete[] lastTileFrames;
 			return;
 		}
 		else
@@ -252,83 +538,386 @@ void VideoReader::RunDecoderThread(void)
 	}
 }
 
-IMT::DisplayFrameInfo VideoReader::SetNextPictureToOpenGLTexture(std::chrono::system_clock::time_point deadline, GLuint textureIds[3])
+void VideoReader::SetDegradedDecode(bool degraded)
 {
-	static bool first = true;
-	bool last = false;
-	auto pts = std::chrono::system_clock::time_point(std::chrono::seconds(-1));
-	size_t nbUsed = 0;
-	deadline = deadline - std::chrono::duration_cast<std::chrono::system_clock::duration>(stallingTime);
-	if (!outputFrames.IsAllDones())
+	degradedDecode = degraded;
+	for (size_t i = 0; i < numInputStreams; i++)
+		if (fmtCtx[i] != nullptr)
+			fmtCtx[i]->streams[videoStreamId]->codec->skip_loop_filter = degraded ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+	if (mergedCodecCtx != nullptr)
+		mergedCodecCtx->skip_loop_filter = degraded ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+	LOG_INFO((degraded ? "Decoding falls behind, loop filter of non-reference frames off" : "Decoding caught up, loop filter on"));
+}
+
+size_t VideoReader::TakeSkippedFrames(void)
+{
+	size_t skipped = skippedFrames;
+	size_t taken = skipped - reportedSkips;
+	reportedSkips = skipped;
+	return taken;
+}
+
+void VideoReader::InitHwDecoder(AVCodecContext* codecCtx, AVCodec* decoder)
+{
+	hwPixFmt = AV_PIX_FMT_NONE;
+	const AVCodecHWConfig* hwConfig;
+	for (int c = 0; (hwConfig = avcodec_get_hw_config(decoder, c)) != nullptr; c++)
 	{
-		PRINT_DEBUG_VideoReader("Update video picture");
-		std::shared_ptr<VideoFrame> frame(nullptr);
-		bool done = false;
-		auto tmp_frame = outputFrames.Get();
-		auto frameDuration = std::chrono::milliseconds((long)frameDurationMs);
-		if (tmp_frame == nullptr && deadline >= currentTimestamp + frameDuration) // Stalling
+		if ((hwConfig->methods & AV_CODEC_HW_CONFIG_METHOD_HW_DEVICE_CTX) && hwConfig->device_type == hwDeviceType)
 		{
-			stallingTime += deadline - (currentTimestamp + frameDuration);
+			hwPixFmt = hwConfig->pix_fmt;
+			break;
 		}
+	}
+
+	if (hwPixFmt == AV_PIX_FMT_NONE)
+	{
+		LOG_WARNING("Decoder " << decoder->name << " does not support the hwaccel device, using software decoding");
+		return;
+	}
+
+	codecCtx->hw_device_ctx = av_buffer_ref(hwDeviceCtx);
+	codecCtx->opaque = this;
+	codecCtx->get_format = &VideoReader::GetHwFormat;
+}
 
-		while (!done)
+AVPixelFormat VideoReader::GetHwFormat(AVCodecContext* codecCtx, const AVPixelFormat* formats)
+{
+	auto* reader = static_cast<VideoReader*>(codecCtx->opaque);
+	for (auto* f = formats; *f != AV_PIX_FMT_NONE; f++)
+		if (*f == reader->hwPixFmt)
+			return *f;
+
+	LOG_WARNING("Hardware surface format not offered, using software decoding");
+	return avcodec_default_get_format(codecCtx, formats);
+}
+
+VideoReader::TileResult VideoReader::DecodeNextTileFrame(size_t tile, VideoFrame& tileFrame, double frameOffset)
+{
+	// a tile that could not be reopened after a seek
+	if (fmtCtx[tile] == nullptr)
+		return TileEnded;
+	AVPacket pkt;
+	int ret;
+	while ((ret = av_read_frame(fmtCtx[tile], &pkt)) >= 0)
+	{
+		unsigned streamId = pkt.stream_index;
+		if (streamId == videoStreamId)
 		{
-			tmp_frame = outputFrames.Get();
+			auto* codecCtx = fmtCtx[tile]->streams[streamId]->codec;
+
+			// tiles only switch between fast and slow path on keyframes, inter frames need their references
+			bool key = (pkt.flags & AV_PKT_FLAG_KEY) != 0;
+			if (key && tileVisibility != nullptr)
+				tileFastPath[tile] = tileVisibility->isVisible(tile);
+			if (!key && !tileFastPath[tile])
+			{
+				av_packet_unref(&pkt);
+				tileFrame.SetFrameOffset(frameOffset);
+				return TileReused;
+			}
+
+			auto decodeStart = std::chrono::steady_clock::now();
+			ret = avcodec_send_packet(codecCtx, &pkt);
+			// a keyframe of a slow tile is decoded on its own, drain the decoder instead of waiting for the next packets
+			if (ret == 0 && !tileFastPath[tile])
+				avcodec_send_packet(codecCtx, nullptr);
 
-			if (tmp_frame != nullptr)
+			if (ret == 0)
 			{
-				currentTimestamp = tmp_frame->GetDisplayTimestamp();
+				ret = tileFrame.AvCodecReceiveFrame(codecCtx);
+				tileFrame.SetFrameOffset(frameOffset);
+				if (!tileFastPath[tile])
+					avcodec_flush_buffers(codecCtx);
 
-				if (deadline >= currentTimestamp)
+				// the surface is copied to system memory for the merge
+				if (ret == 0 && hwDeviceCtx != nullptr && tileFrame.GetFormat() == hwPixFmt)
 				{
-					PRINT_DEBUG_VideoReader("Updated frame");
-					pts = currentTimestamp;
-					frame = std::move(tmp_frame);
-					outputFrames.Pop();
-					++lastDisplayedPictureNumber;
-					++nbUsed;
+					ret = tileFrame.TransferFromHardware(hwTransferFrames[tile]);
+					if (ret < 0)
+						LOG_WARNING("Could not download hardware frame of tile " << tile);
 				}
-				else
+
+				if (ret == 0)
+				{
+					// drained keyframes of slow tiles cost more than the frames of a running decoder
+					if (tileFastPath[tile])
+					{
+						double pixels = double(codecCtx->width) * codecCtx->height;
+						DecodeCostModel::instance().add(pixels, pkt.size, SessionLog::instance().decode(pixels, pkt.size,
+							std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - decodeStart).count()));
+					}
+					av_packet_unref(&pkt);
+					return TileDecoded;
+				}
+			}
+		}
+		av_packet_unref(&pkt);
+	}
+	return TileEnded;
+}
+
+VideoReader::TileResult VideoReader::DecodeNextMergedFrame(VideoFrame& picture, double frameOffset)
+{
+	AVPacket pkt;
+	while (true)
+	{
+		// the next packet of every tile, in the order of the tiles in the picture
+		merger.Begin();
+		AVPacket merged;
+		av_init_packet(&merged);
+		merged.flags = AV_PKT_FLAG_KEY;
+		bool fits = true;
+		for (size_t k = 0; k < tileOrder.size(); k++)
+		{
+			size_t tile = tileOrder[k];
+			bool read = false;
+			while (fmtCtx[tile] != nullptr && !read && av_read_frame(fmtCtx[tile], &pkt) >= 0)
+			{
+				read = pkt.stream_index == videoStreamId;
+				if (read)
 				{
-					done = true;
+					fits = merger.Add(pkt.data, pkt.size) && fits;
+					// the picture is a keyframe if every tile is one, it is timed by the first tile
+					if (!(pkt.flags & AV_PKT_FLAG_KEY))
+						merged.flags = 0;
+					if (k == 0)
+					{
+						merged.pts = pkt.pts;
+						merged.dts = pkt.dts;
+						merged.duration = pkt.duration;
+					}
 				}
+				av_packet_unref(&pkt);
+			}
+			if (!read)
+				return TileEnded;
+		}
+		if (!fits && (merged.flags & AV_PKT_FLAG_KEY))
+			LOG_WARNING("The slices of the tiles do not form a picture, decoding it anyway");
+
+		auto decodeStart = std::chrono::steady_clock::now();
+		merged.data = const_cast<uint8_t*>(merger.Data().data());
+		merged.size = (int)merger.Data().size();
+		int ret = avcodec_send_packet(mergedCodecCtx, &merged);
+		if (ret == 0)
+		{
+			ret = picture.AvCodecReceiveFrame(mergedCodecCtx);
+			picture.SetFrameOffset(frameOffset);
+
+			if (ret == 0 && hwDeviceCtx != nullptr && picture.GetFormat() == hwPixFmt)
+			{
+				ret = picture.TransferFromHardware(hwTransferFrames[0]);
+				if (ret < 0)
+					LOG_WARNING("Could not download hardware frame of the merged tiles");
+			}
+
+			if (ret == 0)
+			{
+				// one sample for all tiles, the cost model is linear in pixels and bytes
+				double pixels = double(mergedCodecCtx->width) * mergedCodecCtx->height;
+				DecodeCostModel::instance().add(pixels, merged.size, SessionLog::instance().decode(pixels, merged.size,
+					std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - decodeStart).count()));
+				return TileDecoded;
+			}
+		}
+	}
+}
+
+void VideoReader::UploadPixelBuffer(const VideoFrame& frame)
+{
+	auto slot = frame.GetPboSlot();
+	if (!pixelBuffers.Bind(slot))
+		return;
+
+	// the upload reads from the bound buffer, the pointer argument is the plane offset
+	auto w = frame.GetWidth();
+	auto h = frame.GetHeight();
+	uint8_t** data = frame.GetDataPtr();
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (int i = 0; i < 3; i++)
+		textures.Upload(TextureRing::Plane(i), 0, 0, i ? w / 2 : w, i ? h / 2 : h, reinterpret_cast<const void*>(data[i] - data[0]));
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	pixelBuffers.Unbind(slot);
+}
+
+void VideoReader::UploadTiles(const VideoFrame& frame)
+{
+	// the pictures the current set holds, from the last time the ring was at it
+	auto& uploadedPts = lastUploadedPts[textures.Current()];
+	// decoded planes are uploaded with their own stride, no merged copy needed
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (int i = 0; i < 3; i++)
+	{
+		for (size_t t = 0; t < frame.GetNbTiles(); t++)
+		{
+			const auto& tile = frame.GetTile(t);
+			if (!tile.IsValid())
+				continue;
+			// the decoder handed out the same picture again, the set already holds it
+			if (tile.GetPts() != AV_NOPTS_VALUE && tile.GetPts() == uploadedPts[t])
+				continue;
+
+			// a tile of a reduced resolution representation fills the top left of its region
+			const auto& srd = inputStreams[t].getSRD();
+			int w = std::min(srd.w, tile.GetWidth());
+			int h = std::min(srd.h, tile.GetHeight());
+			if (i == 0)
+			{
+				size_t scaleIndex = 2 * (srd.y / srd.h * srd.th + srd.x / srd.w);
+				tileScales[scaleIndex] = (float)w / srd.w;
+				tileScales[scaleIndex + 1] = (float)h / srd.h;
+			}
+			glPixelStorei(GL_UNPACK_ROW_LENGTH, tile.GetLinesizePtr()[i]);
+			textures.Upload(TextureRing::Plane(i), i ? srd.x / 2 : srd.x, i ? srd.y / 2 : srd.y, i ? w / 2 : w, i ? h / 2 : h, tile.GetDataPtr()[i]);
+		}
+	}
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+	for (size_t t = 0; t < frame.GetNbTiles(); t++)
+		uploadedPts[t] = frame.GetTile(t).GetPts();
+}
+
+std::shared_ptr<VideoFrame> VideoReader::TakeDueFrame(std::chrono::system_clock::time_point deadline, std::chrono::system_clock::time_point& pts, size_t& nbUsed)
+{
+	std::shared_ptr<VideoFrame> frame(nullptr);
+	bool done = false;
+	clockOffsetMs = std::chrono::duration<double, std::milli>(deadline.time_since_epoch()).count()
+		- std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	clockRunning = true;
+	auto tmp_frame = GetCurrentFrame();
+	auto frameDuration = std::chrono::milliseconds((long)frameDurationMs);
+	if (tmp_frame == nullptr && deadline >= currentTimestamp + frameDuration) // Stalling
+	{
+		// the last picture stays on screen and follows the head with every draw; only a tile that ran out of data
+		// makes it rebuffering, a late decoder is counted apart
+		if (!stalled)
+		{
+			starved = false;
+			for (size_t i = 0; i < numInputStreams; i++)
+				starved = starved || inputStreams[i].starved();
+			if (starved)
+				stalls++;
+			else
+				lateFrames++;
+		}
+		auto behind = deadline - (currentTimestamp + frameDuration);
+		stallingTime += behind;
+		(starved ? rebufferingTime : lateTime) += behind;
+		stalled = true;
+	}
+	else if (tmp_frame != nullptr)
+	{
+		stalled = false;
+	}
+
+	while (!done)
+	{
+		tmp_frame = GetCurrentFrame();
+
+		if (tmp_frame != nullptr)
+		{
+			currentTimestamp = tmp_frame->GetDisplayTimestamp();
+
+			if (deadline >= currentTimestamp)
+			{
+				PRINT_DEBUG_VideoReader("Updated frame");
+				pts = currentTimestamp;
+				displayedMs = std::chrono::duration<double, std::milli>(pts.time_since_epoch()).count();
+				frame = std::move(tmp_frame);
+				outputFrames.Pop();
+				++lastDisplayedPictureNumber;
+				++nbUsed;
 			}
 			else
 			{
 				done = true;
 			}
 		}
+		else
+		{
+			done = true;
+		}
+	}
+	if (frame != nullptr)
+		TRACE_VALUE("frame lateness ms", std::chrono::duration<double, std::milli>(deadline - pts).count());
+	return frame;
+}
+
+IMT::DisplayFrameInfo VideoReader::ConsumeNextPicture(std::chrono::system_clock::time_point deadline)
+{
+	bool last = false;
+	auto pts = std::chrono::system_clock::time_point(std::chrono::seconds(-1));
+	size_t nbUsed = 0;
+	deadline = deadline - std::chrono::duration_cast<std::chrono::system_clock::duration>(stallingTime);
+	if (!outputFrames.IsAllDones())
+	{
+		auto frame = TakeDueFrame(deadline, pts, nbUsed);
+		last = frame != nullptr && !frame->IsValid();
+	}
+	else
+	{
+		last = true;
+	}
+	return { lastDisplayedPictureNumber, (nbUsed > 0 ? nbUsed - 1 : 0) + TakeSkippedFrames(), deadline, pts, last };
+}
+
+VideoReader::DecodeStats VideoReader::GetStats(void) const
+{
+	return { framesDecoded, decodeUs / 1000.0, mergeUs / 1000.0, stalls, rebufferingTime.count(), lateFrames, lateTime.count(), skippedFrames };
+}
+
+IMT::DisplayFrameInfo VideoReader::SetNextPictureToOpenGLTexture(std::chrono::system_clock::time_point deadline)
+{
+	bool last = false;
+	auto pts = std::chrono::system_clock::time_point(std::chrono::seconds(-1));
+	size_t nbUsed = 0;
+	deadline = deadline - std::chrono::duration_cast<std::chrono::system_clock::duration>(stallingTime);
+	if (!outputFrames.IsAllDones())
+	{
+		PRINT_DEBUG_VideoReader("Update video picture");
+		auto frame = TakeDueFrame(deadline, pts, nbUsed);
 
 		if (frame != nullptr && frame->IsValid())
 		{
+			TRACE_SPAN("upload");
 			auto w = frame->GetWidth();
 			auto h = frame->GetHeight();
 				
-			if (first)
+			// the textures are sized by the first picture
+			if (!textures.IsReady())
 			{
-				for (int i = 0; i < 3; i++)
-				{
-					glActiveTexture(GL_TEXTURE0 + i);
-					glBindTexture(GL_TEXTURE_2D, textureIds[i]);
-
-					glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-					glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-					glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-					glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
+				textures.Init(w, h, kTextureSets);
+				lastUploadedPts.assign(kTextureSets, std::vector<int64_t>(numInputStreams, AV_NOPTS_VALUE));
+				if (pboUpload && !pixelBuffers.Init(VideoFrame::mergedImageSize(inputStreams), framePool.Size()))
+					LOG_WARNING("Persistently mapped pixel buffers not available, uploading from client memory");
+				tileScales.assign(2 * inputStreams->getSRD().th * inputStreams->getSRD().tv, 1.0f);
+			}
 
-					glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, i ? w / 2 : w, i ? h / 2 : h, 0, GL_RED, GL_UNSIGNED_BYTE, frame->GetDataPtr()[i]);
-				}
-				first = false;
+			textures.Advance();
+			pixelBuffers.Reclaim();
+			if (!frame->HasTiles())
+				tileScales = frame->GetTileScales();
+			if (frame->GetPboSlot() >= 0)
+			{
+				UploadPixelBuffer(*frame);
+			}
+			else if (frame->HasTiles())
+			{
+				UploadTiles(*frame);
 			}
 			else
 			{
+				// a picture the decoder made as a whole keeps the row padding of its buffers
+				glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 				for (int i = 0; i < 3; i++)
 				{
-					glActiveTexture(GL_TEXTURE0 + i);
-					glBindTexture(GL_TEXTURE_2D, textureIds[i]);
-
-					glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, i ? w / 2 : w, i ? h / 2 : h, GL_RED, GL_UNSIGNED_BYTE, frame->GetDataPtr()[i]);
+					glPixelStorei(GL_UNPACK_ROW_LENGTH, frame->GetLinesizePtr()[i]);
+					textures.Upload(TextureRing::Plane(i), 0, 0, i ? w / 2 : w, i ? h / 2 : h, frame->GetDataPtr()[i]);
 				}
+				glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+				glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 			}
 		}
 		else if (frame != nullptr && !frame->IsValid())
@@ -345,5 +934,5 @@ IMT::DisplayFrameInfo VideoReader::SetNextPictureToOpenGLTexture(std::chrono::sy
 		//Stop sound
 		SDL_PauseAudio(1);
 	}
-	return { lastDisplayedPictureNumber, nbUsed > 0 ? nbUsed - 1 : 0, deadline, pts, last };
+	return { lastDisplayedPictureNumber, (nbUsed > 0 ? nbUsed - 1 : 0) + TakeSkippedFrames(), deadline, pts, last };
 }
@@ -0,0 +1,186 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Minimal timing harness for the player's hot paths. A case is
+	repeated until it ran for at least minTime, the fastest of a few
+	such rounds is reported as ns/op together with the heap
+	allocations and bytes per op, counted by the operator new of the
+	benchmark program. Results are written as CSV and can be checked
+	against an earlier run, a case slower than the tolerance allows or
+	allocating more than before counts as a regression.
+*/
+
+#pragma once
+
+#include <map>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace Benchmark
+{
+// heap allocations since the start of the program, counted by the replaced operator new
+struct Allocations
+{
+	static std::atomic<size_t>& count()
+	{
+		static std::atomic<size_t> c(0);
+		return c;
+	}
+
+	static std::atomic<size_t>& bytes()
+	{
+		static std::atomic<size_t> b(0);
+		return b;
+	}
+};
+
+// keeps the compiler from dropping a computation whose result is otherwise unused
+template<class T>
+inline void keep(const T& value)
+{
+#ifdef _MSC_VER
+	static const volatile void* sink;
+	sink = &value;
+	_ReadWriteBarrier();
+#else
+	asm volatile("" : : "r"(&value) : "memory");
+#endif
+}
+
+struct Result
+{
+	std::string name;
+	double nsPerOp;
+	double allocsPerOp;
+	double bytesPerOp;
+	size_t iterations;
+};
+
+class Runner
+{
+public:
+	Runner(std::chrono::milliseconds minTime, int rounds = 5)
+		: minTime(minTime), rounds(rounds)
+	{
+	}
+
+	// op runs one iteration of the case
+	const Result& run(const std::string& name, const std::function<void()>& op)
+	{
+		// warm up and find an iteration count that fills minTime
+		size_t iterations = 1;
+		while (true)
+		{
+			auto elapsed = measure(op, iterations);
+			if (elapsed >= minTime || iterations >= (size_t(1) << 30))
+				break;
+			double scale = elapsed.count() > 0 ? 1.4 * minTime.count() * 1e6 / std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() : 10;
+			iterations = std::max(iterations + 1, size_t(iterations * std::min(std::max(scale, 1.5), 10.0)));
+		}
+
+		Result result = { name, 0, 0, 0, iterations };
+		for (int r = 0; r < rounds; r++)
+		{
+			size_t allocs = Allocations::count();
+			size_t bytes = Allocations::bytes();
+			auto elapsed = measure(op, iterations);
+			double ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() / (double)iterations;
+			if (r == 0 || ns < result.nsPerOp)
+				result.nsPerOp = ns;
+			result.allocsPerOp = (Allocations::count() - allocs) / (double)iterations;
+			result.bytesPerOp = (Allocations::bytes() - bytes) / (double)iterations;
+		}
+
+		std::cout << std::left << std::setw(44) << name << std::right << std::fixed << std::setprecision(1)
+			<< std::setw(14) << result.nsPerOp << " ns/op"
+			<< std::setw(10) << result.allocsPerOp << " allocs/op"
+			<< std::setw(12) << std::setprecision(0) << result.bytesPerOp << " B/op" << std::endl;
+
+		results.push_back(result);
+		return results.back();
+	}
+
+	const std::vector<Result>& getResults() const
+	{
+		return results;
+	}
+
+	void writeCsv(const std::string& path) const
+	{
+		std::ofstream csv(path);
+		csv << "name,nsPerOp,allocsPerOp,bytesPerOp,iterations\n";
+		for (auto& r : results)
+			csv << r.name << "," << r.nsPerOp << "," << r.allocsPerOp << "," << r.bytesPerOp << "," << r.iterations << "\n";
+	}
+
+	// number of cases slower than baseline by more than tolerance or allocating more, cases missing in the baseline pass
+	int compare(const std::string& baselinePath, double tolerance) const
+	{
+		std::ifstream csv(baselinePath);
+		if (!csv)
+		{
+			std::cout << "Baseline " << baselinePath << " not found" << std::endl;
+			return 0;
+		}
+
+		std::map<std::string, Result> baseline;
+		std::string line;
+		std::getline(csv, line);
+		while (std::getline(csv, line))
+		{
+			std::stringstream ss(line);
+			Result r;
+			char c;
+			std::getline(ss, r.name, ',');
+			ss >> r.nsPerOp >> c >> r.allocsPerOp >> c >> r.bytesPerOp >> c >> r.iterations;
+			if (ss)
+				baseline[r.name] = r;
+		}
+
+		int regressions = 0;
+		for (auto& r : results)
+		{
+			auto it = baseline.find(r.name);
+			if (it == baseline.end())
+				continue;
+			bool slower = r.nsPerOp > it->second.nsPerOp * (1 + tolerance);
+			// allocation counts are exact, half an allocation per op is not noise
+			bool allocates = r.allocsPerOp > it->second.allocsPerOp + 0.5;
+			if (slower || allocates)
+			{
+				regressions++;
+				std::cout << "REGRESSION " << r.name << ": " << std::setprecision(1)
+					<< it->second.nsPerOp << " -> " << r.nsPerOp << " ns/op, "
+					<< it->second.allocsPerOp << " -> " << r.allocsPerOp << " allocs/op" << std::endl;
+			}
+		}
+		return regressions;
+	}
+
+private:
+	std::chrono::milliseconds minTime;
+	int rounds;
+	std::vector<Result> results;
+
+	static std::chrono::steady_clock::duration measure(const std::function<void()>& op, size_t iterations)
+	{
+		auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < iterations; i++)
+			op();
+		return std::chrono::steady_clock::now() - start;
+	}
+};
+}
@@ -0,0 +1,279 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Microbenchmarks of the adaption and media hot paths, run with
+	./360benchmark [pathToConfig]. The player sections of the config
+	set up the adaption like in the player, the Benchmark section
+	names the MPD, the output and an optional baseline to compare to.
+*/
+
+#include <new>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+
+// the adaption logs every segment at info level, the benchmark measures it without the log
+#define LOG_LEVEL 2
+#include "Benchmark.hpp"
+#include "IniReader.hpp"
+#include "ConfigParser.hpp"
+#include "Quaternion.hpp"
+#include "mpd.h"
+#include "TileGrid.hpp"
+#include "ViewportSampler.hpp"
+#include "PoseHistory.hpp"
+#include "HeadTrace.hpp"
+#include "QuaternionBatch.hpp"
+#include "ViewportPredictor.hpp"
+#include "VideoTileStream.hpp"
+#include "Frame.hpp"
+#include "AdaptionUnit.hpp"
+
+using namespace IMT;
+Config* Config::_instance = 0;
+
+// every heap allocation of the program is counted
+void* operator new(std::size_t size)
+{
+	Benchmark::Allocations::count()++;
+	Benchmark::Allocations::bytes() += size;
+	if (void* p = std::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+std::string readFile(const std::string& path)
+{
+	std::ifstream file(path, std::ios::binary);
+	std::stringstream ss;
+	ss << file.rdbuf();
+	return ss.str();
+}
+
+int main(int argc, char* argv[])
+{
+	std::string configPath = argc > 1 ? argv[1] : "benchmark.ini";
+	INIReader ini(configPath);
+	if (ini.ParseError() < 0)
+	{
+		std::cout << "Usage: " << argv[0] << " pathToConfig" << std::endl;
+		return 1;
+	}
+
+	auto config = Config::instance();
+	config->init(configPath);
+	// the transition monitor opens a window
+	config->monitor = false;
+
+	std::string mpdPath = ini.Get("Benchmark", "mpd", "sample.mpd");
+	std::string csvPath = ini.Get("Benchmark", "csv", "benchmark.csv");
+	std::string baselinePath = ini.Get("Benchmark", "baseline", "");
+	double tolerance = ini.GetReal("Benchmark", "tolerance", 0.25);
+	Benchmark::Runner runner(std::chrono::milliseconds(ini.GetInteger("Benchmark", "minTimeMs", 200)));
+
+	std::string mpdText = readFile(mpdPath);
+	if (mpdText.empty())
+	{
+		std::cout << "MPD " << mpdPath << " not found" << std::endl;
+		return 1;
+	}
+	DASH::MPD mpd(mpdText);
+	int numTiles = mpd.period.adaptationSets.size();
+
+	// poses of the head trace every 11 ms (90 Hz), the trace timestamps are seconds
+	HeadTrace headTrace(config->headtracePath.c_str());
+	std::vector<double> poseTimestamps;
+	for (double t = 0; t < 60; t += 0.011)
+		poseTimestamps.push_back(t);
+	auto poseBatch = headTrace.rotationsForTimestamps(poseTimestamps);
+	std::vector<Quaternion> poses;
+	for (size_t i = 0; i < poseBatch.size(); i++)
+		poses.push_back(poseBatch.get(i));
+	size_t pose = 0;
+	auto nextPose = [&]() -> const Quaternion& { pose = (pose + 1) % poses.size(); return poses[pose]; };
+
+	runner.run("DASH::MPD parse", [&]() {
+		DASH::MPD parsed(mpdText);
+		Benchmark::keep(parsed);
+	});
+
+	// the same popularity as a sidecar, as 360popularity writes it
+	PopularitySidecar sidecar;
+	sidecar.segments = (uint32_t)mpd.period.popularSegments;
+	sidecar.tiles = numTiles;
+	sidecar.quality = mpd.period.tilePopularity;
+	std::string sidecarData = sidecar.write();
+	runner.run("DASH::MPD loadPopularity", [&]() {
+		Benchmark::keep(mpd.loadPopularity(sidecarData));
+	});
+
+	runner.run("HeadTrace load", [&]() {
+		HeadTrace trace(config->headtracePath.c_str());
+		Benchmark::keep(trace);
+	});
+
+	runner.run("Quaternion::Rotation", [&]() {
+		VectorCartesian v = nextPose().Rotation(VectorCartesian(1, 0.3, -0.2));
+		Benchmark::keep(v);
+	});
+
+	// a window of 256 poses as the predictors see it
+	const size_t windowSize = std::min<size_t>(256, poses.size());
+	QuaternionBatch::Quaternions window(windowSize);
+	std::vector<double> windowTimestamps(windowSize);
+	for (size_t i = 0; i < windowSize; i++)
+	{
+		window.set(i, poses[i]);
+		windowTimestamps[i] = i * 11.0;
+	}
+	QuaternionBatch::Vectors angles;
+	runner.run("QuaternionBatch::toEuler (256 poses)", [&]() {
+		QuaternionBatch::toEuler(window, angles);
+		Benchmark::keep(angles);
+	});
+
+	QuaternionBatch::Vectors directions(windowSize), rotated;
+	for (size_t i = 0; i < windowSize; i++)
+		directions.set(i, VectorCartesian(1, 0.3, -0.2));
+	runner.run("QuaternionBatch::rotate (256 vectors)", [&]() {
+		QuaternionBatch::rotate(nextPose(), directions, rotated);
+		Benchmark::keep(rotated);
+	});
+
+	runner.run("HeadTrace::rotationsForTimestamps interpolated (60 s at 90 Hz)", [&]() {
+		auto rotations = headTrace.rotationsForTimestamps(poseTimestamps, true);
+		Benchmark::keep(rotations);
+	});
+
+	auto regression = ViewportPredictor::create("regression", windowSize);
+	runner.run("RegressionPredictor::pushAll (256 poses)", [&]() {
+		regression->reset();
+		regression->pushAll(windowTimestamps.data(), window);
+		Benchmark::keep(regression);
+	});
+
+	TileGrid tileGrid;
+	tileGrid.build(&mpd);
+	double coord = 0;
+	runner.run("TileGrid::tileAt (mapCoordToTile)", [&]() {
+		coord += 0.618033988749895;
+		coord -= (int)coord;
+		int tile = tileGrid.tileAt(coord, 1 - coord);
+		Benchmark::keep(tile);
+	});
+
+	// the visibility prediction of the adaption is one or two of these per segment
+	ViewportSampler sampler;
+	sampler.init(&tileGrid, config->sampleResolution, config->solidAngleWeighting, maxHDist, maxVDist);
+	runner.run("ViewportSampler::addVisibleSamples", [&]() {
+		std::map<int, int> tileVisibility;
+		sampler.addVisibleSamples(nextPose(), tileVisibility);
+		Benchmark::keep(tileVisibility);
+	});
+
+	ViewportSampler cachedSampler;
+	cachedSampler.init(&tileGrid, config->sampleResolution, config->solidAngleWeighting, maxHDist, maxVDist,
+		1.0, config->visibilityCacheStep, config->visibilityCacheSize);
+	runner.run("ViewportSampler::addVisibleSamples cached", [&]() {
+		std::map<int, int> tileVisibility;
+		cachedSampler.addVisibleSamples(nextPose(), tileVisibility);
+		Benchmark::keep(tileVisibility);
+	});
+
+	{
+		AdaptionUnit adaptionUnit(&mpd, nullptr);
+		adaptionUnit.setBufferLevel(config->bufferSeconds);
+		long long timestamp = 0;
+		PoseSnapshot<> snapshot;
+		auto snapshotAt = [&](size_t first) {
+			snapshot.count = std::min(snapshot.capacity(), poses.size());
+			for (size_t k = 0; k < snapshot.count; k++)
+			{
+				auto& q = poses[(first + snapshot.count - 1 - k) % poses.size()];
+				snapshot.time[k] = timestamp - (long long)k * 11;
+				snapshot.w[k] = q.GetW();
+				snapshot.x[k] = q.GetV().GetX();
+				snapshot.y[k] = q.GetV().GetY();
+				snapshot.z[k] = q.GetV().GetZ();
+			}
+		};
+
+		size_t segments = mpd.period.popularSegments;
+		int segment = 0;
+		adaptionUnit.initAdaption(PoseSnapshot<>(0, poses[0]));
+
+		runner.run("AdaptionUnit::startAdaption", [&]() {
+			// one second of poses between two adaptions
+			for (int i = 0; i < 90; i++)
+			{
+				timestamp += 11;
+				adaptionUnit.addPose(timestamp, nextPose());
+			}
+			snapshotAt(pose);
+			segment = (segment + 1) % std::max<size_t>(1, segments);
+
+			auto order = adaptionUnit.startAdaption(snapshot, segment);
+			Benchmark::keep(order);
+		});
+	}
+
+	// a 1.5 MB segment read with the 32 KiB buffer of the decoder's AVIOContext
+	const std::string segmentData(1500000, 'x');
+	std::vector<char> readBuffer(32768);
+	VideoTileStream stream;
+	stream.init(mpd.period.adaptationSets[0].srd, std::string(4096, 'i'), segmentData);
+	for (size_t read = 0; read < 4096 + segmentData.size();)
+		read += stream.read(readBuffer.data(), readBuffer.size());
+	runner.run("VideoTileStream::addSegment + read", [&]() {
+		stream.addSegment(std::string(segmentData));
+		size_t read = 0;
+		while (read < segmentData.size())
+			read += stream.read(readBuffer.data(), readBuffer.size());
+		Benchmark::keep(read);
+	});
+
+	{
+		std::vector<VideoTileStream> tileStreams(numTiles);
+		std::unique_ptr<LibAv::VideoFrame[]> tiles(new LibAv::VideoFrame[numTiles]);
+		for (int t = 0; t < numTiles; t++)
+		{
+			const auto& srd = mpd.period.adaptationSets[t].srd;
+			tileStreams[t].init(srd, "", "");
+
+			// a valid decoded picture of one tile, merged from a single tile stream of the same size
+			DASH::SRD single = srd;
+			single.x = single.y = 0;
+			single.th = single.tv = 1;
+			VideoTileStream singleStream;
+			singleStream.init(single, "", "");
+			tiles[t].prepareMerge(&singleStream);
+			tiles[t].finishMerge();
+		}
+
+		LibAv::VideoFrame frame;
+		runner.run("VideoFrame::mergeTilesToFrame", [&]() {
+			frame.mergeTilesToFrame(tiles.get(), tileStreams.data(), numTiles);
+			Benchmark::keep(frame);
+		});
+	}
+
+	runner.writeCsv(csvPath);
+	if (!baselinePath.empty() && runner.compare(baselinePath, tolerance) > 0)
+		return 2;
+	return 0;
+}
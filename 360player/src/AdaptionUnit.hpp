@@ -13,20 +13,34 @@
 #include <deque>
 #include <numeric>
 #include <algorithm>
+#include <mutex>
 
 #include "Quaternion.hpp"
 #include "mpd.h"
+#include "TileGrid.hpp"
+#include "ViewportSampler.hpp"
+#include "TileVisibility.hpp"
 #include "httplib.h"
-#include "CircularBuffer.hpp"
+#include "PoseHistory.hpp"
+#include "ViewportPredictor.hpp"
 #include "ConfigParser.hpp"
 #include "Monitor.hpp"
+#include "DeadlineScheduler.hpp"
+#include "ThroughputEstimator.hpp"
+#include "QualityAllocator.hpp"
+#include "DecodeCostModel.hpp"
+#include "TileBatch.hpp"
+#include "Log.hpp"
+#include "Trace.hpp"
+#include "PlayerMetrics.hpp"
+#include "PopularityFeed.hpp"
+#include "CachedSet.hpp"
+#include "SegmentStore.hpp"
 
 #define TIME_NOW_EPOCH_MS std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count()
-#define SAMPLERES 8
-#define SAMPLEPOINTS (SAMPLERES+1)*(SAMPLERES+1)
 
 #define TIMER auto ttt = TIME_NOW_EPOCH_MS
-#define TIMEROUT(s) auto ttt2 = TIME_NOW_EPOCH_MS; std::cout << s << " TIMER: " << ttt2 - ttt << std::endl
+#define TIMEROUT(s) auto ttt2 = TIME_NOW_EPOCH_MS; LOG_INFO(s << " TIMER: " << ttt2 - ttt)
 
 constexpr float PI = 3.141592653589793238462643383279502884L;
 
@@ -45,37 +59,38 @@ public:
 
 	AdaptionUnit(const DASH::MPD* mpd, httplib::Client* httpClient)
 		: mpd(mpd), httpClient(httpClient)
-		, bytesDownloaded(0), durationDownload(0)
-		, bandwidthEstimate(0)
+		, monitor(nullptr), currentSegment(0)
+		, bandwidthEstimate(0), bufferLevel(0)
 	{
-		auto srd = mpd->period.adaptationSets[0].srd;
-
-		int frameWidth = srd.w * srd.th;
-		int frameHeight = srd.h * srd.tv;
-
-		for (int i = 0; i < mpd->period.adaptationSets.size(); i++)
-		{
-			srd = mpd->period.adaptationSets[i].srd;
-
-			double normalizedCoordX = (srd.x + srd.w) / (double)frameWidth;
-			double normalizedCoordY = (srd.y + srd.h) / (double)frameHeight;
+		auto config = Config::instance();
+		estimator = ThroughputEstimator::create(config->estimator, config->estimatorWindow, config->estimatorAlpha);
+		safetyFactor = config->safetyFactor;
+		// the regression spans about 0.45 s, the 40 poses of a 90 Hz display without the pose sampler
+		predictionWindow = config->poseRate > 0 ? std::max<size_t>(2, (size_t)(config->poseRate * 0.45)) : 40;
+		predictor = ViewportPredictor::create(config->predictor, predictionWindow);
 
-			normalizedCoordTileMapping[normalizedCoordX][normalizedCoordY] = i;
-		}
+		allocator = QualityAllocator::create(config->allocator);
+		allocatorTiles.resize(mpd->period.adaptationSets.size());
+		for (int i = 0; i < allocatorTiles.size(); i++)
+			for (int q = 0; q < mpd->numQualityLevels; q++)
+				allocatorTiles[i].cost.push_back(mpd->bandwidth(i, q) / 8.0);
 
-		#define SIGN(x) (x < 0 ? -1 : 1)
-		auto sampleFun = [](int x) { return 0.5 + x * (1.0 / SAMPLERES); };
-		//auto sampleFun = [](int x) { return 0.5 + 2 * SIGN(x) * std::pow(x * (1.0 / SAMPLERES), 2); };
+		tileGrid.build(mpd);
 
-		int i = 0;
-		for (int x = -SAMPLERES/2; x <= SAMPLERES/2; x++)
-			for (int y = -SAMPLERES/2; y <= SAMPLERES/2; y++)
-				samplePoints[i++] = { sampleFun(x), sampleFun(y) };
+		sampler.init(&tileGrid, config->sampleResolution, config->solidAngleWeighting, maxHDist, maxVDist,
+			1.0, config->visibilityCacheStep, config->visibilityCacheSize);
+		// the margin enlarges the viewport relative to its size, every frame has a new pose so it is not cached
+		marginSampler.init(&tileGrid, config->sampleResolution, false, maxHDist, maxVDist, 1.0 + config->decodeMargin);
 
 		if (Config::instance()->monitor)
 		{
 			monitor = new Monitor();
 		}
+
+		if (config->livePopularity)
+			popularityFeed.reset(new PopularityFeed(mpd, config->mpdUri));
+		if (config->cacheAware)
+			cachedSet.reset(new CachedSet(mpd, config->mpdUri));
 	}
 
 	~AdaptionUnit()
@@ -84,51 +99,107 @@ public:
 			delete monitor;
 	}
 
-	void initAdaption(const std::pair<long long, Quaternion>& headRotation)
+	// plans the first segment from the first pose and returns the tile download order. With lowestQuality every tile
+	// starts in the lowest quality, the tiles of the viewport first, and the next segments upgrade them
+	std::vector<int> initAdaption(const PoseSnapshot<>& headRotations, int segment = 0, bool lowestQuality = false)
 	{
-		CircularBuffer<std::pair<long long, Quaternion>> cb;
-		cb.push(headRotation);
-		startAdaption(cb, 0, true);
+		auto tileDownloadOrder = startAdaption(PoseSnapshot<>(headRotations.timestamp(0), headRotations.rotation(0)), segment, true);
+		int numTiles = (int)tileQuality.size();
+		for (int t = 0; (int)tileDownloadOrder.size() < numTiles && t < numTiles; t++)
+			if (std::find(tileDownloadOrder.begin(), tileDownloadOrder.end(), t) == tileDownloadOrder.end())
+				tileDownloadOrder.push_back(t);
+		if (lowestQuality)
+			tileQuality.assign(numTiles, mpd->period.adaptationSets[0].representations.size() - 1);
+		rankDownloads(tileDownloadOrder);
+		return tileDownloadOrder;
 	}
 
-	std::vector<int> startAdaption(const CircularBuffer<std::pair<long long, Quaternion>>& headRotations, int segment, bool init = false)
+	std::vector<int> startAdaption(const PoseSnapshot<>& headRotations, int segment, bool init = false)
 	{
+		TRACE_SPAN("adaption");
 		std::vector<int> tileDownloadOrder;
+		currentSegment = segment;
 
 		if (init)
 			bandwidthEstimate = 2000000;
-		else if (durationDownload != 0 && bytesDownloaded != 0)
-			bandwidthEstimate = bytesDownloaded * (1000.0 / durationDownload);
+		else
+		{
+			// connections run in parallel, their rates add up to the throughput of the last segment
+			size_t bytes = 0;
+			double rate = 0;
+			for (auto& sample : connectionSamples)
+				if (sample.durationDownload != 0 && sample.bytesDownloaded != 0)
+				{
+					bytes += sample.bytesDownloaded;
+					rate += sample.bytesDownloaded * (1000000.0 / sample.durationDownload);
+				}
+			if (rate > 0)
+				estimator->addSample(bytes, (long long)(bytes * 1000000.0 / rate));
+			if (estimator->estimate() > 0)
+				bandwidthEstimate = estimator->estimate();
+		}
+
+		auto timestamp = headRotations.timestamp(headRotations.size() - 1);
+
+		connectionSamples.clear();
 
-		auto timestamp = headRotations[headRotations.size() - 1].first;
+		if (popularityFeed && !init)
+		{
+			popularityFeed->record(headRotations, [this](const Quaternion& q, std::map<int, int>& visibility) { addVisibleSamples(q, visibility); });
+			// the segments planned until the next sync
+			int interval = std::max(1, Config::instance()->livePopularityInterval);
+			if ((segment - 1) % interval == 0)
+				popularityFeed->sync(httpClient, segment, interval);
+		}
 
-		durationDownload = 0;
-		bytesDownloaded = 0;
+		// the cache is asked for the segments up to the next sync
+		int cachedWindow = std::max(1, Config::instance()->cacheAwareWindow);
+		if (cachedSet && (init || segment % cachedWindow == 0))
+			cachedSet->sync(httpClient, segment, cachedWindow);
 
-		std::cout << "Start adaption: " << bandwidthEstimate << std::endl;
+		LOG_INFO("Start adaption: " << bandwidthEstimate << " buffer: " << bufferLevel);
 		
 		size_t neededBandwidth = 0;
 		int numQualityLevels = mpd->period.adaptationSets[0].representations.size() - 1;
 		int numTiles = mpd->period.adaptationSets.size();
 
 		// start with all tiles in lowest quality
-		for (int i = 0; i < numTiles; i++)
-			tileQuality[i] = numQualityLevels;
+		tileQuality.assign(numTiles, numQualityLevels);
 
 		bool transition = false;
+		bool blend = false;
+		tileVisibility.clear();
 
 		auto config = Config::instance();
 		if (config->popularity && !config->viewportPrediction)
 		{
 			transition = true;
 		}
-		else if (bandwidthNeededForTileQualityMap(tileQuality) < bandwidthEstimate * .75)
+		else if (mpd->segmentRate(segment, tileQuality) < bandwidthEstimate * safetyFactor)
 		{
 			auto tileVisibility = predictTileVisibility(headRotations);
+			this->tileVisibility.assign(numTiles, 0);
+			for (auto& tilevis : tileVisibility)
+				this->tileVisibility[tilevis.second] = tilevis.first;
+
+			// with blendedTransitions the popularity is weighed into every tile instead of replacing the whole choice,
+			// the more the less certain the prediction is
+			DASH::TileQualityVector popular;
+			std::vector<int> popularVisibility;
+			double popularWeight = 0;
+			blend = config->blendedTransitions && config->popularity && config->transitions && popularQualities(segment, popular);
+			if (blend)
+			{
+				popularWeight = 1.0 - predictionConfidence(headRotations);
+				popularVisibility = blendVisibility(popular, popularWeight);
+				tileVisibility.clear();
+				for (int t = 0; t < numTiles; t++)
+					if (this->tileVisibility[t] > 0)
+						tileVisibility.push_back(std::make_pair(this->tileVisibility[t], t));
+			}
 
-			auto highestPriorityTile = std::max_element(tileVisibility.begin(), tileVisibility.end(), [](auto p1, auto p2) { return p1.first < p2.first; });
-			auto maxVisibility =highestPriorityTile->first;
-			auto visibilityPerQualityLevel = int(maxVisibility / (double)numQualityLevels);
+			auto maxVisibility = *std::max_element(this->tileVisibility.begin(), this->tileVisibility.end());
+			auto visibilityPerQualityLevel = std::max(1, int(maxVisibility / (double)std::max(1, numQualityLevels)));
 
 			// generate tile download order by visibility
 			std::sort(tileVisibility.begin(), tileVisibility.end(), [](auto p1, auto p2) { return p1.first < p2.first; });
@@ -138,33 +209,73 @@ public:
 				if (std::find(tileDownloadOrder.begin(), tileDownloadOrder.end(), t) == tileDownloadOrder.end())
 					tileDownloadOrder.push_back(t);
 
-			while (highestPriorityTile->first != 0)
+			// the share of the origin's throughput a cached representation needs, 1 until a hit has been timed
+			double cachedCharge = 1;
 			{
-				// enhance quality of highest priority tile
-				tileQuality.at(highestPriorityTile->second) = std::max(0, tileQuality.at(highestPriorityTile->second) - 1);
+				std::lock_guard<std::mutex> l(sampleMtx);
+				if (cacheRate > 0)
+					cachedCharge = std::min(1.0, bandwidthEstimate / cacheRate);
+			}
 
-				// trigger transition if too much bandwidth is needed
-				if (bandwidthNeededForTileQualityMap(tileQuality) > bandwidthEstimate * .75)
+			// a tile is worth one quality level per visibilityPerQualityLevel of its visibility
+			for (int t = 0; t < numTiles; t++)
+			{
+				auto& tile = allocatorTiles[t];
+				// with a size index the tiles cost what this segment of them needs
+				if (mpd->hasSegmentSizes())
+					for (int q = 0; q < (int)tile.cost.size(); q++)
+						tile.cost[q] = mpd->segmentRate(segment, t, q);
+				tile.charge.clear();
+				if (cachedSet && cachedCharge < 1)
+					for (int q = 0; q < (int)tile.cost.size(); q++)
+						tile.charge.push_back(cachedSet->contains(segment, t, q) ? cachedCharge : 1.0);
+				tile.visibility = this->tileVisibility[t];
+				int lowest = int(tile.cost.size()) - 1;
+				tile.target = std::max(0, lowest - (tile.visibility + visibilityPerQualityLevel - 1) / visibilityPerQualityLevel);
+				tile.popular = -1;
+				tile.popularBonus = 0;
+				if (blend)
 				{
-					if (config->popularity && config->transitions)
-					{
-						transition = true;
-						std::cout << "Transition to popularity" << std::endl;
-					}
-					break;
+					// the popular quality is within reach, and worth more the likelier the cache has it
+					tile.popular = std::min<int>(popular[t], lowest);
+					tile.target = std::min(tile.target, tile.popular);
+					if (tile.popular < lowest)
+						tile.popularBonus = popularWeight * hitLikelihood(segment, t, tile.popular) * popularVisibility[t] * std::log(tile.cost[tile.popular] / tile.cost[lowest]);
 				}
+			}
 
-				// decrease visibility so highest priority tile differs after resort
-				highestPriorityTile->first = std::max(0, highestPriorityTile->first - visibilityPerQualityLevel);
+			// the allocator never goes above a target, targets the decoder can keep up with bound every choice
+			std::vector<int> targets(numTiles);
+			for (int t = 0; t < numTiles; t++)
+				targets[t] = allocatorTiles[t].target;
+			fitDecodeBudget(segment, targets);
+			for (int t = 0; t < numTiles; t++)
+				allocatorTiles[t].target = targets[t];
 
-				// get most visible tile
-				highestPriorityTile = std::max_element(tileVisibility.begin(), tileVisibility.end(), [](auto p1, auto p2) { return p1.first < p2.first; });
+			// trigger transition if the targets need too much bandwidth
+			std::vector<int> quality;
+			if (!allocator->allocate(allocatorTiles, bandwidthEstimate * safetyFactor, visibilityPerQualityLevel, quality)
+				&& config->popularity && config->transitions && !blend)
+			{
+				transition = true;
+				LOG_INFO("Transition to popularity");
 			}
+			for (int t = 0; t < numTiles; t++)
+				tileQuality[t] = quality[t];
+			if (blend)
+				LOG_INFO("Popularity weight " << popularWeight << " hit rate " << hitRate());
+			// the monitor shows a blended segment as a transition once the popularity outweighs the prediction
+			blend = blend && popularWeight >= 0.5;
 		}
 
 		if (transition)
 		{
-			tileQuality = mpd->tilePopularity(segment);
+			if (!popularityFeed || !popularityFeed->tileQuality(segment, tileQuality))
+			{
+				auto popular = mpd->tilePopularity(segment);
+				tileQuality.assign(popular, popular + numTiles);
+			}
+			fitDecodeBudget(segment, tileQuality);
 
 			// generate tile download order by popularity
 			tileDownloadOrder.clear();
@@ -174,17 +285,15 @@ public:
 						tileDownloadOrder.push_back(i);
 		}
 
-		monitor->addsample(timestamp / 1000.0, bandwidthEstimate * 8 / 1000000, transition);
+		if (monitor)
+			monitor->addsample(timestamp / 1000.0, bandwidthEstimate * 8 / 1000000, transition || blend);
 		
+		// the segment is due once the buffered media has been played out
 		downloadStartTime = TIME_NOW_EPOCH_MS;
+		scheduler.startSegment(downloadStartTime, 0.75 * (std::max(mpd->segmentDuration(), bufferLevel) * 1000));
 
+		rankDownloads(tileDownloadOrder);
 		return tileDownloadOrder;
-		//for (int i = 0; i < 4; i++)
-		//{
-		//	for (int j = 0; j < 4; j++)
-		//		std::cout << tileQuality.at(j * 4 + i) << " ";
-		//	std::cout << std::endl;
-		//}
 	}
 
 	void stopAdaption()
@@ -204,134 +313,744 @@ public:
 		//}
 	}
 
-	auto download(int tile, int segment = -1)
+	// quality to request for tile, the planned one unless the schedule forces the lowest
+	int requestQuality(int tile)
 	{
-		if (segment != -1)
-			currentSegment = segment;
-
-		bool qOverride = false;
 		int lowq = mpd->period.adaptationSets[0].representations.size() - 1;
-		if (TIME_NOW_EPOCH_MS - downloadStartTime > 0.75 * (mpd->segmentDuration() * 1000))
+		int quality = tileQuality.at(tile);
+		if (scheduler.deadlinePassed())
 		{
-			qOverride = true;
-			std::cout << "q override "<< TIME_NOW_EPOCH_MS - downloadStartTime << " " << 0.75 * (mpd->segmentDuration() * 1000) << std::endl;
+			quality = lowq;
+			LOG_INFO("q override " << TIME_NOW_EPOCH_MS - downloadStartTime << " " << scheduler.deadline() - downloadStartTime);
 		}
-		
-		auto timer = TIME_NOW_EPOCH_MS;
-		auto res = httpClient->Get(mpd->getUrl(currentSegment, tile, qOverride ? lowq : tileQuality[tile]).c_str());
-		auto duration = TIME_NOW_EPOCH_MS - timer;
+		else if (scheduler.segmentAtRisk() && !tileVisibility.empty() && tileVisibility[tile] == 0)
+		{
+			// segment will be late, tiles outside the predicted viewport are not worth the bandwidth
+			quality = lowq;
+		}
+		return quality;
+	}
+
+	// never null: a tile not even the lowest quality of could be fetched comes back with status -1 and an empty body,
+	// a broken off part of a segment is no use to the demuxer
+	auto download(int tile, int segment = -1, httplib::Client* client = nullptr, size_t connection = 0)
+	{
+		TRACE_SPAN("download");
+		if (segment == -1)
+			segment = currentSegment;
+		if (client == nullptr)
+			client = httpClient;
+		prioritize(client, tile);
 
-		bool cacheHit = res->get_header_value("X-Cache").compare(0, 3, "HIT") == 0;
-		if (!cacheHit)
+		int lowq = mpd->period.adaptationSets[0].representations.size() - 1;
+		int quality = requestQuality(tile);
+		// each download thread formats its urls into one buffer
+		thread_local std::string url;
+		mpd->getUrl(url, segment, tile, quality);
+
+		std::shared_ptr<httplib::Response> res;
+		if (fromStore(tile, quality, url, res))
+			return res;
+		// body of a broken off transfer of quality, continued with a range request instead of fetched again
+		std::string resumed;
+		int resumes = 0;
+		const int maxResumes = 3;
+		while (true)
 		{
-			durationDownload += duration;
-			bytesDownloaded += res->body.size();
+			bool aborted = false;
+			auto timer = TIME_NOW_EPOCH_MS;
+			auto steadyTimer = STEADY_NOW;
+			auto progress = [&](uint64_t current, uint64_t total)
+			{
+				aborted = !(quality == lowq || scheduler.onTrack(timer, resumed.size() + current, resumed.size() + total));
+				return !aborted;
+			};
+			auto part = std::make_shared<httplib::Response>();
+			bool complete = client->GetRange(url.c_str(), resumed.size(), UINT64_MAX, *part, progress);
+			auto duration = ELAPSED_US(steadyTimer);
+			uint64_t received = part->body.size();
+
+			bool cacheHit = complete && part->get_header_value("X-Cache").compare(0, 3, "HIT") == 0;
+			PlayerMetrics::instance().addBytes(tile, quality, received);
+			PlayerMetrics::instance().addRequest(cacheHit, duration / 1e6);
+			if (complete)
+				countPopularRequest(tile, segment, quality, cacheHit);
+			if (cacheHit)
+				addHitSample(duration, received);
+			else
+				addSample(connection, duration, received);
+
+			if (complete)
+			{
+				// a server ignoring the range sends the whole file again
+				if (part->status == 206)
+					part->body.insert(0, resumed);
+				if (part->status == 200 || part->status == 206)
+					toStore(tile, segment, quality, url, part->body);
+				res = part;
+				break;
+			}
+
+			// the connection failed, not the schedule: continue where it stopped
+			if (!aborted && received > 0 && resumes++ < maxResumes)
+			{
+				resumed += part->body;
+				continue;
+			}
+
+			if (quality == lowq)
+			{
+				LOG_INFO("tile " << tile << " of segment " << segment << " failed");
+				res = std::make_shared<httplib::Response>();
+				break;
+			}
+			resumed.clear();
+
+			// transfer was aborted, re-request a representation that fits into the remaining time
+			int fallback = fallbackQuality(tile, segment, quality, duration > 0 ? received * 1000.0 / duration : 0);
+			LOG_INFO("abort tile " << tile << " q " << quality << " -> " << fallback);
+			quality = fallback;
+			mpd->getUrl(url, segment, tile, quality);
 		}
 
+		tileQuality.at(tile) = quality;
 		return res;
 	}
 
+	// requests the tiles of segment on client ahead of their download or downloadStream, in the qualities these will
+	// ask for. Tiles the segment store has are left out
+	void pipeline(const std::vector<int>& tiles, int segment, httplib::Client* client)
+	{
+		std::vector<std::string> urls;
+		for (int tile : tiles)
+		{
+			auto url = mpd->getUrl(segment, tile, requestQuality(tile));
+			if (!segmentStore || !segmentStore->contains(url))
+				urls.push_back(std::move(url));
+		}
+		if (!urls.empty())
+			client->Pipeline(urls);
+	}
+
+	// like download, but the body goes to sink as it arrives, so decoding starts before the segment is complete, as
+	// the chunks of a live segment are sent while it is still encoded. What sink got cannot be taken back: the transfer
+	// is never aborted for a lower quality, a broken one is continued. False if the segment could not be completed.
+	// With reserve, a segment of known length is read from the socket straight into the memory reserve gives for
+	// its size, and sink then gets the bytes where they were written to
+	bool downloadStream(int tile, int segment, httplib::Client* client, size_t connection, const std::function<void(const char*, size_t)>& sink,
+		const std::function<char*(size_t)>& reserve = nullptr)
+	{
+		TRACE_SPAN("download");
+		prioritize(client, tile);
+		int quality = requestQuality(tile);
+		thread_local std::string url;
+		mpd->getUrl(url, segment, tile, quality);
+		tileQuality.at(tile) = quality;
+
+		std::shared_ptr<httplib::Response> stored;
+		if (fromStore(tile, quality, url, stored))
+		{
+			sink(stored->body.data(), stored->body.size());
+			return true;
+		}
+		// the whole segment for the store, if it keeps the segments of this MPD
+		std::string body;
+		bool keep = segmentStore && !mpd->isDynamic();
+
+		// bytes of the segment given to sink
+		uint64_t streamed = 0;
+		// memory from reserve for the whole segment, sized by the first answer that sends all of it
+		char* segmentBuffer = nullptr;
+		uint64_t segmentSize = 0;
+		const int maxResumes = 3;
+		for (int resumes = 0; resumes <= maxResumes; resumes++)
+		{
+			httplib::Response res;
+			uint64_t start = streamed;
+			// segment offset of the next byte received, known once the status is
+			uint64_t position = UINT64_MAX;
+			auto steadyTimer = STEADY_NOW;
+			httplib::ContentBuffer buffer;
+			if (reserve)
+				buffer = [&](size_t length) -> char*
+				{
+					if (res.status == 200 && streamed == 0 && !segmentBuffer)
+					{
+						segmentSize = length;
+						return segmentBuffer = reserve(length);
+					}
+					// a continued transfer fills the rest, a server ignoring the range goes through sink with the skip
+					if (res.status == 206 && segmentBuffer && streamed + length == segmentSize)
+						return segmentBuffer + streamed;
+					return nullptr;
+				};
+			bool complete = client->GetStream(url.c_str(), streamed, res, [&](const char* data, size_t length)
+			{
+				if (res.status != 200 && res.status != 206)
+					return true;
+				// a server ignoring the range starts over with bytes sink already has
+				if (position == UINT64_MAX)
+					position = res.status == 206 ? streamed : 0;
+				size_t skip = (size_t)std::min<uint64_t>(length, streamed > position ? streamed - position : 0);
+				position += length;
+				if (skip < length)
+				{
+					sink(data + skip, length - skip);
+					if (keep)
+						body.append(data + skip, length - skip);
+					streamed += length - skip;
+				}
+				return true;
+			}, nullptr, buffer);
+			auto duration = ELAPSED_US(steadyTimer);
+			uint64_t received = streamed - start;
+
+			bool cacheHit = complete && res.get_header_value("X-Cache").compare(0, 3, "HIT") == 0;
+			PlayerMetrics::instance().addBytes(tile, quality, received);
+			PlayerMetrics::instance().addRequest(cacheHit, duration / 1e6);
+			if (complete)
+				countPopularRequest(tile, segment, quality, cacheHit);
+			if (cacheHit)
+				addHitSample(duration, received);
+			// a chunked transfer comes at the rate the segment is encoded, which says nothing about the network
+			else if (res.get_header_value("Transfer-Encoding") != "chunked")
+				addSample(connection, duration, received);
+
+			if (complete && (res.status == 200 || res.status == 206))
+			{
+				toStore(tile, segment, quality, url, body);
+				return true;
+			}
+			if (received == 0)
+				break;
+		}
+		LOG_ERROR("stream of tile " << tile << " segment " << segment << " broke off");
+		return false;
+	}
+
+	// segments are numbered as in the MPD, a live session starts at segment instead of 0 and a seek continues at
+	// segment from the pose at timestamp on
+	void setFirstSegment(int segment, long long timestamp = 0)
+	{
+		if (popularityFeed)
+			popularityFeed->setFirstSegment(segment, timestamp);
+	}
+
+	// downloads are answered from store if it has the segment and complete ones are kept in it, nullptr disables it
+	void setSegmentStore(SegmentStore* store)
+	{
+		segmentStore = store;
+	}
+
+	// the download connections are streams of one connection: the transfers running in parallel share its rate
+	// instead of adding up, and their samples become one from the start of the first to the end of the last
+	void setSharedConnection(bool shared)
+	{
+		sharedConnection = shared;
+	}
+
+	// segment data of tiles fetched in one request, in the order of tiles. Without a complete answer the tiles are
+	// loaded one by one with download, a batch cannot fall back per tile while it is transferred
+	std::vector<std::string> downloadBatch(const std::vector<int>& tiles, int segment, httplib::Client* client = nullptr, size_t connection = 0)
+	{
+		TRACE_SPAN("download batch");
+		if (client == nullptr)
+			client = httpClient;
+
+		// tiles the segment store has are not requested
+		std::vector<std::string> data(tiles.size());
+		std::vector<int> missing;
+		std::vector<std::pair<int, int>> tileQualities;
+		for (size_t i = 0; i < tiles.size(); i++)
+		{
+			int quality = requestQuality(tiles[i]);
+			std::shared_ptr<httplib::Response> stored;
+			if (fromStore(tiles[i], quality, mpd->getUrl(segment, tiles[i], quality), stored))
+				data[i] = std::move(stored->body);
+			else
+			{
+				missing.push_back((int)i);
+				tileQualities.push_back({ tiles[i], quality });
+			}
+		}
+		if (missing.empty())
+			return data;
+		prioritize(client, tiles[missing[0]]);
+
+		auto steadyTimer = STEADY_NOW;
+		auto res = client->Get(TileBatch::url(Config::instance()->mpdUri, segment, tileQualities).c_str());
+		auto duration = ELAPSED_US(steadyTimer);
+
+		std::vector<TileBatch::Part> parts;
+		bool complete = res && res->status == 200 && TileBatch::split(res->body, parts) && parts.size() == missing.size();
+		for (size_t i = 0; complete && i < parts.size(); i++)
+			complete = parts[i].tile == tiles[missing[i]] && !parts[i].data.empty();
+
+		bool cacheHit = res && res->get_header_value("X-Cache").compare(0, 3, "HIT") == 0;
+		PlayerMetrics::instance().addRequest(cacheHit, duration / 1e6);
+		if (res && cacheHit)
+			addHitSample(duration, res->body.size());
+		else if (res)
+			addSample(connection, duration, res->body.size());
+
+		for (size_t i = 0; i < missing.size(); i++)
+		{
+			int tile = tiles[missing[i]];
+			if (complete)
+			{
+				tileQuality.at(tile) = parts[i].quality;
+				PlayerMetrics::instance().addBytes(tile, parts[i].quality, parts[i].data.size());
+				countPopularRequest(tile, segment, parts[i].quality, cacheHit);
+				toStore(tile, segment, parts[i].quality, mpd->getUrl(segment, tile, parts[i].quality), parts[i].data);
+				data[missing[i]] = std::move(parts[i].data);
+			}
+			else
+				data[missing[i]] = std::move(download(tile, segment, client, connection)->body);
+		}
+		return data;
+	}
+
+	// a segment in the tile streams, with the qualities it was fetched in
+	struct BufferedSegment
+	{
+		// segment of the MPD
+		int segment;
+		// seconds until it starts playing
+		double playsIn;
+		DASH::TileQualityVector quality;
+		// tiles the decoder has not started on
+		std::vector<bool> replaceable;
+	};
+
+	struct Upgrade
+	{
+		int segment;
+		int tile;
+		int quality;
+	};
+
+	// the tile of the buffered segments that the current prediction sees the most of below the quality it would plan
+	// for it now, weighed by the levels it gains. It goes up as far as that quality, as long as its transfer at the
+	// estimated throughput takes at most seconds and the decoder keeps up with its segment. False without one
+	bool planUpgrade(const PoseSnapshot<>& headRotations, const std::vector<BufferedSegment>& buffered, double seconds, Upgrade& upgrade) const
+	{
+		double rate = bandwidthEstimate * safetyFactor;
+		if (rate <= 0 || seconds <= 0 || headRotations.size() == 0)
+			return false;
+		auto& model = DecodeCostModel::instance();
+		double budget = model.ready() ? model.capacityMs() * Config::instance()->decodeBudget : 0;
+		double segmentMs = mpd->segmentDuration() * 1000;
+		bool predict = headRotations.size() > 1 && Config::instance()->viewportPrediction;
+
+		double best = 0;
+		for (auto& b : buffered)
+		{
+			// the visibility the adaption would see for the segment, but planned from the poses of now
+			std::map<int, int> visibility;
+			double playbackStart = headRotations.timestamp(0) + b.playsIn * 1000;
+			if (predict)
+				for (double ts : { playbackStart + 0.5 * segmentMs, playbackStart + segmentMs })
+					addVisibleSamples(predictor->predict(ts), visibility);
+			else
+				addVisibleSamples(headRotations.rotation(0), visibility);
+			int maxVisibility = 0;
+			for (auto& v : visibility)
+				maxVisibility = std::max(maxVisibility, v.second);
+
+			for (size_t t = 0; t < b.quality.size() && t < b.replaceable.size(); t++)
+			{
+				if (!b.replaceable[t] || visibility[(int)t] == 0)
+					continue;
+				int lowest = (int)mpd->period.adaptationSets[t].representations.size() - 1;
+				int perLevel = std::max(1, int(maxVisibility / (double)std::max(1, lowest)));
+				int target = std::max(0, lowest - (visibility[(int)t] + perLevel - 1) / perLevel);
+				for (int q = target; q < (int)b.quality[t]; q++)
+				{
+					double score = double(visibility[(int)t]) * ((int)b.quality[t] - q);
+					if (score <= best || mpd->segmentBytes(b.segment, (int)t, q) / rate > seconds)
+						continue;
+					auto quality = b.quality;
+					quality[t] = q;
+					if (budget > 0 && decodeMs(b.segment, quality) > budget)
+						continue;
+					best = score;
+					upgrade = { b.segment, (int)t, q };
+					break;
+				}
+			}
+		}
+		return best > 0;
+	}
+
+	// fetches tile of segment in quality for an upgrade, the transfer is given up once keepGoing returns false. Its
+	// time goes into the throughput of the next adaption like every download
+	bool downloadUpgrade(int tile, int segment, int quality, const std::function<bool()>& keepGoing, std::string& body, httplib::Client* client = nullptr)
+	{
+		TRACE_SPAN("upgrade");
+		if (client == nullptr)
+			client = httpClient;
+		auto url = mpd->getUrl(segment, tile, quality);
+		if (segmentStore && segmentStore->get(url, body))
+		{
+			PlayerMetrics::instance().addStoreHit(body.size());
+			return true;
+		}
+
+		auto steadyTimer = STEADY_NOW;
+		httplib::Response res;
+		bool complete = client->GetRange(url.c_str(), 0, UINT64_MAX, res, [&](uint64_t, uint64_t) { return keepGoing(); })
+			&& (res.status == 200 || res.status == 206);
+		auto duration = ELAPSED_US(steadyTimer);
+		bool cacheHit = complete && res.get_header_value("X-Cache").compare(0, 3, "HIT") == 0;
+		PlayerMetrics::instance().addBytes(tile, quality, res.body.size());
+		PlayerMetrics::instance().addRequest(cacheHit, duration / 1e6);
+		if (cacheHit)
+			addHitSample(duration, res.body.size());
+		else
+			addSample(0, duration, res.body.size());
+		if (!complete)
+			return false;
+		toStore(tile, segment, quality, url, res.body);
+		body = std::move(res.body);
+		return true;
+	}
+
 	void printTileVisibility(const Quaternion& headRotation)
 	{
 		std::map<int, int> tileVisibilityMap;
-		for (int i = 0; i < SAMPLEPOINTS; i++)
-			tileVisibilityMap[mapCoordToTile(fromViewportCoordToEquirectCoord(headRotation, samplePoints[i]))]++;
+		addVisibleSamples(headRotation, tileVisibilityMap);
 
-		for (int i = 0; i < 16; i++)
-			if (tileVisibilityMap.find(i) == tileVisibilityMap.end())
-				tileVisibilityMap[i] = 0;
-
-		for (int i = 0; i < 4; i++)
+		// tiles are numbered column by column
+		auto srd = mpd->period.adaptationSets[0].srd;
+		for (int i = 0; i < srd.tv; i++)
 		{
-			for (int j = 0; j < 4; j++)
-				std::cout << tileVisibilityMap.at(j * 4 + i) << "\t";
+			for (int j = 0; j < srd.th; j++)
+				std::cout << tileVisibilityMap[j * srd.tv + i] << "\t";
 			std::cout << std::endl;
 		}
 		std::cout << std::endl;
 	}
 
-	const std::map<int, int>& getCurrentTileQuality() const
+	// feed the viewport prediction, called for every recorded pose [render thread]
+	void addPose(long long timestamp, const Quaternion& headRotation)
+	{
+		predictor->push(timestamp, headRotation);
+	}
+
+	// poses the regression is fitted to
+	size_t poseWindow() const
+	{
+		return predictionWindow;
+	}
+
+	// head rotation expected at timestamp, cheap enough to be evaluated every frame
+	Quaternion predictRotation(double timestamp) const
+	{
+		return predictor->predict(timestamp);
+	}
+
+	// bitmask of the tiles inside the viewport enlarged by decodeMargin
+	TileVisibility::Mask visibleTiles(const Quaternion& headRotation) const
+	{
+		TileVisibility::Mask mask;
+		marginSampler.tileMask(headRotation, mask.data(), mask.size());
+		return mask;
+	}
+
+	const DASH::TileQualityVector& getCurrentTileQuality() const
 	{
 		return tileQuality;
 	}
 
+	// seconds of media buffered ahead of the playhead when the next adaption starts
+	void setBufferLevel(double seconds)
+	{
+		bufferLevel = seconds;
+	}
+
+	double getBufferLevel() const
+	{
+		return bufferLevel;
+	}
+
 private:
+	struct ConnectionSample
+	{
+		size_t bytesDownloaded = 0;
+		// microseconds
+		long long durationDownload = 0;
+		// span of the transfers on a shared connection
+		std::chrono::steady_clock::time_point first, last;
+	};
+
 	const DASH::MPD* mpd;
 	httplib::Client* httpClient;
 	Monitor* monitor;
-	std::map<double, std::map<double, int>> normalizedCoordTileMapping;
-	std::map<int, int> tileQuality;
+	TileGrid tileGrid;
+	ViewportSampler sampler;
+	ViewportSampler marginSampler;
+	DASH::TileQualityVector tileQuality;
 	int currentSegment;	
 	size_t bandwidthEstimate;
-	size_t bytesDownloaded;
-	int durationDownload;
+	std::unique_ptr<ThroughputEstimator> estimator;
+	std::unique_ptr<QualityAllocator> allocator;
+	// representation costs per tile, visibility and target are refreshed every segment
+	std::vector<QualityAllocator::Tile> allocatorTiles;
+	// share of the estimated bandwidth the adaption may plan with
+	double safetyFactor;
+	double bufferLevel;
+	std::vector<ConnectionSample> connectionSamples;
+	std::mutex sampleMtx;
+	bool sharedConnection = false;
+	// place of every tile in the download order of the current segment
+	std::vector<int> downloadRank;
 	long long downloadStartTime;
-	NormalizedCoordinate samplePoints[SAMPLEPOINTS];
+	DeadlineScheduler scheduler;
+	std::unique_ptr<ViewportPredictor> predictor;
+	size_t predictionWindow;
+	// predicted visibility per tile of the current segment, empty if the viewport was not used
+	std::vector<int> tileVisibility;
+	// nullptr without livePopularity
+	std::unique_ptr<PopularityFeed> popularityFeed;
+	SegmentStore* segmentStore = nullptr;
+	// share of the requests for the popular quality the cache answered, smoothed; guarded by sampleMtx
+	double popularHitRate = 0.5;
+	// throughput of the cache hits; guarded by sampleMtx
+	double cacheRate = 0;
+	// nullptr without cacheAware
+	std::unique_ptr<CachedSet> cachedSet;
 	
-	size_t bandwidthNeededForTileQualityMap(const std::map<int, int>& tileQualityMap)
+	void rankDownloads(const std::vector<int>& tileDownloadOrder)
 	{
-		size_t neededBandwidth = 0;
-		for (int i = 0; i < mpd->period.adaptationSets.size(); i++)
-			neededBandwidth += mpd->period.adaptationSets[i].representations[tileQualityMap.at(i)].bandwidth;
-		return neededBandwidth / 8;
+		downloadRank.assign(tileQuality.size(), (int)tileDownloadOrder.size());
+		for (size_t r = 0; r < tileDownloadOrder.size(); r++)
+			downloadRank.at(tileDownloadOrder[r]) = (int)r;
+	}
+
+	// the rank of tile on a transport that is shared by the connections, tiles of the predicted viewport are urgent.
+	// An order by popularity keeps every tile urgent, so they come in exactly that order
+	void prioritize(httplib::Client* client, int tile) const
+	{
+		if (tile < 0 || tile >= (int)downloadRank.size())
+			return;
+		bool urgent = tileVisibility.empty() || tileVisibility[tile] > 0;
+		client->set_priority(downloadRank[tile], urgent);
+	}
+
+	// duration is the time up to now the transfer of bytes took
+	void addSample(size_t connection, long long duration, size_t bytes)
+	{
+		std::lock_guard<std::mutex> l(sampleMtx);
+		if (sharedConnection)
+			connection = 0;
+		if (connectionSamples.size() <= connection)
+			connectionSamples.resize(connection + 1);
+		auto& sample = connectionSamples[connection];
+		if (!sharedConnection)
+		{
+			sample.durationDownload += duration;
+			sample.bytesDownloaded += bytes;
+			return;
+		}
+		auto end = STEADY_NOW;
+		auto start = end - std::chrono::microseconds(duration);
+		bool firstTransfer = sample.bytesDownloaded == 0 && sample.durationDownload == 0;
+		sample.first = firstTransfer ? start : std::min(sample.first, start);
+		sample.last = firstTransfer ? end : std::max(sample.last, end);
+		sample.bytesDownloaded += bytes;
+		sample.durationDownload = std::chrono::duration_cast<std::chrono::microseconds>(sample.last - sample.first).count();
 	}
 
-	std::function<double(double)> computeRegressionFunction(const std::vector<double>& x, const std::vector<double>& y) const
+	// a hit of the segment store is no transfer: it is counted apart from the X-Cache answers and leaves the
+	// throughput samples alone
+	bool fromStore(int tile, int quality, const std::string& url, std::shared_ptr<httplib::Response>& res)
 	{
-		const auto n = x.size();
-		const auto s_x = std::accumulate(x.begin(), x.end(), 0.0);
-		const auto s_y = std::accumulate(y.begin(), y.end(), 0.0);
-		const auto s_xx = std::inner_product(x.begin(), x.end(), x.begin(), 0.0);
-		const auto s_xy = std::inner_product(x.begin(), x.end(), y.begin(), 0.0);
-		const auto slope = (n * s_xy - s_x * s_y) / (n * s_xx - s_x * s_x);
-		const auto intercept = (s_y - slope * s_x) / n;
-		return [slope, intercept](double x) { return x * slope + intercept; };
+		if (!segmentStore)
+			return false;
+		auto stored = std::make_shared<httplib::Response>();
+		if (!segmentStore->get(url, stored->body))
+			return false;
+		stored->status = 200;
+		PlayerMetrics::instance().addStoreHit(stored->body.size());
+		tileQuality.at(tile) = quality;
+		res = stored;
+		return true;
 	}
 
-	std::vector<std::pair<int, int>> predictTileVisibility(const CircularBuffer<std::pair<long long, Quaternion>>& headRotations) const
+	// the segments of a dynamic MPD are not watched again. The quality the MPD recommends is evicted last
+	void toStore(int tile, int segment, int quality, const std::string& url, const std::string& body)
+	{
+		if (!segmentStore || mpd->isDynamic())
+			return;
+		segmentStore->put(url, body, mpdPopularQuality(tile, segment) == quality);
+	}
+
+	// quality the MPD's popularity recommends for tile, -1 if it has none for segment
+	int mpdPopularQuality(int tile, int segment) const
+	{
+		if ((size_t)segment >= mpd->period.popularSegments
+			|| mpd->period.tilePopularity[segment * mpd->period.adaptationSets.size()] == PopularitySidecar::none)
+			return -1;
+		return mpd->tilePopularity(segment)[tile];
+	}
+
+	// popular quality of every tile of segment, from the live feed or else the MPD. False if neither has segment
+	bool popularQualities(int segment, DASH::TileQualityVector& quality) const
+	{
+		if (popularityFeed && popularityFeed->tileQuality(segment, quality))
+			return true;
+		if (mpdPopularQuality(0, segment) < 0)
+			return false;
+		auto popular = mpd->tilePopularity(segment);
+		quality.assign(popular, popular + mpd->period.adaptationSets.size());
+		return true;
+	}
+
+	// a request for the popular quality is what a cache filled by the popularity would hold, its answers estimate
+	// how likely a popular tile comes from the cache
+	void countPopularRequest(int tile, int segment, int quality, bool cacheHit)
+	{
+		if (quality != mpdPopularQuality(tile, segment))
+			return;
+		std::lock_guard<std::mutex> l(sampleMtx);
+		popularHitRate += 0.2 * ((cacheHit ? 1.0 : 0.0) - popularHitRate);
+	}
+
+	double hitRate()
+	{
+		std::lock_guard<std::mutex> l(sampleMtx);
+		return popularHitRate;
+	}
+
+	// what the cache published decides if it has tile in quality, without it the hit rate of the popular qualities
+	double hitLikelihood(int segment, int tile, int quality)
+	{
+		if (cachedSet)
+			return cachedSet->contains(segment, tile, quality) ? 1 : 0;
+		return hitRate();
+	}
+
+	// bytes per second of the transfers the cache answered, smoothed
+	void addHitSample(long long duration, size_t bytes)
+	{
+		if (duration <= 0 || bytes == 0)
+			return;
+		double rate = bytes * 1000000.0 / duration;
+		std::lock_guard<std::mutex> l(sampleMtx);
+		cacheRate = cacheRate > 0 ? cacheRate + 0.2 * (rate - cacheRate) : rate;
+	}
+
+	// 1 if the head is predicted to stay where it is until the planned segment has played, 0 once the prediction turns
+	// it by half the horizontal field of view or more
+	double predictionConfidence(const PoseSnapshot<>& headRotations) const
+	{
+		if (headRotations.size() == 1 || !Config::instance()->viewportPrediction)
+			return 1;
+		double end = headRotations.timestamp(0) + (bufferLevel + mpd->segmentDuration()) * 1000;
+		double turn = Quaternion::OrthodromicDistance(headRotations.rotation(0), predictor->predict(end));
+		return std::max(0.0, 1.0 - turn / (monocular_horizontal * PI / 180.0 / 2.0));
+	}
+
+	// mixes the predicted visibility of every tile with the visibility its popular quality stands for, the one that
+	// would give the popular quality as target. Returns the latter
+	std::vector<int> blendVisibility(const DASH::TileQualityVector& popular, double weight)
+	{
+		int lowest = mpd->period.adaptationSets[0].representations.size() - 1;
+		int maxVisibility = std::max(1, *std::max_element(tileVisibility.begin(), tileVisibility.end()));
+		std::vector<int> popularVisibility(tileVisibility.size(), 0);
+		for (size_t t = 0; t < tileVisibility.size(); t++)
+		{
+			if (lowest > 0)
+				popularVisibility[t] = maxVisibility * (lowest - std::min<int>(popular[t], lowest)) / lowest;
+			tileVisibility[t] = (int)std::lround((1 - weight) * tileVisibility[t] + weight * popularVisibility[t]);
+		}
+		return popularVisibility;
+	}
+
+	// ms the decoder threads need for a frame of every tile in the given qualities, predicted by the decode cost model
+	template <typename Qualities>
+	double decodeMs(int segment, const Qualities& quality) const
+	{
+		auto& model = DecodeCostModel::instance();
+		double frames = std::max(1.0, mpd->segmentDuration() * mpd->frameRate());
+		double ms = 0;
+		for (size_t t = 0; t < quality.size(); t++)
+		{
+			auto& set = mpd->period.adaptationSets[t];
+			auto& rep = set.representations[std::min<size_t>(quality[t], set.representations.size() - 1)];
+			double pixels = rep.width > 0 && rep.height > 0 ? double(rep.width) * rep.height : double(set.srd.w) * set.srd.h;
+			ms += model.frameMs(pixels, mpd->segmentBytes(segment, (int)t, quality[t]) / frames);
+		}
+		return ms;
+	}
+
+	// lowers the least visible tiles by one quality at a time until the decoder can keep up with a frame of the choice
+	template <typename Qualities>
+	void fitDecodeBudget(int segment, Qualities& quality) const
+	{
+		auto& model = DecodeCostModel::instance();
+		double budget = model.capacityMs() * Config::instance()->decodeBudget;
+		if (budget <= 0 || !model.ready())
+			return;
+
+		double needed = decodeMs(segment, quality);
+		if (needed <= budget)
+			return;
+		double before = needed;
+		auto visibility = [this](size_t t) { return tileVisibility.empty() ? 0 : tileVisibility[t]; };
+		while (needed > budget)
+		{
+			// ties go to the tile in the higher quality
+			int tile = -1;
+			for (size_t t = 0; t < quality.size(); t++)
+				if ((int)quality[t] < (int)mpd->period.adaptationSets[t].representations.size() - 1
+					&& (tile < 0 || visibility(t) < visibility(tile) || (visibility(t) == visibility(tile) && quality[t] < quality[tile])))
+					tile = (int)t;
+			if (tile < 0)
+				break;
+			quality[tile]++;
+			needed = decodeMs(segment, quality);
+		}
+		LOG_INFO("Decode budget " << budget << " ms per frame, qualities lowered from " << before << " to " << needed << " ms");
+	}
+
+	// highest quality below the aborted one that is expected to arrive before the deadline
+	int fallbackQuality(int tile, int segment, int quality, double bytesPerMs) const
+	{
+		int lowq = mpd->period.adaptationSets[tile].representations.size() - 1;
+		double budget = bytesPerMs * std::max(0ll, scheduler.remainingMs());
+		for (int q = quality + 1; q < lowq; q++)
+			if (mpd->segmentBytes(segment, tile, q) <= budget)
+				return q;
+		return lowq;
+	}
+
+	std::vector<std::pair<int, int>> predictTileVisibility(const PoseSnapshot<>& headRotations) const
 	{
 		std::map<int, int> tileVisibilityMap;
 
 		if (headRotations.size() == 1 || !Config::instance()->viewportPrediction)
 		{
 			// find visible tiles depending on head position
-			for (int j = 0; j < SAMPLEPOINTS; j++)
-				tileVisibilityMap[mapCoordToTile(fromViewportCoordToEquirectCoord(headRotations[0].second, samplePoints[j]))]++;
+			addVisibleSamples(headRotations.rotation(0), tileVisibilityMap);
 		}
 		else
 		{
-			// convert quaternions to euler angles
-			std::vector<double> timeVector(headRotations.size());
-			std::vector<double> rollVector(headRotations.size());
-			std::vector<double> pitchVector(headRotations.size());
-			std::vector<double> yawVector(headRotations.size());
-			for (int i = 0; i < headRotations.size(); i++)
-			{
-				auto eulerAngle = headRotations[i].second.ToEuler();
-				timeVector[i] = headRotations[i].first;
-				rollVector[i] = eulerAngle.GetX();
-				pitchVector[i] = eulerAngle.GetY();
-				yawVector[i] = eulerAngle.GetZ();
-			}
-
-			auto funRegressionRoll = computeRegressionFunction(timeVector, rollVector);
-			auto funRegressionPitch = computeRegressionFunction(timeVector, pitchVector);
-			auto funRegressionYaw = computeRegressionFunction(timeVector, yawVector);
-
-			auto timestamp = headRotations[0].first;
+			auto timestamp = headRotations.timestamp(0);
 
+			// the planned segment starts playing once the buffer has drained
 			static const double segmentDurationMs = mpd->segmentDuration() * 1000;
-			const double predictionTimestamps[2] = { timestamp + 0.5 * segmentDurationMs,
-				timestamp + segmentDurationMs};
+			const double playbackStart = timestamp + bufferLevel * 1000;
+			const double predictionTimestamps[2] = { playbackStart + 0.5 * segmentDurationMs,
+				playbackStart + segmentDurationMs};
 
 			for (int i = 0; i < 2; i++)
 			{
 				auto ts = predictionTimestamps[i];
-				auto rot = Quaternion::FromEuler(funRegressionYaw(ts), funRegressionPitch(ts), funRegressionRoll(ts));
+				auto rot = predictor->predict(ts);
 
 				// find visible tiles depending on head position
-				for (int j = 0; j < SAMPLEPOINTS; j++)
-					tileVisibilityMap[mapCoordToTile(fromViewportCoordToEquirectCoord(rot, samplePoints[j]))]++;
+				addVisibleSamples(rot, tileVisibilityMap);
 			}
 		}
 
@@ -343,9 +1062,15 @@ private:
 		return tileVisibility;
 	}
 
+	// weighted count of the viewport sample points falling into each tile
+	void addVisibleSamples(const Quaternion& headRotation, std::map<int, int>& tileVisibilityMap) const
+	{
+		sampler.addVisibleSamples(headRotation, tileVisibilityMap);
+	}
+
 	int mapCoordToTile(NormalizedCoordinate coord) const
 	{
-		return normalizedCoordTileMapping.lower_bound(coord.x)->second.lower_bound(coord.y)->second;
+		return tileGrid.tileAt(coord.x, coord.y);
 	}
 
 	static NormalizedCoordinate fromViewportCoordToEquirectCoord(const Quaternion& headRotation, const NormalizedCoordinate& viewportCoord)
@@ -0,0 +1,142 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Keeps track of how many seconds of tiled media are
+	buffered ahead of the playhead and lets the download
+	thread fetch segments until the target level is reached.
+	A seek moves the playhead to another segment, frames are
+	counted from the one displayed at the seek on. With a
+	memory limit the download thread also waits while the tile
+	streams hold more media than it.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <algorithm>
+#include <functional>
+
+#include "PlaybackEvents.hpp"
+
+class BufferManager
+{
+public:
+	BufferManager(PlaybackEvents& events, double segmentDuration, double frameRate, double targetSeconds)
+		: events(events), segmentDuration(segmentDuration), frameRate(frameRate)
+		, targetSeconds(std::max(targetSeconds, segmentDuration))
+		, bufferedSegments(0), fetches(0), playheadFrame(0), seekSegment(0), seekFrame(0), requestedSeek(-1)
+	{
+	}
+
+	// heldBytes sums the media of the tile streams, 0 bytes disables the limit. Set before the download thread starts
+	void setMemoryLimit(size_t bytes, std::function<size_t()> heldBytes)
+	{
+		memoryLimit = bytes;
+		mediaBytes = std::move(heldBytes);
+	}
+
+	size_t heldBytes() const
+	{
+		return mediaBytes ? mediaBytes() : 0;
+	}
+
+	// called by the render thread for every displayed frame
+	void setPlayheadFrame(size_t frame)
+	{
+		playheadFrame = frame;
+		events.signal(PlaybackEvents::FrameDisplayed, frame);
+		// the value tells after how many fetched segments the level dropped to the target
+		if (bufferLevel() <= targetSeconds)
+			events.signal(PlaybackEvents::BufferBelowTarget, fetches);
+	}
+
+	// all tiles of segment have been downloaded
+	void segmentBuffered(int segment)
+	{
+		bufferedSegments = std::max(bufferedSegments.load(), segment + 1);
+		events.signal(PlaybackEvents::SegmentComplete, ++fetches);
+	}
+
+	double playheadSeconds() const
+	{
+		return seekSegment * segmentDuration + (playheadFrame - seekFrame) / frameRate;
+	}
+
+	// asks the download thread to continue at segment, a pending request is replaced [any thread]
+	void requestSeek(int segment)
+	{
+		requestedSeek = segment;
+		// wakes the download thread waiting for room
+		events.signal(PlaybackEvents::BufferBelowTarget, fetches);
+	}
+
+	// a seek waits to be taken
+	bool seekRequested() const
+	{
+		return requestedSeek >= 0;
+	}
+
+	// the segment of the last seek request, -1 if there is none
+	int takeSeek()
+	{
+		return requestedSeek.exchange(-1);
+	}
+
+	// the segment plays from the frame displayed now on, nothing after it is buffered yet
+	void seek(int segment)
+	{
+		seekFrame = playheadFrame.load();
+		seekSegment = segment;
+		bufferedSegments = segment;
+	}
+
+	// seconds of media downloaded but not yet displayed
+	double bufferLevel() const
+	{
+		return std::max(0.0, bufferedSegments * segmentDuration - playheadSeconds());
+	}
+
+	double target() const
+	{
+		return targetSeconds;
+	}
+
+	// block until the buffer level has drained to the target and the streams hold less than the memory limit,
+	// false if playback was stopped. The limit never holds back the segment after the one playing
+	bool waitForRoom() const
+	{
+		while (requestedSeek < 0)
+		{
+			if (bufferLevel() > targetSeconds)
+			{
+				if (!events.wait(PlaybackEvents::BufferBelowTarget, fetches))
+					return false;
+			}
+			else if (memoryLimit > 0 && bufferLevel() > segmentDuration && heldBytes() >= memoryLimit)
+			{
+				// the decoder frees what it has read, displayed frames tell it moved on
+				if (!events.wait(PlaybackEvents::FrameDisplayed, events.value(PlaybackEvents::FrameDisplayed) + 1))
+					return false;
+			}
+			else
+				break;
+		}
+		return true;
+	}
+
+private:
+	PlaybackEvents& events;
+	const double segmentDuration;
+	const double frameRate;
+	const double targetSeconds;
+	std::atomic<int> bufferedSegments;
+	// segments fetched since the start, counts on over seeks
+	std::atomic<long long> fetches;
+	std::atomic<size_t> playheadFrame;
+	std::atomic<int> seekSegment;
+	std::atomic<size_t> seekFrame;
+	std::atomic<int> requestedSeek;
+	size_t memoryLimit = 0;
+	std::function<size_t()> mediaBytes;
+};
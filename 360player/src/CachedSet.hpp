@@ -0,0 +1,85 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	The representations the edge cache holds, polled from 360cache
+	(/_cache/cached) a window of segments ahead of the adaption. The
+	answer has one bitmap per segment with a bit per tile and quality,
+	which tells the allocator before the download which tiles come at
+	the speed of the cache and which from the origin.
+*/
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+#include "mpd.h"
+#include "httplib.h"
+
+class CachedSet
+{
+public:
+	CachedSet(const DASH::MPD* mpd, const std::string& mpdUri)
+		: mpd(mpd), path("/_cache/cached" + mpdUri)
+	{
+	}
+
+	// replaces what is known of the segments [first, first + count) [adaption thread]
+	bool sync(httplib::Client* client, int first, int count)
+	{
+		auto res = client->Get((path + "?first=" + std::to_string(first) + "&count=" + std::to_string(count)).c_str());
+		if (!res || res->status != 200)
+			return false;
+		segments.erase(segments.lower_bound(first), segments.lower_bound(first + count));
+		parse(res->body);
+		return true;
+	}
+
+	// false as well for segments not polled yet
+	bool contains(int segment, int tile, int quality) const
+	{
+		auto it = segments.find(segment);
+		size_t bit = (size_t)tile * representations() + quality;
+		return it != segments.end() && bit < it->second.size() && it->second[bit];
+	}
+
+private:
+	const DASH::MPD* mpd;
+	std::string path;
+	std::map<int, std::vector<bool>> segments;
+
+	size_t representations() const
+	{
+		size_t count = 0;
+		for (auto& set : mpd->period.adaptationSets)
+			count = std::max(count, set.representations.size());
+		return count;
+	}
+
+	// lines "segment bitmap", the bitmap in hex digits of four bits each, lowest bit first
+	void parse(const std::string& text)
+	{
+		std::istringstream lines(text);
+		std::string line;
+		while (std::getline(lines, line))
+		{
+			std::istringstream ls(line);
+			int segment;
+			std::string hex;
+			if (!(ls >> segment >> hex))
+				continue;
+			auto& bits = segments[segment];
+			bits.assign(hex.size() * 4, false);
+			for (size_t i = 0; i < hex.size(); i++)
+			{
+				char c = hex[i];
+				int nibble = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : 0;
+				for (int b = 0; b < 4; b++)
+					bits[i * 4 + b] = (nibble >> b & 1) != 0;
+			}
+		}
+	}
+};
@@ -4,7 +4,10 @@
 */
 #pragma once
 
+#include <map>
+#include <algorithm>
 #include <string>
+#include <thread>
 #include <stdexcept>
 #include "IniReader.hpp"
 
@@ -17,6 +20,8 @@ public:
 		INIReader ini(path);
 
 		std::string playConfig = ini.Get("Config", "playConfig", "");
+		perPixelProjection = ini.GetBoolean("Config", "perPixelProjection", true);
+		singlePassStereo = ini.GetBoolean("Config", "singlePassStereo", false);
 		std::string typeStr = ini.Get(playConfig, "type", "");
 
 		if (typeStr == "dash")
@@ -26,11 +31,59 @@ public:
 			squidPort = ini.GetInteger(playConfig, "squidPort", 3128);
 			mpdUri = ini.Get(playConfig, "mpdUri", "");
 			viewportPrediction = ini.GetBoolean(playConfig, "viewportPrediction", true);
+			predictor = ini.Get(playConfig, "predictor", "regression");
+			sampleResolution = ini.GetInteger(playConfig, "sampleResolution", 8);
+			solidAngleWeighting = ini.GetBoolean(playConfig, "solidAngleWeighting", false);
+			visibilityCacheStep = ini.GetReal(playConfig, "visibilityCacheStep", 0.005);
+			visibilityCacheSize = ini.GetInteger(playConfig, "visibilityCacheSize", 4096);
 			popularity = ini.GetBoolean(playConfig, "popularity", true);
 			transitions = ini.GetBoolean(playConfig, "transitions", true);
+			blendedTransitions = ini.GetBoolean(playConfig, "blendedTransitions", false);
+			livePopularity = ini.GetBoolean(playConfig, "livePopularity", false);
+			livePopularityInterval = ini.GetInteger(playConfig, "livePopularityInterval", 4);
+			cacheAware = ini.GetBoolean(playConfig, "cacheAware", false);
+			cacheAwareWindow = ini.GetInteger(playConfig, "cacheAwareWindow", 2);
 			demo = ini.GetBoolean(playConfig, "demo", false);
 			monitor = ini.GetBoolean(playConfig, "monitor", false);
 			monitorttf = ini.Get(playConfig, "monitorttf", "");
+			numConnections = ini.GetInteger(playConfig, "numConnections", 4);
+			tilesPerRequest = ini.GetInteger(playConfig, "tilesPerRequest", 1);
+			keepAlive = ini.GetBoolean(playConfig, "keepAlive", true);
+			pipelineDepth = ini.GetInteger(playConfig, "pipelineDepth", 1);
+			http2 = ini.GetBoolean(playConfig, "http2", false);
+			bufferSeconds = ini.GetReal(playConfig, "bufferSeconds", 2.0);
+			qualityUpgrades = ini.GetBoolean(playConfig, "qualityUpgrades", false);
+			mediaMemoryMB = ini.GetInteger(playConfig, "mediaMemoryMB", 0);
+			estimator = ini.Get(playConfig, "estimator", "harmonic");
+			estimatorWindow = ini.GetInteger(playConfig, "estimatorWindow", 5);
+			estimatorAlpha = ini.GetReal(playConfig, "estimatorAlpha", 0.3);
+			safetyFactor = ini.GetReal(playConfig, "safetyFactor", 0.75);
+			decodeBudget = ini.GetReal(playConfig, "decodeBudget", 0.8);
+			allocator = ini.Get(playConfig, "allocator", "knapsack");
+			decoderThreads = ini.GetInteger(playConfig, "decoderThreads", 0);
+			avioBufferKB = ini.GetInteger(playConfig, "avioBufferKB", 0);
+			pinDecoderThreads = ini.GetBoolean(playConfig, "pinDecoderThreads", false);
+			mergeEarly = ini.GetBoolean(playConfig, "mergeEarly", true);
+			directTileUpload = ini.GetBoolean(playConfig, "directTileUpload", true);
+			pboUpload = ini.GetBoolean(playConfig, "pboUpload", true);
+			hwaccel = ini.Get(playConfig, "hwaccel", "none");
+			decodeSkipping = ini.GetBoolean(playConfig, "decodeSkipping", true);
+			decodeMargin = ini.GetReal(playConfig, "decodeMargin", 0.5);
+			frameSkipping = ini.GetBoolean(playConfig, "frameSkipping", true);
+			headless = ini.GetBoolean(playConfig, "headless", false);
+			displayRate = ini.GetReal(playConfig, "displayRate", 90.0);
+			poseRate = ini.GetReal(playConfig, "poseRate", 250.0);
+			traceFile = ini.Get(playConfig, "traceFile", "");
+			recordSession = ini.Get(playConfig, "recordSession", "");
+			replaySession = ini.Get(playConfig, "replaySession", "");
+			metricsPort = ini.GetInteger(playConfig, "metricsPort", 0);
+			liveDelay = ini.GetReal(playConfig, "liveDelay", -1);
+			chunkedTransfer = ini.GetBoolean(playConfig, "chunkedTransfer", false);
+			fastStart = ini.GetBoolean(playConfig, "fastStart", false);
+			initCacheDir = ini.Get(playConfig, "initCacheDir", "");
+			startTime = ini.GetReal(playConfig, "startTime", 0);
+			segmentCacheDir = ini.Get(playConfig, "segmentCacheDir", "");
+			segmentCacheMB = ini.GetInteger(playConfig, "segmentCacheMB", 2000);
 		}
 		else if (typeStr == "picture")
 		{
@@ -42,25 +95,142 @@ public:
 
 		headtracePath = ini.Get("Headtrace", "path", "");
 		useHeadtrace = ini.GetBoolean("Headtrace", "useTrace", false);
+
+		for (auto role : { "render", "adaption", "download", "decoder", "decoderWorkers", "poses", "monitor" })
+		{
+			std::string name(role);
+			threads[name] = { ini.Get("Threads", name + "Cores", ""), ini.Get("Threads", name + "Priority", "normal"),
+				ini.GetBoolean("Threads", name + "Realtime", false) };
+		}
+		tileDecoderThreads = ini.GetInteger("Threads", "tileDecoderThreads", 0);
+		// pinDecoderThreads puts decoder worker i on core i + 1 unless the section names their cores
+		if (playType == PlayType::Dash && pinDecoderThreads && threads["decoderWorkers"].cores.empty())
+			threads["decoderWorkers"].cores = "1-" + std::to_string(std::max(1, int(std::thread::hardware_concurrency())) - 1) + ",0";
 	}
 
+	// placement of the threads of a role, see ThreadTopology.hpp
+	struct ThreadPlacement
+	{
+		// cores like "0,2-3", empty for all cores of the process
+		std::string cores;
+		// idle, low, normal, high or highest
+		std::string priority = "normal";
+		bool realtime = false;
+	};
+
 	PlayType playType;
+	// the sphere is projected per pixel on one triangle per eye, false draws the indexed cube mesh with UVs
+	bool perPixelProjection;
+	// both eyes are drawn in one instanced pass and handed to RenderManager to present, false renders through its
+	// callbacks once per eye
+	bool singlePassStereo;
 
 	std::string squidAddress;
 	int squidPort;
 	std::string mpdUri;
 	bool viewportPrediction;
+	// regression, velocity or kalman
+	std::string predictor;
+	// the viewport is sampled with (sampleResolution + 1)^2 points
+	int sampleResolution;
+	bool solidAngleWeighting;
+	// quantization of the cached head rotations per quaternion component, 0 disables the cache
+	double visibilityCacheStep;
+	int visibilityCacheSize;
 	bool popularity;
 	bool transitions;
+	// the popularity is weighed into every tile's utility by how unsure the prediction is, instead of replacing the
+	// allocation once it exceeds the budget
+	bool blendedTransitions;
+	// the popularity of the current audience from 360server replaces the MPD's for the segments it covers,
+	// this session's viewing is uploaded to it every livePopularityInterval segments
+	bool livePopularity;
+	int livePopularityInterval;
+	// squidAddress is 360cache, which is asked every cacheAwareWindow segments which representations it holds for
+	// them; the allocator charges those at the cache's throughput
+	bool cacheAware;
+	int cacheAwareWindow;
 	bool demo;
 	bool monitor;
 	std::string monitorttf;
+	int numConnections;
+	// tiles of a segment fetched with one batch request, 1 requests every tile on its own
+	int tilesPerRequest;
+	// the download connections stay open across requests and segments
+	bool keepAlive;
+	// tiles a connection requests before reading the first answer, with keepAlive and tilesPerRequest=1
+	int pipelineDepth;
+	// the tiles are streams of one HTTP/2 connection to squidAddress, which must then be 360cache or 360server
+	bool http2;
+	double bufferSeconds;
+	// while the buffer is above bufferSeconds, tiles of buffered segments the decoder has not reached are fetched again
+	// in the quality the current prediction gives them
+	bool qualityUpgrades;
+	// media the tile streams may hold before prefetching waits, 0 for no limit
+	int mediaMemoryMB;
+	std::string estimator;
+	int estimatorWindow;
+	double estimatorAlpha;
+	double safetyFactor;
+	// share of the decoder threads' time per frame the chosen qualities may need, 0 plans without the decode cost
+	double decodeBudget;
+	// knapsack or greedy
+	std::string allocator;
+	// 0 uses one decoder thread per core
+	int decoderThreads;
+	// demuxer buffer per tile, 0 sizes it from the bitrate of the tile's best representation
+	int avioBufferKB;
+	bool pinDecoderThreads;
+	bool mergeEarly;
+	bool directTileUpload;
+	bool pboUpload;
+	// libav hwdevice name (d3d11va, dxva2, cuda, vaapi, ...) or none
+	std::string hwaccel;
+	// tiles outside the viewport enlarged by decodeMargin are only decoded on keyframes
+	bool decodeSkipping;
+	double decodeMargin;
+	// frames the decoder would finish too late are not merged, and a slow decoder leaves out the loop filter of
+	// non-reference frames
+	bool frameSkipping;
+	// play without OpenGL and HMD, frames are consumed at displayRate and the stream statistics printed
+	bool headless;
+	double displayRate;
+	// head rotations sampled per second on a thread of their own, 0 takes the pose of every other eye drawn
+	double poseRate;
+	// Chrome trace of the pipeline stages written at the end of the session, empty disables tracing
+	std::string traceFile;
+	// session log of the poses, requests and decode times written to recordSession, or read from replaySession to
+	// play the session again with its inputs. Empty disables them, a replay leaves out the recording
+	std::string recordSession;
+	std::string replaySession;
+	// port of the Prometheus endpoint /metrics on localhost, 0 disables it
+	int metricsPort;
+	// seconds behind the live edge a dynamic MPD is joined at, negative takes its suggestedPresentationDelay
+	// or two segments
+	double liveDelay;
+	// segments go to the decoder while they are downloaded instead of once they are complete, for the chunks
+	// of live segments available before they are encoded to the end. Not with tilesPerRequest > 1
+	bool chunkedTransfer;
+	// the first segment is fetched in the lowest quality for every tile, the viewport tiles first
+	bool fastStart;
+	// folder the init segments are kept in between sessions, empty fetches them every time
+	std::string initCacheDir;
+	// seconds into an on demand video playback starts at, rounded down to the start of its segment
+	double startTime;
+	// folder the segments are kept in between sessions, up to segmentCacheMB, empty requests every segment
+	std::string segmentCacheDir;
+	int segmentCacheMB;
 
 	std::string imgPath;
 
 	std::string headtracePath;
 	bool useHeadtrace;
 
+	// [Threads] section by role: render, adaption, download, decoder, decoderWorkers, poses and monitor
+	std::map<std::string, ThreadPlacement> threads;
+	// libav threads inside the decoder of one tile, 0 takes one, or two with a single decoder thread
+	int tileDecoderThreads;
+
 	static Config* instance()
 	{
 		if (!_instance)
@@ -0,0 +1,81 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Tracks tile transfers of the current segment against
+	its playout deadline. A transfer whose projected finish
+	lies behind the deadline is reported so it can be aborted
+	and re-requested in a lower representation.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#define SCHEDULER_NOW_MS std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count()
+
+class DeadlineScheduler
+{
+public:
+	// transfers are only judged after this much data or time, the first bytes are dominated by latency
+	static constexpr uint64_t minBytesForProjection = 32 * 1024;
+	static constexpr long long minMsForProjection = 100;
+
+	DeadlineScheduler()
+		: segmentDeadline(0), missProjected(false)
+	{
+	}
+
+	void startSegment(long long startMs, double budgetMs)
+	{
+		segmentDeadline = startMs + (long long)budgetMs;
+		missProjected = false;
+	}
+
+	long long deadline() const
+	{
+		return segmentDeadline;
+	}
+
+	long long remainingMs() const
+	{
+		return segmentDeadline - SCHEDULER_NOW_MS;
+	}
+
+	bool deadlinePassed() const
+	{
+		return remainingMs() <= 0;
+	}
+
+	// true once any transfer of the current segment was projected to miss the deadline
+	bool segmentAtRisk() const
+	{
+		return missProjected;
+	}
+
+	// progress check for a running transfer, false if it will not finish before the deadline
+	bool onTrack(long long transferStartMs, uint64_t current, uint64_t total)
+	{
+		auto now = SCHEDULER_NOW_MS;
+		auto elapsed = now - transferStartMs;
+		if (current >= total || (current < minBytesForProjection && elapsed < minMsForProjection))
+			return true;
+
+		if (elapsed <= 0)
+			return true;
+
+		double bytesPerMs = current / (double)elapsed;
+		double projectedFinish = now + (total - current) / bytesPerMs;
+		if (projectedFinish <= segmentDeadline)
+			return true;
+
+		missProjected = true;
+		return false;
+	}
+
+private:
+	std::atomic<long long> segmentDeadline;
+	std::atomic<bool> missProjected;
+};
@@ -0,0 +1,109 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Decode cost of the tile representations. The decoder reports the
+	time each tile frame took with its pixels and coded bytes, and a
+	least squares fit of ms = a * pixels + b * bytes, weighted towards
+	the recent frames, predicts what a representation costs per frame
+	from its resolution and segment size. The decoder threads together
+	have capacityMs of decode time per displayed frame, the adaption
+	keeps its choice of qualities within a share of that.
+*/
+
+#pragma once
+
+#include <mutex>
+#include <cstddef>
+
+class DecodeCostModel
+{
+public:
+	static DecodeCostModel& instance()
+	{
+		static DecodeCostModel model;
+		return model;
+	}
+
+	// [decoder thread] once the frame rate and the number of decoder threads are known
+	void setCapacity(double frameMs, size_t threads)
+	{
+		std::lock_guard<std::mutex> l(mtx);
+		capacity = frameMs * threads;
+	}
+
+	// a decoded tile frame [decoder threads]
+	void add(double pixels, double bytes, double ms)
+	{
+		// megapixels and kilobytes keep the sums of the normal equations in a similar range
+		double p = pixels / 1e6, b = bytes / 1e3;
+		std::lock_guard<std::mutex> l(mtx);
+		const double keep = 1.0 - 1.0 / kWindow;
+		spp = spp * keep + p * p;
+		spb = spb * keep + p * b;
+		sbb = sbb * keep + b * b;
+		spt = spt * keep + p * ms;
+		sbt = sbt * keep + b * ms;
+		samples++;
+		fit();
+	}
+
+	// enough tile frames were decoded for a prediction
+	bool ready() const
+	{
+		std::lock_guard<std::mutex> l(mtx);
+		return samples >= kMinSamples && capacity > 0;
+	}
+
+	// predicted ms to decode one frame of a tile representation
+	double frameMs(double pixels, double bytes) const
+	{
+		std::lock_guard<std::mutex> l(mtx);
+		return perMegapixel * pixels / 1e6 + perKilobyte * bytes / 1e3;
+	}
+
+	// decode time all decoder threads have per displayed frame
+	double capacityMs() const
+	{
+		std::lock_guard<std::mutex> l(mtx);
+		return capacity;
+	}
+
+private:
+	// tile frames a sample takes to lose most of its weight, a few seconds of all tiles
+	static constexpr double kWindow = 2000;
+	static const size_t kMinSamples = 200;
+
+	mutable std::mutex mtx;
+	double capacity = 0;
+	double spp = 0, spb = 0, sbb = 0, spt = 0, sbt = 0;
+	size_t samples = 0;
+	double perMegapixel = 0, perKilobyte = 0;
+
+	// solves the normal equations. A coefficient the data would make negative is left out and the other one fitted alone
+	void fit()
+	{
+		double det = spp * sbb - spb * spb;
+		if (det > 1e-9 * spp * sbb)
+		{
+			perMegapixel = (spt * sbb - sbt * spb) / det;
+			perKilobyte = (sbt * spp - spt * spb) / det;
+		}
+		else
+		{
+			perMegapixel = spp > 0 ? spt / spp : 0;
+			perKilobyte = 0;
+		}
+
+		if (perMegapixel < 0)
+		{
+			perMegapixel = 0;
+			perKilobyte = sbb > 0 ? sbt / sbb : 0;
+		}
+		else if (perKilobyte < 0)
+		{
+			perKilobyte = 0;
+			perMegapixel = spp > 0 ? spt / spp : 0;
+		}
+	}
+};
@@ -0,0 +1,121 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Bounded pool of http clients that fetch tiles in parallel.
+	Jobs are started in the order they were enqueued, so the
+	tile download order chosen by the adaption unit is kept.
+	With keep-alive every worker keeps its connection across jobs
+	and segments. With a transport the workers send their requests
+	through it instead, e.g. as the streams of one HTTP/2 connection.
+*/
+
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+
+#include "httplib.h"
+#include "Trace.hpp"
+#include "ThreadTopology.hpp"
+
+class DownloadPool
+{
+public:
+	// job receives the client of the worker running it and the worker index
+	typedef std::function<void(httplib::Client*, size_t)> Job;
+
+	DownloadPool(const std::string& host, int port, size_t numConnections, bool proxyServer = true, bool keepAlive = false,
+		std::shared_ptr<httplib::Transport> transport = nullptr)
+		: pending(0), stopped(false)
+	{
+		if (numConnections == 0)
+			numConnections = 1;
+
+		for (size_t i = 0; i < numConnections; i++)
+		{
+			clients.emplace_back(new httplib::Client(host.c_str(), port));
+			clients.back()->proxyServer = proxyServer;
+			clients.back()->set_keep_alive(keepAlive);
+			clients.back()->set_transport(transport);
+		}
+
+		for (size_t i = 0; i < numConnections; i++)
+			workers.emplace_back(&DownloadPool::worker, this, i);
+	}
+
+	~DownloadPool()
+	{
+		{
+			std::lock_guard<std::mutex> l(mtx);
+			stopped = true;
+		}
+		cv.notify_all();
+		for (auto& w : workers)
+			if (w.joinable())
+				w.join();
+	}
+
+	size_t size() const
+	{
+		return clients.size();
+	}
+
+	void enqueue(Job job)
+	{
+		{
+			std::lock_guard<std::mutex> l(mtx);
+			jobs.push_back(std::move(job));
+			pending++;
+		}
+		cv.notify_one();
+	}
+
+	// block until every enqueued job has finished
+	void wait()
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		cvDone.wait(lock, [this] { return pending == 0; });
+	}
+
+private:
+	std::vector<std::unique_ptr<httplib::Client>> clients;
+	std::vector<std::thread> workers;
+	std::deque<Job> jobs;
+	size_t pending;
+	bool stopped;
+	std::mutex mtx;
+	std::condition_variable cv;
+	std::condition_variable cvDone;
+
+	void worker(size_t index)
+	{
+		Trace::nameThread("download " + std::to_string(index));
+		ThreadTopology::apply("download");
+		while (true)
+		{
+			Job job;
+			{
+				std::unique_lock<std::mutex> lock(mtx);
+				cv.wait(lock, [this] { return stopped || !jobs.empty(); });
+				if (stopped && jobs.empty())
+					return;
+				job = std::move(jobs.front());
+				jobs.pop_front();
+			}
+
+			job(clients[index].get(), index);
+
+			{
+				std::lock_guard<std::mutex> l(mtx);
+				pending--;
+			}
+			cvDone.notify_all();
+		}
+	}
+};
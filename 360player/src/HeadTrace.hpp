@@ -1,46 +1,82 @@
 /*
 	Author: Arne-Tobias Rak
 	TU Darmstadt
+
+	Head rotations of a trace by timestamp. A trace is taken from the
+	corpus next to its text file (see TraceCorpus.hpp) when one holds
+	it, otherwise the text file is parsed. Many timestamps are looked
+	up in one pass and interpolated together with QuaternionBatch.
 */
 #pragma once
 
 #include "Quaternion.hpp"
-#include <sstream>
-#include <fstream>
+#include "QuaternionBatch.hpp"
+#include "TraceCorpus.hpp"
+#include <vector>
+#include <algorithm>
+#include "Log.hpp"
 
 using namespace IMT;
 
 class HeadTrace
 {
 public:
-	HeadTrace(const char* path)
+	HeadTrace(const char* path) : trace(TraceCorpus::find(path))
 	{
-		std::ifstream file(path);
-
-		if (file)
+		if (trace.count == 0)
 		{
-			std::stringstream ss;
-			ss << file.rdbuf();
-			file.close();
-
-			std::string line;
-			while (!std::getline(ss, line).eof())
-			{
-				double timestamp, w, x, y, z;
-				ss >> timestamp >> w >> w >> x >> y >> z;
-				headRotations[timestamp] = Quaternion(w, x, y, z);
-			}
+			auto samples = std::make_shared<TraceCorpus::Samples>(TraceCorpus::parseText(path));
+			trace = { samples, samples->t.data(), samples->w.data(), samples->x.data(), samples->y.data(), samples->z.data(), samples->t.size() };
 		}
-		else
+		if (trace.count == 0)
 		{
-			std::cout << "Headtrace file not found!" << std::endl;
+			LOG_ERROR("Headtrace file not found!");
 		}
 	}
 
-	const Quaternion& rotationForTimestamp(double timestamp)
+	// rotation of the first sample at or after timestamp, the last one after the end of the trace
+	Quaternion rotationForTimestamp(double timestamp) const
+	{
+		if (trace.count == 0)
+			return Quaternion(1, 0, 0, 0);
+		size_t i = std::min<size_t>(std::lower_bound(trace.t, trace.t + trace.count, timestamp) - trace.t, trace.count - 1);
+		return Quaternion(trace.w[i], trace.x[i], trace.y[i], trace.z[i]);
+	}
+
+	// rotations for ascending timestamps, found in a single pass over the samples like rotationForTimestamp;
+	// slerped between the samples around each timestamp if interpolate is set
+	QuaternionBatch::Quaternions rotationsForTimestamps(const std::vector<double>& timestamps, bool interpolate = false) const
 	{
-		return headRotations.lower_bound(timestamp)->second;
+		QuaternionBatch::Quaternions after(timestamps.size());
+		if (trace.count == 0)
+		{
+			for (size_t j = 0; j < timestamps.size(); j++)
+				after.set(j, Quaternion(1, 0, 0, 0));
+			return after;
+		}
+
+		// the sample before each timestamp, the one at or after it where there is none in between
+		QuaternionBatch::Quaternions before(interpolate ? timestamps.size() : 0);
+		std::vector<float> k(before.size());
+		size_t i = 0;
+		for (size_t j = 0; j < timestamps.size(); j++)
+		{
+			while (i + 1 < trace.count && trace.t[i] < timestamps[j])
+				i++;
+			after.set(j, Quaternion(trace.w[i], trace.x[i], trace.y[i], trace.z[i]));
+			if (!interpolate)
+				continue;
+			size_t b = i > 0 && trace.t[i] > timestamps[j] ? i - 1 : i;
+			before.set(j, Quaternion(trace.w[b], trace.x[b], trace.y[b], trace.z[b]));
+			k[j] = b == i ? 1.0f : float((timestamps[j] - trace.t[b]) / (trace.t[i] - trace.t[b]));
+		}
+		if (!interpolate)
+			return after;
+
+		QuaternionBatch::Quaternions rotations;
+		QuaternionBatch::slerp(before, after, k.data(), rotations);
+		return rotations;
 	}
 private:
-	std::map<double, Quaternion> headRotations;
-};
\ No newline at end of file
+	TraceCorpus::Trace trace;
+};
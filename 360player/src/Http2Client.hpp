@@ -0,0 +1,609 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	HTTP/2 transport of the http clients. The requests of all clients
+	sharing it are streams of one cleartext connection to a server
+	known to speak HTTP/2 (h2c with prior knowledge). A reader thread
+	takes the frames off the socket and queues the data of each
+	stream, the thread of the request reads it as the body and gives
+	the flow control window back as it does. Destroying the body
+	before its end resets the stream.
+
+	The rank of a request becomes its place in the dependency tree:
+	urgent streams depend exclusively on the open urgent stream of
+	the next lower rank, a chain the server serves one after the
+	other. The others depend on the end of that chain and share what
+	it leaves, with weights falling with their rank. A connection the
+	server closed is opened again by the next request.
+*/
+
+#pragma once
+
+#include <map>
+#include <deque>
+#include <cstdint>
+#include <algorithm>
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <condition_variable>
+
+#ifndef _WIN32
+#include <netinet/tcp.h>
+#endif
+
+#include "httplib.h"
+#include "Http2.hpp"
+#include "Log.hpp"
+#include "Trace.hpp"
+#include "ThreadTopology.hpp"
+
+class Http2Client : public httplib::Transport
+{
+public:
+	// flow control windows given to the server, large enough that a tile is not held back while it is read
+	static const uint32_t streamWindow = 1 << 20;
+	static const uint32_t connectionWindow = 32 << 20;
+
+	Http2Client(const std::string& host, int port, size_t timeoutSec = 300)
+		: host(host), port(port), timeout(timeoutSec)
+	{
+	}
+
+	Http2Client(const Http2Client&) = delete;
+	Http2Client& operator=(const Http2Client&) = delete;
+
+	std::unique_ptr<httplib::Stream> open(httplib::Request& req, httplib::Response& res, int rank, bool urgent) override
+	{
+		// a request the server did not process, as it closed the connection first, is sent once more
+		bool idempotent = req.method == "GET" || req.method == "HEAD";
+		for (int attempt = 0; attempt < 2; attempt++)
+		{
+			auto conn = connection();
+			if (!conn)
+				return nullptr;
+			auto stream = conn->start(req, rank, urgent);
+			if (!stream)
+				continue;
+
+			std::unique_lock<std::mutex> lock(conn->mtx);
+			conn->cv.wait_for(lock, timeout, [&] { return stream->headers || stream->failed; });
+			if (stream->headers)
+			{
+				res.version = "HTTP/2";
+				res.status = stream->status;
+				res.headers = std::move(stream->fields);
+				return std::unique_ptr<httplib::Stream>(new BodyStream(conn, stream, timeout));
+			}
+			bool retry = stream->refused && idempotent;
+			lock.unlock();
+			conn->finish(stream);
+			if (!retry)
+				return nullptr;
+		}
+		return nullptr;
+	}
+
+private:
+	struct StreamState
+	{
+		uint32_t id;
+		int rank;
+		bool urgent;
+		// the window for the request body
+		int64_t sendWindow;
+		// status and headers of the answer arrived
+		bool headers = false;
+		int status = -1;
+		httplib::Headers fields;
+		// DATA not read yet, offset is the read position in the first one
+		std::deque<std::string> data;
+		size_t offset = 0;
+		bool ended = false;
+		bool failed = false;
+		// failed before the server processed it
+		bool refused = false;
+		// bytes read and not yet given back to the server's window
+		uint32_t unacked = 0;
+	};
+
+	class Connection
+	{
+	public:
+		std::mutex mtx;
+		std::condition_variable cv;
+		// no new streams: the reader has ended or the server sent GOAWAY
+		bool closed = false;
+
+		Connection(socket_t sock) : sock(sock)
+		{
+			std::string frames(http2::connectionPreface, http2::prefaceLength);
+			http2::appendSettings(frames, { { http2::EnablePush, 0 }, { http2::InitialWindowSize, streamWindow } });
+			http2::appendWindowUpdate(frames, 0, connectionWindow - http2::defaultWindow);
+			closed = !write(frames);
+			if (!closed)
+				reader = std::thread(&Connection::read, this);
+		}
+
+		~Connection()
+		{
+			httplib::detail::shutdown_socket(sock);
+			if (reader.joinable())
+				reader.join();
+			httplib::detail::close_socket(sock);
+		}
+
+		// sends the request on a new stream, nullptr if the connection takes no new ones
+		std::shared_ptr<StreamState> start(httplib::Request& req, int rank, bool urgent)
+		{
+			http2::HeaderList fields = { { ":method", req.method }, { ":scheme", "http" },
+				{ ":authority", req.get_header_value("Host") }, { ":path", httplib::detail::encode_url(req.path) } };
+			for (auto& field : req.headers)
+				if (!http2::isConnectionHeader(field.first))
+					fields.push_back(field);
+			if (!req.has_header("User-Agent"))
+				fields.push_back({ "user-agent", "cpp-httplib/0.2" });
+			if (!req.body.empty())
+			{
+				if (!req.has_header("Content-Type"))
+					fields.push_back({ "content-type", "text/plain" });
+				fields.push_back({ "content-length", std::to_string(req.body.size()) });
+			}
+			std::string block;
+			http2::HpackEncoder::encode(fields, block);
+
+			std::unique_lock<std::mutex> lock(mtx);
+			cv.wait(lock, [this] { return closed || streams.size() < peerMaxStreams; });
+			if (closed || nextStream > http2::maxWindow)
+			{
+				closed = true;
+				return nullptr;
+			}
+			auto stream = std::make_shared<StreamState>();
+			stream->id = nextStream;
+			nextStream += 2;
+			stream->rank = rank;
+			stream->urgent = urgent;
+			stream->sendWindow = peerInitialWindow;
+
+			auto priority = dependency(rank, urgent);
+			streams[stream->id] = stream;
+			std::string frames;
+			http2::appendHeaders(frames, stream->id, block, req.body.empty(), peerMaxFrame, &priority);
+			if (!write(frames))
+			{
+				fail();
+				return stream;
+			}
+
+			// the body as far as the windows allow, the rest once the server has given them back
+			size_t sent = 0;
+			while (sent < req.body.size())
+			{
+				cv.wait(lock, [&] { return stream->failed || (sendWindow > 0 && stream->sendWindow > 0); });
+				if (stream->failed)
+					break;
+				size_t chunk = std::min<size_t>({ req.body.size() - sent, size_t(sendWindow), size_t(stream->sendWindow), peerMaxFrame });
+				frames.clear();
+				http2::appendFrame(frames, http2::Data, sent + chunk == req.body.size() ? http2::EndStream : 0, stream->id,
+					req.body.data() + sent, chunk);
+				if (!write(frames))
+				{
+					fail();
+					break;
+				}
+				sendWindow -= chunk;
+				stream->sendWindow -= chunk;
+				sent += chunk;
+			}
+			return stream;
+		}
+
+		// bytes of stream taken from its DATA, 0 at the end of the body and -1 if it failed or nothing came within
+		// timeout [thread of the request]
+		int take(const std::shared_ptr<StreamState>& stream, char* ptr, size_t size, std::chrono::seconds timeout)
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			if (!cv.wait_for(lock, timeout, [&] { return !stream->data.empty() || stream->ended || stream->failed; }))
+				return -1;
+			if (stream->data.empty())
+				return stream->failed ? -1 : 0;
+
+			auto& front = stream->data.front();
+			size_t n = std::min(size, front.size() - stream->offset);
+			memcpy(ptr, front.data() + stream->offset, n);
+			stream->offset += n;
+			if (stream->offset == front.size())
+			{
+				stream->data.pop_front();
+				stream->offset = 0;
+			}
+
+			std::string frames;
+			stream->unacked += n;
+			if (!stream->ended && stream->unacked >= streamWindow / 2)
+			{
+				http2::appendWindowUpdate(frames, stream->id, stream->unacked);
+				stream->unacked = 0;
+			}
+			consumed(n, frames);
+			if (!frames.empty())
+				write(frames);
+			return (int)n;
+		}
+
+		// the request of stream is done, a stream still open is reset
+		void finish(const std::shared_ptr<StreamState>& stream)
+		{
+			std::lock_guard<std::mutex> l(mtx);
+			std::string frames;
+			if (!stream->ended && !stream->failed && !closed)
+				http2::appendRstStream(frames, stream->id, http2::Cancel);
+			// what was never read still counts against the connection window
+			size_t unread = 0;
+			for (auto& data : stream->data)
+				unread += data.size();
+			consumed(unread - stream->offset, frames);
+			stream->data.clear();
+			if (!frames.empty())
+				write(frames);
+			streams.erase(stream->id);
+			cv.notify_all();
+		}
+
+		// urgent streams chain in rank order, the others depend on the end of that chain
+		http2::StreamPriority dependency(int rank, bool urgent) const
+		{
+			http2::StreamPriority priority{ 0, urgent, urgent ? 256 : std::max(1, 32 - rank) };
+			int dependencyRank = 0;
+			for (auto& s : streams)
+			{
+				auto& other = *s.second;
+				if (!other.urgent || other.ended || other.failed || (urgent && other.rank > rank))
+					continue;
+				if (priority.dependency == 0 || other.rank >= dependencyRank)
+				{
+					priority.dependency = other.id;
+					dependencyRank = other.rank;
+				}
+			}
+			return priority;
+		}
+
+	private:
+		socket_t sock;
+		std::thread reader;
+		uint32_t nextStream = 1;
+		int64_t sendWindow = http2::defaultWindow;
+		uint32_t peerInitialWindow = http2::defaultWindow;
+		uint32_t peerMaxFrame = http2::defaultFrameSize;
+		size_t peerMaxStreams = SIZE_MAX;
+		// bytes of DATA done with and not yet given back to the connection window
+		size_t unacked = 0;
+		std::map<uint32_t, std::shared_ptr<StreamState>> streams;
+		http2::HpackDecoder decoder;
+		// header block arriving in CONTINUATION frames
+		uint32_t headerStream = 0;
+		bool headerEndStream = false;
+		std::string headerBlock;
+
+		// [mtx held or before the reader started]
+		bool write(const std::string& frames)
+		{
+			size_t sent = 0;
+			while (sent < frames.size())
+			{
+				auto n = send(sock, frames.data() + sent, (int)(frames.size() - sent), 0);
+				if (n <= 0)
+					return false;
+				sent += n;
+			}
+			return true;
+		}
+
+		// [mtx held]
+		void consumed(size_t bytes, std::string& frames)
+		{
+			unacked += bytes;
+			if (unacked >= connectionWindow / 2)
+			{
+				http2::appendWindowUpdate(frames, 0, (uint32_t)unacked);
+				unacked = 0;
+			}
+		}
+
+		// the connection is gone, streams without an answer yet may be sent on the next one [mtx held]
+		void fail()
+		{
+			closed = true;
+			for (auto& s : streams)
+			{
+				s.second->refused = s.second->refused || !s.second->headers;
+				s.second->failed = true;
+			}
+			cv.notify_all();
+		}
+
+		bool receive(char* ptr, size_t size)
+		{
+			size_t received = 0;
+			while (received < size)
+			{
+				auto n = recv(sock, ptr + received, (int)(size - received), 0);
+				if (n <= 0)
+					return false;
+				received += n;
+			}
+			return true;
+		}
+
+		void read()
+		{
+			Trace::nameThread("http2");
+			ThreadTopology::apply("download");
+			char head[http2::frameHeaderLength];
+			std::string payload;
+			while (receive(head, sizeof(head)))
+			{
+				auto frame = http2::parseFrameHeader(head);
+				// SETTINGS_MAX_FRAME_SIZE is left at its default
+				bool tooLarge = frame.length > http2::defaultFrameSize;
+				payload.resize(tooLarge ? 0 : frame.length);
+				if (tooLarge || !receive(&payload[0], frame.length))
+					break;
+
+				std::lock_guard<std::mutex> l(mtx);
+				auto error = handle(frame, payload);
+				if (error != http2::NoError)
+				{
+					LOG_ERROR("http2 connection error " << error);
+					std::string frames;
+					http2::appendGoAway(frames, 0, error);
+					write(frames);
+					break;
+				}
+			}
+			std::lock_guard<std::mutex> l(mtx);
+			fail();
+		}
+
+		// [mtx held]
+		uint32_t handle(const http2::FrameHeader& frame, const std::string& payload)
+		{
+			if (headerStream != 0 && (frame.type != http2::Continuation || frame.stream != headerStream))
+				return http2::ProtocolError;
+
+			auto it = streams.find(frame.stream);
+			auto stream = it != streams.end() && frame.stream != 0 ? it->second : nullptr;
+			const char* data = payload.data();
+			size_t length = 0;
+			std::string frames;
+			switch (frame.type)
+			{
+			case http2::Data:
+				if (!http2::framePayload(frame, data, length))
+					return http2::ProtocolError;
+				// padding and the data of reset streams are given back right away
+				if (stream && !stream->ended && !stream->failed)
+				{
+					consumed(frame.length - length, frames);
+					if (length > 0)
+						stream->data.emplace_back(data, length);
+					stream->ended = (frame.flags & http2::EndStream) != 0;
+				}
+				else
+					consumed(frame.length, frames);
+				break;
+
+			case http2::Headers:
+				if (!http2::framePayload(frame, data, length))
+					return http2::ProtocolError;
+				headerStream = frame.stream;
+				headerEndStream = (frame.flags & http2::EndStream) != 0;
+				headerBlock.assign(data, length);
+				if (frame.flags & http2::EndHeaders)
+					return headersDone();
+				break;
+
+			case http2::Continuation:
+				if (headerStream == 0)
+					return http2::ProtocolError;
+				headerBlock += payload;
+				if (frame.flags & http2::EndHeaders)
+					return headersDone();
+				break;
+
+			case http2::RstStream:
+				if (payload.size() != 4)
+					return http2::FrameSizeError;
+				if (stream)
+				{
+					stream->failed = true;
+					stream->refused = http2::getUint32(data) == http2::RefusedStream;
+				}
+				break;
+
+			case http2::Settings:
+			{
+				if (frame.flags & http2::Ack)
+					break;
+				http2::SettingList settings;
+				if (!http2::parseSettings(data, payload.size(), settings))
+					return http2::FrameSizeError;
+				for (auto& setting : settings)
+				{
+					if (setting.first == http2::InitialWindowSize)
+					{
+						if (setting.second > http2::maxWindow)
+							return http2::FlowControlError;
+						for (auto& s : streams)
+							s.second->sendWindow += int64_t(setting.second) - peerInitialWindow;
+						peerInitialWindow = setting.second;
+					}
+					else if (setting.first == http2::MaxFrameSize)
+						peerMaxFrame = std::max(http2::defaultFrameSize, std::min<uint32_t>(setting.second, 0xffffff));
+					else if (setting.first == http2::MaxConcurrentStreams)
+						peerMaxStreams = setting.second;
+				}
+				http2::appendFrame(frames, http2::Settings, http2::Ack, 0);
+				break;
+			}
+
+			case http2::Ping:
+				if (payload.size() != 8)
+					return http2::FrameSizeError;
+				if (!(frame.flags & http2::Ack))
+					http2::appendFrame(frames, http2::Ping, http2::Ack, 0, data, payload.size());
+				break;
+
+			case http2::GoAway:
+			{
+				if (payload.size() < 8)
+					return http2::FrameSizeError;
+				// streams above the last one the server processed may be sent again
+				auto last = http2::getUint32(data) & 0x7fffffff;
+				closed = true;
+				for (auto& s : streams)
+					if (s.first > last)
+						s.second->failed = s.second->refused = true;
+				break;
+			}
+
+			case http2::WindowUpdate:
+			{
+				if (payload.size() != 4)
+					return http2::FrameSizeError;
+				auto increment = http2::getUint32(data) & 0x7fffffff;
+				if (frame.stream == 0)
+					sendWindow += increment;
+				else if (stream)
+					stream->sendWindow += increment;
+				break;
+			}
+
+			case http2::PushPromise:
+				// SETTINGS_ENABLE_PUSH is 0
+				return http2::ProtocolError;
+
+			default:
+				// PRIORITY and frames of extensions are not for a client to act on
+				break;
+			}
+
+			if (!frames.empty())
+				write(frames);
+			cv.notify_all();
+			return http2::NoError;
+		}
+
+		// a complete header block, also decoded for streams given up as it changes the decoder's table [mtx held]
+		uint32_t headersDone()
+		{
+			auto id = headerStream;
+			headerStream = 0;
+			http2::HeaderList fields;
+			if (!decoder.decode(headerBlock.data(), headerBlock.size(), fields))
+				return http2::CompressionError;
+
+			auto it = streams.find(id);
+			if (it == streams.end())
+				return http2::NoError;
+			auto& stream = *it->second;
+			if (!stream.headers)
+			{
+				int status = -1;
+				httplib::Headers headers;
+				for (auto& field : fields)
+				{
+					if (field.first == ":status")
+						status = std::atoi(field.second.c_str());
+					else if (!field.first.empty() && field.first[0] != ':')
+						headers.emplace(field.first, field.second);
+				}
+				// an interim answer is followed by the final one
+				if (status >= 100 && status < 200)
+					return http2::NoError;
+				stream.status = status;
+				stream.fields = std::move(headers);
+				stream.headers = true;
+			}
+			stream.ended = stream.ended || headerEndStream;
+			cv.notify_all();
+			return http2::NoError;
+		}
+	};
+
+	// the body of one answer
+	class BodyStream : public httplib::Stream
+	{
+	public:
+		BodyStream(std::shared_ptr<Connection> conn, std::shared_ptr<StreamState> stream, std::chrono::seconds timeout)
+			: conn(std::move(conn)), stream(std::move(stream)), timeout(timeout)
+		{
+		}
+
+		~BodyStream()
+		{
+			conn->finish(stream);
+		}
+
+		int read(char* ptr, size_t size) override
+		{
+			return conn->take(stream, ptr, size, timeout);
+		}
+
+		int write(const char*, size_t) override { return -1; }
+		int write(const char*) override { return -1; }
+		std::string get_remote_addr() override { return ""; }
+
+	private:
+		std::shared_ptr<Connection> conn;
+		std::shared_ptr<StreamState> stream;
+		std::chrono::seconds timeout;
+	};
+
+	std::string host;
+	int port;
+	std::chrono::seconds timeout;
+	std::mutex mtx;
+	std::shared_ptr<Connection> current;
+
+	// the open connection, a new one if the last has closed
+	std::shared_ptr<Connection> connection()
+	{
+		std::lock_guard<std::mutex> l(mtx);
+		if (current)
+		{
+			std::lock_guard<std::mutex> cl(current->mtx);
+			if (!current->closed)
+				return current;
+		}
+
+		auto timeoutSec = (size_t)timeout.count();
+		auto sock = httplib::detail::create_socket(host.c_str(), port, [=](socket_t sock, struct addrinfo& ai) -> bool
+		{
+			httplib::detail::set_nonblocking(sock, true);
+			auto ret = connect(sock, ai.ai_addr, ai.ai_addrlen);
+			if (ret < 0 && (httplib::detail::is_connection_error() || !httplib::detail::wait_until_socket_is_ready(sock, timeoutSec, 0)))
+			{
+				httplib::detail::close_socket(sock);
+				return false;
+			}
+			httplib::detail::set_nonblocking(sock, false);
+			return true;
+		});
+		if (sock == INVALID_SOCKET)
+		{
+			LOG_ERROR("http2 connection to " << host << ":" << port << " failed");
+			return current = nullptr;
+		}
+		// frames are small and each one is waited for
+		int noDelay = 1;
+		setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (char*)&noDelay, sizeof(noDelay));
+		current = std::make_shared<Connection>(sock);
+		return current;
+	}
+};
@@ -0,0 +1,91 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Initialization segments kept on disk between sessions. Every tile
+	needs its init segment before anything can be decoded, so a player
+	that has played the video before reads them from the cache folder
+	instead of waiting for a round trip per tile. Files are named by a
+	hash of the MPD uri and text together with the init url, an MPD
+	that changed never gets the init segments of its old version.
+*/
+
+#pragma once
+
+#include <string>
+#include <chrono>
+#include <thread>
+#include <cstdio>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <functional>
+
+class InitSegmentCache
+{
+public:
+	// without directory nothing is kept, the directory has to exist
+	InitSegmentCache(const std::string& directory, const std::string& mpdUri, const std::string& mpdText)
+		: directory(directory), mpdKey(fnv(fnv(offsetBasis, mpdUri), mpdText))
+	{
+	}
+
+	// false if the init segment of initUrl has not been stored
+	bool load(const std::string& initUrl, std::string& data) const
+	{
+		if (directory.empty())
+			return false;
+		std::ifstream file(path(initUrl), std::ios::binary);
+		if (!file)
+			return false;
+		std::ostringstream ss;
+		ss << file.rdbuf();
+		data = ss.str();
+		return !data.empty();
+	}
+
+	// written next to the target and renamed, a session starting meanwhile never reads a partial file
+	void store(const std::string& initUrl, const std::string& data) const
+	{
+		if (directory.empty() || data.empty())
+			return;
+		std::string target = path(initUrl);
+		std::string tmp = target + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()))
+			+ "." + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()) + ".tmp";
+		{
+			std::ofstream out(tmp, std::ios::binary);
+			out.write(data.data(), data.size());
+			if (!out)
+			{
+				out.close();
+				std::remove(tmp.c_str());
+				return;
+			}
+		}
+#ifdef _WIN32
+		std::remove(target.c_str());
+#endif
+		if (std::rename(tmp.c_str(), target.c_str()) != 0)
+			std::remove(tmp.c_str());
+	}
+
+private:
+	static const uint64_t offsetBasis = 14695981039346656037ull;
+
+	std::string directory;
+	uint64_t mpdKey;
+
+	std::string path(const std::string& initUrl) const
+	{
+		char name[24];
+		snprintf(name, sizeof(name), "%016llx", (unsigned long long)fnv(mpdKey, initUrl));
+		return directory + "/" + name + ".init";
+	}
+
+	static uint64_t fnv(uint64_t h, const std::string& bytes)
+	{
+		for (unsigned char c : bytes)
+			h = (h ^ c) * 1099511628211ull;
+		return h;
+	}
+};
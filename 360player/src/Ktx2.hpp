@@ -0,0 +1,161 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Reader of KTX2 containers holding a 2D texture in a GPU block
+	compression format, BC7 or ASTC. Only the header and the level
+	index are interpreted; the levels stay the bytes of the file so
+	they can be uploaded as they are. Supercompressed files (Basis
+	Universal, zstd) are refused, as are arrays, cube maps and 3D
+	textures.
+*/
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+class Ktx2
+{
+public:
+	enum class Format { BC7, ASTC };
+
+	struct Level
+	{
+		uint32_t width, height;
+		// into data
+		size_t offset, size;
+	};
+
+	Format format;
+	// texels per block, 4x4 for BC7; every block takes 16 bytes
+	uint32_t blockWidth, blockHeight;
+	// Vulkan format of the file, its sRGB variants are reported like the linear ones
+	uint32_t vkFormat;
+	bool srgb;
+	// level 0 is the full size
+	std::vector<Level> levels;
+	std::vector<uint8_t> data;
+
+	// true if path names a KTX2 file by its extension
+	static bool isKtx2(const std::string& path)
+	{
+		return path.size() > 5 && path.compare(path.size() - 5, 5, ".ktx2") == 0;
+	}
+
+	// reads path, error describes why it can not be used if false is returned
+	bool load(const std::string& path, std::string& error)
+	{
+		std::ifstream file(path, std::ios::binary);
+		if (!file)
+		{
+			error = "cannot open " + path;
+			return false;
+		}
+		data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+		return parse(error);
+	}
+
+	// bytes of one row of blocks of level
+	size_t rowBytes(const Level& level) const
+	{
+		return (size_t)((level.width + blockWidth - 1) / blockWidth) * 16;
+	}
+
+private:
+	static const size_t headerSize = 80;
+	static const size_t levelIndexEntrySize = 24;
+
+	bool parse(std::string& error)
+	{
+		static const uint8_t identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+		if (data.size() < headerSize || std::memcmp(data.data(), identifier, sizeof(identifier)) != 0)
+		{
+			error = "not a KTX2 file";
+			return false;
+		}
+
+		vkFormat = u32(12);
+		uint32_t width = u32(20), height = u32(24), depth = u32(28);
+		uint32_t layers = u32(32), faces = u32(36), levelCount = u32(40), supercompression = u32(44);
+		if (!blockFormat(vkFormat))
+		{
+			error = "unsupported format " + std::to_string(vkFormat) + ", only BC7 and ASTC are read";
+			return false;
+		}
+		if (supercompression != 0)
+		{
+			error = "supercompressed KTX2 files are not supported";
+			return false;
+		}
+		if (width == 0 || height == 0 || depth > 1 || layers > 1 || faces != 1)
+		{
+			error = "only single 2D textures are supported";
+			return false;
+		}
+
+		// a count of 0 asks the reader to generate the mipmaps, which block compressed formats do not allow
+		levelCount = levelCount == 0 ? 1 : levelCount;
+		if (data.size() < headerSize + levelCount * levelIndexEntrySize)
+		{
+			error = "truncated level index";
+			return false;
+		}
+		levels.clear();
+		for (uint32_t i = 0; i < levelCount; i++)
+		{
+			size_t entry = headerSize + i * levelIndexEntrySize;
+			Level level;
+			level.width = width >> i ? width >> i : 1;
+			level.height = height >> i ? height >> i : 1;
+			level.offset = (size_t)u64(entry);
+			level.size = (size_t)u64(entry + 8);
+			size_t blocks = (size_t)((level.width + blockWidth - 1) / blockWidth) * ((level.height + blockHeight - 1) / blockHeight);
+			if (level.offset > data.size() || level.size > data.size() - level.offset || level.size != blocks * 16)
+			{
+				error = "level " + std::to_string(i) + " does not fit the file";
+				return false;
+			}
+			levels.push_back(level);
+		}
+		return true;
+	}
+
+	// BC7 and the 14 ASTC LDR block sizes, each as a linear and an sRGB Vulkan format
+	bool blockFormat(uint32_t vk)
+	{
+		static const uint8_t astcBlocks[14][2] = { { 4, 4 }, { 5, 4 }, { 5, 5 }, { 6, 5 }, { 6, 6 }, { 8, 5 }, { 8, 6 },
+			{ 8, 8 }, { 10, 5 }, { 10, 6 }, { 10, 8 }, { 10, 10 }, { 12, 10 }, { 12, 12 } };
+		// VK_FORMAT_BC7_UNORM_BLOCK, VK_FORMAT_BC7_SRGB_BLOCK
+		if (vk == 145 || vk == 146)
+		{
+			format = Format::BC7;
+			blockWidth = blockHeight = 4;
+			srgb = vk == 146;
+			return true;
+		}
+		// VK_FORMAT_ASTC_4x4_UNORM_BLOCK to VK_FORMAT_ASTC_12x12_SRGB_BLOCK
+		if (vk >= 157 && vk <= 184)
+		{
+			format = Format::ASTC;
+			blockWidth = astcBlocks[(vk - 157) / 2][0];
+			blockHeight = astcBlocks[(vk - 157) / 2][1];
+			srgb = (vk - 157) % 2 == 1;
+			return true;
+		}
+		return false;
+	}
+
+	uint32_t u32(size_t at) const
+	{
+		return data[at] | (data[at + 1] << 8) | (data[at + 2] << 16) | ((uint32_t)data[at + 3] << 24);
+	}
+
+	uint64_t u64(size_t at) const
+	{
+		return u32(at) | ((uint64_t)u32(at + 4) << 32);
+	}
+};
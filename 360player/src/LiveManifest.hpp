@@ -0,0 +1,88 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Keeps a dynamic MPD current while a live event plays. A segment is
+	requested once the MPD's clock says it is available, the MPD is
+	fetched again every minimumUpdatePeriod or when the player reaches
+	the last segment it knows, and only what the new version adds is
+	merged into the MPD the player holds.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <algorithm>
+#include "mpd.h"
+#include "httplib.h"
+#include "Log.hpp"
+
+class LiveManifest
+{
+public:
+	LiveManifest(DASH::MPD* mpd, httplib::Client* client, const std::string& mpdUri)
+		: mpd(mpd), client(client), mpdUri(mpdUri), nextRefreshMs(nowMs() + updatePeriodMs())
+	{
+	}
+
+	// the segment to start with, presentationDelay seconds behind the live edge
+	int startSegment(double presentationDelay) const
+	{
+		return std::max(0, mpd->segmentAtMs(nowMs() - (long long)(presentationDelay * 1000)));
+	}
+
+	// blocks until segment can be requested, false once the event ended before it. The MPD is only changed here,
+	// so this must be called while no download reads it [adaption thread]
+	bool waitForSegment(int segment)
+	{
+		while (true)
+		{
+			auto now = nowMs();
+			if (now >= nextRefreshMs || (size_t)segment >= mpd->numSegments())
+				refresh(now);
+
+			long long wakeMs = nextRefreshMs;
+			if ((size_t)segment < mpd->numSegments())
+			{
+				auto availableMs = mpd->segmentAvailableMs(segment);
+				if (availableMs <= now)
+					return true;
+				wakeMs = std::min(wakeMs, availableMs);
+			}
+			else if (!mpd->isDynamic())
+				return false;
+			std::this_thread::sleep_for(std::chrono::milliseconds(std::max(1LL, wakeMs - now)));
+		}
+	}
+
+private:
+	DASH::MPD* mpd;
+	httplib::Client* client;
+	std::string mpdUri;
+	long long nextRefreshMs;
+
+	void refresh(long long now)
+	{
+		httplib::Headers headers = { { "Cache-Control", "no-cache" } };
+		auto res = client->Get(mpdUri.c_str(), headers);
+		if (!res || res->status != 200)
+			LOG_ERROR("MPD refresh failed");
+		else
+			mpd->refresh(res->body);
+		nextRefreshMs = now + updatePeriodMs();
+	}
+
+	// an MPD without minimumUpdatePeriod is fetched again once per segment while the player waits for one it lacks
+	long long updatePeriodMs() const
+	{
+		auto period = mpd->minimumUpdatePeriod.count();
+		return period > 0 ? period : std::max(1LL, (long long)(mpd->segmentDuration() * 1000));
+	}
+
+	static long long nowMs()
+	{
+		return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	}
+};
@@ -0,0 +1,179 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Asynchronous logger. A message is formatted on the calling thread
+	and copied into a slot of a fixed lock-free ring, a background
+	thread writes the slots to the console in order. The caller never
+	waits for the console; if the ring is full the message is dropped
+	and the writer reports how many were lost. LOG_DEBUG statements are
+	removed by the preprocessor unless LOG_LEVEL is 0.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+
+// lowest level that is logged: 0 debug, 1 info, 2 warning, 3 error
+#ifndef LOG_LEVEL
+#define LOG_LEVEL 1
+#endif
+
+#define LOG_AT(level, s) do { if ((level) >= LOG_LEVEL) { \
+	auto& logStream_ = Log::threadStream(); logStream_.str(""); logStream_.clear(); logStream_ << s; \
+	Log::instance().push(level, logStream_.str()); } } while (0)
+
+#if LOG_LEVEL > 0
+#define LOG_DEBUG(s) do {} while (0)
+#else
+#define LOG_DEBUG(s) LOG_AT(Log::Debug, s)
+#endif
+#define LOG_INFO(s) LOG_AT(Log::Info, s)
+#define LOG_WARNING(s) LOG_AT(Log::Warning, s)
+#define LOG_ERROR(s) LOG_AT(Log::Error, s)
+
+class Log
+{
+public:
+	enum Level { Debug = 0, Info = 1, Warning = 2, Error = 3 };
+
+	static Log& instance()
+	{
+		static Log log;
+		return log;
+	}
+
+	// formatting buffer of the calling thread, reused by every message
+	static std::ostringstream& threadStream()
+	{
+		thread_local std::ostringstream ss;
+		return ss;
+	}
+
+	// one line, longer messages are cut at the slot size [any thread]
+	void push(Level level, const std::string& text)
+	{
+		size_t pos = head.load(std::memory_order_relaxed);
+		Slot* slot;
+		while (true)
+		{
+			slot = &slots[pos % capacity];
+			size_t seq = slot->seq.load(std::memory_order_acquire);
+			auto diff = (intptr_t)seq - (intptr_t)pos;
+			if (diff == 0)
+			{
+				if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (diff < 0)
+			{
+				// the writer is a full ring behind
+				dropped.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			else
+				pos = head.load(std::memory_order_relaxed);
+		}
+
+		slot->level = level;
+		slot->length = std::min(text.size(), sizeof(slot->text));
+		memcpy(slot->text, text.data(), slot->length);
+		slot->seq.store(pos + 1, std::memory_order_release);
+	}
+
+	// returns once every message pushed before has been written
+	void flush()
+	{
+		size_t target = head.load(std::memory_order_acquire);
+		while (tail.load(std::memory_order_acquire) < target && running)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+private:
+	static constexpr size_t capacity = 1024;
+
+	struct Slot
+	{
+		std::atomic<size_t> seq;
+		Level level;
+		size_t length;
+		char text[240];
+	};
+
+	Slot slots[capacity];
+	std::atomic<size_t> head;
+	std::atomic<size_t> tail;
+	std::atomic<size_t> dropped;
+	std::atomic<bool> running;
+	std::thread writer;
+
+	Log() : head(0), tail(0), dropped(0), running(true)
+	{
+		for (size_t i = 0; i < capacity; i++)
+			slots[i].seq.store(i, std::memory_order_relaxed);
+		writer = std::thread(&Log::run, this);
+	}
+
+	~Log()
+	{
+		running = false;
+		writer.join();
+	}
+
+	Log(const Log&) = delete;
+	Log& operator=(const Log&) = delete;
+
+	void run()
+	{
+		while (true)
+		{
+			if (drain())
+				continue;
+			if (!running)
+			{
+				drain();
+				return;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(2));
+		}
+	}
+
+	// writes every finished slot, false if there was none [writer thread]
+	bool drain()
+	{
+		bool wrote = false;
+		size_t pos = tail.load(std::memory_order_relaxed);
+		while (true)
+		{
+			Slot& slot = slots[pos % capacity];
+			if (slot.seq.load(std::memory_order_acquire) != pos + 1)
+				break;
+
+			auto& out = slot.level >= Error ? std::cerr : std::cout;
+			out.write(slot.text, slot.length);
+			out.put('\n');
+
+			slot.seq.store(pos + capacity, std::memory_order_release);
+			tail.store(++pos, std::memory_order_release);
+			wrote = true;
+		}
+
+		if (wrote)
+		{
+			size_t lost = dropped.exchange(0, std::memory_order_relaxed);
+			if (lost > 0)
+				std::cout << "[log] " << lost << " messages dropped\n";
+			std::cout.flush();
+			std::cerr.flush();
+		}
+		return wrote;
+	}
+};
@@ -11,6 +11,7 @@ Mesh::~Mesh(void)
   {
     glDeleteBuffers(1, &m_vertexBufferId);
     glDeleteBuffers(1, &m_uvBufferId);
+    glDeleteBuffers(1, &m_indexBufferId);
     glDeleteVertexArrays(1, &m_vertexArrayId);
     m_initialized = false;
   }
@@ -18,16 +19,20 @@ Mesh::~Mesh(void)
 
 DisplayFrameInfo Mesh::Draw(const GLdouble projection[], const GLdouble modelView[],
                 std::shared_ptr<ShaderTexture> shader,
-                std::chrono::system_clock::time_point deadline)
+                std::chrono::system_clock::time_point deadline, GLsizei eyes)
 {
     Init();
 
-    auto frameInfo = shader->useProgram(projection, modelView, std::move(deadline));
+    auto frameInfo = shader->useProgram(projection, modelView, std::move(deadline), eyes);
 
     glBindVertexArray(m_vertexArrayId);
     {
-        glDrawArrays(GL_TRIANGLES, 0,
-                     static_cast<GLsizei>(m_vertexBufferData.size()));
+        if (!m_indexBufferData.empty())
+            glDrawElementsInstanced(GL_TRIANGLES, static_cast<GLsizei>(m_indexBufferData.size()),
+                           GL_UNSIGNED_INT, (GLvoid*)0, eyes);
+        else
+            glDrawArraysInstanced(GL_TRIANGLES, 0,
+                         static_cast<GLsizei>(m_vertexBufferData.size() / 3), eyes);
     }
     glBindVertexArray(0);
     return std::move(frameInfo);
@@ -44,13 +49,16 @@ void Mesh::Init(void)
                    &m_vertexBufferData[0], GL_STATIC_DRAW);
       glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-      // UV buffer
-      glGenBuffers(1, &m_uvBufferId);
-      glBindBuffer(GL_ARRAY_BUFFER, m_uvBufferId);
-      glBufferData(GL_ARRAY_BUFFER,
-                   sizeof(m_uvBufferData[0]) * m_uvBufferData.size(),
-                   &m_uvBufferData[0], GL_STATIC_DRAW);
-      glBindBuffer(GL_ARRAY_BUFFER, 0);
+      // UV buffer, a mesh for the per pixel projection has none
+      if (!m_uvBufferData.empty())
+      {
+        glGenBuffers(1, &m_uvBufferId);
+        glBindBuffer(GL_ARRAY_BUFFER, m_uvBufferId);
+        glBufferData(GL_ARRAY_BUFFER,
+                     sizeof(m_uvBufferData[0]) * m_uvBufferData.size(),
+                     &m_uvBufferData[0], GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+      }
 
       // Vertex array object
       glGenVertexArrays(1, &m_vertexArrayId);
@@ -58,6 +66,16 @@ void Mesh::Init(void)
       {
           //Call specific implementation of the specialization class
           InitImpl();
+
+          // Index buffer, its binding is part of the vertex array object
+          if (!m_indexBufferData.empty())
+          {
+            glGenBuffers(1, &m_indexBufferId);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBufferId);
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                         sizeof(m_indexBufferData[0]) * m_indexBufferData.size(),
+                         &m_indexBufferData[0], GL_STATIC_DRAW);
+          }
       }
       glBindVertexArray(0);
       m_initialized = true;
@@ -27,14 +27,16 @@ class Mesh
 {
 public:
   Mesh(void): m_initialized(false), m_vertexBufferId(0), m_uvBufferId(0),
-      m_vertexArrayId(0), m_vertexBufferData(), m_uvBufferData() {}
+      m_indexBufferId(0), m_vertexArrayId(0), m_vertexBufferData(), m_uvBufferData(),
+      m_indexBufferData() {}
   virtual ~Mesh(void);
 
   //Draw the Mesh in the specified viewport and apply the specified shader.
-  //It return the displayed picture number
+  //It return the displayed picture number. With two eyes the matrices of the
+  //second one follow the first and the mesh is drawn as two instances
   DisplayFrameInfo Draw(const GLdouble projection[], const GLdouble modelView[],
           std::shared_ptr<ShaderTexture> shader,
-          std::chrono::system_clock::time_point deadline);
+          std::chrono::system_clock::time_point deadline, GLsizei eyes = 1);
 
   void Init(void);
 
@@ -45,6 +47,9 @@ public:
     newData.begin(), newData.end());}
   void AppendUvBufferData(std::vector<GLfloat> const& newData) {m_uvBufferData.insert(m_uvBufferData.end(),
     newData.begin(), newData.end());}
+  //With indices the triangles are drawn indexed, three per triangle into the vertices
+  void AppendIndexBufferData(std::vector<GLuint> const& newData) {m_indexBufferData.insert(m_indexBufferData.end(),
+    newData.begin(), newData.end());}
 
 private:
   Mesh(const Mesh&) = delete;
@@ -56,8 +61,10 @@ private:
   bool m_initialized = false;
   GLuint m_vertexBufferId = 0;
   GLuint m_uvBufferId = 0;
+  GLuint m_indexBufferId = 0;
   GLuint m_vertexArrayId = 0;
   std::vector<GLfloat> m_vertexBufferData;
   std::vector<GLfloat> m_uvBufferData;
+  std::vector<GLuint> m_indexBufferData;
 };
 }
@@ -5,6 +5,7 @@
 //standard includes
 #include <cmath>
 #include <array>
+#include <map>
 using namespace IMT;
 
 MeshCubeEquiUV::MeshCubeEquiUV(GLfloat scale, size_t numTriangles): Mesh()
@@ -145,8 +146,28 @@ MeshCubeEquiUV::MeshCubeEquiUV(GLfloat scale, size_t numTriangles): Mesh()
     tmpVertexBufferData.insert(tmpVertexBufferData.end(),
       myFaceBufferData.begin(), myFaceBufferData.end());
   }
-  AppendVertexBufferData(tmpVertexBufferData);
-  AppendUvBufferData(VertexToUVs(tmpVertexBufferData));
+  // Neighbouring quads share their vertices, only the vertices of triangles
+  // crossing the seam get a copy of their own with the shifted U.
+  std::vector<GLfloat> tmpUVs = VertexToUVs(tmpVertexBufferData);
+  std::map<std::array<GLfloat, 5>, GLuint> vertexIds;
+  std::vector<GLfloat> vertexBufferData;
+  std::vector<GLfloat> uvBufferData;
+  std::vector<GLuint> indexBufferData;
+  for (size_t i = 0; i < tmpVertexBufferData.size() / 3; i++) {
+    std::array<GLfloat, 5> vertex = { tmpVertexBufferData[3 * i],
+      tmpVertexBufferData[3 * i + 1], tmpVertexBufferData[3 * i + 2],
+      tmpUVs[2 * i], tmpUVs[2 * i + 1] };
+    auto it = vertexIds.find(vertex);
+    if (it == vertexIds.end()) {
+      it = vertexIds.emplace(vertex, static_cast<GLuint>(vertexIds.size())).first;
+      vertexBufferData.insert(vertexBufferData.end(), vertex.begin(), vertex.begin() + 3);
+      uvBufferData.insert(uvBufferData.end(), vertex.begin() + 3, vertex.end());
+    }
+    indexBufferData.push_back(it->second);
+  }
+  AppendVertexBufferData(vertexBufferData);
+  AppendUvBufferData(uvBufferData);
+  AppendIndexBufferData(indexBufferData);
 }
 
 
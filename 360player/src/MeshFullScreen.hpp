@@ -0,0 +1,38 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	One triangle covering the viewport, for shaders with the per pixel
+	projection. Its corners are given in clip space and it has no UVs,
+	the fragments look the picture up along their view ray.
+*/
+#pragma once
+
+//Internal includes
+#include "Mesh.hpp"
+
+namespace IMT
+{
+	class MeshFullScreen : public Mesh
+	{
+	public:
+		MeshFullScreen(void) : Mesh()
+		{
+			// twice the viewport in x and y, clipped to it
+			AppendVertexBufferData({ -1.0f, -1.0f, 0.0f, 3.0f, -1.0f, 0.0f, -1.0f, 3.0f, 0.0f });
+		}
+
+		virtual ~MeshFullScreen() = default;
+
+	private:
+		MeshFullScreen(const MeshFullScreen&) = delete;
+		MeshFullScreen& operator=(const MeshFullScreen&) = delete;
+
+		virtual void InitImpl(void) override
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, GetVertexBufferId());
+			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (GLvoid*)0);
+			glEnableVertexAttribArray(0);
+		}
+	};
+}
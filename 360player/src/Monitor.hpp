@@ -1,48 +1,145 @@
 /*
 	Author: Arne-Tobias Rak
 	TU Darmstadt
+
+	Transition monitor, a live plot of the measured download rate and
+	whether a segment was adapted by prediction or popularity. The
+	adaption only puts its samples into a lock-free queue; the window,
+	its events and all drawing belong to the monitor's own thread. The
+	plot shows the last historySize samples, so a redraw costs the same
+	late in a session as at its start, and samples that arrive between
+	two redraws are drawn together.
 */
 
+#pragma once
+
+#include <cmath>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <algorithm>
 #include "plot.h"
 #include "llist.h"
 #include "ConfigParser.hpp"
+#include "ThreadTopology.hpp"
 
 class Monitor
 {
 public:
-	Monitor()
+	Monitor() : queueHead(0), queueTail(0), running(true), historyCount(0), historyNext(0)
+	{
+		renderThread = std::thread(&Monitor::run, this);
+	}
+
+	~Monitor()
+	{
+		running = false;
+		renderThread.join();
+	}
+
+	// [adaption thread] only one thread may add samples, a full queue drops the sample
+	void addsample(double timestamp, double value, bool pop = false)
+	{
+		size_t head = queueHead.load(std::memory_order_relaxed);
+		if (head - queueTail.load(std::memory_order_acquire) == queueSize)
+			return;
+		queue[head % queueSize] = { timestamp, value, pop };
+		queueHead.store(head + 1, std::memory_order_release);
+	}
+
+private:
+	struct Sample
 	{
+		double timestamp;
+		double value;
+		bool pop;
+	};
+
+	static constexpr size_t queueSize = 64;
+	static constexpr size_t historySize = 240;
+
+	Sample queue[queueSize];
+	std::atomic<size_t> queueHead;
+	std::atomic<size_t> queueTail;
+	std::atomic<bool> running;
+	std::thread renderThread;
+
+	// [monitor thread] ring of the plotted samples, historyNext is the slot of the next one
+	Sample history[historySize];
+	size_t historyCount;
+	size_t historyNext;
+
+	void run()
+	{
+		ThreadTopology::apply("monitor");
+		LinkedList ll;
 		ll.push_back_caption("Measured Download Rate", 0, 0x0000FF, CaptionType::value);
 		ll.push_back_caption("Prediction Adapt.", 1, 0xFFFFFF, CaptionType::background);
 		ll.push_back_caption("Popularity Adapt.", 2, 0x7777CC, CaptionType::background);
 
-		//populate plot parameter object
-		plot_params params;
-		
-		params.screen_width = 800;
-		params.screen_heigth = 640;
-		params.plot_window_title = "Transition Monitor";
-		params.font_text_path = Config::instance()->monitorttf;
-		params.font_text_size = 14;
-		params.caption_text_x = "Time (s)";
-		params.caption_text_y = "Speed (Mbit/s)";
-		params.ll = &ll;
-		params.scale_x = 1;
-		params.scale_y = 10;
-		params.max_x = 8.5;
-		params.max_y = 120;
+		plot_params params = parameters(&ll, 0, 8.5, 120, 1, 10);
+		SDLPlot plot(&params);
+
+		while (running)
+		{
+			if (takeSamples())
+			{
+				params = layout(ll);
+				plot.update(&params);
+			}
 
-		plot = new SDLPlot(&params);
+			// the window stays responsive without the player handling its events
+			SDL_Event event;
+			while (SDL_PollEvent(&event));
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		}
 	}
 
-	void addsample(double timestamp, double value, bool pop = false)
+	// moves the queued samples into the history, false if there were none
+	bool takeSamples()
 	{
-		ll.push_back_coord(0, timestamp, value, pop ? 0x7777CC : 0xFFFFFF);
-		maxval = std::max(maxval, value * 1.25);
+		size_t tail = queueTail.load(std::memory_order_relaxed);
+		size_t head = queueHead.load(std::memory_order_acquire);
+		if (tail == head)
+			return false;
 
-		//populate plot parameter object
-		plot_params params;
+		for (; tail != head; tail++)
+		{
+			history[historyNext] = queue[tail % queueSize];
+			historyNext = (historyNext + 1) % historySize;
+			if (historyCount < historySize)
+				historyCount++;
+		}
+		queueTail.store(tail, std::memory_order_release);
+		return true;
+	}
+
+	// fills ll with the history and scales the axes to it
+	plot_params layout(LinkedList& ll)
+	{
+		ll.clear_coord();
+		size_t first = (historyNext + historySize - historyCount) % historySize;
+		double maxval = 0;
+		for (size_t i = 0; i < historyCount; i++)
+		{
+			const Sample& s = history[(first + i) % historySize];
+			ll.push_back_coord(0, s.timestamp, s.value, s.pop ? 0x7777CC : 0xFFFFFF);
+			maxval = std::max(maxval, s.value * 1.25);
+		}
+
+		double oldest = history[first].timestamp;
+		double newest = std::max(history[(first + historyCount - 1) % historySize].timestamp, oldest + 1);
+		double scaleX = std::max(1.0, std::ceil((newest - oldest) / 10));
+		double scaleY = std::max(1.0, std::ceil(maxval / 5));
+		// the axis starts at a graduation so its labels stay whole numbers
+		double minX = std::floor(oldest / scaleX) * scaleX;
+		return parameters(&ll, minX, newest, std::max(maxval, scaleY), scaleX, scaleY);
+	}
 
+	static plot_params parameters(LinkedList* ll, double minX, double maxX, double maxY, double scaleX, double scaleY)
+	{
+		plot_params params;
 		params.screen_width = 800;
 		params.screen_heigth = 640;
 		params.plot_window_title = "Transition Monitor";
@@ -50,22 +147,12 @@ public:
 		params.font_text_size = 14;
 		params.caption_text_x = "Time (s)";
 		params.caption_text_y = "Speed (Mbit/s)";
-		params.ll = &ll;
-		params.scale_x = std::ceil(timestamp / 10);
-		params.scale_y = std::ceil(maxval / 5);
-		params.max_x = timestamp;
-		params.max_y = maxval;
-		
-		plot->update(&params);
+		params.ll = ll;
+		params.scale_x = scaleX;
+		params.scale_y = scaleY;
+		params.min_x = minX;
+		params.max_x = maxX;
+		params.max_y = maxY;
+		return params;
 	}
-
-	~Monitor()
-	{
-		delete plot;
-	}
-
-private:
-	LinkedList ll;
-	SDLPlot* plot;
-	double maxval = 0;
-};
\ No newline at end of file
+};
@@ -0,0 +1,68 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Playback event bus. Every event carries a counter that only
+	grows (poses recorded, frame displayed, segments complete),
+	threads block until a counter reaches the value they need.
+*/
+
+#pragma once
+
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+
+class PlaybackEvents
+{
+public:
+	enum Event { PoseAvailable, FrameDisplayed, BufferBelowTarget, SegmentComplete, NumEvents };
+
+	PlaybackEvents()
+		: stopped(false)
+	{
+		std::fill(values, values + NumEvents, 0);
+	}
+
+	// publish the new counter of event, smaller values than the current one are ignored
+	void signal(Event event, long long value)
+	{
+		{
+			std::lock_guard<std::mutex> l(mtx);
+			if (value <= values[event])
+				return;
+			values[event] = value;
+		}
+		cv.notify_all();
+	}
+
+	// block until the counter of event reached value, false if the bus was stopped before
+	bool wait(Event event, long long value)
+	{
+		std::unique_lock<std::mutex> l(mtx);
+		cv.wait(l, [&]() { return stopped || values[event] >= value; });
+		return values[event] >= value;
+	}
+
+	long long value(Event event)
+	{
+		std::lock_guard<std::mutex> l(mtx);
+		return values[event];
+	}
+
+	// wake every waiting thread, used on shutdown
+	void stop()
+	{
+		{
+			std::lock_guard<std::mutex> l(mtx);
+			stopped = true;
+		}
+		cv.notify_all();
+	}
+
+private:
+	std::mutex mtx;
+	std::condition_variable cv;
+	long long values[NumEvents];
+	bool stopped;
+};
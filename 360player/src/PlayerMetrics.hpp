@@ -0,0 +1,121 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Quality of experience of the running session for the metrics
+	endpoint: bytes per tile and quality, requests and cache hits as
+	answered in X-Cache, segments read from the segment store, download
+	latency, buffer level, stalls, late decoding and
+	displayed and dropped frames. The adaption, the download workers
+	and the render thread update their values, write is called by the
+	endpoint's thread.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <sstream>
+#include "Metrics.hpp"
+
+class PlayerMetrics
+{
+public:
+	static PlayerMetrics& instance()
+	{
+		static PlayerMetrics metrics;
+		return metrics;
+	}
+
+	// before the first download
+	void init(size_t tiles, size_t qualities)
+	{
+		numTiles = tiles;
+		numQualities = qualities;
+		tileBytes.reset(new std::atomic<unsigned long long>[tiles * qualities]);
+		for (size_t i = 0; i < tiles * qualities; i++)
+			tileBytes[i] = 0;
+	}
+
+	// bytes received for a tile in quality, also of transfers that were aborted
+	void addBytes(int tile, int quality, size_t bytes)
+	{
+		if (tile >= 0 && quality >= 0 && (size_t)tile < numTiles && (size_t)quality < numQualities)
+			tileBytes[tile * numQualities + quality].fetch_add(bytes, std::memory_order_relaxed);
+	}
+
+	void addRequest(bool cacheHit, double seconds)
+	{
+		(cacheHit ? cacheHits : cacheMisses).fetch_add(1, std::memory_order_relaxed);
+		downloadSeconds.observe(seconds);
+	}
+
+	// a segment taken from the segment store without a request, its bytes are not counted as received
+	void addStoreHit(size_t bytes)
+	{
+		storeHits.fetch_add(1, std::memory_order_relaxed);
+		storeHitBytes.fetch_add(bytes, std::memory_order_relaxed);
+	}
+
+	// [render thread] the frame counters of the reader are totals, dropped frames come per display
+	// stalls are rebuffering, late are the stalls of a decoder that had its data
+	void addFrame(size_t displayedFrame, size_t dropped, size_t stallCount, double stallingMs, size_t lateCount, double lateMs)
+	{
+		framesDisplayed.store(displayedFrame, std::memory_order_relaxed);
+		framesDropped.fetch_add(dropped, std::memory_order_relaxed);
+		stalls.store(stallCount, std::memory_order_relaxed);
+		stallingSeconds.store(stallingMs / 1000, std::memory_order_relaxed);
+		late.store(lateCount, std::memory_order_relaxed);
+		lateSeconds.store(lateMs / 1000, std::memory_order_relaxed);
+	}
+
+	std::string write(double bufferLevel, size_t mediaBytes) const
+	{
+		std::stringstream ss;
+		Metrics::header(ss, "player_tile_bytes_total", "Bytes received per tile and quality", "counter");
+		for (size_t t = 0; t < numTiles; t++)
+			for (size_t q = 0; q < numQualities; q++)
+				Metrics::sample(ss, "player_tile_bytes_total", tileBytes[t * numQualities + q].load(std::memory_order_relaxed),
+					"tile=\"" + std::to_string(t) + "\",quality=\"" + std::to_string(q) + "\"");
+
+		Metrics::header(ss, "player_requests_total", "Segment requests by X-Cache answer", "counter");
+		Metrics::sample(ss, "player_requests_total", cacheHits.load(), "cache=\"hit\"");
+		Metrics::sample(ss, "player_requests_total", cacheMisses.load(), "cache=\"miss\"");
+		downloadSeconds.write(ss, "player_download_seconds", "Duration of segment requests");
+		Metrics::counter(ss, "player_store_hits_total", "Segments read from the segment store", storeHits.load());
+		Metrics::counter(ss, "player_store_hit_bytes_total", "Bytes read from the segment store", storeHitBytes.load());
+
+		Metrics::gauge(ss, "player_buffer_seconds", "Seconds of video buffered ahead of the playhead", bufferLevel);
+		Metrics::gauge(ss, "player_media_bytes", "Bytes of media held by the tile streams", mediaBytes);
+		Metrics::counter(ss, "player_stalls_total", "Playback stalls", stalls.load());
+		Metrics::counter(ss, "player_stalling_seconds_total", "Time spent stalling", stallingSeconds.load());
+		Metrics::counter(ss, "player_decode_late_total", "Times the next frame was not decoded in time", late.load());
+		Metrics::counter(ss, "player_decode_late_seconds_total", "Time the display waited for the decoder", lateSeconds.load());
+		Metrics::counter(ss, "player_frames_displayed_total", "Video frames displayed", framesDisplayed.load());
+		Metrics::counter(ss, "player_frames_dropped_total", "Video frames skipped at display", framesDropped.load());
+		return ss.str();
+	}
+
+private:
+	size_t numTiles;
+	size_t numQualities;
+	std::unique_ptr<std::atomic<unsigned long long>[]> tileBytes;
+	std::atomic<unsigned long long> cacheHits;
+	std::atomic<unsigned long long> cacheMisses;
+	Metrics::Histogram downloadSeconds;
+	std::atomic<unsigned long long> storeHits;
+	std::atomic<unsigned long long> storeHitBytes;
+	std::atomic<size_t> framesDisplayed;
+	std::atomic<size_t> framesDropped;
+	std::atomic<size_t> stalls;
+	std::atomic<double> stallingSeconds;
+	std::atomic<size_t> late;
+	std::atomic<double> lateSeconds;
+
+	PlayerMetrics() : numTiles(0), numQualities(0), cacheHits(0), cacheMisses(0), downloadSeconds(Metrics::latencyBounds()),
+		storeHits(0), storeHitBytes(0), framesDisplayed(0), framesDropped(0), stalls(0), stallingSeconds(0)
+		, late(0), lateSeconds(0)
+	{
+	}
+};
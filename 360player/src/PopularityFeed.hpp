@@ -0,0 +1,150 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	The player's side of the live popularity of 360server. The poses
+	of this session are counted as viewport samples per tile of the
+	segment playing at their timestamp; sync uploads the counts since
+	the last sync and polls the decayed counts of the whole audience
+	for the next segments, which replace the <Popularity> element of
+	the MPD for them.
+*/
+
+#pragma once
+
+#include <map>
+#include <limits>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+#include <functional>
+#include "mpd.h"
+#include "httplib.h"
+#include "PoseHistory.hpp"
+#include "Log.hpp"
+
+class PopularityFeed
+{
+public:
+	// poses are counted at most every sampleInterval seconds, like the traces of 360popularity
+	PopularityFeed(const DASH::MPD* mpd, const std::string& mpdUri, double sampleInterval = 0.25)
+		: mpd(mpd), path("/livepopularity" + mpdUri), sampleMs(sampleInterval * 1000)
+		, lastTimestamp(std::numeric_limits<long long>::min())
+	{
+	}
+
+	// counts the poses of the snapshot newer than the last counted one; the segment of a pose is taken
+	// from its timestamp, stalls shift it by their duration [adaption thread]
+	void record(const PoseSnapshot<>& poses, const std::function<void(const IMT::Quaternion&, std::map<int, int>&)>& visibleSamples)
+	{
+		int numTiles = (int)mpd->period.adaptationSets.size();
+		double segmentMs = mpd->segmentDuration() * 1000;
+		for (size_t i = poses.size(); i-- > 0;)
+		{
+			auto timestamp = poses.timestamp(i);
+			if (lastTimestamp != std::numeric_limits<long long>::min() && timestamp < lastTimestamp + sampleMs)
+				continue;
+			lastTimestamp = timestamp;
+
+			std::map<int, int> visibility;
+			visibleSamples(poses.rotation(i), visibility);
+			auto& counts = pending[firstSegment + (int)((timestamp - firstTimestamp) / segmentMs)];
+			counts.resize(numTiles, 0);
+			for (auto& tile : visibility)
+				if (tile.first >= 0 && tile.first < numTiles)
+					counts[tile.first] += tile.second;
+		}
+	}
+
+	// the segment playing from the pose at timestamp on, of a live session joining an event or after a seek
+	void setFirstSegment(int segment, long long timestamp = 0)
+	{
+		firstSegment = segment;
+		firstTimestamp = timestamp;
+	}
+
+	// uploads the counts recorded since the last sync and polls segments [first, first + count) [adaption thread]
+	bool sync(httplib::Client* client, int first, int count)
+	{
+		if (!pending.empty())
+		{
+			std::ostringstream ss;
+			for (auto& segment : pending)
+			{
+				ss << segment.first << " ";
+				for (size_t t = 0; t < segment.second.size(); t++)
+					ss << (t ? "," : "") << segment.second[t];
+				ss << "\n";
+			}
+			auto res = client->Post(path.c_str(), ss.str(), "text/plain");
+			if (!res || res->status != 200)
+				LOG_ERROR("popularity upload failed");
+			else
+				pending.clear();
+		}
+
+		auto res = client->Get((path + "?first=" + std::to_string(first) + "&count=" + std::to_string(count)).c_str());
+		if (!res || res->status != 200)
+			return false;
+		parse(res->body);
+		return true;
+	}
+
+	// tile qualities the audience suggests for segment, false if nobody has watched it yet
+	bool tileQuality(int segment, DASH::TileQualityVector& quality) const
+	{
+		auto it = live.find(segment);
+		if (it == live.end())
+			return false;
+		quality = it->second;
+		return true;
+	}
+
+private:
+	const DASH::MPD* mpd;
+	std::string path;
+	double sampleMs;
+	long long lastTimestamp;
+	int firstSegment = 0;
+	long long firstTimestamp = 0;
+	// own counts per segment not uploaded yet
+	std::map<int, std::vector<int>> pending;
+	std::map<int, DASH::TileQualityVector> live;
+
+	// lines "segment count,count,..." to qualities like the <Popularity> element: the most watched tile
+	// gets the best quality, the others one level lower per share of its count they miss
+	void parse(const std::string& text)
+	{
+		int numTiles = (int)mpd->period.adaptationSets.size();
+		std::istringstream lines(text);
+		std::string line;
+		while (std::getline(lines, line))
+		{
+			std::istringstream ls(line);
+			int segment;
+			if (!(ls >> segment))
+				continue;
+			std::vector<double> counts;
+			double c;
+			char sep;
+			while (ls >> c)
+			{
+				counts.push_back(c);
+				ls >> sep;
+			}
+			if (counts.empty())
+				continue;
+
+			double max = std::max(1e-9, *std::max_element(counts.begin(), counts.end()));
+			auto& quality = live[segment];
+			quality.resize(numTiles);
+			for (int t = 0; t < numTiles; t++)
+			{
+				int levels = (int)mpd->period.adaptationSets[t].representations.size();
+				double count = t < (int)counts.size() ? counts[t] : 0;
+				quality[t] = (uint8_t)std::max(0, std::min(levels - 1, (int)(levels - levels * (count / max))));
+			}
+		}
+	}
+};
@@ -0,0 +1,136 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Fixed-capacity history of timestamped head rotations.
+	The pose sampler, or the render thread without one, pushes
+	without ever blocking; readers take a consistent copy guarded
+	by a sequence counter (seqlock).
+	Both ring and snapshot are stored as separate arrays per
+	component for the regression in the adaption unit.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+#include "Quaternion.hpp"
+
+template<size_t s = 256>
+class PoseSnapshot
+{
+public:
+	PoseSnapshot() : count(0) { }
+
+	PoseSnapshot(long long timestamp, const IMT::Quaternion& rotation) : count(1)
+	{
+		time[0] = timestamp;
+		w[0] = rotation.GetW();
+		x[0] = rotation.GetV().GetX();
+		y[0] = rotation.GetV().GetY();
+		z[0] = rotation.GetV().GetZ();
+	}
+
+	// index 0 is the most recent pose
+	IMT::Quaternion rotation(size_t index) const
+	{
+		return IMT::Quaternion(w[index], x[index], y[index], z[index]);
+	}
+
+	long long timestamp(size_t index) const
+	{
+		return time[index];
+	}
+
+	size_t size() const
+	{
+		return count;
+	}
+
+	size_t capacity() const
+	{
+		return s;
+	}
+
+	long long time[s];
+	double w[s];
+	double x[s];
+	double y[s];
+	double z[s];
+	size_t count;
+};
+
+template<size_t s = 256>
+class PoseHistory
+{
+public:
+	PoseHistory() : seq(0), pushed(0) { }
+
+	// single writer [pose sampler or render thread]
+	void push(long long timestamp, const IMT::Quaternion& rotation)
+	{
+		auto n = pushed.load(std::memory_order_relaxed);
+		auto i = n % s;
+
+		auto q = seq.load(std::memory_order_relaxed);
+		seq.store(q + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		time[i].store(timestamp, std::memory_order_relaxed);
+		w[i].store(rotation.GetW(), std::memory_order_relaxed);
+		x[i].store(rotation.GetV().GetX(), std::memory_order_relaxed);
+		y[i].store(rotation.GetV().GetY(), std::memory_order_relaxed);
+		z[i].store(rotation.GetV().GetZ(), std::memory_order_relaxed);
+		pushed.store(n + 1, std::memory_order_relaxed);
+
+		seq.store(q + 2, std::memory_order_release);
+	}
+
+	// consistent copy, newest pose first; retries while a push is in progress [any thread]
+	void snapshot(PoseSnapshot<s>& out) const
+	{
+		while (true)
+		{
+			auto q = seq.load(std::memory_order_acquire);
+			if (q & 1)
+				continue;
+
+			auto n = pushed.load(std::memory_order_relaxed);
+			out.count = n < s ? n : s;
+			for (size_t k = 0; k < out.count; k++)
+			{
+				auto i = (n - 1 - k) % s;
+				out.time[k] = time[i].load(std::memory_order_relaxed);
+				out.w[k] = w[i].load(std::memory_order_relaxed);
+				out.x[k] = x[i].load(std::memory_order_relaxed);
+				out.y[k] = y[i].load(std::memory_order_relaxed);
+				out.z[k] = z[i].load(std::memory_order_relaxed);
+			}
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (seq.load(std::memory_order_relaxed) == q)
+				return;
+		}
+	}
+
+	size_t size() const
+	{
+		auto n = pushed.load(std::memory_order_relaxed);
+		return n < s ? n : s;
+	}
+
+	size_t capacity() const
+	{
+		return s;
+	}
+
+private:
+	std::atomic<unsigned> seq;
+	std::atomic<size_t> pushed;
+	std::atomic<long long> time[s];
+	std::atomic<double> w[s];
+	std::atomic<double> x[s];
+	std::atomic<double> y[s];
+	std::atomic<double> z[s];
+};
@@ -0,0 +1,84 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Samples the head rotation at a fixed rate on its own thread, so
+	the pose history of the prediction neither follows the render
+	rate nor stalls with it. Timestamps are ms of the steady clock
+	since start; a sample that is late is not caught up with a burst,
+	the next one is due an interval later.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <functional>
+
+#include "Quaternion.hpp"
+#include "Trace.hpp"
+#include "ThreadTopology.hpp"
+
+class PoseSampler
+{
+public:
+	// fills the rotation at timestamp, false if there is none to push
+	typedef std::function<bool(long long timestamp, IMT::Quaternion& rotation)> Source;
+	typedef std::function<void(long long timestamp, const IMT::Quaternion& rotation)> Sink;
+
+	// source and sink are called on the sampling thread only, which runs until the sampler is destroyed
+	PoseSampler(double rate, std::chrono::steady_clock::time_point start, Source source, Sink sink)
+		: interval(1000.0 / rate), start(start), source(std::move(source)), sink(std::move(sink)), running(true)
+		, samples(0)
+	{
+		thread = std::thread(&PoseSampler::run, this);
+	}
+
+	~PoseSampler()
+	{
+		running = false;
+		thread.join();
+	}
+
+	PoseSampler(const PoseSampler&) = delete;
+	PoseSampler& operator=(const PoseSampler&) = delete;
+
+	// poses pushed so far
+	size_t count() const
+	{
+		return samples.load(std::memory_order_relaxed);
+	}
+
+private:
+	std::chrono::duration<double, std::milli> interval;
+	std::chrono::steady_clock::time_point start;
+	Source source;
+	Sink sink;
+	std::atomic<bool> running;
+	std::atomic<size_t> samples;
+	std::thread thread;
+
+	void run()
+	{
+		Trace::nameThread("poses");
+		ThreadTopology::apply("poses");
+		auto due = std::chrono::steady_clock::now();
+		while (running)
+		{
+			auto now = std::chrono::steady_clock::now();
+			auto timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(now - start).count();
+			IMT::Quaternion rotation;
+			if (source(timestamp, rotation))
+			{
+				sink(timestamp, rotation);
+				samples.fetch_add(1, std::memory_order_relaxed);
+			}
+
+			due += std::chrono::duration_cast<std::chrono::steady_clock::duration>(interval);
+			if (due < now)
+				due = now;
+			std::this_thread::sleep_until(due);
+		}
+	}
+};
@@ -0,0 +1,235 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Quality allocators choosing one representation per tile for a
+	segment under a bandwidth budget. Quality 0 is the highest
+	representation, costs are given in bytes per second.
+*/
+
+#pragma once
+
+#include <vector>
+#include <queue>
+#include <memory>
+#include <string>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+
+class QualityAllocator
+{
+public:
+	struct Tile
+	{
+		// weighted viewport samples, 0 for tiles outside the predicted viewport
+		int visibility;
+		// best quality the tile should get with unlimited bandwidth
+		int target;
+		// bytes per second of every representation, highest quality first
+		std::vector<double> cost;
+		// quality the popularity recommends, -1 for none, and the utility the knapsack adds for choosing exactly
+		// that representation, which the cache is likely to hold
+		int popular = -1;
+		double popularBonus = 0;
+		// share of its cost every representation takes from the budget, empty if all take their full cost.
+		// Representations the cache holds take less, they come at its speed instead of the origin's
+		std::vector<double> charge;
+
+		double charged(int q) const
+		{
+			return charge.empty() ? cost[q] : cost[q] * charge[q];
+		}
+	};
+
+	virtual ~QualityAllocator() {}
+
+	// fills quality per tile, returns false if the budget did not allow every tile its target.
+	// visibilityPerLevel is the visibility one quality step is worth
+	virtual bool allocate(const std::vector<Tile>& tiles, double budget, int visibilityPerLevel, std::vector<int>& quality) = 0;
+
+	// type is one of "knapsack" or "greedy"
+	static std::unique_ptr<QualityAllocator> create(const std::string& type);
+
+protected:
+	static double costOf(const std::vector<Tile>& tiles, const std::vector<int>& quality)
+	{
+		double sum = 0;
+		for (size_t t = 0; t < tiles.size(); t++)
+			sum += tiles[t].charged(quality[t]);
+		return sum;
+	}
+};
+
+// upgrades the most visible tile by one step and lowers its priority until the budget is exceeded,
+// the decision sequence of the former loop in AdaptionUnit::startAdaption kept for comparison
+class GreedyAllocator : public QualityAllocator
+{
+public:
+	bool allocate(const std::vector<Tile>& tiles, double budget, int visibilityPerLevel, std::vector<int>& quality) override
+	{
+		quality.resize(tiles.size());
+		for (size_t t = 0; t < tiles.size(); t++)
+			quality[t] = int(tiles[t].cost.size()) - 1;
+
+		// ties go to the lower tile index
+		std::priority_queue<std::pair<int, int>> queue;
+		for (size_t t = 0; t < tiles.size(); t++)
+			if (tiles[t].visibility > 0)
+				queue.push({ tiles[t].visibility, -int(t) });
+
+		double needed = costOf(tiles, quality);
+		int step = std::max(1, visibilityPerLevel);
+		while (!queue.empty())
+		{
+			auto top = queue.top();
+			queue.pop();
+			int t = -top.second;
+
+			if (quality[t] > tiles[t].target)
+			{
+				needed += tiles[t].charged(quality[t] - 1) - tiles[t].charged(quality[t]);
+				quality[t]--;
+			}
+			// like before, the step that overflows the budget is kept
+			if (needed > budget)
+				return false;
+
+			if (top.first - step > 0)
+				queue.push({ top.first - step, top.second });
+		}
+		return true;
+	}
+};
+
+// multiple-choice knapsack over the budget left after the lowest representations, solved by dynamic programming
+// on budgetUnits steps. Optimal up to that discretization, which only loses choices using nearly all of the budget.
+// The utility of a tile is its visibility times the log bitrate gain over the lowest quality, plus the bonus of its
+// popular quality. Qualities above the target add nothing
+class KnapsackAllocator : public QualityAllocator
+{
+public:
+	KnapsackAllocator(int budgetUnits = 1024) : units(std::max(1, budgetUnits)) {}
+
+	bool allocate(const std::vector<Tile>& tiles, double budget, int /*visibilityPerLevel*/, std::vector<int>& quality) override
+	{
+		const size_t n = tiles.size();
+		quality.resize(n);
+		for (size_t t = 0; t < n; t++)
+			quality[t] = tiles[t].target;
+		if (costOf(tiles, quality) <= budget)
+			return true;
+
+		double base = 0;
+		for (size_t t = 0; t < n; t++)
+		{
+			quality[t] = int(tiles[t].cost.size()) - 1;
+			base += tiles[t].charged(quality[t]);
+		}
+		double spare = budget - base;
+		if (spare <= 0)
+			return false;
+
+		// costs are rounded up so the discretized solution never exceeds the budget
+		const double unitCost = spare / units;
+		const double none = -std::numeric_limits<double>::infinity();
+		value.assign(units + 1, 0);
+		choice.assign(n * (units + 1), -1);
+		for (size_t t = 0; t < n; t++)
+		{
+			const auto& tile = tiles[t];
+			int lowest = int(tile.cost.size()) - 1;
+			if ((tile.visibility <= 0 && tile.popularBonus <= 0) || tile.target >= lowest)
+				continue;
+
+			next.assign(units + 1, none);
+			signed char* tileChoice = &choice[t * (units + 1)];
+			for (int q = lowest; q >= tile.target; q--)
+			{
+				int weight = weightOf(tile, q, unitCost);
+				if (weight > units)
+					continue;
+				double gain = utility(tile, q);
+				for (int b = weight; b <= units; b++)
+					if (value[b - weight] + gain > next[b])
+					{
+						next[b] = value[b - weight] + gain;
+						tileChoice[b] = (signed char)q;
+					}
+			}
+			value.swap(next);
+		}
+
+		// walk the choices back from the full budget
+		int b = units;
+		for (size_t t = n; t-- > 0;)
+		{
+			int q = choice[t * (units + 1) + b];
+			if (q < 0)
+				continue;
+			quality[t] = q;
+			b -= weightOf(tiles[t], q, unitCost);
+		}
+
+		// spend what the rounding left over on the single upgrades with the best gain per byte
+		double left = budget - costOf(tiles, quality);
+		while (true)
+		{
+			int best = -1;
+			double bestRatio = 0;
+			for (size_t t = 0; t < n; t++)
+			{
+				const auto& tile = tiles[t];
+				int q = quality[t];
+				if (q <= tile.target)
+					continue;
+				double extra = tile.charged(q - 1) - tile.charged(q);
+				double ratio = (utility(tile, q - 1) - utility(tile, q)) / std::max(extra, 1.0);
+				if (extra <= left && ratio > bestRatio)
+				{
+					best = int(t);
+					bestRatio = ratio;
+				}
+			}
+			if (best < 0)
+				break;
+			left -= tiles[best].charged(quality[best] - 1) - tiles[best].charged(quality[best]);
+			quality[best]--;
+		}
+		return false;
+	}
+
+private:
+	int units;
+
+	// budget units q takes beyond the lowest quality. A cached quality may take less than an uncached lowest one,
+	// it is then counted as free
+	static int weightOf(const Tile& tile, int q, double unitCost)
+	{
+		int lowest = int(tile.cost.size()) - 1;
+		if (q == lowest)
+			return 0;
+		return std::max(0, int(std::ceil((tile.charged(q) - tile.charged(lowest)) / unitCost - 1e-9)));
+	}
+
+	static double utility(const Tile& tile, int q)
+	{
+		int lowest = int(tile.cost.size()) - 1;
+		double gain = q == lowest ? 0 : tile.visibility * std::log(tile.cost[q] / tile.cost[lowest]);
+		return q == tile.popular ? gain + tile.popularBonus : gain;
+	}
+	std::vector<double> value;
+	std::vector<double> next;
+	std::vector<signed char> choice;
+};
+
+inline std::unique_ptr<QualityAllocator> QualityAllocator::create(const std::string& type)
+{
+	if (type == "knapsack")
+		return std::unique_ptr<QualityAllocator>(new KnapsackAllocator());
+	else if (type == "greedy")
+		return std::unique_ptr<QualityAllocator>(new GreedyAllocator());
+
+	throw std::invalid_argument("QualityAllocator::create: invalid allocator type: " + type);
+}
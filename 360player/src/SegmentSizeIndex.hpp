@@ -0,0 +1,73 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Binary index of the exact byte count of every tile segment,
+	written by tile_and_dash.py next to the MPD, which names it in a
+	<SupplementalProperty> of its Period. The bandwidth attribute of
+	a representation is its average, while the segments of a tile
+	vary several-fold with the content, so the adaption budgets with
+	these sizes where the index has them.
+
+	Layout, little endian:
+		magic "SEGSIZE1", segment count (uint32), tile count (uint32), quality count (uint32)
+		segment count x tile count x quality count byte counts (uint32), 0 where a segment is missing
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+class SegmentSizeIndex
+{
+public:
+	// schemeIdUri of the MPD property whose value is the url of the index, relative to the MPD
+	static const char* scheme()
+	{
+		return "urn:360transitions:segmentsizes";
+	}
+
+	uint32_t segments = 0;
+	uint32_t tiles = 0;
+	uint32_t qualities = 0;
+	// bytes of quality q of tile t in segment s at (s * tiles + t) * qualities + q
+	std::vector<uint32_t> bytes;
+
+	// false if data is no index or is cut short
+	bool read(const std::string& data)
+	{
+		const size_t header = 20;
+		if (data.size() < header || memcmp(data.data(), magic(), 8) != 0)
+			return false;
+		uint32_t s, t, q;
+		memcpy(&s, data.data() + 8, 4);
+		memcpy(&t, data.data() + 12, 4);
+		memcpy(&q, data.data() + 16, 4);
+		size_t count = (size_t)s * t * q;
+		if (t == 0 || q == 0 || (data.size() - header) / 4 < count)
+			return false;
+		segments = s;
+		tiles = t;
+		qualities = q;
+		bytes.resize(count);
+		memcpy(bytes.data(), data.data() + header, count * 4);
+		return true;
+	}
+
+	// 0 if the index has no such segment
+	uint32_t size(int segment, int tile, int quality) const
+	{
+		if (segment < 0 || (uint32_t)segment >= segments || tile < 0 || (uint32_t)tile >= tiles || quality < 0 || (uint32_t)quality >= qualities)
+			return 0;
+		return bytes[((size_t)segment * tiles + tile) * qualities + quality];
+	}
+
+private:
+	static const char* magic()
+	{
+		return "SEGSIZE1";
+	}
+};
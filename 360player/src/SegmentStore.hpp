@@ -0,0 +1,301 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Segments kept on disk between sessions, so rewatching a video does
+	not download its tiles again. Each segment is a file named by a
+	hash of its url and is mapped on its first hit; later hits copy
+	straight from the mapped pages. The store is bounded in bytes and
+	evicts by a replacement policy of the proxy, with the popularity
+	policy the tile qualities the MPD recommends are kept longest.
+
+	An index file in the folder holds the policy state of every
+	segment, lines "refcount popular size url" after one "age" line.
+	It is written every indexInterval stores, on flush and when the
+	store is destroyed; segment files without an index line are
+	written again.
+*/
+
+#pragma once
+
+#include <set>
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <cstdio>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <functional>
+#include <unordered_map>
+#include "MappedFile.hpp"
+#include "ReplacementPolicy.hpp"
+
+class SegmentStore
+{
+public:
+	struct Stats
+	{
+		size_t hits;
+		size_t misses;
+		size_t hitBytes;
+		size_t evictions;
+	};
+
+	// without directory nothing is kept, the directory has to exist. policy is a type of ReplacementPolicy::create
+	SegmentStore(const std::string& directory, size_t capacityBytes, const std::string& policyType = "popularity")
+		: directory(directory), policy(ReplacementPolicy::create(policyType)), capacity(capacityBytes)
+	{
+		if (!directory.empty())
+			load();
+	}
+
+	~SegmentStore()
+	{
+		flush();
+	}
+
+	SegmentStore(const SegmentStore&) = delete;
+	SegmentStore& operator=(const SegmentStore&) = delete;
+
+	bool enabled() const
+	{
+		return !directory.empty();
+	}
+
+	// whether get would find url, counts nothing
+	bool contains(const std::string& url)
+	{
+		if (directory.empty())
+			return false;
+		std::lock_guard<std::mutex> l(mtx);
+		return objects.count(url) > 0;
+	}
+
+	// counts a hit or a miss for url, body is filled on a hit
+	bool get(const std::string& url, std::string& body)
+	{
+		if (directory.empty())
+			return false;
+		std::lock_guard<std::mutex> l(mtx);
+		auto it = objects.find(url);
+		if (it == objects.end())
+		{
+			stats.misses++;
+			return false;
+		}
+
+		auto& object = it->second;
+		if (!object.file)
+			object.file = MappedFile::open(path(url));
+		// the file went missing or was cut short outside of the store
+		if (!object.file || object.file->size() != object.entry.size)
+		{
+			remove(it);
+			stats.misses++;
+			return false;
+		}
+
+		body.assign(object.file->data(), object.file->size());
+		object.entry.refcount++;
+		object.entry.lastAccess = ++accesses;
+		rekey(url, object);
+		dirty = true;
+		stats.hits++;
+		stats.hitBytes += body.size();
+		return true;
+	}
+
+	// keeps a complete segment, popular if it is the quality the MPD recommends for its tile. Segments larger
+	// than the store or whose file name is taken by another url are not kept
+	void put(const std::string& url, const std::string& body, bool popular)
+	{
+		if (directory.empty() || body.empty())
+			return;
+		std::lock_guard<std::mutex> l(mtx);
+		if (body.size() > capacity || objects.count(url) || names.count(name(url)))
+			return;
+
+		while (bytes + body.size() > capacity && !heap.empty())
+		{
+			auto victim = objects.find(heap.begin()->second);
+			age = policy->ageAfterEviction(victim->second.entry, victim->second.key);
+			remove(victim);
+			stats.evictions++;
+		}
+		if (!write(path(url), body))
+			return;
+
+		insert(url, { body.size(), 1, ++accesses, popular });
+		dirty = true;
+		if (++stores % indexInterval == 0)
+			save();
+	}
+
+	// writes the index if it misses changes, for a player that is not destroyed at its end
+	void flush()
+	{
+		std::lock_guard<std::mutex> l(mtx);
+		if (!directory.empty() && dirty)
+			save();
+	}
+
+	Stats statistics()
+	{
+		std::lock_guard<std::mutex> l(mtx);
+		return stats;
+	}
+
+	size_t size()
+	{
+		std::lock_guard<std::mutex> l(mtx);
+		return bytes;
+	}
+
+private:
+	struct Object
+	{
+		ReplacementPolicy::Entry entry;
+		double key;
+		// mapped on the first hit, until the segment is evicted
+		std::shared_ptr<const MappedFile> file;
+	};
+
+	static const uint64_t offsetBasis = 14695981039346656037ull;
+	static const int indexInterval = 32;
+
+	std::string directory;
+	std::unique_ptr<ReplacementPolicy> policy;
+	size_t capacity;
+	size_t bytes = 0;
+	double age = 0;
+	long long accesses = 0;
+	size_t stores = 0;
+	// the index misses changes since it was written
+	bool dirty = false;
+	Stats stats = { 0, 0, 0, 0 };
+
+	std::unordered_map<std::string, Object> objects;
+	// file names in use, two urls with one hash cannot both be kept
+	std::set<uint64_t> names;
+	// (policy key, url), the first one is evicted next
+	std::set<std::pair<double, std::string>> heap;
+	std::mutex mtx;
+
+	void insert(const std::string& url, const ReplacementPolicy::Entry& entry)
+	{
+		auto& object = objects[url];
+		object.entry = entry;
+		object.key = 0;
+		names.insert(name(url));
+		bytes += entry.size;
+		rekey(url, object);
+	}
+
+	void rekey(const std::string& url, Object& object)
+	{
+		heap.erase({ object.key, url });
+		object.key = policy->key(object.entry, age);
+		heap.insert({ object.key, url });
+	}
+
+	void remove(std::unordered_map<std::string, Object>::iterator it)
+	{
+		heap.erase({ it->second.key, it->first });
+		names.erase(name(it->first));
+		bytes -= it->second.entry.size;
+		// unmapped first, Windows does not delete a mapped file
+		it->second.file.reset();
+		std::remove(path(it->first).c_str());
+		objects.erase(it);
+		dirty = true;
+	}
+
+	// segments of the index whose file is still there with its size, in the order they were indexed
+	void load()
+	{
+		std::ifstream index(directory + "/index");
+		std::string line;
+		if (!index || !std::getline(index, line) || !(std::istringstream(line) >> age))
+			return;
+		while (std::getline(index, line))
+		{
+			std::istringstream ls(line);
+			ReplacementPolicy::Entry entry;
+			std::string url;
+			if (!(ls >> entry.refcount >> entry.popular >> entry.size) || !std::getline(ls >> std::ws, url) || objects.count(url)
+				|| names.count(name(url)))
+				continue;
+			std::ifstream file(path(url), std::ios::binary | std::ios::ate);
+			if (!file || (size_t)file.tellg() != entry.size)
+				continue;
+			entry.lastAccess = ++accesses;
+			insert(url, entry);
+		}
+		// the capacity may have shrunk since the index was written
+		while (bytes > capacity && !heap.empty())
+		{
+			auto victim = objects.find(heap.begin()->second);
+			age = policy->ageAfterEviction(victim->second.entry, victim->second.key);
+			remove(victim);
+		}
+	}
+
+	void save()
+	{
+		std::ostringstream ss;
+		ss.precision(17);
+		ss << age << "\n";
+		// in eviction order, so the recency of the least recently used policy survives a restart
+		for (auto& it : heap)
+		{
+			auto& entry = objects.at(it.second).entry;
+			ss << entry.refcount << " " << entry.popular << " " << entry.size << " " << it.second << "\n";
+		}
+		if (write(directory + "/index", ss.str()))
+			dirty = false;
+	}
+
+	// written next to the target and renamed, a player starting meanwhile never reads a partial file
+	static bool write(const std::string& target, const std::string& data)
+	{
+		std::string tmp = target + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()))
+			+ "." + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()) + ".tmp";
+		{
+			std::ofstream out(tmp, std::ios::binary);
+			out.write(data.data(), data.size());
+			if (!out)
+			{
+				out.close();
+				std::remove(tmp.c_str());
+				return false;
+			}
+		}
+#ifdef _WIN32
+		std::remove(target.c_str());
+#endif
+		if (std::rename(tmp.c_str(), target.c_str()) != 0)
+		{
+			std::remove(tmp.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	std::string path(const std::string& url) const
+	{
+		char file[24];
+		snprintf(file, sizeof(file), "%016llx", (unsigned long long)name(url));
+		return directory + "/" + file + ".seg";
+	}
+
+	static uint64_t name(const std::string& url)
+	{
+		uint64_t h = offsetBasis;
+		for (unsigned char c : url)
+			h = (h ^ c) * 1099511628211ull;
+		return h;
+	}
+};
@@ -0,0 +1,177 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	The requests of a session log. record observes every request of
+	the player's clients. Replay is the transport of the clients while
+	a log is replayed: each request takes the next recorded answer to
+	the same path and range, with its status, X-Cache and chunked
+	headers, its first byte after the recorded time and its body
+	spread over the recorded transfer time. A broken off transfer
+	breaks off after as many bytes. The log keeps the bodies of the
+	small files only; those of the media segments are fetched from the
+	server beforehand, or are zeros of the recorded size if it has
+	none. Requests the log has no answer for go to the server untimed.
+*/
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+
+#include "httplib.h"
+#include "SessionLog.hpp"
+
+class SessionHttp
+{
+public:
+	// the media segments and batches of tiles, the log keeps their size without their body
+	static bool isMedia(const std::string& path)
+	{
+		auto end = path.substr(0, path.find('?'));
+		auto endsWith = [&](const char* suffix)
+		{
+			size_t n = std::strlen(suffix);
+			return end.size() >= n && end.compare(end.size() - n, n, suffix) == 0;
+		};
+		return endsWith(".m4s") || endsWith(".mp4") || path.compare(0, 7, "/batch/") == 0;
+	}
+
+	// the request observer of a recorded session [any thread sending requests]
+	static void record(const httplib::Request& req, const httplib::Response& res, const httplib::Exchange& exchange)
+	{
+		auto& log = SessionLog::instance();
+		SessionLog::Request request;
+		request.startUs = log.since(exchange.start);
+		request.firstByteUs = log.since(exchange.first_byte);
+		request.endUs = log.since(exchange.end);
+		request.status = res.status;
+		request.complete = exchange.complete;
+		request.chunked = res.get_header_value("Transfer-Encoding") == "chunked";
+		request.received = exchange.received;
+		request.method = req.method;
+		request.path = req.path;
+		request.range = req.get_header_value("Range");
+		request.xCache = res.get_header_value("X-Cache");
+		request.hasBody = !req.content_receiver && !isMedia(req.path);
+		if (request.hasBody)
+			request.body = res.body;
+		log.request(request);
+	}
+
+	class Replay : public httplib::Transport
+	{
+	public:
+		Replay(const std::string& host, int port, bool proxyServer) : host(host), port(port), proxyServer(proxyServer) {}
+
+		std::unique_ptr<httplib::Stream> open(httplib::Request& req, httplib::Response& res, int, bool) override
+		{
+			auto opened = std::chrono::steady_clock::now();
+			SessionLog::Request recorded;
+			auto range = req.get_header_value("Range");
+			if (!SessionLog::instance().nextRequest(req.method, req.path, range, recorded))
+			{
+				httplib::Response fetched;
+				if (!fetch(req, range, fetched))
+					return nullptr;
+				res.status = fetched.status;
+				res.headers = fetched.headers;
+				res.headers.erase("Content-Length");
+				res.set_header("Content-Length", std::to_string(fetched.body.size()).c_str());
+				auto size = fetched.body.size();
+				return std::unique_ptr<httplib::Stream>(new Body(std::move(fetched.body), size, opened, opened));
+			}
+
+			std::string body;
+			if (recorded.hasBody)
+				body = std::move(recorded.body);
+			else if (recorded.status >= 0)
+			{
+				httplib::Response fetched;
+				if (fetch(req, range, fetched) && fetched.status == recorded.status)
+					body = std::move(fetched.body);
+				else
+					body.assign((size_t)recorded.received, '\0');
+			}
+
+			auto firstByte = opened + std::chrono::microseconds(std::max<int64_t>(0, recorded.firstByteUs - recorded.startUs));
+			auto end = firstByte + std::chrono::microseconds(std::max<int64_t>(0, recorded.endUs - recorded.firstByteUs));
+			// fetching the body from the server took longer than the recorded answer
+			if (std::chrono::steady_clock::now() > firstByte + std::chrono::milliseconds(1))
+				SessionLog::instance().late();
+			std::this_thread::sleep_until(firstByte);
+			// no answer arrived
+			if (recorded.status < 0)
+			{
+				std::this_thread::sleep_until(end);
+				return nullptr;
+			}
+
+			res.status = recorded.status;
+			if (!recorded.xCache.empty())
+				res.set_header("X-Cache", recorded.xCache.c_str());
+			if (recorded.chunked)
+				res.set_header("Transfer-Encoding", "chunked");
+			// the length of the whole body, of which a broken off transfer only sends what it received
+			size_t sent = recorded.complete ? body.size() : (size_t)std::min<uint64_t>(body.size(), recorded.received);
+			size_t length = recorded.complete ? body.size() : std::max(body.size(), sent + 1);
+			res.set_header("Content-Length", std::to_string(length).c_str());
+			return std::unique_ptr<httplib::Stream>(new Body(std::move(body), sent, firstByte, end));
+		}
+
+	private:
+		// the body up to sent bytes, paced to arrive evenly from begin to end, then the read fails
+		class Body : public httplib::Stream
+		{
+		public:
+			Body(std::string data, size_t sent, std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end)
+				: data(std::move(data)), sent(std::min(sent, this->data.size())), offset(0), begin(begin), end(end)
+			{
+			}
+
+			int read(char* ptr, size_t size) override
+			{
+				const size_t chunk = 16384;
+				if (offset >= sent)
+					return -1;
+				size_t n = std::min(std::min(size, sent - offset), chunk);
+				std::this_thread::sleep_until(begin + (end - begin) * (offset + n) / sent);
+				std::memcpy(ptr, data.data() + offset, n);
+				offset += n;
+				return (int)n;
+			}
+
+			int write(const char*, size_t) override { return -1; }
+			int write(const char*) override { return -1; }
+			std::string get_remote_addr() override { return ""; }
+
+		private:
+			std::string data;
+			size_t sent;
+			size_t offset;
+			std::chrono::steady_clock::time_point begin;
+			std::chrono::steady_clock::time_point end;
+		};
+
+		std::string host;
+		int port;
+		bool proxyServer;
+
+		// the answer of the server to req, on a connection of its own
+		bool fetch(const httplib::Request& req, const std::string& range, httplib::Response& res)
+		{
+			httplib::Client client(host.c_str(), port);
+			client.proxyServer = proxyServer;
+			httplib::Request forward;
+			forward.method = req.method;
+			forward.path = req.path;
+			if (!range.empty())
+				forward.set_header("Range", range.c_str());
+			return client.send(forward, res);
+		}
+	};
+};
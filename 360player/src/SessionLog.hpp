@@ -0,0 +1,373 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Binary log of what a session took in: the poses handed to the
+	adaption, every HTTP request with its timing, status, size and
+	X-Cache answer, the bodies of the MPD and the other small files,
+	and the time every tile frame took to decode. A replay reads the
+	log back in place of the tracker, the network timing and the
+	measured decode times, so a run can be repeated with the same
+	inputs to compare builds.
+
+	Layout: the magic "360SESS1", then records of a type byte, the
+	length of the payload as uint32 and the payload, in the byte order
+	of the host. Times are microseconds since the log was started,
+	pose timestamps ms as updatePose takes them.
+*/
+
+#pragma once
+
+#include <map>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+
+#include "Quaternion.hpp"
+
+class SessionLog
+{
+public:
+	enum RecordType : uint8_t
+	{
+		PoseRecord = 1,
+		RequestRecord = 2,
+		DecodeRecord = 3,
+	};
+
+	struct Request
+	{
+		// from the start of the log until the request was sent, the first byte of the body arrived and it ended
+		int64_t startUs = 0;
+		int64_t firstByteUs = 0;
+		int64_t endUs = 0;
+		int status = -1;
+		bool complete = false;
+		bool chunked = false;
+		uint64_t received = 0;
+		std::string method;
+		std::string path;
+		std::string range;
+		std::string xCache;
+		// only kept for files that are no media segments
+		bool hasBody = false;
+		std::string body;
+	};
+
+	struct Decode
+	{
+		int64_t timeUs;
+		double pixels;
+		double bytes;
+		double ms;
+	};
+
+	static SessionLog& instance()
+	{
+		static SessionLog log;
+		return log;
+	}
+
+	// starts writing a log to path, false if it can not be created
+	bool record(const std::string& path)
+	{
+		std::lock_guard<std::mutex> l(mtx);
+		file.open(path, std::ios::binary | std::ios::trunc);
+		if (!file)
+			return false;
+		file.write("360SESS1", 8);
+		start = std::chrono::steady_clock::now();
+		recordingOn = true;
+		return true;
+	}
+
+	// reads the log at path for a replay, false if it is no session log
+	bool replay(const std::string& path)
+	{
+		std::ifstream in(path, std::ios::binary);
+		char magic[8];
+		if (!in.read(magic, 8) || std::memcmp(magic, "360SESS1", 8) != 0)
+			return false;
+
+		std::lock_guard<std::mutex> l(mtx);
+		uint8_t type;
+		uint32_t length;
+		std::string payload;
+		while (in.read((char*)&type, 1) && in.read((char*)&length, 4))
+		{
+			payload.resize(length);
+			if (length > 0 && !in.read(&payload[0], length))
+				break;
+			Reader reader(payload);
+			if (type == PoseRecord)
+			{
+				int64_t timestamp;
+				float q[4];
+				if (reader.get(timestamp) && reader.get(q))
+					poses.push_back({ timestamp, IMT::Quaternion(q[0], q[1], q[2], q[3]) });
+			}
+			else if (type == RequestRecord)
+			{
+				Request request;
+				if (readRequest(reader, request))
+					requests[key(request.method, request.path, request.range)].push_back(std::move(request));
+			}
+			else if (type == DecodeRecord)
+			{
+				Decode decode;
+				if (reader.get(decode.timeUs) && reader.get(decode.pixels) && reader.get(decode.bytes) && reader.get(decode.ms))
+					decodes.push_back(decode);
+			}
+			// records of other types are left for newer readers
+		}
+		std::stable_sort(poses.begin(), poses.end(), [](const Pose& a, const Pose& b) { return a.timestamp < b.timestamp; });
+		start = std::chrono::steady_clock::now();
+		replayOn = true;
+		return true;
+	}
+
+	bool recording() const
+	{
+		return recordingOn;
+	}
+
+	bool replaying() const
+	{
+		return replayOn;
+	}
+
+	// microseconds since the log was started or read
+	int64_t now() const
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	int64_t since(std::chrono::steady_clock::time_point time) const
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(time - start).count();
+	}
+
+	// a pose handed to the adaption [pose sampler or render thread]
+	void pose(long long timestamp, const IMT::Quaternion& rotation)
+	{
+		if (!recordingOn)
+			return;
+		std::string payload;
+		put(payload, (int64_t)timestamp);
+		float q[4] = { (float)rotation.GetW(), (float)rotation.GetV().GetX(), (float)rotation.GetV().GetY(), (float)rotation.GetV().GetZ() };
+		put(payload, q);
+		write(PoseRecord, payload);
+	}
+
+	// the recorded pose at timestamp, the newest one not after it. False before the first one
+	bool poseAt(long long timestamp, IMT::Quaternion& rotation) const
+	{
+		auto it = std::upper_bound(poses.begin(), poses.end(), timestamp, [](long long t, const Pose& p) { return t < p.timestamp; });
+		if (it == poses.begin())
+			return false;
+		rotation = std::prev(it)->rotation;
+		return true;
+	}
+
+	// timestamp of the last recorded pose, -1 without poses
+	long long lastPose() const
+	{
+		return poses.empty() ? -1 : poses.back().timestamp;
+	}
+
+	// [download threads] a request that ended
+	void request(const Request& request)
+	{
+		if (!recordingOn)
+			return;
+		std::string payload;
+		put(payload, request.startUs);
+		put(payload, request.firstByteUs);
+		put(payload, request.endUs);
+		put(payload, (int32_t)request.status);
+		put(payload, (uint8_t)((request.complete ? 1 : 0) | (request.chunked ? 2 : 0) | (request.hasBody ? 4 : 0)));
+		put(payload, request.received);
+		put(payload, request.method);
+		put(payload, request.path);
+		put(payload, request.range);
+		put(payload, request.xCache);
+		if (request.hasBody)
+			put(payload, request.body);
+		write(RequestRecord, payload);
+	}
+
+	// takes the next recorded answer to the request, false if the log has none left
+	bool nextRequest(const std::string& method, const std::string& path, const std::string& range, Request& request)
+	{
+		std::lock_guard<std::mutex> l(mtx);
+		auto it = requests.find(key(method, path, range));
+		if (it == requests.end() || it->second.empty())
+		{
+			unrecorded++;
+			return false;
+		}
+		request = std::move(it->second.front());
+		it->second.pop_front();
+		replayed++;
+		return true;
+	}
+
+	// a tile frame of ms decode time, returns the time to go on with: ms itself, or in a replay the time of the
+	// recorded frame in its place as long as there are any [decoder threads]
+	double decode(double pixels, double bytes, double ms)
+	{
+		if (replayOn)
+		{
+			std::lock_guard<std::mutex> l(mtx);
+			if (nextDecode < decodes.size())
+				return decodes[nextDecode++].ms;
+			return ms;
+		}
+		if (!recordingOn)
+			return ms;
+		std::string payload;
+		put(payload, now());
+		put(payload, pixels);
+		put(payload, bytes);
+		put(payload, ms);
+		write(DecodeRecord, payload);
+		return ms;
+	}
+
+	// a replayed answer that arrived later than recorded [download threads]
+	void late()
+	{
+		std::lock_guard<std::mutex> l(mtx);
+		lateAnswers++;
+	}
+
+	struct ReplayStats
+	{
+		size_t replayed;
+		size_t unrecorded;
+		size_t left;
+		size_t late;
+		size_t decodes;
+		size_t decodesLeft;
+	};
+
+	ReplayStats statistics()
+	{
+		std::lock_guard<std::mutex> l(mtx);
+		size_t left = 0;
+		for (auto& r : requests)
+			left += r.second.size();
+		return { replayed, unrecorded, left, lateAnswers, nextDecode, decodes.size() - nextDecode };
+	}
+
+	void close()
+	{
+		std::lock_guard<std::mutex> l(mtx);
+		recordingOn = false;
+		if (file.is_open())
+			file.close();
+	}
+
+private:
+	struct Pose
+	{
+		long long timestamp;
+		IMT::Quaternion rotation;
+	};
+
+	class Reader
+	{
+	public:
+		explicit Reader(const std::string& data) : data(data), offset(0) {}
+
+		template <typename T>
+		bool get(T& value)
+		{
+			if (offset + sizeof(T) > data.size())
+				return false;
+			std::memcpy(&value, data.data() + offset, sizeof(T));
+			offset += sizeof(T);
+			return true;
+		}
+
+		bool get(std::string& value)
+		{
+			uint32_t length;
+			if (!get(length) || offset + length > data.size())
+				return false;
+			value.assign(data, offset, length);
+			offset += length;
+			return true;
+		}
+
+	private:
+		const std::string& data;
+		size_t offset;
+	};
+
+	std::mutex mtx;
+	std::ofstream file;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::atomic<bool> recordingOn{ false };
+	std::atomic<bool> replayOn{ false };
+	std::vector<Pose> poses;
+	// recorded answers by method, path and range, in the order they were requested
+	std::map<std::string, std::deque<Request>> requests;
+	std::vector<Decode> decodes;
+	size_t nextDecode = 0;
+	size_t replayed = 0;
+	size_t unrecorded = 0;
+	size_t lateAnswers = 0;
+
+	SessionLog() {}
+
+	static std::string key(const std::string& method, const std::string& path, const std::string& range)
+	{
+		return method + " " + path + " " + range;
+	}
+
+	template <typename T>
+	static void put(std::string& payload, const T& value)
+	{
+		payload.append((const char*)&value, sizeof(T));
+	}
+
+	static void put(std::string& payload, const std::string& value)
+	{
+		put(payload, (uint32_t)value.size());
+		payload += value;
+	}
+
+	static bool readRequest(Reader& reader, Request& request)
+	{
+		int32_t status;
+		uint8_t flags;
+		if (!reader.get(request.startUs) || !reader.get(request.firstByteUs) || !reader.get(request.endUs) || !reader.get(status)
+			|| !reader.get(flags) || !reader.get(request.received) || !reader.get(request.method) || !reader.get(request.path)
+			|| !reader.get(request.range) || !reader.get(request.xCache))
+			return false;
+		request.status = status;
+		request.complete = (flags & 1) != 0;
+		request.chunked = (flags & 2) != 0;
+		request.hasBody = (flags & 4) != 0;
+		return !request.hasBody || reader.get(request.body);
+	}
+
+	void write(RecordType type, const std::string& payload)
+	{
+		std::lock_guard<std::mutex> l(mtx);
+		if (!recordingOn)
+			return;
+		uint32_t length = (uint32_t)payload.size();
+		file.write((const char*)&type, 1);
+		file.write((const char*)&length, 4);
+		file.write(payload.data(), payload.size());
+	}
+};
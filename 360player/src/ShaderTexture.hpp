@@ -38,23 +38,92 @@ static const GLchar* vertexShader =
     "   UV = vertexUV;\n"
     "}\n";
 
-static const GLchar* fragmentShader = "#version 330 core\n"
-                                      //"in vec3 fragmentColor;\n"
-                                      "// Interpolated values from the vertex shaders\n"
-                                      "in vec2 UV;\n"
+// Per pixel projection: one triangle covers the viewport and every fragment gets its view ray. Only the
+// rotation of the view is inverted, the sphere is at infinity so the eye offset does not move it
+static const GLchar* vertexShaderRay =
+    "#version 330 core\n"
+    "layout(location = 0) in vec3 position;\n"
+    "out vec3 ray;\n"
+    "uniform mat4 modelView;\n"
+    "uniform mat4 projection;\n"
+    "void main()\n"
+    "{\n"
+    "   gl_Position = vec4(position.xy, 0.0, 1.0);\n"
+    "   vec4 far = inverse(projection * mat4(mat3(modelView))) * vec4(position.xy, 1.0, 1.0);\n"
+    "   ray = far.xyz / far.w;\n"
+    "}\n";
+
+// Single pass stereo: instance i is eye i, drawn into half i of the target. The position is squeezed into the
+// half and clipped at its edges, so each eye keeps its own frustum
+static const GLchar* vertexShaderStereo =
+    "#version 330 core\n"
+    "layout(location = 0) in vec3 position;\n"
+    "layout(location = 1) in vec2 vertexUV;\n"
+    "out vec2 UV;\n"
+    "uniform mat4 modelView[2];\n"
+    "uniform mat4 projection[2];\n"
+    "void main()\n"
+    "{\n"
+    "   vec4 p = projection[gl_InstanceID] * modelView[gl_InstanceID] * vec4(position,1);\n"
+    "   gl_ClipDistance[0] = p.w + p.x;\n"
+    "   gl_ClipDistance[1] = p.w - p.x;\n"
+    "   gl_Position = vec4(0.5 * p.x + (float(gl_InstanceID) - 0.5) * p.w, p.yzw);\n"
+    "   UV = vertexUV;\n"
+    "}\n";
+
+static const GLchar* vertexShaderRayStereo =
+    "#version 330 core\n"
+    "layout(location = 0) in vec3 position;\n"
+    "out vec3 ray;\n"
+    "uniform mat4 modelView[2];\n"
+    "uniform mat4 projection[2];\n"
+    "void main()\n"
+    "{\n"
+    "   gl_ClipDistance[0] = 1.0 + position.x;\n"
+    "   gl_ClipDistance[1] = 1.0 - position.x;\n"
+    "   gl_Position = vec4(0.5 * position.x + float(gl_InstanceID) - 0.5, position.y, 0.0, 1.0);\n"
+    "   vec4 far = inverse(projection[gl_InstanceID] * mat4(mat3(modelView[gl_InstanceID]))) * vec4(position.xy, 1.0, 1.0);\n"
+    "   ray = far.xyz / far.w;\n"
+    "}\n";
+
+// Put in front of the fragment shaders, which read the equirectangular UV from the mesh or from the ray.
+// The ray gives the UVs MeshCubeEquiUV computes per vertex
+static const GLchar* fragmentHeaderMesh =
+    "#version 330 core\n"
+    "// Interpolated values from the vertex shaders\n"
+    "in vec2 UV;\n";
+
+static const GLchar* fragmentHeaderRay =
+    "#version 330 core\n"
+    "in vec3 ray;\n"
+    "vec2 equirectUV(vec3 d)\n"
+    "{\n"
+    "   const float PI = 3.141592653589793;\n"
+    "   d = normalize(d);\n"
+    "   return vec2((atan(d.z, d.x) + PI) / (2.0 * PI), acos(clamp(d.y, -1.0, 1.0)) / PI);\n"
+    "}\n"
+    "#define UV equirectUV(ray)\n";
+
+// the gradients skip the jump of U at the seam, where the mipmap would otherwise drop to its smallest level
+static const GLchar* fragmentShader = //"in vec3 fragmentColor;\n"
                                       "out vec3 color;\n"
                                       "uniform sampler2D myTextureSampler;\n"
                                       "void main()\n"
                                       "{\n"
                                       //"    color = fragmentColor;\n"
-                                      "    color = texture( myTextureSampler, UV ).rgb;\n"
+                                      "    vec2 uv = UV;\n"
+                                      "    vec2 dx = dFdx(uv);\n"
+                                      "    vec2 dy = dFdy(uv);\n"
+                                      "    dx.x -= round(dx.x);\n"
+                                      "    dy.x -= round(dy.x);\n"
+                                      "    color = textureGrad( myTextureSampler, uv, dx, dy ).rgb;\n"
                                       "}\n";
 
 class ShaderTexture {
   public:
     ShaderTexture(void): m_initialized(false), m_programId(0),
       m_projectionUniformId(0), m_modelViewUniformId(0), m_myTextureUniformId(0),
-      m_textureId(0) {}
+      m_textureId(0), m_perPixel(false), m_stereo(false), m_framePrepared(false), m_preparedFrame() {}
 
     virtual ~ShaderTexture()
     {
@@ -69,38 +138,17 @@ class ShaderTexture {
     }
 
 
+    //Draw on a MeshFullScreen and project the sphere per pixel instead of reading the UVs of the mesh,
+    //to be set before the first draw
+    void SetPerPixelProjection(bool perPixel) {m_perPixel = perPixel;}
+    //Draw both eyes with one instanced draw into a StereoTarget, to be set before the first draw
+    void SetSinglePassStereo(bool stereo) {m_stereo = stereo;}
+
     virtual void init()
     {
         if (!m_initialized)
         {
-            GLuint vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
-            GLuint fragmentShaderId = glCreateShader(GL_FRAGMENT_SHADER);
-
-            // vertex shader
-            glShaderSource(vertexShaderId, 1, &vertexShader, NULL);
-            glCompileShader(vertexShaderId);
-            checkShaderError(vertexShaderId,
-                             "Vertex shader compilation failed.");
-
-            // fragment shader
-            glShaderSource(fragmentShaderId, 1, &fragmentShader, NULL);
-            glCompileShader(fragmentShaderId);
-            checkShaderError(fragmentShaderId,
-                             "Fragment shader compilation failed.");
-
-            // linking program
-            m_programId = glCreateProgram();
-            glAttachShader(m_programId, vertexShaderId);
-            glAttachShader(m_programId, fragmentShaderId);
-            glLinkProgram(m_programId);
-            checkProgramError(m_programId, "Shader program link failed.");
-
-            // once linked into a program, we no longer need the shaders.
-            glDeleteShader(vertexShaderId);
-            glDeleteShader(fragmentShaderId);
-
-            m_projectionUniformId = glGetUniformLocation(m_programId, "projection");
-            m_modelViewUniformId = glGetUniformLocation(m_programId, "modelView");
+            compileProgram(fragmentShader);
             m_myTextureUniformId = glGetUniformLocation(m_programId, "myTextureSampler");
             m_initialized = true;
         }
@@ -108,18 +156,25 @@ class ShaderTexture {
 
     virtual void InitAudio(void) {}
 
-    virtual DisplayFrameInfo useProgram(const GLdouble projection[], const GLdouble modelView[], std::chrono::system_clock::time_point deadline)
+    //Upload the picture due at deadline ahead of the draws, which then sample the freshest pose after the upload
+    //and draw with this picture until the next PrepareFrame. Its dropped frames are reported by the first draw
+    DisplayFrameInfo PrepareFrame(std::chrono::system_clock::time_point deadline)
     {
         init();
         glUseProgram(m_programId);
-        GLfloat projectionf[16];
-        GLfloat modelViewf[16];
-        convertMatrix(projection, projectionf);
-        convertMatrix(modelView, modelViewf);
-        glUniformMatrix4fv(m_projectionUniformId, 1, GL_FALSE, projectionf);
-        glUniformMatrix4fv(m_modelViewUniformId, 1, GL_FALSE, modelViewf);
-
-        auto frameInfo = UpdateTexture(std::move(deadline));
+        m_preparedFrame = UpdateTexture(std::move(deadline));
+        m_framePrepared = true;
+        return m_preparedFrame;
+    }
+
+    //projection and modelView hold one matrix per eye, two with the single pass stereo
+    virtual DisplayFrameInfo useProgram(const GLdouble projection[], const GLdouble modelView[], std::chrono::system_clock::time_point deadline, GLsizei eyes)
+    {
+        init();
+        glUseProgram(m_programId);
+        setMatrices(projection, modelView, eyes);
+
+        auto frameInfo = NextFrame(std::move(deadline));
         glActiveTexture(GL_TEXTURE0);
 	
     		glBindTexture(GL_TEXTURE_2D, m_textureId);
@@ -142,10 +197,73 @@ class ShaderTexture {
     GLuint m_modelViewUniformId = 0;
     GLuint m_myTextureUniformId = 0;
     GLuint m_textureId = 0;
+    bool m_perPixel;
+    bool m_stereo;
+    bool m_framePrepared;
+    DisplayFrameInfo m_preparedFrame;
 
     //Update content of openGl m_textureId object and return the current displayed frame id
     virtual DisplayFrameInfo UpdateTexture(std::chrono::system_clock::time_point deadline) = 0;
 
+    //Link m_programId from the vertex shader of the projection and the fragment shader body behind its header
+    void compileProgram(const GLchar* fragmentBody)
+    {
+        GLuint vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
+        GLuint fragmentShaderId = glCreateShader(GL_FRAGMENT_SHADER);
+
+        // vertex shader
+        const GLchar* vertexSource = m_stereo ? (m_perPixel ? vertexShaderRayStereo : vertexShaderStereo)
+                                              : (m_perPixel ? vertexShaderRay : vertexShader);
+        glShaderSource(vertexShaderId, 1, &vertexSource, NULL);
+        glCompileShader(vertexShaderId);
+        checkShaderError(vertexShaderId,
+                         "Vertex shader compilation failed.");
+
+        // fragment shader
+        const GLchar* fragmentSource[2] = { m_perPixel ? fragmentHeaderRay : fragmentHeaderMesh, fragmentBody };
+        glShaderSource(fragmentShaderId, 2, fragmentSource, NULL);
+        glCompileShader(fragmentShaderId);
+        checkShaderError(fragmentShaderId,
+                         "Fragment shader compilation failed.");
+
+        // linking program
+        m_programId = glCreateProgram();
+        glAttachShader(m_programId, vertexShaderId);
+        glAttachShader(m_programId, fragmentShaderId);
+        glLinkProgram(m_programId);
+        checkProgramError(m_programId, "Shader program link failed.");
+
+        // once linked into a program, we no longer need the shaders.
+        glDeleteShader(vertexShaderId);
+        glDeleteShader(fragmentShaderId);
+
+        m_projectionUniformId = glGetUniformLocation(m_programId, "projection");
+        m_modelViewUniformId = glGetUniformLocation(m_programId, "modelView");
+    }
+
+    //The picture of the last PrepareFrame once one was prepared, otherwise the one UpdateTexture uploads now
+    DisplayFrameInfo NextFrame(std::chrono::system_clock::time_point deadline)
+    {
+        if (!m_framePrepared)
+            return UpdateTexture(std::move(deadline));
+        auto frameInfo = m_preparedFrame;
+        m_preparedFrame.m_nbDroppedFrame = 0;
+        return frameInfo;
+    }
+
+    void setMatrices(const GLdouble projection[], const GLdouble modelView[], GLsizei eyes)
+    {
+        GLfloat projectionf[32];
+        GLfloat modelViewf[32];
+        for (GLsizei eye = 0; eye < eyes && eye < 2; eye++)
+        {
+            convertMatrix(projection + 16 * eye, projectionf + 16 * eye);
+            convertMatrix(modelView + 16 * eye, modelViewf + 16 * eye);
+        }
+        glUniformMatrix4fv(m_projectionUniformId, eyes, GL_FALSE, projectionf);
+        glUniformMatrix4fv(m_modelViewUniformId, eyes, GL_FALSE, modelViewf);
+    }
+
     void checkShaderError(GLuint shaderId, const std::string& exceptionMsg)
     {
         GLint result = GL_FALSE;
@@ -1,5 +1,14 @@
-// Author: Xavier Corbillon
-// IMT Atlantique
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Based on work by
+	Xavier Corbillon
+	IMT Atlantique
+*/
+
+#include <vector>
+#include <algorithm>
 
 #include "ShaderTextureStatic.hpp"
 #define STB_IMAGE_IMPLEMENTATION
@@ -8,43 +17,244 @@
 
 using namespace IMT;
 
+namespace {
+	// bytes uploaded per frame, so a 16K picture does not stall the frame it is ready in
+	const size_t kUploadBytesPerFrame = 32 * 1024 * 1024;
+	// the preview is at most this wide
+	const int kPreviewSize = 1024;
+
+	void SetParameters(bool mipmaps)
+	{
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	}
+
+	// the GL format of the blocks of ktx, 0 if the GPU cannot sample them. The sRGB variants are sampled
+	// like the linear ones, as the 8 bit pictures are
+	GLenum CompressedFormat(const Ktx2& ktx)
+	{
+		if (ktx.format == Ktx2::Format::BC7)
+			return GLEW_VERSION_4_2 || GLEW_ARB_texture_compression_bptc ? GL_COMPRESSED_RGBA_BPTC_UNORM_ARB : 0;
+		return GLEW_KHR_texture_compression_astc_ldr ? GL_COMPRESSED_RGBA_ASTC_4x4_KHR + (ktx.vkFormat - 157) / 2 : 0;
+	}
+}
+
+ShaderTextureStatic::ShaderTextureStatic(std::string pathToTexture) : ShaderTexture(), m_pathToTexture(pathToTexture)
+{
+	m_worker = std::thread(&ShaderTextureStatic::Decode, this);
+}
+
+ShaderTextureStatic::~ShaderTextureStatic(void)
+{
+	if (m_worker.joinable())
+		m_worker.join();
+	if (m_loadingTexture != 0)
+		glDeleteTextures(1, &m_loadingTexture);
+}
+
+ShaderTextureStatic::Decoded::~Decoded()
+{
+	if (pixels != nullptr)
+		stbi_image_free(pixels);
+}
+
+void ShaderTextureStatic::Decode(void)
+{
+	std::unique_ptr<Decoded> decoded(new Decoded());
+	if (Ktx2::isKtx2(m_pathToTexture))
+	{
+		decoded->compressed = true;
+		decoded->ktx.load(m_pathToTexture, decoded->error);
+	}
+	else
+	{
+		int w, h, comp;
+		if (!stbi_info(m_pathToTexture.c_str(), &w, &h, &comp))
+			decoded->error = stbi_failure_reason();
+		else
+		{
+			// grey pictures are expanded, alpha is kept
+			decoded->components = comp == 2 || comp == 4 ? 4 : 3;
+			decoded->pixels = stbi_load(m_pathToTexture.c_str(), &decoded->width, &decoded->height, &comp, decoded->components);
+			if (decoded->pixels == nullptr)
+				decoded->error = stbi_failure_reason();
+		}
+
+		int factor = (decoded->width + kPreviewSize - 1) / kPreviewSize;
+		if (decoded->pixels != nullptr && factor > 1)
+		{
+			int c = decoded->components;
+			decoded->previewWidth = decoded->width / factor;
+			decoded->previewHeight = std::max(1, decoded->height / factor);
+			decoded->preview.resize((size_t)decoded->previewWidth * decoded->previewHeight * c);
+			std::vector<unsigned> sum(decoded->previewWidth * c);
+			for (int y = 0; y < decoded->previewHeight; y++)
+			{
+				std::fill(sum.begin(), sum.end(), 0);
+				for (int dy = 0; dy < factor && y * factor + dy < decoded->height; dy++)
+				{
+					const unsigned char* row = decoded->pixels + (size_t)(y * factor + dy) * decoded->width * c;
+					for (int x = 0; x < decoded->previewWidth * factor; x++)
+						for (int k = 0; k < c; k++)
+							sum[(x / factor) * c + k] += row[x * c + k];
+				}
+				int count = factor * std::min(factor, decoded->height - y * factor);
+				for (size_t i = 0; i < sum.size(); i++)
+					decoded->preview[(size_t)y * sum.size() + i] = (unsigned char)(sum[i] / count);
+			}
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_done = std::move(decoded);
+}
+
 DisplayFrameInfo ShaderTextureStatic::UpdateTexture(std::chrono::system_clock::time_point deadline)
 {
-  auto& textureId = GetTextureId();
-  if(textureId == 0)
-  {
-    std::cout << "Load texture " << std::endl;
-    int w;
-    int h;
-    int comp;
-    unsigned char* image = stbi_load(m_pathToTexture.c_str(), &w, &h, &comp, 0);
-    if(image == nullptr)
-    {
-      throw(std::string("Failed to load texture"));
-    }
-    glGenTextures(1, &textureId);
-    glBindTexture(GL_TEXTURE_2D, textureId);
-
-    std::cout << "Loaded with " << comp << " comp" << std::endl;
-
-    if(comp == 3)
-    {
-      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-    }
-    else if(comp == 4)
-    {
-      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
-    }
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glGenerateMipmap(GL_TEXTURE_2D);
-
-    glBindTexture(GL_TEXTURE_2D, 0);
-    stbi_image_free(image);
-    std::cout << "Texture loaded" << std::endl;
-  }
-  return {0, 0, deadline, deadline, false};
+	auto& textureId = GetTextureId();
+	if (textureId == 0)
+	{
+		const unsigned char gray[3] = { 128, 128, 128 };
+		glGenTextures(1, &textureId);
+		glBindTexture(GL_TEXTURE_2D, textureId);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, gray);
+		SetParameters(false);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+
+	if (!m_complete)
+	{
+		if (!m_decoded)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_decoded = std::move(m_done);
+		}
+		if (m_decoded)
+		{
+			if (m_worker.joinable())
+			{
+				m_worker.join();
+				if (!m_decoded->error.empty())
+				{
+					throw(std::string("Failed to load texture: " + m_decoded->error));
+				}
+				std::cout << "Decoded " << m_pathToTexture << std::endl;
+			}
+			if (m_decoded->compressed)
+				UploadCompressed();
+			else
+				UploadPicture();
+		}
+	}
+	return {0, 0, deadline, deadline, false};
+}
+
+void ShaderTextureStatic::UploadPicture(void)
+{
+	auto& textureId = GetTextureId();
+	auto& d = *m_decoded;
+	GLenum format = d.components == 4 ? GL_RGBA : GL_RGB;
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	if (m_uploadLevel < 0)
+	{
+		if (!d.preview.empty())
+		{
+			glBindTexture(GL_TEXTURE_2D, textureId);
+			glTexImage2D(GL_TEXTURE_2D, 0, format, d.previewWidth, d.previewHeight, 0, format, GL_UNSIGNED_BYTE, d.preview.data());
+			SetParameters(true);
+			glGenerateMipmap(GL_TEXTURE_2D);
+		}
+		glGenTextures(1, &m_loadingTexture);
+		glBindTexture(GL_TEXTURE_2D, m_loadingTexture);
+		glTexImage2D(GL_TEXTURE_2D, 0, format, d.width, d.height, 0, format, GL_UNSIGNED_BYTE, nullptr);
+		m_uploadLevel = 0;
+	}
+
+	glBindTexture(GL_TEXTURE_2D, m_loadingTexture);
+	size_t rowBytes = (size_t)d.width * d.components;
+	size_t rows = std::min<size_t>(std::max<size_t>(1, kUploadBytesPerFrame / rowBytes), d.height - m_uploadRow);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, (GLint)m_uploadRow, d.width, (GLsizei)rows, format, GL_UNSIGNED_BYTE, d.pixels + m_uploadRow * rowBytes);
+	m_uploadRow += rows;
+
+	if (m_uploadRow == (size_t)d.height)
+	{
+		SetParameters(true);
+		glGenerateMipmap(GL_TEXTURE_2D);
+		glDeleteTextures(1, &textureId);
+		textureId = m_loadingTexture;
+		m_loadingTexture = 0;
+		m_complete = true;
+		m_decoded.reset();
+		std::cout << "Texture loaded" << std::endl;
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+void ShaderTextureStatic::UploadCompressed(void)
+{
+	auto& textureId = GetTextureId();
+	auto& ktx = m_decoded->ktx;
+	GLenum format = CompressedFormat(ktx);
+	if (format == 0)
+	{
+		throw(std::string("Failed to load texture: the GPU cannot sample ") + (ktx.format == Ktx2::Format::BC7 ? "BC7" : "ASTC"));
+	}
+	GLint numLevels = (GLint)ktx.levels.size();
+
+	if (m_uploadLevel < 0)
+	{
+		glGenTextures(1, &m_loadingTexture);
+		glBindTexture(GL_TEXTURE_2D, m_loadingTexture);
+		for (GLint l = 0; l < numLevels; l++)
+		{
+			auto& level = ktx.levels[l];
+			glCompressedTexImage2D(GL_TEXTURE_2D, l, format, level.width, level.height, 0, (GLsizei)level.size, nullptr);
+		}
+		SetParameters(numLevels > 1);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, numLevels - 1);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, numLevels - 1);
+		m_uploadLevel = numLevels - 1;
+	}
+
+	// the texture is shown from its first complete level on, every further level refines it
+	glBindTexture(GL_TEXTURE_2D, m_loadingTexture != 0 ? m_loadingTexture : textureId);
+	size_t budget = kUploadBytesPerFrame;
+	while (m_uploadLevel >= 0 && budget > 0)
+	{
+		auto& level = ktx.levels[m_uploadLevel];
+		size_t rowBytes = ktx.rowBytes(level);
+		size_t blockRows = (level.height + ktx.blockHeight - 1) / ktx.blockHeight;
+		size_t rows = std::min(blockRows - m_uploadRow, std::max<size_t>(1, budget / rowBytes));
+		GLint y = (GLint)(m_uploadRow * ktx.blockHeight);
+		GLsizei height = (GLsizei)std::min<size_t>(rows * ktx.blockHeight, level.height - y);
+		glCompressedTexSubImage2D(GL_TEXTURE_2D, m_uploadLevel, 0, y, level.width, height, format,
+			(GLsizei)(rows * rowBytes), ktx.data.data() + level.offset + m_uploadRow * rowBytes);
+		budget -= std::min(budget, rows * rowBytes);
+		m_uploadRow += rows;
+
+		if (m_uploadRow == blockRows)
+		{
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, m_uploadLevel);
+			if (m_loadingTexture != 0)
+			{
+				glDeleteTextures(1, &textureId);
+				textureId = m_loadingTexture;
+				m_loadingTexture = 0;
+			}
+			m_uploadLevel--;
+			m_uploadRow = 0;
+		}
+	}
+
+	if (m_uploadLevel < 0)
+	{
+		m_complete = true;
+		m_decoded.reset();
+		std::cout << "Texture loaded" << std::endl;
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
 }
@@ -1,21 +1,68 @@
-// Author: Xavier Corbillon
-// IMT Atlantique
-//
-// Description:
-// Shader Texture implementation for a static texture (the same for each frame)
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Based on work by
+	Xavier Corbillon
+	IMT Atlantique
+
+	Shader Texture implementation for a static texture (the same for each frame).
+	The picture is decoded on a worker thread from construction on; until it is
+	ready the sphere is mid gray, then a downscaled preview is shown while the
+	full picture goes up a slice per frame. KTX2 files with BC7 or ASTC blocks
+	are uploaded as they are, smallest mipmap level first.
+*/
+#pragma once
+
+#include <mutex>
+#include <memory>
+#include <thread>
 
 //internal includes
 #include "ShaderTexture.hpp"
+#include "Ktx2.hpp"
 
 namespace IMT {
 
 	class ShaderTextureStatic : public ShaderTexture
 	{
 	public:
-		ShaderTextureStatic(std::string pathToTexture) : ShaderTexture(), m_pathToTexture(pathToTexture) {}
-		virtual ~ShaderTextureStatic(void) = default;
+		ShaderTextureStatic(std::string pathToTexture);
+		virtual ~ShaderTextureStatic(void);
 	private:
+		// what the worker hands to the render thread
+		struct Decoded
+		{
+			std::string error;
+			bool compressed = false;
+			Ktx2 ktx;
+			// 3 or 4 components per pixel, from stb_image
+			unsigned char* pixels = nullptr;
+			int width = 0, height = 0, components = 0;
+			// box filtered to at most kPreviewSize wide, empty for pictures that small
+			std::vector<unsigned char> preview;
+			int previewWidth = 0, previewHeight = 0;
+
+			~Decoded();
+		};
+
 		std::string m_pathToTexture;
+		std::thread m_worker;
+		std::mutex m_mutex;
+		// set by the worker under m_mutex
+		std::unique_ptr<Decoded> m_done;
+		// owned by the render thread once taken from m_done
+		std::unique_ptr<Decoded> m_decoded;
+		// texture filled while m_textureId shows the preview, 0 when there is none
+		GLuint m_loadingTexture = 0;
+		// level and row of blocks or pixels the upload continues at
+		int m_uploadLevel = -1;
+		size_t m_uploadRow = 0;
+		bool m_complete = false;
+
+		void Decode(void);
+		void UploadPicture(void);
+		void UploadCompressed(void);
 
 		virtual DisplayFrameInfo UpdateTexture(std::chrono::system_clock::time_point deadline) override;
 	};
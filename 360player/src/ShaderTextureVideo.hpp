@@ -12,108 +12,116 @@
 #include "VideoReader.hpp"
 
 namespace IMT {
+// tiles of a grid with more tiles are not stretched
+static const int kMaxScaledTiles = 64;
+
+// a tile of a reduced resolution fills the top left of its region, scaled by its share of the region. Inside a
+// stretched tile the lookup stays a texel away from the end of its pixels, so filtering never reads the stale rest.
+// The picture is the layer set of the texture ring the last frame went into, U and V follow each other in tex_uv.
+// Goes behind the fragment header of ShaderTexture
 static const GLchar* fragmentShaderYUV = 
-"#version 330 core\n"
-"in vec2 UV;\n"
 "out vec3 color;\n"
-"uniform sampler2D tex_y;\n"
-"uniform sampler2D tex_u;\n"
-"uniform sampler2D tex_v;\n"
+"uniform sampler2DArray tex_y;\n"
+"uniform sampler2DArray tex_uv;\n"
+"uniform float textureSet;\n"
+"uniform vec2 tileGrid;\n"
+"uniform vec2 texSize;\n"
+"uniform vec2 tileScale[64];\n"
 "const mat3 coeff = mat3(1.164,  1.164, 1.164, \n"
 "                        1.596, -0.813,   0.0, \n"
 "                          0.0, -0.391, 2.018);\n"
 "const vec3 offset = vec3(0.0625, 0.5, 0.5);\n"
+"vec2 tileUV(vec2 uv)\n"
+"{\n"
+"	vec2 p = vec2(fract(uv.x), clamp(uv.y, 0.0, 1.0)) * tileGrid;\n"
+"	vec2 tile = min(floor(p), tileGrid - 1.0);\n"
+"	vec2 scale = tileScale[int(tile.y * tileGrid.x + tile.x)];\n"
+"	vec2 end = scale - step(scale, vec2(0.999)) * tileGrid / texSize;\n"
+"	return (tile + min((p - tile) * scale, end)) / tileGrid;\n"
+"}\n"
 "void main()\n"
 "{\n"
-"	float y = texture2D(tex_y, UV).r;\n"
-"	float cb = texture2D(tex_u, UV).r;\n"
-"	float cr = texture2D(tex_v, UV).r;\n"
+"	vec2 uv = tileUV(UV);\n"
+"	float y = texture(tex_y, vec3(uv, textureSet)).r;\n"
+"	float cb = texture(tex_uv, vec3(uv, 2.0 * textureSet)).r;\n"
+"	float cr = texture(tex_uv, vec3(uv, 2.0 * textureSet + 1.0)).r;\n"
 "	color = coeff * (vec3(y,cr,cb) - offset);\n"
 "}\n";
 
 class ShaderTextureVideo : public ShaderTexture
 {
 public:
-	ShaderTextureVideo(VideoTileStream* inputStreams, size_t numInputStreams, size_t nbFrames = -1, size_t bufferSize = 10, float startOffsetInSecond = 0) : ShaderTexture(),
-		m_videoReader(inputStreams, numInputStreams, bufferSize, startOffsetInSecond)
+	ShaderTextureVideo(VideoTileStream* inputStreams, size_t numInputStreams, size_t nbFrames = -1, size_t bufferSize = 10, const TileVisibility* tileVisibility = nullptr) : ShaderTexture(),
+		m_videoReader(inputStreams, numInputStreams, bufferSize), m_srd(inputStreams->getSRD())
 	{
+		m_videoReader.SetTileVisibility(tileVisibility);
 		m_videoReader.Init(nbFrames);
 	}
 	virtual ~ShaderTextureVideo(void) = default;
 
+	LibAv::VideoReader::DecodeStats GetStats(void) const
+	{
+		return m_videoReader.GetStats();
+	}
+
+	void Seek(const std::vector<std::string>& inits, std::vector<std::string>&& segments)
+	{
+		m_videoReader.Seek(inits, std::move(segments));
+	}
+
 	void init() override
 	{
 		if (!m_initialized)
 		{
-			GLuint vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
-			GLuint fragmentShaderId = glCreateShader(GL_FRAGMENT_SHADER);
-
-			// vertex shader
-			glShaderSource(vertexShaderId, 1, &vertexShader, NULL);
-			glCompileShader(vertexShaderId);
-			checkShaderError(vertexShaderId, "Vertex shader compilation failed.");
-
-			// fragment shader
-			glShaderSource(fragmentShaderId, 1, &fragmentShaderYUV, NULL);
-			glCompileShader(fragmentShaderId);
-			checkShaderError(fragmentShaderId, "Fragment shader compilation failed.");
-
-			// linking program
-			m_programId = glCreateProgram();
-			glAttachShader(m_programId, vertexShaderId);
-			glAttachShader(m_programId, fragmentShaderId);
-			glLinkProgram(m_programId);
-			checkProgramError(m_programId, "Shader program link failed.");
-
-			// once linked into a program, we no longer need the shaders.
-			glDeleteShader(vertexShaderId);
-			glDeleteShader(fragmentShaderId);
-
-			m_projectionUniformId = glGetUniformLocation(m_programId, "projection");
-			m_modelViewUniformId = glGetUniformLocation(m_programId, "modelView");
+			compileProgram(fragmentShaderYUV);
+			m_tileScaleUniformId = glGetUniformLocation(m_programId, "tileScale");
+			m_textureSetUniformId = glGetUniformLocation(m_programId, "textureSet");
 			m_initialized = true;
 		}
 	}
 
-	DisplayFrameInfo useProgram(const GLdouble projection[], const GLdouble modelView[], std::chrono::system_clock::time_point deadline) override
+	DisplayFrameInfo useProgram(const GLdouble projection[], const GLdouble modelView[], std::chrono::system_clock::time_point deadline, GLsizei eyes) override
 	{
 		init();
 		glUseProgram(m_programId);
-		GLfloat projectionf[16];
-		GLfloat modelViewf[16];
-		convertMatrix(projection, projectionf);
-		convertMatrix(modelView, modelViewf);
-		glUniformMatrix4fv(m_projectionUniformId, 1, GL_FALSE, projectionf);
-		glUniformMatrix4fv(m_modelViewUniformId, 1, GL_FALSE, modelViewf);
+		setMatrices(projection, modelView, eyes);
 
-		auto frameInfo = UpdateTexture(std::move(deadline));
+		auto frameInfo = NextFrame(std::move(deadline));
+
+		// bound for every draw, a prepared picture may have been uploaded before RenderManager used the units
+		m_videoReader.BindTextures(GL_TEXTURE0, GL_TEXTURE1);
+		glUniform1f(m_textureSetUniformId, (GLfloat)m_videoReader.GetTextureSet());
+		auto& scales = m_videoReader.GetTileScales();
+		if (!scales.empty() && scales.size() <= 2 * kMaxScaledTiles)
+			glUniform2fv(m_tileScaleUniformId, (GLsizei)(scales.size() / 2), scales.data());
+		glActiveTexture(GL_TEXTURE0);
 
 		return std::move(frameInfo);
 	}
 
 	DisplayFrameInfo UpdateTexture(std::chrono::system_clock::time_point deadline) override
 	{
-		static bool first = true;
-
-		if (first)
+		if (!m_uniformsSet)
 		{
-			glGenTextures(3, m_textureIds);
 			glUniform1i(glGetUniformLocation(m_programId, "tex_y"), 0);
-			glUniform1i(glGetUniformLocation(m_programId, "tex_u"), 1);
-			glUniform1i(glGetUniformLocation(m_programId, "tex_v"), 2);
-			first = false;
+			glUniform1i(glGetUniformLocation(m_programId, "tex_uv"), 1);
+			// a grid too large for the scales is sampled as one unscaled tile
+			bool scaled = m_srd.th * m_srd.tv <= kMaxScaledTiles;
+			glUniform2f(glGetUniformLocation(m_programId, "tileGrid"), scaled ? (GLfloat)m_srd.th : 1.0f, scaled ? (GLfloat)m_srd.tv : 1.0f);
+			glUniform2f(glGetUniformLocation(m_programId, "texSize"), (GLfloat)(m_srd.w * m_srd.th), (GLfloat)(m_srd.h * m_srd.tv));
+			const GLfloat unscaled[2] = { 1.0f, 1.0f };
+			glUniform2fv(m_tileScaleUniformId, 1, unscaled);
+			m_uniformsSet = true;
 		}
 
-		auto frameInfo = m_videoReader.SetNextPictureToOpenGLTexture(deadline, m_textureIds);
-
-		glActiveTexture(GL_TEXTURE0);
-
-		return std::move(frameInfo);
+		return m_videoReader.SetNextPictureToOpenGLTexture(deadline);
 	}
 
 private:
 	LibAv::VideoReader m_videoReader;
-
-	GLuint m_textureIds[3] = { 0, 0, 0 };
+	DASH::SRD m_srd;
+	GLuint m_tileScaleUniformId = 0;
+	GLuint m_textureSetUniformId = 0;
+	bool m_uniformsSet = false;
 };
 }
@@ -0,0 +1,126 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Render target of the single pass stereo. Both eyes are drawn with
+	one instanced draw into the two halves of one color buffer, which
+	is handed to RenderManager as the buffer of each eye with the half
+	it covers. RenderManager then only distorts and presents, it does
+	not call the render callbacks.
+*/
+
+#pragma once
+
+#include <GL/glew.h>
+#include <osvr/RenderKit/RenderManager.h>
+
+// This must come after we include <GL/gl.h> so its pointer types are defined.
+#include <osvr/RenderKit/GraphicsLibraryOpenGL.h>
+
+//standard includes
+#include <vector>
+#include <algorithm>
+
+class StereoTarget
+{
+public:
+	StereoTarget() : frameBuffer(0), colorBuffer(0), depthBuffer(0), width(0), height(0) {}
+	StereoTarget(const StereoTarget&) = delete;
+	StereoTarget& operator=(const StereoTarget&) = delete;
+
+	~StereoTarget()
+	{
+		if (frameBuffer != 0)
+			glDeleteFramebuffers(1, &frameBuffer);
+		if (colorBuffer != 0)
+			glDeleteTextures(1, &colorBuffer);
+		if (depthBuffer != 0)
+			glDeleteRenderbuffers(1, &depthBuffer);
+	}
+
+	// buffers for two eyes, each half as large as the larger eye viewport. False if RenderManager does not have
+	// two eyes or does not take the buffers [render thread]
+	bool Init(osvr::renderkit::RenderManager& render)
+	{
+		auto renderInfo = render.GetRenderInfo();
+		if (renderInfo.size() != 2)
+			return false;
+		for (auto& eye : renderInfo)
+		{
+			width = std::max(width, 2 * static_cast<GLsizei>(eye.viewport.width));
+			height = std::max(height, static_cast<GLsizei>(eye.viewport.height));
+		}
+
+		glGenFramebuffers(1, &frameBuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, frameBuffer);
+
+		glGenTextures(1, &colorBuffer);
+		glBindTexture(GL_TEXTURE_2D, colorBuffer);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, colorBuffer, 0);
+
+		glGenRenderbuffers(1, &depthBuffer);
+		glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+
+		bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		if (!complete)
+			return false;
+
+		// the same buffer for both eyes, each presents its half
+		osvr::renderkit::RenderBuffer buffer;
+		bufferGL.colorBufferName = colorBuffer;
+		bufferGL.depthStencilBufferName = depthBuffer;
+		buffer.OpenGL = &bufferGL;
+		buffers.push_back(buffer);
+		if (!render.RegisterRenderBuffers(buffers))
+			return false;
+		buffers.push_back(buffer);
+
+		for (size_t eye = 0; eye < 2; eye++)
+		{
+			osvr::renderkit::OSVR_ViewportDescription half;
+			half.left = 0.5 * eye;
+			half.lower = 0;
+			half.width = 0.5;
+			half.height = 1;
+			halves.push_back(half);
+		}
+		return true;
+	}
+
+	// draws go to the whole buffer and are clipped to the half of their eye [render thread]
+	void Bind()
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, frameBuffer);
+		glViewport(0, 0, width, height);
+		glEnable(GL_CLIP_DISTANCE0);
+		glEnable(GL_CLIP_DISTANCE1);
+		glClearColor(0.8f, 0, 0.1f, 1.0f);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	}
+
+	// renderInfo is the one the eyes were drawn with [render thread]
+	bool Present(osvr::renderkit::RenderManager& render, const std::vector<osvr::renderkit::RenderInfo>& renderInfo)
+	{
+		glDisable(GL_CLIP_DISTANCE0);
+		glDisable(GL_CLIP_DISTANCE1);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		return render.PresentRenderBuffers(buffers, renderInfo, osvr::renderkit::RenderManager::RenderParams(), halves);
+	}
+
+private:
+	GLuint frameBuffer;
+	GLuint colorBuffer;
+	GLuint depthBuffer;
+	GLsizei width;
+	GLsizei height;
+	osvr::renderkit::RenderBufferOpenGL bufferGL;
+	std::vector<osvr::renderkit::RenderBuffer> buffers;
+	std::vector<osvr::renderkit::OSVR_ViewportDescription> halves;
+};
@@ -0,0 +1,197 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Core affinity and priority of the player's threads, as the
+	[Threads] section of the config sets them per role. Every thread
+	of a role places itself when it starts. A role without cores runs
+	on all cores the process started with and one without priority at
+	normal priority, so no thread keeps what Linux lets it inherit from
+	the thread that started it. Threads libav starts inside a codec
+	take the placement of the thread that opens the codec.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+
+#include "ConfigParser.hpp"
+#include "Log.hpp"
+
+class ThreadTopology
+{
+public:
+	// places the calling thread as its role is configured, an unknown role takes the defaults. index >= 0 pins the
+	// index-th thread of a role with several threads to one of the role's cores in turn, else the thread may run
+	// on all of them
+	static bool apply(const std::string& role, int index = -1)
+	{
+		auto& current = currentRole();
+		current = { role, index };
+
+		Config::ThreadPlacement placement;
+		auto& threads = Config::instance()->threads;
+		auto it = threads.find(role);
+		if (it != threads.end())
+			placement = it->second;
+
+		std::vector<unsigned> cores = parseCores(placement.cores);
+		if (cores.empty())
+			cores = processCores();
+		else if (index >= 0)
+			cores = { cores[index % cores.size()] };
+
+		bool placed = setAffinity(cores);
+		if (!placed)
+			LOG_WARNING("Could not set the cores of the " << role << " thread to " << placement.cores);
+		if (!setPriority(placement.priority, placement.realtime))
+		{
+			LOG_WARNING("Could not set the " << (placement.realtime ? "realtime " : "") << placement.priority << " priority of the " << role << " thread");
+			placed = false;
+		}
+		return placed;
+	}
+
+	// the calling thread takes the placement of role until the scope ends, for the threads it starts meanwhile
+	class Scope
+	{
+	public:
+		explicit Scope(const std::string& role) : previous(currentRole())
+		{
+			apply(role);
+		}
+
+		~Scope()
+		{
+			apply(previous.first, previous.second);
+		}
+
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+
+	private:
+		std::pair<std::string, int> previous;
+	};
+
+	// "0,2-3" lists cores 0, 2 and 3, there are at most 1024
+	static std::vector<unsigned> parseCores(const std::string& text)
+	{
+		std::vector<unsigned> cores;
+		std::istringstream ss(text);
+		std::string range;
+		while (std::getline(ss, range, ','))
+		{
+			unsigned first, last;
+			char dash;
+			std::istringstream rs(range);
+			if (!(rs >> first))
+				continue;
+			if (!(rs >> dash >> last) || dash != '-')
+				last = first;
+			last = std::min(last, 1023u);
+			for (unsigned c = first; c <= last; c++)
+				cores.push_back(c);
+		}
+		return cores;
+	}
+
+private:
+	// role and index the calling thread was placed with last, an empty role for none
+	static std::pair<std::string, int>& currentRole()
+	{
+		static thread_local std::pair<std::string, int> role("", -1);
+		return role;
+	}
+
+	// the cores of the process before the first thread was placed
+	static const std::vector<unsigned>& processCores()
+	{
+		static const std::vector<unsigned> cores = []()
+		{
+			std::vector<unsigned> all;
+#ifdef _WIN32
+			DWORD_PTR processMask, systemMask;
+			if (GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask))
+				for (unsigned c = 0; c < sizeof(DWORD_PTR) * 8; c++)
+					if (processMask & (DWORD_PTR(1) << c))
+						all.push_back(c);
+#else
+			cpu_set_t cpuset;
+			if (sched_getaffinity(0, sizeof(cpu_set_t), &cpuset) == 0)
+				for (unsigned c = 0; c < CPU_SETSIZE; c++)
+					if (CPU_ISSET(c, &cpuset))
+						all.push_back(c);
+#endif
+			return all;
+		}();
+		return cores;
+	}
+
+	static bool setAffinity(const std::vector<unsigned>& cores)
+	{
+		if (cores.empty())
+			return true;
+#ifdef _WIN32
+		DWORD_PTR mask = 0;
+		for (auto c : cores)
+			if (c < sizeof(DWORD_PTR) * 8)
+				mask |= DWORD_PTR(1) << c;
+		return mask != 0 && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#else
+		cpu_set_t cpuset;
+		CPU_ZERO(&cpuset);
+		for (auto c : cores)
+			if (c < CPU_SETSIZE)
+				CPU_SET(c, &cpuset);
+		return CPU_COUNT(&cpuset) > 0 && pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset) == 0;
+#endif
+	}
+
+	// idle, low, normal, high or highest. Realtime is the time critical priority on Windows, which leaves out
+	// the level, and SCHED_FIFO on Linux, where the level orders the realtime threads among themselves
+	static bool setPriority(const std::string& priority, bool realtime)
+	{
+		static const char* levels[] = { "idle", "low", "normal", "high", "highest" };
+		int level = 2;
+		for (int l = 0; l < 5; l++)
+			if (priority == levels[l])
+				level = l;
+#ifdef _WIN32
+		static const int windowsPriorities[] = { THREAD_PRIORITY_IDLE, THREAD_PRIORITY_BELOW_NORMAL, THREAD_PRIORITY_NORMAL,
+			THREAD_PRIORITY_ABOVE_NORMAL, THREAD_PRIORITY_HIGHEST };
+		return SetThreadPriority(GetCurrentThread(), realtime ? THREAD_PRIORITY_TIME_CRITICAL : windowsPriorities[level]) != 0;
+#else
+		static const int fifoPriorities[] = { 1, 20, 40, 60, 80 };
+		static const int niceSteps[] = { 19, 10, 0, -5, -10 };
+		// like the thread priorities of Windows relative to the class of the process, normal is its nice value
+		static const int processNice = getpriority(PRIO_PROCESS, 0);
+		sched_param param = {};
+		if (realtime)
+		{
+			param.sched_priority = fifoPriorities[level];
+			return pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+		}
+		if (pthread_setschedparam(pthread_self(), level == 0 ? SCHED_IDLE : SCHED_OTHER, &param) != 0)
+			return false;
+		// the nice value of a thread is the one of its thread id, raising it above normal needs CAP_SYS_NICE
+		int nice = std::min(19, std::max(-20, processNice + niceSteps[level]));
+		return level == 0 || setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), nice) == 0;
+#endif
+	}
+};
@@ -0,0 +1,179 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Throughput estimators fed with (bytes, duration) samples.
+	Durations are measured with steady_clock in microseconds,
+	estimates are returned in bytes per second.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <string>
+#include <stdexcept>
+
+#define STEADY_NOW std::chrono::steady_clock::now()
+#define ELAPSED_US(start) std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - (start)).count()
+
+class ThroughputEstimator
+{
+public:
+	virtual ~ThroughputEstimator() {}
+
+	virtual void addSample(size_t bytes, long long durationUs) = 0;
+
+	// bytes per second, 0 as long as no sample was added
+	virtual double estimate() const = 0;
+
+	virtual void reset() = 0;
+
+	// type is one of "harmonic", "ewma" or "goodput"
+	static std::unique_ptr<ThroughputEstimator> create(const std::string& type, size_t window, double alpha);
+
+protected:
+	static double rate(size_t bytes, long long durationUs)
+	{
+		return bytes * (1000000.0 / durationUs);
+	}
+};
+
+// harmonic mean of the last window sample rates, robust against single outliers upwards
+class HarmonicMeanEstimator : public ThroughputEstimator
+{
+public:
+	HarmonicMeanEstimator(size_t window)
+		: window(window == 0 ? 1 : window)
+		, inverseSum(0)
+	{
+	}
+
+	void addSample(size_t bytes, long long durationUs) override
+	{
+		if (bytes == 0 || durationUs <= 0)
+			return;
+
+		double inverse = 1.0 / rate(bytes, durationUs);
+		inverseRates.push_back(inverse);
+		inverseSum += inverse;
+		if (inverseRates.size() > window)
+		{
+			inverseSum -= inverseRates.front();
+			inverseRates.pop_front();
+		}
+	}
+
+	double estimate() const override
+	{
+		if (inverseRates.empty())
+			return 0;
+		return inverseRates.size() / inverseSum;
+	}
+
+	void reset() override
+	{
+		inverseRates.clear();
+		inverseSum = 0;
+	}
+
+private:
+	size_t window;
+	std::deque<double> inverseRates;
+	double inverseSum;
+};
+
+// exponentially weighted moving average of the sample rates
+class EwmaEstimator : public ThroughputEstimator
+{
+public:
+	EwmaEstimator(double alpha)
+		: alpha(alpha), value(0)
+	{
+		if (alpha <= 0 || alpha > 1)
+			throw std::invalid_argument("EwmaEstimator: alpha has to be in (0, 1]");
+	}
+
+	void addSample(size_t bytes, long long durationUs) override
+	{
+		if (bytes == 0 || durationUs <= 0)
+			return;
+
+		double r = rate(bytes, durationUs);
+		value = value == 0 ? r : alpha * r + (1 - alpha) * value;
+	}
+
+	double estimate() const override
+	{
+		return value;
+	}
+
+	void reset() override
+	{
+		value = 0;
+	}
+
+private:
+	double alpha;
+	double value;
+};
+
+// goodput over the last window chunks, total bytes divided by total transfer time
+class GoodputEstimator : public ThroughputEstimator
+{
+public:
+	GoodputEstimator(size_t window)
+		: window(window == 0 ? 1 : window)
+		, bytesSum(0), durationSum(0)
+	{
+	}
+
+	void addSample(size_t bytes, long long durationUs) override
+	{
+		if (bytes == 0 || durationUs <= 0)
+			return;
+
+		samples.push_back({ bytes, durationUs });
+		bytesSum += bytes;
+		durationSum += durationUs;
+		if (samples.size() > window)
+		{
+			bytesSum -= samples.front().first;
+			durationSum -= samples.front().second;
+			samples.pop_front();
+		}
+	}
+
+	double estimate() const override
+	{
+		if (durationSum == 0)
+			return 0;
+		return rate(bytesSum, durationSum);
+	}
+
+	void reset() override
+	{
+		samples.clear();
+		bytesSum = 0;
+		durationSum = 0;
+	}
+
+private:
+	size_t window;
+	std::deque<std::pair<size_t, long long>> samples;
+	size_t bytesSum;
+	long long durationSum;
+};
+
+inline std::unique_ptr<ThroughputEstimator> ThroughputEstimator::create(const std::string& type, size_t window, double alpha)
+{
+	if (type == "harmonic")
+		return std::unique_ptr<ThroughputEstimator>(new HarmonicMeanEstimator(window));
+	else if (type == "ewma")
+		return std::unique_ptr<ThroughputEstimator>(new EwmaEstimator(alpha));
+	else if (type == "goodput")
+		return std::unique_ptr<ThroughputEstimator>(new GoodputEstimator(window));
+
+	throw std::invalid_argument("ThroughputEstimator::create: invalid estimator type: " + type);
+}
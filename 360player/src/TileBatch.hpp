@@ -0,0 +1,67 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Several tiles of one segment fetched with a single request from
+	the server's /batch endpoint. The url only depends on the mpd, the
+	segment and the chosen (tile, quality) pairs, so caches can keep
+	batches like segment files. The answer holds every part as the
+	line "tile quality length\r\n" followed by the segment data.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdlib>
+
+class TileBatch
+{
+public:
+	struct Part
+	{
+		int tile;
+		int quality;
+		std::string data;
+	};
+
+	// tiles in the order the parts should arrive, segment is the index into the segment lists
+	static std::string url(const std::string& mpdUri, int segment, const std::vector<std::pair<int, int>>& tileQualities)
+	{
+		std::string url = "/batch" + (mpdUri.empty() || mpdUri[0] != '/' ? "/" + mpdUri : mpdUri) + "/" + std::to_string(segment) + "/";
+		for (size_t i = 0; i < tileQualities.size(); i++)
+		{
+			if (i > 0)
+				url += ",";
+			url += std::to_string(tileQualities[i].first) + "-" + std::to_string(tileQualities[i].second);
+		}
+		return url;
+	}
+
+	// false if the body is truncated or malformed, parts then holds the complete ones
+	static bool split(const std::string& body, std::vector<Part>& parts)
+	{
+		parts.clear();
+		size_t pos = 0;
+		while (pos < body.size())
+		{
+			size_t eol = body.find("\r\n", pos);
+			if (eol == std::string::npos)
+				return false;
+
+			const char* header = body.c_str() + pos;
+			char* end;
+			Part part;
+			part.tile = int(std::strtol(header, &end, 10));
+			part.quality = int(std::strtol(end, &end, 10));
+			size_t length = std::strtoul(end, &end, 10);
+			if (end != body.c_str() + eol || eol + 2 + length > body.size())
+				return false;
+
+			part.data = body.substr(eol + 2, length);
+			parts.push_back(std::move(part));
+			pos = eol + 2 + length;
+		}
+		return true;
+	}
+};
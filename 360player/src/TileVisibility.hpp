@@ -0,0 +1,45 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Set of tiles inside the current viewport (plus margin),
+	written by the render thread from the live pose and read
+	by the decoder threads.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+class TileVisibility
+{
+public:
+	static constexpr size_t maxTiles = 256;
+	static constexpr size_t numWords = maxTiles / 64;
+	typedef std::array<uint64_t, numWords> Mask;
+
+	TileVisibility()
+	{
+		for (auto& word : mask)
+			word.store(~uint64_t(0), std::memory_order_relaxed);
+	}
+
+	// the words are stored one by one, a reader may see a mix of two updates for one frame
+	void update(const Mask& visibleTiles)
+	{
+		for (size_t w = 0; w < numWords; w++)
+			mask[w].store(visibleTiles[w], std::memory_order_relaxed);
+	}
+
+	// tiles beyond maxTiles are always treated as visible
+	bool isVisible(size_t tile) const
+	{
+		return tile >= maxTiles || (mask[tile / 64].load(std::memory_order_relaxed) >> (tile % 64)) & 1;
+	}
+
+private:
+	std::atomic<uint64_t> mask[numWords];
+};
@@ -0,0 +1,246 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Pipeline tracing. TRACE_SPAN times the rest of its scope and
+	TRACE_VALUE records a measured value (like the lateness of a
+	frame), both into a buffer of the calling thread: no lock and, once
+	the thread's current chunk is allocated, no allocation. Without
+	Trace::start every recording is a single flag test. At the end of a
+	session the events are written as a Chrome trace (chrome://tracing,
+	ui.perfetto.dev) and summarised as percentiles per name.
+*/
+
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+// name has to be a string literal, only the pointer is stored
+#define TRACE_SPAN(name) Trace::Span TRACE_CONCAT(traceSpan_, __LINE__)(name)
+#define TRACE_VALUE(name, v) do { if (Trace::enabled()) Trace::value(name, v); } while (0)
+
+class Trace
+{
+public:
+	struct Event
+	{
+		const char* name;
+		long long start;
+		// microseconds of a span, -1 for a value
+		long long duration;
+		double value;
+	};
+
+	// times its scope or until end, names are string literals
+	class Span
+	{
+	public:
+		Span(const char* name) : name(Trace::enabled() ? name : nullptr), start(this->name ? Trace::nowUs() : 0) {}
+
+		~Span()
+		{
+			end();
+		}
+
+		void end()
+		{
+			if (name)
+				Trace::record({ name, start, Trace::nowUs() - start, 0 });
+			name = nullptr;
+		}
+
+		Span(const Span&) = delete;
+		Span& operator=(const Span&) = delete;
+
+	private:
+		const char* name;
+		long long start;
+	};
+
+	static bool enabled()
+	{
+		return state().enabled.load(std::memory_order_relaxed);
+	}
+
+	// starts recording, the trace's time 0 is now
+	static void start()
+	{
+		state().origin = std::chrono::steady_clock::now();
+		state().enabled = true;
+	}
+
+	static void stop()
+	{
+		state().enabled = false;
+	}
+
+	// microseconds since start
+	static long long nowUs()
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - state().origin).count();
+	}
+
+	// name of the calling thread in the trace
+	static void nameThread(const std::string& name)
+	{
+		auto& buffer = threadBuffer();
+		std::lock_guard<std::mutex> l(state().mtx);
+		buffer.name = name;
+	}
+
+	static void value(const char* name, double value)
+	{
+		record({ name, nowUs(), -1, value });
+	}
+
+	static void record(const Event& event)
+	{
+		threadBuffer().push(event);
+	}
+
+	// Chrome trace event format, spans are complete events and values counters
+	static bool writeChromeTrace(const std::string& path)
+	{
+		std::ofstream file(path);
+		if (!file)
+			return false;
+
+		file << "{\"traceEvents\":[\n";
+		bool first = true;
+		forEachBuffer([&](const ThreadBuffer& buffer)
+		{
+			if (!buffer.name.empty())
+			{
+				file << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer.tid
+					<< ",\"args\":{\"name\":\"" << buffer.name << "\"}}";
+				first = false;
+			}
+			buffer.forEach([&](const Event& e)
+			{
+				file << (first ? "" : ",\n") << "{\"name\":\"" << e.name << "\",\"pid\":1,\"tid\":" << buffer.tid << ",\"ts\":" << e.start;
+				if (e.duration >= 0)
+					file << ",\"ph\":\"X\",\"dur\":" << e.duration << "}";
+				else
+					file << ",\"ph\":\"C\",\"args\":{\"value\":" << e.value << "}}";
+				first = false;
+			});
+		});
+		file << "\n],\"displayTimeUnit\":\"ms\"}\n";
+		return (bool)file;
+	}
+
+	// one line per name with count, p50, p90, p99 and max, spans in ms
+	static std::vector<std::string> summary()
+	{
+		std::map<std::string, std::vector<double>> samples;
+		forEachBuffer([&](const ThreadBuffer& buffer)
+		{
+			buffer.forEach([&](const Event& e)
+			{
+				samples[e.name].push_back(e.duration >= 0 ? e.duration / 1000.0 : e.value);
+			});
+		});
+
+		std::vector<std::string> lines;
+		for (auto& s : samples)
+		{
+			auto& v = s.second;
+			std::sort(v.begin(), v.end());
+			auto percentile = [&](double p) { return v[std::min(v.size() - 1, (size_t)(p * v.size()))]; };
+			std::stringstream ss;
+			ss << std::fixed << std::setprecision(2) << std::left << std::setw(24) << s.first << std::right
+				<< " n " << std::setw(7) << v.size()
+				<< " p50 " << std::setw(9) << percentile(0.5)
+				<< " p90 " << std::setw(9) << percentile(0.9)
+				<< " p99 " << std::setw(9) << percentile(0.99)
+				<< " max " << std::setw(9) << v.back();
+			lines.push_back(ss.str());
+		}
+		return lines;
+	}
+
+private:
+	// events of one thread in fixed chunks, the writer publishes the count after the event [owning thread]
+	struct ThreadBuffer
+	{
+		static constexpr size_t chunkSize = 4096;
+		static constexpr size_t maxChunks = 1024;
+
+		int tid;
+		std::string name;
+		std::unique_ptr<Event[]> chunks[maxChunks];
+		std::atomic<size_t> count;
+
+		ThreadBuffer(int tid) : tid(tid), count(0) {}
+
+		void push(const Event& event)
+		{
+			size_t n = count.load(std::memory_order_relaxed);
+			size_t chunk = n / chunkSize;
+			// a full buffer keeps the start of the session
+			if (chunk >= maxChunks)
+				return;
+			if (!chunks[chunk])
+				chunks[chunk].reset(new Event[chunkSize]);
+			chunks[chunk][n % chunkSize] = event;
+			count.store(n + 1, std::memory_order_release);
+		}
+
+		template<class F>
+		void forEach(F f) const
+		{
+			size_t n = count.load(std::memory_order_acquire);
+			for (size_t i = 0; i < n; i++)
+				f(chunks[i / chunkSize][i % chunkSize]);
+		}
+	};
+
+	struct State
+	{
+		std::atomic<bool> enabled;
+		std::chrono::steady_clock::time_point origin;
+		std::mutex mtx;
+		// buffers outlive their threads, the events of a deleted pool are still exported
+		std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+
+		State() : enabled(false), origin(std::chrono::steady_clock::now()) {}
+	};
+
+	static State& state()
+	{
+		static State s;
+		return s;
+	}
+
+	static ThreadBuffer& threadBuffer()
+	{
+		thread_local ThreadBuffer* buffer = nullptr;
+		if (buffer == nullptr)
+		{
+			std::lock_guard<std::mutex> l(state().mtx);
+			state().buffers.emplace_back(new ThreadBuffer((int)state().buffers.size() + 1));
+			buffer = state().buffers.back().get();
+		}
+		return *buffer;
+	}
+
+	template<class F>
+	static void forEachBuffer(F f)
+	{
+		std::lock_guard<std::mutex> l(state().mtx);
+		for (auto& buffer : state().buffers)
+			f(*buffer);
+	}
+};
@@ -7,32 +7,71 @@
 #define VIDEOSEGMENTSTREAM_HPP
 
 #include "IStream.hpp"
-#include <sstream>
+#include <map>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
 #include "mpd.h"
+#include "Log.hpp"
 
-#define DEBUGVSS 0
-#if DEBUGVSS
-#define PRINT_DEBUG_VSS(s) std::cout <<"VSS -- " << s << std::endl
-#else
-#define PRINT_DEBUG_VSS(s) {}
-#endif
+#define PRINT_DEBUG_VSS(s) LOG_DEBUG("VSS -- " << s)
 
 class VideoTileStream : public IStream
 {
 public:
 	VideoTileStream()
 	{
-		swappedSize = 0;
-		swapReady = false;
+		chunkStart = 0;
+		totalSize = 0;
+		position = 0;
 		done = false;
 	}
 
-	void init(const DASH::SRD& srd, const std::string& init, const std::string& firstSegment)
+	void init(const DASH::SRD& srd, std::string init, std::string firstSegment)
 	{
 		this->srd = srd;
-		ss1 = stream(init);
-		ss1.append(firstSegment);
-		activeStream = &ss1;
+
+		// init and first segment share one chunk, seeks during probing may jump anywhere inside them
+		init.append(firstSegment);
+
+		std::lock_guard<std::mutex> l(mtx);
+		chunks.clear();
+		chunkStart = 0;
+		position = 0;
+		totalSize = init.size();
+		unfilled = 0;
+		segmentStarts.clear();
+		chunks.push_back(std::move(init));
+	}
+
+	// replaces everything buffered with the init and first segment of a seek target. Reads fail until the decoder
+	// called resume, so a demuxer never continues the old position with the bytes of the new one
+	void restart(std::string init, std::string firstSegment)
+	{
+		init.append(firstSegment);
+		{
+			std::lock_guard<std::mutex> l(mtx);
+			chunks.clear();
+			chunkStart = 0;
+			position = 0;
+			totalSize = init.size();
+			unfilled = 0;
+			segmentStarts.clear();
+			chunks.push_back(std::move(init));
+			done = false;
+			restarted = true;
+		}
+		cv.notify_all();
+	}
+
+	// the decoder reopens the stream from its start after a restart
+	void resume()
+	{
+		std::lock_guard<std::mutex> l(mtx);
+		restarted = false;
 	}
 
 	const DASH::SRD& getSRD() const
@@ -40,23 +79,120 @@ public:
 		return srd;
 	}
 
-	void addSegment(const std::string& segment, bool last = false)
+	// takes ownership of the segment, appending is O(1). A number >= 0 lets replaceSegment find the segment again
+	void addSegment(std::string&& segment, bool last = false, int number = -1)
+	{
+		{
+			std::lock_guard<std::mutex> l(mtx);
+			PRINT_DEBUG_VSS("append chunk " << segment.size());
+			if (number >= 0)
+				segmentStarts[number] = totalSize;
+			totalSize += segment.size();
+			chunks.push_back(std::move(segment));
+			done = last;
+			// the chunk kept as the last one may have been read to its end meanwhile
+			releaseConsumedChunks();
+		}
+		cv.notify_all();
+	}
+
+	void addSegment(const std::string& segment, bool last = false, int number = -1)
+	{
+		addSegment(std::string(segment), last, number);
+	}
+
+	// the decoder has read nothing of the segment added with number yet
+	bool replaceable(int number) const
+	{
+		std::lock_guard<std::mutex> l(mtx);
+		auto it = segmentStarts.find(number);
+		return it != segmentStarts.end() && position <= it->second && !restarted;
+	}
+
+	// swaps the segment added with number for another representation of it while the decoder has read nothing of
+	// it, the segments after it move along. False once the decoder has started on it
+	bool replaceSegment(int number, std::string&& segment)
+	{
+		std::lock_guard<std::mutex> l(mtx);
+		auto it = segmentStarts.find(number);
+		if (it == segmentStarts.end() || position > it->second || restarted)
+			return false;
+		int64_t offset = chunkStart;
+		for (auto chunk = chunks.begin(); chunk != chunks.end() && offset <= it->second; offset += chunk->size(), chunk++)
+		{
+			if (offset != it->second)
+				continue;
+			// a reserved chunk is still being written to
+			if (unfilled > 0 && std::next(chunk) == chunks.end())
+				return false;
+			int64_t delta = (int64_t)segment.size() - (int64_t)chunk->size();
+			*chunk = std::move(segment);
+			totalSize += delta;
+			for (auto next = std::next(it); next != segmentStarts.end(); next++)
+				next->second += delta;
+			return true;
+		}
+		return false;
+	}
+
+	// memory for the next size bytes of the stream, which a download writes into before it announces them with
+	// addData. Until endSegment nothing else may be added and the stream must not be restarted
+	char* reserveSegment(size_t size)
 	{
 		std::lock_guard<std::mutex> l(mtx);
+		chunks.emplace_back(size, '\0');
+		unfilled = size;
+		return &chunks.back()[0];
+	}
 
-		if (activeStream == &ss1)
+	// part of a segment still being downloaded, the decoder reads it right away. Bytes a reserved segment got in
+	// place are only announced, others are copied into it or appended as a chunk of their own
+	void addData(const char* data, size_t size)
+	{
 		{
-			PRINT_DEBUG_VSS("append to s2");
-			ss2.append(segment);
+			std::lock_guard<std::mutex> l(mtx);
+			if (unfilled == 0)
+			{
+				totalSize += size;
+				chunks.emplace_back(data, size);
+			}
+			else
+			{
+				auto& chunk = chunks.back();
+				char* dst = &chunk[chunk.size() - unfilled];
+				size = std::min(size, unfilled);
+				if (data != dst)
+					memcpy(dst, data, size);
+				unfilled -= size;
+				totalSize += size;
+			}
 		}
-		else
+		cv.notify_all();
+	}
+
+	// the reserved segment ends with what it got so far, a transfer that broke off leaves it shorter
+	void endSegment(bool last = false)
+	{
 		{
-			PRINT_DEBUG_VSS("append to s1");
-			ss1.append(segment);
+			std::lock_guard<std::mutex> l(mtx);
+			if (unfilled > 0)
+			{
+				chunks.back().resize(chunks.back().size() - unfilled);
+				unfilled = 0;
+			}
+			done = last;
+			releaseConsumedChunks();
 		}
+		cv.notify_all();
+	}
 
-		swapReady = true;
-		done = last;
+	// nothing follows the data added so far, e.g. when a live event has ended
+	void endOfStream()
+	{
+		{
+			std::lock_guard<std::mutex> l(mtx);
+			done = true;
+		}
 		cv.notify_all();
 	}
 
@@ -65,55 +201,100 @@ public:
 		
 	}
 
+	// the decoder has read everything received so far while more is to come [any thread]
+	bool starved() const
+	{
+		std::lock_guard<std::mutex> l(mtx);
+		return position >= totalSize && !done && !restarted;
+	}
+
 	int read(char* buf, int buf_size) override
 	{
-		auto ret = activeStream->read(buf, buf_size);
-		if (ret == 0 && swap())
-			ret = activeStream->read(buf, buf_size);
+		std::unique_lock<std::mutex> lock(mtx);
+		// wait for the next segment if everything buffered has been consumed
+		cv.wait(lock, [=] { return position < totalSize || done || restarted; });
+		if (restarted)
+			return 0;
+
+		int ret = 0;
+		auto it = chunks.begin();
+		int64_t itStart = chunkStart;
+		while (it != chunks.end() && ret < buf_size && position < totalSize)
+		{
+			// a reserved chunk is only readable as far as it has been filled
+			int64_t itEnd = std::min<int64_t>(itStart + it->size(), totalSize);
+			if (position < itEnd)
+			{
+				int64_t n = std::min<int64_t>(itEnd - position, buf_size - ret);
+				memcpy(buf + ret, it->data() + (position - itStart), n);
+				ret += n;
+				position += n;
+			}
+			itStart = itEnd;
+			it++;
+		}
+
+		releaseConsumedChunks();
 		//PRINT_DEBUG_VSS("read " << ret);
 		return ret;
 	}
 
 	int64_t seek(int64_t offset, int whence) override
 	{
-		offset -= swappedSize;
-		
-		if (whence == 0x10000)
+		std::lock_guard<std::mutex> l(mtx);
+		if (restarted)
+			return -1;
+
+		int64_t target;
+		switch (whence)
 		{
-			return activeStream->size + swappedSize;
+		case SEEK_SET: target = offset; break;
+		case SEEK_CUR: target = position + offset; break;
+		case SEEK_END: target = totalSize + offset; break;
+		default: return -1;
 		}
 
-		return activeStream->seek(offset, whence);
+		// chunks before chunkStart have already been released
+		if (target < chunkStart || target > totalSize)
+			return -1;
+
+		position = target;
+		return position;
 	}
 
-	bool swap()
+	int64_t size() override
 	{
-		{
-			std::unique_lock<std::mutex> lock(mtx);
-			cv.wait(lock, [=] { return swapReady || done; });
-		}
+		std::lock_guard<std::mutex> l(mtx);
+		return restarted ? -1 : totalSize;
+	}
 
-		if (done && !swapReady)
-			return false;
+	int readSize() const override
+	{
+		return readBytes;
+	}
 
-		std::lock_guard<std::mutex> l(mtx);
-		swapReady = false;
+	// bytes handed to the demuxer per read, read when the decoder opens the stream
+	void setReadSize(int bytes)
+	{
+		readBytes = bytes;
+	}
 
-		if (activeStream == &ss1 && ss2.good())
-		{
-			PRINT_DEBUG_VSS("swap to s2");
-			swappedSize += ss1.size;
-			activeStream = &ss2;
-			return true;
-		}
-		if (activeStream == &ss2 && ss1.good())
-		{
-			PRINT_DEBUG_VSS("swap to s1");
-			swappedSize += ss2.size;
-			activeStream = &ss1;
-			return true;
-		}
-		return false;
+	// about two frames of the bitrate, so a read mostly covers the frames of all tiles decoded at once. A power of two
+	// from 32 KiB to 1 MiB
+	static int readSizeFor(uint32_t bandwidth, double frameRate)
+	{
+		double frameBytes = bandwidth / 8.0 / std::max(1.0, frameRate);
+		int bytes = 32 << 10;
+		while (bytes < 2 * frameBytes && bytes < (1 << 20))
+			bytes <<= 1;
+		return bytes;
+	}
+
+	// bytes of media held for the decoder, including what it has read of the chunk at its position
+	size_t heldBytes() const
+	{
+		std::lock_guard<std::mutex> l(mtx);
+		return (size_t)(totalSize + unfilled - chunkStart);
 	}
 
 	int getQualityAtTime(double timestamp) const
@@ -127,70 +308,35 @@ public:
 	}
 
 private:
-	struct stream
+	// free every chunk the decoder has completely read, the last chunk is always kept
+	void releaseConsumedChunks()
 	{
-		std::istringstream s;
-		int64_t size;
-
-		stream() : size(0) {}
-
-		stream(const std::string& str)
-		{
-			init(str);
-		}
-
-		int read(char* buf, int buf_size)
-		{
-			s.read(buf, buf_size);
-			return s.gcount();
-		}
-
-		int64_t seek(int64_t offset, int whence)
-		{
-			if (!s.good())
-				s.clear();
-
-			s.seekg(offset, whence);
-			return s.tellg();
-		}
-
-		void append(const std::string& str)
-		{
-			if (size > 0 && good())
-			{
-				std::string concat;
-				concat.resize(size);
-				s.read(&concat[0], size);
-				concat += str;
-				s = std::istringstream(concat);
-				size = concat.size();
-			}
-			else
-				init(str);
-		}
-
-		bool good()
+		while (chunks.size() > 1 && chunkStart + (int64_t)chunks.front().size() <= position)
 		{
-			return s.good();
+			PRINT_DEBUG_VSS("release chunk " << chunks.front().size());
+			chunkStart += chunks.front().size();
+			chunks.pop_front();
 		}
+		while (!segmentStarts.empty() && segmentStarts.begin()->second < chunkStart)
+			segmentStarts.erase(segmentStarts.begin());
+	}
 
-	private:
-		void init(const std::string& str)
-		{
-			PRINT_DEBUG_VSS("Stream::init");
-
-			size = str.size();
-			s = std::istringstream(str);
-		}
-	};
-
-	int64_t swappedSize;
-	stream* activeStream;
-	stream ss1, ss2;
+	std::deque<std::string> chunks;
+	// stream offset of every numbered segment that has not been released
+	std::map<int, int64_t> segmentStarts;
+	// absolute stream offset of chunks.front()
+	int64_t chunkStart;
+	int64_t totalSize;
+	int64_t position;
+	// bytes of the reserved chunk at the back not written yet
+	size_t unfilled = 0;
+	// 0 for the default of the I/O context
+	int readBytes = 0;
 	mutable std::mutex mtx;
 	std::condition_variable cv;
-	bool swapReady = false;
 	bool done = false;
+	// the content was replaced by restart and the decoder has not reopened the stream yet
+	bool restarted = false;
 	DASH::SRD srd;
 	std::map<double, int> qualityLevelAtTimestampMap;
 };
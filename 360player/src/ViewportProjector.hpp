@@ -0,0 +1,109 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Projects a fixed set of viewport sample points onto the
+	equirectangular frame for a head rotation, all points at once.
+	The unit view directions are precomputed as separate float
+	arrays; per pose only a 3x3 rotation and an approximated atan2
+	per angle remain (error about 1e-5 rad), both taken from
+	QuaternionBatch. The loop is written to auto-vectorize, builds
+	with AVX2 and FMA enabled use 8 float lanes. MSVC has no __FMA__,
+	its /arch:AVX2 implies FMA.
+*/
+
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <cstddef>
+
+#include "Quaternion.hpp"
+#include "QuaternionBatch.hpp"
+
+class ViewportProjector
+{
+public:
+	ViewportProjector() {}
+
+	// points in normalized viewport coordinates, hDist and vDist are the half extents of the image plane at distance 1
+	template<class Point>
+	void init(const Point* points, size_t count, double hDist, double vDist)
+	{
+		dx.resize(count);
+		dy.resize(count);
+		dz.resize(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			double u = (points[i].x - 0.5) * (2 * hDist);
+			double v = (0.5 - points[i].y) * (2 * vDist);
+			double norm = std::sqrt(1 + u * u + v * v);
+			dx[i] = float(1 / norm);
+			dy[i] = float(u / norm);
+			dz[i] = float(v / norm);
+		}
+	}
+
+	size_t size() const
+	{
+		return dx.size();
+	}
+
+	// unit view directions of the points before the rotation
+	const std::vector<float>& directionX() const { return dx; }
+	const std::vector<float>& directionY() const { return dy; }
+	const std::vector<float>& directionZ() const { return dz; }
+
+	// equirectangular coordinates of every point, outX and outY hold size() values
+	void project(const IMT::Quaternion& headRotation, float* outX, float* outY) const
+	{
+		// the rotation of QuaternionBatch::rotate, fused with the projection so the rotated points are never stored
+		const QuaternionBatch::Rotation r(headRotation);
+
+		const size_t count = dx.size();
+		const float* px = dx.data();
+		const float* py = dy.data();
+		const float* pz = dz.data();
+		size_t i = 0;
+
+#if defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+		const QuaternionBatch::Rotation8 r8(r);
+		const __m256 one = _mm256_set1_ps(1.0f), zero = _mm256_setzero_ps();
+		const __m256 offset = _mm256_set1_ps(0.75f), inv2Pi = _mm256_set1_ps(invTwoPi), invPiV = _mm256_set1_ps(invPi);
+		for (; i + 8 <= count; i += 8)
+		{
+			__m256 ox, oy, oz;
+			r8.apply(_mm256_loadu_ps(px + i), _mm256_loadu_ps(py + i), _mm256_loadu_ps(pz + i), ox, oy, oz);
+
+			__m256 t = _mm256_fmadd_ps(QuaternionBatch::atan2Avx(oy, ox), inv2Pi, offset);
+			t = _mm256_sub_ps(t, _mm256_and_ps(_mm256_cmp_ps(t, one, _CMP_GE_OQ), one));
+			_mm256_storeu_ps(outX + i, _mm256_sub_ps(one, t));
+
+			__m256 sinPhi = _mm256_sqrt_ps(_mm256_max_ps(zero, _mm256_fnmadd_ps(oz, oz, one)));
+			_mm256_storeu_ps(outY + i, _mm256_mul_ps(QuaternionBatch::atan2Avx(sinPhi, oz), invPiV));
+		}
+#endif
+
+		for (; i < count; i++)
+		{
+			float ox, oy, oz;
+			r.apply(px[i], py[i], pz[i], ox, oy, oz);
+
+			// same mapping as AdaptionUnit::fromViewportCoordToEquirectCoord
+			float t = 0.75f + QuaternionBatch::fastAtan2(oy, ox) * invTwoPi;
+			t = t >= 1.0f ? t - 1.0f : t;
+			outX[i] = 1.0f - t;
+
+			float sinPhi = std::sqrt(std::fmax(0.0f, 1.0f - oz * oz));
+			outY[i] = QuaternionBatch::fastAtan2(sinPhi, oz) * invPi;
+		}
+	}
+
+private:
+	static constexpr float invPi = 0.318309886f;
+	static constexpr float invTwoPi = 0.159154943f;
+
+	std::vector<float> dx;
+	std::vector<float> dy;
+	std::vector<float> dz;
+};
@@ -0,0 +1,179 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Weighted count of viewport sample points per tile. The sample
+	density and the solid-angle weighting are runtime settings;
+	results for quantized head rotations are memoized.
+*/
+
+#pragma once
+
+#include <map>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+#include "Quaternion.hpp"
+#include "TileGrid.hpp"
+#include "ViewportProjector.hpp"
+
+class ViewportSampler
+{
+public:
+	// (tile, weight) of every tile hit by at least one sample
+	typedef std::vector<std::pair<int, int>> TileWeights;
+
+	// weight of the sample in the viewport center when solid-angle weighting is enabled
+	static constexpr int centerWeight = 16;
+
+	ViewportSampler() : grid(nullptr), cacheStep(0), cacheSize(0) {}
+	ViewportSampler(const ViewportSampler&) = delete;
+	ViewportSampler& operator=(const ViewportSampler&) = delete;
+
+	// (resolution + 1)^2 samples on the image plane with half extents hDist, vDist; scale enlarges the sampled area.
+	// Poses are quantized to cacheStep per quaternion component for the cache, 0 disables it
+	void init(const TileGrid* tileGrid, int resolution, bool solidAngleWeighting, double hDist, double vDist,
+		double scale = 1.0, double step = 0, size_t maxCacheEntries = 4096)
+	{
+		grid = tileGrid;
+		cacheStep = step;
+		cacheSize = maxCacheEntries;
+		cache.clear();
+
+		resolution = std::max(1, resolution);
+		std::vector<Point> points;
+		weights.clear();
+		for (int i = 0; i <= resolution; i++)
+			for (int j = 0; j <= resolution; j++)
+			{
+				Point p = { 0.5 + (i / (double)resolution - 0.5) * scale, 0.5 + (j / (double)resolution - 0.5) * scale };
+				points.push_back(p);
+
+				// a sample on the plane at distance 1 covers a solid angle proportional to 1 / (1 + u^2 + v^2)^1.5
+				double u = (p.x - 0.5) * (2 * hDist);
+				double v = (0.5 - p.y) * (2 * vDist);
+				int weight = 1;
+				if (solidAngleWeighting)
+					weight = std::max(1, int(std::lround(centerWeight / std::pow(1 + u * u + v * v, 1.5))));
+				weights.push_back(weight);
+			}
+		projector.init(points.data(), points.size(), hDist, vDist);
+	}
+
+	size_t size() const
+	{
+		return weights.size();
+	}
+
+	// the sample points and their weights, for other implementations of addVisibleSamples
+	const ViewportProjector& samplePoints() const { return projector; }
+	const std::vector<int>& sampleWeights() const { return weights; }
+
+	// the rotation whose visible samples addVisibleSamples adds for headRotation, the center of its cache cell
+	IMT::Quaternion sampledRotation(const IMT::Quaternion& headRotation) const
+	{
+		if (cacheStep <= 0)
+			return headRotation;
+		IMT::Quaternion quantized;
+		quantize(headRotation, quantized);
+		return quantized;
+	}
+
+	// add the weights of the tiles seen with headRotation to tileVisibilityMap [thread safe]
+	void addVisibleSamples(const IMT::Quaternion& headRotation, std::map<int, int>& tileVisibilityMap) const
+	{
+		if (cacheStep <= 0)
+		{
+			for (auto& tw : compute(headRotation))
+				tileVisibilityMap[tw.first] += tw.second;
+			return;
+		}
+
+		IMT::Quaternion quantized;
+		auto key = quantize(headRotation, quantized);
+		{
+			std::lock_guard<std::mutex> l(cacheMtx);
+			auto it = cache.find(key);
+			if (it != cache.end())
+			{
+				for (auto& tw : it->second)
+					tileVisibilityMap[tw.first] += tw.second;
+				return;
+			}
+		}
+
+		// every pose of a cell gets the result of the cell center, independent of which pose came first
+		auto result = compute(quantized);
+		for (auto& tw : result)
+			tileVisibilityMap[tw.first] += tw.second;
+
+		std::lock_guard<std::mutex> l(cacheMtx);
+		if (cache.size() >= cacheSize)
+			cache.clear();
+		cache.emplace(key, std::move(result));
+	}
+
+	// bitmask over words * 64 tiles of the tiles hit by any sample, tiles beyond it are not represented
+	void tileMask(const IMT::Quaternion& headRotation, uint64_t* mask, size_t words) const
+	{
+		std::fill(mask, mask + words, 0);
+		for (auto& tw : compute(headRotation))
+			if (tw.first < words * 64)
+				mask[tw.first / 64] |= uint64_t(1) << (tw.first % 64);
+	}
+
+private:
+	struct Point { double x, y; };
+
+	const TileGrid* grid;
+	ViewportProjector projector;
+	std::vector<int> weights;
+
+	double cacheStep;
+	size_t cacheSize;
+	mutable std::mutex cacheMtx;
+	mutable std::unordered_map<uint64_t, TileWeights> cache;
+
+	TileWeights compute(const IMT::Quaternion& headRotation) const
+	{
+		std::vector<float> x(weights.size()), y(weights.size());
+		projector.project(headRotation, x.data(), y.data());
+
+		TileWeights result;
+		for (size_t j = 0; j < weights.size(); j++)
+		{
+			int tile = grid->tileAt(x[j], y[j]);
+			auto it = std::find_if(result.begin(), result.end(), [tile](const std::pair<int, int>& tw) { return tw.first == tile; });
+			if (it == result.end())
+				result.push_back({ tile, weights[j] });
+			else
+				it->second += weights[j];
+		}
+		return result;
+	}
+
+	// 16 bits per component of the normalized quaternion, q and -q are the same rotation
+	uint64_t quantize(const IMT::Quaternion& q, IMT::Quaternion& center) const
+	{
+		auto v = q.GetV();
+		double c[4] = { q.GetW(), v.GetX(), v.GetY(), v.GetZ() };
+		double norm = std::sqrt(c[0] * c[0] + c[1] * c[1] + c[2] * c[2] + c[3] * c[3]);
+		double sign = c[0] < 0 ? -1 : 1;
+
+		uint64_t key = 0;
+		double centerC[4];
+		for (int i = 0; i < 4; i++)
+		{
+			double value = norm > 0 ? sign * c[i] / norm : 0;
+			long long cell = std::llround((value + 1) / cacheStep);
+			key = (key << 16) | (uint64_t(cell) & 0xFFFF);
+			centerC[i] = cell * cacheStep - 1;
+		}
+		center = IMT::Quaternion(centerC[0], centerC[1], centerC[2], centerC[3]);
+		return key;
+	}
+};
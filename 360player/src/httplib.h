@@ -78,6 +78,8 @@ typedef int socket_t;
 #include <fstream>
 #include <functional>
 #include <map>
+#include <deque>
+#include <chrono>
 #include <memory>
 #include <mutex>
 #include <regex>
@@ -127,7 +129,13 @@ namespace httplib
 
 	typedef std::multimap<std::string, std::string>                Params;
 	typedef std::smatch                                            Match;
-	typedef std::function<void(uint64_t current, uint64_t total)> Progress;
+	// returning false from the progress callback aborts the transfer
+	typedef std::function<bool(uint64_t current, uint64_t total)> Progress;
+	// takes the body piece by piece as it arrives instead of Response::body, returning false aborts the transfer
+	typedef std::function<bool(const char* data, size_t length)> ContentReceiver;
+	// memory for a body of length bytes that the socket is read into, the content receiver then gets the bytes where
+	// they were read to. nullptr receives the body through a buffer of the client
+	typedef std::function<char*(size_t length)> ContentBuffer;
 
 	struct MultipartFile {
 		std::string filename;
@@ -149,6 +157,8 @@ namespace httplib
 		Match          matches;
 
 		Progress       progress;
+		ContentReceiver content_receiver;
+		ContentBuffer  content_buffer;
 
 		bool has_header(const char* key) const;
 		std::string get_header_value(const char* key) const;
@@ -204,6 +214,32 @@ namespace httplib
 		socket_t sock_;
 	};
 
+	// carries the requests of clients in place of a connection of their own, e.g. the streams of one multiplexed
+	// connection. rank orders the requests of the clients sharing it, lower first, and urgent ones before all others
+	class Transport {
+	public:
+		virtual ~Transport() {}
+		// sends req and reads the status and headers of the answer into res. The body is read from the stream
+		// returned, destroying it before the end of the body cancels the request. nullptr if no answer arrived
+		virtual std::unique_ptr<Stream> open(Request& req, Response& res, int rank, bool urgent) = 0;
+	};
+
+	// what a client saw of a request once it ended
+	struct Exchange {
+		std::chrono::steady_clock::time_point start;
+		// the first byte of the body arrived, the end for an answer without one
+		std::chrono::steady_clock::time_point first_byte;
+		std::chrono::steady_clock::time_point end;
+		// bytes of the body, also those handed to a content receiver
+		uint64_t received;
+		bool complete;
+	};
+	typedef std::function<void(const Request&, const Response&, const Exchange&)> RequestObserver;
+
+	// called by every client after each of its requests, e.g. for a log of the session. Set it before the first
+	// request is sent
+	RequestObserver& request_observer();
+
 	class Server {
 	public:
 		typedef std::function<void(const Request&, Response&)> Handler;
@@ -288,6 +324,15 @@ namespace httplib
 		std::shared_ptr<Response> Get(const char* path, Progress progress = nullptr);
 		std::shared_ptr<Response> Get(const char* path, const Headers& headers, Progress progress = nullptr);
 
+		// bytes first to last of path, up to the end if last is beyond it. Answers 200 with the whole body if the
+		// server ignores the range. The body of a transfer that broke off stays in res to continue from
+		bool GetRange(const char* path, uint64_t first, uint64_t last, Response& res, Progress progress = nullptr);
+		std::shared_ptr<Response> GetRange(const char* path, uint64_t first, uint64_t last = UINT64_MAX, Progress progress = nullptr);
+		// bytes from first on handed to receiver as they arrive, res gets the status and headers only. A body
+		// with Content-Length is read straight into the memory buffer gives for it
+		bool GetStream(const char* path, uint64_t first, Response& res, ContentReceiver receiver, Progress progress = nullptr,
+			ContentBuffer buffer = nullptr);
+
 		std::shared_ptr<Response> Head(const char* path);
 		std::shared_ptr<Response> Head(const char* path, const Headers& headers);
 
@@ -307,11 +352,26 @@ namespace httplib
 		std::shared_ptr<Response> Options(const char* path, const Headers& headers);
 
 		bool send(Request& req, Response& res);
+
+		// keep the connection open between requests with HTTP/1.1 keep-alive, plain connections only. A connection
+		// the server closed while idle is opened again, a request it did not answer is sent once more
+		void set_keep_alive(bool on);
+
+		// with keep-alive, send GET requests for paths ahead of their answers. A following Get, GetRange from byte 0 or
+		// GetStream from byte 0 of the first of them reads the answer already on its way. Any other request and a
+		// failed or aborted transfer close the connection, which drops the answers still pending
+		bool Pipeline(const std::vector<std::string>& paths);
+
+		// send the requests through transport instead of a connection of this client, nullptr goes back to that
+		void set_transport(std::shared_ptr<Transport> transport);
+		// priority the next requests are given on the transport
+		void set_priority(int rank, bool urgent = false);
 		
 		bool proxyServer = false;
 
 	protected:
-		bool process_request(Stream& strm, Request& req, Response& res, bool& connection_close);
+		bool send_request(Request& req, Response& res);
+		bool process_request(Stream& strm, Request& req, Response& res, bool& connection_close, bool write = true);
 
 		const std::string host_;
 		const int         port_;
@@ -319,9 +379,20 @@ namespace httplib
 		const std::string host_and_port_;
 
 	private:
+		bool              keep_alive_;
+		socket_t          sock_;
+		// paths requested by Pipeline whose answers were not read yet, oldest first
+		std::deque<std::string> pipelined_;
+		std::shared_ptr<Transport> transport_;
+		int               rank_;
+		bool              urgent_;
+
 		socket_t create_client_socket() const;
 		bool read_response_line(Stream& strm, Response& res);
 		void write_request(Stream& strm, Request& req);
+		// open the kept connection unless it is still usable
+		bool connect_kept();
+		void close_kept();
 
 		virtual bool read_and_close_socket(socket_t sock, Request& req, Response& res);
 	};
@@ -833,43 +904,87 @@ namespace httplib
 			return true;
 		}
 
-		inline bool read_content_with_length(Stream& strm, std::string& out, size_t len, Progress progress)
+		inline bool read_content_with_length(Stream& strm, std::string& out, size_t len, Progress progress, ContentReceiver receiver = ContentReceiver(),
+			ContentBuffer buffer = ContentBuffer())
 		{
+			char* dst = receiver && buffer ? buffer(len) : nullptr;
+			if (dst) {
+				size_t r = 0;
+				while (r < len) {
+					auto n = strm.read(dst + r, len - r);
+					if (n <= 0) {
+						return false;
+					}
+					r += n;
+					if (!receiver(dst + r - n, n) || (progress && !progress(r, len))) {
+						return false;
+					}
+				}
+				return true;
+			}
+
+			if (receiver) {
+				char buf[16384];
+				size_t r = 0;
+				while (r < len) {
+					auto n = strm.read(buf, len - r < sizeof(buf) ? len - r : sizeof(buf));
+					if (n <= 0) {
+						return false;
+					}
+					r += n;
+					if (!receiver(buf, n) || (progress && !progress(r, len))) {
+						return false;
+					}
+				}
+				return true;
+			}
+
 			out.assign(len, 0);
 			size_t r = 0;
 			while (r < len) {
 				auto n = strm.read(&out[r], len - r);
 				if (n <= 0) {
+					// keep what arrived, a range request can continue from there
+					out.resize(r);
 					return false;
 				}
 
 				r += n;
 
-				if (progress) {
-					progress(r, len);
+				if (progress && !progress(r, len)) {
+					out.resize(r);
+					return false;
 				}
 			}
 			return true;
 		}
 
-		inline bool read_content_without_length(Stream& strm, std::string& out)
+		inline bool read_content_without_length(Stream& strm, std::string& out, ContentReceiver receiver = ContentReceiver())
 		{
 			for (;;) {
-				char byte;
-				auto n = strm.read(&byte, 1);
+				char buf[4096];
+				auto n = strm.read(buf, sizeof(buf));
 				if (n < 0) {
 					return false;
 				}
 				else if (n == 0) {
 					return true;
 				}
-				out += byte;
+				if (receiver) {
+					if (!receiver(buf, n)) {
+						return false;
+					}
+				}
+				else {
+					out.append(buf, n);
+				}
 			}
 
 			return true;
 		}
 
-		inline bool read_content_chunked(Stream& strm, std::string& out)
+		// a receiver gets every chunk as soon as it is complete, e.g. the CMAF chunks of a segment still being encoded
+		inline bool read_content_chunked(Stream& strm, std::string& out, ContentReceiver receiver = ContentReceiver())
 		{
 			const auto bufsiz = 16;
 			char buf[bufsiz];
@@ -896,7 +1011,14 @@ namespace httplib
 					break;
 				}
 
-				out += chunk;
+				if (receiver) {
+					if (!receiver(chunk.data(), chunk.size())) {
+						return false;
+					}
+				}
+				else {
+					out += chunk;
+				}
 
 				if (!reader.getline()) {
 					return false;
@@ -915,21 +1037,27 @@ namespace httplib
 		}
 
 		template <typename T>
-		bool read_content(Stream& strm, T& x, Progress progress = Progress())
+		bool read_content(Stream& strm, T& x, Progress progress = Progress(), ContentReceiver receiver = ContentReceiver(),
+			ContentBuffer buffer = ContentBuffer())
 		{
 			auto len = get_header_value_int(x.headers, "Content-Length", 0);
 
+			// an empty body, e.g. of 416, must not be read until the connection closes
+			if (!len && x.has_header("Content-Length")) {
+				return true;
+			}
+
 			if (len) {
-				return read_content_with_length(strm, x.body, len, progress);
+				return read_content_with_length(strm, x.body, len, progress, receiver, buffer);
 			}
 			else {
 				const auto& encoding = get_header_value(x.headers, "Transfer-Encoding", "");
 
 				if (!strcasecmp(encoding, "chunked")) {
-					return read_content_chunked(strm, x.body);
+					return read_content_chunked(strm, x.body, receiver);
 				}
 				else {
-					return read_content_without_length(strm, x.body);
+					return read_content_without_length(strm, x.body, receiver);
 				}
 			}
 
@@ -1927,11 +2055,16 @@ namespace httplib
 		, port_(port)
 		, timeout_sec_(timeout_sec)
 		, host_and_port_(host_ + ":" + std::to_string(port_))
+		, keep_alive_(false)
+		, sock_(INVALID_SOCKET)
+		, rank_(0)
+		, urgent_(false)
 	{
 	}
 
 	inline Client::~Client()
 	{
+		close_kept();
 	}
 
 	inline bool Client::is_valid() const
@@ -1981,18 +2114,189 @@ namespace httplib
 		return true;
 	}
 
+	inline RequestObserver& request_observer()
+	{
+		static RequestObserver observer;
+		return observer;
+	}
+
 	inline bool Client::send(Request& req, Response& res)
+	{
+		auto& observer = request_observer();
+		if (!observer) {
+			return send_request(req, res);
+		}
+
+		// the first call of the receiver or progress marks the first byte
+		Exchange exchange = {};
+		exchange.start = std::chrono::steady_clock::now();
+		auto arrived = false;
+		auto note = [&]() {
+			if (!arrived) {
+				arrived = true;
+				exchange.first_byte = std::chrono::steady_clock::now();
+			}
+		};
+		auto receiver = req.content_receiver;
+		auto progress = req.progress;
+		if (receiver) {
+			req.content_receiver = [&](const char* data, size_t length) {
+				note();
+				exchange.received += length;
+				return receiver(data, length);
+			};
+		}
+		req.progress = [&](uint64_t current, uint64_t total) {
+			note();
+			return !progress || progress(current, total);
+		};
+
+		exchange.complete = send_request(req, res);
+		exchange.end = std::chrono::steady_clock::now();
+		if (!arrived) {
+			exchange.first_byte = exchange.end;
+		}
+		if (!receiver) {
+			exchange.received = res.body.size();
+		}
+		req.content_receiver = receiver;
+		req.progress = progress;
+		observer(req, res, exchange);
+		return exchange.complete;
+	}
+
+	inline bool Client::send_request(Request& req, Response& res)
 	{
 		if (req.path.empty()) {
 			return false;
 		}
 
-		auto sock = create_client_socket();
-		if (sock == INVALID_SOCKET) {
+		if (transport_) {
+			req.set_header("Host", host_and_port_.c_str());
+			auto strm = transport_->open(req, res, rank_, urgent_);
+			if (!strm) {
+				return false;
+			}
+			if (req.method == "HEAD" || res.status == 204 || res.status == 304) {
+				return true;
+			}
+			return detail::read_content(*strm, res, req.progress, req.content_receiver, req.content_buffer);
+		}
+
+		if (!keep_alive_) {
+			auto sock = create_client_socket();
+			if (sock == INVALID_SOCKET) {
+				return false;
+			}
+
+			return read_and_close_socket(sock, req, res);
+		}
+
+		// the answer to a pipelined request is read without writing it again
+		auto range = req.get_header_value("Range");
+		auto pipelined = !pipelined_.empty() && req.method == "GET" && req.path == pipelined_.front() && req.body.empty() &&
+			(range.empty() || range == "bytes=0-");
+		if (pipelined) {
+			pipelined_.pop_front();
+		}
+		else {
+			// answers pending before this one can not be skipped
+			if (!pipelined_.empty()) {
+				close_kept();
+			}
+		}
+
+		for (auto attempt = 0; ; attempt++) {
+			auto reused = sock_ != INVALID_SOCKET;
+			if (!pipelined && !connect_kept()) {
+				return false;
+			}
+
+			auto connection_close = false;
+			bool ret;
+			{
+				SocketStream strm(sock_);
+				ret = process_request(strm, req, res, connection_close, !pipelined);
+			}
+			if (!ret || connection_close) {
+				close_kept();
+			}
+
+			// the server closed the kept connection as the request went out, nothing of the answer arrived
+			if (!ret && reused && res.status == -1 && attempt == 0) {
+				res.headers.clear();
+				pipelined = false;
+				continue;
+			}
+			return ret;
+		}
+	}
+
+	inline void Client::set_keep_alive(bool on)
+	{
+		keep_alive_ = on;
+		if (!on) {
+			close_kept();
+		}
+	}
+
+	inline void Client::set_transport(std::shared_ptr<Transport> transport)
+	{
+		transport_ = std::move(transport);
+		if (transport_) {
+			close_kept();
+		}
+	}
+
+	inline void Client::set_priority(int rank, bool urgent)
+	{
+		rank_ = rank;
+		urgent_ = urgent;
+	}
+
+	inline bool Client::Pipeline(const std::vector<std::string>& paths)
+	{
+		if (transport_ || !keep_alive_ || paths.empty()) {
 			return false;
 		}
+		// the connection must stay the one the requests go out on
+		if (pipelined_.empty() && !connect_kept()) {
+			return false;
+		}
+		if (sock_ == INVALID_SOCKET) {
+			return false;
+		}
+
+		SocketStream strm(sock_);
+		for (const auto& path : paths) {
+			Request req;
+			req.method = "GET";
+			req.path = path;
+			write_request(strm, req);
+			pipelined_.push_back(path);
+		}
+		return true;
+	}
+
+	inline bool Client::connect_kept()
+	{
+		// readable while idle means the server closed it
+		if (sock_ != INVALID_SOCKET && detail::select_read(sock_, 0, 0) != 0) {
+			close_kept();
+		}
+		if (sock_ == INVALID_SOCKET) {
+			sock_ = create_client_socket();
+		}
+		return sock_ != INVALID_SOCKET;
+	}
 
-		return read_and_close_socket(sock, req, res);
+	inline void Client::close_kept()
+	{
+		pipelined_.clear();
+		if (sock_ != INVALID_SOCKET) {
+			detail::close_socket(sock_);
+			sock_ = INVALID_SOCKET;
+		}
 	}
 
 	inline void Client::write_request(Stream& strm, Request& req)
@@ -2018,10 +2322,7 @@ namespace httplib
 			req.set_header("User-Agent", "cpp-httplib/0.2");
 		}
 
-		// TODO: Support KeepAlive connection
-		// if (!req.has_header("Connection")) {
-		req.set_header("Connection", "close");
-		// }
+		req.set_header("Connection", keep_alive_ ? "keep-alive" : "close");
 
 		if (!req.body.empty()) {
 			if (!req.has_header("Content-Type")) {
@@ -2046,10 +2347,12 @@ namespace httplib
 		}
 	}
 
-	inline bool Client::process_request(Stream& strm, Request& req, Response& res, bool& connection_close)
+	inline bool Client::process_request(Stream& strm, Request& req, Response& res, bool& connection_close, bool write)
 	{
-		// Send request
-		write_request(strm, req);
+		// Send request, a pipelined one went out before
+		if (write) {
+			write_request(strm, req);
+		}
 
 		// Receive response and headers
 		if (!read_response_line(strm, res) || !detail::read_headers(strm, res.headers)) {
@@ -2060,9 +2363,16 @@ namespace httplib
 			connection_close = true;
 		}
 
+		// these have no body, any other one without length and chunks ends with the connection
+		auto bodiless = req.method == "HEAD" || res.status == 204 || res.status == 304;
+		if (!bodiless && !res.has_header("Content-Length") &&
+			strcasecmp(res.get_header_value("Transfer-Encoding").c_str(), "chunked")) {
+			connection_close = true;
+		}
+
 		// Body
-		if (req.method != "HEAD") {
-			if (!detail::read_content(strm, res, req.progress)) {
+		if (!bodiless) {
+			if (!detail::read_content(strm, res, req.progress, req.content_receiver, req.content_buffer)) {
 				return false;
 			}
 
@@ -2106,6 +2416,44 @@ namespace httplib
 		return send(req, *res) ? res : nullptr;
 	}
 
+	inline bool Client::GetRange(const char* path, uint64_t first, uint64_t last, Response& res, Progress progress)
+	{
+		Request req;
+		req.method = "GET";
+		req.path = path;
+		req.progress = progress;
+		if (last == UINT64_MAX) {
+			req.headers.insert(make_range_header(first));
+		}
+		else {
+			req.headers.insert(make_range_header(first, last));
+		}
+
+		return send(req, res);
+	}
+
+	inline std::shared_ptr<Response> Client::GetRange(const char* path, uint64_t first, uint64_t last, Progress progress)
+	{
+		auto res = std::make_shared<Response>();
+		return GetRange(path, first, last, *res, progress) ? res : nullptr;
+	}
+
+	inline bool Client::GetStream(const char* path, uint64_t first, Response& res, ContentReceiver receiver, Progress progress,
+		ContentBuffer buffer)
+	{
+		Request req;
+		req.method = "GET";
+		req.path = path;
+		req.progress = progress;
+		req.content_receiver = receiver;
+		req.content_buffer = buffer;
+		if (first > 0) {
+			req.headers.insert(make_range_header(first));
+		}
+
+		return send(req, res);
+	}
+
 	inline std::shared_ptr<Response> Client::Head(const char* path)
 	{
 		return Head(path, Headers());
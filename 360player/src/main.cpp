@@ -23,6 +23,8 @@
 #define BOOST_TYPEOF_EMULATION
 #include <osvr/RenderKit/RenderManager.h>
 #include <osvr/ClientKit/Context.h>
+#include <osvr/ClientKit/Interface.h>
+#include <osvr/ClientKit/InterfaceStateC.h>
 #include <osvr/Util/EigenInterop.h>
 
 // Library/third-party includes
@@ -53,20 +55,49 @@
 #include "ShaderTextureVideo.hpp"
 #include "ShaderTextureStatic.hpp"
 #include "MeshCubeEquiUV.hpp"
+#include "MeshFullScreen.hpp"
+#include "StereoTarget.hpp"
 #include "VideoTileStream.hpp"
 #include "mpd.h"
 #include "AdaptionUnit.hpp"
+#include "PoseHistory.hpp"
+#include "PoseSampler.hpp"
 #include "HeadTrace.hpp"
+#include "DownloadPool.hpp"
+#include "Http2Client.hpp"
+#include "BufferManager.hpp"
+#include "PlaybackEvents.hpp"
+#include "TileVisibility.hpp"
+#include "Log.hpp"
+#include "Trace.hpp"
+#include "ThreadTopology.hpp"
+#include "PlayerMetrics.hpp"
+#include "LiveManifest.hpp"
+#include "InitSegmentCache.hpp"
+#include "SegmentStore.hpp"
+#include "SessionLog.hpp"
+#include "SessionHttp.hpp"
 
 using namespace IMT;
 Config* Config::_instance = 0;
 
 //static global variable
 static httplib::Client* httpClient;
+static DownloadPool* downloadPool;
+static BufferManager* bufferManager;
+static PlaybackEvents playbackEvents;
+static long long numPoses = 0;
+static TileVisibility tileVisibility;
 static DASH::MPD* mpd;
+static InitSegmentCache* initSegmentCache;
+static SegmentStore* segmentStore;
+// init segment of every tile, a seek restarts the streams with them
+static std::vector<std::string> initSegments;
 static AdaptionUnit* au;
 static HeadTrace* headTrace;
 static std::shared_ptr<ShaderTexture> sampleShader(nullptr);
+// decodes the video in headless playback, where there is no shader to own it
+static std::shared_ptr<LibAv::VideoReader> headlessReader(nullptr);
 static std::shared_ptr<Mesh> roomMesh(nullptr);
 static VideoTileStream* segmentStreams{ nullptr };
 //static std::shared_ptr<LogWriter> logWriter(nullptr);
@@ -77,8 +108,11 @@ static std::chrono::system_clock::time_point global_startDisplayTime(zero);
 static size_t lastDisplayedFrame(0);
 static size_t lastNbDroppedFrame(0);
 static bool started(false);
-static CircularBuffer<std::pair<long long, Quaternion>> headRotations;
-static long long startTimeEpochMs;
+static PoseHistory<> headRotations;
+// origin of the pose timestamps
+static std::chrono::steady_clock::time_point poseClockStart;
+// nullptr with poseRate 0, the render thread pushes the poses then
+static std::unique_ptr<PoseSampler> poseSampler;
 static bool firstSegmentDownloaded = false;
 
 // Set to true when it is time for the application to quit.
@@ -194,6 +228,156 @@ void SetupEye(
 }
 
 
+// hand a head rotation to the adaption and the decoder, timestamp in ms since poseClockStart [pose sampler or render thread]
+static void updatePose(long long timestamp, const Quaternion& headRotation)
+{
+	SessionLog::instance().pose(timestamp, headRotation);
+	headRotations.push(timestamp, headRotation);
+	if (au != nullptr)
+		au->addPose(timestamp, headRotation);
+	playbackEvents.signal(PlaybackEvents::PoseAvailable, ++numPoses);
+	if (firstSegmentDownloaded && au != nullptr && Config::instance()->decodeSkipping)
+		tileVisibility.update(au->visibleTiles(headRotation));
+}
+
+// rotation of the head trace at seconds, in the frame of the poses of updatePose
+static Quaternion tracePose(double seconds)
+{
+	static const auto rot = Quaternion::QuaternionFromAngleAxis(-0.5*M_PI, VectorCartesian(0, 0, 1));
+	auto quat = rot.Inv() * headTrace->rotationForTimestamp(seconds);
+	return Quaternion(quat.GetW(), -quat.GetV().GetX(), -quat.GetV().GetY(), quat.GetV().GetZ());
+}
+
+// head orientation of the OSVR tracker, on a client context of its own since the render loop updates the other one
+class TrackerSource
+{
+public:
+	TrackerSource() : context("com.osvr.360player.poses"), head(context.getInterface("/me/head")) {}
+
+	bool operator()(long long, Quaternion& rotation)
+	{
+		context.update();
+		OSVR_TimeValue timestamp;
+		OSVR_OrientationState state;
+		if (osvrGetOrientationState(head.get(), &timestamp, &state) != OSVR_RETURN_SUCCESS)
+			return false;
+		// the conversion DrawWorld applies to the rendered pose
+		auto q = osvr::util::fromQuat(state);
+		rotation = Quaternion(q.w(), q.z(), q.x(), -q.y());
+		return true;
+	}
+
+private:
+	osvr::clientkit::ClientContext context;
+	osvr::clientkit::Interface head;
+};
+
+// samples poses at poseRate from start on, from the head trace or the tracker
+static void startPoseSampler(std::chrono::steady_clock::time_point start)
+{
+	auto config = Config::instance();
+	poseClockStart = start;
+	if (config->poseRate <= 0)
+		return;
+
+	PoseSampler::Source source;
+	if (SessionLog::instance().replaying())
+		source = [](long long timestamp, Quaternion& rotation) { return SessionLog::instance().poseAt(timestamp, rotation); };
+	else if (config->useHeadtrace)
+		source = [](long long timestamp, Quaternion& rotation)
+		{
+			rotation = tracePose(timestamp / 1000.0);
+			return true;
+		};
+	else
+	{
+		// the context is created here and only used by the sampling thread from then on
+		auto tracker = std::make_shared<TrackerSource>();
+		source = [tracker](long long timestamp, Quaternion& rotation) { return (*tracker)(timestamp, rotation); };
+	}
+	poseSampler.reset(new PoseSampler(config->poseRate, start, source, &updatePose));
+	LOG_INFO("Sampling poses at " << config->poseRate << " Hz");
+}
+
+// time since the first display frame, the clock frames are due on and head traces are read at [render thread]
+static std::chrono::system_clock::time_point displayDeadline()
+{
+	auto now = std::chrono::system_clock::now();
+	if (global_startDisplayTime == zero)
+		global_startDisplayTime = now;// + std::chrono::milliseconds(5000);
+	return std::chrono::system_clock::time_point(now - global_startDisplayTime);
+}
+
+// draws the video for eyes views at once, pose and projection of each eye one after another. The pose of the
+// first eye goes to the adaption when samplePose is set and there is no pose sampler [render thread]
+static void drawEyes(OSVR_PoseState* poses, const osvr::renderkit::OSVR_ProjectionMatrix* projections, size_t eyes, bool samplePose)
+{
+	// from sampling the pose until the frame is drawn with it
+	TRACE_SPAN("pose to draw");
+
+	auto deadlineTP = displayDeadline();
+
+	GLdouble projectionGL[32];
+	GLdouble viewGL[32];
+	for (size_t eye = 0; eye < eyes && eye < 2; eye++)
+	{
+		osvr::renderkit::OSVR_Projection_to_OpenGL(projectionGL + 16 * eye, projections[eye]);
+
+		auto& pose = poses[eye];
+		if (Config::instance()->useHeadtrace)
+		{
+			auto quat = headTrace->rotationForTimestamp(std::chrono::time_point_cast<std::chrono::milliseconds>(deadlineTP).time_since_epoch().count() / 1000.0);
+			auto rot = Quaternion::QuaternionFromAngleAxis(-0.5*M_PI, VectorCartesian(0, 0, 1));
+			quat = rot.Inv() * quat;
+			pose.rotation.data[0] = quat.GetW();
+			pose.rotation.data[1] = -quat.GetV().GetY();
+			pose.rotation.data[2] = -quat.GetV().GetZ();
+			pose.rotation.data[3] = -quat.GetV().GetX();
+		}
+		osvr::renderkit::OSVR_PoseState_to_OpenGL(viewGL + 16 * eye, pose);
+	}
+
+	if (samplePose && !poseSampler)
+	{
+		auto q = osvr::util::fromQuat(poses[0].rotation);
+		Quaternion headRotation(q.w(), q.z(), q.x(), -q.y());
+		updatePose(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - poseClockStart).count(), headRotation);
+	}
+
+	if (firstSegmentDownloaded)
+	{
+		// Draw a cube with a 5-meter radius as the room we are floating in.
+		auto frameInfo = roomMesh->Draw(projectionGL, viewGL, sampleShader, std::move(deadlineTP), static_cast<GLsizei>(eyes));
+		//au->printTileVisibility(Quaternion(q.w(), q.z(), q.x(), -q.y()));
+
+		lastDisplayedFrame = frameInfo.m_frameDisplayId;
+		lastNbDroppedFrame += frameInfo.m_nbDroppedFrame;
+		if (Config::instance()->playType == Config::PlayType::Dash)
+		{
+			bufferManager->setPlayheadFrame(lastDisplayedFrame);
+			auto stats = static_cast<ShaderTextureVideo*>(sampleShader.get())->GetStats();
+			PlayerMetrics::instance().addFrame(lastDisplayedFrame, frameInfo.m_nbDroppedFrame, stats.stalls, stats.stallingMs, stats.lateFrames, stats.lateMs);
+		}
+
+		if (frameInfo.m_last)
+			quit = true;
+	}
+}
+
+// both eyes of a display frame in one pass, the video is updated once for them [render thread]
+static bool renderStereo(osvr::renderkit::RenderManager& render, StereoTarget& target)
+{
+	auto renderInfo = render.GetRenderInfo();
+	if (renderInfo.size() != 2)
+		return false;
+	OSVR_PoseState poses[2] = { renderInfo[0].pose, renderInfo[1].pose };
+	osvr::renderkit::OSVR_ProjectionMatrix projections[2] = { renderInfo[0].projection, renderInfo[1].projection };
+
+	target.Bind();
+	drawEyes(poses, projections, 2, true);
+	return target.Present(render, renderInfo);
+}
+
 // Callbacks to draw things in world space.
 void DrawWorld(
 	void* userData //< Passed into AddRenderCallback
@@ -225,100 +409,450 @@ void DrawWorld(
 
 		osvr::renderkit::GraphicsLibraryOpenGL* glLibrary = library.OpenGL;
 
-		std::chrono::system_clock::time_point deadlineTP(
-			std::chrono::seconds{ deadline.seconds } +
-			std::chrono::microseconds{ deadline.microseconds });
+		static bool leftEye = true;
+		drawEyes(&pose, &projection, 1, leftEye);
+		leftEye = !leftEye;
+	}
+}
 
-		auto now = std::chrono::system_clock::now();
-		if (global_startDisplayTime == zero)
-			global_startDisplayTime = now;// + std::chrono::milliseconds(5000);
-		deadlineTP = std::chrono::system_clock::time_point(now - global_startDisplayTime);
+// the first segment after an init is what the decoder probes the stream with, a tile that failed is asked for again
+// before its stream starts without it
+static std::string downloadFirstSegment(int tileIndex, int segment, httplib::Client* client, size_t connection)
+{
+	const int attempts = 3;
+	auto res = au->download(tileIndex, segment, client, connection);
+	for (int attempt = 1; res->status == -1 && attempt < attempts; attempt++)
+		res = au->download(tileIndex, segment, client, connection);
+	return std::move(res->body);
+}
 
-		GLdouble projectionGL[16];
-		osvr::renderkit::OSVR_Projection_to_OpenGL(projectionGL, projection);
-		
-		if (Config::instance()->useHeadtrace)
+// fetches segment of every tile in the qualities planned from the current pose and restarts the decoder with them,
+// so a seek waits for one segment instead of everything before it [adaption thread]
+static void seekTo(int segment, bool last)
+{
+	auto requested = std::chrono::steady_clock::now();
+	PoseSnapshot<> poses;
+	headRotations.snapshot(poses);
+	auto tileDownloadOrder = au->startAdaption(poses, segment);
+	std::vector<std::string> segments(numTiles);
+	for (int tileIndex : tileDownloadOrder)
+	{
+		downloadPool->enqueue([&segments, segment, tileIndex](httplib::Client* client, size_t connection)
 		{
-			auto quat = headTrace->rotationForTimestamp(std::chrono::time_point_cast<std::chrono::milliseconds>(deadlineTP).time_since_epoch().count() / 1000.0);
-			auto rot = Quaternion::QuaternionFromAngleAxis(-0.5*M_PI, VectorCartesian(0, 0, 1));
-			quat = rot.Inv() * quat;
-			pose.rotation.data[0] = quat.GetW();
-			pose.rotation.data[1] = -quat.GetV().GetY();
-			pose.rotation.data[2] = -quat.GetV().GetZ();
-			pose.rotation.data[3] = -quat.GetV().GetX();
-		}
-
-		GLdouble viewGL[16];
-		osvr::renderkit::OSVR_PoseState_to_OpenGL(viewGL, pose);
-
-		auto q = osvr::util::fromQuat(pose.rotation);
+			segments[tileIndex] = downloadFirstSegment(tileIndex, segment, client, connection);
+		});
+	}
+	downloadPool->wait();
+	au->stopAdaption();
 
-		static bool leftEye = true;
-		if (leftEye)
-			headRotations.push({ TIME_NOW_EPOCH_MS - startTimeEpochMs, Quaternion(q.w(), q.z(), q.x(), -q.y()) });
-		leftEye = !leftEye;
+	bufferManager->seek(segment);
+	au->setFirstSegment(segment, poses.timestamp(0));
+	if (headlessReader)
+		headlessReader->Seek(initSegments, std::move(segments));
+	else
+		static_cast<ShaderTextureVideo*>(sampleShader.get())->Seek(initSegments, std::move(segments));
+	for (int t = 0; t < numTiles; t++)
+	{
+		segmentStreams[t].addQuality(segment * mpd->segmentDuration(), au->getCurrentTileQuality().at(t));
+		if (last)
+			segmentStreams[t].endOfStream();
+	}
+	bufferManager->segmentBuffered(segment);
+	LOG_INFO("Seek to segment " << segment << " after " << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - requested).count() << " ms");
+}
 
-		if (firstSegmentDownloaded)
+// raises tiles of the buffered segments first + [start, next) to the quality the current prediction gives them, while
+// the buffer is above its target. An upgrade takes at most the time until the buffer drains to the target and is
+// given up when it does, so the next segment is fetched as it would be without it. Returns once the next segment is
+// due [adaption thread]
+static void upgradeBuffered(int first, int start, int next, size_t& upgraded, size_t& wasted)
+{
+	double segmentDuration = mpd->segmentDuration();
+	auto keepGoing = []() { return !quit && !bufferManager->seekRequested() && bufferManager->bufferLevel() > bufferManager->target(); };
+	PoseSnapshot<> poses;
+	while (keepGoing())
+	{
+		std::vector<AdaptionUnit::BufferedSegment> buffered;
+		for (int i = std::max(start, (int)(bufferManager->playheadSeconds() / segmentDuration) + 1); i < next; i++)
 		{
-			// Draw a cube with a 5-meter radius as the room we are floating in.
-			auto frameInfo = roomMesh->Draw(projectionGL, viewGL, sampleShader, std::move(deadlineTP));
-			//au->printTileVisibility(Quaternion(q.w(), q.z(), q.x(), -q.y()));
+			AdaptionUnit::BufferedSegment b = { first + i, i * segmentDuration - bufferManager->playheadSeconds(), {}, {} };
+			bool any = false;
+			for (int t = 0; t < numTiles; t++)
+			{
+				b.quality.push_back(segmentStreams[t].getQualityAtTime(i * segmentDuration));
+				b.replaceable.push_back(segmentStreams[t].replaceable(i));
+				any = any || b.replaceable.back();
+			}
+			if (any)
+				buffered.push_back(std::move(b));
+		}
 
-			lastDisplayedFrame = frameInfo.m_frameDisplayId;
-			lastNbDroppedFrame += frameInfo.m_nbDroppedFrame;
+		headRotations.snapshot(poses);
+		AdaptionUnit::Upgrade upgrade;
+		if (buffered.empty() || !au->planUpgrade(poses, buffered, bufferManager->bufferLevel() - bufferManager->target(), upgrade))
+		{
+			// the prediction moves on with the poses, it is asked again after a quarter of a second of frames
+			auto displayed = playbackEvents.value(PlaybackEvents::FrameDisplayed);
+			if (!playbackEvents.wait(PlaybackEvents::FrameDisplayed, displayed + std::max(1, (int)(mpd->frameRate() / 4))))
+				return;
+			continue;
+		}
 
-			if (frameInfo.m_last)
-				quit = true;
+		std::string body;
+		int i = upgrade.segment - first;
+		if (!au->downloadUpgrade(upgrade.tile, upgrade.segment, upgrade.quality, keepGoing, body))
+			continue;
+		if (segmentStreams[upgrade.tile].replaceSegment(i, std::move(body)))
+		{
+			segmentStreams[upgrade.tile].addQuality(i * segmentDuration, upgrade.quality);
+			upgraded++;
+			LOG_INFO("upgrade tile " << upgrade.tile << " segment " << upgrade.segment << " -> q " << upgrade.quality);
 		}
+		else
+			wasted++;
 	}
 }
 
 void querySegmentThread()
 {
-	while (headRotations.size() < 1)
-		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	Trace::nameThread("adaption");
+	ThreadTopology::apply("adaption");
+	if (!playbackEvents.wait(PlaybackEvents::PoseAvailable, 1))
+		return;
 
-	au->initAdaption(headRotations[0]);
-	for (int i = 0; i < numTiles; i++)
+	auto config = Config::instance();
+	// a live event is joined behind its live edge, the player's segment i is segment first + i of the MPD
+	std::unique_ptr<LiveManifest> live;
+	int first = 0;
+	if (mpd->isDynamic())
 	{
-		auto initRes = httpClient->Get((mpd->getInitUrl(i)).c_str());
-		auto fsRes = au->download(i, 0);
-		segmentStreams[i].init(mpd->period.adaptationSets[i].srd, initRes->body, fsRes->body);
-		segmentStreams[i].addQuality(0, au->getCurrentTileQuality().at(i));
+		live.reset(new LiveManifest(mpd, httpClient, config->mpdUri));
+		double delay = config->liveDelay >= 0 ? config->liveDelay
+			: mpd->suggestedPresentationDelay.count() > 0 ? mpd->suggestedPresentationDelay.count() / 1000.0 : 2 * mpd->segmentDuration();
+		first = live->startSegment(delay);
+		if (!live->waitForSegment(first))
+			return;
+		au->setFirstSegment(first);
+		LOG_INFO("Joining the live event at segment " << first);
 	}
+
+	// an on demand video starts at the segment of startTime
+	int start = live ? 0 : mpd->segmentAt(config->startTime);
+	bufferManager->seek(start);
+	initSegments.resize(numTiles);
+
+	auto startup = std::chrono::steady_clock::now();
+	PoseSnapshot<> poses;
+	headRotations.snapshot(poses);
+	auto tileDownloadOrder = au->initAdaption(poses, first + start, config->fastStart);
+	// the tiles are fetched in parallel, each its init segment, from disk if an earlier session kept it, then its first segment
+	for (int tileIndex : tileDownloadOrder)
+	{
+		downloadPool->enqueue([=](httplib::Client* client, size_t connection)
+		{
+			auto& initUrl = mpd->getInitUrl(tileIndex);
+			std::string init;
+			if (!initSegmentCache->load(initUrl, init))
+			{
+				auto initRes = client->Get(initUrl.c_str());
+				if (initRes && initRes->status == 200)
+				{
+					init = std::move(initRes->body);
+					initSegmentCache->store(initUrl, init);
+				}
+			}
+			initSegments[tileIndex] = init;
+			segmentStreams[tileIndex].init(mpd->period.adaptationSets[tileIndex].srd, std::move(init),
+				downloadFirstSegment(tileIndex, first + start, client, connection));
+			segmentStreams[tileIndex].addQuality(0, au->getCurrentTileQuality().at(tileIndex));
+		});
+	}
+	downloadPool->wait();
 	au->stopAdaption();
+	bufferManager->segmentBuffered(start);
+	LOG_INFO("First segment of " << numTiles << " tiles after " << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startup).count() << " ms");
 
-	sampleShader = std::make_shared<ShaderTextureVideo>(segmentStreams, numTiles, -1, 150, 0);
+	if (Config::instance()->headless)
+	{
+		headlessReader = std::make_shared<LibAv::VideoReader>(segmentStreams, numTiles, 150);
+		headlessReader->SetTileVisibility(Config::instance()->decodeSkipping ? &tileVisibility : nullptr);
+		headlessReader->Init(-1);
+	}
+	else
+	{
+		sampleShader = std::make_shared<ShaderTextureVideo>(segmentStreams, numTiles, -1, 150, Config::instance()->decodeSkipping ? &tileVisibility : nullptr);
+		sampleShader->SetPerPixelProjection(Config::instance()->perPixelProjection);
+		sampleShader->SetSinglePassStereo(Config::instance()->singlePassStereo);
+	}
 	firstSegmentDownloaded = true;
 
-	while (headRotations.size() < headRotations.capacity())
-		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	// the prediction needs a full window of poses
+	if (!playbackEvents.wait(PlaybackEvents::PoseAvailable, std::min(headRotations.capacity(), au->poseWindow())))
+		return;
 
-	int numSegments = mpd->period.adaptationSets[0].representations[0].segmentList.segmentUrls.size();
-	double frameRate = mpd->frameRate();
+	int numSegments = mpd->numSegments();
 	double segmentDuration = mpd->segmentDuration();
-	double segmentFrames = segmentDuration * frameRate;
-
-	for (int i = 1; i < numSegments; i++)
-	{
-		int firstSegmentFrame = i * segmentFrames;
 
-		while (firstSegmentFrame - segmentFrames > lastDisplayedFrame)
-			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	// upgrades of tiles of buffered segments, and those the decoder reached before they arrived
+	size_t upgraded = 0, wasted = 0;
+	// the segments since the last seek may be upgraded, whole ones only
+	int upgradable = start + 1;
+	bool upgrades = config->qualityUpgrades && !config->chunkedTransfer;
 
-		auto tileDownloadOrder = au->startAdaption(headRotations, i);
+	for (int i = start + 1; live || i < numSegments; i++)
+	{
+		// plan segment i while the buffered segments play, meanwhile upgrading them
+		if (upgrades)
+			upgradeBuffered(first, upgradable, i, upgraded, wasted);
+		if (!bufferManager->waitForRoom())
+			return;
+		// a seek replaces the buffered segments with its target, the loop continues after it
+		int target = bufferManager->takeSeek();
+		if (target >= 0 && !live)
+		{
+			seekTo(target, target == numSegments - 1);
+			i = target;
+			upgradable = target + 1;
+			continue;
+		}
+		int segment = first + i;
+		if (live && !live->waitForSegment(segment))
+			break;
+		au->setBufferLevel(bufferManager->bufferLevel());
+		bool last = !live && i == numSegments - 1;
+
+		headRotations.snapshot(poses);
+		auto tileDownloadOrder = au->startAdaption(poses, segment);
 		assert(tileDownloadOrder.size() == numTiles);
-		for (int t = 0; t < numTiles; t++)
+		// tiles are handed to the pool in priority order, the first connections pick up the most visible tiles
+		int tilesPerRequest = std::max(1, config->tilesPerRequest);
+		int pipelineDepth = config->keepAlive && !config->http2 ? std::max(1, config->pipelineDepth) : 1;
+		bool chunked = config->chunkedTransfer;
+		auto fetchTile = [=](int tileIndex, httplib::Client* client, size_t connection)
 		{
-			int tileIndex = tileDownloadOrder[t];
-			auto res = au->download(tileIndex, i);
-			segmentStreams[tileIndex].addSegment(res->body, i == numSegments - 1);
+			if (chunked)
+			{
+				auto& stream = segmentStreams[tileIndex];
+				au->downloadStream(tileIndex, segment, client, connection, [&](const char* data, size_t size) { stream.addData(data, size); },
+					[&](size_t size) { return stream.reserveSegment(size); });
+				stream.endSegment(last);
+			}
+			else
+			{
+				// a tile that failed ends its segment empty, the next one continues the stream
+				auto res = au->download(tileIndex, segment, client, connection);
+				segmentStreams[tileIndex].addSegment(std::move(res->body), last, i);
+			}
 			segmentStreams[tileIndex].addQuality(i * segmentDuration, au->getCurrentTileQuality().at(tileIndex));
+		};
+		// a connection requests pipelineDepth consecutive tiles of the order at once and reads their answers one
+		// after the other
+		for (int t = 0; t < numTiles && tilesPerRequest == 1; t += pipelineDepth)
+		{
+			std::vector<int> group(tileDownloadOrder.begin() + t, tileDownloadOrder.begin() + std::min(numTiles, t + pipelineDepth));
+			downloadPool->enqueue([=](httplib::Client* client, size_t connection)
+			{
+				if (group.size() > 1)
+					au->pipeline(group, segment, client);
+				for (int tileIndex : group)
+					fetchTile(tileIndex, client, connection);
+			});
 		}
+		// batches of consecutive tiles of the order save a round trip per tile
+		for (int t = 0; t < numTiles && tilesPerRequest > 1; t += tilesPerRequest)
+		{
+			std::vector<int> batch(tileDownloadOrder.begin() + t, tileDownloadOrder.begin() + std::min(numTiles, t + tilesPerRequest));
+			downloadPool->enqueue([=](httplib::Client* client, size_t connection)
+			{
+				auto data = au->downloadBatch(batch, segment, client, connection);
+				for (size_t b = 0; b < batch.size(); b++)
+				{
+					segmentStreams[batch[b]].addSegment(std::move(data[b]), last, i);
+					segmentStreams[batch[b]].addQuality(i * segmentDuration, au->getCurrentTileQuality().at(batch[b]));
+				}
+			});
+		}
+		downloadPool->wait();
 		au->stopAdaption();
+		bufferManager->segmentBuffered(i);
+	}
+
+	// the live event has ended
+	for (int t = 0; live && t < numTiles; t++)
+		segmentStreams[t].endOfStream();
+
+	if (upgrades)
+		LOG_INFO("Quality upgrades: " << upgraded << " tiles raised, " << wasted << " reached by the decoder first");
+	if (segmentStore->enabled())
+	{
+		segmentStore->flush();
+		auto stats = segmentStore->statistics();
+		LOG_INFO("Segment store: " << stats.hits << " hits (" << stats.hitBytes / 1000000 << " MB), " << stats.misses
+			<< " misses, " << stats.evictions << " evictions, " << segmentStore->size() / 1000000 << " MB kept");
 	}
 }
 
+// playback without OpenGL: a virtual display takes frames at displayRate, the poses come from the head trace.
+// Prints decode and display rates, merge time, buffer level, stalls, late decoding and skipped frames every two seconds and for
+// the whole run
+int runHeadless()
+{
+	auto config = Config::instance();
+	bool replayPoses = SessionLog::instance().replaying() && SessionLog::instance().lastPose() >= 0;
+	if (!replayPoses && (!config->useHeadtrace || headTrace == nullptr))
+	{
+		std::cerr << "Headless playback needs a head trace or a session replay" << std::endl;
+		return 1;
+	}
+	if (config->playType != Config::PlayType::Dash)
+	{
+		std::cerr << "Headless playback needs a dash config" << std::endl;
+		return 1;
+	}
+
+#ifdef _WIN32
+	SetConsoleCtrlHandler((PHANDLER_ROUTINE)CtrlHandler, TRUE);
+#endif
+
+	LOG_INFO("Start playing the video headless");
+
+	// the display time of frame n is n refresh intervals, late frames do not shift the clock
+	const std::chrono::duration<double, std::milli> refreshInterval(1000.0 / config->displayRate);
+	auto wallStart = std::chrono::steady_clock::now();
+	startPoseSampler(wallStart);
+	// the virtual display is the render role, placed after the threads that would inherit it on Linux
+	ThreadTopology::apply("render");
+
+	struct Sample
+	{
+		std::chrono::steady_clock::time_point time;
+		size_t displayed;
+		LibAv::VideoReader::DecodeStats stats;
+	};
+	Sample start = { wallStart, 0, {} };
+	Sample report = start;
+	Sample now = start;
+	auto print = [&](const char* label, const Sample& from, const Sample& to)
+	{
+		double seconds = std::chrono::duration<double>(to.time - from.time).count();
+		size_t decoded = to.stats.framesDecoded - from.stats.framesDecoded;
+		LOG_INFO(label
+			<< " decode " << (seconds > 0 ? decoded / seconds : 0) << " fps"
+			<< " | display " << (seconds > 0 ? (to.displayed - from.displayed) / seconds : 0) << " fps"
+			<< " | decode " << (decoded ? (to.stats.decodeMs - from.stats.decodeMs) / decoded : 0) << " ms/frame"
+			<< " | merge " << (decoded ? (to.stats.mergeMs - from.stats.mergeMs) / decoded : 0) << " ms/frame"
+			<< " | buffer " << bufferManager->bufferLevel() << " s"
+			<< " | stalls " << to.stats.stalls - from.stats.stalls << " (" << to.stats.stallingMs - from.stats.stallingMs << " ms)"
+			<< " | late " << to.stats.lateFrames - from.stats.lateFrames << " (" << to.stats.lateMs - from.stats.lateMs << " ms)"
+			<< " | skipped " << to.stats.skippedFrames - from.stats.skippedFrames);
+	};
+
+	for (long long n = 0; !quit; n++)
+	{
+		auto displayTime = n * refreshInterval;
+		std::this_thread::sleep_until(wallStart + std::chrono::duration_cast<std::chrono::steady_clock::duration>(displayTime));
+		TRACE_SPAN("pose to draw");
+
+		Quaternion pose;
+		if (!poseSampler && !replayPoses)
+			updatePose((long long)displayTime.count(), tracePose(displayTime.count() / 1000.0));
+		else if (!poseSampler && SessionLog::instance().poseAt((long long)displayTime.count(), pose))
+			updatePose((long long)displayTime.count(), pose);
+
+		if (firstSegmentDownloaded)
+		{
+			auto frameInfo = headlessReader->ConsumeNextPicture(std::chrono::system_clock::time_point(
+				std::chrono::duration_cast<std::chrono::system_clock::duration>(displayTime)));
+			lastDisplayedFrame = frameInfo.m_frameDisplayId;
+			bufferManager->setPlayheadFrame(lastDisplayedFrame);
+			lastNbDroppedFrame += frameInfo.m_nbDroppedFrame;
+
+			now = { std::chrono::steady_clock::now(), lastDisplayedFrame + 1, headlessReader->GetStats() };
+			PlayerMetrics::instance().addFrame(lastDisplayedFrame, frameInfo.m_nbDroppedFrame, now.stats.stalls, now.stats.stallingMs,
+				now.stats.lateFrames, now.stats.lateMs);
+			if (frameInfo.m_last)
+				quit = true;
+		}
+		else
+			now.time = std::chrono::steady_clock::now();
+
+		if (now.time - report.time >= std::chrono::seconds(2))
+		{
+			print("[headless]", report, now);
+			report = now;
+		}
+	}
+
+	print("[headless] total", start, now);
+	LOG_INFO("[headless] frames displayed " << now.displayed << ", dropped " << lastNbDroppedFrame);
+	if (poseSampler)
+		LOG_INFO("[headless] poses sampled at " << poseSampler->count() / std::chrono::duration<double>(now.time - start.time).count() << " Hz");
+	poseSampler.reset();
+	Log::instance().flush();
+	return 0;
+}
+
+// Prometheus endpoint of the session's metrics on localhost:port, runs until the process ends
+void serveMetrics(int port)
+{
+	std::thread([port]()
+	{
+		httplib::Server metricsServer;
+		metricsServer.Get("/metrics", [](const httplib::Request&, httplib::Response& res)
+		{
+			res.set_content(PlayerMetrics::instance().write(bufferManager->bufferLevel(), bufferManager->heldBytes()), "text/plain; version=0.0.4");
+		});
+		// POST /seek?t=seconds continues playback at that media time, not for live events
+		metricsServer.Post("/seek", [](const httplib::Request& req, httplib::Response& res)
+		{
+			if (!req.has_param("t") || mpd->isDynamic())
+			{
+				res.status = 400;
+				return;
+			}
+			int segment = mpd->segmentAt(std::atof(req.get_param_value("t").c_str()));
+			bufferManager->requestSeek(segment);
+			res.set_content(std::to_string(segment) + "\n", "text/plain");
+		});
+		if (!metricsServer.listen("localhost", port))
+			LOG_ERROR("Could not serve metrics on port " << port);
+	}).detach();
+}
+
+// ends the recording of the session log, or logs how closely the replay followed it
+void closeSessionLog()
+{
+	auto& session = SessionLog::instance();
+	if (session.replaying())
+	{
+		auto stats = session.statistics();
+		LOG_INFO("Session replay: " << stats.replayed << " requests replayed, " << stats.late << " of them late, " << stats.unrecorded
+			<< " not in the log, " << stats.left << " left over; " << stats.decodes << " decode times replayed, " << stats.decodesLeft << " left over");
+	}
+	else if (session.recording())
+	{
+		// the observer stays, requests still running are left out once the log is closed
+		session.close();
+		LOG_INFO("Session log written to " << Config::instance()->recordSession);
+	}
+}
+
+// writes the trace of the session and logs the percentiles of every stage
+void writeTrace()
+{
+	auto& path = Config::instance()->traceFile;
+	if (path.empty())
+		return;
+	Trace::stop();
+	if (Trace::writeChromeTrace(path))
+		LOG_INFO("Trace written to " << path);
+	else
+		LOG_ERROR("Could not write trace " << path);
+	for (auto& line : Trace::summary())
+		LOG_INFO("[trace] " << line);
+	Log::instance().flush();
+}
+
 #ifdef _WIN32
 #undef main
 #endif
@@ -333,11 +867,35 @@ int main(int argc, char* argv[])
 
 	auto config = Config::instance();
 	config->init(argv[1]);
+	if (!config->traceFile.empty())
+		Trace::start();
+	Trace::nameThread("render");
+
+	// the transport answering the requests of a replayed session, before the first one is sent
+	std::shared_ptr<SessionHttp::Replay> replay;
+	if (!config->replaySession.empty())
+	{
+		if (!SessionLog::instance().replay(config->replaySession))
+		{
+			std::cout << "cannot replay the session log " << config->replaySession << std::endl;
+			return -1;
+		}
+		replay = std::make_shared<SessionHttp::Replay>(config->squidAddress, config->squidPort, true);
+		LOG_INFO("Replaying the session " << config->replaySession);
+	}
+	else if (!config->recordSession.empty())
+	{
+		if (SessionLog::instance().record(config->recordSession))
+			httplib::request_observer() = &SessionHttp::record;
+		else
+			LOG_ERROR("Could not write the session log " << config->recordSession);
+	}
 
 	if (config->playType == Config::PlayType::Dash)
 	{
 		httpClient = new httplib::Client(config->squidAddress.c_str(), config->squidPort);
 		httpClient->proxyServer = true;
+		httpClient->set_transport(replay);
 
 		auto res = httpClient->Get(config->mpdUri.c_str());
 		if (!res || res->status != 200)
@@ -346,30 +904,96 @@ int main(int argc, char* argv[])
 			return -1;
 		}
 		mpd = new DASH::MPD(res->body);
+		// the popularity sidecar 360popularity writes next to the MPD is read in place of its <Popularity> element
+		auto sidecar = httpClient->Get((config->mpdUri + ".pop").c_str());
+		if (sidecar && sidecar->status == 200 && mpd->loadPopularity(sidecar->body))
+			LOG_INFO("Popularity of " << mpd->period.popularSegments << " segments from " << config->mpdUri << ".pop");
+		if (!mpd->period.segmentSizesUrl.empty())
+		{
+			// a relative index url is resolved against the folder of the MPD
+			auto& indexUrl = mpd->period.segmentSizesUrl;
+			auto url = indexUrl[0] == '/' ? indexUrl : config->mpdUri.substr(0, config->mpdUri.rfind('/') + 1) + indexUrl;
+			auto index = httpClient->Get(url.c_str());
+			if (index && index->status == 200 && mpd->loadSegmentSizes(index->body))
+				LOG_INFO("Segment sizes from " << url);
+			else
+				LOG_WARNING("No segment size index at " << url << ", the adaption budgets with the representation bandwidths");
+		}
+		initSegmentCache = new InitSegmentCache(config->initCacheDir, config->mpdUri, res->body);
+		segmentStore = new SegmentStore(config->segmentCacheDir, size_t(config->segmentCacheMB) << 20);
 		au = new AdaptionUnit(mpd, httpClient);
+		if (segmentStore->enabled())
+			au->setSegmentStore(segmentStore);
+		if (replay)
+			downloadPool = new DownloadPool(config->squidAddress, config->squidPort, config->numConnections, true, false, replay);
+		else if (config->http2)
+		{
+			// a worker per tile, so all tiles of a segment are streams at the same time and the server orders them
+			auto transport = std::make_shared<Http2Client>(config->squidAddress, config->squidPort);
+			downloadPool = new DownloadPool(config->squidAddress, config->squidPort, mpd->period.adaptationSets.size(), true, false, transport);
+			au->setSharedConnection(true);
+		}
+		else
+			downloadPool = new DownloadPool(config->squidAddress, config->squidPort, config->numConnections, true, config->keepAlive);
+		bufferManager = new BufferManager(playbackEvents, mpd->segmentDuration(), mpd->frameRate(), config->bufferSeconds);
 
 		auto srd = mpd->period.adaptationSets[0].srd;
 		numTiles = srd.th * srd.tv;
 		segmentStreams = new VideoTileStream[numTiles];
+		for (int t = 0; t < numTiles; t++)
+		{
+			uint32_t bandwidth = 0;
+			for (auto& representation : mpd->period.adaptationSets[t].representations)
+				bandwidth = std::max(bandwidth, representation.bandwidth);
+			segmentStreams[t].setReadSize(config->avioBufferKB > 0 ? config->avioBufferKB << 10 : VideoTileStream::readSizeFor(bandwidth, mpd->frameRate()));
+		}
+		bufferManager->setMemoryLimit(size_t(config->mediaMemoryMB) << 20, [] {
+			size_t bytes = 0;
+			for (int t = 0; t < numTiles; t++)
+				bytes += segmentStreams[t].heldBytes();
+			return bytes;
+		});
+		PlayerMetrics::instance().init(numTiles, mpd->period.adaptationSets[0].representations.size());
+		if (config->metricsPort > 0)
+			serveMetrics(config->metricsPort);
 
 		std::thread(&querySegmentThread).detach();
 	}
 	else if (config->playType == Config::PlayType::Picture)
 	{
 		sampleShader = std::make_shared<ShaderTextureStatic>(config->imgPath);
+		sampleShader->SetPerPixelProjection(config->perPixelProjection);
+		sampleShader->SetSinglePassStereo(config->singlePassStereo);
 		firstSegmentDownloaded = true;
 	}
 
-	startTimeEpochMs = TIME_NOW_EPOCH_MS;
-
 	if (config->useHeadtrace)
 	{
 		headTrace = new HeadTrace(config->headtracePath.c_str());
 	}
 
+	if (config->headless)
+	{
+		int ret = runHeadless();
+		writeTrace();
+		closeSessionLog();
+		if (segmentStore)
+			segmentStore->flush();
+		playbackEvents.stop();
+		headlessReader.reset();
+		delete downloadPool;
+		delete bufferManager;
+		delete mpd;
+		delete httpClient;
+		return ret;
+	}
+
 	try
 	{
-		roomMesh = std::make_shared<MeshCubeEquiUV>(5.0f, 6 * 2 * 30 * 30);
+		if (config->perPixelProjection)
+			roomMesh = std::make_shared<MeshFullScreen>();
+		else
+			roomMesh = std::make_shared<MeshCubeEquiUV>(5.0f, 6 * 2 * 30 * 30);
 		
 		// Get an OSVR client context to use to access the devices that we need.
 		osvr::clientkit::ClientContext context("com.osvr.renderManager.openGLExample");
@@ -424,10 +1048,25 @@ int main(int argc, char* argv[])
 		// Clear any GL error that Glew caused.  Apparently on Non-Windows platforms, this can cause a spurious  error 1280.
 		glGetError();
 
+		// the shaders are built for single pass stereo, so there is no falling back to the callbacks
+		std::unique_ptr<StereoTarget> stereoTarget;
+		if (config->singlePassStereo)
+		{
+			stereoTarget.reset(new StereoTarget());
+			if (!stereoTarget->Init(*render))
+			{
+				std::cerr << "Could not set up the single pass stereo buffers" << std::endl;
+				return 3;
+			}
+		}
+
 		global_startDisplayTime = zero;
 		started = true;
+		startPoseSampler(std::chrono::steady_clock::now());
+		// only now, the threads started so far would have inherited the placement of the render loop on Linux
+		ThreadTopology::apply("render");
 
-		std::cout << "Start playing the video\n";
+		LOG_INFO("Start playing the video");
 
 		// Frame timing
 		size_t countFrames = 0;
@@ -437,10 +1076,15 @@ int main(int argc, char* argv[])
 		// Continue rendering until it is time to quit.
 		while (!quit) 
 		{
+			// The next picture is uploaded before the tracker state is updated, so the draws take the newest pose
+			// after the upload. A late decoder leaves the last picture, which is still drawn with that pose.
+			if (firstSegmentDownloaded)
+				sampleShader->PrepareFrame(displayDeadline());
+
 			// Update the context so we get our callbacks called and update tracker state.
 			context.update();
 			
-			if (!render->Render()) 
+			if (stereoTarget ? !renderStereo(*render, *stereoTarget) : !render->Render()) 
 			{
 				std::cerr << "Render() returned false, maybe because it was asked to quit" << std::endl;
 				quit = true;
@@ -469,6 +1113,7 @@ int main(int argc, char* argv[])
 			}
 			//sleep(1);
 		}
+		poseSampler.reset();
 	}
 	catch (std::exception& e)
 	{
@@ -481,6 +1126,13 @@ int main(int argc, char* argv[])
 		return 1;
 	}
 
+	writeTrace();
+	closeSessionLog();
+	if (segmentStore)
+		segmentStore->flush();
+	playbackEvents.stop();
+	delete downloadPool;
+	delete bufferManager;
 	delete mpd;
 	delete httpClient;
 
@@ -10,8 +10,16 @@
 #include <string>
 #include <vector>
 #include <sstream>
+#include <stdexcept>
+#include <cstdint>
+#include <cstdlib>
+#include <cmath>
+#include <cstdio>
 #include "tinyxml2.h"
+#include "PopularitySidecar.hpp"
+#include "SegmentSizeIndex.hpp"
 #include <chrono>
+#include <algorithm>
 using namespace tinyxml2;
 #define getattr(elem, attr) attr = elem->Attribute(#attr) ? elem->Attribute(#attr) : ""
 #define getattr_dur(elem, attr) if(elem->Attribute(#attr)) attr = parseDuration(elem->Attribute(#attr)); else attr = std::chrono::milliseconds(0);
@@ -19,6 +27,9 @@ using namespace tinyxml2;
 #define getattr_bool(elem, attr) if(elem->Attribute(#attr)) std::istringstream(elem->Attribute(#attr)) >> std::boolalpha >> attr; else attr = false;
 namespace DASH
 {
+	// representation index per tile, 0 is the highest quality
+	typedef std::vector<uint8_t> TileQualityVector;
+
 	static std::chrono::duration<int, std::milli> parseDuration(std::string str)
 	{
 		std::chrono::duration<int, std::milli> dur = std::chrono::milliseconds(0);
@@ -45,6 +56,31 @@ namespace DASH
 		return dur;
 	}
 
+	// ms since the epoch of an xs:dateTime like 2026-10-14T12:00:00.5Z, without a zone it is taken as UTC
+	static long long parseDateTime(const std::string& str)
+	{
+		int year, month, day, hour, minute;
+		double second;
+		if (sscanf(str.c_str(), "%d-%d-%dT%d:%d:%lf", &year, &month, &day, &hour, &minute, &second) != 6)
+			return 0;
+		// days from the civil date, counted from 1970-01-01
+		year -= month <= 2;
+		long long era = (year >= 0 ? year : year - 399) / 400;
+		long long yearOfEra = year - era * 400;
+		long long dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+		long long days = era * 146097 + yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear - 719468;
+		long long ms = ((days * 24 + hour) * 60 + minute) * 60000 + (long long)std::llround(second * 1000);
+
+		size_t zone = str.find_first_of("+-", str.find('T'));
+		if (zone != std::string::npos)
+		{
+			int zoneHours = 0, zoneMinutes = 0;
+			sscanf(str.c_str() + zone + 1, "%d:%d", &zoneHours, &zoneMinutes);
+			ms -= (str[zone] == '+' ? 1 : -1) * (zoneHours * 60 + zoneMinutes) * 60000LL;
+		}
+		return ms;
+	}
+
 	static double parseFramerate(std::string str)
 	{
 		std::istringstream ss(str);
@@ -57,35 +93,183 @@ namespace DASH
 		return num / denom;
 	}
 
+// the segments of a representation, listed by a <SegmentList> or generated from a <SegmentTemplate>
 struct SegmentList
 {
 	void parse(XMLElement* elem)
 	{
 		getattr_int(elem, timescale);
 		getattr_int(elem, duration);
+		availabilityTimeOffset = elem->DoubleAttribute("availabilityTimeOffset", 0);
+		// the list of a live event may start with a later segment than the first
+		startNumber = elem->UnsignedAttribute("startNumber", 1);
 		initializationUrl = elem->FirstChildElement("Initialization")->Attribute("sourceURL");
+		initializationPath = "/" + initializationUrl;
 
 		for (auto e = elem->FirstChildElement("SegmentURL"); e != NULL; e = e->NextSiblingElement("SegmentURL"))
+			segmentUrls.push_back(e->Attribute("media"));
+		count = startNumber - 1 + segmentUrls.size();
+		durationSeconds = duration / (double)timescale;
+	}
+
+	// $RepresentationID$, $Bandwidth$ and $$ are filled in here, $Number$ and $Number%0<width>d$ per url;
+	// a template without duration has no segments, a negative presentationSeconds has no last one
+	void parseTemplate(XMLElement* elem, const std::string& representationId, uint32_t bandwidth, double presentationSeconds)
+	{
+		timescale = elem->UnsignedAttribute("timescale", 1);
+		duration = elem->UnsignedAttribute("duration", 0);
+		startNumber = elem->UnsignedAttribute("startNumber", 1);
+		availabilityTimeOffset = elem->DoubleAttribute("availabilityTimeOffset", 0);
+		durationSeconds = duration / (double)timescale;
+		count = templateCount(presentationSeconds);
+
+		std::vector<std::string> initPieces;
+		std::vector<int> initWidths;
+		compile(elem->Attribute("initialization") ? elem->Attribute("initialization") : "", representationId, bandwidth, initPieces, initWidths);
+		initializationPath = "/";
+		format(initPieces, initWidths, startNumber, initializationPath);
+		initializationUrl = initializationPath.substr(1);
+		compile(elem->Attribute("media") ? elem->Attribute("media") : "", representationId, bandwidth, pieces, widths);
+	}
+
+	// takes the segments a refreshed MPD added to a list, those known already are skipped rather than parsed again;
+	// a template only changes its count
+	void update(XMLElement* representation, double presentationSeconds)
+	{
+		if (!pieces.empty())
 		{
+			count = templateCount(presentationSeconds);
+			return;
+		}
+		auto list = representation->FirstChildElement("SegmentList");
+		if (!list)
+			return;
+		// a list that keeps only a window of the event continues after the last known segment; one that moved past
+		// it replaces the known ones
+		auto first = list->FirstChildElement("SegmentURL");
+		auto e = first;
+		for (; e != NULL && !segmentUrls.empty(); e = e->NextSiblingElement("SegmentURL"))
+			if (segmentUrls.back() == e->Attribute("media"))
+				break;
+		if (e != NULL && !segmentUrls.empty())
+			first = e->NextSiblingElement("SegmentURL");
+		else
+		{
+			segmentUrls.clear();
+			startNumber = list->UnsignedAttribute("startNumber", 1);
+		}
+		for (e = first; e != NULL; e = e->NextSiblingElement("SegmentURL"))
 			segmentUrls.push_back(e->Attribute("media"));
+		count = startNumber - 1 + segmentUrls.size();
+	}
+
+	// appends the url of a segment, counted from 0, to url
+	void appendUrl(size_t segment, std::string& url) const
+	{
+		if (pieces.empty())
+		{
+			url += segmentUrls.at(segment - (startNumber - 1));
+			return;
 		}
+		if (segment >= count)
+			throw std::out_of_range("SegmentList::appendUrl: no segment " + std::to_string(segment));
+		format(pieces, widths, startNumber + (uint32_t)segment, url);
 	}
-	uint32_t timescale;
-	uint32_t duration;
+
+	uint32_t timescale = 1;
+	uint32_t duration = 0;
+	uint32_t startNumber = 1;
+	// seconds before the end of its media time from which a segment is sent, chunk by chunk as it is encoded
+	double availabilityTimeOffset = 0;
+	double durationSeconds = 0;
+	size_t count = 0;
 	std::string initializationUrl;
+	// the url as requested
+	std::string initializationPath;
+	// urls of a <SegmentList> from segment startNumber - 1 on, empty for a template
 	std::vector<std::string> segmentUrls;
+
+private:
+	// literal pieces of the media template around its $Number$ identifiers, with their widths
+	std::vector<std::string> pieces;
+	std::vector<int> widths;
+
+	size_t templateCount(double presentationSeconds) const
+	{
+		if (duration == 0)
+			return 0;
+		if (presentationSeconds < 0)
+			return SIZE_MAX;
+		return (size_t)std::ceil(presentationSeconds / durationSeconds - 1e-9);
+	}
+
+	static void compile(const std::string& templ, const std::string& representationId, uint32_t bandwidth, std::vector<std::string>& pieces, std::vector<int>& widths)
+	{
+		pieces.assign(1, "");
+		widths.clear();
+		for (size_t i = 0; i < templ.size(); i++)
+		{
+			size_t end = templ[i] == '$' ? templ.find('$', i + 1) : std::string::npos;
+			if (end == std::string::npos)
+			{
+				pieces.back() += templ[i];
+				continue;
+			}
+			std::string identifier = templ.substr(i + 1, end - i - 1);
+			i = end;
+			if (identifier.empty())
+				pieces.back() += '$';
+			else if (identifier == "RepresentationID")
+				pieces.back() += representationId;
+			else if (identifier == "Bandwidth")
+				pieces.back() += std::to_string(bandwidth);
+			else if (identifier.compare(0, 6, "Number") == 0)
+			{
+				widths.push_back(identifier.size() > 7 && identifier[6] == '%' ? std::atoi(identifier.c_str() + 7) : 0);
+				pieces.emplace_back();
+			}
+			// $Time$ and others are kept as they are
+			else
+				pieces.back() += "$" + identifier + "$";
+		}
+	}
+
+	static void format(const std::vector<std::string>& pieces, const std::vector<int>& widths, uint32_t number, std::string& url)
+	{
+		url += pieces[0];
+		for (size_t i = 0; i < widths.size(); i++)
+		{
+			// digits from the back, padded with zeros to the width
+			char digits[16];
+			char* end = digits + sizeof(digits);
+			char* first = end;
+			for (uint32_t n = number; first == end || n > 0; n /= 10)
+				*--first = char('0' + n % 10);
+			while (end - first < std::min(widths[i], (int)sizeof(digits)))
+				*--first = '0';
+			url.append(first, end);
+			url += pieces[i + 1];
+		}
+	}
 };
 
 struct Representation
 {
-	void parse(XMLElement* elem)
+	// the segments come from a <SegmentList> or a <SegmentTemplate> of the representation, or else the
+	// template of its adaptation set
+	void parse(XMLElement* elem, XMLElement* adaptationSetTemplate, double presentationSeconds)
 	{
 		getattr(elem, id);
 		getattr_int(elem, width);
 		getattr_int(elem, height);
 		getattr_int(elem, bandwidth);
 		getattr(elem, frameRate);
-		segmentList.parse(elem->FirstChildElement("SegmentList"));
+		auto list = elem->FirstChildElement("SegmentList");
+		auto templ = elem->FirstChildElement("SegmentTemplate");
+		if (list)
+			segmentList.parse(list);
+		else if (templ || adaptationSetTemplate)
+			segmentList.parseTemplate(templ ? templ : adaptationSetTemplate, id, bandwidth, presentationSeconds);
 	}
 	std::string id;
 	uint32_t width;
@@ -112,14 +296,14 @@ struct SRD
 
 struct AdaptationSet
 {
-	void parse(XMLElement* elem)
+	void parse(XMLElement* elem, double presentationSeconds)
 	{
 		getattr_bool(elem, segmentAlignment);
 		srd.parse(elem->FirstChildElement("SupplementalProperty"));
 		for (auto e = elem->FirstChildElement("Representation"); e != NULL; e = e->NextSiblingElement("Representation"))
 		{
 			representations.push_back(Representation());
-			representations.back().parse(e);
+			representations.back().parse(e, elem->FirstChildElement("SegmentTemplate"), presentationSeconds);
 		}
 	}
 	bool segmentAlignment;
@@ -129,7 +313,8 @@ struct AdaptationSet
 
 struct Period
 {
-	void parse(XMLElement* elem)
+	// presentationSeconds gives the number of segments of templates
+	void parse(XMLElement* elem, double presentationSeconds)
 	{
 		getattr(elem, start);
 		getattr_dur(elem, duration);
@@ -137,20 +322,40 @@ struct Period
 		for (auto e = elem->FirstChildElement("AdaptationSet"); e != NULL; e = e->NextSiblingElement("AdaptationSet"))
 		{
 			adaptationSets.push_back(AdaptationSet());
-			adaptationSets.back().parse(e);
+			adaptationSets.back().parse(e, presentationSeconds);
 		}
 
+		for (auto e = elem->FirstChildElement("SupplementalProperty"); e != NULL; e = e->NextSiblingElement("SupplementalProperty"))
+			if (e->Attribute("schemeIdUri", SegmentSizeIndex::scheme()) && e->Attribute("value"))
+				segmentSizesUrl = e->Attribute("value");
+
+		popularSegments = 0;
 		if (auto elemPopularity = elem->FirstChildElement("Popularity"))
 		{
+			size_t numTiles = adaptationSets.size();
 			for (auto e = elemPopularity->FirstChildElement("SegmentPopularity"); e != NULL; e = e->NextSiblingElement("SegmentPopularity"))
 			{
 				int segmentIndex = e->Int64Attribute("segment", -1);
-				std::stringstream ss(e->Attribute("tileQuality"));
-				char c;	int q;
-				for (int t = 0; t < adaptationSets.size(); t++)
+				const char* list = e->Attribute("tileQuality");
+				if (segmentIndex < 1 || list == NULL)
+					continue;
+				if (popularSegments < (size_t)segmentIndex)
+				{
+					popularSegments = segmentIndex;
+					tilePopularity.resize(popularSegments * numTiles, PopularitySidecar::none);
+				}
+
+				auto tileQuality = &tilePopularity[(segmentIndex - 1) * numTiles];
+				for (size_t t = 0; t < numTiles; t++)
 				{
-					ss >> q >> c;
-					segmentTilePopularity[segmentIndex-1][t] = q;
+					char* end;
+					long q = strtol(list, &end, 10);
+					// tiles missing in a short list get the lowest quality
+					if (end == list)
+						q = adaptationSets[t].representations.size() - 1;
+					else
+						list = *end == ',' ? end + 1 : end;
+					tileQuality[t] = (uint8_t)q;
 				}
 			}
 		}
@@ -159,7 +364,12 @@ struct Period
 	std::string start;
 	std::chrono::duration<int, std::milli> duration;
 	std::vector<AdaptationSet> adaptationSets;
-	std::map<int, std::map<int, int>> segmentTilePopularity;
+	// segments x tiles qualities of the <Popularity> element or its sidecar, PopularitySidecar::none for
+	// the tiles of segments without popularity
+	std::vector<uint8_t> tilePopularity;
+	size_t popularSegments;
+	// url of the SegmentSizeIndex relative to the MPD, empty without one
+	std::string segmentSizesUrl;
 };
 
 struct MPD
@@ -172,21 +382,119 @@ struct MPD
 			std::cout << e <<  " " << doc.ErrorStr() << std::endl;
 		auto elem = doc.FirstChildElement();
 		getattr(elem, xmlns);
+		getattr(elem, type);
 		getattr_dur(elem, minBufferTime);
 		getattr_dur(elem, mediaPresentationDuration);
 		getattr(elem, profiles);
-		period.parse(elem->FirstChildElement("Period"));
+		getattr(elem, availabilityStartTime);
+		getattr_dur(elem, minimumUpdatePeriod);
+		getattr_dur(elem, suggestedPresentationDelay);
+		availabilityStartMs = parseDateTime(availabilityStartTime);
+		period.parse(elem->FirstChildElement("Period"), presentationSeconds());
+		periodStart = period.start.empty() ? std::chrono::duration<int, std::milli>(0) : parseDuration(period.start);
+
+		// the adaption reads the bandwidths for every candidate, keep them in one tiles x levels block
+		numQualityLevels = 0;
+		for (auto& adaptationSet : period.adaptationSets)
+			numQualityLevels = std::max(numQualityLevels, adaptationSet.representations.size());
+		bandwidths.resize(period.adaptationSets.size() * numQualityLevels);
+		for (size_t t = 0; t < period.adaptationSets.size(); t++)
+		{
+			auto& representations = period.adaptationSets[t].representations;
+			for (size_t q = 0; q < numQualityLevels; q++)
+				bandwidths[t * numQualityLevels + q] = representations.empty() ? 0 : representations[std::min(q, representations.size() - 1)].bandwidth;
+		}
 	}
 
 
-	std::string getInitUrl(int adaptionSet = 0, int representation = 0) const
+	const std::string& getInitUrl(int adaptionSet = 0, int representation = 0) const
 	{
-		return "/" + period.adaptationSets.at(adaptionSet).representations.at(representation).segmentList.initializationUrl;
+		return period.adaptationSets.at(adaptionSet).representations.at(representation).segmentList.initializationPath;
+	}
+
+	// formats the url of a segment into url, which keeps its capacity across calls
+	void getUrl(std::string& url, int segmentIndex, int adaptionSet = 0, int representation = 0) const
+	{
+		url.assign(1, '/');
+		period.adaptationSets.at(adaptionSet).representations.at(representation).segmentList.appendUrl(segmentIndex, url);
 	}
 
 	std::string getUrl(int segmentIndex, int adaptionSet = 0, int representation = 0) const
 	{
-		return "/" + period.adaptationSets.at(adaptionSet).representations.at(representation).segmentList.segmentUrls.at(segmentIndex);
+		std::string url;
+		getUrl(url, segmentIndex, adaptionSet, representation);
+		return url;
+	}
+
+	size_t numSegments(int adaptionSet = 0, int representation = 0) const
+	{
+		return period.adaptationSets.at(adaptionSet).representations.at(representation).segmentList.count;
+	}
+
+	// a live presentation whose MPD is refreshed while it plays
+	bool isDynamic() const
+	{
+		return type == "dynamic";
+	}
+
+	// ms since the epoch from which a segment can be requested: once its media time has passed, earlier by the
+	// availabilityTimeOffset of low latency segments. Segments of static MPDs are always available
+	long long segmentAvailableMs(int segmentIndex, int adaptionSet = 0, int representation = 0) const
+	{
+		if (!isDynamic())
+			return 0;
+		auto& segmentList = period.adaptationSets.at(adaptionSet).representations.at(representation).segmentList;
+		return availabilityStartMs + periodStart.count() + (long long)(((segmentIndex + 1) * segmentList.durationSeconds - segmentList.availabilityTimeOffset) * 1000);
+	}
+
+	// segment of the media time at epochMs, -1 before the presentation started
+	int segmentAtMs(long long epochMs, int adaptionSet = 0, int representation = 0) const
+	{
+		auto& segmentList = period.adaptationSets.at(adaptionSet).representations.at(representation).segmentList;
+		double seconds = (epochMs - availabilityStartMs - periodStart.count()) / 1000.0;
+		if (seconds < 0 || segmentList.count == 0 || segmentList.durationSeconds <= 0)
+			return -1;
+		return (int)std::min<double>(seconds / segmentList.durationSeconds, segmentList.count - 1);
+	}
+
+	// segment playing at seconds of media time, clamped to the segments of the presentation
+	int segmentAt(double seconds, int adaptionSet = 0, int representation = 0) const
+	{
+		auto& segmentList = period.adaptationSets.at(adaptionSet).representations.at(representation).segmentList;
+		if (seconds <= 0 || segmentList.count == 0 || segmentList.durationSeconds <= 0)
+			return 0;
+		return (int)std::min<double>(seconds / segmentList.durationSeconds, segmentList.count - 1);
+	}
+
+	// merges a new version of a dynamic MPD: the segments it adds, its type and durations. The tiling, bandwidths
+	// and popularity are kept. Returns the number of segments the first representation gained, 0 if the text is no MPD
+	size_t refresh(const std::string& mpdText)
+	{
+		XMLDocument doc;
+		if (doc.Parse(mpdText.c_str(), mpdText.size()) || !doc.FirstChildElement() || !doc.FirstChildElement()->FirstChildElement("Period"))
+			return 0;
+		auto elem = doc.FirstChildElement();
+		getattr(elem, type);
+		getattr_dur(elem, mediaPresentationDuration);
+		getattr_dur(elem, minimumUpdatePeriod);
+
+		size_t before = numSegments();
+		auto setElem = elem->FirstChildElement("Period")->FirstChildElement("AdaptationSet");
+		for (auto& adaptationSet : period.adaptationSets)
+		{
+			if (setElem == NULL)
+				break;
+			auto repElem = setElem->FirstChildElement("Representation");
+			for (auto& representation : adaptationSet.representations)
+			{
+				if (repElem == NULL)
+					break;
+				representation.segmentList.update(repElem, presentationSeconds());
+				repElem = repElem->NextSiblingElement("Representation");
+			}
+			setElem = setElem->NextSiblingElement("AdaptationSet");
+		}
+		return numSegments() > before ? numSegments() - before : 0;
 	}
 
 	double frameRate(int adaptionSet = 0, int representation = 0) const
@@ -196,19 +504,106 @@ struct MPD
 
 	double segmentDuration(int adaptionSet = 0, int representation = 0) const
 	{
-		auto segmentList = period.adaptationSets.at(adaptionSet).representations.at(representation).segmentList;
-		return segmentList.duration / (double)segmentList.timescale;
+		return period.adaptationSets.at(adaptionSet).representations.at(representation).segmentList.durationSeconds;
 	}
 
-	const std::map<int, int>& tilePopularity(int segmentIndex) const
+	// quality per tile of segmentIndex, one for every adaptation set
+	const uint8_t* tilePopularity(int segmentIndex) const
 	{
-		return period.segmentTilePopularity.at(segmentIndex);
+		size_t numTiles = period.adaptationSets.size();
+		if (segmentIndex < 0 || (size_t)segmentIndex >= period.popularSegments || period.tilePopularity[segmentIndex * numTiles] == PopularitySidecar::none)
+			throw std::out_of_range("MPD::tilePopularity: no popularity for segment " + std::to_string(segmentIndex));
+		return &period.tilePopularity[segmentIndex * numTiles];
+	}
+
+	// takes the popularity from a sidecar instead of the <Popularity> element, false if it is none for this tiling
+	bool loadPopularity(const std::string& sidecarData)
+	{
+		PopularitySidecar sidecar;
+		if (!sidecar.read(sidecarData) || sidecar.tiles != period.adaptationSets.size())
+			return false;
+		period.tilePopularity = std::move(sidecar.quality);
+		period.popularSegments = sidecar.segments;
+		return true;
+	}
+
+	// bits per second, representations missing for a tile repeat its lowest quality
+	uint32_t bandwidth(int adaptionSet, int representation) const
+	{
+		return bandwidths[adaptionSet * numQualityLevels + representation];
+	}
+
+	// bits per second of all tiles in the given qualities
+	size_t bandwidth(const TileQualityVector& tileQuality) const
+	{
+		size_t sum = 0;
+		for (size_t t = 0; t < tileQuality.size(); t++)
+			sum += bandwidths[t * numQualityLevels + tileQuality[t]];
+		return sum;
+	}
+
+	// takes the exact segment sizes from an index, false if it is none for this tiling
+	bool loadSegmentSizes(const std::string& indexData)
+	{
+		SegmentSizeIndex index;
+		if (!index.read(indexData) || index.tiles != period.adaptationSets.size() || index.qualities != numQualityLevels)
+			return false;
+		segmentSizes = std::move(index);
+		return true;
+	}
+
+	bool hasSegmentSizes() const
+	{
+		return segmentSizes.segments > 0;
+	}
+
+	// bytes of a tile segment, from the size index or else from the bandwidth of its representation
+	double segmentBytes(int segmentIndex, int adaptionSet, int representation) const
+	{
+		if (auto bytes = segmentSizes.size(segmentIndex, adaptionSet, representation))
+			return bytes;
+		return bandwidth(adaptionSet, representation) / 8.0 * segmentDuration();
+	}
+
+	// bytes per second a tile segment needs, like its bandwidth but exact where the size index has the segment
+	double segmentRate(int segmentIndex, int adaptionSet, int representation) const
+	{
+		if (auto bytes = segmentSizes.size(segmentIndex, adaptionSet, representation))
+			return bytes / segmentDuration();
+		return bandwidth(adaptionSet, representation) / 8.0;
+	}
+
+	// bytes per second of all tiles of a segment in the given qualities
+	double segmentRate(int segmentIndex, const TileQualityVector& tileQuality) const
+	{
+		double sum = 0;
+		for (size_t t = 0; t < tileQuality.size(); t++)
+			sum += segmentRate(segmentIndex, (int)t, tileQuality[t]);
+		return sum;
 	}
 
 	std::string xmlns;
+	// static or dynamic
+	std::string type;
 	std::chrono::duration<int, std::milli> minBufferTime;
 	std::chrono::duration<int, std::milli> mediaPresentationDuration;
 	std::string profiles;
+	std::string availabilityStartTime;
+	long long availabilityStartMs;
+	std::chrono::duration<int, std::milli> minimumUpdatePeriod;
+	std::chrono::duration<int, std::milli> suggestedPresentationDelay;
 	Period period;
+	std::chrono::duration<int, std::milli> periodStart;
+	size_t numQualityLevels;
+
+private:
+	std::vector<uint32_t> bandwidths;
+	SegmentSizeIndex segmentSizes;
+
+	// a live presentation still going on has no duration yet, its templates no last segment
+	double presentationSeconds() const
+	{
+		return isDynamic() && mediaPresentationDuration.count() == 0 ? -1 : mediaPresentationDuration.count() / 1000.0;
+	}
 };
 }
\ No newline at end of file
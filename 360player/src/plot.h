@@ -60,6 +60,7 @@ typedef struct plot_params_struct{
 	LinkedList* ll                ;
 	float       scale_x           ;
 	float       scale_y           ;
+	float       min_x             ;
 	float       max_x             ;
 	float       max_y             ;
 
@@ -209,6 +210,13 @@ public:
 
 			int stroke_width = 2;
 
+			// the surfaces and textures of the previous draw
+			*surface_list = params->ll->clear_surface(*surface_list);
+			SDL_FreeSurface(plot->captionX);
+			SDL_FreeSurface(plot->captionY);
+			SDL_DestroyTexture(plot->textureX);
+			SDL_DestroyTexture(plot->textureY);
+
 			SDL_Color font_color = { 0, 0, 0 };
 			plot->captionX = TTF_RenderText_Blended(plot->font, params->caption_text_x.c_str(), font_color);
 			plot->captionY = TTF_RenderText_Blended(plot->font, params->caption_text_y.c_str(), font_color);
@@ -376,6 +384,7 @@ public:
 						caption_text.x = circle_x2 + DOT_RADIUS + CAPTION_OFFSET_CIRCLE_TO_TEXT;
 						caption_text.y = circle_y2 - caption_text.h / 2;
 						SDL_RenderCopy(plot->renderer, texture_text, NULL, &caption_text);
+						SDL_DestroyTexture(texture_text);
 
 						*surface_list = params->ll->push_back_surface(*surface_list, caption_text_surface);
 
@@ -413,7 +422,7 @@ public:
 	{
 		coordinate_item* tmp = params->ll->coordinate_list;
 
-		float scale_x_num = plot_width / (params->max_x / params->scale_x);
+		float scale_x_num = plot_width / ((params->max_x - params->min_x) / params->scale_x);
 		float scale_y_num = plot_heigth / (params->max_y / params->scale_y);
 
 		unsigned char isFirst = 1;
@@ -430,9 +439,9 @@ public:
 					tmp->bgcolor & 0x0000FF, 255);
 
 				SDL_Rect screen;
-				screen.x = plot_mask_position.x + 1 + (tmp->x / params->scale_x)*scale_x_num;
+				screen.x = plot_mask_position.x + 1 + ((tmp->x - params->min_x) / params->scale_x)*scale_x_num;
 				screen.y = plot_mask_position.y + GRADUATION_HEIGTH;
-				screen.w = plot_mask_position.x + 1 + (tmp->nxt->x / params->scale_x)*scale_x_num - screen.x;
+				screen.w = plot_mask_position.x + 1 + ((tmp->nxt->x - params->min_x) / params->scale_x)*scale_x_num - screen.x;
 				screen.h = plot_heigth - GRADUATION_HEIGTH * 2;
 
 				SDL_RenderFillRect(plot.renderer, &screen);
@@ -468,7 +477,7 @@ public:
 	{
 		coordinate_item* tmp = params->ll->coordinate_list;
 
-		float scale_x_num = plot_width / (params->max_x / params->scale_x);
+		float scale_x_num = plot_width / ((params->max_x - params->min_x) / params->scale_x);
 		float scale_y_num = plot_heigth / (params->max_y / params->scale_y);
 
 		unsigned char isFirst = 1;
@@ -480,7 +489,7 @@ public:
 		{
 			if (tmp->caption_id == caption_item->caption_id)
 			{
-				float circle_x1 = plot_mask_position.x + 1 + (tmp->x / params->scale_x)*scale_x_num;
+				float circle_x1 = plot_mask_position.x + 1 + ((tmp->x - params->min_x) / params->scale_x)*scale_x_num;
 				float circle_y1 = plot_mask_position.y + plot_heigth - (tmp->y / params->scale_y)*scale_y_num;
 
 				SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
@@ -522,7 +531,7 @@ public:
 		int plot_position_x,
 		int plot_position_y) {
 
-		int scale_x_num = plot_width / (params->max_x / params->scale_x);
+		int scale_x_num = plot_width / ((params->max_x - params->min_x) / params->scale_x);
 		int scale_y_num = plot_heigth / (params->max_y / params->scale_y);
 		
 		int init_pos_x = plot_mask_position.x + 1;
@@ -578,15 +587,15 @@ public:
 		int plot_position_x,
 		int plot_position_y) {
 
-		int scale_x_num = plot_width / (params->max_x / params->scale_x);
+		int scale_x_num = plot_width / ((params->max_x - params->min_x) / params->scale_x);
 		int scale_y_num = plot_heigth / (params->max_y / params->scale_y);
 
 		int init_pos_x = plot_mask_position.x + 1;
 		int init_pos_y = plot_mask_position.y + plot_heigth + 1;
 
-		int current_scale = 0;
+		int current_scale = params->min_x;
 
-		int point_number_x = (params->max_x / params->scale_x);
+		int point_number_x = ((params->max_x - params->min_x) / params->scale_x);
 
 		int i = 0;
 
@@ -608,6 +617,7 @@ public:
 			caption_text.x = init_pos_x - caption_text.w / 2;
 			caption_text.y = init_pos_y + 5;
 			SDL_RenderCopy(renderer, texture_text, NULL, &caption_text);
+			SDL_DestroyTexture(texture_text);
 
 			*surface_list = params->ll->push_back_surface(*surface_list, caption_text_surface);
 
@@ -636,6 +646,7 @@ public:
 			caption_text.x = init_pos_x - caption_text.w - 10;
 			caption_text.y = init_pos_y - caption_text.h / 2;
 			SDL_RenderCopy(renderer, texture_text, NULL, &caption_text);
+			SDL_DestroyTexture(texture_text);
 
 			*surface_list = params->ll->push_back_surface(*surface_list, caption_text_surface);
 
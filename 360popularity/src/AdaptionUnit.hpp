@@ -10,13 +10,15 @@ TU Darmstadt
 #include <deque>
 #include <numeric>
 #include <algorithm>
+#include <sstream>
+#include <string>
 
 #include "Quaternion.hpp"
 #include "mpd.h"
+#include "TileGrid.hpp"
+#include "ViewportSampler.hpp"
 
 #define TIME_NOW_EPOCH_MS std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count()
-#define SAMPLERES 8
-#define SAMPLEPOINTS (SAMPLERES+1)*(SAMPLERES+1)
 
 #define TIMER auto ttt = TIME_NOW_EPOCH_MS
 #define TIMEROUT(s) auto ttt2 = TIME_NOW_EPOCH_MS; std::cout << s << " TIMER: " << ttt2 - ttt << std::endl
@@ -36,47 +38,61 @@ class AdaptionUnit
 public:
 	struct NormalizedCoordinate { double x, y; };
 
-	AdaptionUnit(const DASH::MPD* mpd) : mpd(mpd)
+	// (sampleResolution + 1)^2 samples per viewport, results are cached for head rotations quantized to cacheStep
+	AdaptionUnit(const DASH::MPD* mpd, int sampleResolution = 8, bool solidAngleWeighting = false, double cacheStep = 0, size_t cacheSize = 4096)
+		: mpd(mpd)
 	{
-		auto srd = mpd->period.adaptationSets[0].srd;
+		tileGrid.build(mpd);
+		sampler.init(&tileGrid, sampleResolution, solidAngleWeighting, maxHDist, maxVDist, 1.0, cacheStep, cacheSize);
 
-		int frameWidth = srd.w * srd.th;
-		int frameHeight = srd.h * srd.tv;
-
-		for (int i = 0; i < mpd->period.adaptationSets.size(); i++)
-		{
-			srd = mpd->period.adaptationSets[i].srd;
-
-			double normalizedCoordX = (srd.x + srd.w) / (double)frameWidth;
-			double normalizedCoordY = (srd.y + srd.h) / (double)frameHeight;
-
-			normalizedCoordTileMapping[normalizedCoordX][normalizedCoordY] = i;
-		}
-
-		for (int i = 0; i <= SAMPLERES; i++)
-			for (int j = 0; j <= SAMPLERES; j++)
-				samplePoints[i * (SAMPLERES + 1) + j] = { i * (1.0 / SAMPLERES), j * (1.0 / SAMPLERES) };
+		std::ostringstream ss;
+		ss.precision(17);
+		ss << "sampler " << sampleResolution << " " << solidAngleWeighting << " " << maxHDist << " " << maxVDist << " " << cacheStep;
+		model = ss.str();
 	}
 
 	std::map<int, int> computeTileVisibility(const Quaternion& headRotation) const
 	{
 		std::map<int, int> tileVisibilityMap;
 
-		for (int j = 0; j < SAMPLEPOINTS; j++)
-			tileVisibilityMap[mapCoordToTile(fromViewportCoordToEquirectCoord(headRotation, samplePoints[j]))]++;
+		addVisibleSamples(headRotation, tileVisibilityMap);
 
 		return tileVisibilityMap;
 	}
 
+	// what computeTileVisibility depends on besides the tiling, part of the key of saved visibility matrices
+	const std::string& visibilityModel() const
+	{
+		return model;
+	}
+
+	// the tiling and the viewport samples computeTileVisibility counts with
+	const TileGrid& grid() const
+	{
+		return tileGrid;
+	}
+
+	const ViewportSampler& viewportSampler() const
+	{
+		return sampler;
+	}
+
 private:
 	const DASH::MPD* mpd;
-	std::map<double, std::map<double, int>> normalizedCoordTileMapping;
+	std::string model;
+	TileGrid tileGrid;
+	ViewportSampler sampler;
 	std::map<int, int> tileQuality;
-	NormalizedCoordinate samplePoints[SAMPLEPOINTS];
+
+	// weighted count of the viewport sample points falling into each tile [thread safe]
+	void addVisibleSamples(const Quaternion& headRotation, std::map<int, int>& tileVisibilityMap) const
+	{
+		sampler.addVisibleSamples(headRotation, tileVisibilityMap);
+	}
 
 	int mapCoordToTile(NormalizedCoordinate coord) const
 	{
-		return normalizedCoordTileMapping.lower_bound(coord.x)->second.lower_bound(coord.y)->second;
+		return tileGrid.tileAt(coord.x, coord.y);
 	}
 
 	static NormalizedCoordinate fromViewportCoordToEquirectCoord(const Quaternion& headRotation, const NormalizedCoordinate& viewportCoord)
@@ -1,55 +1,162 @@
 /*
 	Author: Arne-Tobias Rak
 	TU Darmstadt
+
+	Head rotations of a trace by timestamp. A trace is taken from the
+	corpus next to its text file (see TraceCorpus.hpp) when one holds
+	it, otherwise the text file is parsed. Many timestamps are looked
+	up in one pass and interpolated together with QuaternionBatch.
 */
 #pragma once
 
 #include "Quaternion.hpp"
-#include <sstream>
-#include <fstream>
-#include <map>
+#include "QuaternionBatch.hpp"
+#include "TraceCorpus.hpp"
+#include <vector>
+#include <iterator>
+#include <algorithm>
+#ifdef _WIN32
+#include <experimental/filesystem>
+#endif
 #define M_PI           3.14159265358979323846  /* pi */
 using namespace IMT;
 
 class HeadTrace
 {
 public:
+	// walks the samples like the iterator of a map from timestamp to rotation
+	class const_iterator
+	{
+	public:
+		typedef std::bidirectional_iterator_tag iterator_category;
+		typedef std::pair<double, Quaternion> value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef const value_type* pointer;
+		typedef const value_type& reference;
+
+		const_iterator(const HeadTrace* trace, size_t i) : trace(trace), i(i) {}
+
+		reference operator*() const { current = { trace->trace.t[i], trace->rotation(i) }; return current; }
+		pointer operator->() const { return &**this; }
+		const_iterator& operator++() { i++; return *this; }
+		const_iterator operator++(int) { auto it = *this; i++; return it; }
+		const_iterator& operator--() { i--; return *this; }
+		const_iterator operator--(int) { auto it = *this; i--; return it; }
+		bool operator==(const const_iterator& other) const { return i == other.i; }
+		bool operator!=(const const_iterator& other) const { return i != other.i; }
+
+	private:
+		const HeadTrace* trace;
+		size_t i;
+		mutable value_type current;
+	};
+
 #ifdef _WIN32
-	HeadTrace(const wchar_t* path)
+	HeadTrace(const wchar_t* path) : trace(TraceCorpus::find(std::experimental::filesystem::path(path).string()))
 #else
-	HeadTrace(const char* path)
+	HeadTrace(const char* path) : trace(TraceCorpus::find(path))
 #endif
 	{
-		std::ifstream file(path);
+		if (trace.count == 0)
+			own(TraceCorpus::parseText(path));
+	}
+
+	// a trace of a corpus by its name in it, like "Diving/trace1.txt"
+	HeadTrace(const std::shared_ptr<const TraceCorpus>& corpus, const std::string& name) : trace(TraceCorpus::trace(corpus, name))
+	{
+	}
 
-		if (file)
-		{
-			std::stringstream ss;
-			ss << file.rdbuf();
-			file.close();
+	// rotation of the first sample at or after timestamp, the last one after the end of the trace;
+	// interpolated between the samples around timestamp by slerp if interpolate is set
+	Quaternion rotationForTimestamp(double timestamp, bool interpolate = false) const
+	{
+		return rotationAt(index(timestamp), timestamp, interpolate);
+	}
 
-			std::string line;
-			while (!std::getline(ss, line).eof())
+	// rotations for ascending timestamps, found in a single pass over the samples;
+	// the ones between two samples are slerped all at once with QuaternionBatch if interpolate is set
+	std::vector<Quaternion> rotationsForTimestamps(const std::vector<double>& timestamps, bool interpolate = false) const
+	{
+		std::vector<Quaternion> rotations;
+		rotations.reserve(timestamps.size());
+		// position in rotations and the sample after it of every rotation to interpolate, with its weight
+		std::vector<std::pair<size_t, size_t>> between;
+		std::vector<float> k;
+		size_t i = 0;
+		for (double timestamp : timestamps)
+		{
+			while (i + 1 < trace.count && trace.t[i] < timestamp)
+				i++;
+			if (interpolate && i > 0 && trace.t[i] > timestamp)
 			{
-				double timestamp, w, x, y, z;
-				ss >> timestamp >> w >> w >> x >> y >> z;
-				Quaternion a(w, x, y, z);
-				Quaternion rot = Quaternion::QuaternionFromAngleAxis(-0.5*M_PI, VectorCartesian(0, 0, 1));
-				a = rot.Inv() * a;
-				rotations[timestamp] = Quaternion(a.GetW(), -a.GetV().GetX(), -a.GetV().GetY(), a.GetV().GetZ());
+				between.push_back({ rotations.size(), i });
+				k.push_back(float((timestamp - trace.t[i - 1]) / (trace.t[i] - trace.t[i - 1])));
 			}
+			rotations.push_back(rotation(i));
+		}
+		if (between.empty())
+			return rotations;
+
+		QuaternionBatch::Quaternions before(between.size()), after(between.size()), slerped;
+		for (size_t j = 0; j < between.size(); j++)
+		{
+			before.set(j, rotation(between[j].second - 1));
+			after.set(j, rotations[between[j].first]);
 		}
+		QuaternionBatch::slerp(before, after, k.data(), slerped);
+		for (size_t j = 0; j < between.size(); j++)
+			rotations[between[j].first] = slerped.get(j);
+		return rotations;
+	}
+
+	// all samples at once, their timestamps ascending and their rotations as rotationForTimestamp returns them
+	void samples(std::vector<double>& timestamps, QuaternionBatch::Quaternions& rotations) const
+	{
+		timestamps.assign(trace.t, trace.t + trace.count);
+		rotations.resize(trace.count);
+		for (size_t i = 0; i < trace.count; i++)
+			rotations.set(i, rotation(i));
 	}
 
-	auto rotationForTimestamp(double timestamp)
+	const_iterator rotationForTimestampIt(double timestamp) const
 	{
-		return rotations.lower_bound(timestamp)->second;
+		return const_iterator(this, index(timestamp));
 	}
 
-	auto rotationForTimestampIt(double timestamp)
+	size_t size() const
 	{
-		return rotations.lower_bound(timestamp);
+		return trace.count;
 	}
+
 private:
-	std::map<double, Quaternion> rotations;
+	TraceCorpus::Trace trace;
+
+	void own(TraceCorpus::Samples samples)
+	{
+		auto owned = std::make_shared<TraceCorpus::Samples>(std::move(samples));
+		trace = { owned, owned->t.data(), owned->w.data(), owned->x.data(), owned->y.data(), owned->z.data(), owned->t.size() };
+	}
+
+	size_t index(double timestamp) const
+	{
+		size_t i = std::lower_bound(trace.t, trace.t + trace.count, timestamp) - trace.t;
+		return trace.count > 0 && i == trace.count ? i - 1 : i;
+	}
+
+	// sample i is the first at or after timestamp or the last one
+	Quaternion rotationAt(size_t i, double timestamp, bool interpolate) const
+	{
+		if (!interpolate || i == 0 || trace.t[i] <= timestamp)
+			return rotation(i);
+		double k = (timestamp - trace.t[i - 1]) / (trace.t[i] - trace.t[i - 1]);
+		return Quaternion::SLERP(rotation(i - 1), rotation(i), k);
+	}
+
+	// traces are recorded in another frame than the player's: turned about z and mirrored in x and y
+	Quaternion rotation(size_t i) const
+	{
+		static const Quaternion rot = Quaternion::QuaternionFromAngleAxis(-0.5*M_PI, VectorCartesian(0, 0, 1));
+		Quaternion a = rot.Inv() * Quaternion(trace.w[i], trace.x[i], trace.y[i], trace.z[i]);
+		return Quaternion(a.GetW(), -a.GetV().GetX(), -a.GetV().GetY(), a.GetV().GetZ());
+	}
 };
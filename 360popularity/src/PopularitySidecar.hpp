@@ -0,0 +1,65 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Binary sidecar of the <Popularity> element of an MPD, written by
+	360popularity next to the MPD as "<mpd>.pop". It holds the same
+	tile qualities as a segments x tiles table of bytes, so a player
+	reads them with one copy instead of parsing an attribute string
+	per segment.
+
+	Layout, host byte order:
+		magic "TILEPOP1", segment count (uint32), tile count (uint32)
+		segment count x tile count quality bytes, none for segments without popularity
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+class PopularitySidecar
+{
+public:
+	enum : uint8_t { none = 255 };
+
+	uint32_t segments = 0;
+	uint32_t tiles = 0;
+	// quality of tile t in segment s at s * tiles + t
+	std::vector<uint8_t> quality;
+
+	// false if data is no sidecar or is cut short
+	bool read(const std::string& data)
+	{
+		const size_t header = 16;
+		if (data.size() < header || memcmp(data.data(), magic(), 8) != 0)
+			return false;
+		uint32_t s, t;
+		memcpy(&s, data.data() + 8, 4);
+		memcpy(&t, data.data() + 12, 4);
+		if ((data.size() - header) / std::max<uint32_t>(t, 1) < s)
+			return false;
+		segments = s;
+		tiles = t;
+		quality.assign(data.begin() + header, data.begin() + header + (size_t)s * t);
+		return true;
+	}
+
+	std::string write() const
+	{
+		std::string data(magic(), 8);
+		data.append(reinterpret_cast<const char*>(&segments), 4);
+		data.append(reinterpret_cast<const char*>(&tiles), 4);
+		data.append(reinterpret_cast<const char*>(quality.data()), quality.size());
+		return data;
+	}
+
+private:
+	static const char* magic()
+	{
+		return "TILEPOP1";
+	}
+};
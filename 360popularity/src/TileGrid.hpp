@@ -0,0 +1,118 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Maps normalized equirectangular coordinates to tiles.
+	The SRDs are compiled once into a flat grid of cells; uniform
+	tilings are indexed arithmetically, irregular ones by a binary
+	search over the cell edges.
+*/
+
+#pragma once
+
+#include <map>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include "mpd.h"
+
+class TileGrid
+{
+public:
+	TileGrid() : columns(0), rows(0), uniform(false) {}
+
+	void build(const DASH::MPD* mpd)
+	{
+		auto srd = mpd->period.adaptationSets[0].srd;
+
+		int frameWidth = srd.w * srd.th;
+		int frameHeight = srd.h * srd.tv;
+
+		// tiles keyed by the normalized lower right corner of their SRD
+		std::map<double, std::map<double, int>> mapping;
+		std::vector<double> allRowEdges;
+		for (int i = 0; i < mpd->period.adaptationSets.size(); i++)
+		{
+			srd = mpd->period.adaptationSets[i].srd;
+
+			double normalizedCoordX = (srd.x + srd.w) / (double)frameWidth;
+			double normalizedCoordY = (srd.y + srd.h) / (double)frameHeight;
+
+			mapping[normalizedCoordX][normalizedCoordY] = i;
+			allRowEdges.push_back(normalizedCoordY);
+		}
+
+		columnEdges.clear();
+		for (auto& column : mapping)
+			columnEdges.push_back(column.first);
+		std::sort(allRowEdges.begin(), allRowEdges.end());
+		allRowEdges.erase(std::unique(allRowEdges.begin(), allRowEdges.end()), allRowEdges.end());
+		rowEdges = allRowEdges;
+
+		columns = columnEdges.size();
+		rows = rowEdges.size();
+
+		// a cell is resolved at its lower right edge, which is a key of the mapping, so every point inside it maps alike
+		cells.assign(columns * rows, 0);
+		for (size_t c = 0; c < columns; c++)
+		{
+			const auto& column = mapping.at(columnEdges[c]);
+			for (size_t r = 0; r < rows; r++)
+			{
+				auto it = column.lower_bound(rowEdges[r]);
+				if (it == column.end())
+					--it;
+				cells[c * rows + r] = it->second;
+			}
+		}
+
+		uniform = isUniform(columnEdges) && isUniform(rowEdges);
+	}
+
+	int tileAt(double x, double y) const
+	{
+		return cells[cellIndex(x, columnEdges) * rows + cellIndex(y, rowEdges)];
+	}
+
+	// the lower right edges of the columns and rows and the tile of every cell, column by column, for lookups elsewhere than tileAt
+	const std::vector<double>& columnEdgeList() const { return columnEdges; }
+	const std::vector<double>& rowEdgeList() const { return rowEdges; }
+	const std::vector<int>& cellTiles() const { return cells; }
+
+private:
+	std::vector<double> columnEdges;
+	std::vector<double> rowEdges;
+	std::vector<int> cells;
+	size_t columns;
+	size_t rows;
+	bool uniform;
+
+	// edges at k / n
+	static bool isUniform(const std::vector<double>& edges)
+	{
+		for (size_t k = 0; k < edges.size(); k++)
+			if (std::abs(edges[k] - (k + 1) / (double)edges.size()) > 1e-9)
+				return false;
+		return true;
+	}
+
+	// first cell whose upper edge is not below v, points beyond the last edge fall into the last cell
+	size_t cellIndex(double v, const std::vector<double>& edges) const
+	{
+		size_t n = edges.size();
+		if (uniform)
+		{
+			double estimate = std::ceil(v * n) - 1;
+			size_t cell = estimate <= 0 ? 0 : std::min(n - 1, size_t(estimate));
+			// the edges are rounded, correct the estimate for points right on an edge
+			if (cell > 0 && v <= edges[cell - 1])
+				cell--;
+			else if (cell + 1 < n && v > edges[cell])
+				cell++;
+			return cell;
+		}
+		auto it = std::lower_bound(edges.begin(), edges.end(), v);
+		return it == edges.end() ? n - 1 : size_t(it - edges.begin());
+	}
+};
@@ -0,0 +1,271 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Binary corpus of head traces. The converter (eval/src/trace_corpus)
+	writes all text traces below a folder into one file, traces.htc, in
+	that folder. Each trace is stored as a sorted structure of arrays,
+	timestamps followed by the w, x, y and z components of its
+	rotations, so a mapped corpus is used in place without parsing.
+
+	Layout, host byte order:
+		Header	magic "HTCORP1", version, trace count
+		Entry	per trace: offset and length of its name, offset of its data, sample count
+		names	path of each trace relative to the corpus folder, '/' separated
+		data	per trace, 8 byte aligned: count doubles each of t, w, x, y, z
+*/
+
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <unordered_map>
+#include <sys/stat.h>
+#include "MappedFile.hpp"
+
+class TraceCorpus
+{
+public:
+	static constexpr const char* fileName = "traces.htc";
+
+	// samples of one trace as structure of arrays, sorted by timestamp
+	struct Samples
+	{
+		std::vector<double> t, w, x, y, z;
+	};
+
+	// view of one trace, valid as long as corpus is held
+	struct Trace
+	{
+		std::shared_ptr<const void> owner;
+		const double* t;
+		const double* w;
+		const double* x;
+		const double* y;
+		const double* z;
+		size_t count;
+	};
+
+	// parses a text trace, lines of "timestamp frame w x y z"; duplicate timestamps keep the last sample
+	template<class Char>
+	static Samples parseText(const Char* path)
+	{
+		Samples samples;
+		std::ifstream file(path, std::ios::binary);
+		if (!file)
+			return samples;
+		std::stringstream ss;
+		ss << file.rdbuf();
+		std::string text = ss.str();
+
+		struct Line { double t, w, x, y, z; };
+		std::vector<Line> lines;
+		// the first line is skipped, as the loader always did, so earlier results stay reproducible
+		const char* p = strchr(text.c_str(), '\n');
+		while (p)
+		{
+			double v[6];
+			char* end = const_cast<char*>(p);
+			int n = 0;
+			for (; n < 6; n++)
+			{
+				v[n] = strtod(end, &end);
+				if (end == p)
+					break;
+				p = end;
+			}
+			if (n < 6)
+				break;
+			lines.push_back({ v[0], v[2], v[3], v[4], v[5] });
+			p = strchr(p, '\n');
+		}
+
+		std::stable_sort(lines.begin(), lines.end(), [](const Line& a, const Line& b) { return a.t < b.t; });
+		for (size_t i = 0; i < lines.size(); i++)
+		{
+			if (i + 1 < lines.size() && lines[i + 1].t == lines[i].t)
+				continue;
+			samples.t.push_back(lines[i].t);
+			samples.w.push_back(lines[i].w);
+			samples.x.push_back(lines[i].x);
+			samples.y.push_back(lines[i].y);
+			samples.z.push_back(lines[i].z);
+		}
+		return samples;
+	}
+
+	// maps a corpus file, nullptr if it is missing or not a corpus
+	static std::shared_ptr<const TraceCorpus> open(const std::string& path)
+	{
+		std::shared_ptr<TraceCorpus> corpus(new TraceCorpus());
+		corpus->file = MappedFile::open(path);
+		if (!corpus->file)
+			return nullptr;
+		corpus->data = corpus->file->data();
+		corpus->size = corpus->file->size();
+
+		auto header = reinterpret_cast<const Header*>(corpus->data);
+		if (corpus->size < sizeof(Header) || memcmp(header->magic, magic(), sizeof(header->magic)) != 0 || header->version != version
+			|| corpus->size < sizeof(Header) + header->traceCount * sizeof(Entry))
+			return nullptr;
+
+		auto entries = reinterpret_cast<const Entry*>(corpus->data + sizeof(Header));
+		for (uint32_t i = 0; i < header->traceCount; i++)
+		{
+			auto& e = entries[i];
+			if (e.nameOffset + e.nameLength > corpus->size || e.dataOffset + 5 * e.count * sizeof(double) > corpus->size)
+				return nullptr;
+			corpus->entries[std::string(corpus->data + e.nameOffset, e.nameLength)] = &e;
+		}
+		return corpus;
+	}
+
+	// writes traces by their name into a corpus file
+	static bool write(const std::string& path, const std::map<std::string, Samples>& traces)
+	{
+		std::vector<Entry> entries;
+		std::string names;
+		for (auto& trace : traces)
+		{
+			entries.push_back({ names.size(), (uint32_t)trace.first.size(), 0, 0, trace.second.t.size() });
+			names += trace.first;
+		}
+
+		uint64_t offset = sizeof(Header) + entries.size() * sizeof(Entry);
+		for (auto& e : entries)
+			e.nameOffset += offset;
+		offset = align(offset + names.size());
+		for (auto& e : entries)
+		{
+			e.dataOffset = offset;
+			offset += 5 * e.count * sizeof(double);
+		}
+
+		std::ofstream file(path, std::ios::binary);
+		if (!file)
+			return false;
+		Header header;
+		memcpy(header.magic, magic(), sizeof(header.magic));
+		header.version = version;
+		header.traceCount = (uint32_t)entries.size();
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(Entry));
+		file.write(names.data(), names.size());
+		file.write("\0\0\0\0\0\0\0", align(file.tellp()) - (uint64_t)file.tellp());
+		for (auto& trace : traces)
+			for (auto column : { &trace.second.t, &trace.second.w, &trace.second.x, &trace.second.y, &trace.second.z })
+				file.write(reinterpret_cast<const char*>(column->data()), column->size() * sizeof(double));
+		return (bool)file;
+	}
+
+	// trace of the corpus by name, count 0 if it has none
+	static Trace trace(const std::shared_ptr<const TraceCorpus>& corpus, const std::string& name)
+	{
+		Trace trace = { nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0 };
+		auto it = corpus->entries.find(name);
+		if (it == corpus->entries.end())
+			return trace;
+		auto columns = reinterpret_cast<const double*>(corpus->data + it->second->dataOffset);
+		size_t n = it->second->count;
+		return { corpus, columns, columns + n, columns + 2 * n, columns + 3 * n, columns + 4 * n, n };
+	}
+
+	// the trace of a text file from the corpus in its folder or the folder above, count 0 if neither has it
+	// or the text file was changed after the corpus was written
+	static Trace find(std::string path)
+	{
+		std::replace(path.begin(), path.end(), '\\', '/');
+		std::vector<std::string> folders;
+		size_t slash = path.rfind('/');
+		folders.push_back(slash == std::string::npos ? "" : path.substr(0, slash + 1));
+		if (slash != std::string::npos && slash > 0)
+		{
+			size_t up = path.rfind('/', slash - 1);
+			folders.push_back(up == std::string::npos ? "" : path.substr(0, up + 1));
+		}
+
+		Trace none = { nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0 };
+		for (auto& folder : folders)
+		{
+			auto corpus = cached(folder + fileName);
+			if (!corpus)
+				continue;
+			auto t = trace(corpus, path.substr(folder.size()));
+			if (t.count == 0)
+				continue;
+			struct stat textStat, corpusStat;
+			if (stat(path.c_str(), &textStat) == 0 && (stat((folder + fileName).c_str(), &corpusStat) != 0 || textStat.st_mtime > corpusStat.st_mtime))
+				return none;
+			return t;
+		}
+		return none;
+	}
+
+	std::vector<std::string> names() const
+	{
+		std::vector<std::string> names;
+		for (auto& e : entries)
+			names.push_back(e.first);
+		std::sort(names.begin(), names.end());
+		return names;
+	}
+
+private:
+	static constexpr uint32_t version = 1;
+
+	struct Header
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t traceCount;
+	};
+
+	struct Entry
+	{
+		uint64_t nameOffset;
+		uint32_t nameLength;
+		uint32_t reserved;
+		uint64_t dataOffset;
+		uint64_t count;
+	};
+
+	std::shared_ptr<const MappedFile> file;
+	const char* data;
+	size_t size;
+	std::unordered_map<std::string, const Entry*> entries;
+
+	TraceCorpus() : data(nullptr), size(0)
+	{
+	}
+
+	static const char* magic()
+	{
+		return "HTCORP1";
+	}
+
+	static uint64_t align(uint64_t offset)
+	{
+		return (offset + 7) & ~(uint64_t)7;
+	}
+
+	// every corpus is mapped once per process, a missing one is remembered as well
+	static std::shared_ptr<const TraceCorpus> cached(const std::string& path)
+	{
+		static std::mutex mtx;
+		static std::map<std::string, std::shared_ptr<const TraceCorpus>> corpora;
+		std::lock_guard<std::mutex> l(mtx);
+		auto it = corpora.find(path);
+		if (it == corpora.end())
+			it = corpora.emplace(path, open(path)).first;
+		return it->second;
+	}
+};
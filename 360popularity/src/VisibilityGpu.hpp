@@ -0,0 +1,372 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Visible samples per segment and tile of many traces at once on the
+	GPU, in an OpenGL 4.3 compute shader on a headless EGL context.
+	One invocation projects one sample of one rotation with the
+	arithmetic of ViewportProjector (rotation matrix from the CPU, the
+	same atan2 polynomial) and adds its weight to the count of the
+	segment and tile it falls into; the tile is looked up on the edges
+	of the TileGrid rounded down to float, which compares like the
+	double edges. Counts agree with ViewportSampler::addVisibleSamples
+	up to samples within float rounding of a tile edge.
+	Only built with -DVISIBILITY_GPU (link -lEGL -lGL), otherwise
+	create returns nullptr and the CPU counts.
+*/
+
+#pragma once
+
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <iostream>
+#include <algorithm>
+
+#include "Quaternion.hpp"
+#include "QuaternionBatch.hpp"
+#include "TileGrid.hpp"
+#include "ViewportSampler.hpp"
+
+#ifdef VISIBILITY_GPU
+#define GL_GLEXT_PROTOTYPES
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GL/gl.h>
+#include <GL/glext.h>
+#endif
+
+class VisibilityGpu
+{
+public:
+	// a context with compute shaders for sampler on grid, nullptr without one. The context is current on the calling thread,
+	// count has to be called from it
+	static std::unique_ptr<VisibilityGpu> create(const TileGrid& grid, const ViewportSampler& sampler, size_t tiles)
+	{
+#ifdef VISIBILITY_GPU
+		std::unique_ptr<VisibilityGpu> gpu(new VisibilityGpu(sampler, tiles));
+		if (!gpu->init(grid))
+			return nullptr;
+		return gpu;
+#else
+		return nullptr;
+#endif
+	}
+
+	~VisibilityGpu()
+	{
+#ifdef VISIBILITY_GPU
+		if (program)
+		{
+			glDeleteBuffers(buffers, buffer);
+			glDeleteProgram(program);
+		}
+		if (display != EGL_NO_DISPLAY)
+		{
+			eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+			if (context != EGL_NO_CONTEXT)
+				eglDestroyContext(display, context);
+			eglTerminate(display);
+		}
+#endif
+	}
+
+	VisibilityGpu(const VisibilityGpu&) = delete;
+	VisibilityGpu& operator=(const VisibilityGpu&) = delete;
+
+	const std::string& renderer() const
+	{
+		return name;
+	}
+
+	// the segments x tiles counts of every trace's rotations, sample k belongs to segment s if segmentSamples[s] <= k < segmentSamples[s + 1]
+	std::vector<std::vector<int32_t>> count(const std::vector<const std::vector<IMT::Quaternion>*>& traces, const std::vector<size_t>& segmentSamples)
+	{
+		size_t segments = segmentSamples.empty() ? 0 : segmentSamples.size() - 1;
+		std::vector<std::vector<int32_t>> counts(traces.size(), std::vector<int32_t>(segments * tiles, 0));
+#ifdef VISIBILITY_GPU
+		// traces go to the GPU in batches whose counts fit the buffer
+		size_t perTrace = std::max<size_t>(1, segments * tiles);
+		size_t batch = std::max<size_t>(1, maxCounts / perTrace);
+		for (size_t first = 0; first < traces.size(); first += batch)
+		{
+			size_t last = std::min(traces.size(), first + batch);
+			std::vector<Pose> poses;
+			for (size_t i = first; i < last; i++)
+				for (size_t s = 0; s < segments; s++)
+					for (size_t k = segmentSamples[s]; k < segmentSamples[s + 1] && k < traces[i]->size(); k++)
+						poses.push_back(pose(sampler.sampledRotation((*traces[i])[k]), (i - first) * perTrace + s * tiles));
+			if (poses.empty())
+				continue;
+
+			std::vector<int32_t> result((last - first) * perTrace, 0);
+			run(poses, result);
+			for (size_t i = first; i < last; i++)
+				std::copy(result.begin() + (i - first) * perTrace, result.begin() + (i - first) * perTrace + segments * tiles, counts[i].begin());
+		}
+#endif
+		return counts;
+	}
+
+private:
+	// a view direction and the weight of the sample
+	struct Sample
+	{
+		float x, y, z;
+		int32_t weight;
+	};
+
+	// a rotation to project and the offset of its segment's counts
+	struct Pose
+	{
+		float m[9];
+		int32_t offset;
+	};
+
+	static const size_t localSize = 64;
+	// counts of one dispatch batch, 64 MB
+	static const size_t maxCounts = 16 << 20;
+	// poses of one dispatch, below the minimum work group count of 65535
+	static const size_t maxPoses = 65535;
+
+	const ViewportSampler& sampler;
+	size_t tiles;
+	size_t samples;
+	std::string name;
+
+	static Pose pose(const IMT::Quaternion& rotation, size_t offset)
+	{
+		QuaternionBatch::Rotation r(rotation);
+		Pose p;
+		std::copy(r.m, r.m + 9, p.m);
+		p.offset = (int32_t)offset;
+		return p;
+	}
+
+	// the largest float not above v, a float value compares to it like to v
+	static float floatBelow(double v)
+	{
+		float f = (float)v;
+		return f > v ? std::nextafter(f, -INFINITY) : f;
+	}
+
+#ifdef VISIBILITY_GPU
+	enum { SampleBuffer, PoseBuffer, ColumnBuffer, RowBuffer, CellBuffer, CountBuffer, buffers };
+
+	EGLDisplay display = EGL_NO_DISPLAY;
+	EGLContext context = EGL_NO_CONTEXT;
+	GLuint program = 0;
+	GLuint buffer[buffers] = {};
+	GLint poseBaseUniform = -1, poseCountUniform = -1;
+
+	VisibilityGpu(const ViewportSampler& sampler, size_t tiles) : sampler(sampler), tiles(tiles), samples(sampler.size()) {}
+
+	bool init(const TileGrid& grid)
+	{
+		// a device without window system, Mesa's surfaceless platform where there is one
+		auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+		if (getPlatformDisplay)
+			display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+		if (display == EGL_NO_DISPLAY)
+			display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+		if (display == EGL_NO_DISPLAY || !eglInitialize(display, nullptr, nullptr))
+		{
+			display = EGL_NO_DISPLAY;
+			return false;
+		}
+		if (!eglBindAPI(EGL_OPENGL_API))
+			return false;
+
+		// nothing is drawn, a display without configs takes a context without one
+		const EGLint configAttributes[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+		EGLConfig config;
+		EGLint numConfigs = 0;
+		if (!eglChooseConfig(display, configAttributes, &config, 1, &numConfigs) || numConfigs == 0)
+			config = EGL_NO_CONFIG_KHR;
+		const EGLint contextAttributes[] = { EGL_CONTEXT_MAJOR_VERSION, 4, EGL_CONTEXT_MINOR_VERSION, 3,
+			EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT, EGL_NONE };
+		context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+		if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+			return false;
+		name = (const char*)glGetString(GL_RENDERER);
+
+		if (!compile(grid))
+			return false;
+
+		glGenBuffers(buffers, buffer);
+
+		// the samples and the grid never change
+		std::vector<Sample> sampleData;
+		auto& points = sampler.samplePoints();
+		for (size_t i = 0; i < samples; i++)
+			sampleData.push_back({ points.directionX()[i], points.directionY()[i], points.directionZ()[i], sampler.sampleWeights()[i] });
+		upload(SampleBuffer, sampleData.data(), sampleData.size() * sizeof(Sample));
+
+		std::vector<float> columns, rows;
+		for (double e : grid.columnEdgeList())
+			columns.push_back(floatBelow(e));
+		for (double e : grid.rowEdgeList())
+			rows.push_back(floatBelow(e));
+		upload(ColumnBuffer, columns.data(), columns.size() * sizeof(float));
+		upload(RowBuffer, rows.data(), rows.size() * sizeof(float));
+		upload(CellBuffer, grid.cellTiles().data(), grid.cellTiles().size() * sizeof(int));
+		return glGetError() == GL_NO_ERROR;
+	}
+
+	bool compile(const TileGrid& grid)
+	{
+		std::string source = std::string("#version 430\n")
+			+ "#define LOCAL_SIZE " + std::to_string(localSize) + "\n"
+			+ "#define SAMPLES " + std::to_string(samples) + "u\n"
+			+ "#define COLUMNS " + std::to_string(grid.columnEdgeList().size()) + "\n"
+			+ "#define ROWS " + std::to_string(grid.rowEdgeList().size()) + "\n"
+			+ "#define TILES " + std::to_string(tiles) + "\n"
+			+ shader;
+		const char* text = source.c_str();
+		GLuint shaderId = glCreateShader(GL_COMPUTE_SHADER);
+		glShaderSource(shaderId, 1, &text, nullptr);
+		glCompileShader(shaderId);
+		GLint ok = 0;
+		glGetShaderiv(shaderId, GL_COMPILE_STATUS, &ok);
+		if (!ok)
+		{
+			char log[4096];
+			glGetShaderInfoLog(shaderId, sizeof(log), nullptr, log);
+			std::cout << "Visibility shader compilation failed: " << log << std::endl;
+			glDeleteShader(shaderId);
+			return false;
+		}
+
+		program = glCreateProgram();
+		glAttachShader(program, shaderId);
+		glLinkProgram(program);
+		glDeleteShader(shaderId);
+		glGetProgramiv(program, GL_LINK_STATUS, &ok);
+		if (!ok)
+		{
+			std::cout << "Visibility shader link failed" << std::endl;
+			return false;
+		}
+		poseBaseUniform = glGetUniformLocation(program, "poseBase");
+		poseCountUniform = glGetUniformLocation(program, "poseCount");
+		return true;
+	}
+
+	void upload(int index, const void* data, size_t size)
+	{
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer[index]);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, std::max<size_t>(size, 4), data, GL_STATIC_DRAW);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, index, buffer[index]);
+	}
+
+	// counts all poses into result, which holds the zeroed counts their offsets point into
+	void run(const std::vector<Pose>& poses, std::vector<int32_t>& result)
+	{
+		upload(PoseBuffer, poses.data(), poses.size() * sizeof(Pose));
+		upload(CountBuffer, result.data(), result.size() * sizeof(int32_t));
+
+		glUseProgram(program);
+		glUniform1ui(poseCountUniform, (GLuint)poses.size());
+		GLuint groups = GLuint((samples + localSize - 1) / localSize);
+		for (size_t base = 0; base < poses.size(); base += maxPoses)
+		{
+			glUniform1ui(poseBaseUniform, (GLuint)base);
+			glDispatchCompute(groups, (GLuint)std::min(size_t(maxPoses), poses.size() - base), 1);
+		}
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer[CountBuffer]);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, result.size() * sizeof(int32_t), result.data());
+	}
+
+	// the projection of ViewportProjector::project, precise keeps the compiler from fusing what the scalar path does not
+	static constexpr const char* shader = R"(
+layout(local_size_x = LOCAL_SIZE) in;
+
+struct Sample { float x, y, z; int weight; };
+struct Pose { float m[9]; int offset; };
+
+layout(std430, binding = 0) readonly buffer Samples { Sample samples[]; };
+layout(std430, binding = 1) readonly buffer Poses { Pose poses[]; };
+layout(std430, binding = 2) readonly buffer Columns { float columnEdges[]; };
+layout(std430, binding = 3) readonly buffer Rows { float rowEdges[]; };
+layout(std430, binding = 4) readonly buffer Cells { int cells[]; };
+layout(std430, binding = 5) buffer Counts { int counts[]; };
+
+uniform uint poseBase;
+uniform uint poseCount;
+
+const float pi = 3.14159265;
+const float halfPi = 1.57079633;
+const float invPi = 0.318309886;
+const float invTwoPi = 0.159154943;
+
+float fastAtan2(float y, float x)
+{
+	precise float ax = abs(x), ay = abs(y);
+	precise float mx = max(ax, ay), mn = min(ax, ay);
+	precise float a = mx > 0.0 ? mn / mx : 0.0;
+	precise float s = a * a;
+	precise float r = ((((0.0208351 * s - 0.085133) * s + 0.180141) * s - 0.3302995) * s + 0.999866) * a;
+	r = ay > ax ? halfPi - r : r;
+	r = x < 0.0 ? pi - r : r;
+	return y < 0.0 ? -r : r;
+}
+
+// first edge not below v, points beyond the last edge fall into the last cell
+int columnIndex(float v)
+{
+	int lo = 0, hi = COLUMNS;
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (columnEdges[mid] < v)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return min(lo, COLUMNS - 1);
+}
+
+int rowIndex(float v)
+{
+	int lo = 0, hi = ROWS;
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (rowEdges[mid] < v)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return min(lo, ROWS - 1);
+}
+
+void main()
+{
+	uint i = gl_GlobalInvocationID.x;
+	uint p = poseBase + gl_GlobalInvocationID.y;
+	if (i >= SAMPLES || p >= poseCount)
+		return;
+
+	Sample d = samples[i];
+	Pose r = poses[p];
+	precise float ox = r.m[0] * d.x + r.m[1] * d.y + r.m[2] * d.z;
+	precise float oy = r.m[3] * d.x + r.m[4] * d.y + r.m[5] * d.z;
+	precise float oz = r.m[6] * d.x + r.m[7] * d.y + r.m[8] * d.z;
+
+	precise float t = 0.75 + fastAtan2(oy, ox) * invTwoPi;
+	t = t >= 1.0 ? t - 1.0 : t;
+	precise float x = 1.0 - t;
+	precise float sinPhi = sqrt(max(0.0, 1.0 - oz * oz));
+	precise float y = fastAtan2(sinPhi, oz) * invPi;
+
+	int tile = cells[columnIndex(x) * ROWS + rowIndex(y)];
+	if (tile >= 0 && tile < TILES)
+		atomicAdd(counts[r.offset + tile], d.weight);
+}
+)";
+#endif
+};
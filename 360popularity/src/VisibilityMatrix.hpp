@@ -0,0 +1,180 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Visible samples per segment and tile of one head trace. Computing
+	them projects every viewport sample of every sampled rotation, so a
+	matrix is saved to the visibility cache folder under a hash of all
+	it depends on: the tiling of the MPD, the visibility model of the
+	adaption unit, the split of the samples into segments and the
+	sampled rotations themselves. Any tool asking again for the same
+	trace, video and tiling maps the saved matrix instead.
+*/
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include "mpd.h"
+#include "Quaternion.hpp"
+#include "MappedFile.hpp"
+
+using namespace IMT;
+
+class VisibilityMatrix
+{
+public:
+	// hash of everything the matrix of rotations depends on, sample k belongs to segment s if segmentSamples[s] <= k < segmentSamples[s + 1]
+	static uint64_t key(const DASH::MPD* mpd, const std::string& model, const std::vector<size_t>& segmentSamples, const std::vector<Quaternion>& rotations)
+	{
+		uint64_t h = 14695981039346656037ull;
+		auto add = [&h](const void* bytes, size_t n)
+		{
+			for (size_t i = 0; i < n; i++)
+				h = (h ^ static_cast<const unsigned char*>(bytes)[i]) * 1099511628211ull;
+		};
+
+		uint32_t format = version;
+		add(&format, sizeof(format));
+		for (auto& as : mpd->period.adaptationSets)
+		{
+			int32_t srd[] = { as.srd.i, as.srd.x, as.srd.y, as.srd.w, as.srd.h, as.srd.th, as.srd.tv };
+			add(srd, sizeof(srd));
+		}
+		add(model.data(), model.size());
+		for (uint64_t first : segmentSamples)
+			add(&first, sizeof(first));
+		for (auto& q : rotations)
+		{
+			double c[] = { q.GetW(), q.GetV().GetX(), q.GetV().GetY(), q.GetV().GetZ() };
+			add(c, sizeof(c));
+		}
+		return h;
+	}
+
+	// the matrix saved under key in dir, otherwise computed by visibility (rotation to visible samples per tile) and saved;
+	// without dir it is only computed
+	static std::shared_ptr<const VisibilityMatrix> get(const std::string& dir, uint64_t key, size_t tiles, const std::vector<size_t>& segmentSamples,
+		const std::vector<Quaternion>& rotations, const std::function<std::map<int, int>(const Quaternion&)>& visibility)
+	{
+		size_t segments = segmentSamples.empty() ? 0 : segmentSamples.size() - 1;
+		if (auto saved = load(dir, key, segments, tiles))
+			return saved;
+
+		std::vector<int32_t> counts(segments * tiles, 0);
+#pragma omp parallel for
+		for (int s = 0; s < (int)segments; s++)
+			for (size_t k = segmentSamples[s]; k < segmentSamples[s + 1]; k++)
+				for (auto& tile : visibility(rotations[k]))
+					if (tile.first >= 0 && (size_t)tile.first < tiles)
+						counts[s * tiles + tile.first] += tile.second;
+		return store(dir, key, segments, tiles, std::move(counts));
+	}
+
+	// the matrix saved under key in dir, nullptr if there is none
+	static std::shared_ptr<const VisibilityMatrix> load(const std::string& dir, uint64_t key, size_t segments, size_t tiles)
+	{
+		if (dir.empty())
+			return nullptr;
+		auto file = MappedFile::open(path(dir, key));
+		if (!file || file->size() != sizeof(Header) + segments * tiles * sizeof(int32_t))
+			return nullptr;
+		auto header = reinterpret_cast<const Header*>(file->data());
+		if (memcmp(header->magic, magic(), sizeof(header->magic)) != 0 || header->key != key || header->segments != segments || header->tiles != tiles)
+			return nullptr;
+
+		std::shared_ptr<VisibilityMatrix> matrix(new VisibilityMatrix(segments, tiles));
+		matrix->file = file;
+		matrix->counts = reinterpret_cast<const int32_t*>(file->data() + sizeof(Header));
+		return matrix;
+	}
+
+	// a matrix of segments x tiles counts computed elsewhere, saved under key in dir unless dir is empty
+	static std::shared_ptr<const VisibilityMatrix> store(const std::string& dir, uint64_t key, size_t segments, size_t tiles, std::vector<int32_t> counts)
+	{
+		std::shared_ptr<VisibilityMatrix> matrix(new VisibilityMatrix(segments, tiles));
+		matrix->owned = std::move(counts);
+		matrix->owned.resize(segments * tiles, 0);
+		matrix->counts = matrix->owned.data();
+		if (!dir.empty())
+			matrix->save(path(dir, key), key);
+		return matrix;
+	}
+
+	// visible samples of tile in segment, 0 if it was not seen
+	int count(size_t segment, int tile) const
+	{
+		return counts[segment * numTiles + tile];
+	}
+
+	size_t segments() const { return numSegments; }
+	size_t tiles() const { return numTiles; }
+
+private:
+	static constexpr uint32_t version = 1;
+
+	struct Header
+	{
+		char magic[8];
+		uint64_t key;
+		uint32_t segments;
+		uint32_t tiles;
+	};
+
+	size_t numSegments;
+	size_t numTiles;
+	const int32_t* counts;
+	std::vector<int32_t> owned;
+	std::shared_ptr<const MappedFile> file;
+
+	VisibilityMatrix(size_t segments, size_t tiles) : numSegments(segments), numTiles(tiles), counts(nullptr) {}
+
+	static const char* magic()
+	{
+		return "VISMAT1";
+	}
+
+	static std::string path(const std::string& dir, uint64_t key)
+	{
+		char buffer[17];
+		snprintf(buffer, sizeof(buffer), "%016llx", (unsigned long long)key);
+		return dir + "/" + buffer + ".vis";
+	}
+
+	// written next to the target and renamed, tools sharing the folder never map a partial matrix
+	void save(const std::string& path, uint64_t key) const
+	{
+		std::string tmp = path + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()))
+			+ "." + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()) + ".tmp";
+		{
+			std::ofstream out(tmp, std::ios::binary);
+			Header header;
+			memcpy(header.magic, magic(), sizeof(header.magic));
+			header.key = key;
+			header.segments = (uint32_t)numSegments;
+			header.tiles = (uint32_t)numTiles;
+			out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			out.write(reinterpret_cast<const char*>(owned.data()), owned.size() * sizeof(int32_t));
+			if (!out)
+			{
+				out.close();
+				std::remove(tmp.c_str());
+				return;
+			}
+		}
+#ifdef _WIN32
+		std::remove(path.c_str());
+#endif
+		if (std::rename(tmp.c_str(), path.c_str()) != 0)
+			std::remove(tmp.c_str());
+	}
+};
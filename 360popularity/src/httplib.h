@@ -127,7 +127,8 @@ namespace httplib
 
 	typedef std::multimap<std::string, std::string>                Params;
 	typedef std::smatch                                            Match;
-	typedef std::function<void(uint64_t current, uint64_t total)> Progress;
+	// returning false from the progress callback aborts the transfer
+	typedef std::function<bool(uint64_t current, uint64_t total)> Progress;
 
 	struct MultipartFile {
 		std::string filename;
@@ -307,6 +308,11 @@ namespace httplib
 		std::shared_ptr<Response> Options(const char* path, const Headers& headers);
 
 		bool send(Request& req, Response& res);
+
+		// GETs paths over one kept alive connection with up to depth requests sent ahead of their responses,
+		// callback gets the index of each path with its response in order; reconnects for the rest when the
+		// server closes, returns how many were answered
+		size_t GetPipelined(const std::vector<std::string>& paths, size_t depth, std::function<void(size_t, const Response&)> callback);
 		
 		bool proxyServer = false;
 
@@ -845,8 +851,8 @@ namespace httplib
 
 				r += n;
 
-				if (progress) {
-					progress(r, len);
+				if (progress && !progress(r, len)) {
+					return false;
 				}
 			}
 			return true;
@@ -2018,10 +2024,10 @@ namespace httplib
 			req.set_header("User-Agent", "cpp-httplib/0.2");
 		}
 
-		// TODO: Support KeepAlive connection
-		// if (!req.has_header("Connection")) {
-		req.set_header("Connection", "close");
-		// }
+		// only pipelined requests keep the connection
+		if (!req.has_header("Connection")) {
+			req.set_header("Connection", "close");
+		}
 
 		if (!req.body.empty()) {
 			if (!req.has_header("Content-Type")) {
@@ -2088,6 +2094,47 @@ namespace httplib
 		});
 	}
 
+	inline size_t Client::GetPipelined(const std::vector<std::string>& paths, size_t depth, std::function<void(size_t, const Response&)> callback)
+	{
+		depth = std::max<size_t>(depth, 1);
+		size_t answered = 0;
+		while (answered < paths.size()) {
+			auto sock = create_client_socket();
+			if (sock == INVALID_SOCKET) {
+				break;
+			}
+
+			SocketStream strm(sock);
+			auto before = answered;
+			auto sent = answered;
+			auto connection_close = false;
+			while (answered < paths.size() && !connection_close) {
+				for (; sent < paths.size() && sent - answered < depth; sent++) {
+					Request req;
+					req.method = "GET";
+					req.path = paths[sent];
+					req.set_header("Connection", "keep-alive");
+					write_request(strm, req);
+				}
+
+				Response res;
+				if (!read_response_line(strm, res) || !detail::read_headers(strm, res.headers) || !detail::read_content(strm, res)) {
+					break;
+				}
+				connection_close = res.get_header_value("Connection") == "close" || res.version == "HTTP/1.0";
+				callback(answered, res);
+				answered++;
+			}
+			detail::close_socket(sock);
+
+			// a connection that answers nothing is not tried again
+			if (answered == before) {
+				break;
+			}
+		}
+		return answered;
+	}
+
 	inline std::shared_ptr<Response> Client::Get(const char* path, Progress progress)
 	{
 		return Get(path, Headers(), progress);
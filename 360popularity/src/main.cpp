@@ -5,9 +5,16 @@ TU Darmstadt
 #include "mpd.h"
 #include "httplib.h"
 #include "HeadTrace.hpp"
+#include "VisibilityMatrix.hpp"
+#include "VisibilityGpu.hpp"
 #include "AdaptionUnit.hpp"
+#include "CacheWarmer.hpp"
+#include "PopularitySidecar.hpp"
 #include <experimental/filesystem>
 #include "IniReader.hpp"
+#include <atomic>
+#include <memory>
+#include <algorithm>
 
 int main(int argc, char* argv[])
 {
@@ -24,6 +31,20 @@ int main(int argc, char* argv[])
 	std::string mpdOut = ini.Get("Config", "mpdOut", "");
 	std::string squidAddress = ini.Get("Config", "squidAddress", "");
 	int squidPort = ini.GetInteger("Config", "squidPort", 3128);
+	int sampleResolution = ini.GetInteger("Config", "sampleResolution", 8);
+	bool solidAngleWeighting = ini.GetBoolean("Config", "solidAngleWeighting", false);
+	double visibilityCacheStep = ini.GetReal("Config", "visibilityCacheStep", 0.005);
+	int visibilityCacheSize = ini.GetInteger("Config", "visibilityCacheSize", 65536);
+	// head rotations between two samples are slerped
+	bool interpolateHeadtraces = ini.GetBoolean("Config", "interpolateHeadtraces", false);
+	// folder of the visibility matrices saved per trace, video and tiling
+	std::string visibilityCache = ini.Get("Config", "visibilityCache", "");
+	// visibility is counted on the GPU when the tool was built with it and one is found
+	bool gpu = ini.GetBoolean("Config", "gpu", true);
+	// connections warming the cache, the requests pipelined on each and an optional cap in requests per second
+	int requestWorkers = ini.GetInteger("Config", "requestWorkers", 8);
+	int requestDepth = ini.GetInteger("Config", "requestDepth", 8);
+	double requestRate = ini.GetReal("Config", "requestRate", 0);
 
 	auto httpClient = new httplib::Client(squidAddress.c_str(), squidPort);
 	httpClient->proxyServer = true;
@@ -37,81 +58,165 @@ int main(int argc, char* argv[])
 	auto mpd = new DASH::MPD(res->body);
 	auto srd = mpd->period.adaptationSets[0].srd;
 	auto numTiles = srd.th * srd.tv;
-	AdaptionUnit au(mpd);
-
-	// download init files
-	for (int i = 0; i < numTiles; i++)
-		auto initRes = httpClient->Get((mpd->getInitUrl(i)).c_str());
+	AdaptionUnit au(mpd, sampleResolution, solidAngleWeighting, visibilityCacheStep, visibilityCacheSize);
 
 	double vidDurationMs = mpd->mediaPresentationDuration.count();
 	double segDurationS = mpd->segmentDuration();
 	int numSegments = vidDurationMs / 1000.0 / segDurationS;
 	int numQualityLevels = mpd->period.adaptationSets[0].representations.size();
 
-	std::map<int, std::map<int, double>> tileVisibility;
-	int i = 0;
+	// a couple of timestamps inside each segment, those of segment s start at segmentSamples[s]
+	std::vector<double> timestamps;
+	std::vector<size_t> segmentSamples;
+	for (int s = 0; s < numSegments; s++)
+	{
+		segmentSamples.push_back(timestamps.size());
+		double segStart = segDurationS * s;
+		for (double ts = segStart; ts < segStart + segDurationS; ts += 0.25)
+			timestamps.push_back(ts);
+	}
+	segmentSamples.push_back(timestamps.size());
 
-	// iterate all trace files in folder
+	std::vector<std::string> traces;
 	for (auto& f : std::experimental::filesystem::directory_iterator(pathHeadtraces))
+		if (f.path().filename() != TraceCorpus::fileName)
+			traces.push_back(f.path().string());
+	std::sort(traces.begin(), traces.end());
+
+	std::unique_ptr<VisibilityGpu> visibilityGpu;
+	if (gpu)
+		visibilityGpu = VisibilityGpu::create(au.grid(), au.viewportSampler(), numTiles);
+	std::cout << "Visibility on " << (visibilityGpu ? visibilityGpu->renderer() : "the CPU") << std::endl;
+
+	// first phase: the visibility of every trace, computed in parallel over traces, computeTileVisibility is thread safe
+	std::vector<std::shared_ptr<const VisibilityMatrix>> visibilities(traces.size());
+	std::atomic<int> done(0);
+	if (!visibilityGpu)
+	{
+#pragma omp parallel for schedule(dynamic)
+		for (int i = 0; i < (int)traces.size(); i++)
+		{
+			HeadTrace headTrace(traces[i].c_str());
+			auto headRotations = headTrace.rotationsForTimestamps(timestamps, interpolateHeadtraces);
+			// visible samples per segment and tile, saved once per trace, video and tiling
+			visibilities[i] = VisibilityMatrix::get(visibilityCache, VisibilityMatrix::key(mpd, au.visibilityModel(), segmentSamples, headRotations),
+				numTiles, segmentSamples, headRotations, [&](const Quaternion& q) { return au.computeTileVisibility(q); });
+#pragma omp critical
+			std::cout << "\r" << ++done << "/" << traces.size() << std::flush;
+		}
+	}
+	else
 	{
-		// parse trace file
-		HeadTrace headTrace(f.path().c_str());
+		// the traces are read in parallel a batch at a time, the matrices not saved yet are counted on the GPU in one go
+		const int batch = 256;
+		for (int first = 0; first < (int)traces.size(); first += batch)
+		{
+			int last = std::min((int)traces.size(), first + batch);
+			std::vector<std::vector<Quaternion>> rotations(last - first);
+			std::vector<uint64_t> keys(last - first);
+#pragma omp parallel for schedule(dynamic)
+			for (int i = first; i < last; i++)
+			{
+				HeadTrace headTrace(traces[i].c_str());
+				rotations[i - first] = headTrace.rotationsForTimestamps(timestamps, interpolateHeadtraces);
+				keys[i - first] = VisibilityMatrix::key(mpd, au.visibilityModel(), segmentSamples, rotations[i - first]);
+				visibilities[i] = VisibilityMatrix::load(visibilityCache, keys[i - first], numSegments, numTiles);
+			}
+
+			std::vector<int> missing;
+			std::vector<const std::vector<Quaternion>*> missingRotations;
+			for (int i = first; i < last; i++)
+				if (!visibilities[i])
+				{
+					missing.push_back(i);
+					missingRotations.push_back(&rotations[i - first]);
+				}
+			auto counts = visibilityGpu->count(missingRotations, segmentSamples);
+			for (size_t m = 0; m < missing.size(); m++)
+				visibilities[missing[m]] = VisibilityMatrix::store(visibilityCache, keys[missing[m] - first], numSegments, numTiles, std::move(counts[m]));
+
+			done += last - first;
+			std::cout << "\r" << done << "/" << traces.size() << std::flush;
+		}
+	}
+	std::cout << std::endl;
 
-		// iterate over temporal segments
+	// segments x tiles summed over all traces, each segment is reduced by one thread
+	std::vector<double> tileVisibility(numSegments * numTiles, 0);
+	// how many traces would have requested each (segment, tile, quality)
+	std::vector<std::vector<int>> requested(numSegments, std::vector<int>(numTiles * numQualityLevels, 0));
 #pragma omp parallel for
-		for (int s = 0; s < numSegments; s++)
+	for (int s = 0; s < numSegments; s++)
+	{
+		for (auto& visibility : visibilities)
 		{
-			double segStart = segDurationS * s;
-			std::map<int, int> segTileVisibility;
-
-			// iterate over a couple of timestamps inside each segment
-			for (double ts = segStart; ts < segStart + segDurationS; ts += 0.25)
+			int max = 0;
+			for (int t = 0; t < numTiles; t++)
 			{
-				auto headRot = headTrace.rotationForTimestamp(ts);
-				// compute tile visibility for head rotation at given timestamp
-				auto tv = au.computeTileVisibility(headRot);
-
-				for (auto it = tv.begin(); it != tv.end(); it++)
-					segTileVisibility[it->first] += it->second;
+				tileVisibility[s * numTiles + t] += visibility->count(s, t);
+				max = std::max(max, visibility->count(s, t));
 			}
 
-			// add segment tile visibility from this headtrace to overall visibility
-			for (auto it = segTileVisibility.begin(); it != segTileVisibility.end(); it++)
-#pragma omp atomic
-				tileVisibility[s][it->first] += it->second;
-
-			// compute quality levels and request them to trigger caching
-			double max = std::max_element(segTileVisibility.begin(), segTileVisibility.end(), [](auto p1, auto p2) { return p1.second < p2.second; })->second;
-			for (auto it = segTileVisibility.begin(); it != segTileVisibility.end(); it++)
+			// quality levels of the visible tiles
+			for (int t = 0; t < numTiles; t++)
 			{
-				it->second = (int)(numQualityLevels - (numQualityLevels * (it->second / max)));
-				auto initRes = httpClient->Get((mpd->getUrl(s, it->first, it->second)).c_str());
+				if (visibility->count(s, t) == 0)
+					continue;
+				int quality = std::min(numQualityLevels - 1, (int)(numQualityLevels - (numQualityLevels * (visibility->count(s, t) / (double)max))));
+				requested[s][t * numQualityLevels + quality]++;
 			}
 		}
-
-		std::cout << "\r" << ++i << std::flush;
 	}
-	std::cout << std::endl;
 
+	// second phase: request the init files, which every session fetches, and every distinct segment to warm the cache
+	CacheWarmer warmer;
+	for (int t = 0; t < numTiles; t++)
+		warmer.add(mpd->getInitUrl(t), traces.size(), 0);
+	for (int s = 0; s < numSegments; s++)
+		for (int t = 0; t < numTiles; t++)
+			for (int q = 0; q < numQualityLevels; q++)
+				if (requested[s][t * numQualityLevels + q])
+					warmer.add(mpd->getUrl(s, t, q), requested[s][t * numQualityLevels + q], CacheWarmer::segmentBytes(mpd, t, q));
+
+	// a client per connection, httplib::Client is not shared between threads
+	std::vector<std::unique_ptr<httplib::Client>> clients;
+	std::vector<httplib::Client*> connections;
+	for (int w = 0; w < std::max(1, requestWorkers); w++)
+	{
+		clients.emplace_back(new httplib::Client(squidAddress.c_str(), squidPort));
+		clients.back()->proxyServer = true;
+		connections.push_back(clients.back().get());
+	}
+	auto warmup = warmer.run(connections, requestDepth, requestRate);
+	std::cout << warmup.requests << " requests, " << warmup.failed << " failed, " << warmup.bytes / 1e6 << " MB in " << warmup.seconds << " s" << std::endl;
 
 	// add popularity statistics to mpd file
 	XMLDocument& xml = mpd->getXML();
 	auto period = xml.FirstChildElement()->FirstChildElement("Period");
+	// the packager leaves an empty element to be filled in
+	auto placeholder = period->FirstChildElement("Popularity");
+	if (placeholder != NULL && placeholder->NoChildren())
+		period->DeleteChild(placeholder);
 	if (period->FirstChildElement("Popularity") == NULL)
 	{
 		auto popularity = xml.NewElement("Popularity");
-		i = 0;
-		for (auto it = tileVisibility.begin(); it != tileVisibility.end(); it++)
+		// the same qualities as a table the player loads without parsing
+		PopularitySidecar sidecar;
+		sidecar.segments = numSegments;
+		sidecar.tiles = numTiles;
+		for (int s = 0; s < numSegments; s++)
 		{
 			auto tp = xml.NewElement("SegmentPopularity");
-			tp->SetAttribute("segment", ++i);
+			tp->SetAttribute("segment", s + 1);
+			// one entry per tile of the SRD, tiles nobody looked at get the lowest quality
 			std::string pops;
-			double max = std::max_element(it->second.begin(), it->second.end(), [](auto p1, auto p2) { return p1.second < p2.second; })->second;
-			for (auto it2 = it->second.begin(); it2 != it->second.end(); it2++)
+			double max = std::max(1.0, *std::max_element(tileVisibility.begin() + s * numTiles, tileVisibility.begin() + (s + 1) * numTiles));
+			for (int t = 0; t < numTiles; t++)
 			{
-				it2->second = (int)(numQualityLevels - (numQualityLevels * (it2->second / max)));
-				pops += std::to_string((int)it2->second);
-				if (it2 != std::prev(it->second.end()))
+				int quality = std::min(numQualityLevels - 1, (int)(numQualityLevels - (numQualityLevels * (tileVisibility[s * numTiles + t] / max))));
+				pops += std::to_string(quality);
+				sidecar.quality.push_back(quality);
+				if (t != numTiles - 1)
 					pops += ",";
 			}
 			tp->SetAttribute("tileQuality", pops.c_str());
@@ -119,5 +224,6 @@ int main(int argc, char* argv[])
 		}
 		period->InsertFirstChild(popularity);
 		xml.SaveFile(mpdOut.c_str());
+		std::ofstream(mpdOut + ".pop", std::ios::binary) << sidecar.write();
 	}
 }
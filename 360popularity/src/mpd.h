@@ -10,6 +10,11 @@ Wrapper class for mpd xml files
 #include <string>
 #include <vector>
 #include <sstream>
+#include <stdexcept>
+#include <cstdint>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
 #include "tinyxml2.h"
 #include <chrono>
 using namespace tinyxml2;
@@ -57,6 +62,7 @@ namespace DASH
 		return num / denom;
 	}
 
+	// the segments of a representation, listed by a <SegmentList> or generated from a <SegmentTemplate>
 	struct SegmentList
 	{
 		void parse(XMLElement* elem)
@@ -64,28 +70,128 @@ namespace DASH
 			getattr_int(elem, timescale);
 			getattr_int(elem, duration);
 			initializationUrl = elem->FirstChildElement("Initialization")->Attribute("sourceURL");
+			initializationPath = "/" + initializationUrl;
 
 			for (auto e = elem->FirstChildElement("SegmentURL"); e != NULL; e = e->NextSiblingElement("SegmentURL"))
-			{
 				segmentUrls.push_back(e->Attribute("media"));
+			count = segmentUrls.size();
+			durationSeconds = duration / (double)timescale;
+		}
+
+		// $RepresentationID$, $Bandwidth$ and $$ are filled in here, $Number$ and $Number%0<width>d$ per url;
+		// a template without duration has no segments
+		void parseTemplate(XMLElement* elem, const std::string& representationId, uint32_t bandwidth, double presentationSeconds)
+		{
+			timescale = elem->UnsignedAttribute("timescale", 1);
+			duration = elem->UnsignedAttribute("duration", 0);
+			startNumber = elem->UnsignedAttribute("startNumber", 1);
+			durationSeconds = duration / (double)timescale;
+			count = duration > 0 ? (size_t)std::ceil(presentationSeconds / durationSeconds - 1e-9) : 0;
+
+			std::vector<std::string> initPieces;
+			std::vector<int> initWidths;
+			compile(elem->Attribute("initialization") ? elem->Attribute("initialization") : "", representationId, bandwidth, initPieces, initWidths);
+			initializationPath = "/";
+			format(initPieces, initWidths, startNumber, initializationPath);
+			initializationUrl = initializationPath.substr(1);
+			compile(elem->Attribute("media") ? elem->Attribute("media") : "", representationId, bandwidth, pieces, widths);
+		}
+
+		// appends the url of a segment, counted from 0, to url
+		void appendUrl(size_t segment, std::string& url) const
+		{
+			if (pieces.empty())
+			{
+				url += segmentUrls.at(segment);
+				return;
 			}
+			if (segment >= count)
+				throw std::out_of_range("SegmentList::appendUrl: no segment " + std::to_string(segment));
+			format(pieces, widths, startNumber + (uint32_t)segment, url);
 		}
-		uint32_t timescale;
-		uint32_t duration;
+
+		uint32_t timescale = 1;
+		uint32_t duration = 0;
+		uint32_t startNumber = 1;
+		double durationSeconds = 0;
+		size_t count = 0;
 		std::string initializationUrl;
+		// the url as requested
+		std::string initializationPath;
+		// urls of a <SegmentList>, empty for a template
 		std::vector<std::string> segmentUrls;
+
+	private:
+		// literal pieces of the media template around its $Number$ identifiers, with their widths
+		std::vector<std::string> pieces;
+		std::vector<int> widths;
+
+		static void compile(const std::string& templ, const std::string& representationId, uint32_t bandwidth, std::vector<std::string>& pieces, std::vector<int>& widths)
+		{
+			pieces.assign(1, "");
+			widths.clear();
+			for (size_t i = 0; i < templ.size(); i++)
+			{
+				size_t end = templ[i] == '$' ? templ.find('$', i + 1) : std::string::npos;
+				if (end == std::string::npos)
+				{
+					pieces.back() += templ[i];
+					continue;
+				}
+				std::string identifier = templ.substr(i + 1, end - i - 1);
+				i = end;
+				if (identifier.empty())
+					pieces.back() += '$';
+				else if (identifier == "RepresentationID")
+					pieces.back() += representationId;
+				else if (identifier == "Bandwidth")
+					pieces.back() += std::to_string(bandwidth);
+				else if (identifier.compare(0, 6, "Number") == 0)
+				{
+					widths.push_back(identifier.size() > 7 && identifier[6] == '%' ? std::atoi(identifier.c_str() + 7) : 0);
+					pieces.emplace_back();
+				}
+				// $Time$ and others are kept as they are
+				else
+					pieces.back() += "$" + identifier + "$";
+			}
+		}
+
+		static void format(const std::vector<std::string>& pieces, const std::vector<int>& widths, uint32_t number, std::string& url)
+		{
+			url += pieces[0];
+			for (size_t i = 0; i < widths.size(); i++)
+			{
+				// digits from the back, padded with zeros to the width
+				char digits[16];
+				char* end = digits + sizeof(digits);
+				char* first = end;
+				for (uint32_t n = number; first == end || n > 0; n /= 10)
+					*--first = char('0' + n % 10);
+				while (end - first < std::min(widths[i], (int)sizeof(digits)))
+					*--first = '0';
+				url.append(first, end);
+				url += pieces[i + 1];
+			}
+		}
 	};
 
 	struct Representation
 	{
-		void parse(XMLElement* elem)
+		// the segments come from a <SegmentList> or a <SegmentTemplate> of the representation, or else the
+		// template of its adaptation set
+		void parse(XMLElement* elem, XMLElement* adaptationSetTemplate, double presentationSeconds)
 		{
 			getattr(elem, id);
 			getattr_int(elem, width);
 			getattr_int(elem, height);
 			getattr_int(elem, bandwidth);
 			getattr(elem, frameRate);
-			segmentList.parse(elem->FirstChildElement("SegmentList"));
+			auto templ = elem->FirstChildElement("SegmentTemplate");
+			if (auto list = elem->FirstChildElement("SegmentList"))
+				segmentList.parse(list);
+			else if (templ || (templ = adaptationSetTemplate))
+				segmentList.parseTemplate(templ, id, bandwidth, presentationSeconds);
 		}
 		std::string id;
 		uint32_t width;
@@ -112,14 +218,14 @@ namespace DASH
 
 	struct AdaptationSet
 	{
-		void parse(XMLElement* elem)
+		void parse(XMLElement* elem, double presentationSeconds)
 		{
 			getattr_bool(elem, segmentAlignment);
 			srd.parse(elem->FirstChildElement("SupplementalProperty"));
 			for (auto e = elem->FirstChildElement("Representation"); e != NULL; e = e->NextSiblingElement("Representation"))
 			{
 				representations.push_back(Representation());
-				representations.back().parse(e);
+				representations.back().parse(e, elem->FirstChildElement("SegmentTemplate"), presentationSeconds);
 			}
 		}
 		bool segmentAlignment;
@@ -129,14 +235,15 @@ namespace DASH
 
 	struct Period
 	{
-		void parse(XMLElement* elem)
+		// presentationSeconds gives the number of segments of templates
+		void parse(XMLElement* elem, double presentationSeconds)
 		{
 			getattr(elem, start);
 			getattr_dur(elem, duration);
 			for (auto e = elem->FirstChildElement("AdaptationSet"); e != NULL; e = e->NextSiblingElement("AdaptationSet"))
 			{
 				adaptationSets.push_back(AdaptationSet());
-				adaptationSets.back().parse(e);
+				adaptationSets.back().parse(e, presentationSeconds);
 			}
 		}
 
@@ -157,18 +264,32 @@ namespace DASH
 			getattr_dur(elem, minBufferTime);
 			getattr_dur(elem, mediaPresentationDuration);
 			getattr(elem, profiles);
-			period.parse(elem->FirstChildElement("Period"));
+			period.parse(elem->FirstChildElement("Period"), mediaPresentationDuration.count() / 1000.0);
 		}
 
 
-		std::string getInitUrl(int adaptionSet = 0, int representation = 0) const
+		const std::string& getInitUrl(int adaptionSet = 0, int representation = 0) const
+		{
+			return period.adaptationSets.at(adaptionSet).representations.at(representation).segmentList.initializationPath;
+		}
+
+		// formats the url of a segment into url, which keeps its capacity across calls
+		void getUrl(std::string& url, int segmentIndex, int adaptionSet = 0, int representation = 0) const
 		{
-			return "/" + period.adaptationSets.at(adaptionSet).representations.at(representation).segmentList.initializationUrl;
+			url.assign(1, '/');
+			period.adaptationSets.at(adaptionSet).representations.at(representation).segmentList.appendUrl(segmentIndex, url);
 		}
 
 		std::string getUrl(int segmentIndex, int adaptionSet = 0, int representation = 0) const
 		{
-			return "/" + period.adaptationSets.at(adaptionSet).representations.at(representation).segmentList.segmentUrls.at(segmentIndex);
+			std::string url;
+			getUrl(url, segmentIndex, adaptionSet, representation);
+			return url;
+		}
+
+		size_t numSegments(int adaptionSet = 0, int representation = 0) const
+		{
+			return period.adaptationSets.at(adaptionSet).representations.at(representation).segmentList.count;
 		}
 
 		double frameRate(int adaptionSet = 0, int representation = 0) const
@@ -178,8 +299,7 @@ namespace DASH
 
 		double segmentDuration(int adaptionSet = 0, int representation = 0) const
 		{
-			auto segmentList = period.adaptationSets.at(adaptionSet).representations.at(representation).segmentList;
-			return segmentList.duration / (double)segmentList.timescale;
+			return period.adaptationSets.at(adaptionSet).representations.at(representation).segmentList.durationSeconds;
 		}
 
 		XMLDocument& getXML()
@@ -0,0 +1,307 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Object store of the caching proxy. Objects are evicted by a
+	replacement policy over the whole capacity; the policies use
+	squid's heap keys so results stay comparable to the former squid
+	setups. Bodies live in memory up to a memory budget, the least
+	recently used ones beyond it are spilled to files of a disk
+	directory and read back on a hit.
+*/
+#pragma once
+
+#include <set>
+#include <map>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdio>
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+#include "ReplacementPolicy.hpp"
+
+class EdgeCache
+{
+public:
+	struct Stats
+	{
+		size_t hits;
+		size_t misses;
+		size_t hitBytes;
+		size_t missBytes;
+		// objects the live popularity fetched before any client asked for them
+		size_t seeded;
+		size_t seedBytes;
+	};
+
+	// memoryBytes beyond capacityBytes or an empty diskDir keep every body in memory
+	EdgeCache(size_t capacityBytes, size_t memoryBytes, const std::string& diskDir, const std::string& policy)
+		: diskDir(diskDir)
+	{
+		reset(capacityBytes, memoryBytes, policy);
+	}
+
+	~EdgeCache()
+	{
+		clear();
+	}
+
+	// drops every object and starts over with another size and policy, the popular urls stay known
+	void reset(size_t capacityBytes, size_t memoryBytes, const std::string& policyType)
+	{
+		auto newPolicy = ReplacementPolicy::create(policyType);
+		std::lock_guard<std::mutex> l(mtx);
+		clear();
+		policy = std::move(newPolicy);
+		capacity = capacityBytes;
+		memoryCapacity = diskDir.empty() ? capacityBytes : std::min(memoryBytes, capacityBytes);
+	}
+
+	void setPopular(const std::string& key)
+	{
+		std::lock_guard<std::mutex> l(mtx);
+		popularKeys.insert(key);
+		auto it = objects.find(key);
+		if (it != objects.end() && !it->second.entry.popular)
+		{
+			it->second.entry.popular = true;
+			rekey(it->first, it->second);
+		}
+	}
+
+	// the popular urls become keys, cached objects no longer among them lose their priority
+	void replacePopular(const std::vector<std::string>& keys)
+	{
+		std::lock_guard<std::mutex> l(mtx);
+		popularKeys = std::unordered_set<std::string>(keys.begin(), keys.end());
+		for (auto& object : objects)
+		{
+			bool popular = popularKeys.count(object.first) > 0;
+			if (object.second.entry.popular != popular)
+			{
+				object.second.entry.popular = popular;
+				rekey(object.first, object.second);
+			}
+		}
+	}
+
+	// without counting a hit or a miss
+	bool contains(const std::string& key)
+	{
+		std::lock_guard<std::mutex> l(mtx);
+		return objects.count(key) > 0;
+	}
+
+	// counts a hit or a miss for key, body and contentType are filled on a hit. The bytes are counted by sent
+	bool get(const std::string& key, std::string& body, std::string& contentType)
+	{
+		std::lock_guard<std::mutex> l(mtx);
+		auto it = objects.find(key);
+		if (it == objects.end())
+		{
+			stats.misses++;
+			return false;
+		}
+
+		auto& object = it->second;
+		if (object.onDisk && !load(key, object))
+		{
+			remove(it);
+			stats.misses++;
+			return false;
+		}
+
+		body = object.body;
+		contentType = object.contentType;
+		object.entry.refcount++;
+		touch(key, object);
+		rekey(key, object);
+		spill();
+		stats.hits++;
+		return true;
+	}
+
+	// bytes of an answer sent to a client, from the cache or passed on from upstream
+	void sent(bool hit, size_t bytesSent)
+	{
+		std::lock_guard<std::mutex> l(mtx);
+		(hit ? stats.hitBytes : stats.missBytes) += bytesSent;
+	}
+
+	// an object fetched for the live popularity was stored
+	void seededObject(size_t bodyBytes)
+	{
+		std::lock_guard<std::mutex> l(mtx);
+		stats.seeded++;
+		stats.seedBytes += bodyBytes;
+	}
+
+	// stores an upstream answer, of a miss or fetched ahead; objects larger than the cache are not kept
+	void put(const std::string& key, const std::string& body, const std::string& contentType)
+	{
+		std::lock_guard<std::mutex> l(mtx);
+		if (body.size() > capacity || objects.count(key))
+			return;
+
+		while (bytes + body.size() > capacity && !heap.empty())
+		{
+			auto victim = objects.find(heap.begin()->second);
+			age = policy->ageAfterEviction(victim->second.entry, victim->second.key);
+			remove(victim);
+		}
+
+		auto& object = objects[key];
+		object.entry = { body.size(), 1, 0, popularKeys.count(key) > 0 };
+		object.key = 0;
+		object.body = body;
+		object.contentType = contentType;
+		object.onDisk = false;
+		object.id = nextId++;
+		bytes += body.size();
+		memoryBytes += body.size();
+		touch(key, object);
+		rekey(key, object);
+		spill();
+	}
+
+	Stats statistics()
+	{
+		std::lock_guard<std::mutex> l(mtx);
+		return stats;
+	}
+
+	size_t size()
+	{
+		std::lock_guard<std::mutex> l(mtx);
+		return bytes;
+	}
+
+	size_t capacityBytes()
+	{
+		std::lock_guard<std::mutex> l(mtx);
+		return capacity;
+	}
+
+private:
+	struct Object
+	{
+		ReplacementPolicy::Entry entry;
+		double key;
+		std::string body;
+		std::string contentType;
+		// the body is in the file id of diskDir and body is empty
+		bool onDisk;
+		size_t id;
+	};
+
+	std::string diskDir;
+	std::unique_ptr<ReplacementPolicy> policy;
+	size_t capacity;
+	size_t memoryCapacity;
+	size_t bytes;
+	size_t memoryBytes;
+	double age;
+	long long accesses;
+	size_t nextId;
+	Stats stats;
+
+	std::unordered_map<std::string, Object> objects;
+	// (policy key, url), the first one is evicted next
+	std::set<std::pair<double, std::string>> heap;
+	// (last access, url) of the bodies held in memory, the first one is spilled next
+	std::set<std::pair<long long, std::string>> memoryLru;
+	std::unordered_set<std::string> popularKeys;
+	std::mutex mtx;
+
+	void clear()
+	{
+		for (auto& object : objects)
+			if (object.second.onDisk)
+				std::remove(path(object.second).c_str());
+		objects.clear();
+		heap.clear();
+		memoryLru.clear();
+		bytes = 0;
+		memoryBytes = 0;
+		age = 0;
+		accesses = 0;
+		nextId = 0;
+		stats = { 0, 0, 0, 0, 0, 0 };
+	}
+
+	std::string path(const Object& object) const
+	{
+		return diskDir + "/" + std::to_string(object.id) + ".obj";
+	}
+
+	void rekey(const std::string& key, Object& object)
+	{
+		heap.erase({ object.key, key });
+		object.key = policy->key(object.entry, age);
+		heap.insert({ object.key, key });
+	}
+
+	void touch(const std::string& key, Object& object)
+	{
+		if (!object.onDisk)
+			memoryLru.erase({ object.entry.lastAccess, key });
+		object.entry.lastAccess = ++accesses;
+		if (!object.onDisk)
+			memoryLru.insert({ object.entry.lastAccess, key });
+	}
+
+	void remove(std::unordered_map<std::string, Object>::iterator it)
+	{
+		auto& object = it->second;
+		heap.erase({ object.key, it->first });
+		if (object.onDisk)
+			std::remove(path(object).c_str());
+		else
+		{
+			memoryLru.erase({ object.entry.lastAccess, it->first });
+			memoryBytes -= object.body.size();
+		}
+		bytes -= object.entry.size;
+		objects.erase(it);
+	}
+
+	// moves bodies to disk until the memory budget holds, a body that cannot be written stays in memory
+	void spill()
+	{
+		while (memoryBytes > memoryCapacity && !memoryLru.empty())
+		{
+			auto it = objects.find(memoryLru.begin()->second);
+			auto& object = it->second;
+			memoryLru.erase(memoryLru.begin());
+
+			std::ofstream file(path(object), std::ios::binary | std::ios::trunc);
+			file.write(object.body.data(), object.body.size());
+			if (!file)
+				continue;
+			memoryBytes -= object.body.size();
+			object.body.clear();
+			object.body.shrink_to_fit();
+			object.onDisk = true;
+		}
+	}
+
+	// reads a spilled body back into memory
+	bool load(const std::string& key, Object& object)
+	{
+		std::ifstream file(path(object), std::ios::binary);
+		std::string body(object.entry.size, '\0');
+		if (!file.read(&body[0], body.size()))
+			return false;
+		std::remove(path(object).c_str());
+		object.body = std::move(body);
+		object.onDisk = false;
+		memoryBytes += object.entry.size;
+		memoryLru.insert({ object.entry.lastAccess, key });
+		return true;
+	}
+};
@@ -0,0 +1,699 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Wire format of HTTP/2 over cleartext connections whose client
+	knows the server speaks it (h2c with prior knowledge): frames
+	and the HPACK header compression. The decoder takes everything
+	a peer may send, Huffman coded strings and the dynamic table
+	included. The encoder only writes literals that are not indexed,
+	so it never changes the table of the peer. The priority tree
+	decides which stream of a connection a sender serves next. The
+	same file is used by 360player and 360server.
+*/
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cctype>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <functional>
+#include <utility>
+#include <algorithm>
+
+namespace http2
+{
+// a client starts the connection with it, then both sides send their SETTINGS
+static const char connectionPreface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+static const size_t prefaceLength = 24;
+static const size_t frameHeaderLength = 9;
+// flow control window and frame size every connection starts with
+static const uint32_t defaultWindow = 65535;
+static const uint32_t defaultFrameSize = 16384;
+static const uint32_t maxWindow = 0x7fffffff;
+
+enum FrameType : uint8_t { Data = 0, Headers = 1, Priority = 2, RstStream = 3, Settings = 4, PushPromise = 5, Ping = 6, GoAway = 7,
+	WindowUpdate = 8, Continuation = 9 };
+enum Flag : uint8_t { EndStream = 0x1, Ack = 0x1, EndHeaders = 0x4, Padded = 0x8, PriorityFlag = 0x20 };
+enum Setting : uint16_t { HeaderTableSize = 1, EnablePush = 2, MaxConcurrentStreams = 3, InitialWindowSize = 4, MaxFrameSize = 5,
+	MaxHeaderListSize = 6 };
+enum ErrorCode : uint32_t { NoError = 0, ProtocolError = 1, InternalError = 2, FlowControlError = 3, StreamClosed = 5, FrameSizeError = 6,
+	RefusedStream = 7, Cancel = 8, CompressionError = 9, EnhanceYourCalm = 11 };
+
+typedef std::vector<std::pair<std::string, std::string>> HeaderList;
+typedef std::vector<std::pair<uint16_t, uint32_t>> SettingList;
+
+struct FrameHeader
+{
+	uint32_t length;
+	uint8_t type;
+	uint8_t flags;
+	uint32_t stream;
+};
+
+// the stream a stream depends on and its weight of 1 to 256 among the other dependents of that stream. An
+// exclusive dependency makes it the only dependent, the former ones depend on it instead
+struct StreamPriority
+{
+	uint32_t dependency;
+	bool exclusive;
+	int weight;
+};
+
+inline void putUint32(std::string& out, uint32_t v)
+{
+	out += char(v >> 24);
+	out += char(v >> 16);
+	out += char(v >> 8);
+	out += char(v);
+}
+
+inline uint32_t getUint32(const char* p)
+{
+	auto u = reinterpret_cast<const uint8_t*>(p);
+	return uint32_t(u[0]) << 24 | uint32_t(u[1]) << 16 | uint32_t(u[2]) << 8 | u[3];
+}
+
+// the header of the frame starting at p, which has frameHeaderLength bytes
+inline FrameHeader parseFrameHeader(const char* p)
+{
+	auto u = reinterpret_cast<const uint8_t*>(p);
+	FrameHeader header;
+	header.length = uint32_t(u[0]) << 16 | uint32_t(u[1]) << 8 | u[2];
+	header.type = u[3];
+	header.flags = u[4];
+	header.stream = getUint32(p + 5) & 0x7fffffff;
+	return header;
+}
+
+inline void appendFrame(std::string& out, uint8_t type, uint8_t flags, uint32_t stream, const char* payload = nullptr, size_t length = 0)
+{
+	out += char(length >> 16);
+	out += char(length >> 8);
+	out += char(length);
+	out += char(type);
+	out += char(flags);
+	putUint32(out, stream & 0x7fffffff);
+	if (length > 0)
+		out.append(payload, length);
+}
+
+inline void appendSettings(std::string& out, const SettingList& settings)
+{
+	std::string payload;
+	for (auto& setting : settings)
+	{
+		payload += char(setting.first >> 8);
+		payload += char(setting.first);
+		putUint32(payload, setting.second);
+	}
+	appendFrame(out, Settings, 0, 0, payload.data(), payload.size());
+}
+
+inline void appendWindowUpdate(std::string& out, uint32_t stream, uint32_t increment)
+{
+	std::string payload;
+	putUint32(payload, increment & 0x7fffffff);
+	appendFrame(out, WindowUpdate, 0, stream, payload.data(), payload.size());
+}
+
+inline void appendRstStream(std::string& out, uint32_t stream, uint32_t error)
+{
+	std::string payload;
+	putUint32(payload, error);
+	appendFrame(out, RstStream, 0, stream, payload.data(), payload.size());
+}
+
+inline void appendGoAway(std::string& out, uint32_t lastStream, uint32_t error)
+{
+	std::string payload;
+	putUint32(payload, lastStream & 0x7fffffff);
+	putUint32(payload, error);
+	appendFrame(out, GoAway, 0, 0, payload.data(), payload.size());
+}
+
+// a header block in a HEADERS frame and as many CONTINUATION frames as frames of maxFrame bytes need. With
+// priority the HEADERS frame carries the dependency and weight of the stream
+inline void appendHeaders(std::string& out, uint32_t stream, const std::string& block, bool endStream, size_t maxFrame,
+	const StreamPriority* priority = nullptr)
+{
+	std::string first;
+	if (priority)
+	{
+		putUint32(first, (priority->dependency & 0x7fffffff) | (priority->exclusive ? 0x80000000u : 0));
+		first += char(std::max(1, std::min(256, priority->weight)) - 1);
+	}
+	size_t taken = std::min(block.size(), maxFrame - first.size());
+	first.append(block, 0, taken);
+	uint8_t flags = (endStream ? EndStream : 0) | (taken == block.size() ? EndHeaders : 0) | (priority ? PriorityFlag : 0);
+	appendFrame(out, Headers, flags, stream, first.data(), first.size());
+	while (taken < block.size())
+	{
+		size_t part = std::min(block.size() - taken, maxFrame);
+		appendFrame(out, Continuation, taken + part == block.size() ? EndHeaders : 0, stream, block.data() + taken, part);
+		taken += part;
+	}
+}
+
+// the payload of a DATA or HEADERS frame without its padding, for HEADERS and PRIORITY frames also without the
+// priority, which is given to priority. False if the frame is too short for them
+inline bool framePayload(const FrameHeader& header, const char*& payload, size_t& length, StreamPriority* priority = nullptr)
+{
+	length = header.length;
+	size_t padding = 0;
+	if ((header.type == Data || header.type == Headers) && (header.flags & Padded))
+	{
+		if (length < 1)
+			return false;
+		padding = uint8_t(payload[0]);
+		payload++;
+		length--;
+	}
+	if (header.type == Priority || (header.type == Headers && (header.flags & PriorityFlag)))
+	{
+		if (length < 5)
+			return false;
+		if (priority)
+		{
+			auto dependency = getUint32(payload);
+			priority->dependency = dependency & 0x7fffffff;
+			priority->exclusive = (dependency & 0x80000000u) != 0;
+			priority->weight = uint8_t(payload[4]) + 1;
+		}
+		payload += 5;
+		length -= 5;
+	}
+	if (padding > length)
+		return false;
+	length -= padding;
+	return true;
+}
+
+inline bool parseSettings(const char* payload, size_t length, SettingList& settings)
+{
+	if (length % 6 != 0)
+		return false;
+	for (size_t i = 0; i < length; i += 6)
+		settings.push_back({ uint16_t(uint8_t(payload[i]) << 8 | uint8_t(payload[i + 1])), getUint32(payload + i + 2) });
+	return true;
+}
+
+// headers of HTTP/1.1 that only concern its connection, HTTP/2 forbids them
+inline bool isConnectionHeader(const std::string& name)
+{
+	static const char* names[] = { "connection", "keep-alive", "proxy-connection", "transfer-encoding", "upgrade", "host" };
+	for (auto n : names)
+		if (name.size() == strlen(n) && std::equal(name.begin(), name.end(), n, [](char a, char b) { return ::tolower(a) == b; }))
+			return true;
+	return false;
+}
+
+namespace hpack
+{
+	inline const std::pair<const char*, const char*>* staticTable()
+	{
+		static const std::pair<const char*, const char*> table[] = {
+			{ ":authority", "" }, { ":method", "GET" }, { ":method", "POST" },
+			{ ":path", "/" }, { ":path", "/index.html" }, { ":scheme", "http" },
+			{ ":scheme", "https" }, { ":status", "200" }, { ":status", "204" },
+			{ ":status", "206" }, { ":status", "304" }, { ":status", "400" },
+			{ ":status", "404" }, { ":status", "500" }, { "accept-charset", "" },
+			{ "accept-encoding", "gzip, deflate" }, { "accept-language", "" }, { "accept-ranges", "" },
+			{ "accept", "" }, { "access-control-allow-origin", "" }, { "age", "" },
+			{ "allow", "" }, { "authorization", "" }, { "cache-control", "" },
+			{ "content-disposition", "" }, { "content-encoding", "" }, { "content-language", "" },
+			{ "content-length", "" }, { "content-location", "" }, { "content-range", "" },
+			{ "content-type", "" }, { "cookie", "" }, { "date", "" },
+			{ "etag", "" }, { "expect", "" }, { "expires", "" },
+			{ "from", "" }, { "host", "" }, { "if-match", "" },
+			{ "if-modified-since", "" }, { "if-none-match", "" }, { "if-range", "" },
+			{ "if-unmodified-since", "" }, { "last-modified", "" }, { "link", "" },
+			{ "location", "" }, { "max-forwards", "" }, { "proxy-authenticate", "" },
+			{ "proxy-authorization", "" }, { "range", "" }, { "referer", "" },
+			{ "refresh", "" }, { "retry-after", "" }, { "server", "" },
+			{ "set-cookie", "" }, { "strict-transport-security", "" }, { "transfer-encoding", "" },
+			{ "user-agent", "" }, { "vary", "" }, { "via", "" },
+			{ "www-authenticate", "" },		};
+		return table;
+	}
+	static const size_t staticTableSize = 61;
+
+	// code and bit length of every byte, RFC 7541 appendix B
+	struct HuffmanCode
+	{
+		uint32_t code;
+		uint8_t bits;
+	};
+
+	inline const HuffmanCode* huffmanCodes()
+	{
+		static const HuffmanCode codes[] = {
+			{ 0x1ff8, 13 }, { 0x7fffd8, 23 }, { 0xfffffe2, 28 }, { 0xfffffe3, 28 }, { 0xfffffe4, 28 }, { 0xfffffe5, 28 }, { 0xfffffe6, 28 }, { 0xfffffe7, 28 },
+			{ 0xfffffe8, 28 }, { 0xffffea, 24 }, { 0x3ffffffc, 30 }, { 0xfffffe9, 28 }, { 0xfffffea, 28 }, { 0x3ffffffd, 30 }, { 0xfffffeb, 28 }, { 0xfffffec, 28 },
+			{ 0xfffffed, 28 }, { 0xfffffee, 28 }, { 0xfffffef, 28 }, { 0xffffff0, 28 }, { 0xffffff1, 28 }, { 0xffffff2, 28 }, { 0x3ffffffe, 30 }, { 0xffffff3, 28 },
+			{ 0xffffff4, 28 }, { 0xffffff5, 28 }, { 0xffffff6, 28 }, { 0xffffff7, 28 }, { 0xffffff8, 28 }, { 0xffffff9, 28 }, { 0xffffffa, 28 }, { 0xffffffb, 28 },
+			{ 0x14, 6 }, { 0x3f8, 10 }, { 0x3f9, 10 }, { 0xffa, 12 }, { 0x1ff9, 13 }, { 0x15, 6 }, { 0xf8, 8 }, { 0x7fa, 11 },
+			{ 0x3fa, 10 }, { 0x3fb, 10 }, { 0xf9, 8 }, { 0x7fb, 11 }, { 0xfa, 8 }, { 0x16, 6 }, { 0x17, 6 }, { 0x18, 6 },
+			{ 0x0, 5 }, { 0x1, 5 }, { 0x2, 5 }, { 0x19, 6 }, { 0x1a, 6 }, { 0x1b, 6 }, { 0x1c, 6 }, { 0x1d, 6 },
+			{ 0x1e, 6 }, { 0x1f, 6 }, { 0x5c, 7 }, { 0xfb, 8 }, { 0x7ffc, 15 }, { 0x20, 6 }, { 0xffb, 12 }, { 0x3fc, 10 },
+			{ 0x1ffa, 13 }, { 0x21, 6 }, { 0x5d, 7 }, { 0x5e, 7 }, { 0x5f, 7 }, { 0x60, 7 }, { 0x61, 7 }, { 0x62, 7 },
+			{ 0x63, 7 }, { 0x64, 7 }, { 0x65, 7 }, { 0x66, 7 }, { 0x67, 7 }, { 0x68, 7 }, { 0x69, 7 }, { 0x6a, 7 },
+			{ 0x6b, 7 }, { 0x6c, 7 }, { 0x6d, 7 }, { 0x6e, 7 }, { 0x6f, 7 }, { 0x70, 7 }, { 0x71, 7 }, { 0x72, 7 },
+			{ 0xfc, 8 }, { 0x73, 7 }, { 0xfd, 8 }, { 0x1ffb, 13 }, { 0x7fff0, 19 }, { 0x1ffc, 13 }, { 0x3ffc, 14 }, { 0x22, 6 },
+			{ 0x7ffd, 15 }, { 0x3, 5 }, { 0x23, 6 }, { 0x4, 5 }, { 0x24, 6 }, { 0x5, 5 }, { 0x25, 6 }, { 0x26, 6 },
+			{ 0x27, 6 }, { 0x6, 5 }, { 0x74, 7 }, { 0x75, 7 }, { 0x28, 6 }, { 0x29, 6 }, { 0x2a, 6 }, { 0x7, 5 },
+			{ 0x2b, 6 }, { 0x76, 7 }, { 0x2c, 6 }, { 0x8, 5 }, { 0x9, 5 }, { 0x2d, 6 }, { 0x77, 7 }, { 0x78, 7 },
+			{ 0x79, 7 }, { 0x7a, 7 }, { 0x7b, 7 }, { 0x7ffe, 15 }, { 0x7fc, 11 }, { 0x3ffd, 14 }, { 0x1ffd, 13 }, { 0xffffffc, 28 },
+			{ 0xfffe6, 20 }, { 0x3fffd2, 22 }, { 0xfffe7, 20 }, { 0xfffe8, 20 }, { 0x3fffd3, 22 }, { 0x3fffd4, 22 }, { 0x3fffd5, 22 }, { 0x7fffd9, 23 },
+			{ 0x3fffd6, 22 }, { 0x7fffda, 23 }, { 0x7fffdb, 23 }, { 0x7fffdc, 23 }, { 0x7fffdd, 23 }, { 0x7fffde, 23 }, { 0xffffeb, 24 }, { 0x7fffdf, 23 },
+			{ 0xffffec, 24 }, { 0xffffed, 24 }, { 0x3fffd7, 22 }, { 0x7fffe0, 23 }, { 0xffffee, 24 }, { 0x7fffe1, 23 }, { 0x7fffe2, 23 }, { 0x7fffe3, 23 },
+			{ 0x7fffe4, 23 }, { 0x1fffdc, 21 }, { 0x3fffd8, 22 }, { 0x7fffe5, 23 }, { 0x3fffd9, 22 }, { 0x7fffe6, 23 }, { 0x7fffe7, 23 }, { 0xffffef, 24 },
+			{ 0x3fffda, 22 }, { 0x1fffdd, 21 }, { 0xfffe9, 20 }, { 0x3fffdb, 22 }, { 0x3fffdc, 22 }, { 0x7fffe8, 23 }, { 0x7fffe9, 23 }, { 0x1fffde, 21 },
+			{ 0x7fffea, 23 }, { 0x3fffdd, 22 }, { 0x3fffde, 22 }, { 0xfffff0, 24 }, { 0x1fffdf, 21 }, { 0x3fffdf, 22 }, { 0x7fffeb, 23 }, { 0x7fffec, 23 },
+			{ 0x1fffe0, 21 }, { 0x1fffe1, 21 }, { 0x3fffe0, 22 }, { 0x1fffe2, 21 }, { 0x7fffed, 23 }, { 0x3fffe1, 22 }, { 0x7fffee, 23 }, { 0x7fffef, 23 },
+			{ 0xfffea, 20 }, { 0x3fffe2, 22 }, { 0x3fffe3, 22 }, { 0x3fffe4, 22 }, { 0x7ffff0, 23 }, { 0x3fffe5, 22 }, { 0x3fffe6, 22 }, { 0x7ffff1, 23 },
+			{ 0x3ffffe0, 26 }, { 0x3ffffe1, 26 }, { 0xfffeb, 20 }, { 0x7fff1, 19 }, { 0x3fffe7, 22 }, { 0x7ffff2, 23 }, { 0x3fffe8, 22 }, { 0x1ffffec, 25 },
+			{ 0x3ffffe2, 26 }, { 0x3ffffe3, 26 }, { 0x3ffffe4, 26 }, { 0x7ffffde, 27 }, { 0x7ffffdf, 27 }, { 0x3ffffe5, 26 }, { 0xfffff1, 24 }, { 0x1ffffed, 25 },
+			{ 0x7fff2, 19 }, { 0x1fffe3, 21 }, { 0x3ffffe6, 26 }, { 0x7ffffe0, 27 }, { 0x7ffffe1, 27 }, { 0x3ffffe7, 26 }, { 0x7ffffe2, 27 }, { 0xfffff2, 24 },
+			{ 0x1fffe4, 21 }, { 0x1fffe5, 21 }, { 0x3ffffe8, 26 }, { 0x3ffffe9, 26 }, { 0xffffffd, 28 }, { 0x7ffffe3, 27 }, { 0x7ffffe4, 27 }, { 0x7ffffe5, 27 },
+			{ 0xfffec, 20 }, { 0xfffff3, 24 }, { 0xfffed, 20 }, { 0x1fffe6, 21 }, { 0x3fffe9, 22 }, { 0x1fffe7, 21 }, { 0x1fffe8, 21 }, { 0x7ffff3, 23 },
+			{ 0x3fffea, 22 }, { 0x3fffeb, 22 }, { 0x1ffffee, 25 }, { 0x1ffffef, 25 }, { 0xfffff4, 24 }, { 0xfffff5, 24 }, { 0x3ffffea, 26 }, { 0x7ffff4, 23 },
+			{ 0x3ffffeb, 26 }, { 0x7ffffe6, 27 }, { 0x3ffffec, 26 }, { 0x3ffffed, 26 }, { 0x7ffffe7, 27 }, { 0x7ffffe8, 27 }, { 0x7ffffe9, 27 }, { 0x7ffffea, 27 },
+			{ 0x7ffffeb, 27 }, { 0xffffffe, 28 }, { 0x7ffffec, 27 }, { 0x7ffffed, 27 }, { 0x7ffffee, 27 }, { 0x7ffffef, 27 }, { 0x7fffff0, 27 }, { 0x3ffffee, 26 },		};
+		return codes;
+	}
+
+	// binary tree of the codes, a node is a leaf if its children are -1 and then holds its byte
+	struct HuffmanNode
+	{
+		int child[2];
+		int symbol;
+	};
+
+	inline const std::vector<HuffmanNode>& huffmanTree()
+	{
+		static const std::vector<HuffmanNode> tree = []()
+		{
+			std::vector<HuffmanNode> nodes(1, HuffmanNode{ { -1, -1 }, -1 });
+			auto codes = huffmanCodes();
+			for (int symbol = 0; symbol < 256; symbol++)
+			{
+				int node = 0;
+				for (int bit = codes[symbol].bits - 1; bit >= 0; bit--)
+				{
+					int b = (codes[symbol].code >> bit) & 1;
+					if (nodes[node].child[b] < 0)
+					{
+						nodes[node].child[b] = (int)nodes.size();
+						nodes.push_back(HuffmanNode{ { -1, -1 }, -1 });
+					}
+					node = nodes[node].child[b];
+				}
+				nodes[node].symbol = symbol;
+			}
+			return nodes;
+		}();
+		return tree;
+	}
+
+	// false for a code that is not in the table, the end of string code or padding that is not the start of it
+	inline bool huffmanDecode(const uint8_t* data, size_t length, std::string& out)
+	{
+		auto& tree = huffmanTree();
+		int node = 0;
+		// bits read since the last symbol and whether all of them were ones
+		int pending = 0;
+		bool ones = true;
+		for (size_t i = 0; i < length; i++)
+		{
+			for (int bit = 7; bit >= 0; bit--)
+			{
+				int b = (data[i] >> bit) & 1;
+				node = tree[node].child[b];
+				if (node < 0)
+					return false;
+				pending++;
+				ones = ones && b;
+				if (tree[node].symbol >= 0)
+				{
+					out += char(tree[node].symbol);
+					node = 0;
+					pending = 0;
+					ones = true;
+				}
+			}
+		}
+		return pending <= 7 && ones;
+	}
+
+	// integer with an N bit prefix in the first byte, the remaining bits of that byte are left as they are
+	inline void encodeInteger(std::string& out, uint8_t first, int prefixBits, uint64_t value)
+	{
+		uint64_t max = (1u << prefixBits) - 1;
+		if (value < max)
+		{
+			out += char(first | value);
+			return;
+		}
+		out += char(first | max);
+		value -= max;
+		while (value >= 128)
+		{
+			out += char(value % 128 + 128);
+			value /= 128;
+		}
+		out += char(value);
+	}
+
+	inline bool decodeInteger(const uint8_t*& p, const uint8_t* end, int prefixBits, uint64_t& value)
+	{
+		if (p == end)
+			return false;
+		uint64_t max = (1u << prefixBits) - 1;
+		value = *p++ & max;
+		if (value < max)
+			return true;
+		for (int shift = 0; p != end && shift <= 28; shift += 7)
+		{
+			uint8_t b = *p++;
+			value += uint64_t(b & 127) << shift;
+			if (!(b & 128))
+				return true;
+		}
+		return false;
+	}
+}
+
+class HpackDecoder
+{
+public:
+	// maxTableSize is the SETTINGS_HEADER_TABLE_SIZE sent to the peer
+	explicit HpackDecoder(size_t maxTableSize = 4096) : maxSize(maxTableSize), limit(maxTableSize), size(0) {}
+
+	// one complete header block, appended to headers. False on a compression error, which ends the connection
+	bool decode(const char* data, size_t length, HeaderList& headers)
+	{
+		auto p = reinterpret_cast<const uint8_t*>(data);
+		auto end = p + length;
+		while (p != end)
+		{
+			uint64_t index;
+			if (*p & 0x80)
+			{
+				// indexed field
+				if (!hpack::decodeInteger(p, end, 7, index) || index == 0 || !entry(index, headers))
+					return false;
+				continue;
+			}
+			if ((*p & 0xe0) == 0x20)
+			{
+				// table size update
+				if (!hpack::decodeInteger(p, end, 5, index) || index > maxSize)
+					return false;
+				limit = (size_t)index;
+				evict(0);
+				continue;
+			}
+
+			bool indexed = (*p & 0xc0) == 0x40;
+			if (!hpack::decodeInteger(p, end, indexed ? 6 : 4, index))
+				return false;
+			std::pair<std::string, std::string> field;
+			if (index > 0)
+			{
+				HeaderList name;
+				if (!entry(index, name))
+					return false;
+				field.first = name[0].first;
+			}
+			else if (!decodeString(p, end, field.first))
+				return false;
+			if (!decodeString(p, end, field.second))
+				return false;
+			if (indexed)
+				insert(field);
+			headers.push_back(std::move(field));
+		}
+		return true;
+	}
+
+private:
+	size_t maxSize;
+	// the size the peer chose with its last table size update
+	size_t limit;
+	size_t size;
+	// newest first, index 62 is its front
+	std::deque<std::pair<std::string, std::string>> table;
+
+	bool entry(uint64_t index, HeaderList& headers) const
+	{
+		if (index <= hpack::staticTableSize)
+		{
+			auto& field = hpack::staticTable()[index - 1];
+			headers.push_back({ field.first, field.second });
+			return true;
+		}
+		index -= hpack::staticTableSize + 1;
+		if (index >= table.size())
+			return false;
+		headers.push_back(table[(size_t)index]);
+		return true;
+	}
+
+	static size_t entrySize(const std::pair<std::string, std::string>& field)
+	{
+		return field.first.size() + field.second.size() + 32;
+	}
+
+	// drop the oldest entries until extra more bytes fit
+	void evict(size_t extra)
+	{
+		while (!table.empty() && size + extra > limit)
+		{
+			size -= entrySize(table.back());
+			table.pop_back();
+		}
+	}
+
+	// an entry larger than the table empties it and is not kept
+	void insert(const std::pair<std::string, std::string>& field)
+	{
+		auto fieldSize = entrySize(field);
+		evict(fieldSize);
+		if (fieldSize > limit)
+			return;
+		table.push_front(field);
+		size += fieldSize;
+	}
+
+	static bool decodeString(const uint8_t*& p, const uint8_t* end, std::string& out)
+	{
+		if (p == end)
+			return false;
+		bool huffman = (*p & 0x80) != 0;
+		uint64_t length;
+		if (!hpack::decodeInteger(p, end, 7, length) || length > uint64_t(end - p))
+			return false;
+		if (huffman)
+		{
+			if (!hpack::huffmanDecode(p, (size_t)length, out))
+				return false;
+		}
+		else
+			out.assign(reinterpret_cast<const char*>(p), (size_t)length);
+		p += length;
+		return true;
+	}
+};
+
+class HpackEncoder
+{
+public:
+	// fields of the static table by reference, all others as literals that are not added to the table. Names are
+	// written in lower case
+	static void encode(const HeaderList& headers, std::string& block)
+	{
+		auto table = hpack::staticTable();
+		for (auto& field : headers)
+		{
+			std::string name = field.first;
+			std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+			size_t nameIndex = 0;
+			size_t fieldIndex = 0;
+			for (size_t i = 0; i < hpack::staticTableSize && fieldIndex == 0; i++)
+			{
+				if (name != table[i].first)
+					continue;
+				if (nameIndex == 0)
+					nameIndex = i + 1;
+				if (field.second == table[i].second)
+					fieldIndex = i + 1;
+			}
+
+			if (fieldIndex > 0)
+			{
+				hpack::encodeInteger(block, 0x80, 7, fieldIndex);
+				continue;
+			}
+			hpack::encodeInteger(block, 0, 4, nameIndex);
+			if (nameIndex == 0)
+				appendString(block, name);
+			appendString(block, field.second);
+		}
+	}
+
+private:
+	static void appendString(std::string& block, const std::string& s)
+	{
+		hpack::encodeInteger(block, 0, 7, s.size());
+		block += s;
+	}
+};
+
+// the dependency tree of the streams of a connection, RFC 7540 5.3. The root is stream 0. It keeps at most capacity
+// streams, as every PRIORITY frame of a peer may name another one
+class PriorityTree
+{
+public:
+	typedef std::function<bool(uint32_t stream)> Ready;
+
+	explicit PriorityTree(size_t capacity = 1024) : capacity(capacity) { nodes[0] = Node(); }
+
+	bool contains(uint32_t stream) const
+	{
+		return stream != 0 && nodes.count(stream) != 0;
+	}
+
+	bool full() const
+	{
+		return nodes.size() > capacity;
+	}
+
+	// adds stream or moves it with its dependents, false if it is new and the tree is full. A dependency on a stream
+	// the tree does not know is one on the root with the default weight, a dependency on one of its own dependents
+	// first moves that one to its place
+	bool set(uint32_t stream, StreamPriority priority)
+	{
+		if (stream == 0 || priority.dependency == stream)
+			return true;
+		if (!nodes.count(stream) && full())
+			return false;
+		if (!nodes.count(priority.dependency))
+			priority = StreamPriority{ 0, false, 16 };
+
+		if (!nodes.count(stream))
+			nodes[stream] = Node();
+		else
+		{
+			for (auto p = nodes[priority.dependency].parent; priority.dependency != 0 && p != 0; p = nodes[p].parent)
+				if (p == stream)
+				{
+					reparent(priority.dependency, nodes[stream].parent);
+					break;
+				}
+			detach(stream);
+		}
+
+		auto& node = nodes[stream];
+		node.weight = std::max(1, std::min(256, priority.weight));
+		if (priority.exclusive)
+		{
+			auto children = nodes[priority.dependency].children;
+			for (auto child : children)
+				reparent(child, stream);
+		}
+		attach(stream, priority.dependency);
+		return true;
+	}
+
+	// removes stream, its dependents take its place
+	void remove(uint32_t stream)
+	{
+		if (!contains(stream))
+			return;
+		auto parent = nodes[stream].parent;
+		auto children = nodes[stream].children;
+		for (auto child : children)
+			reparent(child, parent);
+		detach(stream);
+		nodes.erase(stream);
+	}
+
+	// removes every stream stale takes, of closed streams or idle ones that were never opened
+	void prune(const Ready& stale)
+	{
+		std::vector<uint32_t> streams;
+		for (auto& node : nodes)
+			if (node.first != 0 && stale(node.first))
+				streams.push_back(node.first);
+		for (auto stream : streams)
+			remove(stream);
+	}
+
+	// the stream to send for next among those ready takes, 0 if there is none. A ready stream goes before the
+	// streams depending on it, dependents of the same stream share by weight in the bytes they were sent: the
+	// dependents are searched by the lowest pass first, depth first without recursion as the tree may be deep
+	uint32_t next(const Ready& ready) const
+	{
+		std::vector<uint32_t> pending(1, 0);
+		std::vector<uint32_t> children;
+		while (!pending.empty())
+		{
+			auto stream = pending.back();
+			pending.pop_back();
+			if (stream != 0 && ready(stream))
+				return stream;
+			children = nodes.at(stream).children;
+			std::stable_sort(children.begin(), children.end(), [this](uint32_t a, uint32_t b) { return nodes.at(a).pass < nodes.at(b).pass; });
+			pending.insert(pending.end(), children.rbegin(), children.rend());
+		}
+		return 0;
+	}
+
+	// bytes sent for stream, counted for it and every stream it depends on
+	void sent(uint32_t stream, size_t bytes)
+	{
+		for (auto s = stream; s != 0 && nodes.count(s); s = nodes[s].parent)
+			nodes[s].pass += double(bytes) / nodes[s].weight;
+	}
+
+private:
+	struct Node
+	{
+		uint32_t parent = 0;
+		int weight = 16;
+		// bytes sent by weight, the dependent with the lowest goes next
+		double pass = 0;
+		std::vector<uint32_t> children;
+	};
+	std::map<uint32_t, Node> nodes;
+	size_t capacity;
+
+	// a new dependent starts with the lowest pass among its siblings, so it neither waits for them nor overtakes them
+	void attach(uint32_t stream, uint32_t parent)
+	{
+		auto& siblings = nodes[parent].children;
+		double pass = 0;
+		for (size_t i = 0; i < siblings.size(); i++)
+			pass = i == 0 ? nodes[siblings[i]].pass : std::min(pass, nodes[siblings[i]].pass);
+		nodes[stream].parent = parent;
+		nodes[stream].pass = pass;
+		siblings.push_back(stream);
+	}
+
+	void detach(uint32_t stream)
+	{
+		auto& siblings = nodes[nodes[stream].parent].children;
+		siblings.erase(std::remove(siblings.begin(), siblings.end(), stream), siblings.end());
+	}
+
+	void reparent(uint32_t stream, uint32_t parent)
+	{
+		detach(stream);
+		attach(stream, parent);
+	}
+};
+}
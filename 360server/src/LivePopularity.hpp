@@ -0,0 +1,152 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Tile popularity of the current audience. Players upload how many of
+	their viewport samples fell into each tile of the segments they
+	played, the server keeps the sums per MPD and segment and lets them
+	decay with a half life, so what is served follows who is watching
+	now rather than everyone who ever did.
+
+	Uploads and answers are lines "segment count,count,..." with the
+	segment 0-based and one count per tile.
+*/
+#pragma once
+
+#include <map>
+#include <cmath>
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+#include "MpdIndex.hpp"
+
+class LivePopularity
+{
+public:
+	LivePopularity(double halfLifeSeconds) : halfLife(halfLifeSeconds)
+	{
+	}
+
+	void setHalfLife(double seconds)
+	{
+		std::lock_guard<std::mutex> l(mtx);
+		halfLife = seconds;
+	}
+
+	// adds the lines of an upload for an MPD, returns the number of segments they held
+	size_t add(const std::string& mpdPath, const std::string& summary)
+	{
+		auto counts = parse(summary);
+		double now = nowSeconds();
+		std::lock_guard<std::mutex> l(mtx);
+		auto& segments = mpds[mpdPath];
+		for (auto& upload : counts)
+		{
+			auto& segment = segments[upload.first];
+			decay(segment, now);
+			if (segment.counts.size() < upload.second.size())
+				segment.counts.resize(upload.second.size(), 0);
+			for (size_t t = 0; t < upload.second.size(); t++)
+				segment.counts[t] += upload.second[t];
+		}
+		return counts.size();
+	}
+
+	// decayed counts of the segments from first on, at most count of them; segments nobody watched are left out
+	std::string write(const std::string& mpdPath, int first = 0, int count = -1)
+	{
+		double now = nowSeconds();
+		std::ostringstream ss;
+		std::lock_guard<std::mutex> l(mtx);
+		auto mpd = mpds.find(mpdPath);
+		if (mpd == mpds.end())
+			return "";
+		for (auto it = mpd->second.lower_bound(first); it != mpd->second.end() && (count < 0 || it->first < first + count); ++it)
+		{
+			decay(it->second, now);
+			ss << it->first << " ";
+			for (size_t t = 0; t < it->second.counts.size(); t++)
+				ss << (t ? "," : "") << it->second.counts[t];
+			ss << "\n";
+		}
+		return ss.str();
+	}
+
+	// counts per segment of lines "segment count,count,...", malformed lines are skipped
+	static std::map<int, std::vector<double>> parse(const std::string& text)
+	{
+		std::map<int, std::vector<double>> counts;
+		std::istringstream lines(text);
+		std::string line;
+		while (std::getline(lines, line))
+		{
+			std::istringstream ls(line);
+			int segment;
+			if (!(ls >> segment) || segment < 0)
+				continue;
+			std::vector<double> tiles;
+			double c;
+			char sep;
+			while (ls >> c)
+			{
+				tiles.push_back(std::max(0.0, c));
+				ls >> sep;
+			}
+			if (!tiles.empty())
+				counts[segment] = tiles;
+		}
+		return counts;
+	}
+
+	// quality per tile like the <Popularity> element computes it: the most watched tile gets the best quality,
+	// the others one level lower per share of its count they miss, unwatched tiles the lowest
+	static std::map<int, std::vector<int>> qualities(const std::map<int, std::vector<double>>& counts, const MpdIndex& index)
+	{
+		std::map<int, std::vector<int>> result;
+		for (auto& segment : counts)
+		{
+			double max = std::max(1e-9, *std::max_element(segment.second.begin(), segment.second.end()));
+			auto& quality = result[segment.first];
+			for (size_t t = 0; t < index.urls.size(); t++)
+			{
+				int levels = (int)index.urls[t].size();
+				double count = t < segment.second.size() ? segment.second[t] : 0;
+				quality.push_back(std::max(0, std::min(levels - 1, (int)(levels - levels * (count / max)))));
+			}
+		}
+		return result;
+	}
+
+private:
+	struct Segment
+	{
+		std::vector<double> counts;
+		// seconds of the last decay
+		double updated = 0;
+	};
+
+	std::mutex mtx;
+	double halfLife;
+	// segments by MPD path
+	std::map<std::string, std::map<int, Segment>> mpds;
+
+	// brings counts to now, a half life of 0 keeps them forever
+	void decay(Segment& segment, double now)
+	{
+		if (halfLife > 0 && segment.updated > 0)
+		{
+			double factor = std::exp2(-(now - segment.updated) / halfLife);
+			for (auto& c : segment.counts)
+				c *= factor;
+		}
+		segment.updated = now;
+	}
+
+	static double nowSeconds()
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+};
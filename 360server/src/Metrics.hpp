@@ -0,0 +1,104 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Counters, gauges and histograms in the Prometheus text format.
+	Values are plain atomics updated where they are measured, a scrape
+	reads them without stopping the measuring threads.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <memory>
+#include <sstream>
+#include <algorithm>
+
+namespace Metrics
+{
+// histogram with fixed upper bounds, observing is one atomic increment per bucket hit plus the sum
+class Histogram
+{
+public:
+	Histogram(std::vector<double> bounds) : bounds(std::move(bounds)), counts(new std::atomic<unsigned long long>[this->bounds.size() + 1]), sumMicro(0)
+	{
+		for (size_t i = 0; i <= this->bounds.size(); i++)
+			counts[i] = 0;
+	}
+
+	void observe(double value)
+	{
+		// the first bound not below value, a value equal to a bound is counted in its bucket
+		size_t bucket = std::lower_bound(bounds.begin(), bounds.end(), value) - bounds.begin();
+		counts[bucket].fetch_add(1, std::memory_order_relaxed);
+		sumMicro.fetch_add((long long)(value * 1e6), std::memory_order_relaxed);
+	}
+
+	// cumulative buckets, count and sum of name
+	void write(std::ostream& os, const std::string& name, const std::string& help, const std::string& labels = "") const
+	{
+		os << "# HELP " << name << " " << help << "\n# TYPE " << name << " histogram\n";
+		std::string sep = labels.empty() ? "" : ",";
+		unsigned long long cumulative = 0;
+		for (size_t i = 0; i <= bounds.size(); i++)
+		{
+			cumulative += counts[i].load(std::memory_order_relaxed);
+			os << name << "_bucket{" << labels << sep << "le=\"";
+			if (i < bounds.size())
+				os << bounds[i];
+			else
+				os << "+Inf";
+			os << "\"} " << cumulative << "\n";
+		}
+		os << name << "_sum" << braces(labels) << " " << sumMicro.load(std::memory_order_relaxed) / 1e6 << "\n";
+		os << name << "_count" << braces(labels) << " " << cumulative << "\n";
+	}
+
+private:
+	std::vector<double> bounds;
+	std::unique_ptr<std::atomic<unsigned long long>[]> counts;
+	std::atomic<long long> sumMicro;
+
+	static std::string braces(const std::string& labels)
+	{
+		return labels.empty() ? "" : "{" + labels + "}";
+	}
+};
+
+// seconds from 1 ms to 10 s
+inline std::vector<double> latencyBounds()
+{
+	return { 0.001, 0.002, 0.005, 0.01, 0.02, 0.05, 0.1, 0.2, 0.5, 1, 2, 5, 10 };
+}
+
+inline void header(std::ostream& os, const std::string& name, const std::string& help, const char* type)
+{
+	os << "# HELP " << name << " " << help << "\n# TYPE " << name << " " << type << "\n";
+}
+
+// a sample of a metric whose header was written, labels like tile="3",quality="0"
+template<class T>
+inline void sample(std::ostream& os, const std::string& name, T value, const std::string& labels = "")
+{
+	os << name;
+	if (!labels.empty())
+		os << "{" << labels << "}";
+	os << " " << value << "\n";
+}
+
+template<class T>
+inline void counter(std::ostream& os, const std::string& name, const std::string& help, T value)
+{
+	header(os, name, help, "counter");
+	sample(os, name, value);
+}
+
+template<class T>
+inline void gauge(std::ostream& os, const std::string& name, const std::string& help, T value)
+{
+	header(os, name, help, "gauge");
+	sample(os, name, value);
+}
+}
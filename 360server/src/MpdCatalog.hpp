@@ -0,0 +1,361 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Every static MPD below the www directory, read and indexed once at
+	startup. An entry keeps the MPD as it is served, its gzip encoding
+	when the server is built with zlib and an ETag of its content, and
+	the same for its compiled form: there every <SegmentList> whose
+	files are numbered one after the other is replaced by the
+	<SegmentTemplate> that names the same files, so its size does not
+	grow with the length of the video. The compiled form is only kept
+	if MpdIndex finds the same segment urls in it as in the original.
+	A file changed on disk is read again by the next request for it;
+	dynamic MPDs are left to the static file handler, they change
+	while they are played.
+*/
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <regex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cctype>
+#include <cstdio>
+#include <sstream>
+#include <fstream>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+
+#include "httplib.h"
+#include "MpdIndex.hpp"
+
+class MpdCatalog
+{
+public:
+	// one way of sending an MPD
+	struct Variant
+	{
+		std::string body;
+		// empty without zlib
+		std::string gzip;
+		std::string etag;
+	};
+
+	struct Entry
+	{
+		Variant original;
+		Variant compiled;
+		std::shared_ptr<const MpdIndex> index;
+		// modification time and size of the file the entry was read from
+		long long mtime = 0;
+		long long size = 0;
+	};
+
+	// reads every MPD below wwwDir, returns their number
+	size_t build(const std::string& wwwDir)
+	{
+		std::vector<std::string> paths;
+		walk(wwwDir, "", paths);
+
+		std::lock_guard<std::mutex> l(mtx);
+		dir = wwwDir;
+		entries.clear();
+		for (auto& path : paths)
+		{
+			auto entry = read(path);
+			if (entry)
+				entries[path] = entry;
+		}
+		return entries.size();
+	}
+
+	// the entry of the MPD at path below the www directory, read again if the file changed; nullptr if it is not in the catalog
+	std::shared_ptr<const Entry> find(const std::string& path)
+	{
+		std::lock_guard<std::mutex> l(mtx);
+		auto it = entries.find(path);
+		if (it == entries.end())
+			return nullptr;
+
+		long long mtime, size;
+		if (!fileStat(dir + path, mtime, size))
+		{
+			entries.erase(it);
+			return nullptr;
+		}
+		if (mtime != it->second->mtime || size != it->second->size)
+		{
+			auto entry = read(path);
+			if (!entry)
+			{
+				entries.erase(it);
+				return nullptr;
+			}
+			it->second = entry;
+		}
+		return it->second;
+	}
+
+	// answers GET and HEAD of a catalogued MPD and of its compiled form under /index, false for every other request
+	bool serve(const httplib::Request& req, httplib::Response& res)
+	{
+		static const std::string indexPrefix = "/index/";
+		// tile requests go on to the files without taking the lock
+		if (req.path.size() < 4 || req.path.compare(req.path.size() - 4, 4, ".mpd") != 0)
+			return false;
+		bool compiled = req.path.compare(0, indexPrefix.size(), indexPrefix) == 0;
+		auto entry = find(compiled ? req.path.substr(indexPrefix.size() - 1) : req.path);
+		if (!entry)
+			return false;
+
+		auto& variant = compiled ? entry->compiled : entry->original;
+		res.set_header("ETag", variant.etag.c_str());
+		res.set_header("Vary", "Accept-Encoding");
+		auto match = req.get_header_value("If-None-Match");
+		if (match.find(variant.etag) != std::string::npos || match == "*")
+		{
+			res.status = 304;
+			return true;
+		}
+
+		res.status = 200;
+		if (!variant.gzip.empty() && req.get_header_value("Accept-Encoding").find("gzip") != std::string::npos)
+		{
+			res.set_header("Content-Encoding", "gzip");
+			res.set_content(variant.gzip, "application/dash+xml");
+		}
+		else
+			res.set_content(variant.body, "application/dash+xml");
+		return true;
+	}
+
+	// one line per MPD: path, tiles, representations of the first tile, segments, bytes of the original and of the compiled form
+	std::string list()
+	{
+		std::lock_guard<std::mutex> l(mtx);
+		std::stringstream ss;
+		for (auto& e : entries)
+		{
+			auto& urls = e.second->index->urls;
+			size_t representations = urls.empty() ? 0 : urls[0].size();
+			size_t segments = representations == 0 ? 0 : urls[0][0].size();
+			ss << e.first << " " << urls.size() << " " << representations << " " << segments << " "
+				<< e.second->original.body.size() << " " << e.second->compiled.body.size() << "\n";
+		}
+		return ss.str();
+	}
+
+	// indices of all catalogued MPDs by path
+	std::map<std::string, std::shared_ptr<const MpdIndex>> indices()
+	{
+		std::lock_guard<std::mutex> l(mtx);
+		std::map<std::string, std::shared_ptr<const MpdIndex>> result;
+		for (auto& e : entries)
+			result[e.first] = e.second->index;
+		return result;
+	}
+
+	// the MPD with every consecutively numbered <SegmentList> written as <SegmentTemplate>, lists of any other form stay
+	static std::string compile(const std::string& mpd)
+	{
+		static const std::regex media(R"re(<SegmentURL[^>]*media="([^"]*)")re");
+		static const std::regex initialization(R"re(<Initialization[^>]*sourceURL="([^"]*)")re");
+		static const std::regex startNumber(R"re(\sstartNumber="(\d+)")re");
+		static const std::string open = "<SegmentList", close = "</SegmentList>";
+
+		// the lists are found without a regular expression, a long one would exhaust its matcher's stack
+		std::string result;
+		size_t last = 0;
+		for (size_t begin = mpd.find(open); begin != std::string::npos; begin = mpd.find(open, begin + open.size()))
+		{
+			size_t tagEnd = mpd.find('>', begin);
+			size_t end = tagEnd == std::string::npos ? std::string::npos : mpd.find(close, tagEnd);
+			if (end == std::string::npos)
+				break;
+			// not <SegmentListSomething> and not an empty <SegmentList/>
+			char next = mpd[begin + open.size()];
+			if ((next != '>' && !isspace((unsigned char)next)) || mpd[tagEnd - 1] == '/')
+				continue;
+			std::string attrs = mpd.substr(begin + open.size(), tagEnd - begin - open.size());
+			std::string children = mpd.substr(tagEnd + 1, end - tagEnd - 1);
+
+			// a list starting later than the first segment is counted differently by players than a template, it stays
+			std::smatch start;
+			if (std::regex_search(attrs, start, startNumber) && start[1] != "1")
+				continue;
+
+			std::vector<std::string> urls;
+			for (auto u = std::sregex_iterator(children.begin(), children.end(), media); u != std::sregex_iterator(); ++u)
+				urls.push_back((*u)[1]);
+			std::string templ = numberTemplate(urls);
+			if (templ.empty())
+				continue;
+
+			result.append(mpd, last, begin - last);
+			result += "<SegmentTemplate" + attrs + " media=\"" + templ + "\"";
+			std::smatch init;
+			if (std::regex_search(children, init, initialization))
+				result += " initialization=\"" + escape(init[1]) + "\"";
+			result += "/>";
+			last = end + close.size();
+		}
+		result.append(mpd, last, std::string::npos);
+		return result;
+	}
+
+private:
+	std::mutex mtx;
+	std::string dir;
+	std::map<std::string, std::shared_ptr<const Entry>> entries;
+
+	std::shared_ptr<const Entry> read(const std::string& path) const
+	{
+		static const std::regex dynamic(R"re(<MPD[^>]*\stype="dynamic")re");
+
+		auto entry = std::make_shared<Entry>();
+		if (!fileStat(dir + path, entry->mtime, entry->size))
+			return nullptr;
+		std::ifstream file(dir + path, std::ios::binary);
+		if (!file)
+			return nullptr;
+		std::stringstream ss;
+		ss << file.rdbuf();
+		std::string mpd = ss.str();
+		if (std::regex_search(mpd, dynamic))
+			return nullptr;
+
+		auto index = std::make_shared<MpdIndex>(mpd);
+		std::string compiled = compile(mpd);
+		if (compiled != mpd && MpdIndex(compiled).urls != index->urls)
+			compiled = mpd;
+		entry->index = index;
+		entry->original = variant(std::move(mpd));
+		entry->compiled = variant(std::move(compiled));
+		return entry;
+	}
+
+	static Variant variant(std::string body)
+	{
+		Variant v;
+		v.etag = etag(body);
+#ifdef CPPHTTPLIB_ZLIB_SUPPORT
+		v.gzip = body;
+		httplib::detail::compress(v.gzip);
+#endif
+		v.body = std::move(body);
+		return v;
+	}
+
+	// FNV-1a of the content, quoted as a strong validator
+	static std::string etag(const std::string& body)
+	{
+		unsigned long long hash = 14695981039346656037ull;
+		for (unsigned char c : body)
+		{
+			hash ^= c;
+			hash *= 1099511628211ull;
+		}
+		char tag[20];
+		snprintf(tag, sizeof(tag), "\"%016llx\"", hash);
+		return tag;
+	}
+
+	static std::string escape(const std::string& url)
+	{
+		std::string result;
+		for (char c : url)
+			result += c == '$' ? "$$" : std::string(1, c);
+		return result;
+	}
+
+	// media template of urls if they differ only in one number counting up from 1, empty otherwise
+	static std::string numberTemplate(const std::vector<std::string>& urls)
+	{
+		if (urls.empty())
+			return "";
+		// the last run of digits in the first url that holds 1 and fits the others is taken to be the number
+		const std::string& url = urls[0];
+		for (size_t end = url.size(); end > 0; end--)
+		{
+			if (!isdigit((unsigned char)url[end - 1]))
+				continue;
+			size_t begin = end;
+			while (begin > 0 && isdigit((unsigned char)url[begin - 1]))
+				begin--;
+			std::string run = url.substr(begin, end - begin);
+			end = begin + 1;
+			if (run.find_first_not_of('0') != run.size() - 1 || run.back() != '1')
+				continue;
+
+			std::string prefix = url.substr(0, begin), suffix = url.substr(begin + run.size());
+			int width = run.size() > 1 && run[0] == '0' ? (int)run.size() : 0;
+			bool matches = true;
+			char digits[24];
+			for (size_t i = 0; i < urls.size() && matches; i++)
+			{
+				int n = snprintf(digits, sizeof(digits), "%0*u", width, 1 + (unsigned)i);
+				matches = urls[i].size() == prefix.size() + n + suffix.size()
+					&& urls[i].compare(0, prefix.size(), prefix) == 0
+					&& urls[i].compare(prefix.size(), n, digits) == 0
+					&& urls[i].compare(prefix.size() + n, suffix.size(), suffix) == 0;
+			}
+			if (matches)
+				return escape(prefix) + (width > 0 ? "$Number%0" + std::to_string(width) + "d$" : "$Number$") + escape(suffix);
+		}
+		return "";
+	}
+
+	static bool fileStat(const std::string& path, long long& mtime, long long& size)
+	{
+		struct stat st;
+		if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+			return false;
+		mtime = (long long)st.st_mtime;
+		size = (long long)st.st_size;
+		return true;
+	}
+
+	// paths of the .mpd files below dir + relative, relative to dir and starting with /
+	static void walk(const std::string& dir, const std::string& relative, std::vector<std::string>& paths)
+	{
+		auto visit = [&](const std::string& name, bool isDir)
+		{
+			if (name == "." || name == "..")
+				return;
+			std::string path = relative + "/" + name;
+			if (isDir)
+				walk(dir, path, paths);
+			else if (name.size() > 4 && name.compare(name.size() - 4, 4, ".mpd") == 0)
+				paths.push_back(path);
+		};
+#ifdef _WIN32
+		WIN32_FIND_DATAA data;
+		HANDLE h = FindFirstFileA((dir + relative + "/*").c_str(), &data);
+		if (h == INVALID_HANDLE_VALUE)
+			return;
+		do
+			visit(data.cFileName, (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0);
+		while (FindNextFileA(h, &data));
+		FindClose(h);
+#else
+		DIR* d = opendir((dir + relative).c_str());
+		if (!d)
+			return;
+		while (auto e = readdir(d))
+		{
+			struct stat st;
+			std::string name = e->d_name;
+			if (stat((dir + relative + "/" + name).c_str(), &st) == 0)
+				visit(name, S_ISDIR(st.st_mode));
+		}
+		closedir(d);
+#endif
+	}
+};
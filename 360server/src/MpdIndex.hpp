@@ -0,0 +1,179 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Segment urls and popularity lists of an MPD, found with a few
+	regular expressions instead of a full XML parse. Enough for the
+	server and the cache to name the files of a tile and quality.
+	Representations with a <SegmentTemplate>, their own or the one of
+	their adaptation set, get the urls of its $Number$ expanded over
+	the mediaPresentationDuration.
+*/
+#pragma once
+
+#include <map>
+#include <regex>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <sstream>
+
+struct MpdIndex
+{
+	// segment files per tile and representation, relative to the www directory
+	std::vector<std::vector<std::vector<std::string>>> urls;
+	// quality per tile of the <Popularity> element by 0-based segment
+	std::map<int, std::vector<int>> popularity;
+
+	MpdIndex() {}
+
+	explicit MpdIndex(const std::string& mpd)
+	{
+		static const std::regex token(R"re(<(AdaptationSet|Representation)(\s[^>]*)?>|<SegmentURL[^>]*media="([^"]*)"|<SegmentPopularity([^>]*)>|<SegmentTemplate([^>]*)>)re");
+		static const std::regex segmentAttr(R"re(segment="(\d+)")re");
+		static const std::regex qualityAttr(R"re(tileQuality="([^"]*)")re");
+		// templates of the adaptation sets and representations, and the attributes of the representations
+		std::vector<std::string> setTemplates;
+		std::vector<std::vector<std::string>> templates, representations;
+		for (auto it = std::sregex_iterator(mpd.begin(), mpd.end(), token); it != std::sregex_iterator(); ++it)
+		{
+			auto& m = *it;
+			if (m[1] == "AdaptationSet")
+			{
+				urls.emplace_back();
+				setTemplates.emplace_back();
+				templates.emplace_back();
+				representations.emplace_back();
+			}
+			else if (m[1] == "Representation" && !urls.empty())
+			{
+				urls.back().emplace_back();
+				templates.back().emplace_back();
+				representations.back().push_back(m[2]);
+			}
+			else if (m[3].matched && !urls.empty() && !urls.back().empty())
+				urls.back().back().push_back(m[3]);
+			else if (m[4].matched)
+			{
+				std::string attrs = m[4];
+				std::smatch segment, quality;
+				if (!std::regex_search(attrs, segment, segmentAttr) || !std::regex_search(attrs, quality, qualityAttr))
+					continue;
+				std::istringstream qs(quality[1].str());
+				std::vector<int> qualities;
+				int q; char c;
+				while (qs >> q)
+				{
+					qualities.push_back(q);
+					qs >> c;
+				}
+				popularity[std::stoi(segment[1]) - 1] = qualities;
+			}
+			else if (m[5].matched && !urls.empty())
+				(urls.back().empty() ? setTemplates.back() : templates.back().back()) = m[5];
+		}
+
+		double seconds = presentationSeconds(mpd);
+		for (size_t t = 0; t < urls.size(); t++)
+			for (size_t r = 0; r < urls[t].size(); r++)
+			{
+				auto& templ = templates[t][r].empty() ? setTemplates[t] : templates[t][r];
+				if (urls[t][r].empty() && !templ.empty())
+					urls[t][r] = expand(templ, attribute(representations[t][r], "id"), attribute(representations[t][r], "bandwidth"), seconds);
+			}
+	}
+
+	// url of segment of a tile and representation, empty if the MPD has none
+	std::string segmentUrl(size_t tile, size_t quality, size_t segment) const
+	{
+		if (tile >= urls.size() || quality >= urls[tile].size() || segment >= urls[tile][quality].size())
+			return "";
+		return "/" + urls[tile][quality][segment];
+	}
+
+	// urls of the representations the <Popularity> element recommends
+	std::vector<std::string> popularUrls() const
+	{
+		std::vector<std::string> result;
+		for (auto& segment : popularity)
+			for (size_t tile = 0; tile < segment.second.size(); tile++)
+			{
+				int quality = segment.second[tile];
+				auto url = quality < 0 ? "" : segmentUrl(tile, quality, segment.first);
+				if (!url.empty())
+					result.push_back(url);
+			}
+		return result;
+	}
+
+private:
+	static std::string attribute(const std::string& attrs, const std::string& name)
+	{
+		std::smatch m;
+		if (!std::regex_search(attrs, m, std::regex("(?:^|\\s)" + name + "=\"([^\"]*)\"")))
+			return "";
+		return m[1];
+	}
+
+	static double presentationSeconds(const std::string& mpd)
+	{
+		static const std::regex duration(R"re(mediaPresentationDuration="PT(?:([\d.]+)H)?(?:([\d.]+)M)?(?:([\d.]+)S)?")re");
+		std::smatch m;
+		if (!std::regex_search(mpd, m, duration))
+			return 0;
+		double seconds = 0;
+		for (int i = 1; i <= 3; i++)
+			if (m[i].matched)
+				seconds += std::stod(m[i]) * (i == 1 ? 3600 : i == 2 ? 60 : 1);
+		return seconds;
+	}
+
+	// the media urls of a template, with $RepresentationID$, $Bandwidth$, $Number$, $Number%0<width>d$
+	// and $$ filled in like DASH::SegmentList does
+	static std::vector<std::string> expand(const std::string& templ, const std::string& id, const std::string& bandwidth, double seconds)
+	{
+		auto number = [&](const std::string& name, double fallback)
+		{
+			auto value = attribute(templ, name);
+			return value.empty() ? fallback : std::stod(value);
+		};
+		double duration = number("duration", 0) / number("timescale", 1);
+		unsigned startNumber = (unsigned)number("startNumber", 1);
+		std::string media = attribute(templ, "media");
+		std::vector<std::string> result;
+		size_t count = duration > 0 ? (size_t)std::ceil(seconds / duration - 1e-9) : 0;
+		for (size_t s = 0; s < count; s++)
+		{
+			std::string url;
+			for (size_t i = 0; i < media.size(); i++)
+			{
+				size_t end = media[i] == '$' ? media.find('$', i + 1) : std::string::npos;
+				if (end == std::string::npos)
+				{
+					url += media[i];
+					continue;
+				}
+				std::string identifier = media.substr(i + 1, end - i - 1);
+				i = end;
+				if (identifier.empty())
+					url += '$';
+				else if (identifier == "RepresentationID")
+					url += id;
+				else if (identifier == "Bandwidth")
+					url += bandwidth;
+				else if (identifier.compare(0, 6, "Number") == 0)
+				{
+					char digits[16];
+					int width = identifier.size() > 7 && identifier[6] == '%' ? std::atoi(identifier.c_str() + 7) : 0;
+					url.append(digits, snprintf(digits, sizeof(digits), "%0*u", width, startNumber + (unsigned)s));
+				}
+				else
+					url += "$" + identifier + "$";
+			}
+			result.push_back(url);
+		}
+		return result;
+	}
+};
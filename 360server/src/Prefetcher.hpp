@@ -0,0 +1,340 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Fills the cache ahead of its viewers. For every MPD it follows, the
+	prefetcher notes the newest segment a client requested lately, the
+	one of the leading viewer, and fetches the most popular tile
+	representations of the next segments from the origin before anyone
+	asks for them. The tiles are ranked by the MPD's <Popularity>
+	element or by the live popularity of the server. Fetches are paced
+	to a byte rate and wait while requests of clients are fetched, so
+	they do not compete with demand for the origin.
+*/
+#pragma once
+
+#include <map>
+#include <set>
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <iterator>
+#include <algorithm>
+#include <unordered_map>
+#include <condition_variable>
+#include "httplib.h"
+#include "MpdIndex.hpp"
+#include "EdgeCache.hpp"
+#include "LivePopularity.hpp"
+
+class Prefetcher
+{
+public:
+	struct Settings
+	{
+		// segments after the one of the leading viewer that are fetched, 0 stops following the MPD
+		int window = 2;
+		// representations fetched per segment, the most popular tiles in their popular quality
+		int topK = 8;
+		// bytes per second the fetches are paced to, 0 does not pace them
+		double rate = 1e6;
+		// rank the tiles by the live popularity, by the <Popularity> element for segments it has no counts of
+		bool live = false;
+	};
+
+	struct Stats
+	{
+		size_t objects = 0;
+		size_t bytes = 0;
+	};
+
+	// a segment requested longer ago than this no longer leads
+	static constexpr int leadSeconds = 10;
+	// longest a fetch waits for the client requests in flight
+	static constexpr int demandWaitMs = 100;
+	// most segments a window may hold, far more than a cache keeps ahead of its viewers
+	static constexpr int maxWindow = 10000;
+
+	Prefetcher(EdgeCache& cache, const std::string& upstreamHost, int upstreamPort)
+		: cache(cache), upstreamHost(upstreamHost), upstreamPort(upstreamPort), demand(0), running(true)
+	{
+		thread = std::thread(&Prefetcher::run, this);
+	}
+
+	~Prefetcher()
+	{
+		{
+			std::lock_guard<std::mutex> l(mtx);
+			running = false;
+		}
+		cv.notify_all();
+		thread.join();
+	}
+
+	Prefetcher(const Prefetcher&) = delete;
+	Prefetcher& operator=(const Prefetcher&) = delete;
+
+	// follows an MPD, or stops following it with a window of 0. Returns the number of its segments, 0 if it can
+	// not be fetched or names no segment urls
+	size_t follow(const std::string& mpdPath, const Settings& settings)
+	{
+		if (settings.window <= 0)
+		{
+			std::lock_guard<std::mutex> l(mtx);
+			mpds.erase(mpdPath);
+			return 0;
+		}
+
+		httplib::Client client(upstreamHost.c_str(), upstreamPort);
+		auto res = client.Get(mpdPath.c_str());
+		if (!res || res->status != 200)
+			return 0;
+		auto index = std::make_shared<const MpdIndex>(res->body);
+		std::unordered_map<std::string, int> segments;
+		for (size_t tile = 0; tile < index->urls.size(); tile++)
+			for (size_t quality = 0; quality < index->urls[tile].size(); quality++)
+				for (size_t segment = 0; segment < index->urls[tile][quality].size(); segment++)
+					segments[index->segmentUrl(tile, quality, segment)] = (int)segment;
+		if (segments.empty())
+			return 0;
+
+		size_t count = 0;
+		for (auto& tile : index->urls)
+			for (auto& quality : tile)
+				count = std::max(count, quality.size());
+
+		std::lock_guard<std::mutex> l(mtx);
+		auto& followed = mpds[mpdPath];
+		followed.index = index;
+		followed.settings = settings;
+		followed.segments = std::move(segments);
+		cv.notify_all();
+		return count;
+	}
+
+	// [serving threads] a client requested url
+	void requested(const std::string& url)
+	{
+		std::lock_guard<std::mutex> l(mtx);
+		for (auto& mpd : mpds)
+		{
+			auto it = mpd.second.segments.find(url);
+			if (it == mpd.second.segments.end())
+				continue;
+			bool leads = mpd.second.requested.empty() || it->second > mpd.second.requested.rbegin()->first;
+			mpd.second.requested[it->second] = std::chrono::steady_clock::now();
+			if (leads)
+				cv.notify_all();
+		}
+	}
+
+	// [serving threads] held while a client's request is fetched from the origin
+	class Demand
+	{
+	public:
+		explicit Demand(Prefetcher& prefetcher) : prefetcher(prefetcher)
+		{
+			std::lock_guard<std::mutex> l(prefetcher.mtx);
+			prefetcher.demand++;
+		}
+
+		~Demand()
+		{
+			{
+				std::lock_guard<std::mutex> l(prefetcher.mtx);
+				prefetcher.demand--;
+			}
+			prefetcher.demandDone.notify_all();
+		}
+
+		Demand(const Demand&) = delete;
+		Demand& operator=(const Demand&) = delete;
+
+	private:
+		Prefetcher& prefetcher;
+	};
+
+	Stats statistics()
+	{
+		std::lock_guard<std::mutex> l(mtx);
+		return stats;
+	}
+
+	// with the cache, every object may be fetched again
+	void reset()
+	{
+		std::lock_guard<std::mutex> l(mtx);
+		stats = Stats();
+		for (auto& mpd : mpds)
+			mpd.second.fetched.clear();
+	}
+
+private:
+	struct Followed
+	{
+		std::shared_ptr<const MpdIndex> index;
+		Settings settings;
+		// 0-based segment of every media url
+		std::unordered_map<std::string, int> segments;
+		// segments by the time a client requested them last
+		std::map<int, std::chrono::steady_clock::time_point> requested;
+		// urls fetched already, not fetched again if the cache evicted them
+		std::set<std::string> fetched;
+	};
+
+	struct Plan
+	{
+		std::string mpdPath;
+		std::shared_ptr<const MpdIndex> index;
+		Settings settings;
+		int first;
+	};
+
+	EdgeCache& cache;
+	std::string upstreamHost;
+	int upstreamPort;
+	std::mutex mtx;
+	std::condition_variable cv;
+	std::condition_variable demandDone;
+	std::map<std::string, Followed> mpds;
+	int demand;
+	bool running;
+	Stats stats;
+	std::thread thread;
+
+	// newest segment requested within leadSeconds, -1 if there is none [under mtx]
+	static int leading(Followed& followed)
+	{
+		auto stale = std::chrono::steady_clock::now() - std::chrono::seconds(leadSeconds);
+		for (auto it = followed.requested.begin(); it != followed.requested.end();)
+			it = it->second < stale ? followed.requested.erase(it) : std::next(it);
+		return followed.requested.empty() ? -1 : followed.requested.rbegin()->first;
+	}
+
+	// urls of the topK most popular tiles of every segment of the window, nearest segment first
+	std::vector<std::string> rank(const Plan& plan)
+	{
+		const auto& index = *plan.index;
+		std::map<int, std::vector<double>> counts;
+		if (plan.settings.live)
+		{
+			httplib::Client client(upstreamHost.c_str(), upstreamPort);
+			auto res = client.Get(("/livepopularity" + plan.mpdPath + "?first=" + std::to_string(plan.first)
+				+ "&count=" + std::to_string(plan.settings.window)).c_str());
+			if (res && res->status == 200)
+				counts = LivePopularity::parse(res->body);
+		}
+		auto liveQualities = LivePopularity::qualities(counts, index);
+
+		std::vector<std::string> urls;
+		for (int segment = plan.first; segment < plan.first + plan.settings.window; segment++)
+		{
+			// score per tile: its count, or without counts the levels its quality is above the lowest
+			std::vector<std::pair<double, int>> order;
+			const std::vector<int>* quality = nullptr;
+			auto live = counts.find(segment);
+			auto fixed = index.popularity.find(segment);
+			if (live != counts.end())
+			{
+				quality = &liveQualities[segment];
+				for (size_t t = 0; t < live->second.size() && t < quality->size(); t++)
+					if (live->second[t] > 0)
+						order.push_back({ live->second[t], (int)t });
+			}
+			else if (fixed != index.popularity.end())
+			{
+				quality = &fixed->second;
+				for (size_t t = 0; t < quality->size() && t < index.urls.size(); t++)
+					if ((*quality)[t] >= 0)
+						order.push_back({ double(index.urls[t].size() - (*quality)[t]), (int)t });
+			}
+			else
+				continue;
+
+			std::stable_sort(order.begin(), order.end(), [](const std::pair<double, int>& a, const std::pair<double, int>& b)
+			{
+				return a.first > b.first;
+			});
+			for (size_t i = 0; i < order.size() && (int)i < plan.settings.topK; i++)
+			{
+				auto url = index.segmentUrl(order[i].second, (*quality)[order[i].second], segment);
+				if (!url.empty())
+					urls.push_back(url);
+			}
+		}
+		return urls;
+	}
+
+	void run()
+	{
+		auto paced = std::chrono::steady_clock::now();
+		std::unique_lock<std::mutex> l(mtx);
+		while (running)
+		{
+			std::vector<Plan> plans;
+			for (auto& mpd : mpds)
+			{
+				int lead = leading(mpd.second);
+				if (lead >= 0)
+					plans.push_back({ mpd.first, mpd.second.index, mpd.second.settings, lead + 1 });
+			}
+
+			bool fetchedAny = false;
+			for (auto& plan : plans)
+			{
+				l.unlock();
+				auto urls = rank(plan);
+				l.lock();
+				for (auto& url : urls)
+				{
+					auto mpd = mpds.find(plan.mpdPath);
+					if (!running || mpd == mpds.end())
+						break;
+					if (mpd->second.fetched.count(url))
+						continue;
+					mpd->second.fetched.insert(url);
+					l.unlock();
+					bool cached = cache.contains(url);
+					size_t bytes = cached ? 0 : fetch(url, plan.settings.rate, paced);
+					l.lock();
+					if (bytes > 0)
+					{
+						stats.objects++;
+						stats.bytes += bytes;
+						fetchedAny = true;
+					}
+				}
+			}
+
+			// a new leading segment, a new MPD or a second to see whether the live popularity changed
+			if (!fetchedAny && running)
+				cv.wait_for(l, std::chrono::seconds(1));
+		}
+	}
+
+	// fetches url into the cache once the pace and the demand allow it, returns its bytes. The pace may fall up to
+	// a second behind, what the link was idle for is spent in one burst at most
+	size_t fetch(const std::string& url, double rate, std::chrono::steady_clock::time_point& paced)
+	{
+		{
+			std::unique_lock<std::mutex> l(mtx);
+			cv.wait_until(l, paced, [this] { return !running; });
+			demandDone.wait_for(l, std::chrono::milliseconds(demandWaitMs), [this] { return demand == 0 || !running; });
+			if (!running)
+				return 0;
+		}
+
+		httplib::Client client(upstreamHost.c_str(), upstreamPort);
+		auto res = client.Get(url.c_str());
+		if (!res || res->status != 200)
+			return 0;
+		cache.put(url, res->body, res->get_header_value("Content-Type"));
+		if (rate > 0)
+			paced = std::max(paced, std::chrono::steady_clock::now() - std::chrono::seconds(1))
+				+ std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(res->body.size() / rate));
+		return res->body.size();
+	}
+};
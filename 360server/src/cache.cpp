@@ -0,0 +1,432 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Caching proxy in front of 360server, replaces squid for the
+	evaluations. Clients send their requests to it like to squid and
+	get the same X-Cache header; the cache is reconfigured and reset
+	over HTTP instead of restarting a daemon.
+*/
+#include <map>
+#include <mutex>
+#include <iostream>
+#include <sstream>
+#include "httplib.h"
+#include "MpdIndex.hpp"
+#include "EdgeCache.hpp"
+#include "LivePopularity.hpp"
+#include "Prefetcher.hpp"
+
+std::string upstreamHost;
+int upstreamPort;
+EdgeCache* cache;
+Prefetcher* prefetcher;
+size_t memoryBytes;
+// segment urls of the MPDs the cached sets were asked for, fetched upstream once
+std::map<std::string, MpdIndex> cachedSetIndexes;
+std::mutex cachedSetMtx;
+
+// request path without the scheme and authority proxy requests carry, the query is kept
+std::string cacheKey(const httplib::Request& req)
+{
+	std::string path = req.path;
+	auto scheme = path.find("://");
+	if (scheme != std::string::npos && scheme < path.find('/'))
+	{
+		auto slash = path.find('/', scheme + 3);
+		path = slash == std::string::npos ? "/" : path.substr(slash);
+	}
+
+	auto query = req.target.find('?');
+	if (query != std::string::npos)
+		path += req.target.substr(query);
+	return path;
+}
+
+void sendBody(const httplib::Request& req, httplib::Response& res, const std::string& body)
+{
+	size_t first, last;
+	switch (req.has_header("Range") ? httplib::detail::parse_range_header(req.get_header_value("Range"), body.size(), first, last) : httplib::detail::ByteRange::None)
+	{
+	case httplib::detail::ByteRange::Satisfiable:
+		res.status = 206;
+		res.body = body.substr(first, last - first + 1);
+		res.set_header("Content-Range", ("bytes " + std::to_string(first) + "-" + std::to_string(last) + "/" + std::to_string(body.size())).c_str());
+		break;
+	case httplib::detail::ByteRange::Unsatisfiable:
+		res.status = 416;
+		res.set_header("Content-Range", ("bytes */" + std::to_string(body.size())).c_str());
+		res.set_header("Content-Length", "0");
+		break;
+	default:
+		res.status = 200;
+		res.body = body;
+		break;
+	}
+}
+
+// answers from the cache or fetches the whole object upstream, ranges are cut from it
+void serve(const httplib::Request& req, httplib::Response& res)
+{
+	auto key = cacheKey(req);
+	prefetcher->requested(key);
+	std::string body, contentType;
+	if (cache->get(key, body, contentType))
+	{
+		res.set_header("X-Cache", "HIT from 360cache");
+		res.set_header("Content-Type", contentType.c_str());
+		sendBody(req, res, body);
+		// a range is sent as its slice, a HEAD without a body
+		cache->sent(true, req.method == "HEAD" ? 0 : res.body.size());
+		return;
+	}
+
+	res.set_header("X-Cache", "MISS from 360cache");
+	// like squid, a request for a cached answer only is not passed on
+	if (req.get_header_value("Cache-Control").find("only-if-cached") != std::string::npos)
+	{
+		res.status = 504;
+		return;
+	}
+
+	httplib::Client client(upstreamHost.c_str(), upstreamPort);
+	if (req.method == "HEAD")
+	{
+		auto upstream = client.Head(key.c_str());
+		res.status = upstream ? upstream->status : 502;
+		if (upstream && upstream->has_header("Content-Length"))
+			res.set_header("Content-Length", upstream->get_header_value("Content-Length").c_str());
+		return;
+	}
+
+	Prefetcher::Demand demand(*prefetcher);
+	auto upstream = client.Get(key.c_str());
+	if (!upstream)
+	{
+		res.status = 502;
+		return;
+	}
+
+	contentType = upstream->get_header_value("Content-Type");
+	res.set_header("Content-Type", contentType.c_str());
+	if (upstream->status != 200)
+	{
+		res.status = upstream->status;
+		res.body = upstream->body;
+		return;
+	}
+
+	cache->put(key, upstream->body, contentType);
+	sendBody(req, res, upstream->body);
+	cache->sent(false, res.body.size());
+}
+
+// fetches an MPD upstream and marks the representations of its <Popularity> element, returns their number
+size_t seedPopularity(const std::string& mpdPath)
+{
+	httplib::Client client(upstreamHost.c_str(), upstreamPort);
+	auto res = client.Get(mpdPath.c_str());
+	if (!res || res->status != 200)
+		return 0;
+
+	auto urls = MpdIndex(res->body).popularUrls();
+	for (auto& url : urls)
+		cache->setPopular(url);
+	return urls.size();
+}
+
+// marks the tiles the current audience of an MPD watches most in place of the popular ones so far
+// and fetches those not cached yet, returns their number
+size_t followLivePopularity(const std::string& mpdPath)
+{
+	httplib::Client client(upstreamHost.c_str(), upstreamPort);
+	auto mpd = client.Get(mpdPath.c_str());
+	auto live = client.Get(("/livepopularity" + mpdPath).c_str());
+	if (!mpd || mpd->status != 200 || !live || live->status != 200)
+		return 0;
+
+	MpdIndex index(mpd->body);
+	index.popularity = LivePopularity::qualities(LivePopularity::parse(live->body), index);
+	auto urls = index.popularUrls();
+	cache->replacePopular(urls);
+	for (auto& url : urls)
+	{
+		if (cache->contains(url))
+			continue;
+		auto res = client.Get(url.c_str());
+		if (res && res->status == 200)
+		{
+			cache->put(url, res->body, res->get_header_value("Content-Type"));
+			cache->seededObject(res->body.size());
+		}
+	}
+	return urls.size();
+}
+
+// which representations of the segments [first, first + count) of an MPD are cached, as lines "segment bitmap".
+// Bit tile * representations + quality of the bitmap is set for a cached one, the bitmap is written in hex digits
+// of four bits each, lowest bit first. Segments without a cached representation are left out
+std::string cachedSet(const std::string& mpdPath, int first, int count)
+{
+	std::lock_guard<std::mutex> l(cachedSetMtx);
+	auto it = cachedSetIndexes.find(mpdPath);
+	if (it == cachedSetIndexes.end())
+	{
+		httplib::Client client(upstreamHost.c_str(), upstreamPort);
+		auto res = client.Get(mpdPath.c_str());
+		if (!res || res->status != 200)
+			return "";
+		it = cachedSetIndexes.emplace(mpdPath, MpdIndex(res->body)).first;
+	}
+	auto& index = it->second;
+
+	size_t representations = 0;
+	size_t segments = 0;
+	for (auto& tile : index.urls)
+	{
+		representations = std::max(representations, tile.size());
+		for (auto& quality : tile)
+			segments = std::max(segments, quality.size());
+	}
+	size_t last = count < 0 ? segments : std::min(segments, (size_t)std::max(0, first) + count);
+
+	static const char digits[] = "0123456789abcdef";
+	std::ostringstream ss;
+	for (size_t segment = std::max(0, first); segment < last; segment++)
+	{
+		std::vector<int> nibbles((index.urls.size() * representations + 3) / 4, 0);
+		bool any = false;
+		for (size_t tile = 0; tile < index.urls.size(); tile++)
+			for (size_t quality = 0; quality < index.urls[tile].size(); quality++)
+			{
+				auto url = index.segmentUrl(tile, quality, segment);
+				if (url.empty() || !cache->contains(url))
+					continue;
+				size_t bit = tile * representations + quality;
+				nibbles[bit / 4] |= 1 << (bit % 4);
+				any = true;
+			}
+		if (!any)
+			continue;
+		ss << segment << " ";
+		for (int nibble : nibbles)
+			ss << digits[nibble];
+		ss << "\n";
+	}
+	return ss.str();
+}
+
+// follows an MPD for a prefetch request or command, the answer is the number of its segments
+std::string prefetch(const std::string& mpdPath, const Prefetcher::Settings& settings)
+{
+	if (settings.window <= 0)
+	{
+		prefetcher->follow(mpdPath, settings);
+		return "stopped";
+	}
+	size_t segments = prefetcher->follow(mpdPath, settings);
+	return segments > 0 ? std::to_string(segments) + " segments" : "no segments in " + mpdPath;
+}
+
+// requests the cache passes on without keeping the answer
+void forward(const httplib::Request& req, httplib::Response& res)
+{
+	httplib::Client client(upstreamHost.c_str(), upstreamPort);
+	auto key = cacheKey(req);
+	auto upstream = req.method == "POST" ? client.Post(key.c_str(), req.body, "text/plain") : client.Get(key.c_str());
+	if (!upstream)
+	{
+		res.status = 502;
+		return;
+	}
+	res.status = upstream->status;
+	res.set_content(upstream->body, upstream->get_header_value("Content-Type").c_str());
+}
+
+void printHelp()
+{
+	std::cout <<
+		"reset [policy] [MB] - drop every object, optionally switch policy and size\n" <<
+		"popularity [mpd]    - mark the tiles an mpd recommends for the popularity policy\n" <<
+		"livepopularity [mpd] - mark and prefetch the tiles the current audience of an mpd watches most\n" <<
+		"prefetch [mpd] [window] [topK] [Bytes/s] [0|1] - fetch the popular tiles ahead of the leading viewer\n" <<
+		"stats               - hits, misses and bytes since the last reset\n" <<
+		"quit                - close cache\n";
+	std::cout << std::endl;
+}
+
+std::string statistics()
+{
+	auto stats = cache->statistics();
+	auto prefetched = prefetcher->statistics();
+	std::ostringstream ss;
+	ss << "hits " << stats.hits << " misses " << stats.misses << " hitBytes " << stats.hitBytes
+		<< " missBytes " << stats.missBytes << " size " << cache->size()
+		<< " prefetched " << prefetched.objects << " prefetchBytes " << prefetched.bytes
+		<< " seeded " << stats.seeded << " seedBytes " << stats.seedBytes;
+	return ss.str();
+}
+
+void processCommand(const std::string& cmd)
+{
+	std::istringstream ss(cmd);
+	std::string basecmd;
+	ss >> basecmd;
+
+	if (basecmd == "quit")
+		exit(-1);
+	else if (basecmd == "reset")
+	{
+		std::string policy = "LFUDA";
+		size_t mb = 0;
+		ss >> policy >> mb;
+		try
+		{
+			cache->reset(mb > 0 ? mb << 20 : cache->capacityBytes(), memoryBytes, policy);
+			prefetcher->reset();
+		}
+		catch (const std::invalid_argument& e)
+		{
+			std::cout << e.what() << std::endl;
+		}
+	}
+	else if (basecmd == "popularity")
+	{
+		std::string path;
+		ss >> path;
+		std::cout << seedPopularity(path) << " popular segments" << std::endl;
+	}
+	else if (basecmd == "livepopularity")
+	{
+		std::string path;
+		ss >> path;
+		std::cout << followLivePopularity(path) << " popular segments" << std::endl;
+	}
+	else if (basecmd == "prefetch")
+	{
+		std::string path;
+		Prefetcher::Settings settings;
+		ss >> path >> settings.window >> settings.topK >> settings.rate >> settings.live;
+		std::cout << prefetch(path, settings) << std::endl;
+	}
+	else if (basecmd == "stats")
+		std::cout << statistics() << std::endl;
+	else
+		printHelp();
+}
+
+int main(int argc, char* argv[])
+{
+	using namespace httplib;
+
+	if (argc < 3 || argc > 8)
+	{
+		std::cout << "Start with the 360server host and port, optionally followed by the listen port, the cache size in MB, "
+			"the replacement policy (LRU, LFUDA, GDSF or popularity), a disk directory and the memory share in MB." << std::endl;
+		return -1;
+	}
+
+	upstreamHost = argv[1];
+	upstreamPort = std::stoi(argv[2]);
+	int port = argc > 3 ? std::stoi(argv[3]) : 3128;
+	size_t capacity = (argc > 4 ? std::stoul(argv[4]) : 1000) << 20;
+	std::string policy = argc > 5 ? argv[5] : "LFUDA";
+	std::string diskDir = argc > 6 ? argv[6] : "";
+	memoryBytes = argc > 7 ? std::stoul(argv[7]) << 20 : capacity;
+
+	// the link to the clients is not shaped, only the server emulates the network
+	httplib::bandwidth = 0;
+
+	EdgeCache edgeCache(capacity, memoryBytes, diskDir, policy);
+	cache = &edgeCache;
+	Prefetcher edgePrefetcher(edgeCache, upstreamHost, upstreamPort);
+	prefetcher = &edgePrefetcher;
+
+	Server sv;
+	sv.set_keep_alive_max_count(1000);
+
+	// control requests come through the proxy as well, with or without the authority of the origin
+	sv.Get(R"((?:http://[^/]+)?/_cache/reset/(\w+)/(\d+))", [&](const Request& req, Response& res) {
+		try
+		{
+			cache->reset(std::stoul(req.matches[2]) << 20, memoryBytes, req.matches[1]);
+			prefetcher->reset();
+			res.set_content("ok", "text/plain");
+		}
+		catch (const std::invalid_argument& e)
+		{
+			res.status = 400;
+			res.set_content(e.what(), "text/plain");
+		}
+	});
+
+	sv.Get(R"((?:http://[^/]+)?/_cache/popularity(/[^\s]+))", [&](const Request& req, Response& res) {
+		res.set_content(std::to_string(seedPopularity(req.matches[1])), "text/plain");
+	});
+
+	sv.Get(R"((?:http://[^/]+)?/_cache/livepopularity(/[^\s]+))", [&](const Request& req, Response& res) {
+		res.set_content(std::to_string(followLivePopularity(req.matches[1])), "text/plain");
+	});
+
+	sv.Get(R"((?:http://[^/]+)?/_cache/cached(/[^\s]+))", [&](const Request& req, Response& res) {
+		long long first = 0;
+		long long count = -1;
+		if ((req.has_param("first") && !detail::parse_integer(req.get_param_value("first"), 0, INT_MAX, first))
+			|| (req.has_param("count") && !detail::parse_integer(req.get_param_value("count"), -1, INT_MAX, count)))
+		{
+			res.status = 400;
+			res.set_content("first and count are numbers of segments", "text/plain");
+			return;
+		}
+		res.set_content(cachedSet(req.matches[1], (int)first, (int)count), "text/plain");
+	});
+
+	sv.Get(R"((?:http://[^/]+)?/_cache/prefetch(/[^\s]+))", [&](const Request& req, Response& res) {
+		Prefetcher::Settings settings;
+		long long window = settings.window;
+		long long topK = settings.topK;
+		if ((req.has_param("window") && !detail::parse_integer(req.get_param_value("window"), 0, Prefetcher::maxWindow, window))
+			|| (req.has_param("topk") && !detail::parse_integer(req.get_param_value("topk"), 0, INT_MAX, topK))
+			|| (req.has_param("rate") && !detail::parse_number(req.get_param_value("rate"), 0, settings.rate)))
+		{
+			res.status = 400;
+			res.set_content("window, topk and rate are numbers of at least 0, window of at most " + std::to_string(Prefetcher::maxWindow), "text/plain");
+			return;
+		}
+		settings.window = (int)window;
+		settings.topK = (int)topK;
+		settings.live = req.get_param_value("live") == "1";
+		res.set_content(prefetch(req.matches[1], settings), "text/plain");
+	});
+
+	// the live popularity changes with every upload, it is never cached
+	sv.Get(R"((?:http://[^/]+)?/livepopularity/[^\s]+)", forward);
+	sv.Post(R"((?:http://[^/]+)?/livepopularity/[^\s]+)", forward);
+
+	// a dynamic MPD changes with every update of a live event, players refresh it with Cache-Control: no-cache
+	sv.Get(R"((?:http://[^/]+)?/[^\s]+\.mpd)", [&](const Request& req, Response& res) {
+		if (req.get_header_value("Cache-Control").find("no-cache") != std::string::npos)
+			forward(req, res);
+		else
+			serve(req, res);
+	});
+
+	sv.Get(R"((?:http://[^/]+)?/_cache/stats)", [&](const Request& req, Response& res) {
+		res.set_content(statistics(), "text/plain");
+	});
+
+	sv.Get(".*", serve);
+
+	std::cout << "Caching " << upstreamHost << ":" << upstreamPort << " on port " << port << std::endl;
+	std::thread([&sv, port]() { sv.listen("localhost", port); }).detach();
+
+	while (true)
+	{
+		std::cout << "> ";
+		std::string input;
+		std::getline(std::cin, input);
+		processCommand(input);
+	}
+
+	return 0;
+}
@@ -69,6 +69,16 @@ typedef SOCKET socket_t;
 #include <signal.h>
 #include <sys/socket.h>
 #include <sys/select.h>
+#include <netinet/tcp.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <cerrno>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#define CPPHTTPLIB_EPOLL
+#endif
 
 typedef int socket_t;
 #define INVALID_SOCKET (-1)
@@ -76,16 +86,28 @@ typedef int socket_t;
 
 #include <fstream>
 #include <functional>
+#include <cctype>
+#include <cmath>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
 #include <map>
 #include <memory>
 #include <mutex>
 #include <regex>
 #include <string>
 #include <thread>
+#include <deque>
+#include <list>
+#include <queue>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <assert.h>
 #include "send.hpp"
+#include "Http2.hpp"
 
 #ifdef CPPHTTPLIB_OPENSSL_SUPPORT
 #include <openssl/ssl.h>
@@ -100,6 +122,13 @@ typedef int socket_t;
 */
 #define CPPHTTPLIB_KEEPALIVE_TIMEOUT_SECOND 5
 #define CPPHTTPLIB_KEEPALIVE_TIMEOUT_USECOND 0
+#define CPPHTTPLIB_LISTEN_BACKLOG 5
+#define CPPHTTPLIB_FILE_CACHE_BYTES (size_t(1) << 30)
+#define CPPHTTPLIB_HTTP2_IDLE_TIMEOUT_SECOND 60
+#define CPPHTTPLIB_HTTP2_MAX_STREAMS 128
+#define CPPHTTPLIB_HTTP2_MAX_HEADER_LIST_SIZE 65536
+#define CPPHTTPLIB_HTTP2_HANDLER_THREADS 8
+#define CPPHTTPLIB_REQUEST_HEADER_MAX_BYTES 65536
 
 namespace httplib
 {
@@ -116,6 +145,9 @@ namespace httplib
 			}
 		};
 
+		class MappedFile;
+		class MappedFileCache;
+
 	} // namespace detail
 
 	enum class HttpVersion { v1_0 = 0, v1_1 };
@@ -150,6 +182,9 @@ namespace httplib
 
 		Progress       progress;
 
+		// when the server read the request line
+		std::chrono::steady_clock::time_point received;
+
 		bool has_header(const char* key) const;
 		std::string get_header_value(const char* key) const;
 		void set_header(const char* key, const char* val);
@@ -166,6 +201,11 @@ namespace httplib
 		int         status;
 		Headers     headers;
 		std::string body;
+		// static file sent instead of body, shared by all responses for the same file
+		std::shared_ptr<const detail::MappedFile> file;
+		// part of file sent for a range request
+		size_t      file_offset;
+		size_t      file_length;
 
 		bool has_header(const char* key) const;
 		std::string get_header_value(const char* key) const;
@@ -175,7 +215,7 @@ namespace httplib
 		void set_content(const char* s, size_t n, const char* content_type);
 		void set_content(const std::string& s, const char* content_type);
 
-		Response() : status(-1) {}
+		Response() : status(-1), file_offset(0), file_length(0) {}
 	};
 
 	class Stream {
@@ -185,6 +225,16 @@ namespace httplib
 		virtual int write(const char* ptr, size_t size1) = 0;
 		virtual int write(const char* ptr) = 0;
 		virtual std::string get_remote_addr() = 0;
+		// shape the following writes with a session profile, nullptr for the link
+		virtual void set_shaping_profile(const std::shared_ptr<ShapingProfile>& profile) {}
+		// the plain socket beneath, INVALID_SOCKET if there is none
+		virtual socket_t socket() const { return INVALID_SOCKET; }
+		// bytes already taken from the socket that the next reads return first
+		virtual size_t buffered() const { return 0; }
+		// length bytes of file from offset, a stream that sends later keeps the mapping until then
+		virtual int write_file(const std::shared_ptr<const detail::MappedFile>& file, size_t offset, size_t length);
+		// runs callback once everything written is sent, right away for a stream whose writes block until then
+		virtual void when_sent(std::function<void()> callback) { callback(); }
 
 		template <typename ...Args>
 		void write_format(const char* fmt, const Args& ...args);
@@ -199,15 +249,86 @@ namespace httplib
 		virtual int write(const char* ptr, size_t size);
 		virtual int write(const char* ptr);
 		virtual std::string get_remote_addr();
+		virtual void set_shaping_profile(const std::shared_ptr<ShapingProfile>& profile);
+		virtual socket_t socket() const;
+
+	protected:
+		// the next read starts a request
+		bool request_pending_;
+
+	private:
+		socket_t sock_;
+		std::shared_ptr<ShapingProfile> profile_;
+		// shaping bucket of the link or of the peer, resolved on the first write
+		std::shared_ptr<TokenBucket> bucket_;
+	};
+
+#ifdef CPPHTTPLIB_EPOLL
+	// a connection the event loop read ahead on, its reads return those bytes before the ones still in the socket
+	class BufferedSocketStream : public SocketStream {
+	public:
+		BufferedSocketStream(socket_t sock, std::string buffered);
+
+		virtual int read(char* ptr, size_t size);
+		virtual size_t buffered() const;
+
+	private:
+		std::string buffered_;
+		size_t position_;
+	};
+
+	// one request the event loop read completely. The answer is queued instead of sent, the loop sends it without
+	// a worker once the handler returned, shaped slice by slice
+	class EventLoopStream : public Stream {
+	public:
+		enum class Progress { Sent, Due, Full, Failed };
+
+		EventLoopStream(socket_t sock, std::string request);
+
+		virtual int read(char* ptr, size_t size);
+		virtual int write(const char* ptr, size_t size);
+		virtual int write(const char* ptr);
+		virtual std::string get_remote_addr();
+		virtual void set_shaping_profile(const std::shared_ptr<ShapingProfile>& profile);
+		virtual int write_file(const std::shared_ptr<const detail::MappedFile>& file, size_t offset, size_t length);
+		virtual void when_sent(std::function<void()> callback);
+
+		// sends the queue until it is empty (Sent), the next slice is due at wake ns (Due), the socket is full
+		// (Full) or the peer is gone (Failed). Slices go to the bucket of the session profile or to bucket
+		Progress send_queued(TokenBucket& bucket, long long& wake);
+		// runs the callbacks of when_sent, once Sent was returned
+		void sent();
 
 	private:
+		// bytes still to send from offset on, of data or of a mapped file
+		struct Piece {
+			std::string data;
+			std::shared_ptr<const detail::MappedFile> file;
+			size_t offset;
+			size_t length;
+		};
+
 		socket_t sock_;
+		std::string request_;
+		size_t position_;
+		std::deque<Piece> queue_;
+		size_t queued_;
+		std::shared_ptr<ShapingProfile> profile_;
+		// bytes of the slice reserved last that are not sent yet and the time they are due
+		size_t slice_left_;
+		long long slice_start_;
+		std::vector<std::function<void()>> callbacks_;
 	};
+#endif
 
 	class Server {
 	public:
 		typedef std::function<void(const Request&, Response&)> Handler;
 		typedef std::function<void(const Request&, const Response&)> Logger;
+		// called once a response was sent with the time from reading the request line to its last byte
+		typedef std::function<void(const Request&, const Response&, std::chrono::microseconds)> Observer;
+		// answers a request in place of the static files and the handlers when it returns true
+		typedef std::function<bool(const Request&, Response&)> PreRoutingHandler;
 
 		Server();
 
@@ -225,9 +346,22 @@ namespace httplib
 		bool set_base_dir(const char* path);
 
 		void set_error_handler(Handler handler);
+		// consulted for every GET and HEAD before the files of the base directory
+		void set_pre_routing_handler(PreRoutingHandler handler);
 		void set_logger(Logger logger);
+		void set_observer(Observer observer);
+		// connections currently open, idle keep-alive connections included
+		size_t active_connections() const;
 
 		void set_keep_alive_max_count(size_t count);
+		void set_listen_backlog(int backlog);
+		// threads serving the event loop, 0 or a platform without epoll starts a thread per connection
+		void set_thread_pool_size(size_t count);
+		// bytes of static files kept mapped, files of higher priority are evicted last
+		void set_file_cache_size(size_t bytes);
+		void set_file_priority(const std::string& path, int priority);
+		// cached mapping of a file below the base directory, nullptr if there is none
+		std::shared_ptr<const detail::MappedFile> get_file(const std::string& path);
 
 		int bind_to_any_port(const char* host, int socket_flags = 0);
 		bool listen_after_bind();
@@ -248,18 +382,27 @@ namespace httplib
 		socket_t create_server_socket(const char* host, int port, int socket_flags) const;
 		int bind_internal(const char* host, int port, int socket_flags);
 		bool listen_internal();
+		bool listen_event_loop();
 
 		bool routing(Request& req, Response& res);
 		bool handle_file_request(Request& req, Response& res);
+		void apply_range(const Request& req, Response& res, size_t size);
 		bool dispatch_request(Request& req, Response& res, Handlers& handlers);
 
 		bool parse_request_line(const char* s, Request& req);
+		// the headers every response gets from what it sends, also calls the error handler
+		void finish_response(const Request& req, Response& res);
 		void write_response(Stream& strm, bool last_connection, const Request& req, Response& res);
+		// a connection whose client sent the first line of the HTTP/2 preface, served until it closes
+		bool serve_http2(Stream& strm);
 
 		virtual bool read_and_close_socket(socket_t sock);
 
 		bool        is_running_;
 		socket_t    svr_sock_;
+		int         listen_backlog_;
+		size_t      thread_pool_size_;
+		std::unique_ptr<detail::MappedFileCache> file_cache_;
 		std::string base_dir_;
 		Handlers    get_handlers_;
 		Handlers    post_handlers_;
@@ -267,7 +410,10 @@ namespace httplib
 		Handlers    delete_handlers_;
 		Handlers    options_handlers_;
 		Handler     error_handler_;
+		PreRoutingHandler pre_routing_handler_;
 		Logger      logger_;
+		Observer    observer_;
+		std::atomic<size_t> active_connections_;
 
 		// TODO: Use thread pool...
 		std::mutex  running_threads_mutex_;
@@ -626,6 +772,60 @@ namespace httplib
 #endif
 		}
 
+		// fixed set of threads working off a queue, jobs still queued on destruction are run first
+		class WorkerPool {
+		public:
+			explicit WorkerPool(size_t count) : shutdown_(false)
+			{
+				for (size_t i = 0; i < count; i++)
+					threads_.emplace_back([this]() { run(); });
+			}
+
+			~WorkerPool()
+			{
+				{
+					std::lock_guard<std::mutex> guard(mutex_);
+					shutdown_ = true;
+				}
+				cond_.notify_all();
+				for (auto& t : threads_)
+					t.join();
+			}
+
+			void enqueue(std::function<void()> job)
+			{
+				{
+					std::lock_guard<std::mutex> guard(mutex_);
+					jobs_.push_back(std::move(job));
+				}
+				cond_.notify_one();
+			}
+
+		private:
+			void run()
+			{
+				for (;;) {
+					std::function<void()> job;
+					{
+						std::unique_lock<std::mutex> lock(mutex_);
+						cond_.wait(lock, [this]() { return shutdown_ || !jobs_.empty(); });
+						if (jobs_.empty()) {
+							return;
+						}
+						job = std::move(jobs_.front());
+						jobs_.pop_front();
+					}
+					job();
+				}
+			}
+
+			std::vector<std::thread> threads_;
+			std::deque<std::function<void()>> jobs_;
+			std::mutex mutex_;
+			std::condition_variable cond_;
+			bool shutdown_;
+		};
+
 		inline bool is_connection_error()
 		{
 #ifdef _WIN32
@@ -714,6 +914,161 @@ namespace httplib
 			fs.read(&out[0], size);
 		}
 
+		// the whole of text as a decimal number of min to max, false for anything else where std::stoll would throw or
+		// stop early
+		inline bool parse_integer(const std::string& text, long long min, long long max, long long& value)
+		{
+			if (text.empty() || !(std::isdigit((unsigned char)text[0]) || text[0] == '-')) {
+				return false;
+			}
+			char* end;
+			errno = 0;
+			auto parsed = std::strtoll(text.c_str(), &end, 10);
+			if (errno == ERANGE || *end != '\0' || parsed < min || parsed > max) {
+				return false;
+			}
+			value = parsed;
+			return true;
+		}
+
+		// the whole of text as a finite decimal number of at least min
+		inline bool parse_number(const std::string& text, double min, double& value)
+		{
+			if (text.empty() || std::isspace((unsigned char)text[0])) {
+				return false;
+			}
+			char* end;
+			errno = 0;
+			auto parsed = std::strtod(text.c_str(), &end);
+			if (errno == ERANGE || *end != '\0' || !std::isfinite(parsed) || parsed < min) {
+				return false;
+			}
+			value = parsed;
+			return true;
+		}
+
+		enum class ByteRange { None, Satisfiable, Unsatisfiable };
+
+		// a position of a range header, one beyond any file saturates instead of throwing like std::stoull
+		inline unsigned long long parse_range_position(const std::string& digits)
+		{
+			errno = 0;
+			auto value = std::strtoull(digits.c_str(), nullptr, 10);
+			return errno == ERANGE ? ULLONG_MAX : value;
+		}
+
+		// first and last byte of a single range "bytes=first-last", "bytes=first-" or "bytes=-suffix" of a size byte
+		// resource. Multiple ranges are not supported and answered with the whole resource like a missing header
+		inline ByteRange parse_range_header(const std::string& value, size_t size, size_t& first, size_t& last)
+		{
+			static const std::regex re(R"(\s*bytes\s*=\s*(\d*)\s*-\s*(\d*)\s*)");
+			std::smatch m;
+			if (!std::regex_match(value, m, re) || (m[1].length() == 0 && m[2].length() == 0)) {
+				return ByteRange::None;
+			}
+
+			if (m[1].length() == 0) {
+				auto suffix = parse_range_position(m[2]);
+				if (suffix == 0 || size == 0) {
+					return ByteRange::Unsatisfiable;
+				}
+				first = suffix >= size ? 0 : size - static_cast<size_t>(suffix);
+				last = size - 1;
+				return ByteRange::Satisfiable;
+			}
+
+			auto from = parse_range_position(m[1]);
+			if (from >= size) {
+				return ByteRange::Unsatisfiable;
+			}
+			auto to = m[2].length() ? parse_range_position(m[2]) : size - 1;
+			if (to < from) {
+				return ByteRange::None;
+			}
+			first = static_cast<size_t>(from);
+			last = static_cast<size_t>(std::min<unsigned long long>(to, size - 1));
+			return ByteRange::Satisfiable;
+		}
+
+		// read only mapping of a whole file, the page cache is sent without copying it to the heap first
+		class MappedFile {
+		public:
+			static std::shared_ptr<const MappedFile> open(const std::string& path)
+			{
+				std::shared_ptr<MappedFile> file(new MappedFile());
+#ifdef _WIN32
+				file->file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+				if (file->file_ == INVALID_HANDLE_VALUE) {
+					return nullptr;
+				}
+				LARGE_INTEGER size;
+				GetFileSizeEx(file->file_, &size);
+				file->size_ = static_cast<size_t>(size.QuadPart);
+				if (file->size_ > 0) {
+					file->mapping_ = CreateFileMappingA(file->file_, NULL, PAGE_READONLY, 0, 0, NULL);
+					if (!file->mapping_) {
+						return nullptr;
+					}
+					file->data_ = static_cast<const char*>(MapViewOfFile(file->mapping_, FILE_MAP_READ, 0, 0, 0));
+				}
+#else
+				auto fd = ::open(path.c_str(), O_RDONLY);
+				if (fd < 0) {
+					return nullptr;
+				}
+				struct stat st;
+				if (fstat(fd, &st) < 0) {
+					::close(fd);
+					return nullptr;
+				}
+				file->size_ = static_cast<size_t>(st.st_size);
+				if (file->size_ > 0) {
+					auto addr = mmap(NULL, file->size_, PROT_READ, MAP_SHARED, fd, 0);
+					file->data_ = addr == MAP_FAILED ? nullptr : static_cast<const char*>(addr);
+				}
+				// the mapping stays valid without the descriptor
+				::close(fd);
+#endif
+				if (file->size_ > 0 && !file->data_) {
+					return nullptr;
+				}
+				return file;
+			}
+
+			~MappedFile()
+			{
+#ifdef _WIN32
+				if (data_) UnmapViewOfFile(data_);
+				if (mapping_) CloseHandle(mapping_);
+				if (file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+#else
+				if (data_) munmap(const_cast<char*>(data_), size_);
+#endif
+			}
+
+			const char* data() const { return data_; }
+			size_t size() const { return size_; }
+
+			// response header values, computed once when the file is mapped
+			const char* content_type;
+			std::string content_length;
+
+		private:
+			MappedFile()
+				: content_type(nullptr), data_(nullptr), size_(0)
+#ifdef _WIN32
+				, file_(INVALID_HANDLE_VALUE), mapping_(NULL)
+#endif
+			{}
+
+			const char* data_;
+			size_t size_;
+#ifdef _WIN32
+			HANDLE file_;
+			HANDLE mapping_;
+#endif
+		};
+
 		inline std::string file_extension(const std::string& path)
 		{
 			std::smatch m;
@@ -769,10 +1124,147 @@ namespace httplib
 			return nullptr;
 		}
 
+		// Bounded set of mapped files by path. Segments are immutable during an experiment, so a cached file is
+		// only checked for changes once per second. When the byte budget is exceeded the least recently used
+		// files of the lowest priority go first; tiles the MPD popularity names can be given a higher priority
+		class MappedFileCache {
+		public:
+			explicit MappedFileCache(size_t max_bytes) : max_bytes_(max_bytes), bytes_(0) {}
+
+			std::shared_ptr<const MappedFile> get(const std::string& path)
+			{
+				auto now = std::chrono::steady_clock::now();
+				{
+					std::lock_guard<std::mutex> guard(mutex_);
+					auto it = entries_.find(path);
+					if (it != entries_.end() && now - it->second.last_check < std::chrono::seconds(1)) {
+						touch(it->second);
+						return it->second.file;
+					}
+				}
+
+				struct stat st;
+				if (stat(path.c_str(), &st) < 0 || !S_ISREG(st.st_mode)) {
+					return nullptr;
+				}
+
+				std::lock_guard<std::mutex> guard(mutex_);
+				auto it = entries_.find(path);
+				if (it != entries_.end() && it->second.mtime == st.st_mtime && it->second.file->size() == static_cast<size_t>(st.st_size)) {
+					it->second.last_check = now;
+					touch(it->second);
+					return it->second.file;
+				}
+
+				auto mapped = MappedFile::open(path);
+				if (!mapped) {
+					return nullptr;
+				}
+				auto file = std::const_pointer_cast<MappedFile>(mapped);
+				file->content_type = find_content_type(path);
+				file->content_length = std::to_string(file->size());
+
+				int priority = 0;
+				if (it != entries_.end()) {
+					priority = it->second.priority;
+					remove(it);
+				}
+				else {
+					auto p = priorities_.find(path);
+					if (p != priorities_.end()) {
+						priority = p->second;
+					}
+				}
+
+				// files above the budget are served but not kept
+				if (file->size() > max_bytes_) {
+					return mapped;
+				}
+
+				auto& entry = entries_[path];
+				entry.file = mapped;
+				entry.mtime = st.st_mtime;
+				entry.last_check = now;
+				entry.priority = priority;
+				auto& order = lru_[priority];
+				entry.position = order.insert(order.end(), path);
+				bytes_ += file->size();
+
+				// responses still sending keep their mapping alive through their own reference
+				while (bytes_ > max_bytes_) {
+					auto lowest = lru_.begin();
+					remove(entries_.find(lowest->second.front()));
+				}
+				return mapped;
+			}
+
+			// files of higher priority are evicted after all files of lower priority
+			void set_priority(const std::string& path, int priority)
+			{
+				std::lock_guard<std::mutex> guard(mutex_);
+				priorities_[path] = priority;
+				auto it = entries_.find(path);
+				if (it != entries_.end() && it->second.priority != priority) {
+					auto& from = lru_[it->second.priority];
+					from.erase(it->second.position);
+					if (from.empty()) {
+						lru_.erase(it->second.priority);
+					}
+					it->second.priority = priority;
+					auto& order = lru_[priority];
+					it->second.position = order.insert(order.end(), path);
+				}
+			}
+
+			void set_max_bytes(size_t max_bytes)
+			{
+				std::lock_guard<std::mutex> guard(mutex_);
+				max_bytes_ = max_bytes;
+				while (bytes_ > max_bytes_) {
+					remove(entries_.find(lru_.begin()->second.front()));
+				}
+			}
+
+		private:
+			struct Entry {
+				std::shared_ptr<const MappedFile> file;
+				time_t mtime;
+				std::chrono::steady_clock::time_point last_check;
+				int priority;
+				std::list<std::string>::iterator position;
+			};
+
+			void touch(Entry& entry)
+			{
+				auto& order = lru_[entry.priority];
+				order.splice(order.end(), order, entry.position);
+			}
+
+			void remove(std::map<std::string, Entry>::iterator it)
+			{
+				auto& order = lru_[it->second.priority];
+				order.erase(it->second.position);
+				if (order.empty()) {
+					lru_.erase(it->second.priority);
+				}
+				bytes_ -= it->second.file->size();
+				entries_.erase(it);
+			}
+
+			std::map<std::string, Entry> entries_;
+			// least recently used first, per priority
+			std::map<int, std::list<std::string>> lru_;
+			std::map<std::string, int> priorities_;
+			std::mutex mutex_;
+			size_t max_bytes_;
+			size_t bytes_;
+		};
+
 		inline const char* status_message(int status)
 		{
 			switch (status) {
 			case 200: return "OK";
+			case 206: return "Partial Content";
 			case 301: return "Moved Permanently";
 			case 302: return "Found";
 			case 303: return "See Other";
@@ -781,8 +1273,11 @@ namespace httplib
 			case 403: return "Forbidden";
 			case 404: return "Not Found";
 			case 415: return "Unsupported Media Type";
+			case 416: return "Range Not Satisfiable";
 			default:
 			case 500: return "Internal Server Error";
+			case 502: return "Bad Gateway";
+			case 504: return "Gateway Timeout";
 			}
 		}
 
@@ -935,6 +1430,52 @@ namespace httplib
 			return true;
 		}
 
+		// length of the request at the start of buf once its headers and the body they announce arrived, 0 while
+		// bytes are missing. Like process_request only POST and PUT have a body
+		inline size_t complete_request_length(const std::string& buf)
+		{
+			auto end = buf.find("\r\n\r\n");
+			if (end == std::string::npos) {
+				return 0;
+			}
+			end += 4;
+			if (buf.compare(0, 5, "POST ") && buf.compare(0, 4, "PUT ")) {
+				return end;
+			}
+
+			static const std::regex length_re(R"(\r\nContent-Length:[ \t]*(\d+))", std::regex::icase);
+			static const std::regex chunked_re(R"(\r\nTransfer-Encoding:[ \t]*chunked)", std::regex::icase);
+			std::smatch m;
+			if (std::regex_search(buf.begin(), buf.begin() + end, m, length_re)) {
+				auto length = std::strtoull(m[1].str().c_str(), nullptr, 10);
+				if (length > 0) {
+					return length <= buf.size() - end ? end + static_cast<size_t>(length) : 0;
+				}
+			}
+			if (!std::regex_search(buf.begin(), buf.begin() + end, chunked_re)) {
+				return end;
+			}
+
+			// chunks until the empty one, which is followed by an empty line
+			for (auto pos = end;;) {
+				auto line = buf.find("\r\n", pos);
+				if (line == std::string::npos) {
+					return 0;
+				}
+				auto size = std::strtoull(buf.c_str() + pos, nullptr, 16);
+				if (size == 0) {
+					return buf.size() >= line + 4 ? line + 4 : 0;
+				}
+				if (size > buf.size()) {
+					return 0;
+				}
+				pos = line + 2 + static_cast<size_t>(size) + 2;
+				if (pos > buf.size()) {
+					return 0;
+				}
+			}
+		}
+
 		template <typename T>
 		inline void write_headers(Stream& strm, const T& info)
 		{
@@ -1455,7 +1996,7 @@ namespace httplib
 	}
 
 	// Socket stream implementation
-	inline SocketStream::SocketStream(socket_t sock) : sock_(sock)
+	inline SocketStream::SocketStream(socket_t sock) : request_pending_(true), sock_(sock)
 	{
 	}
 
@@ -1465,12 +2006,22 @@ namespace httplib
 
 	inline int SocketStream::read(char* ptr, size_t size)
 	{
-		return recv(sock_, ptr, size, 0);
+		auto n = recv(sock_, ptr, size, 0);
+		if (n > 0 && request_pending_) {
+			request_pending_ = false;
+			waitRoundTrip();
+		}
+		return n;
 	}
 
 	inline int SocketStream::write(const char* ptr, size_t size)
 	{
-		return sendBandwidthLimited(sock_, ptr, size);
+		request_pending_ = true;
+		if (profile_)
+			return sendBandwidthLimited(sock_, profile_->bucket, ptr, size, profile_.get());
+		if (!bucket_)
+			bucket_ = bucketForSocket(sock_);
+		return sendBandwidthLimited(sock_, *bucket_, ptr, size);
 	}
 
 	inline int SocketStream::write(const char* ptr)
@@ -1482,11 +2033,159 @@ namespace httplib
 		return detail::get_remote_addr(sock_);
 	}
 
+	inline void SocketStream::set_shaping_profile(const std::shared_ptr<ShapingProfile>& profile)
+	{
+		profile_ = profile;
+	}
+
+	inline socket_t SocketStream::socket() const
+	{
+		return sock_;
+	}
+
+	inline int Stream::write_file(const std::shared_ptr<const detail::MappedFile>& file, size_t offset, size_t length)
+	{
+		return write(file->data() + offset, length);
+	}
+
+#ifdef CPPHTTPLIB_EPOLL
+	inline BufferedSocketStream::BufferedSocketStream(socket_t sock, std::string buffered)
+		: SocketStream(sock), buffered_(std::move(buffered)), position_(0)
+	{
+		// the event loop waited the round trip before it handed over the connection
+		request_pending_ = false;
+	}
+
+	inline int BufferedSocketStream::read(char* ptr, size_t size)
+	{
+		if (position_ == buffered_.size()) {
+			return SocketStream::read(ptr, size);
+		}
+		auto n = std::min(size, buffered_.size() - position_);
+		memcpy(ptr, buffered_.data() + position_, n);
+		position_ += n;
+		return (int)n;
+	}
+
+	inline size_t BufferedSocketStream::buffered() const
+	{
+		return buffered_.size() - position_;
+	}
+
+	inline EventLoopStream::EventLoopStream(socket_t sock, std::string request)
+		: sock_(sock), request_(std::move(request)), position_(0), queued_(0), slice_left_(0), slice_start_(0)
+	{
+	}
+
+	inline int EventLoopStream::read(char* ptr, size_t size)
+	{
+		auto n = std::min(size, request_.size() - position_);
+		memcpy(ptr, request_.data() + position_, n);
+		position_ += n;
+		return (int)n;
+	}
+
+	inline int EventLoopStream::write(const char* ptr, size_t size)
+	{
+		if (size == 0) {
+			return 0;
+		}
+		// the response line and the headers arrive in many small writes
+		if (!queue_.empty() && !queue_.back().file) {
+			queue_.back().data.append(ptr, size);
+			queue_.back().length += size;
+		}
+		else {
+			queue_.push_back({ std::string(ptr, size), nullptr, 0, size });
+		}
+		queued_ += size;
+		return (int)size;
+	}
+
+	inline int EventLoopStream::write(const char* ptr)
+	{
+		return write(ptr, strlen(ptr));
+	}
+
+	inline std::string EventLoopStream::get_remote_addr() {
+		return detail::get_remote_addr(sock_);
+	}
+
+	inline void EventLoopStream::set_shaping_profile(const std::shared_ptr<ShapingProfile>& profile)
+	{
+		profile_ = profile;
+	}
+
+	inline int EventLoopStream::write_file(const std::shared_ptr<const detail::MappedFile>& file, size_t offset, size_t length)
+	{
+		if (length == 0) {
+			return 0;
+		}
+		queue_.push_back({ std::string(), file, offset, length });
+		queued_ += length;
+		return (int)length;
+	}
+
+	inline void EventLoopStream::when_sent(std::function<void()> callback)
+	{
+		callbacks_.push_back(std::move(callback));
+	}
+
+	inline EventLoopStream::Progress EventLoopStream::send_queued(TokenBucket& bucket, long long& wake)
+	{
+		auto& slices = profile_ ? profile_->bucket : bucket;
+		while (!queue_.empty()) {
+			if (slice_left_ == 0) {
+				slice_start_ = reserveSlice(slices, queued_, slice_left_, profile_.get());
+			}
+			if (slice_start_ > shaperNowNs()) {
+				wake = slice_start_;
+				return Progress::Due;
+			}
+
+			auto& piece = queue_.front();
+			auto ptr = piece.file ? piece.file->data() + piece.offset : piece.data.data() + piece.offset;
+			auto size = std::min(slice_left_, piece.length);
+			// the headers wait for the start of the body when both fit into the slice
+			auto more = size == piece.length && size < slice_left_ ? MSG_MORE : 0;
+			auto n = ::send(sock_, ptr, size, MSG_NOSIGNAL | more);
+			if (n < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				return errno == EAGAIN || errno == EWOULDBLOCK ? Progress::Full : Progress::Failed;
+			}
+
+			piece.offset += n;
+			piece.length -= n;
+			queued_ -= n;
+			slice_left_ -= n;
+			if (piece.length == 0) {
+				queue_.pop_front();
+			}
+		}
+		slice_left_ = 0;
+		return Progress::Sent;
+	}
+
+	inline void EventLoopStream::sent()
+	{
+		for (auto& callback : callbacks_) {
+			callback();
+		}
+		callbacks_.clear();
+	}
+#endif
+
 	// HTTP server implementation
 	inline Server::Server()
 		: keep_alive_max_count_(5)
 		, is_running_(false)
 		, svr_sock_(INVALID_SOCKET)
+		, listen_backlog_(CPPHTTPLIB_LISTEN_BACKLOG)
+		, thread_pool_size_(0)
+		, file_cache_(new detail::MappedFileCache(CPPHTTPLIB_FILE_CACHE_BYTES))
+		, active_connections_(0)
 		, running_threads_(0)
 	{
 #ifndef _WIN32
@@ -1542,33 +2241,76 @@ namespace httplib
 		error_handler_ = handler;
 	}
 
+	inline void Server::set_pre_routing_handler(PreRoutingHandler handler)
+	{
+		pre_routing_handler_ = handler;
+	}
+
 	inline void Server::set_logger(Logger logger)
 	{
 		logger_ = logger;
 	}
 
-	inline void Server::set_keep_alive_max_count(size_t count)
+	inline void Server::set_observer(Observer observer)
 	{
-		keep_alive_max_count_ = count;
+		observer_ = observer;
 	}
 
-	inline int Server::bind_to_any_port(const char* host, int socket_flags)
+	inline size_t Server::active_connections() const
 	{
-		return bind_internal(host, 0, socket_flags);
+		return active_connections_;
 	}
 
-	inline bool Server::listen_after_bind() {
-		return listen_internal();
+	inline void Server::set_keep_alive_max_count(size_t count)
+	{
+		keep_alive_max_count_ = count;
 	}
 
-	inline bool Server::listen(const char* host, int port, int socket_flags)
+	inline void Server::set_listen_backlog(int backlog)
 	{
-		if (bind_internal(host, port, socket_flags) < 0)
-			return false;
-		return listen_internal();
+		listen_backlog_ = backlog;
 	}
 
-	inline bool Server::is_running() const
+	inline void Server::set_thread_pool_size(size_t count)
+	{
+		thread_pool_size_ = count;
+	}
+
+	inline void Server::set_file_cache_size(size_t bytes)
+	{
+		file_cache_->set_max_bytes(bytes);
+	}
+
+	inline void Server::set_file_priority(const std::string& path, int priority)
+	{
+		file_cache_->set_priority(base_dir_ + path, priority);
+	}
+
+	inline std::shared_ptr<const detail::MappedFile> Server::get_file(const std::string& path)
+	{
+		if (base_dir_.empty() || !detail::is_valid_path(path)) {
+			return nullptr;
+		}
+		return file_cache_->get(base_dir_ + path);
+	}
+
+	inline int Server::bind_to_any_port(const char* host, int socket_flags)
+	{
+		return bind_internal(host, 0, socket_flags);
+	}
+
+	inline bool Server::listen_after_bind() {
+		return listen_internal();
+	}
+
+	inline bool Server::listen(const char* host, int port, int socket_flags)
+	{
+		if (bind_internal(host, port, socket_flags) < 0)
+			return false;
+		return listen_internal();
+	}
+
+	inline bool Server::is_running() const
 	{
 		return is_running_;
 	}
@@ -1606,7 +2348,7 @@ namespace httplib
 		return false;
 	}
 
-	inline void Server::write_response(Stream& strm, bool last_connection, const Request& req, Response& res)
+	inline void Server::finish_response(const Request& req, Response& res)
 	{
 		assert(res.status != -1);
 
@@ -1614,23 +2356,22 @@ namespace httplib
 			error_handler_(req, res);
 		}
 
-		// Response line
-		strm.write_format("HTTP/1.1 %d %s\r\n",
-			res.status,
-			detail::status_message(res.status));
-
-		// Headers
-		if (last_connection ||
-			req.version == "HTTP/1.0" ||
-			req.get_header_value("Connection") == "close") {
-			res.set_header("Connection", "close");
+		if (res.file) {
+			if (!res.has_header("Content-Type")) {
+				res.set_header("Content-Type", res.file->content_type ? res.file->content_type : "application/octet-stream");
+			}
+			if (res.status == 206) {
+				res.set_header("Content-Length", std::to_string(res.file_length).c_str());
+			}
+			else if (res.status != 416) {
+				res.set_header("Content-Length", res.file->content_length.c_str());
+			}
 		}
-
-		if (!res.body.empty()) {
+		else if (!res.body.empty()) {
 #ifdef CPPHTTPLIB_ZLIB_SUPPORT
 			// TODO: 'Accpet-Encoding' has gzip, not gzip;q=0
 			const auto& encodings = req.get_header_value("Accept-Encoding");
-			if (encodings.find("gzip") != std::string::npos &&
+			if (encodings.find("gzip") != std::string::npos && !res.has_header("Content-Encoding") &&
 				detail::can_compress(res.get_header_value("Content-Type"))) {
 				detail::compress(res.body);
 				res.set_header("Content-Encoding", "gzip");
@@ -1644,17 +2385,78 @@ namespace httplib
 			auto length = std::to_string(res.body.size());
 			res.set_header("Content-Length", length.c_str());
 		}
+	}
+
+	inline void Server::write_response(Stream& strm, bool last_connection, const Request& req, Response& res)
+	{
+		finish_response(req, res);
+
+		// Response line
+		strm.write_format("HTTP/1.1 %d %s\r\n",
+			res.status,
+			detail::status_message(res.status));
+
+		// Headers
+		if (last_connection ||
+			req.version == "HTTP/1.0" ||
+			req.get_header_value("Connection") == "close") {
+			res.set_header("Connection", "close");
+		}
 
 		detail::write_headers(strm, res);
 
-		// Body
-		if (!res.body.empty() && req.method != "HEAD") {
-			strm.write(res.body.c_str(), res.body.size());
+		// Body, files are sent straight from their mapping through the bandwidth limiter
+		if (req.method != "HEAD") {
+			if (res.file) {
+				if (res.status == 206) {
+					strm.write_file(res.file, res.file_offset, res.file_length);
+				}
+				else if (res.status != 416) {
+					strm.write_file(res.file, 0, res.file->size());
+				}
+			}
+			else if (!res.body.empty()) {
+				strm.write(res.body.c_str(), res.body.size());
+			}
+		}
+
+		// Log once the last byte is out, which for the event loop is after the caller returned
+		if (logger_ || observer_) {
+			auto answered = std::make_shared<std::pair<Request, Response>>(req, std::move(res));
+			strm.when_sent([this, answered]() {
+				if (logger_) {
+					logger_(answered->first, answered->second);
+				}
+				if (observer_) {
+					observer_(answered->first, answered->second,
+						std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - answered->first.received));
+				}
+			});
+		}
+	}
+
+	// turns a 200 for a size byte resource into a 206 or 416 if the request names a byte range
+	inline void Server::apply_range(const Request& req, Response& res, size_t size)
+	{
+		if (!req.has_header("Range")) {
+			return;
 		}
 
-		// Log
-		if (logger_) {
-			logger_(req, res);
+		size_t first = 0, last = 0;
+		switch (detail::parse_range_header(req.get_header_value("Range"), size, first, last)) {
+		case detail::ByteRange::Satisfiable:
+			res.status = 206;
+			res.file_offset = first;
+			res.file_length = last - first + 1;
+			res.set_header("Content-Range", ("bytes " + std::to_string(first) + "-" + std::to_string(last) + "/" + std::to_string(size)).c_str());
+			break;
+		case detail::ByteRange::Unsatisfiable:
+			res.status = 416;
+			res.set_header("Content-Range", ("bytes */" + std::to_string(size)).c_str());
+			res.set_header("Content-Length", "0");
+			break;
+		default:
+			break;
 		}
 	}
 
@@ -1667,6 +2469,14 @@ namespace httplib
 				path += "index.html";
 			}
 
+			res.file = file_cache_->get(path);
+			if (res.file) {
+				res.status = 200;
+				res.set_header("Accept-Ranges", "bytes");
+				apply_range(req, res, res.file->size());
+				return true;
+			}
+
 			if (detail::is_file(path)) {
 				detail::read_file(path, res.body);
 				auto type = detail::find_content_type(path);
@@ -1674,6 +2484,14 @@ namespace httplib
 					res.set_header("Content-Type", type);
 				}
 				res.status = 200;
+				res.set_header("Accept-Ranges", "bytes");
+				apply_range(req, res, res.body.size());
+				if (res.status == 206) {
+					res.body = res.body.substr(res.file_offset, res.file_length);
+				}
+				else if (res.status == 416) {
+					res.body.clear();
+				}
 				return true;
 			}
 		}
@@ -1683,12 +2501,13 @@ namespace httplib
 
 	inline socket_t Server::create_server_socket(const char* host, int port, int socket_flags) const
 	{
+		auto backlog = listen_backlog_;
 		return detail::create_socket(host, port,
-			[](socket_t sock, struct addrinfo& ai) -> bool {
+			[backlog](socket_t sock, struct addrinfo& ai) -> bool {
 			if (::bind(sock, ai.ai_addr, ai.ai_addrlen)) {
 				return false;
 			}
-			if (::listen(sock, 5)) { // Listen through 5 channels
+			if (::listen(sock, backlog)) {
 				return false;
 			}
 			return true;
@@ -1729,6 +2548,12 @@ namespace httplib
 
 	inline bool Server::listen_internal()
 	{
+#ifdef CPPHTTPLIB_EPOLL
+		if (thread_pool_size_ > 0) {
+			return listen_event_loop();
+		}
+#endif
+
 		auto ret = true;
 
 		is_running_ = true;
@@ -1764,7 +2589,9 @@ namespace httplib
 					running_threads_++;
 				}
 
+				active_connections_++;
 				read_and_close_socket(sock);
+				active_connections_--;
 
 				{
 					std::lock_guard<std::mutex> guard(running_threads_mutex_);
@@ -1787,9 +2614,359 @@ namespace httplib
 		return ret;
 	}
 
+	// Connections wait in epoll while their requests arrive. The loop reads them without blocking and hands a worker
+	// one request once it is complete, the worker answers into the queue of an EventLoopStream and the loop sends
+	// that. A shaped slice that is not due yet is waited for with the epoll timeout, a full socket with EPOLLOUT, so a
+	// slow client or a slow link only keeps its connection waiting, never a worker. A connection speaking HTTP/2 is
+	// handed to a worker until it closes. Only the loop touches the connections, a worker reports a finished request
+	// through the eventfd
+	inline bool Server::listen_event_loop()
+	{
+#ifdef CPPHTTPLIB_EPOLL
+		enum class State { Reading, Serving, Sending, Http2 };
+		struct Connection {
+			State state;
+			// tells a connection apart from an earlier one with the same descriptor
+			uint64_t generation;
+			size_t requests_left;
+			// read but not yet handed to a worker
+			std::string input;
+			bool peer_closed;
+			// the first byte of the next request arrived then, it is served one round trip later
+			long long request_start;
+			std::chrono::steady_clock::time_point idle_since;
+			// the request a worker serves or whose answer is sent
+			std::unique_ptr<EventLoopStream> stream;
+			bool keep;
+			// shaping bucket of the link or of the peer, resolved for every answer
+			std::shared_ptr<TokenBucket> bucket;
+		};
+		struct Finished {
+			socket_t sock;
+			bool keep;
+		};
+		// steady clock ns a connection continues, its generation tells whether it still exists
+		typedef std::tuple<long long, socket_t, uint64_t> Timer;
+
+		auto epfd = epoll_create1(0);
+		if (epfd < 0) {
+			return false;
+		}
+		auto wakefd = eventfd(0, EFD_NONBLOCK);
+		if (wakefd < 0) {
+			close(epfd);
+			return false;
+		}
+
+		is_running_ = true;
+		auto ret = true;
+		auto listen_sock = svr_sock_;
+		detail::set_nonblocking(listen_sock, true);
+
+		epoll_event ev = {};
+		ev.events = EPOLLIN;
+		ev.data.fd = listen_sock;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, listen_sock, &ev);
+		ev.data.fd = wakefd;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, wakefd, &ev);
+
+		std::map<socket_t, Connection> connections;
+		uint64_t generations = 0;
+		std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers;
+		std::mutex finished_mutex;
+		std::vector<Finished> finished;
+		const auto keep_alive_timeout = std::chrono::seconds(CPPHTTPLIB_KEEPALIVE_TIMEOUT_SECOND)
+			+ std::chrono::microseconds(CPPHTTPLIB_KEEPALIVE_TIMEOUT_USECOND);
+		const std::string http2_line(http2::connectionPreface, 16);
+
+		auto arm = [&](socket_t sock, uint32_t events) {
+			epoll_event conn_ev = {};
+			conn_ev.events = events | EPOLLONESHOT;
+			conn_ev.data.fd = sock;
+			epoll_ctl(epfd, EPOLL_CTL_MOD, sock, &conn_ev);
+		};
+
+		auto close_connection = [&](std::map<socket_t, Connection>::iterator it) {
+			detail::close_socket(it->first);
+			connections.erase(it);
+			active_connections_--;
+		};
+
+		auto report = [&](socket_t sock, bool keep) {
+			{
+				std::lock_guard<std::mutex> guard(finished_mutex);
+				finished.push_back({ sock, keep });
+			}
+			uint64_t one = 1;
+			auto written = ::write(wakefd, &one, sizeof(one));
+			(void)written;
+		};
+
+		{
+			detail::WorkerPool workers(thread_pool_size_);
+
+			// takes the connection as far as it gets without waiting, false once it is to be closed
+			auto advance = [&](socket_t sock, Connection& conn) {
+				for (;;) {
+					if (conn.state == State::Sending) {
+						long long wake = 0;
+						switch (conn.stream->send_queued(*conn.bucket, wake)) {
+						case EventLoopStream::Progress::Due:
+							timers.emplace(wake, sock, conn.generation);
+							return true;
+						case EventLoopStream::Progress::Full:
+							// without EPOLLRDHUP, a client that only shut down its side would wake the loop until then
+							arm(sock, EPOLLOUT);
+							return true;
+						case EventLoopStream::Progress::Failed:
+							return false;
+						case EventLoopStream::Progress::Sent:
+							break;
+						}
+						conn.stream->sent();
+						conn.stream.reset();
+						if (!conn.keep) {
+							return false;
+						}
+						conn.state = State::Reading;
+						conn.idle_since = std::chrono::steady_clock::now();
+						conn.request_start = shaperNowNs();
+						continue;
+					}
+					if (conn.state != State::Reading) {
+						return true;
+					}
+
+					// a client that knows the server speaks HTTP/2 starts with the first line of its preface
+					auto http2 = !conn.input.compare(0, http2_line.size(), http2_line);
+					auto length = http2 ? 0 : detail::complete_request_length(conn.input);
+					if (length == 0 && conn.input.size() > CPPHTTPLIB_REQUEST_HEADER_MAX_BYTES
+						&& conn.input.find("\r\n\r\n") == std::string::npos) {
+						// answered with 400, there is no telling where a request after it would start
+						length = conn.input.size();
+						conn.requests_left = 1;
+					}
+					if (!http2 && length == 0) {
+						if (conn.peer_closed) {
+							return false;
+						}
+						arm(sock, EPOLLIN | EPOLLRDHUP);
+						return true;
+					}
+
+					auto due = conn.request_start + rttNs.load(std::memory_order_relaxed);
+					if (due > shaperNowNs()) {
+						timers.emplace(due, sock, conn.generation);
+						return true;
+					}
+
+					if (http2) {
+						conn.state = State::Http2;
+						detail::set_nonblocking(sock, false);
+						// frames are read blocking by the worker, a stalled client must not hold it forever
+						timeval tv;
+						tv.tv_sec = CPPHTTPLIB_KEEPALIVE_TIMEOUT_SECOND;
+						tv.tv_usec = CPPHTTPLIB_KEEPALIVE_TIMEOUT_USECOND;
+						setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (char*)&tv, sizeof(tv));
+						auto input = std::make_shared<std::string>(std::move(conn.input));
+						workers.enqueue([&, sock, input]() {
+							BufferedSocketStream strm(sock, std::move(*input));
+							auto connection_close = false;
+							process_request(strm, true, connection_close);
+							report(sock, false);
+						});
+						return true;
+					}
+
+					auto requests_left = --conn.requests_left;
+					conn.state = State::Serving;
+					conn.stream.reset(new EventLoopStream(sock, conn.input.substr(0, length)));
+					conn.input.erase(0, length);
+					auto strm = conn.stream.get();
+					workers.enqueue([&, sock, strm, requests_left]() {
+						auto connection_close = false;
+						auto keep = process_request(*strm, requests_left == 0, connection_close)
+							&& !connection_close && requests_left > 0;
+						report(sock, keep);
+					});
+					return true;
+				}
+			};
+
+			auto readable = [&](socket_t sock, Connection& conn) {
+				// a client sending faster than the loop reads is continued with the next epoll_wait
+				char buf[16384];
+				for (size_t total = 0; total < 4 * sizeof(buf);) {
+					auto n = recv(sock, buf, sizeof(buf), 0);
+					if (n > 0) {
+						if (conn.input.empty()) {
+							conn.request_start = shaperNowNs();
+						}
+						conn.input.append(buf, n);
+						conn.idle_since = std::chrono::steady_clock::now();
+						total += n;
+					}
+					else if (n < 0 && errno == EINTR) {
+						continue;
+					}
+					else {
+						if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+							conn.peer_closed = true;
+						}
+						break;
+					}
+				}
+				return advance(sock, conn);
+			};
+
+			auto next_sweep = std::chrono::steady_clock::now();
+			std::vector<epoll_event> events(256);
+
+			while (svr_sock_ != INVALID_SOCKET) {
+				auto timeout = 100;
+				if (!timers.empty()) {
+					auto wait = std::get<0>(timers.top()) - shaperNowNs();
+					timeout = wait <= 0 ? 0 : (int)std::min<long long>(timeout, (wait + 999999) / 1000000);
+				}
+				auto n = epoll_wait(epfd, events.data(), (int)events.size(), timeout);
+				if (n < 0) {
+					if (errno == EINTR) {
+						continue;
+					}
+					ret = false;
+					break;
+				}
+
+				for (int i = 0; i < n; i++) {
+					socket_t sock = events[i].data.fd;
+
+					if (sock == listen_sock) {
+						// take everything the backlog holds, the listening socket is non-blocking
+						for (;;) {
+							socket_t client = accept(listen_sock, NULL, NULL);
+							if (client == INVALID_SOCKET) {
+								break;
+							}
+							detail::set_nonblocking(client, true);
+
+							auto& conn = connections[client];
+							conn.state = State::Reading;
+							conn.generation = ++generations;
+							conn.requests_left = keep_alive_max_count_ > 0 ? keep_alive_max_count_ : 1;
+							conn.peer_closed = false;
+							conn.request_start = shaperNowNs();
+							conn.idle_since = std::chrono::steady_clock::now();
+							conn.keep = false;
+							active_connections_++;
+
+							epoll_event conn_ev = {};
+							conn_ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+							conn_ev.data.fd = client;
+							epoll_ctl(epfd, EPOLL_CTL_ADD, client, &conn_ev);
+						}
+						continue;
+					}
+
+					if (sock == wakefd) {
+						uint64_t count;
+						auto drained = ::read(wakefd, &count, sizeof(count));
+						(void)drained;
+						std::vector<Finished> done;
+						{
+							std::lock_guard<std::mutex> guard(finished_mutex);
+							done.swap(finished);
+						}
+						for (const auto& f : done) {
+							auto it = connections.find(f.sock);
+							if (it == connections.end()) {
+								continue;
+							}
+							if (it->second.state == State::Http2) {
+								close_connection(it);
+								continue;
+							}
+							it->second.state = State::Sending;
+							it->second.keep = f.keep && svr_sock_ != INVALID_SOCKET;
+							it->second.bucket = bucketForSocket(f.sock);
+							if (!advance(f.sock, it->second)) {
+								close_connection(it);
+							}
+						}
+						continue;
+					}
+
+					// events of a descriptor closed and accepted again within this batch only cause a read or a send
+					// that finds nothing to do
+					auto it = connections.find(sock);
+					if (it == connections.end()) {
+						continue;
+					}
+					auto& conn = it->second;
+					auto keep = true;
+					if (conn.state == State::Reading) {
+						keep = readable(sock, conn);
+					}
+					else if (conn.state == State::Sending) {
+						keep = advance(sock, conn);
+					}
+					if (!keep) {
+						close_connection(it);
+					}
+				}
+
+				// continue the shaped sends and the requests whose round trip is over
+				auto now = shaperNowNs();
+				while (!timers.empty() && std::get<0>(timers.top()) <= now) {
+					auto timer = timers.top();
+					timers.pop();
+					auto it = connections.find(std::get<1>(timer));
+					if (it != connections.end() && it->second.generation == std::get<2>(timer) && !advance(it->first, it->second)) {
+						close_connection(it);
+					}
+				}
+
+				// close connections that sent nothing within the keep-alive timeout, a started request included
+				auto steady_now = std::chrono::steady_clock::now();
+				if (steady_now >= next_sweep) {
+					next_sweep = steady_now + std::chrono::milliseconds(100);
+					for (auto it = connections.begin(); it != connections.end();) {
+						auto current = it++;
+						if (current->second.state == State::Reading && steady_now - current->second.idle_since > keep_alive_timeout) {
+							close_connection(current);
+						}
+					}
+				}
+			}
+
+			if (!ret) {
+				detail::close_socket(svr_sock_);
+				svr_sock_ = INVALID_SOCKET;
+			}
+			// the workers finish the queued requests before they are joined, their answers are not sent anymore
+		}
+
+		for (auto& conn : connections) {
+			detail::close_socket(conn.first);
+		}
+		active_connections_ -= connections.size();
+		close(wakefd);
+		close(epfd);
+
+		is_running_ = false;
+
+		return ret;
+#else
+		return false;
+#endif
+	}
+
 	inline bool Server::routing(Request& req, Response& res)
 	{
-		if (req.method == "GET" && handle_file_request(req, res)) {
+		if ((req.method == "GET" || req.method == "HEAD") && pre_routing_handler_ && pre_routing_handler_(req, res)) {
+			return true;
+		}
+
+		if ((req.method == "GET" || req.method == "HEAD") && handle_file_request(req, res)) {
 			return true;
 		}
 
@@ -1837,9 +3014,15 @@ namespace httplib
 			return false;
 		}
 
+		// a client that knows the server speaks HTTP/2 starts the connection with this line of its preface
+		if (!strcmp(reader.ptr(), "PRI * HTTP/2.0\r\n")) {
+			return serve_http2(strm);
+		}
+
 		Request req;
 		Response res;
 
+		req.received = std::chrono::steady_clock::now();
 		res.version = "HTTP/1.1";
 
 		// Request line and headers
@@ -1857,6 +3040,10 @@ namespace httplib
 
 		req.set_header("REMOTE_ADDR", strm.get_remote_addr().c_str());
 
+		// load tests tell their clients apart by a session token in a header or the query
+		auto session = req.has_header("X-Session") ? req.get_header_value("X-Session") : req.get_param_value("session");
+		strm.set_shaping_profile(sessionProfile(session, false));
+
 		// Body
 		if (req.method == "POST" || req.method == "PUT") {
 			if (!detail::read_content(strm, req)) {
@@ -1904,6 +3091,555 @@ namespace httplib
 		return ret;
 	}
 
+	inline bool Server::serve_http2(Stream& strm)
+	{
+		struct Http2Stream {
+			Request req;
+			Response res;
+			// the request line or its headers could not be parsed, it is answered with 400
+			bool malformed = false;
+			// the request is complete and was handed to a handler, no more frames may add to it
+			bool dispatched = false;
+			// the handler has filled res, which goes out one round trip after the request arrived
+			bool answered = false;
+			std::chrono::steady_clock::time_point ready_at;
+			bool headers_sent = false;
+			const char* body = nullptr;
+			size_t length = 0;
+			size_t sent = 0;
+			int64_t window = 0;
+			std::shared_ptr<ShapingProfile> profile;
+		};
+
+		auto sock = strm.socket();
+		char rest[http2::prefaceLength - 16];
+		for (size_t r = 0; r < sizeof(rest);) {
+			auto n = sock == INVALID_SOCKET ? -1 : strm.read(rest + r, sizeof(rest) - r);
+			if (n <= 0) {
+				return false;
+			}
+			r += n;
+		}
+		if (memcmp(rest, http2::connectionPreface + 16, sizeof(rest))) {
+			return false;
+		}
+		// frames are small and each one is waited for
+		int no_delay = 1;
+		setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (char*)&no_delay, sizeof(no_delay));
+
+		std::mutex mtx;
+		std::condition_variable cv;
+		std::map<uint32_t, std::shared_ptr<Http2Stream>> streams;
+		// the priorities of idle and closed streams take at most the room of three times the open ones
+		http2::PriorityTree tree(4 * CPPHTTPLIB_HTTP2_MAX_STREAMS);
+		// frames the sender writes before any DATA
+		std::string control;
+		auto done = false;
+		int64_t conn_window = http2::defaultWindow;
+		uint32_t peer_initial_window = http2::defaultWindow;
+		uint32_t peer_max_frame = http2::defaultFrameSize;
+		const uint32_t stream_window = 1 << 20;
+		const auto rtt = std::chrono::nanoseconds(rttNs.load(std::memory_order_relaxed));
+
+		http2::appendSettings(control, { { http2::MaxConcurrentStreams, CPPHTTPLIB_HTTP2_MAX_STREAMS },
+			{ http2::InitialWindowSize, stream_window }, { http2::MaxHeaderListSize, CPPHTTPLIB_HTTP2_MAX_HEADER_LIST_SIZE } });
+
+		// the stream whose frame goes out next: the priority tree picks among the streams with an answer due and
+		// either their headers still to send or a window for their body
+		auto sendable = [&](std::chrono::steady_clock::time_point now) {
+			return [&, now](uint32_t id) {
+				auto it = streams.find(id);
+				if (it == streams.end() || !it->second->answered || it->second->ready_at > now) {
+					return false;
+				}
+				auto& s = *it->second;
+				return !s.headers_sent || (s.sent < s.length && s.window > 0 && conn_window > 0);
+			};
+		};
+
+		std::thread sender([&]() {
+			std::unique_lock<std::mutex> lock(mtx);
+			while (true) {
+				if (!control.empty()) {
+					std::string frames;
+					frames.swap(control);
+					lock.unlock();
+					strm.set_shaping_profile(nullptr);
+					auto ok = strm.write(frames.data(), frames.size()) == (int)frames.size();
+					lock.lock();
+					if (!ok) {
+						break;
+					}
+					continue;
+				}
+				if (done) {
+					break;
+				}
+
+				auto now = std::chrono::steady_clock::now();
+				auto id = tree.next(sendable(now));
+				if (id == 0) {
+					auto wake = now + std::chrono::seconds(1);
+					for (auto& s : streams) {
+						if (s.second->answered && !s.second->headers_sent && s.second->ready_at > now) {
+							wake = std::min(wake, s.second->ready_at);
+						}
+					}
+					cv.wait_until(lock, wake);
+					continue;
+				}
+
+				auto s = streams[id];
+				std::string frames;
+				if (!s->headers_sent) {
+					http2::HeaderList fields = { { ":status", std::to_string(s->res.status) } };
+					for (const auto& field : s->res.headers) {
+						if (!http2::isConnectionHeader(field.first)) {
+							fields.push_back(field);
+						}
+					}
+					std::string block;
+					http2::HpackEncoder::encode(fields, block);
+					http2::appendHeaders(frames, id, block, s->length == 0, peer_max_frame);
+					s->headers_sent = true;
+				}
+				else {
+					auto chunk = std::min<size_t>({ s->length - s->sent, size_t(s->window), size_t(conn_window), peer_max_frame });
+					http2::appendFrame(frames, http2::Data, s->sent + chunk == s->length ? http2::EndStream : 0, id, s->body + s->sent, chunk);
+					s->sent += chunk;
+					s->window -= chunk;
+					conn_window -= chunk;
+					tree.sent(id, chunk);
+				}
+				auto complete = s->sent == s->length;
+				if (complete) {
+					streams.erase(id);
+					tree.remove(id);
+				}
+
+				lock.unlock();
+				strm.set_shaping_profile(s->profile);
+				auto ok = strm.write(frames.data(), frames.size()) == (int)frames.size();
+				if (ok && complete) {
+					if (logger_) {
+						logger_(s->req, s->res);
+					}
+					if (observer_) {
+						observer_(s->req, s->res, std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - s->req.received));
+					}
+				}
+				lock.lock();
+				if (!ok) {
+					break;
+				}
+			}
+			// a failed write ends the connection
+			done = true;
+			cv.notify_all();
+		});
+
+		// the handlers of the requests, declared last so it is joined before the state they use goes away
+		detail::WorkerPool handlers(CPPHTTPLIB_HTTP2_HANDLER_THREADS);
+		auto dispatch = [&](std::shared_ptr<Http2Stream> s) {
+			s->dispatched = true;
+			handlers.enqueue([this, s, &mtx, &cv]() {
+				auto& req = s->req;
+				auto& res = s->res;
+				if (s->malformed) {
+					res.status = 400;
+				}
+				else {
+					const auto& content_type = req.get_header_value("Content-Type");
+					if (!content_type.find("application/x-www-form-urlencoded")) {
+						detail::parse_query_text(req.body, req.params);
+					}
+					else if (!content_type.find("multipart/form-data")) {
+						std::string boundary;
+						if (!detail::parse_multipart_boundary(content_type, boundary) ||
+							!detail::parse_multipart_formdata(boundary, req.body, req.files)) {
+							res.status = 400;
+						}
+					}
+					if (res.status == -1) {
+						if (routing(req, res)) {
+							if (res.status == -1) {
+								res.status = 200;
+							}
+						}
+						else {
+							res.status = 404;
+						}
+					}
+				}
+				finish_response(req, res);
+
+				const char* body = nullptr;
+				size_t length = 0;
+				if (req.method != "HEAD") {
+					if (res.file) {
+						if (res.status == 206) {
+							body = res.file->data() + res.file_offset;
+							length = res.file_length;
+						}
+						else if (res.status != 416) {
+							body = res.file->data();
+							length = res.file->size();
+						}
+					}
+					else {
+						body = res.body.data();
+						length = res.body.size();
+					}
+				}
+
+				std::lock_guard<std::mutex> guard(mtx);
+				s->body = body;
+				s->length = length;
+				s->answered = true;
+				cv.notify_all();
+			});
+		};
+
+		// frames are read here; a header block in CONTINUATION frames must not be interleaved with other frames
+		http2::HpackDecoder decoder;
+		uint32_t last_stream = 0;
+		uint32_t header_stream = 0;
+		auto header_end_stream = false;
+		std::string header_block;
+		auto idle_since = std::chrono::steady_clock::now();
+
+		// a frame for a stream whose request is already complete: the stream is reset, its answer is dropped
+		auto close_stream = [&](uint32_t id) {
+			http2::appendRstStream(control, id, http2::StreamClosed);
+			streams.erase(id);
+			tree.remove(id);
+			cv.notify_all();
+		};
+
+		// the priority of a stream that is not open takes room only while the tree has some; the closed and
+		// never opened streams below the last one are dropped first, once for every new last stream
+		uint32_t pruned_below = 0;
+		auto set_priority = [&](uint32_t id, http2::StreamPriority priority) {
+			if (!tree.contains(id) && !streams.count(id) && tree.full() && pruned_below != last_stream) {
+				pruned_below = last_stream;
+				tree.prune([&](uint32_t stream) { return stream <= last_stream && !streams.count(stream); });
+			}
+			tree.set(id, priority);
+		};
+
+		auto receive = [&](char* ptr, size_t size) {
+			for (size_t r = 0; r < size;) {
+				auto n = strm.buffered() > 0 ? strm.read(ptr + r, size - r) : recv(sock, ptr + r, (int)(size - r), 0);
+				if (n <= 0) {
+					return false;
+				}
+				r += n;
+			}
+			return true;
+		};
+
+		// the request of a complete header block, answered once its body has arrived too
+		auto request = [&](uint32_t id) {
+			http2::HeaderList fields;
+			if (!decoder.decode(header_block.data(), header_block.size(), fields)) {
+				return (uint32_t)http2::CompressionError;
+			}
+
+			std::lock_guard<std::mutex> guard(mtx);
+			auto it = streams.find(id);
+			if (it != streams.end()) {
+				if (it->second->dispatched) {
+					close_stream(id);
+				}
+				// trailers end the body
+				else if (header_end_stream) {
+					dispatch(it->second);
+				}
+				return (uint32_t)http2::NoError;
+			}
+			if (id <= last_stream || id % 2 == 0) {
+				return (uint32_t)http2::ProtocolError;
+			}
+			last_stream = id;
+			if (streams.size() >= CPPHTTPLIB_HTTP2_MAX_STREAMS) {
+				http2::appendRstStream(control, id, http2::RefusedStream);
+				tree.remove(id);
+				cv.notify_all();
+				return (uint32_t)http2::NoError;
+			}
+
+			auto s = std::make_shared<Http2Stream>();
+			auto& req = s->req;
+			std::string method, path, authority;
+			for (auto& field : fields) {
+				if (field.first == ":method") {
+					method = field.second;
+				}
+				else if (field.first == ":path") {
+					path = field.second;
+				}
+				else if (field.first == ":authority") {
+					authority = field.second;
+				}
+				else if (!field.first.empty() && field.first[0] != ':') {
+					req.headers.emplace(field.first, field.second);
+				}
+			}
+			// the pseudo-headers go through the parser of the request line
+			s->malformed = !parse_request_line((method + " " + path + " HTTP/1.1\r\n").c_str(), req);
+			req.version = "HTTP/2";
+			req.received = std::chrono::steady_clock::now();
+			if (!authority.empty() && !req.has_header("Host")) {
+				req.set_header("Host", authority.c_str());
+			}
+			req.set_header("REMOTE_ADDR", strm.get_remote_addr().c_str());
+			auto session = req.has_header("X-Session") ? req.get_header_value("X-Session") : req.get_param_value("session");
+			s->profile = sessionProfile(session, false);
+			s->ready_at = req.received + rtt;
+			s->window = peer_initial_window;
+
+			streams[id] = s;
+			if (!tree.contains(id)) {
+				// an open stream always finds room, the open ones are fewer than the tree holds
+				if (tree.full()) {
+					tree.prune([&](uint32_t stream) { return !streams.count(stream); });
+				}
+				tree.set(id, http2::StreamPriority{ 0, false, 16 });
+			}
+			if (header_end_stream) {
+				dispatch(s);
+			}
+			return (uint32_t)http2::NoError;
+		};
+
+		auto error = (uint32_t)http2::NoError;
+		auto goaway = false;
+		char head[http2::frameHeaderLength];
+		std::string payload;
+		while (error == http2::NoError && !goaway) {
+			// idle connections are polled so they can be closed
+			auto ready = strm.buffered() > 0 ? 1 : detail::select_read(sock, 1, 0);
+			if (ready < 0) {
+				break;
+			}
+			{
+				std::lock_guard<std::mutex> guard(mtx);
+				if (done) {
+					break;
+				}
+				auto now = std::chrono::steady_clock::now();
+				if (!streams.empty() || ready > 0) {
+					idle_since = now;
+				}
+				else if (now - idle_since > std::chrono::seconds(CPPHTTPLIB_HTTP2_IDLE_TIMEOUT_SECOND)) {
+					http2::appendGoAway(control, last_stream, http2::NoError);
+					break;
+				}
+			}
+			if (ready == 0) {
+				continue;
+			}
+
+			if (!receive(head, sizeof(head))) {
+				break;
+			}
+			auto frame = http2::parseFrameHeader(head);
+			if (frame.length > http2::defaultFrameSize) {
+				error = http2::FrameSizeError;
+				break;
+			}
+			payload.resize(frame.length);
+			if (!receive(&payload[0], frame.length)) {
+				break;
+			}
+
+			if (header_stream != 0 && (frame.type != http2::Continuation || frame.stream != header_stream)) {
+				error = http2::ProtocolError;
+				break;
+			}
+
+			const char* data = payload.data();
+			size_t length = 0;
+			http2::StreamPriority priority{ 0, false, 16 };
+			switch (frame.type) {
+			case http2::Headers:
+				if (frame.stream == 0 || !http2::framePayload(frame, data, length, &priority)) {
+					error = http2::ProtocolError;
+					break;
+				}
+				if (frame.flags & http2::PriorityFlag) {
+					std::lock_guard<std::mutex> guard(mtx);
+					set_priority(frame.stream, priority);
+				}
+				header_stream = frame.stream;
+				header_end_stream = (frame.flags & http2::EndStream) != 0;
+				header_block.assign(data, length);
+				if (frame.flags & http2::EndHeaders) {
+					header_stream = 0;
+					error = request(frame.stream);
+				}
+				break;
+
+			case http2::Continuation:
+				if (header_stream == 0) {
+					error = http2::ProtocolError;
+					break;
+				}
+				// the block can not be skipped without losing the state of the decoder, a peer sending more ends the connection
+				if (header_block.size() + payload.size() > CPPHTTPLIB_HTTP2_MAX_HEADER_LIST_SIZE) {
+					error = http2::EnhanceYourCalm;
+					break;
+				}
+				header_block += payload;
+				if (frame.flags & http2::EndHeaders) {
+					auto id = header_stream;
+					header_stream = 0;
+					error = request(id);
+				}
+				break;
+
+			case http2::Data: {
+				if (frame.stream == 0 || !http2::framePayload(frame, data, length)) {
+					error = http2::ProtocolError;
+					break;
+				}
+				// request bodies are kept whole, their windows are given back as they arrive
+				std::lock_guard<std::mutex> guard(mtx);
+				if (frame.length > 0) {
+					http2::appendWindowUpdate(control, 0, frame.length);
+				}
+				auto it = streams.find(frame.stream);
+				if (it == streams.end()) {
+					break;
+				}
+				if (it->second->dispatched) {
+					close_stream(frame.stream);
+					break;
+				}
+				it->second->req.body.append(data, length);
+				if (frame.flags & http2::EndStream) {
+					dispatch(it->second);
+				}
+				else if (frame.length > 0) {
+					http2::appendWindowUpdate(control, frame.stream, frame.length);
+				}
+				cv.notify_all();
+				break;
+			}
+
+			case http2::Priority: {
+				if (frame.stream == 0 || payload.size() != 5 || !http2::framePayload(frame, data, length, &priority)) {
+					error = http2::ProtocolError;
+					break;
+				}
+				std::lock_guard<std::mutex> guard(mtx);
+				set_priority(frame.stream, priority);
+				cv.notify_all();
+				break;
+			}
+
+			case http2::RstStream: {
+				if (payload.size() != 4) {
+					error = http2::FrameSizeError;
+					break;
+				}
+				std::lock_guard<std::mutex> guard(mtx);
+				streams.erase(frame.stream);
+				tree.remove(frame.stream);
+				cv.notify_all();
+				break;
+			}
+
+			case http2::Settings: {
+				if (frame.flags & http2::Ack) {
+					break;
+				}
+				http2::SettingList settings;
+				if (frame.stream != 0 || !http2::parseSettings(data, payload.size(), settings)) {
+					error = http2::FrameSizeError;
+					break;
+				}
+				std::lock_guard<std::mutex> guard(mtx);
+				for (auto& setting : settings) {
+					if (setting.first == http2::InitialWindowSize) {
+						if (setting.second > http2::maxWindow) {
+							error = http2::FlowControlError;
+							break;
+						}
+						for (auto& s : streams) {
+							s.second->window += int64_t(setting.second) - peer_initial_window;
+						}
+						peer_initial_window = setting.second;
+					}
+					else if (setting.first == http2::MaxFrameSize) {
+						peer_max_frame = std::max(http2::defaultFrameSize, std::min<uint32_t>(setting.second, 0xffffff));
+					}
+				}
+				http2::appendFrame(control, http2::Settings, http2::Ack, 0);
+				cv.notify_all();
+				break;
+			}
+
+			case http2::Ping: {
+				if (payload.size() != 8) {
+					error = http2::FrameSizeError;
+					break;
+				}
+				if (!(frame.flags & http2::Ack)) {
+					std::lock_guard<std::mutex> guard(mtx);
+					http2::appendFrame(control, http2::Ping, http2::Ack, 0, data, payload.size());
+					cv.notify_all();
+				}
+				break;
+			}
+
+			case http2::WindowUpdate: {
+				if (payload.size() != 4) {
+					error = http2::FrameSizeError;
+					break;
+				}
+				auto increment = http2::getUint32(data) & 0x7fffffff;
+				std::lock_guard<std::mutex> guard(mtx);
+				if (frame.stream == 0) {
+					conn_window += increment;
+				}
+				else {
+					auto it = streams.find(frame.stream);
+					if (it != streams.end()) {
+						it->second->window += increment;
+					}
+				}
+				cv.notify_all();
+				break;
+			}
+
+			case http2::GoAway:
+				// the client is done with the connection
+				goaway = true;
+				break;
+
+			case http2::PushPromise:
+				error = http2::ProtocolError;
+				break;
+
+			default:
+				// frames of extensions are ignored
+				break;
+			}
+		}
+
+		{
+			std::lock_guard<std::mutex> guard(mtx);
+			if (error != http2::NoError) {
+				http2::appendGoAway(control, last_stream, error);
+			}
+			done = true;
+			cv.notify_all();
+		}
+		sender.join();
+		return false;
+	}
+
 	inline bool Server::is_valid() const
 	{
 		return true;
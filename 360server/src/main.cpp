@@ -4,13 +4,22 @@
 */
 #include <iostream>
 #include <sstream>
+#include <regex>
 #include "httplib.h"
+#include "MpdIndex.hpp"
+#include "MpdCatalog.hpp"
+#include "LivePopularity.hpp"
+#include "Metrics.hpp"
 
-std::thread* networkTraceThread;
-const size_t networkTraceSampleDurMs = 250;
-bool runTrace = false;
-bool resetTrace = false;
-std::map<std::string, std::map<size_t, size_t>> netTraces;
+// parsed delivery traces by path, the active one is restarted on its clock by /tracereset
+std::map<std::string, std::shared_ptr<const httplib::DeliveryTrace>> netTraces;
+std::mutex netTracesMtx;
+httplib::Server* server;
+std::string wwwDir;
+// static MPDs read at startup with --catalog
+MpdCatalog catalog;
+// tile popularity uploaded by the players, counts halve every 5 minutes unless set otherwise
+LivePopularity livePopularity(300);
 
 
 void printHelp()
@@ -18,58 +27,182 @@ void printHelp()
 	std::cout <<
 		"bw [bytes/s]  - set bandwidth\n" <<
 		"trace [path]  - run network trace\n" <<
+		"rtt [ms]      - set emulated round trip time\n" <<
+		"loss [rate]   - set packet loss rate of traced links\n" <<
+		"shaping [link|client] - shape the whole link or every client separately\n" <<
+		"popularity [mpd] - keep popular tiles of an mpd cached\n" <<
+		"halflife [s]  - half life of the live popularity, 0 keeps every upload\n" <<
 		"quit          - close server\n";
 	std::cout << std::endl;
 }
 
-void networkTrace(const std::map<size_t, size_t>& trace)
+void stopNetworkTrace()
+{
+	httplib::setTrace(nullptr);
+}
+
+// parsed trace of path starting at 0, nullptr if it holds no opportunity
+std::shared_ptr<const httplib::DeliveryTrace> loadNetworkTrace(const std::string& path)
 {
-	while (runTrace)
+	std::lock_guard<std::mutex> l(netTracesMtx);
+	auto& trace = netTraces[path];
+	if (!trace)
 	{
-		resetTrace = false;
-		for (auto& pair : trace)
-		{
-			httplib::bandwidth = pair.second;
-			std::this_thread::sleep_for(std::chrono::milliseconds(networkTraceSampleDurMs));
-			if (!runTrace || resetTrace)
-				break;
-		}
+		std::ifstream traceFile(path);
+		std::vector<long long> timestamps;
+		long long timestamp;
+		while (traceFile >> timestamp)
+			timestamps.push_back(timestamp);
+		trace = std::make_shared<const httplib::DeliveryTrace>(std::move(timestamps), 0);
+		if (trace->empty())
+			std::cout << "empty network trace: " << path << std::endl;
 	}
+	return trace->empty() ? nullptr : trace;
 }
 
-void stopNetworkTrace()
+// the trace replayed on the shaper clock as if it had started offsetMs ago, it loops from there without drifting
+std::shared_ptr<const httplib::DeliveryTrace> replayNetworkTrace(const std::shared_ptr<const httplib::DeliveryTrace>& trace, long long offsetMs = 0)
 {
-	runTrace = false;
-	if (networkTraceThread && networkTraceThread->joinable())
-		networkTraceThread->join();
+	if (!trace)
+		return nullptr;
+	return std::make_shared<const httplib::DeliveryTrace>(*trace, httplib::shaperNowNs() - offsetMs * 1000000);
 }
 
 void startNetworkTrace(const std::string& path)
 {
-	stopNetworkTrace();
+	httplib::setTrace(replayNetworkTrace(loadNetworkTrace(path)));
+}
+
+void restartNetworkTrace()
+{
+	auto trace = httplib::activeTrace();
+	if (trace)
+		httplib::setTrace(replayNetworkTrace(trace));
+}
+
+std::map<std::string, std::shared_ptr<const MpdIndex>> mpdIndices;
+std::mutex mpdIndicesMtx;
+
+// parsed once per path, nullptr if the MPD does not exist
+std::shared_ptr<const MpdIndex> loadMpd(const std::string& mpdPath)
+{
+	std::lock_guard<std::mutex> l(mpdIndicesMtx);
+	auto it = mpdIndices.find(mpdPath);
+	if (it != mpdIndices.end())
+		return it->second;
+
+	std::ifstream mpdFile(wwwDir + mpdPath);
+	if (!mpdFile)
+		return nullptr;
+	std::stringstream ss;
+	ss << mpdFile.rdbuf();
+	return mpdIndices[mpdPath] = std::make_shared<const MpdIndex>(ss.str());
+}
+
+// gives the representations named by the <Popularity> element of an MPD a higher cache priority, returns their number
+size_t seedPopularity(const std::string& mpdPath)
+{
+	auto index = loadMpd(mpdPath);
+	if (!index)
+		return 0;
+
+	auto urls = index->popularUrls();
+	for (auto& url : urls)
+		server->set_file_priority(url, 1);
+	return urls.size();
+}
+
+// answers a batch of tiles of one segment, every part is the line "tile quality length\r\n" followed by the file.
+// Missing segments are sent with length 0
+void serveTileBatch(const std::string& mpdPath, size_t segment, const std::string& tiles, httplib::Response& res)
+{
+	auto index = loadMpd(mpdPath);
+	if (!index)
+	{
+		res.status = 404;
+		return;
+	}
 
-	if (netTraces.find(path) == netTraces.end())
+	std::vector<std::pair<size_t, size_t>> parts;
+	std::vector<std::shared_ptr<const httplib::detail::MappedFile>> files;
+	size_t length = 0;
+	std::istringstream ts(tiles);
+	size_t tile, quality;
+	char sep;
+	while (ts >> tile >> sep >> quality)
 	{
-		std::ifstream traceFile(path);
-		std::map<size_t, size_t> netTrace;
-		int timestamp;
-		while (!traceFile.eof())
+		auto file = server->get_file(index->segmentUrl(tile, quality, segment));
+		parts.push_back({ tile, quality });
+		files.push_back(file);
+		length += file ? file->size() : 0;
+		ts >> sep;
+	}
+
+	std::string body;
+	body.reserve(length + parts.size() * 32);
+	for (size_t i = 0; i < parts.size(); i++)
+	{
+		size_t size = files[i] ? files[i]->size() : 0;
+		body += std::to_string(parts[i].first) + " " + std::to_string(parts[i].second) + " " + std::to_string(size) + "\r\n";
+		if (size > 0)
+			body.append(files[i]->data(), size);
+	}
+	res.set_content(body, "application/x-tile-batch");
+}
+
+// bytes per second the link of the request's session currently delivers
+size_t sessionBandwidth(const httplib::Request& req)
+{
+	auto session = req.has_header("X-Session") ? req.get_header_value("X-Session") : req.get_param_value("session");
+	auto profile = httplib::sessionProfile(session, false);
+	if (!profile)
+		return httplib::currentBandwidth();
+	auto trace = std::atomic_load(&profile->trace);
+	return trace ? trace->rateAt(httplib::shaperNowNs()) : profile->bandwidth.load();
+}
+
+// served requests, bytes and service times for /metrics, service time runs from the request line to the last byte sent
+struct ServerMetrics
+{
+	std::atomic<unsigned long long> requests[6];
+	std::atomic<unsigned long long> bytesSent;
+	Metrics::Histogram serviceSeconds;
+
+	ServerMetrics() : bytesSent(0), serviceSeconds(Metrics::latencyBounds())
+	{
+		for (auto& r : requests)
+			r = 0;
+	}
+
+	void observe(const httplib::Request& req, const httplib::Response& res, std::chrono::microseconds serviceTime)
+	{
+		size_t bytes = 0;
+		if (req.method != "HEAD")
 		{
-			traceFile >> timestamp;
-			size_t add = 1500 * (1000.0 / networkTraceSampleDurMs);
-			int ts = timestamp / networkTraceSampleDurMs * networkTraceSampleDurMs;
-			if (netTrace.find(ts) != netTrace.end())
-				netTrace[ts] += add;
+			if (res.file)
+				bytes = res.status == 206 ? res.file_length : res.status != 416 ? res.file->size() : 0;
 			else
-				netTrace[ts] = add;
+				bytes = res.body.size();
 		}
-		netTraces[path] = netTrace;
+		requests[std::min(5, std::max(0, res.status / 100))]++;
+		bytesSent += bytes;
+		serviceSeconds.observe(serviceTime.count() / 1e6);
 	}
 
-	runTrace = true;
-	networkTraceThread = new std::thread(networkTrace, netTraces.at(path));
-	networkTraceThread->detach();
-}
+	std::string write(const httplib::Server& sv) const
+	{
+		std::stringstream ss;
+		Metrics::header(ss, "server_requests_total", "Responses sent by status class", "counter");
+		for (int c = 1; c <= 5; c++)
+			Metrics::sample(ss, "server_requests_total", requests[c].load(), "code=\"" + std::to_string(c) + "xx\"");
+		Metrics::counter(ss, "server_sent_bytes_total", "Body bytes sent, rate() of it is the throughput", bytesSent.load());
+		serviceSeconds.write(ss, "server_request_seconds", "Time from reading a request line to sending the last byte of its response");
+		Metrics::gauge(ss, "server_active_connections", "Open client connections", sv.active_connections());
+		Metrics::gauge(ss, "server_bandwidth_limit_bytes", "Bytes per second the shaped link delivers now", httplib::currentBandwidth());
+		return ss.str();
+	}
+};
+ServerMetrics serverMetrics;
 
 void processCommand(const std::string& cmd)
 {
@@ -92,6 +225,36 @@ void processCommand(const std::string& cmd)
 		ss >> path;
 		startNetworkTrace(path);
 	}
+	else if (basecmd == "rtt")
+	{
+		double rtt;
+		ss >> rtt;
+		httplib::rttNs = (long long)(rtt * 1e6);
+	}
+	else if (basecmd == "loss")
+	{
+		double loss;
+		ss >> loss;
+		httplib::lossRate = loss;
+	}
+	else if (basecmd == "shaping")
+	{
+		std::string mode;
+		ss >> mode;
+		httplib::shapingMode = mode == "client" ? httplib::ShapingMode::PerClient : httplib::ShapingMode::Link;
+	}
+	else if (basecmd == "popularity")
+	{
+		std::string path;
+		ss >> path;
+		std::cout << seedPopularity(path) << " popular segments" << std::endl;
+	}
+	else if (basecmd == "halflife")
+	{
+		double seconds;
+		ss >> seconds;
+		livePopularity.setHalfLife(seconds);
+	}
 	else
 		printHelp();
 }
@@ -100,19 +263,68 @@ int main(int argc, char* argv[])
 {
 	using namespace httplib;
 
-	if (argc != 2)
+	// --catalog may stand anywhere, the other arguments keep their order
+	bool catalogMode = false;
+	std::vector<char*> args;
+	for (int i = 0; i < argc; i++)
+	{
+		if (std::string(argv[i]) == "--catalog")
+			catalogMode = true;
+		else
+			args.push_back(argv[i]);
+	}
+	argc = (int)args.size();
+	argv = args.data();
+
+	if (argc < 2 || argc > 4)
 	{
-		std::cout << "Start with www directory path as argument." << std::endl;
+		std::cout << "Start with www directory path as argument, optionally followed by the number of worker threads and the listen backlog. "
+			"--catalog serves the MPDs below it from memory." << std::endl;
 		return -1;
 	}
 
+	// workers only run the handlers, the event loop reads the requests and sends the throttled answers
+	size_t workers = argc > 2 ? std::stoul(argv[2]) : 64;
+	int backlog = argc > 3 ? std::stoi(argv[3]) : SOMAXCONN;
+
 	std::cout << "www directory: " << argv[1] << std::endl;
 
 	Server sv;
+	server = &sv;
+	wwwDir = argv[1];
 	sv.set_base_dir(argv[1]);
+	sv.set_thread_pool_size(workers);
+	sv.set_listen_backlog(backlog);
+	// players fetch every tile of every segment over the same few connections
+	sv.set_keep_alive_max_count(1000);
+	sv.set_observer([](const Request& req, const Response& res, std::chrono::microseconds serviceTime) {
+		serverMetrics.observe(req, res, serviceTime);
+	});
+
+	if (catalogMode)
+	{
+		std::cout << catalog.build(wwwDir) << " MPDs in the catalog" << std::endl;
+		{
+			std::lock_guard<std::mutex> l(mpdIndicesMtx);
+			mpdIndices = catalog.indices();
+		}
+		sv.set_pre_routing_handler([](const Request& req, Response& res) {
+			return catalog.serve(req, res);
+		});
+	}
+
+	sv.Get("/catalog", [&](const Request& req, Response& res) {
+		res.set_content(catalog.list(), "text/plain");
+	});
+
+	// Prometheus text format, scraping it is counted like any other request
+	sv.Get("/metrics", [&](const Request& req, Response& res) {
+		res.set_content(serverMetrics.write(sv), "text/plain; version=0.0.4");
+	});
+
 	sv.Get("/cntrl", [](const Request& req, Response& res) {
 		std::string cntrlContent;
-		cntrlContent.resize(httplib::bandwidth / 10 + 1, 'c');
+		cntrlContent.resize(sessionBandwidth(req) / 10 + 1, 'c');
 		res.set_content(cntrlContent, "text/plain");
 	});
 
@@ -129,8 +341,98 @@ int main(int argc, char* argv[])
 		res.set_content("ok", "text/plain");
 	});
 
+	sv.Get(R"(/rtt/(\d+))", [&](const Request& req, Response& res) {
+		httplib::rttNs = std::stoll(req.matches[1]) * 1000000;
+		res.set_content("ok", "text/plain");
+	});
+
+	sv.Get(R"(/loss/([0-9.]+))", [&](const Request& req, Response& res) {
+		httplib::lossRate = std::stod(req.matches[1]);
+		res.set_content("ok", "text/plain");
+	});
+
+	sv.Get(R"(/shaping/(link|client))", [&](const Request& req, Response& res) {
+		httplib::shapingMode = req.matches[1] == "client" ? httplib::ShapingMode::PerClient : httplib::ShapingMode::Link;
+		res.set_content("ok", "text/plain");
+	});
+
+	// deterministic url per choice of tiles so caches can keep batches like files
+	sv.Get(R"(/batch/([^\s]+\.mpd)/(\d+)/(\d+-\d+(?:,\d+-\d+)*))", [&](const Request& req, Response& res) {
+		serveTileBatch("/" + req.matches[1].str(), std::stoul(req.matches[2]), req.matches[3], res);
+	});
+
+	sv.Get(R"(/popularity/([^\s]+))", [&](const Request& req, Response& res) {
+		std::string path = "/" + req.matches[1].str();
+		res.set_content(std::to_string(seedPopularity(path)), "text/plain");
+	});
+
+	// players upload the viewport samples per tile of the segments they played and poll what the audience watches,
+	// first and count select the segments of the answer
+	sv.Post(R"(/livepopularity/([^\s]+))", [&](const Request& req, Response& res) {
+		res.set_content(std::to_string(livePopularity.add("/" + req.matches[1].str(), req.body)), "text/plain");
+	});
+
+	sv.Get(R"(/livepopularity/([^\s]+))", [&](const Request& req, Response& res) {
+		long long first = 0;
+		long long count = -1;
+		if ((req.has_param("first") && !detail::parse_integer(req.get_param_value("first"), 0, INT_MAX, first))
+			|| (req.has_param("count") && !detail::parse_integer(req.get_param_value("count"), -1, INT_MAX - first, count)))
+		{
+			res.status = 400;
+			res.set_content("first and count are numbers of segments", "text/plain");
+			return;
+		}
+		res.set_content(livePopularity.write("/" + req.matches[1].str(), (int)first, (int)count), "text/plain");
+	});
+
+	sv.Get(R"(/halflife/([0-9.]+))", [&](const Request& req, Response& res) {
+		livePopularity.setHalfLife(std::stod(req.matches[1]));
+		res.set_content("ok", "text/plain");
+	});
+
+	// a session is shaped on its own from the first of these calls for it, until then its requests share the link
+	sv.Get(R"(/session/([^/\s]+)/bw/(\d+))", [&](const Request& req, Response& res) {
+		long long bandwidth;
+		if (!detail::parse_integer(req.matches[2], 0, LLONG_MAX, bandwidth))
+		{
+			res.status = 400;
+			res.set_content("the bandwidth is a number of bytes/s", "text/plain");
+			return;
+		}
+		auto profile = httplib::sessionProfile(req.matches[1]);
+		profile->bandwidth = (size_t)bandwidth;
+		std::atomic_store(&profile->trace, std::shared_ptr<const httplib::DeliveryTrace>());
+		res.set_content("ok", "text/plain");
+	});
+
+	// the optional query parameter offset in ms starts the replay at another point, so sessions sharing a trace differ
+	sv.Get(R"(/session/([^/\s]+)/trace/([^\s]+))", [&](const Request& req, Response& res) {
+		long long offset = 0;
+		if (req.has_param("offset") && !detail::parse_integer(req.get_param_value("offset"), 0, INT_MAX, offset))
+		{
+			res.status = 400;
+			res.set_content("the offset is a number of ms", "text/plain");
+			return;
+		}
+		auto profile = httplib::sessionProfile(req.matches[1]);
+		std::atomic_store(&profile->trace, replayNetworkTrace(loadNetworkTrace(req.matches[2]), offset));
+		res.set_content("ok", "text/plain");
+	});
+
+	sv.Get(R"(/session/([^/\s]+)/tracereset)", [&](const Request& req, Response& res) {
+		auto profile = httplib::sessionProfile(req.matches[1], false);
+		if (profile)
+			std::atomic_store(&profile->trace, replayNetworkTrace(std::atomic_load(&profile->trace)));
+		res.set_content("ok", "text/plain");
+	});
+
+	sv.Get(R"(/session/([^/\s]+)/end)", [&](const Request& req, Response& res) {
+		httplib::endSession(req.matches[1]);
+		res.set_content("ok", "text/plain");
+	});
+
 	sv.Get("/tracereset", [&](const Request& req, Response& res) {
-		resetTrace = true;
+		restartNetworkTrace();
 		res.set_content("ok", "text/plain");
 	});
 
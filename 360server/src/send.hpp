@@ -1,10 +1,38 @@
 /*
 	Author: Arne-Tobias Rak
 	TU Darmstadt
+
+	Bandwidth shaping of the socket writes. Every send reserves its
+	transmission time on a token bucket (GCRA): the bucket only holds
+	the time the link becomes free again and is updated with one CAS,
+	so concurrent senders share it without a lock. Data is sent in
+	chunks of about a millisecond of transmission time. The event loop
+	of the server waits for a chunk's turn with its timeout instead of
+	sleeping like sendBandwidthLimited does. Buckets exist for the
+	whole link or, with ShapingMode::PerClient, per remote address.
+
+	Instead of a fixed rate the link can replay a Mahimahi delivery
+	trace, where every line is the millisecond of one 1500 byte
+	delivery opportunity. Reservations then consume opportunities
+	of the looped trace on the same steady clock. A round trip time
+	delays every request before it is served, random packet loss
+	costs extra opportunities and one round trip per lossy chunk.
+
+	Requests carrying a session token are shaped by the session's
+	ShapingProfile instead, with its own bandwidth, trace and bucket.
 */
 #pragma once
 
 #include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <map>
+#include <algorithm>
+#include <vector>
+#include <random>
 
 #ifdef _WIN32
 #include <io.h>
@@ -27,66 +55,285 @@ typedef int socket_t;
 
 namespace httplib
 {
-static size_t bandwidth = 2000000;
-#define TIME_NOW_EPOCH_MS std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count()
-#define SEND_SEGMENTS_PER_SECOND 10
-#define SEND_SEGMENT_DURATION 1000 / SEND_SEGMENTS_PER_SECOND
+// bytes per second, 0 disables shaping
+static std::atomic<size_t> bandwidth(2000000);
 
-inline int sendBandwidthLimited(const socket_t& sock, const char* ptr, size_t size)
+enum class ShapingMode { Link, PerClient };
+static std::atomic<ShapingMode> shapingMode(ShapingMode::Link);
+
+// transmission time an idle bucket may be ahead of, and the pacing quantum of a send
+#define SHAPER_BURST_NS 2000000LL
+#define SHAPER_QUANTUM_NS 1000000LL
+#define SHAPER_MIN_CHUNK 1460
+#define SHAPER_PACKET_SIZE 1500
+
+inline long long shaperNowNs()
 {
-	static auto timeSegmentStart = TIME_NOW_EPOCH_MS;
-	static size_t sentDataSinceSegmentStart = 0;
-	size_t allowedSendSize = bandwidth / SEND_SEGMENTS_PER_SECOND;
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
-	auto now = TIME_NOW_EPOCH_MS;
-	if (now - timeSegmentStart >= SEND_SEGMENT_DURATION)
+// looped sequence of delivery opportunities starting at origin on the shaper clock
+class DeliveryTrace
+{
+public:
+	// timestamps in ms, the last one is the period like in Mahimahi
+	DeliveryTrace(std::vector<long long> timestampsMs, long long originNs) : origin(originNs), period(0)
 	{
-		timeSegmentStart += SEND_SEGMENT_DURATION;
-		auto sizeLeftFromLastSendSegment = bandwidth / SEND_SEGMENTS_PER_SECOND - sentDataSinceSegmentStart;
-		allowedSendSize += sizeLeftFromLastSendSegment > 0 ? sizeLeftFromLastSendSegment : 0;
-		while (now - timeSegmentStart >= SEND_SEGMENT_DURATION)
+		if (timestampsMs.empty())
+			return;
+		std::sort(timestampsMs.begin(), timestampsMs.end());
+		period = std::max(1LL, timestampsMs.back()) * 1000000;
+
+		// an opportunity at the period is the one at 0 of the next round
+		for (auto& ts : timestampsMs)
+			ts = ts * 1000000 % period;
+		std::sort(timestampsMs.begin(), timestampsMs.end());
+
+		// opportunities of the same millisecond are spread over it so that every one has its own time
+		opportunities.resize(timestampsMs.size());
+		for (size_t i = 0; i < timestampsMs.size();)
 		{
-			timeSegmentStart += SEND_SEGMENT_DURATION;
-			allowedSendSize += bandwidth / SEND_SEGMENTS_PER_SECOND;
+			size_t j = i;
+			while (j < timestampsMs.size() && timestampsMs[j] == timestampsMs[i])
+				j++;
+			for (size_t k = i; k < j; k++)
+				opportunities[k] = timestampsMs[i] + (long long)(k - i) * 1000000 / (long long)(j - i);
+			i = j;
 		}
-		sentDataSinceSegmentStart = 0;
 	}
 
-	auto n = 0;
-	if (size + sentDataSinceSegmentStart > allowedSendSize)
+	DeliveryTrace(const DeliveryTrace& other, long long originNs) : origin(originNs), period(other.period), opportunities(other.opportunities) {}
+
+	bool empty() const
+	{
+		return opportunities.empty();
+	}
+
+	// index of the first opportunity at or after t
+	long long indexAt(long long t) const
+	{
+		long long rel = std::max(0LL, t - origin);
+		long long round = rel / period;
+		auto it = std::lower_bound(opportunities.begin(), opportunities.end(), rel - round * period);
+		return round * (long long)opportunities.size() + (it - opportunities.begin());
+	}
+
+	long long timeOf(long long index) const
+	{
+		long long n = (long long)opportunities.size();
+		return origin + index / n * period + opportunities[index % n];
+	}
+
+	// bytes per second delivered in the window of windowNs before t
+	size_t rateAt(long long t, long long windowNs = 100000000) const
+	{
+		return (size_t)((indexAt(t) - indexAt(t - windowNs)) * SHAPER_PACKET_SIZE * (1e9 / windowNs));
+	}
+
+private:
+	long long origin;
+	long long period;
+	std::vector<long long> opportunities;
+};
+
+// active trace, replaces bandwidth while set
+static std::shared_ptr<const DeliveryTrace> deliveryTrace;
+// round trip time emulated per request and packet loss rate of the shaped sends
+static std::atomic<long long> rttNs(0);
+static std::atomic<double> lossRate(0);
+
+inline std::shared_ptr<const DeliveryTrace> activeTrace()
+{
+	return std::atomic_load(&deliveryTrace);
+}
+
+inline void setTrace(std::shared_ptr<const DeliveryTrace> trace)
+{
+	std::atomic_store(&deliveryTrace, trace);
+}
+
+// bytes per second the link currently delivers
+inline size_t currentBandwidth()
+{
+	auto trace = activeTrace();
+	return trace ? trace->rateAt(shaperNowNs()) : bandwidth.load();
+}
+
+class TokenBucket
+{
+public:
+	TokenBucket() : next(0) {}
+
+	// reserves the transmission of size bytes at rate, returns the steady clock time in ns the send may start
+	long long reserve(size_t size, size_t rate, long long now)
+	{
+		long long duration = rate > 0 ? (long long)(size * 1e9 / rate) : 0;
+		long long current = next.load(std::memory_order_relaxed);
+		long long start;
+		do
+		{
+			start = std::max(current, now - SHAPER_BURST_NS);
+		} while (!next.compare_exchange_weak(current, start + duration, std::memory_order_relaxed));
+		return start;
+	}
+
+	// reserves the next packets delivery opportunities of trace
+	long long reserve(long long packets, const DeliveryTrace& trace, long long now)
 	{
-		const char* cp = ptr;
-		while (size + sentDataSinceSegmentStart > allowedSendSize)
+		long long current = next.load(std::memory_order_relaxed);
+		long long start, end;
+		do
 		{
-			// send remaining allowed data in send segment
-			auto sentSize = send(sock, cp, allowedSendSize - sentDataSinceSegmentStart, 0);
-			n += sentSize;
+			long long first = trace.indexAt(std::max(current, now - SHAPER_BURST_NS));
+			start = trace.timeOf(first);
+			end = trace.timeOf(first + packets);
+		} while (!next.compare_exchange_weak(current, end, std::memory_order_relaxed));
+		return start;
+	}
 
-			// sleep for rest of the send segment
-			now = TIME_NOW_EPOCH_MS;
-			auto sleepDuration = SEND_SEGMENT_DURATION - (now - timeSegmentStart);
-			if (sleepDuration > 0)
-				std::this_thread::sleep_for(std::chrono::milliseconds(sleepDuration));
+private:
+	std::atomic<long long> next;
+};
 
-			sentDataSinceSegmentStart = 0;
-			timeSegmentStart = timeSegmentStart + SEND_SEGMENT_DURATION;
+// shaping of one test session, replaces bandwidth and the active trace for its requests
+struct ShapingProfile
+{
+	ShapingProfile() : bandwidth(httplib::bandwidth.load()) {}
 
-			size -= sentSize;
-			cp += sentSize;
+	std::atomic<size_t> bandwidth;
+	// read and replaced with atomic_load and atomic_store
+	std::shared_ptr<const DeliveryTrace> trace;
+	TokenBucket bucket;
+};
 
-			allowedSendSize = bandwidth / SEND_SEGMENTS_PER_SECOND;
-		}
+struct ShapingSessions
+{
+	std::mutex mtx;
+	std::map<std::string, std::shared_ptr<ShapingProfile>> profiles;
+};
+
+inline ShapingSessions& shapingSessions()
+{
+	static ShapingSessions sessions;
+	return sessions;
+}
+
+// profile of a session token, created on first use unless create is false
+inline std::shared_ptr<ShapingProfile> sessionProfile(const std::string& token, bool create = true)
+{
+	if (token.empty())
+		return nullptr;
+	auto& sessions = shapingSessions();
+	std::lock_guard<std::mutex> l(sessions.mtx);
+	auto it = sessions.profiles.find(token);
+	if (it != sessions.profiles.end())
+		return it->second;
+	if (!create)
+		return nullptr;
+	return sessions.profiles[token] = std::make_shared<ShapingProfile>();
+}
+
+// requests still running keep the profile until they finish
+inline void endSession(const std::string& token)
+{
+	auto& sessions = shapingSessions();
+	std::lock_guard<std::mutex> l(sessions.mtx);
+	sessions.profiles.erase(token);
+}
+
+inline std::shared_ptr<TokenBucket> linkBucket()
+{
+	static std::shared_ptr<TokenBucket> bucket = std::make_shared<TokenBucket>();
+	return bucket;
+}
+
+// with ShapingMode::PerClient every remote address gets a bucket of the full bandwidth
+inline std::shared_ptr<TokenBucket> bucketForSocket(socket_t sock)
+{
+	if (shapingMode.load(std::memory_order_relaxed) == ShapingMode::Link)
+		return linkBucket();
+
+	struct sockaddr_storage addr;
+	socklen_t len = sizeof(addr);
+	char host[NI_MAXHOST] = "";
+	if (getpeername(sock, (struct sockaddr*)&addr, &len) == 0)
+		getnameinfo((struct sockaddr*)&addr, len, host, sizeof(host), nullptr, 0, NI_NUMERICHOST);
 
-		// send remaining data that fits into one send segment
-		sentDataSinceSegmentStart = send(sock, cp, size, 0);
-		n += sentDataSinceSegmentStart;
+	static std::mutex clientsMtx;
+	static std::map<std::string, std::shared_ptr<TokenBucket>> clients;
+	std::lock_guard<std::mutex> l(clientsMtx);
+	auto& bucket = clients[host];
+	if (!bucket)
+		bucket = std::make_shared<TokenBucket>();
+	return bucket;
+}
+
+// called when a new request starts arriving, the response is served one round trip later
+inline void waitRoundTrip()
+{
+	auto rtt = rttNs.load(std::memory_order_relaxed);
+	if (rtt > 0)
+		std::this_thread::sleep_for(std::chrono::nanoseconds(rtt));
+}
+
+// reserves the next slice of a send with size bytes left on bucket, shaped with profile if given, otherwise with
+// bandwidth and the active trace. chunk is set to the bytes of the slice, returns the steady clock time in ns the
+// slice may be sent
+inline long long reserveSlice(TokenBucket& bucket, size_t size, size_t& chunk, const ShapingProfile* profile = nullptr)
+{
+	thread_local std::minstd_rand random(std::random_device{}());
+	auto trace = profile ? std::atomic_load(&profile->trace) : activeTrace();
+	size_t rate = (profile ? profile->bandwidth : bandwidth).load(std::memory_order_relaxed);
+	chunk = size;
+	long long stall = 0;
+	long long start;
+	if (trace && !trace->empty())
+	{
+		// a millisecond worth of packets, the last one of a write may be short but still takes an opportunity
+		chunk = std::min(chunk, std::max<size_t>(SHAPER_PACKET_SIZE, trace->rateAt(shaperNowNs(), SHAPER_QUANTUM_NS * 10) / 1000 / SHAPER_PACKET_SIZE * SHAPER_PACKET_SIZE));
+		long long packets = (chunk + SHAPER_PACKET_SIZE - 1) / SHAPER_PACKET_SIZE;
+
+		// a lost packet is sent again, the chunk waits one round trip for the retransmission
+		double loss = lossRate.load(std::memory_order_relaxed);
+		if (loss > 0)
+		{
+			long long lost = std::binomial_distribution<long long>(packets, std::min(loss, 0.99))(random);
+			packets += lost;
+			if (lost > 0)
+				stall = rttNs.load(std::memory_order_relaxed);
+		}
+		start = bucket.reserve(packets, *trace, shaperNowNs());
 	}
 	else
 	{
-		n = send(sock, ptr, size, 0);
-		sentDataSinceSegmentStart += n;
+		if (rate > 0)
+			chunk = std::min(chunk, std::max<size_t>(SHAPER_MIN_CHUNK, (size_t)(rate * (SHAPER_QUANTUM_NS / 1e9))));
+		start = bucket.reserve(chunk, rate, shaperNowNs());
 	}
+	return start + stall;
+}
 
-	return n;
+// sends the slices of reserveSlice, sleeping until each one is due
+inline int sendBandwidthLimited(const socket_t& sock, TokenBucket& bucket, const char* ptr, size_t size, const ShapingProfile* profile = nullptr)
+{
+	size_t sent = 0;
+	while (sent < size)
+	{
+		size_t chunk;
+		auto wait = reserveSlice(bucket, size - sent, chunk, profile) - shaperNowNs();
+		if (wait > 0)
+			std::this_thread::sleep_for(std::chrono::nanoseconds(wait));
+
+		auto n = send(sock, ptr + sent, (int)chunk, 0);
+		if (n <= 0)
+			return sent > 0 ? (int)sent : (int)n;
+		sent += n;
+	}
+	return (int)sent;
+}
+
+inline int sendBandwidthLimited(const socket_t& sock, const char* ptr, size_t size)
+{
+	return sendBandwidthLimited(sock, *linkBucket(), ptr, size);
 }
 }
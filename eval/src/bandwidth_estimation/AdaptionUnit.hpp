@@ -16,16 +16,21 @@
 
 #include "Quaternion.hpp"
 #include "mpd.h"
+#include "Log.hpp"
+#include "TileGrid.hpp"
+#include "ViewportProjector.hpp"
 #include "httplib.h"
 #include "CircularBuffer.hpp"
 #include "ConfigParser.hpp"
+#include "ThroughputEstimator.hpp"
+#include "AdaptionCore.hpp"
 
-#define TIME_NOW_EPOCH_MS std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count()
+#define TIME_NOW_EPOCH_MS SimClock::epochMs()
 #define SAMPLERES 8
 #define SAMPLEPOINTS (SAMPLERES+1)*(SAMPLERES+1)
 
 #define TIMER auto ttt = TIME_NOW_EPOCH_MS
-#define TIMEROUT(s) auto ttt2 = TIME_NOW_EPOCH_MS; std::cout << s << " TIMER: " << ttt2 - ttt << std::endl
+#define TIMEROUT(s) auto ttt2 = TIME_NOW_EPOCH_MS; LOG_INFO(s << " TIMER: " << ttt2 - ttt)
 
 constexpr float PI = 3.141592653589793238462643383279502884L;
 
@@ -43,28 +48,20 @@ public:
 	struct NormalizedCoordinate { double x, y; };
 
 	AdaptionUnit(const DASH::MPD* mpd, httplib::Client* httpClient)
-		: mpd(mpd), httpClient(httpClient)
+		: mpd(mpd), core(mpd), httpClient(httpClient)
 		, bytesDownloaded(0), durationDownload(0)
 		, bandwidthEstimate(0)
 	{
-		auto srd = mpd->period.adaptationSets[0].srd;
-
-		int frameWidth = srd.w * srd.th;
-		int frameHeight = srd.h * srd.tv;
-
-		for (int i = 0; i < mpd->period.adaptationSets.size(); i++)
-		{
-			srd = mpd->period.adaptationSets[i].srd;
-
-			double normalizedCoordX = (srd.x + srd.w) / (double)frameWidth;
-			double normalizedCoordY = (srd.y + srd.h) / (double)frameHeight;
+		auto config = Config::instance();
+		estimator = ThroughputEstimator::create(config->estimator, config->estimatorWindow, config->estimatorAlpha);
 
-			normalizedCoordTileMapping[normalizedCoordX][normalizedCoordY] = i;
-		}
+		tileGrid.build(mpd);
 
 		for (int i = 0; i <= SAMPLERES; i++)
 			for (int j = 0; j <= SAMPLERES; j++)
 				samplePoints[i * (SAMPLERES + 1) + j] = { i * (1.0 / SAMPLERES), j * (1.0 / SAMPLERES) };
+
+		projector.init(samplePoints, SAMPLEPOINTS, maxHDist, maxVDist);
 	}
 
 	void initAdaption(const std::pair<long long, Quaternion>& headRotation)
@@ -76,12 +73,17 @@ public:
 
 	size_t bwEstimate() const
 	{
-		if (durationDownload != 0)
-			return bytesDownloaded * (1000.0 / durationDownload);
+		if (estimator->estimate() > 0)
+			return estimator->estimate();
 		else
 			return 2000000;
 	}
 
+	void resetEstimator()
+	{
+		estimator->reset();
+	}
+
 	void startAdaption(const CircularBuffer<std::pair<long long, Quaternion>>& headRotations, int segment, bool init = false)
 	{
 		bandwidthEstimate = 4200000;
@@ -106,36 +108,13 @@ public:
 		{
 			transition = true;
 		}
-		else if (bandwidthNeededForTileQualityMap(tileQuality) < bandwidthEstimate * .75)
+		else if (core.neededBandwidth(tileQuality) < bandwidthEstimate * .75)
 		{
 			auto tileVisibility = computeTileVisibility(headRotations);
 
-			auto highestPriorityTile = std::max_element(tileVisibility.begin(), tileVisibility.end(), [](auto p1, auto p2) { return p1.first < p2.first; });
-			auto maxVisibility =highestPriorityTile->first;
-			auto visibilityPerQualityLevel = int(maxVisibility / (double)numQualityLevels);
-
-			while (highestPriorityTile->first != 0)
-			{
-				// enhance quality of highest priority tile
-				tileQuality.at(highestPriorityTile->second) = std::max(0, tileQuality.at(highestPriorityTile->second) - 1);
-
-				// trigger transition if too much bandwidth is needed
-				if (bandwidthNeededForTileQualityMap(tileQuality) > bandwidthEstimate * .75)
-				{
-					if (config->popularity && config->transitions)
-					{
-						transition = true;
-						std::cout << "Transition to popularity" << std::endl;
-					}
-					break;
-				}
-
-				// decrease visibility so highest priority tile differs after resort
-				highestPriorityTile->first = std::max(0, highestPriorityTile->first - visibilityPerQualityLevel);
-
-				// get most visible tile
-				highestPriorityTile = std::max_element(tileVisibility.begin(), tileVisibility.end(), [](auto p1, auto p2) { return p1.first < p2.first; });
-			}
+			transition = core.upgrade(config->popularity && config->transitions, true, tileVisibility, bandwidthEstimate * .75, numQualityLevels, tileQuality);
+			if (transition)
+				LOG_INFO("Transition to popularity");
 		}
 
 		if (transition)
@@ -167,16 +146,15 @@ public:
 		if (segment != -1)
 			currentSegment = segment;
 		
-		auto timer = TIME_NOW_EPOCH_MS;
+		auto timer = STEADY_NOW;
 		auto res = httpClient->Get(mpd->getUrl(currentSegment, tile, tileQuality[tile]).c_str());
 		//auto res = httpClient->Get("/cntrl");
-		auto duration = TIME_NOW_EPOCH_MS - timer;
+		auto duration = ELAPSED_US(timer);
 
 		bool cacheHit = res->get_header_value("X-Cache").compare(0, 3, "HIT") == 0;
 		if (!cacheHit)
 		{
-			durationDownload += duration;
-			bytesDownloaded += res->body.size();
+			addTransfer(*res, duration);
 		}
 		totalBytesDownloaded += res->body.size();
 
@@ -187,15 +165,18 @@ public:
 	{
 		tileQuality = mpd->tilePopularity(segment);
 
-		for (int i = 0; i < 16; i++)
+		durationDownload = 0;
+		bytesDownloaded = 0;
+		for (int i = 0; i < mpd->period.adaptationSets.size(); i++)
 			download(i, segment);
+		estimator->addSample(bytesDownloaded, durationDownload);
 	}
 
 	void downloadTiles(int segment, const std::map<int, int> qualities)
 	{
 		tileQuality = qualities;
 
-		for (int i = 0; i < 16; i++)
+		for (int i = 0; i < mpd->period.adaptationSets.size(); i++)
 			download(i, segment);
 
 	}
@@ -235,17 +216,14 @@ public:
 	void printTileVisibility(const Quaternion& headRotation)
 	{
 		std::map<int, int> tileVisibilityMap;
-		for (int i = 0; i < SAMPLEPOINTS; i++)
-			tileVisibilityMap[mapCoordToTile(fromViewportCoordToEquirectCoord(headRotation, samplePoints[i]))]++;
+		addVisibleSamples(headRotation, tileVisibilityMap);
 
-		for (int i = 0; i < 16; i++)
-			if (tileVisibilityMap.find(i) == tileVisibilityMap.end())
-				tileVisibilityMap[i] = 0;
-
-		for (int i = 0; i < 4; i++)
+		// tiles are numbered column by column
+		auto srd = mpd->period.adaptationSets[0].srd;
+		for (int i = 0; i < srd.tv; i++)
 		{
-			for (int j = 0; j < 4; j++)
-				std::cout << tileVisibilityMap.at(j * 4 + i) << "\t";
+			for (int j = 0; j < srd.th; j++)
+				std::cout << tileVisibilityMap[j * srd.tv + i] << "\t";
 			std::cout << std::endl;
 		}
 		std::cout << std::endl;
@@ -257,25 +235,37 @@ public:
 	}
 
 private:
+	// the body after its first chunk over the time to its last chunk, which leaves out the wait for
+	// the server, a body that arrived in one read counts whole with the duration of its request
+	void addTransfer(const httplib::Response& res, long long duration)
+	{
+		if (res.transfer_us > 0)
+		{
+			durationDownload += res.transfer_us;
+			bytesDownloaded += res.transfer_bytes;
+		}
+		else
+		{
+			durationDownload += duration;
+			bytesDownloaded += res.body.size();
+		}
+	}
+
 	const DASH::MPD* mpd;
+	AdaptionCore core;
 	httplib::Client* httpClient;
-	std::map<double, std::map<double, int>> normalizedCoordTileMapping;
+	TileGrid tileGrid;
+	ViewportProjector projector;
 	std::map<int, int> tileQuality;
 	int currentSegment;	
 	size_t bandwidthEstimate;
 	size_t bytesDownloaded;
-	int durationDownload;
+	// microseconds
+	long long durationDownload;
+	std::unique_ptr<ThroughputEstimator> estimator;
 	NormalizedCoordinate samplePoints[SAMPLEPOINTS];
 	size_t totalBytesDownloaded = 0;
 	
-	size_t bandwidthNeededForTileQualityMap(const std::map<int, int>& tileQualityMap)
-	{
-		size_t neededBandwidth = 0;
-		for (int i = 0; i < mpd->period.adaptationSets.size(); i++)
-			neededBandwidth += mpd->period.adaptationSets[i].representations[tileQualityMap.at(i)].bandwidth;
-		return neededBandwidth / 8;
-	}
-
 	std::function<double(double)> computeRegressionFunction(const std::vector<double>& x, const std::vector<double>& y) const
 	{
 		const auto n = x.size();
@@ -295,8 +285,7 @@ private:
 		if (headRotations.size() == 1 || !Config::instance()->viewportPrediction)
 		{
 			// find visible tiles depending on head position
-			for (int j = 0; j < SAMPLEPOINTS; j++)
-				tileVisibilityMap[mapCoordToTile(fromViewportCoordToEquirectCoord(headRotations[0].second, samplePoints[j]))]++;
+			addVisibleSamples(headRotations[0].second, tileVisibilityMap);
 		}
 		else
 		{
@@ -330,8 +319,7 @@ private:
 				auto rot = Quaternion::FromEuler(funRegressionYaw(ts), funRegressionPitch(ts), funRegressionRoll(ts));
 
 				// find visible tiles depending on head position
-				for (int j = 0; j < SAMPLEPOINTS; j++)
-					tileVisibilityMap[mapCoordToTile(fromViewportCoordToEquirectCoord(rot, samplePoints[j]))]++;
+				addVisibleSamples(rot, tileVisibilityMap);
 			}
 		}
 
@@ -343,9 +331,18 @@ private:
 		return tileVisibility;
 	}
 
+	// count the viewport sample points falling into each tile
+	void addVisibleSamples(const Quaternion& headRotation, std::map<int, int>& tileVisibilityMap) const
+	{
+		float x[SAMPLEPOINTS], y[SAMPLEPOINTS];
+		projector.project(headRotation, x, y);
+		for (int j = 0; j < SAMPLEPOINTS; j++)
+			tileVisibilityMap[tileGrid.tileAt(x[j], y[j])]++;
+	}
+
 	int mapCoordToTile(NormalizedCoordinate coord) const
 	{
-		return normalizedCoordTileMapping.lower_bound(coord.x)->second.lower_bound(coord.y)->second;
+		return tileGrid.tileAt(coord.x, coord.y);
 	}
 
 	static NormalizedCoordinate fromViewportCoordToEquirectCoord(const Quaternion& headRotation, const NormalizedCoordinate& viewportCoord)
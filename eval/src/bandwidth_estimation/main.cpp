@@ -26,6 +26,8 @@
 #include "mpd.h"
 #include "AdaptionUnit.hpp"
 #include "HeadTrace.hpp"
+#include "ExperimentRunner.hpp"
+#include "SimulatedClient.hpp"
 
 using namespace IMT;
 namespace fs = std::experimental::filesystem;
@@ -36,6 +38,8 @@ httplib::Client* httpClient;
 DASH::MPD* mpd;
 int numTiles;
 AdaptionUnit* au;
+// draws the head traces, seeded from the config
+std::mt19937 rng;
 
 const std::string netTrace = "TMobile-LTE-driving";
 
@@ -45,30 +49,6 @@ typedef std::wstring pathType;
 typedef std::string pathType;
 #endif
 
-std::vector<pathType> tracePermutation(int numTraces)
-{
-	std::vector<pathType> traces;
-
-	auto dirIt = fs::directory_iterator(Config::instance()->headtracePath);
-	auto dirItBegin = fs::begin(dirIt);
-	auto dirItEnd = fs::end(dirIt);
-	auto numFiles = std::distance(dirItBegin, dirItEnd);
-
-	std::set<int> traceIndices;
-	for (int i = 0; i < numTraces; i++)
-		while (!traceIndices.insert(std::rand() % numFiles).second);
-
-	int fi = 0;
-	for (auto& f : fs::directory_iterator(Config::instance()->headtracePath))
-	{
-		if (traceIndices.find(fi) != traceIndices.end())
-			traces.push_back(f.path());
-		fi++;
-	}
-
-	return traces;
-}
-
 void downloadPopularTiles()
 {
 	// download init files
@@ -101,7 +81,7 @@ void downloadTrace(pathType pathToTrace, std::function<void(int)> dlfun)
 	dlfun(0);
 	au->stopAdaption();
 
-	int numSegments = mpd->period.adaptationSets[0].representations[0].segmentList.segmentUrls.size();
+	int numSegments = mpd->numSegments();
 	double frameRate = mpd->frameRate();
 	double segmentDuration = mpd->segmentDuration();
 	double segmentFrames = segmentDuration * frameRate;
@@ -132,24 +112,31 @@ int main(int argc, char* argv[])
 
 	auto config = Config::instance();
 	config->init(argv[1]);
+	rng.seed(config->seed);
 
-	httpClient = new httplib::Client(config->squidAddress.c_str(), config->squidPort);
+	if (config->simulation)
+	{
+		SimClock::setVirtual(true);
+		httpClient = new SimulatedClient(std::make_shared<SimulatedNetwork>(config->wwwDir, config->traceDir), true);
+	}
+	else
+		httpClient = new httplib::Client(config->squidAddress.c_str(), config->squidPort);
 	//httpClient->proxyServer = true;
 
-	auto res = httpClient->Get(config->mpdUri.c_str());
-	if (!res || res->status != 200)
+	auto mpdContent = fetchMpd(*httpClient, config->mpdUri);
+	if (mpdContent.empty())
 	{
-		std::cout << "MPD not found " << res->status << std::endl;
+		std::cout << "MPD not found" << std::endl;
 		return -1;
 	}
-	mpd = new DASH::MPD(res->body);
+	mpd = new DASH::MPD(mpdContent);
 	au = new AdaptionUnit(mpd, httpClient);
 
 	auto srd = mpd->period.adaptationSets[0].srd;
 	numTiles = srd.th * srd.tv;
-	int numSegments = mpd->period.adaptationSets[0].representations[0].segmentList.segmentUrls.size();
+	int numSegments = mpd->numSegments();
 
-	auto traces = tracePermutation(30);
+	auto traces = tracePermutation<pathType>(Config::instance()->headtracePath, 30, rng);
 	//std::ofstream tracesUsed("tracesUsed.txt");
  //       for (auto traceStr : traces)
  //               tracesUsed << strrchr(traceStr.c_str(), '/') << " ";
@@ -163,7 +150,7 @@ int main(int argc, char* argv[])
 	httpClient->Get(("/trace/traces/" + netTrace + ".down").c_str());
 	std::cout << "Trace set." << std::endl;
 
-	std::ofstream csv(netTrace + ".csv");
+	ResultSink csv(netTrace + ".csv", config->rawResults, {}, { "Mbps" });
 	csv << "Iteration,Time,Mbps\n";
 
 	Config::instance()->popularity = true;
@@ -171,6 +158,7 @@ int main(int argc, char* argv[])
 	for (int i = 0; i < 30; i++)
 	{
 		httpClient->Get("/tracereset");
+		au->resetEstimator();
 		auto startTime = TIME_NOW_EPOCH_MS;
 		csv << i << "," << 0 << "," << 2000000 * 8 / 1000000.0 << "\n";
 		downloadTrace(traces[0], [&](int segment)
@@ -180,7 +168,7 @@ int main(int argc, char* argv[])
 			auto ts = TIME_NOW_EPOCH_MS - startTime;
 			int sleepDurMs = (segment + 1) * 1500 - ts;
 			if (sleepDurMs > 0)
-				std::this_thread::sleep_for(std::chrono::milliseconds(sleepDurMs));
+				SimClock::sleepFor(std::chrono::milliseconds(sleepDurMs));
 			csv << i << "," << ts << "," << au->bwEstimate() * 8 / 1000000.0 << "\n";
 			au->resetTotalBytesDownloaded();
 		});
@@ -26,6 +26,7 @@
 #include "mpd.h"
 #include "AdaptionUnit.hpp"
 #include "HeadTrace.hpp"
+#include "ExperimentRunner.hpp"
 
 using namespace IMT;
 namespace fs = std::experimental::filesystem;
@@ -36,6 +37,8 @@ httplib::Client* httpClient;
 DASH::MPD* mpd;
 int numTiles;
 AdaptionUnit* au;
+// draws the head traces, seeded from the config
+std::mt19937 rng;
 
 #ifdef _WIN32
 typedef std::wstring pathType;
@@ -43,30 +46,6 @@ typedef std::wstring pathType;
 typedef std::string pathType;
 #endif
 
-std::vector<pathType> tracePermutation(int numTraces)
-{
-	std::vector<pathType> traces;
-
-	auto dirIt = fs::directory_iterator(Config::instance()->headtracePath);
-	auto dirItBegin = fs::begin(dirIt);
-	auto dirItEnd = fs::end(dirIt);
-	auto numFiles = std::distance(dirItBegin, dirItEnd);
-
-	std::set<int> traceIndices;
-	for (int i = 0; i < numTraces; i++)
-		while (!traceIndices.insert(std::rand() % numFiles).second);
-
-	int fi = 0;
-	for (auto& f : fs::directory_iterator(Config::instance()->headtracePath))
-	{
-		if (traceIndices.find(fi) != traceIndices.end())
-			traces.push_back(f.path());
-		fi++;
-	}
-
-	return traces;
-}
-
 void downloadPopularTiles()
 {
 	// download init files
@@ -99,7 +78,7 @@ void downloadTrace(pathType pathToTrace, std::function<void(int)> dlfun)
 	dlfun(0);
 	au->stopAdaption();
 
-	int numSegments = mpd->period.adaptationSets[0].representations[0].segmentList.segmentUrls.size();
+	int numSegments = mpd->numSegments();
 	double frameRate = mpd->frameRate();
 	double segmentDuration = mpd->segmentDuration();
 	double segmentFrames = segmentDuration * frameRate;
@@ -130,25 +109,26 @@ int main(int argc, char* argv[])
 
 	auto config = Config::instance();
 	config->init(argv[1]);
+	rng.seed(config->seed);
 
 	httpClient = new httplib::Client(config->squidAddress.c_str(), config->squidPort);
 	httpClient->proxyServer = true;
 
-	auto res = httpClient->Get(config->mpdUri.c_str());
-	if (!res || res->status != 200)
+	auto mpdContent = fetchMpd(*httpClient, config->mpdUri);
+	if (mpdContent.empty())
 	{
-		std::cout << "MPD not found " << res->status << std::endl;
+		std::cout << "MPD not found" << std::endl;
 		return -1;
 	}
-	mpd = new DASH::MPD(res->body);
+	mpd = new DASH::MPD(mpdContent);
 	au = new AdaptionUnit(mpd, httpClient);
 
 	auto srd = mpd->period.adaptationSets[0].srd;
 	numTiles = srd.th * srd.tv;
-	int numSegments = mpd->period.adaptationSets[0].representations[0].segmentList.segmentUrls.size();
+	int numSegments = mpd->numSegments();
 
-	auto traces = tracePermutation(30);
-	std::ofstream csv("test.csv");
+	auto traces = tracePermutation<pathType>(Config::instance()->headtracePath, 30, rng);
+	ResultSink csv("test.csv", config->rawResults, { "Type" }, { "Bandwidth (Mb/Segment)" });
 	std::ofstream tracesUsed("tracesUsed.txt");
         for (auto traceStr : traces)
                 tracesUsed << strrchr(traceStr.c_str(), '/') << " ";
@@ -0,0 +1,116 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Tile upgrade loop shared by the adaption units of the evaluations.
+	Starting from the lowest quality, the most visible tile is raised
+	one level at a time until the visibility is used up or the tiles
+	need more than the bandwidth budget. What happens at the budget
+	is set by two policies, each combination is its own instantiation
+	so the loop does not test the adaption flags. The bandwidth of the
+	current choice is kept up to date with every step instead of being
+	summed over all tiles again.
+
+	Only this loop is shared. Estimating the throughput, predicting
+	the viewport and downloading the tiles stay with the adaption unit
+	of every evaluation, which each measure them their own way, and
+	the player keeps its own adaption with its QualityAllocator and
+	ViewportPredictor interfaces.
+*/
+
+#pragma once
+
+#include <map>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include "mpd.h"
+
+namespace AdaptionPolicy
+{
+// the budget only ends the loop through the budget policy
+struct NoTransition { static constexpr bool onOverload = false; };
+// exceeding the budget switches the segment to the popular tiles
+struct TransitionOnOverload { static constexpr bool onOverload = true; };
+
+// the upgrade exceeding the budget is the last one and is kept
+struct StopAtBudget { static constexpr bool stop = true; };
+// upgrading goes on until the visibility is used up
+struct IgnoreBudget { static constexpr bool stop = false; };
+}
+
+class AdaptionCore
+{
+public:
+	AdaptionCore(const DASH::MPD* mpd)
+	{
+		for (auto& set : mpd->period.adaptationSets)
+		{
+			bandwidth.push_back(std::vector<size_t>());
+			for (auto& rep : set.representations)
+				bandwidth.back().push_back(rep.bandwidth);
+		}
+	}
+
+	// bytes per second the qualities need, the bit rates are summed before the division like the MPD's
+	size_t neededBandwidth(const std::map<int, int>& tileQuality) const
+	{
+		size_t needed = 0;
+		for (size_t i = 0; i < bandwidth.size(); i++)
+			needed += bandwidth[i][tileQuality.at(i)];
+		return needed / 8;
+	}
+
+	// tileVisibility holds (visibility, tile) pairs and is used up, tileQuality starts with every tile at numQualityLevels.
+	// Returns true if the segment should transition to the popular tiles
+	template<class Transition, class Budget>
+	bool upgrade(std::vector<std::pair<int, int>>& tileVisibility, double budget, int numQualityLevels, std::map<int, int>& tileQuality) const
+	{
+		auto byVisibility = [](const std::pair<int, int>& p1, const std::pair<int, int>& p2) { return p1.first < p2.first; };
+		auto highestPriorityTile = std::max_element(tileVisibility.begin(), tileVisibility.end(), byVisibility);
+		auto maxVisibility = highestPriorityTile->first;
+		auto visibilityPerQualityLevel = int(maxVisibility / (double)numQualityLevels);
+
+		size_t needed = 0;
+		for (size_t i = 0; i < bandwidth.size(); i++)
+			needed += bandwidth[i][tileQuality.at(i)];
+
+		while (highestPriorityTile->first != 0)
+		{
+			// enhance quality of highest priority tile
+			int tile = highestPriorityTile->second;
+			int& quality = tileQuality.at(tile);
+			int upgraded = std::max(0, quality - 1);
+			needed += bandwidth[tile][upgraded] - bandwidth[tile][quality];
+			quality = upgraded;
+
+			if (needed / 8 > budget)
+			{
+				if (Transition::onOverload)
+					return true;
+				if (Budget::stop)
+					break;
+			}
+
+			// decrease visibility so highest priority tile differs after resort
+			highestPriorityTile->first = std::max(0, highestPriorityTile->first - visibilityPerQualityLevel);
+			highestPriorityTile = std::max_element(tileVisibility.begin(), tileVisibility.end(), byVisibility);
+		}
+		return false;
+	}
+
+	// picks the instantiation for the adaption flags once per segment
+	bool upgrade(bool transitions, bool stopAtBudget, std::vector<std::pair<int, int>>& tileVisibility, double budget, int numQualityLevels, std::map<int, int>& tileQuality) const
+	{
+		using namespace AdaptionPolicy;
+		if (transitions)
+			return upgrade<TransitionOnOverload, StopAtBudget>(tileVisibility, budget, numQualityLevels, tileQuality);
+		if (stopAtBudget)
+			return upgrade<NoTransition, StopAtBudget>(tileVisibility, budget, numQualityLevels, tileQuality);
+		return upgrade<NoTransition, IgnoreBudget>(tileVisibility, budget, numQualityLevels, tileQuality);
+	}
+
+private:
+	// bit rate of every (tile, quality)
+	std::vector<std::vector<size_t>> bandwidth;
+};
@@ -0,0 +1,193 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Trace driven simulation of the edge cache for replacement policy
+	sweeps. It replays a sequence of urls with known sizes against a
+	cache of the same policies and the same eviction as 360cache, so
+	no server or proxy is involved. A simulator is not thread safe,
+	but simulators of different configurations run side by side.
+*/
+#pragma once
+
+#include <set>
+#include <map>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <unordered_map>
+#include <unordered_set>
+#include "ReplacementPolicy.hpp"
+#include "mpd.h"
+
+class CacheSimulator
+{
+public:
+	struct Request
+	{
+		std::string url;
+		size_t size;
+	};
+
+	CacheSimulator(size_t capacityBytes, const std::string& policyType)
+		: policy(ReplacementPolicy::create(policyType)), capacity(capacityBytes)
+	{
+	}
+
+	void setPopular(const std::string& url)
+	{
+		popularUrls.insert(url);
+	}
+
+	// serves url from the cache or stores it like a miss fetched upstream, true on a hit
+	bool request(const std::string& url, size_t size)
+	{
+		if (get(url, size))
+			return true;
+		put(url, size);
+		return false;
+	}
+
+	// counts a hit or a miss of a request for url with size bytes, a hit refreshes the object
+	bool get(const std::string& url, size_t size)
+	{
+		totalFiles++;
+		totalBytes += size;
+
+		auto it = objects.find(url);
+		if (it == objects.end())
+			return false;
+
+		auto& object = it->second;
+		object.entry.refcount++;
+		object.entry.lastAccess = ++accesses;
+		rekey(url, object);
+		cacheHits++;
+		cacheHitBytes += object.entry.size;
+		return true;
+	}
+
+	// stores url after a miss, objects larger than the cache are not kept
+	void put(const std::string& url, size_t size)
+	{
+		if (size > capacity || objects.count(url))
+			return;
+
+		while (bytes + size > capacity && !heap.empty())
+		{
+			auto victim = objects.find(heap.begin()->second);
+			age = policy->ageAfterEviction(victim->second.entry, victim->second.key);
+			heap.erase(heap.begin());
+			bytes -= victim->second.entry.size;
+			objects.erase(victim);
+		}
+
+		auto& object = objects[url];
+		object.entry = { size, 1, ++accesses, popularUrls.count(url) > 0 };
+		object.key = 0;
+		bytes += size;
+		rekey(url, object);
+	}
+
+	void replay(const std::vector<Request>& requests)
+	{
+		for (auto& r : requests)
+			request(r.url, r.size);
+	}
+
+	double cacheHitrate() const
+	{
+		return cacheHits / (double)totalFiles;
+	}
+	double byteHitrate() const
+	{
+		return cacheHitBytes / (double)totalBytes;
+	}
+
+	// the cached objects stay, only the counters start over
+	void resetHitrateVars()
+	{
+		cacheHits = 0;
+		totalFiles = 0;
+		cacheHitBytes = 0;
+		totalBytes = 0;
+	}
+
+private:
+	struct Object
+	{
+		ReplacementPolicy::Entry entry;
+		double key;
+	};
+
+	std::unique_ptr<ReplacementPolicy> policy;
+	size_t capacity;
+	size_t bytes = 0;
+	double age = 0;
+	long long accesses = 0;
+	int cacheHits = 0;
+	int totalFiles = 0;
+	size_t cacheHitBytes = 0;
+	size_t totalBytes = 0;
+
+	std::unordered_map<std::string, Object> objects;
+	// (policy key, url), the first one is evicted next
+	std::set<std::pair<double, std::string>> heap;
+	std::unordered_set<std::string> popularUrls;
+
+	void rekey(const std::string& url, Object& object)
+	{
+		heap.erase({ object.key, url });
+		object.key = policy->key(object.entry, age);
+		heap.insert({ object.key, url });
+	}
+};
+
+// sizes of the urls of an MPD, read from the segment files of wwwDir or estimated from the representation bandwidth
+class SegmentSizes
+{
+public:
+	SegmentSizes(const DASH::MPD* mpd, const std::string& wwwDir)
+		: wwwDir(wwwDir)
+	{
+		auto& sets = mpd->period.adaptationSets;
+		for (size_t a = 0; a < sets.size(); a++)
+			for (size_t r = 0; r < sets[a].representations.size(); r++)
+			{
+				auto& rep = sets[a].representations[r];
+				auto segmentBytes = (size_t)(rep.bandwidth / 8.0 * mpd->segmentDuration(a, r));
+				estimates[mpd->getInitUrl(a, r)] = 0;
+				std::string url;
+				for (size_t s = 0; s < rep.segmentList.count; s++)
+				{
+					mpd->getUrl(url, s, a, r);
+					estimates[url] = segmentBytes;
+				}
+			}
+	}
+
+	size_t size(const std::string& url)
+	{
+		auto it = sizes.find(url);
+		if (it != sizes.end())
+			return it->second;
+
+		size_t size = 0;
+		std::ifstream file(wwwDir + url, std::ios::binary | std::ios::ate);
+		if (!wwwDir.empty() && file)
+			size = (size_t)file.tellg();
+		else if (estimates.count(url))
+			size = estimates[url];
+		return sizes[url] = size;
+	}
+
+	CacheSimulator::Request request(const std::string& url)
+	{
+		return { url, size(url) };
+	}
+
+private:
+	std::string wwwDir;
+	std::map<std::string, size_t> estimates;
+	std::map<std::string, size_t> sizes;
+};
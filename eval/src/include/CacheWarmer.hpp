@@ -0,0 +1,126 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Warms a cache from aggregated popularity. Urls are added with the
+	hits they are expected to get, like once per trace that would
+	request them, and their size. Every distinct url is requested once,
+	those with the most expected hits per byte first so a cache that
+	fills up during the warm-up keeps what is worth most. The requests
+	go over a few pipelined connections, optionally at a fixed rate.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include "httplib.h"
+#include "mpd.h"
+
+class CacheWarmer
+{
+public:
+	struct Url
+	{
+		std::string url;
+		double hits;
+		// 0 if unknown, sorted like a single byte
+		size_t bytes;
+	};
+
+	struct Result
+	{
+		size_t requests;
+		size_t failed;
+		size_t bytes;
+		double seconds;
+	};
+
+	// duplicates add up their hits, the size of the first one is kept
+	void add(const std::string& url, double hits, size_t bytes)
+	{
+		auto it = index.find(url);
+		if (it != index.end())
+		{
+			urls[it->second].hits += hits;
+			return;
+		}
+		index.emplace(url, urls.size());
+		urls.push_back({ url, hits, bytes });
+	}
+
+	size_t size() const
+	{
+		return urls.size();
+	}
+
+	// distinct urls by expected hits per byte, highest first, equal ones in the order they were added
+	std::vector<Url> ordered() const
+	{
+		auto order = urls;
+		std::stable_sort(order.begin(), order.end(), [](const Url& a, const Url& b)
+		{
+			return a.hits * std::max<size_t>(b.bytes, 1) > b.hits * std::max<size_t>(a.bytes, 1);
+		});
+		return order;
+	}
+
+	// requests the ordered urls, one thread per client with up to depth requests in flight on its connection;
+	// rate caps the requests per second of all clients together, 0 for no cap
+	Result run(const std::vector<httplib::Client*>& clients, size_t depth = 8, double rate = 0) const
+	{
+		std::vector<std::string> paths;
+		for (auto& url : ordered())
+			paths.push_back(url.url);
+
+		// clients take a few depths of urls at a time, a connection is kept for each such chunk
+		size_t chunk = std::max<size_t>(depth, 1) * 8;
+		std::atomic<size_t> next(0), failed(0), bytes(0);
+		auto start = std::chrono::steady_clock::now();
+		auto work = [&](httplib::Client* client)
+		{
+			for (size_t first = next.fetch_add(chunk); first < paths.size(); first = next.fetch_add(chunk))
+			{
+				std::vector<std::string> part(paths.begin() + first, paths.begin() + std::min(paths.size(), first + chunk));
+				// a chunk is sent when the rate allows its first url
+				if (rate > 0)
+					std::this_thread::sleep_until(start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(first / rate)));
+				size_t answered = client->GetPipelined(part, depth, [&](size_t, const httplib::Response& res)
+				{
+					if (res.status == 200)
+						bytes += res.body.size();
+					else
+						failed++;
+				});
+				failed += part.size() - answered;
+			}
+		};
+
+		if (clients.size() == 1)
+			work(clients[0]);
+		else
+		{
+			std::vector<std::thread> threads;
+			for (auto client : clients)
+				threads.emplace_back(work, client);
+			for (auto& thread : threads)
+				thread.join();
+		}
+		return { paths.size(), failed, bytes, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() };
+	}
+
+	// size of a segment of a tile in quality from the bandwidth its representation announces
+	static size_t segmentBytes(const DASH::MPD* mpd, int tile, int quality)
+	{
+		return (size_t)(mpd->period.adaptationSets[tile].representations[quality].bandwidth * mpd->segmentDuration(tile, quality) / 8);
+	}
+
+private:
+	std::vector<Url> urls;
+	std::unordered_map<std::string, size_t> index;
+};
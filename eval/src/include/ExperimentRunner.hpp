@@ -0,0 +1,199 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Pieces shared by the evaluation programs. Head traces are drawn
+	from an explicitly seeded generator over the sorted directory, so
+	a seed always selects the same traces. ExperimentRunner spreads
+	independent jobs over a work stealing pool; every job returns its
+	CSV rows, which are written in job order no matter which worker
+	finished first, so parallel runs produce the sequential file. Rows
+	going to a ResultSink are summarized on the workers.
+*/
+
+#pragma once
+
+#include <set>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+#include <thread>
+#include <ostream>
+#include <algorithm>
+#include <functional>
+#include <exception>
+#include <experimental/filesystem>
+#include "httplib.h"
+#include "TraceCorpus.hpp"
+#include "ResultSummary.hpp"
+
+namespace fs = std::experimental::filesystem;
+
+inline void assignPath(const fs::path& path, std::string& out)
+{
+	out = path.string();
+}
+
+inline void assignPath(const fs::path& path, std::wstring& out)
+{
+	out = path.wstring();
+}
+
+// numTraces distinct traces of dir in directory order, the same for the same state of rng
+template<class PathType>
+std::vector<PathType> tracePermutation(const std::string& dir, int numTraces, std::mt19937& rng)
+{
+	std::vector<fs::path> files;
+	for (auto& f : fs::directory_iterator(dir))
+		if (f.path().filename() != TraceCorpus::fileName)
+			files.push_back(f.path());
+	std::sort(files.begin(), files.end());
+	if (files.empty())
+		return {};
+
+	std::set<size_t> traceIndices;
+	std::uniform_int_distribution<size_t> index(0, files.size() - 1);
+	while (traceIndices.size() < std::min<size_t>(numTraces, files.size()))
+		traceIndices.insert(index(rng));
+
+	std::vector<PathType> traces;
+	for (auto i : traceIndices)
+	{
+		traces.push_back(PathType());
+		assignPath(files[i], traces.back());
+	}
+	return traces;
+}
+
+// body of the MPD at uri, empty if it could not be fetched
+inline std::string fetchMpd(httplib::Client& client, const std::string& uri)
+{
+	auto res = client.Get(uri.c_str());
+	if (!res || res->status != 200)
+		return "";
+	return res->body;
+}
+
+class ExperimentRunner
+{
+public:
+	// 0 workers use every core, 1 runs the jobs on the calling thread
+	ExperimentRunner(size_t workers)
+		: workers(workers > 0 ? workers : std::max(1u, std::thread::hardware_concurrency()))
+	{
+	}
+
+	size_t numWorkers() const
+	{
+		return workers;
+	}
+
+	// runs job(0) to job(numJobs - 1) and writes their rows to csv in that order, rethrows the first failure.
+	// The rows going to a ResultSink are summarized by the worker that ran the job
+	void run(size_t numJobs, const std::function<std::string(size_t)>& job, std::ostream& csv)
+	{
+		auto sink = dynamic_cast<ResultSink*>(&csv);
+		if (sink && !sink->summary().knowsHeader())
+			sink = nullptr;
+		std::vector<ResultSummary> shards(sink ? workers : 0, sink ? sink->summary().empty() : ResultSummary());
+		std::vector<std::string> rows(numJobs);
+		std::vector<bool> done(numJobs, false);
+		size_t written = 0;
+		std::mutex outMtx;
+		std::exception_ptr failure;
+
+		auto finish = [&](size_t j, std::string result) {
+			std::lock_guard<std::mutex> l(outMtx);
+			rows[j] = std::move(result);
+			done[j] = true;
+			while (written < numJobs && done[written])
+			{
+				if (sink)
+					sink->writeRaw(rows[written]);
+				else
+					csv << rows[written];
+				rows[written].clear();
+				written++;
+			}
+			csv.flush();
+		};
+
+		auto execute = [&](size_t j, size_t worker) {
+			try
+			{
+				auto result = job(j);
+				if (sink)
+					shards[worker].addRows(result);
+				finish(j, std::move(result));
+			}
+			catch (...)
+			{
+				std::lock_guard<std::mutex> l(outMtx);
+				if (!failure)
+					failure = std::current_exception();
+			}
+		};
+
+		if (workers == 1)
+		{
+			for (size_t j = 0; j < numJobs; j++)
+				execute(j, 0);
+		}
+		else
+		{
+			// jobs are dealt round robin, an idle worker steals from the back of the others' queues
+			std::vector<Queue> queues(workers);
+			for (size_t j = 0; j < numJobs; j++)
+				queues[j % workers].jobs.push_back(j);
+
+			std::vector<std::thread> threads;
+			for (size_t w = 0; w < workers; w++)
+				threads.emplace_back([&, w]() {
+					size_t j;
+					while (take(queues, w, j))
+						execute(j, w);
+				});
+			for (auto& t : threads)
+				t.join();
+		}
+
+		for (auto& shard : shards)
+			sink->summary().merge(shard);
+		if (failure)
+			std::rethrow_exception(failure);
+	}
+
+private:
+	struct Queue
+	{
+		std::mutex mtx;
+		std::deque<size_t> jobs;
+	};
+
+	size_t workers;
+
+	static bool take(std::vector<Queue>& queues, size_t worker, size_t& job)
+	{
+		for (size_t i = 0; i < queues.size(); i++)
+		{
+			auto& q = queues[(worker + i) % queues.size()];
+			std::lock_guard<std::mutex> l(q.mtx);
+			if (q.jobs.empty())
+				continue;
+			if (i == 0)
+			{
+				job = q.jobs.front();
+				q.jobs.pop_front();
+			}
+			else
+			{
+				job = q.jobs.back();
+				q.jobs.pop_back();
+			}
+			return true;
+		}
+		return false;
+	}
+};
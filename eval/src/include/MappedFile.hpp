@@ -0,0 +1,98 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Read only mapping of a whole file. The pages are shared by every
+	process mapping the same file and are only read from disk when
+	touched.
+*/
+
+#pragma once
+
+#include <memory>
+#include <string>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
+class MappedFile
+{
+public:
+	// nullptr if the file is missing or empty
+	static std::shared_ptr<const MappedFile> open(const std::string& path)
+	{
+		std::shared_ptr<MappedFile> file(new MappedFile());
+#ifdef _WIN32
+		file->file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file->file == INVALID_HANDLE_VALUE)
+			return nullptr;
+		LARGE_INTEGER fileSize;
+		GetFileSizeEx(file->file, &fileSize);
+		file->length = (size_t)fileSize.QuadPart;
+		if (file->length == 0)
+			return nullptr;
+		file->mapping = CreateFileMappingA(file->file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (!file->mapping)
+			return nullptr;
+		file->bytes = static_cast<const char*>(MapViewOfFile(file->mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return nullptr;
+		struct stat st;
+		if (fstat(fd, &st) < 0 || st.st_size == 0)
+		{
+			::close(fd);
+			return nullptr;
+		}
+		file->length = (size_t)st.st_size;
+		void* addr = mmap(NULL, file->length, PROT_READ, MAP_SHARED, fd, 0);
+		file->bytes = addr == MAP_FAILED ? nullptr : static_cast<const char*>(addr);
+		// the mapping stays valid without the descriptor
+		::close(fd);
+#endif
+		if (!file->bytes)
+			return nullptr;
+		return file;
+	}
+
+	~MappedFile()
+	{
+#ifdef _WIN32
+		if (bytes) UnmapViewOfFile(bytes);
+		if (mapping) CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+		if (bytes) munmap(const_cast<char*>(bytes), length);
+#endif
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const char* data() const { return bytes; }
+	size_t size() const { return length; }
+
+private:
+	const char* bytes;
+	size_t length;
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#endif
+
+	MappedFile() : bytes(nullptr), length(0)
+#ifdef _WIN32
+		, file(INVALID_HANDLE_VALUE), mapping(NULL)
+#endif
+	{
+	}
+};
@@ -0,0 +1,407 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Quaternion math on many values at once: N vectors rotated by one
+	rotation, the Euler angles of N rotations, slerp between N pairs
+	and the angle between the viewing directions of N pairs. Values are floats stored as separate arrays per component;
+	Quaternions and Vectors convert from and to the double Quaternion
+	and VectorCartesian that single poses keep using. atan2 and sin
+	are approximated by polynomials (error about 1e-5 rad). The loops
+	are written to auto-vectorize, builds with AVX2 and FMA enabled
+	use 8 float lanes and a scalar tail. MSVC has no __FMA__, its
+	/arch:AVX2 implies FMA.
+*/
+
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <cstddef>
+
+#if defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+#include <immintrin.h>
+#endif
+
+#include "Quaternion.hpp"
+
+class QuaternionBatch
+{
+public:
+	// rotations, one array per component
+	struct Quaternions
+	{
+		std::vector<float> w, x, y, z;
+
+		Quaternions(size_t count = 0)
+		{
+			resize(count);
+		}
+
+		void resize(size_t count)
+		{
+			w.resize(count);
+			x.resize(count);
+			y.resize(count);
+			z.resize(count);
+		}
+
+		size_t size() const
+		{
+			return w.size();
+		}
+
+		void set(size_t i, const IMT::Quaternion& q)
+		{
+			w[i] = float(q.GetW());
+			x[i] = float(q.GetV().GetX());
+			y[i] = float(q.GetV().GetY());
+			z[i] = float(q.GetV().GetZ());
+		}
+
+		IMT::Quaternion get(size_t i) const
+		{
+			return IMT::Quaternion(w[i], x[i], y[i], z[i]);
+		}
+	};
+
+	// vectors, one array per component; Euler angles are stored as ToEuler returns them, (roll, pitch, yaw)
+	struct Vectors
+	{
+		std::vector<float> x, y, z;
+
+		Vectors(size_t count = 0)
+		{
+			resize(count);
+		}
+
+		void resize(size_t count)
+		{
+			x.resize(count);
+			y.resize(count);
+			z.resize(count);
+		}
+
+		size_t size() const
+		{
+			return x.size();
+		}
+
+		void set(size_t i, const IMT::VectorCartesian& v)
+		{
+			x[i] = float(v.GetX());
+			y[i] = float(v.GetY());
+			z[i] = float(v.GetZ());
+		}
+
+		IMT::VectorCartesian get(size_t i) const
+		{
+			return IMT::VectorCartesian(x[i], y[i], z[i]);
+		}
+	};
+
+	// 3x3 matrix of a rotation, computed in double from a quaternion that need not be normalized
+	struct Rotation
+	{
+		float m[9];
+
+		Rotation(const IMT::Quaternion& q)
+		{
+			double w = q.GetW();
+			auto v = q.GetV();
+			double x = v.GetX(), y = v.GetY(), z = v.GetZ();
+			double n = w * w + x * x + y * y + z * z;
+			double s = n > 0 ? 2 / n : 0;
+
+			m[0] = float(1 - s * (y * y + z * z)); m[1] = float(s * (x * y - w * z)); m[2] = float(s * (x * z + w * y));
+			m[3] = float(s * (x * y + w * z)); m[4] = float(1 - s * (x * x + z * z)); m[5] = float(s * (y * z - w * x));
+			m[6] = float(s * (x * z - w * y)); m[7] = float(s * (y * z + w * x)); m[8] = float(1 - s * (x * x + y * y));
+		}
+
+		void apply(float x, float y, float z, float& ox, float& oy, float& oz) const
+		{
+			ox = m[0] * x + m[1] * y + m[2] * z;
+			oy = m[3] * x + m[4] * y + m[5] * z;
+			oz = m[6] * x + m[7] * y + m[8] * z;
+		}
+	};
+
+#if defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+	// a Rotation broadcast to 8 lanes, set up once per batch
+	struct Rotation8
+	{
+		__m256 m[9];
+
+		Rotation8(const Rotation& r)
+		{
+			for (int i = 0; i < 9; i++)
+				m[i] = _mm256_set1_ps(r.m[i]);
+		}
+
+		void apply(__m256 x, __m256 y, __m256 z, __m256& ox, __m256& oy, __m256& oz) const
+		{
+			ox = _mm256_fmadd_ps(m[0], x, _mm256_fmadd_ps(m[1], y, _mm256_mul_ps(m[2], z)));
+			oy = _mm256_fmadd_ps(m[3], x, _mm256_fmadd_ps(m[4], y, _mm256_mul_ps(m[5], z)));
+			oz = _mm256_fmadd_ps(m[6], x, _mm256_fmadd_ps(m[7], y, _mm256_mul_ps(m[8], z)));
+		}
+	};
+#endif
+
+	// every vector of in rotated by rotation, out is resized to in
+	static void rotate(const IMT::Quaternion& rotation, const Vectors& in, Vectors& out)
+	{
+		const size_t count = in.size();
+		out.resize(count);
+		const Rotation r(rotation);
+		const float* px = in.x.data();
+		const float* py = in.y.data();
+		const float* pz = in.z.data();
+		float* ox = out.x.data();
+		float* oy = out.y.data();
+		float* oz = out.z.data();
+		size_t i = 0;
+
+#if defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+		const Rotation8 r8(r);
+		for (; i + 8 <= count; i += 8)
+		{
+			__m256 x, y, z;
+			r8.apply(_mm256_loadu_ps(px + i), _mm256_loadu_ps(py + i), _mm256_loadu_ps(pz + i), x, y, z);
+			_mm256_storeu_ps(ox + i, x);
+			_mm256_storeu_ps(oy + i, y);
+			_mm256_storeu_ps(oz + i, z);
+		}
+#endif
+
+		for (; i < count; i++)
+			r.apply(px[i], py[i], pz[i], ox[i], oy[i], oz[i]);
+	}
+
+	// (roll, pitch, yaw) of every rotation like Quaternion::ToEuler, out is resized to rotations
+	static void toEuler(const Quaternions& rotations, Vectors& out)
+	{
+		const size_t count = rotations.size();
+		out.resize(count);
+		const float* pw = rotations.w.data();
+		const float* px = rotations.x.data();
+		const float* py = rotations.y.data();
+		const float* pz = rotations.z.data();
+		float* roll = out.x.data();
+		float* pitch = out.y.data();
+		float* yaw = out.z.data();
+		size_t i = 0;
+
+#if defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+		const __m256 one = _mm256_set1_ps(1.0f), minusOne = _mm256_set1_ps(-1.0f), two = _mm256_set1_ps(2.0f), zero = _mm256_setzero_ps();
+		for (; i + 8 <= count; i += 8)
+		{
+			__m256 w = _mm256_loadu_ps(pw + i), x = _mm256_loadu_ps(px + i), y = _mm256_loadu_ps(py + i), z = _mm256_loadu_ps(pz + i);
+
+			__m256 sinr = _mm256_mul_ps(two, _mm256_fmadd_ps(w, x, _mm256_mul_ps(y, z)));
+			__m256 cosr = _mm256_fnmadd_ps(two, _mm256_fmadd_ps(x, x, _mm256_mul_ps(y, y)), one);
+			_mm256_storeu_ps(roll + i, atan2Avx(sinr, cosr));
+
+			// asin as atan2, clamped to +-90 degrees where rounding leaves the range
+			__m256 sinp = _mm256_mul_ps(two, _mm256_fmsub_ps(w, y, _mm256_mul_ps(z, x)));
+			sinp = _mm256_min_ps(one, _mm256_max_ps(minusOne, sinp));
+			__m256 cosp = _mm256_sqrt_ps(_mm256_max_ps(zero, _mm256_fnmadd_ps(sinp, sinp, one)));
+			_mm256_storeu_ps(pitch + i, atan2Avx(sinp, cosp));
+
+			__m256 siny = _mm256_mul_ps(two, _mm256_fmadd_ps(w, z, _mm256_mul_ps(x, y)));
+			__m256 cosy = _mm256_fnmadd_ps(two, _mm256_fmadd_ps(y, y, _mm256_mul_ps(z, z)), one);
+			_mm256_storeu_ps(yaw + i, atan2Avx(siny, cosy));
+		}
+#endif
+
+		for (; i < count; i++)
+		{
+			float w = pw[i], x = px[i], y = py[i], z = pz[i];
+			roll[i] = fastAtan2(2 * (w * x + y * z), 1 - 2 * (x * x + y * y));
+			float sinp = std::fmin(1.0f, std::fmax(-1.0f, 2 * (w * y - z * x)));
+			pitch[i] = fastAtan2(sinp, std::sqrt(std::fmax(0.0f, 1 - sinp * sinp)));
+			yaw[i] = fastAtan2(2 * (w * z + x * y), 1 - 2 * (y * y + z * z));
+		}
+	}
+
+	// slerp from a[i] to b[i] by k[i] on the short way around like Quaternion::SLERP, results are normalized.
+	// a, b and k hold the same number of values, out is resized to them
+	static void slerp(const Quaternions& a, const Quaternions& b, const float* k, Quaternions& out)
+	{
+		const size_t count = a.size();
+		out.resize(count);
+		size_t i = 0;
+
+#if defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+		const __m256 one = _mm256_set1_ps(1.0f), zero = _mm256_setzero_ps(), signMask = _mm256_set1_ps(-0.0f);
+		const __m256 linear = _mm256_set1_ps(linearBelow);
+		for (; i + 8 <= count; i += 8)
+		{
+			__m256 aw = _mm256_loadu_ps(&a.w[i]), ax = _mm256_loadu_ps(&a.x[i]), ay = _mm256_loadu_ps(&a.y[i]), az = _mm256_loadu_ps(&a.z[i]);
+			__m256 bw = _mm256_loadu_ps(&b.w[i]), bx = _mm256_loadu_ps(&b.x[i]), by = _mm256_loadu_ps(&b.y[i]), bz = _mm256_loadu_ps(&b.z[i]);
+			__m256 t = _mm256_loadu_ps(k + i);
+
+			// b or -b, whichever is closer to a
+			__m256 d = _mm256_fmadd_ps(aw, bw, _mm256_fmadd_ps(ax, bx, _mm256_fmadd_ps(ay, by, _mm256_mul_ps(az, bz))));
+			__m256 sign = _mm256_and_ps(d, signMask);
+			bw = _mm256_xor_ps(bw, sign);
+			bx = _mm256_xor_ps(bx, sign);
+			by = _mm256_xor_ps(by, sign);
+			bz = _mm256_xor_ps(bz, sign);
+			d = _mm256_min_ps(one, _mm256_andnot_ps(signMask, d));
+
+			__m256 sinTheta = _mm256_sqrt_ps(_mm256_max_ps(zero, _mm256_fnmadd_ps(d, d, one)));
+			__m256 theta = atan2Avx(sinTheta, d);
+			__m256 invSin = _mm256_div_ps(one, _mm256_max_ps(sinTheta, linear));
+			__m256 u = _mm256_sub_ps(one, t);
+			__m256 wa = _mm256_mul_ps(sinAvx(_mm256_mul_ps(u, theta)), invSin);
+			__m256 wb = _mm256_mul_ps(sinAvx(_mm256_mul_ps(t, theta)), invSin);
+			__m256 nearby = _mm256_cmp_ps(sinTheta, linear, _CMP_LT_OQ);
+			wa = _mm256_blendv_ps(wa, u, nearby);
+			wb = _mm256_blendv_ps(wb, t, nearby);
+
+			__m256 ow = _mm256_fmadd_ps(wa, aw, _mm256_mul_ps(wb, bw));
+			__m256 ox = _mm256_fmadd_ps(wa, ax, _mm256_mul_ps(wb, bx));
+			__m256 oy = _mm256_fmadd_ps(wa, ay, _mm256_mul_ps(wb, by));
+			__m256 oz = _mm256_fmadd_ps(wa, az, _mm256_mul_ps(wb, bz));
+			__m256 n = _mm256_fmadd_ps(ow, ow, _mm256_fmadd_ps(ox, ox, _mm256_fmadd_ps(oy, oy, _mm256_mul_ps(oz, oz))));
+			__m256 invNorm = _mm256_div_ps(one, _mm256_sqrt_ps(_mm256_max_ps(n, _mm256_set1_ps(1e-30f))));
+			_mm256_storeu_ps(&out.w[i], _mm256_mul_ps(ow, invNorm));
+			_mm256_storeu_ps(&out.x[i], _mm256_mul_ps(ox, invNorm));
+			_mm256_storeu_ps(&out.y[i], _mm256_mul_ps(oy, invNorm));
+			_mm256_storeu_ps(&out.z[i], _mm256_mul_ps(oz, invNorm));
+		}
+#endif
+
+		for (; i < count; i++)
+		{
+			float aw = a.w[i], ax = a.x[i], ay = a.y[i], az = a.z[i];
+			float bw = b.w[i], bx = b.x[i], by = b.y[i], bz = b.z[i];
+			float t = k[i];
+
+			float d = aw * bw + ax * bx + ay * by + az * bz;
+			float sign = d < 0 ? -1.0f : 1.0f;
+			bw *= sign;
+			bx *= sign;
+			by *= sign;
+			bz *= sign;
+			d = std::fmin(1.0f, std::fabs(d));
+
+			// nearly equal rotations are interpolated linearly, the normalization below keeps the result a rotation
+			float sinTheta = std::sqrt(std::fmax(0.0f, 1 - d * d));
+			float theta = fastAtan2(sinTheta, d);
+			bool nearby = sinTheta < linearBelow;
+			float invSin = 1 / std::fmax(sinTheta, linearBelow);
+			float wa = nearby ? 1 - t : fastSin((1 - t) * theta) * invSin;
+			float wb = nearby ? t : fastSin(t * theta) * invSin;
+
+			float ow = wa * aw + wb * bw, ox = wa * ax + wb * bx, oy = wa * ay + wb * by, oz = wa * az + wb * bz;
+			float invNorm = 1 / std::sqrt(std::fmax(ow * ow + ox * ox + oy * oy + oz * oz, 1e-30f));
+			out.w[i] = ow * invNorm;
+			out.x[i] = ox * invNorm;
+			out.y[i] = oy * invNorm;
+			out.z[i] = oz * invNorm;
+		}
+	}
+
+	// angle between the x axis rotated by a[i] and by b[i] like Quaternion::OrthodromicDistance, in radians.
+	// a and b hold the same number of rotations, out one value per pair
+	static void orthodromicDistance(const Quaternions& a, const Quaternions& b, float* out)
+	{
+		const size_t count = a.size();
+		size_t i = 0;
+
+#if defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+		const __m256 two = _mm256_set1_ps(2.0f);
+		for (; i + 8 <= count; i += 8)
+		{
+			__m256 aw = _mm256_loadu_ps(&a.w[i]), ax = _mm256_loadu_ps(&a.x[i]), ay = _mm256_loadu_ps(&a.y[i]), az = _mm256_loadu_ps(&a.z[i]);
+			__m256 bw = _mm256_loadu_ps(&b.w[i]), bx = _mm256_loadu_ps(&b.x[i]), by = _mm256_loadu_ps(&b.y[i]), bz = _mm256_loadu_ps(&b.z[i]);
+
+			__m256 p0 = _mm256_sub_ps(_mm256_fmadd_ps(aw, aw, _mm256_mul_ps(ax, ax)), _mm256_fmadd_ps(ay, ay, _mm256_mul_ps(az, az)));
+			__m256 p1 = _mm256_mul_ps(two, _mm256_fmadd_ps(ax, ay, _mm256_mul_ps(aw, az)));
+			__m256 p2 = _mm256_mul_ps(two, _mm256_fmsub_ps(ax, az, _mm256_mul_ps(aw, ay)));
+			__m256 q0 = _mm256_sub_ps(_mm256_fmadd_ps(bw, bw, _mm256_mul_ps(bx, bx)), _mm256_fmadd_ps(by, by, _mm256_mul_ps(bz, bz)));
+			__m256 q1 = _mm256_mul_ps(two, _mm256_fmadd_ps(bx, by, _mm256_mul_ps(bw, bz)));
+			__m256 q2 = _mm256_mul_ps(two, _mm256_fmsub_ps(bx, bz, _mm256_mul_ps(bw, by)));
+
+			__m256 c0 = _mm256_fmsub_ps(p1, q2, _mm256_mul_ps(p2, q1));
+			__m256 c1 = _mm256_fmsub_ps(p2, q0, _mm256_mul_ps(p0, q2));
+			__m256 c2 = _mm256_fmsub_ps(p0, q1, _mm256_mul_ps(p1, q0));
+			__m256 cross = _mm256_sqrt_ps(_mm256_fmadd_ps(c0, c0, _mm256_fmadd_ps(c1, c1, _mm256_mul_ps(c2, c2))));
+			__m256 dot = _mm256_fmadd_ps(p0, q0, _mm256_fmadd_ps(p1, q1, _mm256_mul_ps(p2, q2)));
+			_mm256_storeu_ps(out + i, atan2Avx(cross, dot));
+		}
+#endif
+
+		for (; i < count; i++)
+		{
+			float aw = a.w[i], ax = a.x[i], ay = a.y[i], az = a.z[i];
+			float bw = b.w[i], bx = b.x[i], by = b.y[i], bz = b.z[i];
+
+			// the rotated x axis scaled by the squared norm of the quaternion, which leaves the angle as it is
+			float p0 = aw * aw + ax * ax - ay * ay - az * az, p1 = 2 * (ax * ay + aw * az), p2 = 2 * (ax * az - aw * ay);
+			float q0 = bw * bw + bx * bx - by * by - bz * bz, q1 = 2 * (bx * by + bw * bz), q2 = 2 * (bx * bz - bw * by);
+
+			float c0 = p1 * q2 - p2 * q1, c1 = p2 * q0 - p0 * q2, c2 = p0 * q1 - p1 * q0;
+			out[i] = fastAtan2(std::sqrt(c0 * c0 + c1 * c1 + c2 * c2), p0 * q0 + p1 * q1 + p2 * q2);
+		}
+	}
+
+	// polynomial for atan on [0, 1] (Abramowitz and Stegun 4.4.47), the quadrant is restored with selects so the loop stays branch free
+	static float fastAtan2(float y, float x)
+	{
+		float ax = std::fabs(x), ay = std::fabs(y);
+		float mx = ax > ay ? ax : ay;
+		float mn = ax > ay ? ay : ax;
+		float a = mx > 0 ? mn / mx : 0.0f;
+		float s = a * a;
+		float r = ((((0.0208351f * s - 0.085133f) * s + 0.180141f) * s - 0.3302995f) * s + 0.999866f) * a;
+		r = ay > ax ? halfPi - r : r;
+		r = x < 0 ? pi - r : r;
+		return y < 0 ? -r : r;
+	}
+
+#if defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+	static __m256 atan2Avx(__m256 y, __m256 x)
+	{
+		const __m256 signMask = _mm256_set1_ps(-0.0f);
+		__m256 ax = _mm256_andnot_ps(signMask, x), ay = _mm256_andnot_ps(signMask, y);
+		__m256 mx = _mm256_max_ps(ax, ay), mn = _mm256_min_ps(ax, ay);
+		__m256 a = _mm256_div_ps(mn, _mm256_max_ps(mx, _mm256_set1_ps(1e-30f)));
+		__m256 s = _mm256_mul_ps(a, a);
+		__m256 r = _mm256_fmadd_ps(_mm256_set1_ps(0.0208351f), s, _mm256_set1_ps(-0.085133f));
+		r = _mm256_fmadd_ps(r, s, _mm256_set1_ps(0.180141f));
+		r = _mm256_fmadd_ps(r, s, _mm256_set1_ps(-0.3302995f));
+		r = _mm256_fmadd_ps(r, s, _mm256_set1_ps(0.999866f));
+		r = _mm256_mul_ps(r, a);
+		r = _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_set1_ps(halfPi), r), _mm256_cmp_ps(ay, ax, _CMP_GT_OQ));
+		r = _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_set1_ps(pi), r), _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_LT_OQ));
+		return _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_setzero_ps(), r), _mm256_cmp_ps(y, _mm256_setzero_ps(), _CMP_LT_OQ));
+	}
+#endif
+
+private:
+	static constexpr float pi = 3.14159265f;
+	static constexpr float halfPi = 1.57079633f;
+	// sin(theta) below which slerp falls back to linear weights
+	static constexpr float linearBelow = 1e-3f;
+
+	// Taylor polynomial of sin to x^9, for the angles of slerp in [0, pi / 2]
+	static float fastSin(float x)
+	{
+		float s = x * x;
+		return x * ((((2.75573192e-6f * s - 1.98412698e-4f) * s + 8.33333333e-3f) * s - 0.166666667f) * s + 1.0f);
+	}
+
+#if defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+	static __m256 sinAvx(__m256 x)
+	{
+		__m256 s = _mm256_mul_ps(x, x);
+		__m256 r = _mm256_fmadd_ps(_mm256_set1_ps(2.75573192e-6f), s, _mm256_set1_ps(-1.98412698e-4f));
+		r = _mm256_fmadd_ps(r, s, _mm256_set1_ps(8.33333333e-3f));
+		r = _mm256_fmadd_ps(r, s, _mm256_set1_ps(-0.166666667f));
+		r = _mm256_fmadd_ps(r, s, _mm256_set1_ps(1.0f));
+		return _mm256_mul_ps(x, r);
+	}
+#endif
+};
@@ -0,0 +1,109 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Replacement policies with squid's heap keys, shared by the caching
+	proxy, the cache simulation of the evaluations and the player's
+	segment store: an entry with a smaller key is evicted first.
+*/
+#pragma once
+
+#include <memory>
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+
+class ReplacementPolicy
+{
+public:
+	struct Entry
+	{
+		size_t size;
+		size_t refcount;
+		// position in the sequence of all accesses
+		long long lastAccess;
+		// named by the popularity metadata of an MPD
+		bool popular;
+	};
+
+	virtual ~ReplacementPolicy() {}
+
+	// entries with the smallest key are evicted first, age is the inflation of the dynamic aging policies
+	virtual double key(const Entry& entry, double age) const = 0;
+
+	// age after evicting an entry with key
+	virtual double ageAfterEviction(const Entry& entry, double key) const
+	{
+		return key;
+	}
+
+	// type is one of "LRU", "LFUDA", "GDSF" or "popularity"
+	static std::unique_ptr<ReplacementPolicy> create(const std::string& type);
+};
+
+class LruPolicy : public ReplacementPolicy
+{
+public:
+	double key(const Entry& entry, double age) const override
+	{
+		return double(entry.lastAccess);
+	}
+
+	double ageAfterEviction(const Entry& entry, double key) const override
+	{
+		return 0;
+	}
+};
+
+// least frequently used with dynamic aging, keeps popular objects without letting old counts pin them forever
+class LfudaPolicy : public ReplacementPolicy
+{
+public:
+	double key(const Entry& entry, double age) const override
+	{
+		return entry.refcount + age;
+	}
+};
+
+// greedy dual size frequency, favours small objects and so the object hit rate
+class GdsfPolicy : public ReplacementPolicy
+{
+public:
+	double key(const Entry& entry, double age) const override
+	{
+		return age + double(entry.refcount) / std::max<size_t>(entry.size, 1);
+	}
+};
+
+// LFUDA in two classes: representations the MPD recommends are only evicted when nothing else is left.
+// The class offset is kept out of the age, so new objects do not inherit it
+class PopularityPolicy : public ReplacementPolicy
+{
+public:
+	double key(const Entry& entry, double age) const override
+	{
+		return (entry.popular ? popularOffset : 0) + entry.refcount + age;
+	}
+
+	double ageAfterEviction(const Entry& entry, double key) const override
+	{
+		return entry.popular ? key - popularOffset : key;
+	}
+
+private:
+	static constexpr double popularOffset = 1e12;
+};
+
+inline std::unique_ptr<ReplacementPolicy> ReplacementPolicy::create(const std::string& type)
+{
+	if (type == "LRU")
+		return std::unique_ptr<ReplacementPolicy>(new LruPolicy());
+	else if (type == "LFUDA")
+		return std::unique_ptr<ReplacementPolicy>(new LfudaPolicy());
+	else if (type == "GDSF")
+		return std::unique_ptr<ReplacementPolicy>(new GdsfPolicy());
+	else if (type == "popularity")
+		return std::unique_ptr<ReplacementPolicy>(new PopularityPolicy());
+
+	throw std::invalid_argument("ReplacementPolicy::create: invalid replacement policy type: " + type);
+}
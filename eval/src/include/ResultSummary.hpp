@@ -0,0 +1,414 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Statistics of the evaluation results computed while they are
+	written. A ResultSink stands in for the CSV file of a program: it
+	reads the rows written to it, keeps mean, variance and a quantile
+	sketch of every metric column per group, the values of the group
+	columns, and writes them as a summary CSV when it is closed. The raw
+	rows are written as well unless they are turned off. Summaries of
+	parallel workers merge into the same result as a sequential run,
+	the quantiles up to the relative accuracy of the sketch.
+*/
+
+#pragma once
+
+#include <map>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <limits>
+#include <ostream>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cstdint>
+#include <algorithm>
+
+// count, mean and variance by Welford's update, merged with the pairwise formula of Chan et al.
+class RunningStats
+{
+public:
+	void add(double x)
+	{
+		n++;
+		double delta = x - m;
+		m += delta / n;
+		m2 += delta * (x - m);
+		lo = std::min(lo, x);
+		hi = std::max(hi, x);
+	}
+
+	void merge(const RunningStats& other)
+	{
+		if (other.n == 0)
+			return;
+		if (n == 0)
+		{
+			*this = other;
+			return;
+		}
+		double total = double(n + other.n);
+		double delta = other.m - m;
+		m += delta * other.n / total;
+		m2 += other.m2 + delta * delta * n * other.n / total;
+		n += other.n;
+		lo = std::min(lo, other.lo);
+		hi = std::max(hi, other.hi);
+	}
+
+	uint64_t count() const { return n; }
+	double mean() const { return m; }
+	double min() const { return lo; }
+	double max() const { return hi; }
+
+	// sample variance, 0 below two values
+	double variance() const
+	{
+		return n > 1 ? m2 / (n - 1) : 0;
+	}
+
+	// half width of the 95% confidence interval of the mean, with Student's t up to 30 degrees of freedom
+	double confidence95() const
+	{
+		static const double t[] = { 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228, 2.201, 2.179,
+			2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048,
+			2.045, 2.042 };
+		if (n < 2)
+			return 0;
+		double quantile = n - 1 <= 30 ? t[n - 2] : 1.96;
+		return quantile * std::sqrt(variance() / n);
+	}
+
+private:
+	uint64_t n = 0;
+	double m = 0;
+	double m2 = 0;
+	double lo = std::numeric_limits<double>::infinity();
+	double hi = -std::numeric_limits<double>::infinity();
+};
+
+// quantiles with a relative error of at most accuracy, from counts of logarithmic buckets like DDSketch.
+// The buckets only exist for the magnitudes seen, sketches merge by adding their counts
+class QuantileSketch
+{
+public:
+	explicit QuantileSketch(double accuracy = 0.01)
+		: gamma((1 + accuracy) / (1 - accuracy)), logGamma(std::log(gamma))
+	{
+	}
+
+	void add(double x)
+	{
+		if (std::fabs(x) < minMagnitude)
+			zeros++;
+		else
+			(x > 0 ? positive : negative)[key(std::fabs(x))]++;
+		n++;
+	}
+
+	void merge(const QuantileSketch& other)
+	{
+		for (auto& b : other.positive)
+			positive[b.first] += b.second;
+		for (auto& b : other.negative)
+			negative[b.first] += b.second;
+		zeros += other.zeros;
+		n += other.n;
+	}
+
+	// value at quantile q in [0, 1], NaN for an empty sketch
+	double quantile(double q) const
+	{
+		if (n == 0)
+			return std::numeric_limits<double>::quiet_NaN();
+		uint64_t rank = (uint64_t)(std::max(0.0, std::min(1.0, q)) * (n - 1));
+		uint64_t seen = 0;
+		// the most negative values have the highest keys
+		for (auto it = negative.rbegin(); it != negative.rend(); ++it)
+			if ((seen += it->second) > rank)
+				return -value(it->first);
+		if ((seen += zeros) > rank)
+			return 0;
+		for (auto& b : positive)
+			if ((seen += b.second) > rank)
+				return value(b.first);
+		return value(positive.rbegin()->first);
+	}
+
+private:
+	static constexpr double minMagnitude = 1e-9;
+
+	double gamma;
+	double logGamma;
+	std::map<int, uint64_t> positive;
+	std::map<int, uint64_t> negative;
+	uint64_t zeros = 0;
+	uint64_t n = 0;
+
+	int key(double magnitude) const
+	{
+		return (int)std::ceil(std::log(magnitude) / logGamma);
+	}
+
+	// the value of a bucket with the lowest relative error to all in it
+	double value(int key) const
+	{
+		return 2 * std::pow(gamma, key) / (gamma + 1);
+	}
+};
+
+// statistics of the metric columns of CSV rows per group, the group being the values of the group columns
+class ResultSummary
+{
+public:
+	ResultSummary() {}
+
+	// columns are named as in the header, missing ones are left out
+	ResultSummary(const std::vector<std::string>& groupColumns, const std::vector<std::string>& metricColumns)
+		: groupNames(groupColumns), metricNames(metricColumns)
+	{
+	}
+
+	// the columns of the header row, the other rows only once it was given
+	void header(const std::string& line)
+	{
+		auto names = split(line);
+		groupIndices = indicesOf(groupNames, names);
+		metricIndices = indicesOf(metricNames, names);
+		hasHeader = true;
+	}
+
+	bool knowsHeader() const
+	{
+		return hasHeader;
+	}
+
+	// the same columns without statistics, for a worker to fill and merge back
+	ResultSummary empty() const
+	{
+		ResultSummary summary(groupNames, metricNames);
+		summary.groupIndices = groupIndices;
+		summary.metricIndices = metricIndices;
+		summary.hasHeader = hasHeader;
+		return summary;
+	}
+
+	// adds every row of text, a metric that is no number is skipped
+	void addRows(const std::string& text)
+	{
+		std::istringstream lines(text);
+		std::string line;
+		while (std::getline(lines, line))
+			addRow(line);
+	}
+
+	void addRow(const std::string& line)
+	{
+		if (!hasHeader || line.empty())
+			return;
+		auto fields = split(line);
+		std::vector<std::string> group;
+		for (int i : groupIndices)
+			group.push_back(i >= 0 && i < (int)fields.size() ? fields[i] : "");
+		for (size_t m = 0; m < metricIndices.size(); m++)
+		{
+			int i = metricIndices[m];
+			if (i < 0 || i >= (int)fields.size())
+				continue;
+			char* end;
+			double value = std::strtod(fields[i].c_str(), &end);
+			if (end == fields[i].c_str() || !std::isfinite(value))
+				continue;
+			group.push_back(metricNames[m]);
+			auto& metric = metrics[group];
+			group.pop_back();
+			metric.stats.add(value);
+			metric.sketch.add(value);
+		}
+	}
+
+	void merge(const ResultSummary& other)
+	{
+		for (auto& m : other.metrics)
+		{
+			auto& metric = metrics[m.first];
+			metric.stats.merge(m.second.stats);
+			metric.sketch.merge(m.second.sketch);
+		}
+	}
+
+	// one row per group and metric, in the order of their values
+	void write(std::ostream& out) const
+	{
+		for (auto& name : groupNames)
+			out << name << ",";
+		out << "Metric,Count,Mean,Std,CI95 Low,CI95 High,Min,P5,P50,P90,P95,P99,Max\n";
+		for (auto& m : metrics)
+		{
+			for (auto& key : m.first)
+				out << key << ",";
+			auto& s = m.second.stats;
+			double ci = s.confidence95();
+			out << s.count() << "," << s.mean() << "," << std::sqrt(s.variance()) << "," << s.mean() - ci << "," << s.mean() + ci
+				<< "," << s.min();
+			// a bucket's value may lie just outside the values in it
+			for (double q : { 0.05, 0.5, 0.9, 0.95, 0.99 })
+				out << "," << std::min(s.max(), std::max(s.min(), m.second.sketch.quantile(q)));
+			out << "," << s.max() << "\n";
+		}
+	}
+
+private:
+	struct Metric
+	{
+		RunningStats stats;
+		QuantileSketch sketch;
+	};
+
+	std::vector<std::string> groupNames;
+	std::vector<std::string> metricNames;
+	std::vector<int> groupIndices;
+	std::vector<int> metricIndices;
+	bool hasHeader = false;
+	// by the values of the group columns followed by the name of the metric
+	std::map<std::vector<std::string>, Metric> metrics;
+
+	static std::vector<std::string> split(const std::string& line)
+	{
+		std::vector<std::string> fields;
+		std::istringstream ss(!line.empty() && line.back() == '\r' ? line.substr(0, line.size() - 1) : line);
+		std::string field;
+		while (std::getline(ss, field, ','))
+			fields.push_back(field);
+		return fields;
+	}
+
+	static std::vector<int> indicesOf(const std::vector<std::string>& wanted, const std::vector<std::string>& names)
+	{
+		std::vector<int> indices;
+		for (auto& w : wanted)
+		{
+			auto it = std::find(names.begin(), names.end(), w);
+			indices.push_back(it == names.end() ? -1 : int(it - names.begin()));
+		}
+		return indices;
+	}
+};
+
+// CSV output of an evaluation: the first line written is the header, every line after it a row that goes into
+// the summary. The raw rows are written to path if raw is set, the summary to path with .summary.csv in place
+// of .csv when the sink is closed or destroyed
+class ResultSink : public std::ostream
+{
+public:
+	ResultSink(const std::string& path, bool raw, const std::vector<std::string>& groupColumns, const std::vector<std::string>& metricColumns)
+		: std::ostream(nullptr), buffer(*this), path(path), results(groupColumns, metricColumns)
+	{
+		rdbuf(&buffer);
+		if (raw)
+		{
+			rawFile.open(path);
+			rawOut = &rawFile;
+		}
+	}
+
+	// the raw rows go to out, e.g. the console, if raw is set
+	ResultSink(std::ostream& out, bool raw, const std::string& path, const std::vector<std::string>& groupColumns, const std::vector<std::string>& metricColumns)
+		: std::ostream(nullptr), buffer(*this), path(path), results(groupColumns, metricColumns), rawOut(raw ? &out : nullptr)
+	{
+		rdbuf(&buffer);
+	}
+
+	~ResultSink()
+	{
+		close();
+	}
+
+	ResultSink(const ResultSink&) = delete;
+	ResultSink& operator=(const ResultSink&) = delete;
+
+	ResultSummary& summary()
+	{
+		return results;
+	}
+
+	// rows whose statistics were added to the summary already, or the header
+	void writeRaw(const std::string& text)
+	{
+		if (text.empty())
+			return;
+		if (!results.knowsHeader())
+			results.header(text.substr(0, text.find('\n')));
+		if (rawOut)
+			*rawOut << text;
+	}
+
+	void close()
+	{
+		if (closed)
+			return;
+		flush();
+		closed = true;
+		rawOut = nullptr;
+		rawFile.close();
+		auto dot = path.rfind(".csv");
+		std::ofstream out((dot == std::string::npos ? path : path.substr(0, dot)) + ".summary.csv");
+		results.write(out);
+	}
+
+private:
+	// hands every complete line to the sink
+	class LineBuffer : public std::streambuf
+	{
+	public:
+		explicit LineBuffer(ResultSink& sink) : sink(sink) {}
+
+	protected:
+		int overflow(int c) override
+		{
+			if (c == traits_type::eof())
+				return traits_type::not_eof(c);
+			line += (char)c;
+			if (c == '\n')
+			{
+				sink.line(line);
+				line.clear();
+			}
+			return c;
+		}
+
+		std::streamsize xsputn(const char* s, std::streamsize count) override
+		{
+			for (std::streamsize i = 0; i < count; i++)
+				overflow((unsigned char)s[i]);
+			return count;
+		}
+
+		int sync() override
+		{
+			if (sink.rawOut)
+				sink.rawOut->flush();
+			return 0;
+		}
+
+	private:
+		ResultSink& sink;
+		std::string line;
+	};
+
+	LineBuffer buffer;
+	std::string path;
+	ResultSummary results;
+	std::ofstream rawFile;
+	std::ostream* rawOut = nullptr;
+	bool closed = false;
+
+	void line(const std::string& text)
+	{
+		if (results.knowsHeader())
+			results.addRow(text.substr(0, text.size() - 1));
+		writeRaw(text);
+	}
+};
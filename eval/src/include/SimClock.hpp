@@ -0,0 +1,77 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Clock of the evaluation harnesses. It follows steady_clock unless
+	switched to virtual time, where it only moves when a simulated
+	download or a sleep advances it, so sessions run as fast as the
+	adaption logic computes. Every thread has its own clock, so runs
+	on different workers keep separate virtual times.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <thread>
+
+class SimClock
+{
+public:
+	static void setVirtual(bool enabled)
+	{
+		state().isVirtual = enabled;
+	}
+
+	static bool isVirtual()
+	{
+		return state().isVirtual;
+	}
+
+	static std::chrono::steady_clock::time_point now()
+	{
+		if (isVirtual())
+			return std::chrono::steady_clock::time_point(std::chrono::microseconds(state().virtualUs));
+		return std::chrono::steady_clock::now();
+	}
+
+	// microseconds on the clock, virtual time starts at 0
+	static long long nowUs()
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(now().time_since_epoch()).count();
+	}
+
+	// wall clock milliseconds since the epoch, or virtual ones
+	static long long epochMs()
+	{
+		if (isVirtual())
+			return state().virtualUs / 1000;
+		return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	}
+
+	static void advance(long long us)
+	{
+		if (us > 0)
+			state().virtualUs += us;
+	}
+
+	static void sleepFor(std::chrono::microseconds duration)
+	{
+		if (isVirtual())
+			advance(duration.count());
+		else
+			std::this_thread::sleep_for(duration);
+	}
+
+private:
+	struct State
+	{
+		bool isVirtual = false;
+		long long virtualUs = 0;
+	};
+
+	static State& state()
+	{
+		static thread_local State s;
+		return s;
+	}
+};
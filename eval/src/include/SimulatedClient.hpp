@@ -0,0 +1,325 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Simulation backend of the evaluation harnesses. SimulatedClient
+	answers the requests an httplib::Client would send to 360server or
+	through 360cache without any socket: segment sizes come from the
+	files of a www directory or the MPD, transfers are timed by the
+	bandwidth or the delivery trace of a SimulatedNetwork, and the
+	cache is a CacheSimulator. Every answer advances the SimClock by
+	its transfer time, so with a virtual clock a session takes as long
+	as its adaption decisions need to compute.
+
+	The network models the server's shaping: a fixed rate, or a looped
+	Mahimahi trace where every line is the millisecond of one 1500 byte
+	delivery opportunity, plus a round trip time per shaped request.
+	Cache hits are not shaped, like a proxy on the client's host.
+*/
+
+#pragma once
+
+#include <regex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include "httplib.h"
+#include "mpd.h"
+#include "SimClock.hpp"
+#include "CacheSimulator.hpp"
+
+#define SIM_PACKET_SIZE 1500
+
+// looped delivery opportunities in microseconds, the origin is the clock time the trace was started
+class NetworkTrace
+{
+public:
+	NetworkTrace() : period(0), origin(0) {}
+
+	// timestamps in ms, the last one is the period like in Mahimahi
+	NetworkTrace(std::vector<long long> timestampsMs) : period(0), origin(0)
+	{
+		if (timestampsMs.empty())
+			return;
+		std::sort(timestampsMs.begin(), timestampsMs.end());
+		period = std::max(1LL, timestampsMs.back()) * 1000;
+
+		for (auto& ts : timestampsMs)
+			ts = ts * 1000 % period;
+		std::sort(timestampsMs.begin(), timestampsMs.end());
+
+		// opportunities of the same millisecond are spread over it
+		opportunities.resize(timestampsMs.size());
+		for (size_t i = 0; i < timestampsMs.size();)
+		{
+			size_t j = i;
+			while (j < timestampsMs.size() && timestampsMs[j] == timestampsMs[i])
+				j++;
+			for (size_t k = i; k < j; k++)
+				opportunities[k] = timestampsMs[i] + (long long)(k - i) * 1000 / (long long)(j - i);
+			i = j;
+		}
+	}
+
+	bool empty() const
+	{
+		return opportunities.empty();
+	}
+
+	void restart(long long nowUs)
+	{
+		origin = nowUs;
+	}
+
+	// index of the first opportunity at or after t
+	long long indexAt(long long t) const
+	{
+		long long rel = std::max(0LL, t - origin);
+		long long round = rel / period;
+		auto it = std::lower_bound(opportunities.begin(), opportunities.end(), rel - round * period);
+		return round * (long long)opportunities.size() + (it - opportunities.begin());
+	}
+
+	long long timeOf(long long index) const
+	{
+		long long n = (long long)opportunities.size();
+		return origin + index / n * period + opportunities[index % n];
+	}
+
+	// bytes per second delivered in the window of windowUs before t
+	size_t rateAt(long long t, long long windowUs = 100000) const
+	{
+		return (size_t)((indexAt(t) - indexAt(t - windowUs)) * SIM_PACKET_SIZE * (1e6 / windowUs));
+	}
+
+private:
+	long long period;
+	long long origin;
+	std::vector<long long> opportunities;
+};
+
+// server, link and cache shared by the simulated clients of a harness
+class SimulatedNetwork
+{
+public:
+	// trace paths of /trace requests are resolved against traceDir like against the server's working directory
+	SimulatedNetwork(const std::string& wwwDir, const std::string& traceDir = ".")
+		: wwwDir(wwwDir), traceDir(traceDir), bandwidth(2000000), rttUs(0)
+		, cache(new CacheSimulator(size_t(1000) << 20, "LFUDA"))
+	{
+	}
+
+	// answers req like the server behind the proxy if viaCache is set, returns false if there is no answer
+	bool serve(const httplib::Request& req, httplib::Response& res, bool viaCache)
+	{
+		if (control(req.path, res))
+			return true;
+
+		bool isHead = req.method == "HEAD";
+		if (!isHead && req.method != "GET")
+			return false;
+
+		size_t size = 0;
+		std::string body;
+		if (!resource(req.path, size, body))
+		{
+			SimClock::advance(rttUs);
+			res.status = 404;
+			return true;
+		}
+
+		bool transfer = true;
+		if (viaCache)
+		{
+			bool hit = cache->get(req.path, size);
+			res.set_header("X-Cache", hit ? "HIT from 360cache" : "MISS from 360cache");
+			if (!hit && req.get_header_value("Cache-Control").find("only-if-cached") != std::string::npos)
+			{
+				res.status = 504;
+				return true;
+			}
+			// a HEAD miss is answered from the server's headers and stores nothing
+			if (!hit && !isHead)
+				cache->put(req.path, size);
+			transfer = !hit;
+		}
+		if (transfer)
+		{
+			// the body is timed from its first packet on like httplib times it from its first chunk
+			if (!isHead && size > SIM_PACKET_SIZE)
+			{
+				res.transfer_us = transferUs(size) - transferUs(SIM_PACKET_SIZE);
+				res.transfer_bytes = size - SIM_PACKET_SIZE;
+			}
+			SimClock::advance(transferUs(isHead ? 0 : size));
+		}
+
+		res.status = 200;
+		res.set_header("Content-Length", std::to_string(size).c_str());
+		if (!isHead)
+			res.body = body.empty() ? std::string(size, '\0') : body;
+		return true;
+	}
+
+	// microseconds the link needs for a request with an answer of bytes, starting now
+	long long transferUs(size_t bytes) const
+	{
+		long long now = SimClock::nowUs();
+		if (!trace.empty())
+		{
+			long long packets = (bytes + SIM_PACKET_SIZE - 1) / SIM_PACKET_SIZE;
+			long long first = trace.indexAt(now + rttUs);
+			return trace.timeOf(first + packets) - now;
+		}
+		return rttUs + (bandwidth > 0 ? (long long)(bytes * 1e6 / bandwidth) : 0);
+	}
+
+	// bytes per second the link delivers now
+	size_t currentBandwidth() const
+	{
+		return trace.empty() ? bandwidth : trace.rateAt(SimClock::nowUs());
+	}
+
+	CacheSimulator& cacheSimulator()
+	{
+		return *cache;
+	}
+
+private:
+	std::string wwwDir;
+	std::string traceDir;
+	size_t bandwidth;
+	long long rttUs;
+	NetworkTrace trace;
+	std::unique_ptr<CacheSimulator> cache;
+	std::unique_ptr<DASH::MPD> mpd;
+	std::unique_ptr<SegmentSizes> sizes;
+
+	// endpoints of 360server and 360cache that reconfigure the network or the cache
+	bool control(const std::string& path, httplib::Response& res)
+	{
+		static const std::regex bwPattern(R"(/bw/(\d+))"), tracePattern(R"(/trace/([^\s]+))"), rttPattern(R"(/rtt/(\d+))"),
+			resetPattern(R"(/_cache/reset/(\w+)/(\d+))"), popularityPattern(R"(/_cache/popularity(/[^\s]+))");
+
+		// file requests skip the patterns
+		if (path.size() > 4 && (path.compare(path.size() - 4, 4, ".m4s") == 0 || path.compare(path.size() - 4, 4, ".mp4") == 0))
+			return false;
+
+		std::smatch m;
+		if (std::regex_match(path, m, bwPattern))
+		{
+			bandwidth = std::stoul(m[1]);
+			trace = NetworkTrace();
+		}
+		else if (std::regex_match(path, m, tracePattern))
+		{
+			trace = loadTrace(traceDir + "/" + m[1].str());
+			trace.restart(SimClock::nowUs());
+		}
+		else if (path == "/tracereset")
+			trace.restart(SimClock::nowUs());
+		else if (std::regex_match(path, m, rttPattern))
+			rttUs = std::stoll(m[1]) * 1000;
+		else if (std::regex_match(path, m, resetPattern))
+			cache.reset(new CacheSimulator(std::stoul(m[2]) << 20, m[1]));
+		else if (std::regex_match(path, m, popularityPattern))
+			seedPopularity(m[1]);
+		else
+			return false;
+
+		res.status = 200;
+		res.body = "ok";
+		return true;
+	}
+
+	// size and, for MPDs and /cntrl, the content of a path, false if it does not exist
+	bool resource(const std::string& path, size_t& size, std::string& body)
+	{
+		if (path == "/cntrl")
+		{
+			size = currentBandwidth() / 10 + 1;
+			return true;
+		}
+
+		if (path.size() > 4 && path.compare(path.size() - 4, 4, ".mpd") == 0)
+		{
+			std::ifstream file(wwwDir + path, std::ios::binary);
+			if (!file)
+				return false;
+			std::stringstream ss;
+			ss << file.rdbuf();
+			body = ss.str();
+			size = body.size();
+			if (!mpd)
+			{
+				mpd.reset(new DASH::MPD(body));
+				sizes.reset(new SegmentSizes(mpd.get(), wwwDir));
+			}
+			return true;
+		}
+
+		if (!sizes)
+			return false;
+		size = sizes->size(path);
+		return size > 0;
+	}
+
+	void seedPopularity(const std::string& mpdPath)
+	{
+		size_t size;
+		std::string body;
+		if (!resource(mpdPath, size, body))
+			return;
+		for (auto& segment : mpd->period.segmentTilePopularity)
+			for (auto& tile : segment.second)
+				cache->setPopular(mpd->getUrl(segment.first, tile.first, tile.second));
+	}
+
+	static NetworkTrace loadTrace(const std::string& path)
+	{
+		std::ifstream file(path);
+		std::vector<long long> timestamps;
+		long long timestamp;
+		while (file >> timestamp)
+			timestamps.push_back(timestamp);
+		return NetworkTrace(std::move(timestamps));
+	}
+};
+
+// drop-in for the httplib::Client of a harness, viaCache answers like requests through 360cache
+class SimulatedClient : public httplib::Client
+{
+public:
+	SimulatedClient(std::shared_ptr<SimulatedNetwork> network, bool viaCache)
+		: httplib::Client("simulation"), network(network), viaCache(viaCache)
+	{
+	}
+
+	bool send(httplib::Request& req, httplib::Response& res) override
+	{
+		return network->serve(req, res, viaCache);
+	}
+
+	// the simulated network has no connections to pipeline on, every path is served in turn
+	size_t GetPipelined(const std::vector<std::string>& paths, size_t /*depth*/, std::function<void(size_t, const httplib::Response&)> callback) override
+	{
+		for (size_t i = 0; i < paths.size(); i++)
+		{
+			httplib::Request req;
+			req.method = "GET";
+			req.path = paths[i];
+			httplib::Response res;
+			if (!send(req, res))
+				return i;
+			callback(i, res);
+		}
+		return paths.size();
+	}
+
+private:
+	std::shared_ptr<SimulatedNetwork> network;
+	bool viaCache;
+};
@@ -0,0 +1,493 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Head rotation predictors fed with timestamped poses (ms).
+	One thread pushes, any thread may predict: every predictor
+	publishes its state through a sequence counter (seqlock),
+	so pushing never blocks and predicting does not allocate.
+	A run of poses can be pushed at once, the Euler predictors then
+	convert all of them with QuaternionBatch and publish once.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cmath>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include "Quaternion.hpp"
+#include "QuaternionBatch.hpp"
+
+class ViewportPredictor
+{
+public:
+	virtual ~ViewportPredictor() {}
+
+	// add the newest pose [single writer]
+	virtual void push(double timestamp, const IMT::Quaternion& rotation) = 0;
+
+	// add poses oldest first, as pushing them one by one would [single writer]
+	virtual void pushAll(const double* timestamps, const QuaternionBatch::Quaternions& rotations)
+	{
+		for (size_t i = 0; i < rotations.size(); i++)
+			push(timestamps[i], rotations.get(i));
+	}
+
+	// head rotation expected at timestamp, the newest pose if nothing can be predicted yet
+	virtual IMT::Quaternion predict(double timestamp) const = 0;
+
+	// forget all poses [single writer]
+	virtual void reset() = 0;
+
+	// type is one of "regression", "velocity" or "kalman", window is only used by the regression
+	static std::unique_ptr<ViewportPredictor> create(const std::string& type, size_t window);
+
+protected:
+	enum Angle { Roll, Pitch, Yaw, NumAngles };
+
+	// value of angle + 2 pi k closest to reference, keeps yaw and roll continuous across the seam
+	static double unwrap(double angle, double reference)
+	{
+		const double twoPi = 2 * 3.141592653589793238462643383279502884;
+		return angle - twoPi * std::round((angle - reference) / twoPi);
+	}
+
+	static void toAngles(const IMT::Quaternion& rotation, double angles[NumAngles])
+	{
+		auto euler = rotation.ToEuler();
+		angles[Roll] = euler.GetX();
+		angles[Pitch] = euler.GetY();
+		angles[Yaw] = euler.GetZ();
+	}
+
+	// angles of every rotation, in float and within 1e-5 rad of toAngles
+	static void toAngles(const QuaternionBatch::Quaternions& rotations, QuaternionBatch::Vectors& angles)
+	{
+		QuaternionBatch::toEuler(rotations, angles);
+	}
+
+	static IMT::Quaternion fromAngles(const double angles[NumAngles])
+	{
+		return IMT::Quaternion::FromEuler(angles[Yaw], angles[Pitch], angles[Roll]);
+	}
+
+	// n doubles written by one thread and copied consistently by the others
+	template<size_t n>
+	class SharedState
+	{
+	public:
+		SharedState() : seq(0)
+		{
+			for (auto& v : values)
+				v.store(0, std::memory_order_relaxed);
+		}
+
+		void store(const double* in)
+		{
+			auto q = seq.load(std::memory_order_relaxed);
+			seq.store(q + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			for (size_t i = 0; i < n; i++)
+				values[i].store(in[i], std::memory_order_relaxed);
+			seq.store(q + 2, std::memory_order_release);
+		}
+
+		void load(double* out) const
+		{
+			while (true)
+			{
+				auto q = seq.load(std::memory_order_acquire);
+				if (q & 1)
+					continue;
+				for (size_t i = 0; i < n; i++)
+					out[i] = values[i].load(std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if (seq.load(std::memory_order_relaxed) == q)
+					return;
+			}
+		}
+
+	private:
+		std::atomic<unsigned> seq;
+		std::atomic<double> values[n];
+	};
+};
+
+// per-axis linear regression of the Euler angles over the last window poses, sums are updated incrementally
+class RegressionPredictor : public ViewportPredictor
+{
+public:
+	RegressionPredictor(size_t window)
+		: window(window == 0 ? 1 : window), samples(this->window), count(0), next(0), pushesSinceRebase(0)
+	{
+		clearSums();
+		publish();
+	}
+
+	void push(double timestamp, const IMT::Quaternion& rotation) override
+	{
+		double angles[NumAngles];
+		toAngles(rotation, angles);
+		addPose(timestamp, angles);
+		publish();
+	}
+
+	void pushAll(const double* timestamps, const QuaternionBatch::Quaternions& rotations) override
+	{
+		toAngles(rotations, batchAngles);
+		for (size_t i = 0; i < rotations.size(); i++)
+		{
+			double angles[NumAngles] = { batchAngles.x[i], batchAngles.y[i], batchAngles.z[i] };
+			addPose(timestamps[i], angles);
+		}
+		publish();
+	}
+
+	IMT::Quaternion predict(double timestamp) const override
+	{
+		double m[numShared];
+		state.load(m);
+
+		double n = m[0], st = m[2], stt = m[3];
+		double angles[NumAngles];
+		double denominator = n * stt - st * st;
+		for (int a = 0; a < NumAngles; a++)
+		{
+			double sa = m[4 + a], sta = m[4 + NumAngles + a];
+			double slope = n > 1 && denominator != 0 ? (n * sta - st * sa) / denominator : 0;
+			double intercept = n > 0 ? (sa - slope * st) / n : 0;
+			angles[a] = (timestamp - m[1]) * slope + intercept;
+		}
+		return fromAngles(angles);
+	}
+
+	void reset() override
+	{
+		count = 0;
+		next = 0;
+		pushesSinceRebase = 0;
+		clearSums();
+		publish();
+	}
+
+private:
+	struct Sample
+	{
+		double t;
+		double a[NumAngles];
+	};
+
+	// n, origin, st, stt, sa[3], sta[3]
+	static constexpr size_t numShared = 4 + 2 * NumAngles;
+
+	// only touched by the writer
+	size_t window;
+	std::vector<Sample> samples;
+	size_t count;
+	size_t next;
+	size_t pushesSinceRebase;
+	double n, origin, st, stt, sa[NumAngles], sta[NumAngles];
+	QuaternionBatch::Vectors batchAngles;
+
+	SharedState<numShared> state;
+
+	// one pose without publishing it
+	void addPose(double timestamp, const double angles[NumAngles])
+	{
+		Sample sample;
+		sample.t = timestamp;
+		for (int a = 0; a < NumAngles; a++)
+			sample.a[a] = angles[a];
+		if (count > 0)
+		{
+			const auto& newest = samples[(next + window - 1) % window];
+			for (int a = 0; a < NumAngles; a++)
+				sample.a[a] = unwrap(sample.a[a], newest.a[a]);
+		}
+
+		if (count == window)
+			remove(samples[next]);
+		else
+			count++;
+		samples[next] = sample;
+		next = (next + 1) % window;
+		add(sample);
+
+		// the running sums drift with every subtraction, recompute them once per window
+		if (++pushesSinceRebase >= window)
+			rebase(sample.t);
+	}
+
+	void clearSums()
+	{
+		n = origin = st = stt = 0;
+		for (int a = 0; a < NumAngles; a++)
+			sa[a] = sta[a] = 0;
+	}
+
+	void add(const Sample& sample)
+	{
+		double t = sample.t - origin;
+		n += 1;
+		st += t;
+		stt += t * t;
+		for (int a = 0; a < NumAngles; a++)
+		{
+			sa[a] += sample.a[a];
+			sta[a] += t * sample.a[a];
+		}
+	}
+
+	void remove(const Sample& sample)
+	{
+		double t = sample.t - origin;
+		n -= 1;
+		st -= t;
+		stt -= t * t;
+		for (int a = 0; a < NumAngles; a++)
+		{
+			sa[a] -= sample.a[a];
+			sta[a] -= t * sample.a[a];
+		}
+	}
+
+	// sums relative to the newest timestamp keep t * t small
+	void rebase(double newOrigin)
+	{
+		clearSums();
+		origin = newOrigin;
+		for (size_t i = 0; i < count; i++)
+			add(samples[i]);
+		pushesSinceRebase = 0;
+	}
+
+	void publish()
+	{
+		double m[numShared] = { n, origin, st, stt };
+		for (int a = 0; a < NumAngles; a++)
+		{
+			m[4 + a] = sa[a];
+			m[4 + NumAngles + a] = sta[a];
+		}
+		state.store(m);
+	}
+};
+
+// rotates the newest pose further with the smoothed angular velocity, works on quaternions so there is no seam
+class VelocityPredictor : public ViewportPredictor
+{
+public:
+	// weight of the newest instantaneous velocity
+	static constexpr double smoothing = 0.3;
+
+	VelocityPredictor()
+		: last(1, 0, 0, 0), lastTimestamp(0), velocity(0, 0, 0), hasPose(false)
+	{
+		publish();
+	}
+
+	void push(double timestamp, const IMT::Quaternion& rotation) override
+	{
+		auto q = rotation / rotation.Norm();
+		if (hasPose && timestamp > lastTimestamp)
+		{
+			// rotation from the last to the newest pose, on the short way around
+			auto delta = q * last.Conj();
+			if (delta.GetW() < 0)
+				delta = -delta;
+			auto v = delta.GetV();
+			double sinHalf = v.Norm();
+			IMT::VectorCartesian instant(0, 0, 0);
+			if (sinHalf > 1e-9)
+				instant = v * (2 * std::atan2(sinHalf, delta.GetW()) / sinHalf / (timestamp - lastTimestamp));
+			velocity = instant * smoothing + velocity * (1 - smoothing);
+		}
+		last = q;
+		lastTimestamp = timestamp;
+		hasPose = true;
+		publish();
+	}
+
+	IMT::Quaternion predict(double timestamp) const override
+	{
+		double m[8];
+		state.load(m);
+		IMT::Quaternion q(m[0], m[1], m[2], m[3]);
+		IMT::VectorCartesian w(m[5], m[6], m[7]);
+
+		// more than half a turn cannot be told apart from turning back
+		double speed = w.Norm();
+		double angle = std::min(speed * std::max(0.0, timestamp - m[4]), 3.141592653589793238462643383279502884);
+		if (angle < 1e-9)
+			return q;
+		return IMT::Quaternion::QuaternionFromAngleAxis(angle, w / speed) * q;
+	}
+
+	void reset() override
+	{
+		last = IMT::Quaternion(1, 0, 0, 0);
+		lastTimestamp = 0;
+		velocity = IMT::VectorCartesian(0, 0, 0);
+		hasPose = false;
+		publish();
+	}
+
+private:
+	IMT::Quaternion last;
+	double lastTimestamp;
+	// rad per ms around the axis of the vector
+	IMT::VectorCartesian velocity;
+	bool hasPose;
+
+	// last (w, x, y, z), lastTimestamp, velocity (x, y, z)
+	SharedState<8> state;
+
+	void publish()
+	{
+		double m[8] = { last.GetW(), last.GetV().GetX(), last.GetV().GetY(), last.GetV().GetZ(), lastTimestamp,
+			velocity.GetX(), velocity.GetY(), velocity.GetZ() };
+		state.store(m);
+	}
+};
+
+// constant velocity Kalman filter per Euler angle, measurements are unwrapped against the estimate
+class KalmanPredictor : public ViewportPredictor
+{
+public:
+	// variance of the angular acceleration (rad/s^2)^2 and of a measured angle rad^2
+	static constexpr double processNoise = 4.0;
+	static constexpr double measurementNoise = 1e-4;
+
+	KalmanPredictor()
+	{
+		reset();
+	}
+
+	void push(double timestamp, const IMT::Quaternion& rotation) override
+	{
+		double z[NumAngles];
+		toAngles(rotation, z);
+		measure(timestamp, z);
+		publish();
+	}
+
+	void pushAll(const double* timestamps, const QuaternionBatch::Quaternions& rotations) override
+	{
+		toAngles(rotations, batchAngles);
+		for (size_t i = 0; i < rotations.size(); i++)
+		{
+			double z[NumAngles] = { batchAngles.x[i], batchAngles.y[i], batchAngles.z[i] };
+			measure(timestamps[i], z);
+		}
+		publish();
+	}
+
+	IMT::Quaternion predict(double timestamp) const override
+	{
+		double m[1 + 2 * NumAngles];
+		state.load(m);
+		double dt = std::max(0.0, timestamp - m[0]) / 1000.0;
+		double angles[NumAngles];
+		for (int a = 0; a < NumAngles; a++)
+			angles[a] = m[1 + a] + m[1 + NumAngles + a] * dt;
+		return fromAngles(angles);
+	}
+
+	void reset() override
+	{
+		for (int a = 0; a < NumAngles; a++)
+			filters[a] = Filter(0);
+		lastTimestamp = 0;
+		hasPose = false;
+		publish();
+	}
+
+private:
+	// state (angle, rate in rad/s) and its covariance
+	struct Filter
+	{
+		Filter(double angle = 0) : angle(angle), rate(0), p00(measurementNoise), p01(0), p11(1) {}
+
+		void predict(double dt)
+		{
+			angle += rate * dt;
+			double dt2 = dt * dt;
+			p00 += dt * (2 * p01 + dt * p11) + processNoise * dt2 * dt2 / 4;
+			p01 += dt * p11 + processNoise * dt2 * dt / 2;
+			p11 += processNoise * dt2;
+		}
+
+		void update(double measured)
+		{
+			double s = p00 + measurementNoise;
+			double k0 = p00 / s, k1 = p01 / s;
+			double residual = measured - angle;
+			angle += k0 * residual;
+			rate += k1 * residual;
+			p11 -= k1 * p01;
+			p01 -= k1 * p00;
+			p00 -= k0 * p00;
+		}
+
+		double angle, rate;
+		double p00, p01, p11;
+	};
+
+	Filter filters[NumAngles];
+	double lastTimestamp;
+	bool hasPose;
+	QuaternionBatch::Vectors batchAngles;
+
+	// lastTimestamp, angles, rates
+	SharedState<1 + 2 * NumAngles> state;
+
+	// one measurement without publishing it
+	void measure(double timestamp, const double z[NumAngles])
+	{
+		if (!hasPose)
+		{
+			for (int a = 0; a < NumAngles; a++)
+				filters[a] = Filter(z[a]);
+		}
+		else
+		{
+			double dt = std::max(0.0, timestamp - lastTimestamp) / 1000.0;
+			for (int a = 0; a < NumAngles; a++)
+			{
+				filters[a].predict(dt);
+				filters[a].update(unwrap(z[a], filters[a].angle));
+			}
+		}
+		lastTimestamp = timestamp;
+		hasPose = true;
+	}
+
+	void publish()
+	{
+		double m[1 + 2 * NumAngles];
+		m[0] = lastTimestamp;
+		for (int a = 0; a < NumAngles; a++)
+		{
+			m[1 + a] = filters[a].angle;
+			m[1 + NumAngles + a] = filters[a].rate;
+		}
+		state.store(m);
+	}
+};
+
+inline std::unique_ptr<ViewportPredictor> ViewportPredictor::create(const std::string& type, size_t window)
+{
+	if (type == "regression")
+		return std::unique_ptr<ViewportPredictor>(new RegressionPredictor(window));
+	else if (type == "velocity")
+		return std::unique_ptr<ViewportPredictor>(new VelocityPredictor());
+	else if (type == "kalman")
+		return std::unique_ptr<ViewportPredictor>(new KalmanPredictor());
+
+	throw std::invalid_argument("ViewportPredictor::create: invalid predictor type: " + type);
+}
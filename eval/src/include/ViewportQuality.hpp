@@ -0,0 +1,161 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Quality of what a viewer actually saw. For every frame of a session
+	the true head rotation from its trace projects a dense grid of
+	viewport samples onto the tiles, each sample weighted by the solid
+	angle it covers, and a tile's share of the viewport weights its
+	quality level, its bit rate and, from an optional table, the PSNR
+	of its decoded representation. The frames of a segment are averaged
+	into its values. The engine holds no state across sessions, so
+	sessions are scored in parallel.
+*/
+
+#pragma once
+
+#include <map>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+
+#include "mpd.h"
+#include "TileGrid.hpp"
+#include "HeadTrace.hpp"
+#include "ViewportProjector.hpp"
+
+class ViewportQuality
+{
+public:
+	// viewport weighted values of one segment
+	struct Metrics
+	{
+		// quality index, 0 is the best
+		double quality = 0;
+		double bitrateMbit = 0;
+		// dB, 0 without a PSNR table
+		double psnr = 0;
+	};
+
+	// (resolution + 1)^2 samples on the image plane with half extents hDist, vDist
+	ViewportQuality(const DASH::MPD* mpd, int resolution, double hDist, double vDist)
+		: numTiles(mpd->period.adaptationSets.size()), numLevels(mpd->period.adaptationSets[0].representations.size())
+		, frameRate(mpd->frameRate()), segmentDuration(mpd->segmentDuration())
+	{
+		// an MPD without frame rate is scored at 30 frames per second
+		if (!(frameRate > 0))
+			frameRate = 30;
+		grid.build(mpd);
+
+		struct Point { double x, y; };
+		std::vector<Point> points;
+		resolution = std::max(1, resolution);
+		for (int i = 0; i <= resolution; i++)
+			for (int j = 0; j <= resolution; j++)
+			{
+				Point p = { i / (double)resolution, j / (double)resolution };
+				points.push_back(p);
+
+				// a sample on the plane at distance 1 covers a solid angle proportional to 1 / (1 + u^2 + v^2)^1.5
+				double u = (p.x - 0.5) * (2 * hDist);
+				double v = (0.5 - p.y) * (2 * vDist);
+				weights.push_back(float(1 / std::pow(1 + u * u + v * v, 1.5)));
+			}
+		projector.init(points.data(), points.size(), hDist, vDist);
+
+		bitrate.assign(numTiles * numLevels, 0);
+		psnr.assign(numTiles * numLevels, 0);
+		for (int t = 0; t < numTiles; t++)
+			for (int q = 0; q < numLevels && q < (int)mpd->period.adaptationSets[t].representations.size(); q++)
+				bitrate[t * numLevels + q] = mpd->period.adaptationSets[t].representations[q].bandwidth / 1e6;
+	}
+
+	// lines of tile,quality,psnr; a tile of -1 sets the quality of every tile. False if the file could not be read
+	bool loadPsnr(const std::string& path)
+	{
+		std::ifstream in(path);
+		if (!in)
+			return false;
+		std::string line;
+		while (std::getline(in, line))
+		{
+			std::istringstream ss(line);
+			int tile, quality;
+			double value;
+			char comma;
+			if (!(ss >> tile >> comma >> quality >> comma >> value) || quality < 0 || quality >= numLevels || tile >= numTiles)
+				continue;
+			for (int t = tile < 0 ? 0 : tile; t < (tile < 0 ? numTiles : tile + 1); t++)
+				psnr[t * numLevels + quality] = value;
+		}
+		hasPsnr = true;
+		return true;
+	}
+
+	bool psnrLoaded() const
+	{
+		return hasPsnr;
+	}
+
+	// the values of every segment of a session that played qualities[s] in segment s while its viewer followed trace
+	std::vector<Metrics> session(const HeadTrace& trace, const std::vector<std::map<int, int>>& qualities, bool interpolate) const
+	{
+		// one head rotation per frame
+		size_t framesPerSegment = std::max<size_t>(1, (size_t)std::lround(segmentDuration * frameRate));
+		std::vector<double> timestamps;
+		for (size_t s = 0; s < qualities.size(); s++)
+			for (size_t f = 0; f < framesPerSegment; f++)
+				timestamps.push_back(s * segmentDuration + f / frameRate);
+		auto rotations = trace.rotationsForTimestamps(timestamps, interpolate);
+
+		std::vector<Metrics> metrics(qualities.size());
+		std::vector<float> x(weights.size()), y(weights.size());
+		std::vector<int> level(numTiles);
+		for (size_t s = 0; s < qualities.size(); s++)
+		{
+			for (int t = 0; t < numTiles; t++)
+			{
+				auto it = qualities[s].find(t);
+				level[t] = it == qualities[s].end() ? numLevels - 1 : std::min(numLevels - 1, std::max(0, it->second));
+			}
+
+			auto& m = metrics[s];
+			for (size_t f = 0; f < framesPerSegment; f++)
+			{
+				projector.project(rotations[s * framesPerSegment + f], x.data(), y.data());
+				double total = 0, quality = 0, rate = 0, db = 0;
+				for (size_t j = 0; j < weights.size(); j++)
+				{
+					int tile = grid.tileAt(x[j], y[j]);
+					int index = tile * numLevels + level[tile];
+					total += weights[j];
+					quality += weights[j] * level[tile];
+					rate += weights[j] * bitrate[index];
+					db += weights[j] * psnr[index];
+				}
+				m.quality += quality / total;
+				m.bitrateMbit += rate / total;
+				m.psnr += db / total;
+			}
+			m.quality /= framesPerSegment;
+			m.bitrateMbit /= framesPerSegment;
+			m.psnr /= framesPerSegment;
+		}
+		return metrics;
+	}
+
+private:
+	int numTiles;
+	int numLevels;
+	double frameRate;
+	double segmentDuration;
+	TileGrid grid;
+	ViewportProjector projector;
+	std::vector<float> weights;
+	// per tile and quality
+	std::vector<double> bitrate;
+	std::vector<double> psnr;
+	bool hasPsnr = false;
+};
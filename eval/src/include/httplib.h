@@ -75,6 +75,7 @@ typedef int socket_t;
 #define INVALID_SOCKET (-1)
 #endif
 
+#include <chrono>
 #include <fstream>
 #include <functional>
 #include <map>
@@ -127,7 +128,8 @@ namespace httplib
 
 	typedef std::multimap<std::string, std::string>                Params;
 	typedef std::smatch                                            Match;
-	typedef std::function<void(uint64_t current, uint64_t total)> Progress;
+	// returning false from the progress callback aborts the transfer
+	typedef std::function<bool(uint64_t current, uint64_t total)> Progress;
 
 	struct MultipartFile {
 		std::string filename;
@@ -166,6 +168,10 @@ namespace httplib
 		int         status;
 		Headers     headers;
 		std::string body;
+		// receive timing of a body with Content-Length: microseconds from its first chunk to its last and
+		// the bytes that came after the first, both 0 if it arrived in one read
+		long long   transfer_us;
+		size_t      transfer_bytes;
 
 		bool has_header(const char* key) const;
 		std::string get_header_value(const char* key) const;
@@ -175,7 +181,7 @@ namespace httplib
 		void set_content(const char* s, size_t n, const char* content_type);
 		void set_content(const std::string& s, const char* content_type);
 
-		Response() : status(-1) {}
+		Response() : status(-1), transfer_us(0), transfer_bytes(0) {}
 	};
 
 	class Stream {
@@ -306,7 +312,13 @@ namespace httplib
 		std::shared_ptr<Response> Options(const char* path);
 		std::shared_ptr<Response> Options(const char* path, const Headers& headers);
 
-		bool send(Request& req, Response& res);
+		// every request goes through send, simulated clients answer here without a socket
+		virtual bool send(Request& req, Response& res);
+
+		// GETs paths over one kept alive connection with up to depth requests sent ahead of their responses,
+		// callback gets the index of each path with its response in order; reconnects for the rest when the
+		// server closes, returns how many were answered
+		virtual size_t GetPipelined(const std::vector<std::string>& paths, size_t depth, std::function<void(size_t, const Response&)> callback);
 		
 		bool proxyServer = false;
 
@@ -845,8 +857,8 @@ namespace httplib
 
 				r += n;
 
-				if (progress) {
-					progress(r, len);
+				if (progress && !progress(r, len)) {
+					return false;
 				}
 			}
 			return true;
@@ -936,6 +948,26 @@ namespace httplib
 			return true;
 		}
 
+		// read_content of a response that stamps the chunks of its body, the time to the first
+		// one is waiting for the server and left out of transfer_us
+		inline bool read_timed_content(Stream& strm, Response& res, Progress progress = Progress())
+		{
+			std::chrono::steady_clock::time_point first;
+			uint64_t first_bytes = 0;
+			return read_content(strm, res, [&](uint64_t current, uint64_t total) {
+				auto now = std::chrono::steady_clock::now();
+				if (!first_bytes) {
+					first = now;
+					first_bytes = current;
+				}
+				else {
+					res.transfer_us = std::chrono::duration_cast<std::chrono::microseconds>(now - first).count();
+					res.transfer_bytes = current - first_bytes;
+				}
+				return !progress || progress(current, total);
+			});
+		}
+
 		template <typename T>
 		inline void write_headers(Stream& strm, const T& info)
 		{
@@ -2018,10 +2050,10 @@ namespace httplib
 			req.set_header("User-Agent", "cpp-httplib/0.2");
 		}
 
-		// TODO: Support KeepAlive connection
-		// if (!req.has_header("Connection")) {
-		req.set_header("Connection", "close");
-		// }
+		// only pipelined requests keep the connection
+		if (!req.has_header("Connection")) {
+			req.set_header("Connection", "close");
+		}
 
 		if (!req.body.empty()) {
 			if (!req.has_header("Content-Type")) {
@@ -2062,7 +2094,7 @@ namespace httplib
 
 		// Body
 		if (req.method != "HEAD") {
-			if (!detail::read_content(strm, res, req.progress)) {
+			if (!detail::read_timed_content(strm, res, req.progress)) {
 				return false;
 			}
 
@@ -2088,6 +2120,47 @@ namespace httplib
 		});
 	}
 
+	inline size_t Client::GetPipelined(const std::vector<std::string>& paths, size_t depth, std::function<void(size_t, const Response&)> callback)
+	{
+		depth = std::max<size_t>(depth, 1);
+		size_t answered = 0;
+		while (answered < paths.size()) {
+			auto sock = create_client_socket();
+			if (sock == INVALID_SOCKET) {
+				break;
+			}
+
+			SocketStream strm(sock);
+			auto before = answered;
+			auto sent = answered;
+			auto connection_close = false;
+			while (answered < paths.size() && !connection_close) {
+				for (; sent < paths.size() && sent - answered < depth; sent++) {
+					Request req;
+					req.method = "GET";
+					req.path = paths[sent];
+					req.set_header("Connection", "keep-alive");
+					write_request(strm, req);
+				}
+
+				Response res;
+				if (!read_response_line(strm, res) || !detail::read_headers(strm, res.headers) || !detail::read_timed_content(strm, res)) {
+					break;
+				}
+				connection_close = res.get_header_value("Connection") == "close" || res.version == "HTTP/1.0";
+				callback(answered, res);
+				answered++;
+			}
+			detail::close_socket(sock);
+
+			// a connection that answers nothing is not tried again
+			if (answered == before) {
+				break;
+			}
+		}
+		return answered;
+	}
+
 	inline std::shared_ptr<Response> Client::Get(const char* path, Progress progress)
 	{
 		return Get(path, Headers(), progress);
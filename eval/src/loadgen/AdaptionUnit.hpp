@@ -0,0 +1,142 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Tile quality selection of one simulated viewer of the load
+	generator. The viewport of a segment is the one the viewer's head
+	trace shows during it, so the requests follow the trace and not a
+	predictor; the quality choice is the shared upgrade loop over the
+	viewer's own throughput estimate.
+*/
+
+#pragma once
+
+#include <map>
+#include <cmath>
+#include <vector>
+#include <memory>
+#include <sstream>
+#include <algorithm>
+
+#include "Quaternion.hpp"
+#include "mpd.h"
+#include "TileGrid.hpp"
+#include "ViewportProjector.hpp"
+#include "ConfigParser.hpp"
+#include "ThroughputEstimator.hpp"
+#include "AdaptionCore.hpp"
+#include "VisibilityMatrix.hpp"
+
+#define SAMPLERES 8
+#define SAMPLEPOINTS (SAMPLERES+1)*(SAMPLERES+1)
+
+constexpr float PI = 3.141592653589793238462643383279502884L;
+
+static const double monocular_horizontal = 92.0;
+static const double monocular_vertical = 92.0;
+
+static const double maxHDist = 1.5 * std::tan(monocular_horizontal * PI / 180.0 / 2.0);
+static const double maxVDist = 1.5 * std::tan(monocular_vertical * PI / 180.0 / 2.0);
+
+using namespace IMT;
+
+class AdaptionUnit
+{
+public:
+	struct NormalizedCoordinate { double x, y; };
+
+	// safetyFactor is the share of the throughput estimate the qualities may use
+	AdaptionUnit(const DASH::MPD* mpd, double safetyFactor)
+		: mpd(mpd), core(mpd), safetyFactor(safetyFactor)
+	{
+		auto config = Config::instance();
+		estimator = ThroughputEstimator::create(config->estimator, config->estimatorWindow, config->estimatorAlpha);
+
+		tileGrid.build(mpd);
+
+		for (int i = 0; i <= SAMPLERES; i++)
+			for (int j = 0; j <= SAMPLERES; j++)
+				samplePoints[i * (SAMPLERES + 1) + j] = { i * (1.0 / SAMPLERES), j * (1.0 / SAMPLERES) };
+
+		projector.init(samplePoints, SAMPLEPOINTS, maxHDist, maxVDist);
+	}
+
+	std::map<int, int> computeTileVisibility(const Quaternion& headRotation) const
+	{
+		std::map<int, int> tileVisibilityMap;
+		float x[SAMPLEPOINTS], y[SAMPLEPOINTS];
+		projector.project(headRotation, x, y);
+		for (int j = 0; j < SAMPLEPOINTS; j++)
+			tileVisibilityMap[tileGrid.tileAt(x[j], y[j])]++;
+		return tileVisibilityMap;
+	}
+
+	// what computeTileVisibility depends on besides the tiling, part of the key of saved visibility matrices
+	std::string visibilityModel() const
+	{
+		std::ostringstream ss;
+		ss.precision(17);
+		ss << "projector " << SAMPLERES << " " << maxHDist << " " << maxVDist;
+		return ss.str();
+	}
+
+	// chooses the qualities of segment and returns its tiles in the order to request them, the most visible first
+	std::vector<int> startAdaption(int segment, const VisibilityMatrix& visibility)
+	{
+		int numQualityLevels = mpd->period.adaptationSets[0].representations.size() - 1;
+		int numTiles = mpd->period.adaptationSets.size();
+
+		// start with all tiles in lowest quality
+		std::vector<std::pair<int, int>> tileVisibility;
+		for (int i = 0; i < numTiles; i++)
+		{
+			tileQuality[i] = numQualityLevels;
+			tileVisibility.push_back(std::make_pair(visibility.count(segment, i), i));
+		}
+
+		std::vector<int> order;
+		for (auto& tv : tileVisibility)
+			order.push_back(tv.second);
+		std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return tileVisibility[a].first > tileVisibility[b].first; });
+
+		// nothing is upgraded before the first transfer was measured
+		double budget = estimator->estimate() * safetyFactor;
+		if (budget <= 0 || core.neededBandwidth(tileQuality) >= budget)
+			return order;
+
+		auto config = Config::instance();
+		bool popular = config->popularity && mpd->period.segmentTilePopularity.count(segment);
+		bool transition = core.upgrade(popular && config->transitions, true, tileVisibility, budget, numQualityLevels, tileQuality);
+		if (transition)
+			tileQuality = mpd->tilePopularity(segment);
+
+		return order;
+	}
+
+	// a tile body of bytes that took durationUs from its first to its last chunk
+	void addTransfer(size_t bytes, long long durationUs)
+	{
+		if (bytes > 0 && durationUs > 0)
+			estimator->addSample(bytes, durationUs);
+	}
+
+	double bwEstimate() const
+	{
+		return estimator->estimate();
+	}
+
+	const std::map<int, int>& getCurrentTileQuality() const
+	{
+		return tileQuality;
+	}
+
+private:
+	const DASH::MPD* mpd;
+	AdaptionCore core;
+	double safetyFactor;
+	TileGrid tileGrid;
+	ViewportProjector projector;
+	std::map<int, int> tileQuality;
+	std::unique_ptr<ThroughputEstimator> estimator;
+	NormalizedCoordinate samplePoints[SAMPLEPOINTS];
+};
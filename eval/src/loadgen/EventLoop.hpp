@@ -0,0 +1,548 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Single threaded HTTP/1.1 client for many connections at once, on
+	an epoll loop (Linux only). A connection sends its requests one
+	after another over a keep-alive socket and opens a new one when
+	the other side closes it. Bodies are counted, not kept; the
+	callback of a request gets the status, whether X-Cache reported a
+	hit and when the request was sent and its first and last body
+	bytes arrived. Timers run a callback at a point in time, so the
+	viewers wait for their buffers to drain without a thread each.
+*/
+
+#pragma once
+
+#include <map>
+#include <deque>
+#include <queue>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <cstring>
+#include <cstdlib>
+#include <functional>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+class EventLoop
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	struct Response
+	{
+		// false if the connection failed before the response was complete
+		bool ok = false;
+		int status = 0;
+		bool cacheHit = false;
+		size_t bytes = 0;
+		// body bytes that came with the first read of the body, the transfer is timed from then on
+		size_t firstBytes = 0;
+		Clock::time_point sent, firstByte, done;
+	};
+
+	typedef std::function<void(const Response&)> Callback;
+
+	// origin is put in front of every path, as a proxy like squid asks for absolute urls
+	EventLoop(const std::string& host, int port, const std::string& origin)
+		: host(host), port(port), origin(origin), epfd(epoll_create1(0)), pending(0)
+	{
+	}
+
+	~EventLoop()
+	{
+		for (auto& c : connections)
+			if (c->fd >= 0)
+				::close(c->fd);
+		if (epfd >= 0)
+			::close(epfd);
+	}
+
+	EventLoop(const EventLoop&) = delete;
+	EventLoop& operator=(const EventLoop&) = delete;
+
+	// a new connection, its socket is opened with the first request
+	size_t connection()
+	{
+		connections.emplace_back(new Connection());
+		return connections.size() - 1;
+	}
+
+	// queues a GET on connection, done is called from run once the response is complete or failed
+	void get(size_t connection, const std::string& path, Callback done)
+	{
+		auto& c = *connections[connection];
+		c.queue.push_back({ path, std::move(done) });
+		pending++;
+		if (!c.inFlight)
+			send(connection);
+	}
+
+	// runs f from run at when or as soon after as the loop gets to it
+	void at(Clock::time_point when, std::function<void()> f)
+	{
+		timers.push({ when, timerSeq++, std::move(f) });
+	}
+
+	// handles responses and timers until no request is outstanding and no timer is left
+	void run()
+	{
+		std::vector<epoll_event> events(256);
+		while (pending > 0 || !timers.empty())
+		{
+			auto now = Clock::now();
+			while (!timers.empty() && timers.top().when <= now)
+			{
+				auto f = timers.top().f;
+				timers.pop();
+				f();
+			}
+			if (pending == 0 && timers.empty())
+				break;
+
+			int timeout = 100;
+			if (!timers.empty())
+				timeout = (int)std::max<long long>(0, std::min<long long>(timeout,
+					std::chrono::duration_cast<std::chrono::milliseconds>(timers.top().when - Clock::now()).count() + 1));
+			int n = epoll_wait(epfd, events.data(), (int)events.size(), timeout);
+			if (n < 0 && errno != EINTR)
+				break;
+			for (int i = 0; i < n; i++)
+			{
+				size_t id = events[i].data.u64;
+				if (events[i].events & EPOLLOUT)
+					writable(id);
+				if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+					readable(id);
+			}
+		}
+	}
+
+	// sockets currently open
+	size_t openConnections() const
+	{
+		size_t open = 0;
+		for (auto& c : connections)
+			open += c->fd >= 0;
+		return open;
+	}
+
+private:
+	struct Request
+	{
+		std::string path;
+		Callback done;
+	};
+
+	enum class Parse { Header, Body, ChunkSize, ChunkData, ChunkEnd, Trailer, UntilClose };
+
+	struct Connection
+	{
+		int fd = -1;
+		bool connected = false;
+		// the request at the front of the queue was sent
+		bool inFlight = false;
+		std::deque<Request> queue;
+		std::string out;
+		size_t written = 0;
+		std::string in;
+		Parse state = Parse::Header;
+		size_t remaining = 0;
+		bool closeAfter = false;
+		// the request was written to a connection that had served others, the server may have closed it meanwhile
+		bool reused = false;
+		bool retried = false;
+		Response response;
+	};
+
+	struct Timer
+	{
+		Clock::time_point when;
+		unsigned long long seq;
+		std::function<void()> f;
+
+		bool operator<(const Timer& other) const
+		{
+			return when != other.when ? when > other.when : seq > other.seq;
+		}
+	};
+
+	std::string host;
+	int port;
+	std::string origin;
+	int epfd;
+	size_t pending;
+	std::vector<std::unique_ptr<Connection>> connections;
+	std::priority_queue<Timer> timers;
+	unsigned long long timerSeq = 0;
+
+	bool open(size_t id)
+	{
+		auto& c = *connections[id];
+		addrinfo hints = {};
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		addrinfo* result;
+		if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &result) != 0)
+			return false;
+
+		for (auto rp = result; rp; rp = rp->ai_next)
+		{
+			int fd = socket(rp->ai_family, rp->ai_socktype | SOCK_NONBLOCK, rp->ai_protocol);
+			if (fd < 0)
+				continue;
+			int yes = 1;
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+			if (::connect(fd, rp->ai_addr, rp->ai_addrlen) == 0 || errno == EINPROGRESS)
+			{
+				c.fd = fd;
+				break;
+			}
+			::close(fd);
+		}
+		freeaddrinfo(result);
+		if (c.fd < 0)
+			return false;
+
+		c.connected = false;
+		c.in.clear();
+		c.state = Parse::Header;
+		epoll_event ev = {};
+		ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP;
+		ev.data.u64 = id;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, c.fd, &ev);
+		return true;
+	}
+
+	void close(size_t id)
+	{
+		auto& c = *connections[id];
+		if (c.fd >= 0)
+		{
+			epoll_ctl(epfd, EPOLL_CTL_DEL, c.fd, nullptr);
+			::close(c.fd);
+		}
+		c.fd = -1;
+		c.connected = false;
+		c.in.clear();
+		c.state = Parse::Header;
+	}
+
+	// writes the request at the front of the queue, opening the socket if there is none
+	void send(size_t id)
+	{
+		auto& c = *connections[id];
+		if (c.queue.empty())
+			return;
+		c.reused = c.fd >= 0;
+		if (c.fd < 0 && !open(id))
+		{
+			fail(id);
+			return;
+		}
+
+		auto& request = c.queue.front();
+		c.out = "GET " + origin + request.path + " HTTP/1.1\r\nHost: " + host + ":" + std::to_string(port)
+			+ "\r\nAccept: */*\r\nUser-Agent: 360loadgen\r\nConnection: keep-alive\r\n\r\n";
+		c.written = 0;
+		c.inFlight = true;
+		c.response = Response();
+		c.response.sent = Clock::now();
+		c.closeAfter = false;
+		if (c.connected)
+			writable(id);
+	}
+
+	void writable(size_t id)
+	{
+		auto& c = *connections[id];
+		if (c.fd < 0)
+			return;
+		if (!c.connected)
+		{
+			int error = 0;
+			socklen_t len = sizeof(error);
+			getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &error, &len);
+			if (error != 0)
+			{
+				close(id);
+				fail(id);
+				return;
+			}
+			c.connected = true;
+		}
+
+		while (c.written < c.out.size())
+		{
+			auto n = ::send(c.fd, c.out.data() + c.written, c.out.size() - c.written, MSG_NOSIGNAL);
+			if (n < 0)
+			{
+				if (errno == EAGAIN || errno == EWOULDBLOCK)
+					break;
+				close(id);
+				retryOrFail(id);
+				return;
+			}
+			c.written += n;
+		}
+
+		// only wait for writability while something is left to write
+		epoll_event ev = {};
+		ev.events = EPOLLIN | EPOLLRDHUP | (c.written < c.out.size() ? (uint32_t)EPOLLOUT : 0u);
+		ev.data.u64 = id;
+		epoll_ctl(epfd, EPOLL_CTL_MOD, c.fd, &ev);
+	}
+
+	void readable(size_t id)
+	{
+		auto& c = *connections[id];
+		char buffer[65536];
+		while (c.fd >= 0)
+		{
+			auto n = ::recv(c.fd, buffer, sizeof(buffer), 0);
+			if (n > 0)
+			{
+				if (!consume(id, buffer, (size_t)n))
+					return;
+				continue;
+			}
+			if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+				return;
+
+			// closed by the other side
+			bool untilClose = c.state == Parse::UntilClose;
+			close(id);
+			if (untilClose)
+				complete(id);
+			else
+				retryOrFail(id);
+			return;
+		}
+	}
+
+	// parses data of the response in flight, false once the connection was closed or handed on
+	bool consume(size_t id, const char* data, size_t size)
+	{
+		auto& c = *connections[id];
+		auto& r = c.response;
+		if (c.queue.empty())
+		{
+			// nothing was asked for
+			close(id);
+			return false;
+		}
+
+		size_t pos = 0;
+		while (pos < size || (c.state == Parse::Header && !c.in.empty()))
+		{
+			switch (c.state)
+			{
+			case Parse::Header:
+			{
+				c.in.append(data + pos, size - pos);
+				pos = size;
+				auto end = c.in.find("\r\n\r\n");
+				if (end == std::string::npos)
+					return true;
+				parseHeader(c, c.in.substr(0, end));
+				std::string rest = c.in.substr(end + 4);
+				c.in.clear();
+				if (c.state == Parse::Body && c.remaining == 0)
+				{
+					if (!complete(id))
+						return false;
+					if (rest.empty())
+						return true;
+				}
+				// the rest of the read belongs to the body
+				if (!rest.empty())
+					return consume(id, rest.data(), rest.size());
+				return true;
+			}
+			case Parse::Body:
+			case Parse::UntilClose:
+			{
+				size_t n = c.state == Parse::Body ? std::min(c.remaining, size - pos) : size - pos;
+				body(r, n);
+				pos += n;
+				if (c.state == Parse::Body)
+				{
+					c.remaining -= n;
+					if (c.remaining == 0 && !complete(id))
+						return false;
+				}
+				break;
+			}
+			case Parse::ChunkSize:
+			case Parse::ChunkEnd:
+			case Parse::Trailer:
+			{
+				// line based states
+				auto eol = std::find(data + pos, data + size, '\n');
+				c.in.append(data + pos, eol);
+				pos = eol - data;
+				if (pos == size)
+					return true;
+				pos++;
+				std::string line = c.in;
+				c.in.clear();
+				if (!line.empty() && line.back() == '\r')
+					line.pop_back();
+				if (c.state == Parse::ChunkSize)
+				{
+					c.remaining = strtoul(line.c_str(), nullptr, 16);
+					c.state = c.remaining == 0 ? Parse::Trailer : Parse::ChunkData;
+				}
+				else if (c.state == Parse::ChunkEnd)
+					c.state = Parse::ChunkSize;
+				else if (line.empty() && !complete(id))
+					return false;
+				break;
+			}
+			case Parse::ChunkData:
+			{
+				size_t n = std::min(c.remaining, size - pos);
+				body(r, n);
+				pos += n;
+				c.remaining -= n;
+				if (c.remaining == 0)
+					c.state = Parse::ChunkEnd;
+				break;
+			}
+			}
+		}
+		return true;
+	}
+
+	void parseHeader(Connection& c, const std::string& header)
+	{
+		auto& r = c.response;
+		r.status = 0;
+		auto space = header.find(' ');
+		if (space != std::string::npos)
+			r.status = atoi(header.c_str() + space + 1);
+
+		bool chunked = false, hasLength = false;
+		size_t length = 0;
+		size_t lineStart = header.find("\r\n");
+		while (lineStart != std::string::npos)
+		{
+			lineStart += 2;
+			auto lineEnd = header.find("\r\n", lineStart);
+			std::string line = header.substr(lineStart, lineEnd == std::string::npos ? std::string::npos : lineEnd - lineStart);
+			auto colon = line.find(':');
+			if (colon != std::string::npos)
+			{
+				std::string name = line.substr(0, colon);
+				auto valueStart = line.find_first_not_of(' ', colon + 1);
+				std::string value = valueStart == std::string::npos ? "" : line.substr(valueStart);
+				if (strcasecmp(name.c_str(), "Content-Length") == 0)
+				{
+					hasLength = true;
+					length = strtoull(value.c_str(), nullptr, 10);
+				}
+				else if (strcasecmp(name.c_str(), "Transfer-Encoding") == 0)
+					chunked = strcasecmp(value.c_str(), "chunked") == 0;
+				else if (strcasecmp(name.c_str(), "X-Cache") == 0)
+					r.cacheHit = value.compare(0, 3, "HIT") == 0;
+				else if (strcasecmp(name.c_str(), "Connection") == 0)
+					c.closeAfter = strcasecmp(value.c_str(), "close") == 0;
+			}
+			lineStart = lineEnd;
+		}
+
+		if (chunked)
+			c.state = Parse::ChunkSize;
+		else if (hasLength)
+		{
+			c.state = Parse::Body;
+			c.remaining = length;
+		}
+		else
+			c.state = Parse::UntilClose;
+	}
+
+	static void body(Response& r, size_t n)
+	{
+		if (n == 0)
+			return;
+		auto now = Clock::now();
+		if (r.bytes == 0)
+		{
+			r.firstByte = now;
+			r.firstBytes = n;
+		}
+		r.bytes += n;
+		r.done = now;
+	}
+
+	// hands the response to its callback and sends the next request, false if the connection was closed
+	bool complete(size_t id)
+	{
+		auto& c = *connections[id];
+		auto request = std::move(c.queue.front());
+		c.queue.pop_front();
+		pending--;
+		auto response = c.response;
+		response.ok = true;
+		if (response.bytes == 0)
+			response.firstByte = response.done = Clock::now();
+		c.state = Parse::Header;
+		c.retried = false;
+		c.inFlight = false;
+
+		bool keep = c.fd >= 0 && !c.closeAfter;
+		if (!keep)
+			close(id);
+		request.done(response);
+		// the callback may have sent the next request already
+		auto& after = *connections[id];
+		if (!after.inFlight && !after.queue.empty())
+			send(id);
+		return keep && after.fd >= 0;
+	}
+
+	// a keep-alive connection the server closed before answering is retried once on a new one
+	void retryOrFail(size_t id)
+	{
+		auto& c = *connections[id];
+		if (c.reused && !c.retried && c.response.bytes == 0)
+		{
+			c.retried = true;
+			send(id);
+			return;
+		}
+		fail(id);
+	}
+
+	void fail(size_t id)
+	{
+		auto& c = *connections[id];
+		if (c.queue.empty())
+			return;
+		auto request = std::move(c.queue.front());
+		c.queue.pop_front();
+		pending--;
+		c.retried = false;
+		c.inFlight = false;
+		auto response = c.response;
+		response.ok = false;
+		response.done = Clock::now();
+		request.done(response);
+		auto& after = *connections[id];
+		if (!after.inFlight && !after.queue.empty())
+			send(id);
+	}
+};
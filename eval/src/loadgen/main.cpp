@@ -0,0 +1,363 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Load generator: many simulated viewers in one process play the
+	video against the server or the cache at once, each replaying a
+	head trace with its own adaption state and throughput estimate.
+	For each number of viewers a step starts them over rampUp seconds
+	and writes the aggregate throughput, the request latency, the hit
+	ratios of the cache and the stall rates of the viewers to the csv.
+*/
+
+#include "mpd.h"
+#include "httplib.h"
+#include "HeadTrace.hpp"
+#include "VisibilityMatrix.hpp"
+#include "ExperimentRunner.hpp"
+#include "ConfigParser.hpp"
+#include "IniReader.hpp"
+#include "AdaptionUnit.hpp"
+#include "EventLoop.hpp"
+#include <sys/resource.h>
+#include <random>
+#include <numeric>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+
+Config* Config::_instance = 0;
+
+typedef EventLoop::Clock Clock;
+
+static double seconds(Clock::duration d)
+{
+	return std::chrono::duration<double>(d).count();
+}
+
+// value below which share p of the sorted values lie
+static double percentile(std::vector<double>& values, double p)
+{
+	if (values.empty())
+		return 0;
+	std::sort(values.begin(), values.end());
+	size_t i = std::min(values.size() - 1, (size_t)std::ceil(p * values.size()) - (p > 0 ? 1 : 0));
+	return values[i];
+}
+
+struct Settings
+{
+	std::vector<int> viewers;
+	int segments;
+	double rampUp;
+	int connections;
+	double bufferSeconds;
+	double safetyFactor;
+	std::string cacheReset;
+	std::string origin;
+	std::string csv;
+};
+
+struct Totals
+{
+	size_t requests = 0;
+	size_t errors = 0;
+	size_t hits = 0;
+	size_t bytes = 0;
+	size_t hitBytes = 0;
+	// ms from sending a request to its last byte
+	std::vector<double> latencies;
+};
+
+struct Viewer
+{
+	std::unique_ptr<AdaptionUnit> au;
+	std::shared_ptr<const VisibilityMatrix> visibility;
+	std::vector<size_t> connections;
+	int segment = 0;
+	int pending = 0;
+	bool playing = false;
+	Clock::time_point joined, playStart;
+	// seconds the playback waited for segments after it started
+	double stalled = 0;
+	double startupMs = 0;
+	bool finished = false;
+};
+
+class LoadStep
+{
+public:
+	LoadStep(const DASH::MPD* mpd, const Settings& settings, const std::vector<std::shared_ptr<const VisibilityMatrix>>& visibilities, int numViewers)
+		: mpd(mpd), settings(settings), loop(Config::instance()->squidAddress, Config::instance()->squidPort, settings.origin)
+		, numTiles(mpd->period.adaptationSets.size()), segDuration(mpd->segmentDuration())
+	{
+		numSegments = settings.segments > 0 ? std::min<int>(settings.segments, mpd->numSegments()) : mpd->numSegments();
+		viewers.resize(numViewers);
+		for (int i = 0; i < numViewers; i++)
+		{
+			auto& v = viewers[i];
+			v.au.reset(new AdaptionUnit(mpd, settings.safetyFactor));
+			v.visibility = visibilities[i % visibilities.size()];
+			for (int c = 0; c < settings.connections; c++)
+				v.connections.push_back(loop.connection());
+		}
+	}
+
+	// plays all viewers to the end and returns the csv row of the step
+	std::string run()
+	{
+		auto start = Clock::now();
+		for (size_t i = 0; i < viewers.size(); i++)
+		{
+			auto when = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(settings.rampUp * i / viewers.size()));
+			loop.at(when, [this, i]() { join(i); });
+		}
+		loop.run();
+		double duration = seconds(Clock::now() - start);
+
+		std::vector<double> stallRates, startups;
+		int stalling = 0;
+		for (auto& v : viewers)
+		{
+			if (!v.finished)
+				continue;
+			double rate = v.stalled / (v.stalled + numSegments * segDuration);
+			stallRates.push_back(rate);
+			startups.push_back(v.startupMs);
+			stalling += v.stalled > 0;
+		}
+		double meanStall = stallRates.empty() ? 0 : std::accumulate(stallRates.begin(), stallRates.end(), 0.0) / stallRates.size();
+		double meanStartup = startups.empty() ? 0 : std::accumulate(startups.begin(), startups.end(), 0.0) / startups.size();
+		size_t answered = totals.requests - totals.errors;
+
+		std::ostringstream row;
+		row << viewers.size() << "," << duration << "," << totals.bytes * 8 / duration / 1e6 << "," << totals.requests << "," << totals.errors
+			<< "," << percentile(totals.latencies, 0.5) << "," << percentile(totals.latencies, 0.95) << "," << percentile(totals.latencies, 0.99)
+			<< "," << (answered ? totals.hits / (double)answered : 0) << "," << (totals.bytes ? totals.hitBytes / (double)totals.bytes : 0)
+			<< "," << meanStall << "," << percentile(stallRates, 0.95) << "," << stalling << "," << viewers.size() - stallRates.size()
+			<< "," << meanStartup;
+		return row.str();
+	}
+
+	static const char* header()
+	{
+		return "Viewers,Duration (s),Throughput (Mbit/s),Requests,Errors,Latency p50 (ms),Latency p95 (ms),Latency p99 (ms),"
+			"Hit Ratio,Byte Hit Ratio,Mean Stall Rate,Stall Rate p95,Stalling Viewers,Failed Viewers,Mean Startup (ms)";
+	}
+
+private:
+	const DASH::MPD* mpd;
+	const Settings& settings;
+	EventLoop loop;
+	int numTiles;
+	int numSegments;
+	double segDuration;
+	std::vector<Viewer> viewers;
+	Totals totals;
+
+	// the init segments of every tile, then the first segment
+	void join(size_t i)
+	{
+		auto& v = viewers[i];
+		v.joined = Clock::now();
+		v.pending = numTiles;
+		for (int t = 0; t < numTiles; t++)
+			loop.get(v.connections[t % v.connections.size()], mpd->getInitUrl(t), [this, i](const EventLoop::Response& res) {
+				auto& v = viewers[i];
+				if (!record(v, res, false))
+					return;
+				if (--v.pending == 0)
+					request(i);
+			});
+	}
+
+	void request(size_t i)
+	{
+		auto& v = viewers[i];
+		auto order = v.au->startAdaption(v.segment, *v.visibility);
+		auto& quality = v.au->getCurrentTileQuality();
+		v.pending = numTiles;
+		for (size_t k = 0; k < order.size(); k++)
+		{
+			int t = order[k];
+			loop.get(v.connections[k % v.connections.size()], mpd->getUrl(v.segment, t, quality.at(t)), [this, i](const EventLoop::Response& res) {
+				auto& v = viewers[i];
+				if (!record(v, res, true))
+					return;
+				if (--v.pending == 0)
+					downloaded(i);
+			});
+		}
+	}
+
+	// the segment of viewer i is complete: playback starts or it was late, the next one is requested once the buffer runs low
+	void downloaded(size_t i)
+	{
+		auto& v = viewers[i];
+		auto now = Clock::now();
+		if (!v.playing)
+		{
+			v.playing = true;
+			v.playStart = now;
+			v.startupMs = seconds(now - v.joined) * 1000;
+		}
+		else
+		{
+			double due = v.segment * segDuration + v.stalled;
+			double late = seconds(now - v.playStart) - due;
+			if (late > 0)
+				v.stalled += late;
+		}
+
+		if (++v.segment >= numSegments)
+		{
+			v.finished = true;
+			return;
+		}
+
+		// playback reaches the end of the buffered segments at bufferEnd
+		double bufferEnd = v.segment * segDuration + v.stalled;
+		double wait = bufferEnd - settings.bufferSeconds - seconds(now - v.playStart);
+		if (wait <= 0)
+			request(i);
+		else
+			loop.at(now + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(wait)), [this, i]() { request(i); });
+	}
+
+	// counts a response, false if it failed and the viewer gives up
+	bool record(Viewer& v, const EventLoop::Response& res, bool tile)
+	{
+		totals.requests++;
+		if (!res.ok || res.status != 200)
+		{
+			totals.errors++;
+			v.pending = -1;
+			return false;
+		}
+		if (v.pending < 0)
+			return false;
+
+		totals.bytes += res.bytes;
+		if (res.cacheHit)
+		{
+			totals.hits++;
+			totals.hitBytes += res.bytes;
+		}
+		totals.latencies.push_back(seconds(res.done - res.sent) * 1000);
+
+		// the body after its first chunk over the time to its last chunk, a body that arrived in one read counts whole with the duration of its request
+		if (tile)
+		{
+			auto transferUs = std::chrono::duration_cast<std::chrono::microseconds>(res.done - res.firstByte).count();
+			if (transferUs > 0 && res.bytes > res.firstBytes)
+				v.au->addTransfer(res.bytes - res.firstBytes, transferUs);
+			else
+				v.au->addTransfer(res.bytes, std::chrono::duration_cast<std::chrono::microseconds>(res.done - res.sent).count());
+		}
+		return true;
+	}
+};
+
+static std::vector<int> parseList(const std::string& list)
+{
+	std::vector<int> values;
+	std::istringstream ss(list);
+	std::string value;
+	while (std::getline(ss, value, ','))
+		if (!value.empty())
+			values.push_back(std::stoi(value));
+	return values;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc != 2)
+	{
+		std::cout << "Usage: " << argv[0] << " pathToConfig" << std::endl;
+		return -1;
+	}
+
+	auto config = Config::instance();
+	config->init(argv[1]);
+
+	INIReader ini(argv[1]);
+	Settings settings;
+	settings.viewers = parseList(ini.Get("Loadgen", "viewers", "10,50,100,200"));
+	settings.segments = ini.GetInteger("Loadgen", "segments", 0);
+	settings.rampUp = ini.GetReal("Loadgen", "rampUp", 10);
+	settings.connections = std::max(1, (int)ini.GetInteger("Loadgen", "connections", 2));
+	settings.bufferSeconds = ini.GetReal("Loadgen", "bufferSeconds", 2.0);
+	settings.safetyFactor = ini.GetReal("Loadgen", "safetyFactor", 0.75);
+	settings.cacheReset = ini.Get("Loadgen", "cacheReset", "");
+	settings.origin = ini.Get("Loadgen", "origin", "http://[::1]");
+	settings.csv = ini.Get("Loadgen", "csv", "loadgen.csv");
+
+	httplib::Client httpClient(config->squidAddress.c_str(), config->squidPort);
+	httpClient.proxyServer = !settings.origin.empty();
+
+	auto mpdContent = fetchMpd(httpClient, config->mpdUri);
+	if (mpdContent.empty())
+	{
+		std::cout << "MPD not found" << std::endl;
+		return -1;
+	}
+	DASH::MPD mpd(mpdContent);
+	int numTiles = mpd.period.adaptationSets.size();
+
+	// every viewer holds one socket per connection
+	int mostViewers = *std::max_element(settings.viewers.begin(), settings.viewers.end());
+	rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < (rlim_t)mostViewers * settings.connections + 64)
+		std::cout << "Open file limit " << limit.rlim_cur << " is below " << mostViewers * settings.connections + 64 << ", raise it with ulimit -n" << std::endl;
+
+	// the visible samples of segment s, from timestamps every 0.25 s inside it
+	double segDuration = mpd.segmentDuration();
+	std::vector<double> timestamps;
+	std::vector<size_t> segmentSamples;
+	for (size_t s = 0; s < mpd.numSegments(); s++)
+	{
+		segmentSamples.push_back(timestamps.size());
+		for (double ts = segDuration * s; ts < segDuration * (s + 1); ts += 0.25)
+			timestamps.push_back(ts);
+	}
+	segmentSamples.push_back(timestamps.size());
+
+	// viewers beyond the number of traces replay them again
+	std::mt19937 rng(config->seed);
+	auto traces = tracePermutation<std::string>(config->headtracePath, mostViewers, rng);
+	if (traces.empty())
+	{
+		std::cout << "No head traces in " << config->headtracePath << std::endl;
+		return -1;
+	}
+	AdaptionUnit au(&mpd, settings.safetyFactor);
+	std::vector<std::shared_ptr<const VisibilityMatrix>> visibilities;
+	for (auto& trace : traces)
+	{
+		HeadTrace headTrace(trace.c_str());
+		auto rotations = headTrace.rotationsForTimestamps(timestamps, config->interpolateHeadtrace);
+		visibilities.push_back(VisibilityMatrix::get(config->visibilityCache, VisibilityMatrix::key(&mpd, au.visibilityModel(), segmentSamples, rotations),
+			numTiles, segmentSamples, rotations, [&](const Quaternion& q) { return au.computeTileVisibility(q); }));
+	}
+
+	std::ofstream csv(settings.csv);
+	csv << LoadStep::header() << "\n";
+	std::cout << LoadStep::header() << std::endl;
+	for (int viewers : settings.viewers)
+	{
+		// each step starts from an empty cache, e.g. cacheReset=LFUDA/1000
+		if (!settings.cacheReset.empty())
+		{
+			auto reset = httpClient.Get(("/_cache/reset/" + settings.cacheReset).c_str());
+			if (!reset || reset->status != 200)
+				std::cout << "Cache reset failed " << (reset ? reset->status : 0) << std::endl;
+		}
+
+		LoadStep step(&mpd, settings, visibilities, viewers);
+		auto row = step.run();
+		csv << row << "\n" << std::flush;
+		std::cout << row << std::endl;
+	}
+
+	return 0;
+}
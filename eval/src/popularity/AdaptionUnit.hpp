@@ -10,19 +10,24 @@
 #include <deque>
 #include <numeric>
 #include <algorithm>
+#include <sstream>
 #include <string>
 #include <map>
 
 #include "Quaternion.hpp"
 #include "mpd.h"
+#include "Log.hpp"
+#include "TileGrid.hpp"
+#include "ViewportProjector.hpp"
 #include "httplib.h"
+#include "AdaptionCore.hpp"
 
 #define TIME_NOW_EPOCH_MS std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count()
 #define SAMPLERES 8
 #define SAMPLEPOINTS (SAMPLERES+1)*(SAMPLERES+1)
 
 #define TIMER auto ttt = TIME_NOW_EPOCH_MS
-#define TIMEROUT(s) auto ttt2 = TIME_NOW_EPOCH_MS; std::cout << s << " TIMER: " << ttt2 - ttt << std::endl
+#define TIMEROUT(s) auto ttt2 = TIME_NOW_EPOCH_MS; LOG_INFO(s << " TIMER: " << ttt2 - ttt)
 
  float PI = 3.141592653589793238462643383279502884L;
 
@@ -40,26 +45,15 @@ public:
 	struct NormalizedCoordinate { double x, y; };
 
 	AdaptionUnit(const DASH::MPD* mpd, httplib::Client* httpClient)
-		: mpd(mpd), httpClient(httpClient)
+		: mpd(mpd), core(mpd), httpClient(httpClient)
 	{
-		auto srd = mpd->period.adaptationSets[0].srd;
-
-		int frameWidth = srd.w * srd.th;
-		int frameHeight = srd.h * srd.tv;
-
-		for (int i = 0; i < mpd->period.adaptationSets.size(); i++)
-		{
-			srd = mpd->period.adaptationSets[i].srd;
-
-			double normalizedCoordX = (srd.x + srd.w) / (double)frameWidth;
-			double normalizedCoordY = (srd.y + srd.h) / (double)frameHeight;
-
-			normalizedCoordTileMapping[normalizedCoordX][normalizedCoordY] = i;
-		}
+		tileGrid.build(mpd);
 
 		for (int i = 0; i <= SAMPLERES; i++)
 			for (int j = 0; j <= SAMPLERES; j++)
 				samplePoints[i * (SAMPLERES + 1) + j] = { i * (1.0 / SAMPLERES), j * (1.0 / SAMPLERES) };
+
+		projector.init(samplePoints, SAMPLEPOINTS, maxHDist, maxVDist);
 	}
 
 
@@ -89,31 +83,11 @@ public:
 
 	
 		
-		if (bandwidthNeededForTileQualityMap(tileQuality) < bandwidthEstimate * .75)
+		if (core.neededBandwidth(tileQuality) < bandwidthEstimate * .75)
 		{
 			auto tileVisibility = computeTileVisibility(headRotations);
 
-			auto highestPriorityTile = std::max_element(tileVisibility.begin(), tileVisibility.end(), [](auto p1, auto p2) { return p1.first < p2.first; });
-			auto maxVisibility =highestPriorityTile->first;
-			auto visibilityPerQualityLevel = int(maxVisibility / (double)numQualityLevels);
-
-			while (highestPriorityTile->first != 0)
-			{
-				// enhance quality of highest priority tile
-				tileQuality.at(highestPriorityTile->second) = std::max(0, tileQuality.at(highestPriorityTile->second) - 1);
-
-				// trigger transition if too much bandwidth is needed
-				if (bandwidthNeededForTileQualityMap(tileQuality) > bandwidthEstimate * .75)
-				{
-					break;
-				}
-
-				// decrease visibility so highest priority tile differs after resort
-				highestPriorityTile->first = std::max(0, highestPriorityTile->first - visibilityPerQualityLevel);
-
-				// get most visible tile
-				highestPriorityTile = std::max_element(tileVisibility.begin(), tileVisibility.end(), [](auto p1, auto p2) { return p1.first < p2.first; });
-			}
+			core.upgrade<AdaptionPolicy::NoTransition, AdaptionPolicy::StopAtBudget>(tileVisibility, bandwidthEstimate * .75, numQualityLevels, tileQuality);
 		}
 	}
 
@@ -126,12 +100,20 @@ public:
 	{
 		std::map<int, int> tileVisibilityMap;
 
-		for (int j = 0; j < SAMPLEPOINTS; j++)
-			tileVisibilityMap[mapCoordToTile(fromViewportCoordToEquirectCoord(headRotation, samplePoints[j]))]++;
+		addVisibleSamples(headRotation, tileVisibilityMap);
 
 		return tileVisibilityMap;
 	}
 
+	// what computeTileVisibility depends on besides the tiling, part of the key of saved visibility matrices
+	std::string visibilityModel() const
+	{
+		std::ostringstream ss;
+		ss.precision(17);
+		ss << "projector " << SAMPLERES << " " << maxHDist << " " << maxVDist;
+		return ss.str();
+	}
+
 	auto download(int tile, int segment)
 	{
 		auto res = httpClient->Get(mpd->getUrl(segment, tile, tileQuality[tile]).c_str());
@@ -153,7 +135,7 @@ public:
 	{
 		tileQuality = mpd->tilePopularity(segment);
 
-		for (int i = 0; i < 16; i++)
+		for (int i = 0; i < mpd->period.adaptationSets.size(); i++)
 			download(i, segment);
 	}
 
@@ -161,7 +143,7 @@ public:
 	{
 		tileQuality = qualities;
 
-		for (int i = 0; i < 16; i++)
+		for (int i = 0; i < mpd->period.adaptationSets.size(); i++)
 			download(i, segment);
 
 	}
@@ -186,8 +168,10 @@ public:
 
 private:
 	const DASH::MPD* mpd;
+	AdaptionCore core;
 	httplib::Client* httpClient;
-	std::map<double, std::map<double, int>> normalizedCoordTileMapping;
+	TileGrid tileGrid;
+	ViewportProjector projector;
 	std::map<int, int> tileQuality;
 	NormalizedCoordinate samplePoints[SAMPLEPOINTS];
 	int cacheHits = 0;
@@ -195,14 +179,6 @@ private:
 	size_t cacheHitBytesDownloaded = 0;
 	size_t totalBytesDownloaded = 0;
 
-	size_t bandwidthNeededForTileQualityMap(const std::map<int, int>& tileQualityMap)
-	{
-		size_t neededBandwidth = 0;
-		for (int i = 0; i < mpd->period.adaptationSets.size(); i++)
-			neededBandwidth += mpd->period.adaptationSets[i].representations[tileQualityMap.at(i)].bandwidth;
-		return neededBandwidth / 8;
-	}
-
 	std::function<double(double)> computeRegressionFunction(const std::vector<double>& x, const std::vector<double>& y) const
 	{
 		const auto n = x.size();
@@ -222,8 +198,7 @@ private:
 		if (headRotations.size() == 1)
 		{
 			// find visible tiles depending on head position
-			for (int j = 0; j < SAMPLEPOINTS; j++)
-				tileVisibilityMap[mapCoordToTile(fromViewportCoordToEquirectCoord(headRotations[0].second, samplePoints[j]))]++;
+			addVisibleSamples(headRotations[0].second, tileVisibilityMap);
 		}
 		else
 		{
@@ -257,8 +232,7 @@ private:
 				auto rot = Quaternion::FromEuler(funRegressionYaw(ts), funRegressionPitch(ts), funRegressionRoll(ts));
 
 				// find visible tiles depending on head position
-				for (int j = 0; j < SAMPLEPOINTS; j++)
-					tileVisibilityMap[mapCoordToTile(fromViewportCoordToEquirectCoord(rot, samplePoints[j]))]++;
+				addVisibleSamples(rot, tileVisibilityMap);
 			}
 		}
 
@@ -270,9 +244,18 @@ private:
 		return tileVisibility;
 	}
 
+	// count the viewport sample points falling into each tile
+	void addVisibleSamples(const Quaternion& headRotation, std::map<int, int>& tileVisibilityMap) const
+	{
+		float x[SAMPLEPOINTS], y[SAMPLEPOINTS];
+		projector.project(headRotation, x, y);
+		for (int j = 0; j < SAMPLEPOINTS; j++)
+			tileVisibilityMap[tileGrid.tileAt(x[j], y[j])]++;
+	}
+
 	int mapCoordToTile(NormalizedCoordinate coord) const
 	{
-		return normalizedCoordTileMapping.lower_bound(coord.x)->second.lower_bound(coord.y)->second;
+		return tileGrid.tileAt(coord.x, coord.y);
 	}
 
 	static NormalizedCoordinate fromViewportCoordToEquirectCoord(const Quaternion& headRotation, const NormalizedCoordinate& viewportCoord)
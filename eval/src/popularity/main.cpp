@@ -5,8 +5,11 @@
 #include "mpd.h"
 #include "httplib.h"
 #include "HeadTrace.hpp"
+#include "VisibilityMatrix.hpp"
+#include "ExperimentRunner.hpp"
 #include "CircularBuffer.hpp"
 #include "AdaptionUnit.hpp"
+#include "CacheWarmer.hpp"
 #include <experimental/filesystem>
 #include "IniReader.hpp"
 #include <random>
@@ -18,10 +21,22 @@
 namespace fs = std::experimental::filesystem;
 
 std::string pathHeadtraces;
+// head rotations between two samples are slerped
+bool interpolateHeadtraces;
+// folder of saved visibility matrices, none are saved without
+std::string visibilityCache;
+// warms the cache with every distinct url once, by expected hits per byte over pipelined connections,
+// instead of each trace's requests in turn
+bool dedupWarmup;
+std::vector<httplib::Client*> warmupClients;
+int warmupDepth;
+double warmupRate;
 httplib::Client* httpClient;
 DASH::MPD* mpd;
 int numTiles;
 AdaptionUnit* au;
+// draws the head traces, seeded from the config
+std::mt19937 rng;
 
 #ifdef _WIN32
 typedef std::wstring pathType;
@@ -40,35 +55,16 @@ void resetSquidCache()
 	system("sudo service squid start");
 }
 
-std::vector<pathType> tracePermutation(int numTraces)
-{
-	std::vector<pathType> traces;
-
-	auto dirIt = fs::directory_iterator(pathHeadtraces);
-	auto dirItBegin = fs::begin(dirIt);
-	auto dirItEnd = fs::end(dirIt);
-	auto numFiles = std::distance(dirItBegin, dirItEnd);
-	
-	std::set<int> traceIndices;
-	for (int i = 0; i < numTraces; i++)
-		while (!traceIndices.insert(std::rand()%numFiles).second);
-	
-	int fi = 0;
-	for (auto& f : fs::directory_iterator(pathHeadtraces))
-	{
-		if (traceIndices.find(fi) != traceIndices.end())
-			traces.push_back(f.path());
-		fi++;
-	}
-	
-	return traces;
-}
-
 void initCache(const std::vector<pathType>& traces)
 {
+	CacheWarmer warmer;
+
 	// download init files
 	for (int i = 0; i < numTiles; i++)
-		auto initRes = httpClient->Get((mpd->getInitUrl(i)).c_str());
+		if (dedupWarmup)
+			warmer.add(mpd->getInitUrl(i), traces.size(), 0);
+		else
+			auto initRes = httpClient->Get((mpd->getInitUrl(i)).c_str());
 
 	double vidDurationMs = mpd->mediaPresentationDuration.count();
 	double segDurationS = mpd->segmentDuration();
@@ -78,31 +74,34 @@ void initCache(const std::vector<pathType>& traces)
 	std::map<int, std::map<int, double>> tileVisibility;
 	int i = 0;
 
+	// a couple of timestamps inside each segment, those of segment s start at segmentSamples[s]
+	std::vector<double> timestamps;
+	std::vector<size_t> segmentSamples;
+	for (int s = 0; s < numSegments; s++)
+	{
+		segmentSamples.push_back(timestamps.size());
+		double segStart = segDurationS * s;
+		for (double ts = segStart; ts < segStart + segDurationS; ts += 0.25)
+			timestamps.push_back(ts);
+	}
+	segmentSamples.push_back(timestamps.size());
+
 	for (auto trace : traces)
 	{
 		// parse trace file
 		HeadTrace headTrace(trace.c_str());
+		auto headRotations = headTrace.rotationsForTimestamps(timestamps, interpolateHeadtraces);
+		// visible samples per segment and tile, saved once per trace, video and tiling
+		auto visibility = VisibilityMatrix::get(visibilityCache, VisibilityMatrix::key(mpd, au->visibilityModel(), segmentSamples, headRotations),
+			numTiles, segmentSamples, headRotations, [&](const Quaternion& q) { return au->computeTileVisibility(q); });
 
 		// iterate over temporal segments
 		for (int s = 0; s < numSegments; s++)
 		{
-			double segStart = segDurationS * s;
+			// tiles no sample fell into count as 1
 			std::map<int, int> segTileVisibility;
-
-			// iterate over a couple of timestamps inside each segment
-			for (double ts = segStart; ts < segStart + segDurationS; ts += 0.25)
-			{
-				auto headRot = headTrace.rotationForTimestamp(ts);
-				// compute tile visibility for head rotation at given timestamp
-				auto tv = au->computeTileVisibility(headRot);
-
-				for (auto it = tv.begin(); it != tv.end(); it++)
-					segTileVisibility[it->first] += it->second;
-			}
-
 			for (int t = 0; t < numTiles; t++)
-				if (segTileVisibility.find(t) == segTileVisibility.end())
-					segTileVisibility[t] = 1;
+				segTileVisibility[t] = std::max(1, visibility->count(s, t));
 
 			// add segment tile visibility from this headtrace to overall visibility
 			for (auto it = segTileVisibility.begin(); it != segTileVisibility.end(); it++)
@@ -113,7 +112,10 @@ void initCache(const std::vector<pathType>& traces)
 			for (auto it = segTileVisibility.begin(); it != segTileVisibility.end(); it++)
 			{
 				it->second = (int)(numQualityLevels - (numQualityLevels * (it->second / max)));
-				httpClient->Get((mpd->getUrl(s, it->first, it->second)).c_str());
+				if (dedupWarmup)
+					warmer.add(mpd->getUrl(s, it->first, it->second), 1, CacheWarmer::segmentBytes(mpd, it->first, it->second));
+				else
+					httpClient->Get((mpd->getUrl(s, it->first, it->second)).c_str());
 			}
 		}
 
@@ -121,6 +123,11 @@ void initCache(const std::vector<pathType>& traces)
 	}
 
 	std::cout << std::endl;
+	if (dedupWarmup)
+	{
+		auto result = warmer.run(warmupClients, warmupDepth, warmupRate);
+		std::cout << result.requests << " warm-up requests, " << result.failed << " failed" << std::endl;
+	}
 }
 
 void downloadPopularTiles()
@@ -175,7 +182,7 @@ void downloadTrace(std::string pathToTrace)
 	}
 	au->stopAdaption();
 
-	int numSegments = mpd->period.adaptationSets[0].representations[0].segmentList.segmentUrls.size();
+	int numSegments = mpd->numSegments();
 	double frameRate = mpd->frameRate();
 	double segmentDuration = mpd->segmentDuration();
 	double segmentFrames = segmentDuration * frameRate;
@@ -231,7 +238,14 @@ int main(int argc, char* argv[])
 	
 	// parse config
 	INIReader ini(argv[1]);
+	rng.seed(ini.GetInteger("Config", "seed", 0));
 	pathHeadtraces = ini.Get("Config", "pathHeadtraces", "");
+	interpolateHeadtraces = ini.GetBoolean("Config", "interpolateHeadtraces", false);
+	visibilityCache = ini.Get("Config", "visibilityCache", "");
+	dedupWarmup = ini.GetBoolean("Config", "dedupWarmup", false);
+	int warmupConnections = ini.GetInteger("Config", "warmupConnections", 4);
+	warmupDepth = ini.GetInteger("Config", "warmupDepth", 8);
+	warmupRate = ini.GetReal("Config", "warmupRate", 0);
 	std::string mpdUri = ini.Get("Config", "mpdUri", "");
 	std::string mpdOut = ini.Get("Config", "mpdOut", "");
 	std::string squidAddress = ini.Get("Config", "squidAddress", "");
@@ -239,14 +253,20 @@ int main(int argc, char* argv[])
 
 	httpClient = new httplib::Client(squidAddress.c_str(), squidPort);
 	httpClient->proxyServer = true;
+	warmupClients.push_back(httpClient);
+	for (int i = 1; i < warmupConnections; i++)
+	{
+		warmupClients.push_back(new httplib::Client(squidAddress.c_str(), squidPort));
+		warmupClients.back()->proxyServer = true;
+	}
 
-	auto res = httpClient->Get(mpdUri.c_str());
-	if (!res || res->status != 200)
+	auto mpdContent = fetchMpd(*httpClient, mpdUri);
+	if (mpdContent.empty())
 	{
-		std::cout << "MPD not found " << res->status << std::endl;
+		std::cout << "MPD not found" << std::endl;
 		return -1;
 	}
-	mpd = new DASH::MPD(res->body);
+	mpd = new DASH::MPD(mpdContent);
 	auto srd = mpd->period.adaptationSets[0].srd;
 	numTiles = srd.th * srd.tv;
 	au = new AdaptionUnit(mpd, httpClient);
@@ -257,14 +277,13 @@ int main(int argc, char* argv[])
 	const char* rps[1] = { "LFUDA" };
 	const int cacheSizes[4] = { 20, 40, 60, 80 };
 
-	std::srand(std::time(0));
 
-	std::ofstream csv("test.csv");
+	ResultSink csv("test.csv", ini.GetBoolean("Config", "rawResults", true), { "Cache Size (MB)", "Type" }, { "BHR", "CHR" });
 	std::ofstream tracesUsed("tracesUsed.txt");
 	csv << "Cache Size (MB),Type,Stable State,BHR,CHR\n";
 
 	tracesUsed << "== EVAL ==" << std::endl;
-	auto testTraces = tracePermutation(numEvalTraces);
+	auto testTraces = tracePermutation<pathType>(pathHeadtraces, numEvalTraces, rng);
 	for (auto traceStr : testTraces)
 		tracesUsed << strrchr(traceStr.c_str(), '/') << " ";
 	tracesUsed << "\n";
@@ -273,7 +292,7 @@ int main(int argc, char* argv[])
 
 	for (int i = 0; i < numStableStates; i++)
 	{
-		auto traces = tracePermutation(numTracesPerInit);
+		auto traces = tracePermutation<pathType>(pathHeadtraces, numTracesPerInit, rng);
 		for (auto traceStr : traces)
 			tracesUsed << strrchr(traceStr.c_str(), '/') << " ";
 		tracesUsed << "\n";
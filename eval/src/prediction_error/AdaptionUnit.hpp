@@ -16,16 +16,22 @@
 
 #include "Quaternion.hpp"
 #include "mpd.h"
+#include "Log.hpp"
+#include "TileGrid.hpp"
+#include "ViewportProjector.hpp"
 #include "httplib.h"
 #include "CircularBuffer.hpp"
 #include "ConfigParser.hpp"
+#include "ThroughputEstimator.hpp"
+#include "AdaptionCore.hpp"
+#include "ViewportPredictor.hpp"
 
 #define TIME_NOW_EPOCH_MS std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count()
 #define SAMPLERES 8
 #define SAMPLEPOINTS (SAMPLERES+1)*(SAMPLERES+1)
 
 #define TIMER auto ttt = TIME_NOW_EPOCH_MS
-#define TIMEROUT(s) auto ttt2 = TIME_NOW_EPOCH_MS; std::cout << s << " TIMER: " << ttt2 - ttt << std::endl
+#define TIMEROUT(s) auto ttt2 = TIME_NOW_EPOCH_MS; LOG_INFO(s << " TIMER: " << ttt2 - ttt)
 
 constexpr float PI = 3.141592653589793238462643383279502884L;
 
@@ -43,28 +49,21 @@ public:
 	struct NormalizedCoordinate { double x, y; };
 
 	AdaptionUnit(const DASH::MPD* mpd, httplib::Client* httpClient)
-		: mpd(mpd), httpClient(httpClient)
+		: mpd(mpd), core(mpd), httpClient(httpClient)
 		, bytesDownloaded(0), durationDownload(0)
 		, bandwidthEstimate(0)
 	{
-		auto srd = mpd->period.adaptationSets[0].srd;
-
-		int frameWidth = srd.w * srd.th;
-		int frameHeight = srd.h * srd.tv;
-
-		for (int i = 0; i < mpd->period.adaptationSets.size(); i++)
-		{
-			srd = mpd->period.adaptationSets[i].srd;
+		auto config = Config::instance();
+		estimator = ThroughputEstimator::create(config->estimator, config->estimatorWindow, config->estimatorAlpha);
+		predictor = ViewportPredictor::create(config->predictor, CircularBuffer<std::pair<long long, Quaternion>>().capacity());
 
-			double normalizedCoordX = (srd.x + srd.w) / (double)frameWidth;
-			double normalizedCoordY = (srd.y + srd.h) / (double)frameHeight;
-
-			normalizedCoordTileMapping[normalizedCoordX][normalizedCoordY] = i;
-		}
+		tileGrid.build(mpd);
 
 		for (int i = 0; i <= SAMPLERES; i++)
 			for (int j = 0; j <= SAMPLERES; j++)
 				samplePoints[i * (SAMPLERES + 1) + j] = { i * (1.0 / SAMPLERES), j * (1.0 / SAMPLERES) };
+
+		projector.init(samplePoints, SAMPLEPOINTS, maxHDist, maxVDist);
 	}
 
 	void initAdaption(const std::pair<long long, Quaternion>& headRotation)
@@ -78,8 +77,12 @@ public:
 	{
 		if (init)
 			bandwidthEstimate = 2000000;
-		else if (durationDownload != 0 && bytesDownloaded != 0)
-			bandwidthEstimate = bytesDownloaded * (1000.0 / durationDownload);
+		else
+		{
+			estimator->addSample(bytesDownloaded, durationDownload);
+			if (estimator->estimate() > 0)
+				bandwidthEstimate = estimator->estimate();
+		}
 
 		durationDownload = 0;
 		bytesDownloaded = 0;
@@ -101,36 +104,13 @@ public:
 		{
 			transition = true;
 		}
-		else if (bandwidthNeededForTileQualityMap(tileQuality) < bandwidthEstimate * .75)
+		else if (core.neededBandwidth(tileQuality) < bandwidthEstimate * .75)
 		{
 			auto tileVisibility = computeTileVisibility(headRotations);
 
-			auto highestPriorityTile = std::max_element(tileVisibility.begin(), tileVisibility.end(), [](auto p1, auto p2) { return p1.first < p2.first; });
-			auto maxVisibility =highestPriorityTile->first;
-			auto visibilityPerQualityLevel = int(maxVisibility / (double)numQualityLevels);
-
-			while (highestPriorityTile->first != 0)
-			{
-				// enhance quality of highest priority tile
-				tileQuality.at(highestPriorityTile->second) = std::max(0, tileQuality.at(highestPriorityTile->second) - 1);
-
-				// trigger transition if too much bandwidth is needed
-				if (bandwidthNeededForTileQualityMap(tileQuality) > bandwidthEstimate * .75)
-				{
-					if (config->popularity && config->transitions)
-					{
-						transition = true;
-						std::cout << "Transition to popularity" << std::endl;
-					}
-					break;
-				}
-
-				// decrease visibility so highest priority tile differs after resort
-				highestPriorityTile->first = std::max(0, highestPriorityTile->first - visibilityPerQualityLevel);
-
-				// get most visible tile
-				highestPriorityTile = std::max_element(tileVisibility.begin(), tileVisibility.end(), [](auto p1, auto p2) { return p1.first < p2.first; });
-			}
+			transition = core.upgrade(config->popularity && config->transitions, true, tileVisibility, bandwidthEstimate * .75, numQualityLevels, tileQuality);
+			if (transition)
+				LOG_INFO("Transition to popularity");
 		}
 
 		if (transition)
@@ -148,18 +128,18 @@ public:
 
 	void stopAdaption()
 	{
-		if (durationDownload < 200)
+		// the probe is only needed when no tile of the segment was transferred, e.g. all were cache hits
+		if (durationDownload == 0)
 		{
-			auto timer = TIME_NOW_EPOCH_MS;
+			auto timer = STEADY_NOW;
 			auto res = httpClient->Get("/cntrl");
-			auto duration = TIME_NOW_EPOCH_MS - timer;
+			auto duration = ELAPSED_US(timer);
 
 			bool cacheHit = res->get_header_value("X-Cache").compare(0, 3, "HIT") == 0;
 			if (!cacheHit)
 			{
 				//std::cout << "control cache miss!" << std::endl;
-				durationDownload += duration;
-				bytesDownloaded += res->body.size();
+				addTransfer(*res, duration);
 			}
 		}
 	}
@@ -169,15 +149,14 @@ public:
 		if (segment != -1)
 			currentSegment = segment;
 		
-		auto timer = TIME_NOW_EPOCH_MS;
+		auto timer = STEADY_NOW;
 		auto res = httpClient->Get(mpd->getUrl(currentSegment, tile, tileQuality[tile]).c_str());
-		auto duration = TIME_NOW_EPOCH_MS - timer;
+		auto duration = ELAPSED_US(timer);
 
 		bool cacheHit = res->get_header_value("X-Cache").compare(0, 3, "HIT") == 0;
 		if (!cacheHit)
 		{
-			durationDownload += duration;
-			bytesDownloaded += res->body.size();
+			addTransfer(*res, duration);
 		}
 		else
 		{
@@ -193,24 +172,8 @@ public:
 
 	Quaternion predictHeadRotation(const CircularBuffer<std::pair<long long, Quaternion>>& headRotations, long long when) const
 	{
-		std::vector<double> timeVector(headRotations.size());
-		std::vector<double> rollVector(headRotations.size());
-		std::vector<double> pitchVector(headRotations.size());
-		std::vector<double> yawVector(headRotations.size());
-		for (int i = 0; i < headRotations.size(); i++)
-		{
-			auto eulerAngle = headRotations[i].second.ToEuler();
-			timeVector[i] = headRotations[i].first;
-			rollVector[i] = eulerAngle.GetX();
-			pitchVector[i] = eulerAngle.GetY();
-			yawVector[i] = eulerAngle.GetZ();
-		}
-
-		auto funRegressionRoll = computeRegressionFunction(timeVector, rollVector);
-		auto funRegressionPitch = computeRegressionFunction(timeVector, pitchVector);
-		auto funRegressionYaw = computeRegressionFunction(timeVector, yawVector);
-
-		return Quaternion::FromEuler(funRegressionYaw(when), funRegressionPitch(when), funRegressionRoll(when));
+		feedPredictor(headRotations);
+		return predictor->predict(when);
 	}
 
 	void printCacheHitrate()
@@ -233,17 +196,14 @@ public:
 	void printTileVisibility(const Quaternion& headRotation)
 	{
 		std::map<int, int> tileVisibilityMap;
-		for (int i = 0; i < SAMPLEPOINTS; i++)
-			tileVisibilityMap[mapCoordToTile(fromViewportCoordToEquirectCoord(headRotation, samplePoints[i]))]++;
+		addVisibleSamples(headRotation, tileVisibilityMap);
 
-		for (int i = 0; i < 16; i++)
-			if (tileVisibilityMap.find(i) == tileVisibilityMap.end())
-				tileVisibilityMap[i] = 0;
-
-		for (int i = 0; i < 4; i++)
+		// tiles are numbered column by column
+		auto srd = mpd->period.adaptationSets[0].srd;
+		for (int i = 0; i < srd.tv; i++)
 		{
-			for (int j = 0; j < 4; j++)
-				std::cout << tileVisibilityMap.at(j * 4 + i) << "\t";
+			for (int j = 0; j < srd.th; j++)
+				std::cout << tileVisibilityMap[j * srd.tv + i] << "\t";
 			std::cout << std::endl;
 		}
 		std::cout << std::endl;
@@ -255,38 +215,55 @@ public:
 	}
 
 private:
+	// the body after its first chunk over the time to its last chunk, which leaves out the wait for
+	// the server, a body that arrived in one read counts whole with the duration of its request
+	void addTransfer(const httplib::Response& res, long long duration)
+	{
+		if (res.transfer_us > 0)
+		{
+			durationDownload += res.transfer_us;
+			bytesDownloaded += res.transfer_bytes;
+		}
+		else
+		{
+			durationDownload += duration;
+			bytesDownloaded += res.body.size();
+		}
+	}
+
 	const DASH::MPD* mpd;
+	AdaptionCore core;
 	httplib::Client* httpClient;
-	std::map<double, std::map<double, int>> normalizedCoordTileMapping;
+	TileGrid tileGrid;
+	ViewportProjector projector;
 	std::map<int, int> tileQuality;
 	int currentSegment;	
 	size_t bandwidthEstimate;
 	size_t bytesDownloaded;
-	int durationDownload;
+	// microseconds
+	long long durationDownload;
+	std::unique_ptr<ThroughputEstimator> estimator;
+	std::unique_ptr<ViewportPredictor> predictor;
 	NormalizedCoordinate samplePoints[SAMPLEPOINTS];
 	int cacheHits = 0;
 	int totalFilesDownloaded = 0;
 	size_t cacheHitBytesDownloaded = 0;
 	size_t totalBytesDownloaded = 0;
 	
-	size_t bandwidthNeededForTileQualityMap(const std::map<int, int>& tileQualityMap)
+	// replay the recorded poses oldest first
+	void feedPredictor(const CircularBuffer<std::pair<long long, Quaternion>>& headRotations) const
 	{
-		size_t neededBandwidth = 0;
-		for (int i = 0; i < mpd->period.adaptationSets.size(); i++)
-			neededBandwidth += mpd->period.adaptationSets[i].representations[tileQualityMap.at(i)].bandwidth;
-		return neededBandwidth / 8;
-	}
-
-	std::function<double(double)> computeRegressionFunction(const std::vector<double>& x, const std::vector<double>& y) const
-	{
-		const auto n = x.size();
-		const auto s_x = std::accumulate(x.begin(), x.end(), 0.0);
-		const auto s_y = std::accumulate(y.begin(), y.end(), 0.0);
-		const auto s_xx = std::inner_product(x.begin(), x.end(), x.begin(), 0.0);
-		const auto s_xy = std::inner_product(x.begin(), x.end(), y.begin(), 0.0);
-		const auto slope = (n * s_xy - s_x * s_y) / (n * s_xx - s_x * s_x);
-		const auto intercept = (s_y - slope * s_x) / n;
-		return [slope, intercept](double x) { return x * slope + intercept; };
+		// the whole window oldest first, so the predictor converts it in one batch
+		size_t n = headRotations.size();
+		std::vector<double> timestamps(n);
+		QuaternionBatch::Quaternions rotations(n);
+		for (size_t i = 0; i < n; i++)
+		{
+			timestamps[i] = headRotations[n - 1 - i].first;
+			rotations.set(i, headRotations[n - 1 - i].second);
+		}
+		predictor->reset();
+		predictor->pushAll(timestamps.data(), rotations);
 	}
 
 	std::vector<std::pair<int, int>> computeTileVisibility(const CircularBuffer<std::pair<long long, Quaternion>>& headRotations) const
@@ -296,28 +273,11 @@ private:
 		if (headRotations.size() == 1 || !Config::instance()->viewportPrediction)
 		{
 			// find visible tiles depending on head position
-			for (int j = 0; j < SAMPLEPOINTS; j++)
-				tileVisibilityMap[mapCoordToTile(fromViewportCoordToEquirectCoord(headRotations[0].second, samplePoints[j]))]++;
+			addVisibleSamples(headRotations[0].second, tileVisibilityMap);
 		}
 		else
 		{
-			// convert quaternions to euler angles
-			std::vector<double> timeVector(headRotations.size());
-			std::vector<double> rollVector(headRotations.size());
-			std::vector<double> pitchVector(headRotations.size());
-			std::vector<double> yawVector(headRotations.size());
-			for (int i = 0; i < headRotations.size(); i++)
-			{
-				auto eulerAngle = headRotations[i].second.ToEuler();
-				timeVector[i] = headRotations[i].first;
-				rollVector[i] = eulerAngle.GetX();
-				pitchVector[i] = eulerAngle.GetY();
-				yawVector[i] = eulerAngle.GetZ();
-			}
-
-			auto funRegressionRoll = computeRegressionFunction(timeVector, rollVector);
-			auto funRegressionPitch = computeRegressionFunction(timeVector, pitchVector);
-			auto funRegressionYaw = computeRegressionFunction(timeVector, yawVector);
+			feedPredictor(headRotations);
 
 			auto timestamp = headRotations[0].first;
 
@@ -328,11 +288,10 @@ private:
 			for (int i = 0; i < 2; i++)
 			{
 				auto ts = predictionTimestamps[i];
-				auto rot = Quaternion::FromEuler(funRegressionYaw(ts), funRegressionPitch(ts), funRegressionRoll(ts));
+				auto rot = predictor->predict(ts);
 
 				// find visible tiles depending on head position
-				for (int j = 0; j < SAMPLEPOINTS; j++)
-					tileVisibilityMap[mapCoordToTile(fromViewportCoordToEquirectCoord(rot, samplePoints[j]))]++;
+				addVisibleSamples(rot, tileVisibilityMap);
 			}
 		}
 
@@ -344,9 +303,18 @@ private:
 		return tileVisibility;
 	}
 
+	// count the viewport sample points falling into each tile
+	void addVisibleSamples(const Quaternion& headRotation, std::map<int, int>& tileVisibilityMap) const
+	{
+		float x[SAMPLEPOINTS], y[SAMPLEPOINTS];
+		projector.project(headRotation, x, y);
+		for (int j = 0; j < SAMPLEPOINTS; j++)
+			tileVisibilityMap[tileGrid.tileAt(x[j], y[j])]++;
+	}
+
 	int mapCoordToTile(NormalizedCoordinate coord) const
 	{
-		return normalizedCoordTileMapping.lower_bound(coord.x)->second.lower_bound(coord.y)->second;
+		return tileGrid.tileAt(coord.x, coord.y);
 	}
 
 	static NormalizedCoordinate fromViewportCoordToEquirectCoord(const Quaternion& headRotation, const NormalizedCoordinate& viewportCoord)
@@ -1,6 +1,14 @@
 /*
 	Author: Arne-Tobias Rak
 	TU Darmstadt
+
+	Prediction error of every predictor, history timeframe and
+	prediction time over all traces of a folder. The traces are read
+	once, as whole sample arrays, together with their actual rotations
+	at every prediction time; each combination of predictor and
+	timeframe is a job that feeds every window of every trace to its
+	own predictor and measures the errors of all prediction times in
+	one batch per trace. The jobs run in parallel.
 */
 
 // Internal Includes
@@ -23,21 +31,145 @@
 //Internal Includes
 #include "ConfigParser.hpp"
 #include "Quaternion.hpp"
+#include "QuaternionBatch.hpp"
 #include "mpd.h"
 #include "AdaptionUnit.hpp"
 #include "HeadTrace.hpp"
+#include "ExperimentRunner.hpp"
 
 using namespace IMT;
 Config* Config::_instance = 0;
 
+// the samples of a trace and its actual rotation at the end of every window plus each prediction time
+struct TraceSamples
+{
+	std::vector<double> timestamps;
+	QuaternionBatch::Quaternions rotations;
+	std::vector<QuaternionBatch::Quaternions> actual;
+};
+
 //static global variable
 static httplib::Client* httpClient;
 static DASH::MPD* mpd;
-static AdaptionUnit* au;
-static HeadTrace* headTrace;
-static int numTiles = 0;
+static std::vector<TraceSamples> traces;
+static std::vector<double> predictionTimes;
+static std::vector<double> timeframes;
+static std::vector<std::string> predictors;
+// the first segment predicted for, the ones before have too little history
+static const int firstSegment = 2;
+
+static std::vector<std::string> parseList(const std::string& list)
+{
+	std::vector<std::string> values;
+	std::istringstream ss(list);
+	std::string value;
+	while (std::getline(ss, value, ','))
+		if (!value.empty())
+			values.push_back(value);
+	return values;
+}
+
+static std::vector<double> parseSeconds(const std::string& list)
+{
+	std::vector<double> values;
+	for (auto& value : parseList(list))
+		values.push_back(std::stod(value));
+	return values;
+}
+
+// sample at or after timestamp, the last one after the end of the trace
+static size_t sampleIndex(const std::vector<double>& timestamps, double timestamp)
+{
+	size_t i = std::lower_bound(timestamps.begin(), timestamps.end(), timestamp) - timestamps.begin();
+	return i == timestamps.size() ? i - 1 : i;
+}
 
-int main(int argc, char* argv[]) 
+static void loadTrace(const std::experimental::filesystem::path& path, TraceSamples& samples)
+{
+	auto config = Config::instance();
+	HeadTrace headTrace(path.c_str());
+	headTrace.samples(samples.timestamps, samples.rotations);
+
+	samples.actual.resize(predictionTimes.size());
+	for (size_t l = 0; l < predictionTimes.size(); l++)
+	{
+		std::vector<double> when;
+		for (int i = firstSegment; i < (int)mpd->numSegments(); i++)
+			when.push_back(i * mpd->segmentDuration() + predictionTimes[l]);
+		auto rotations = headTrace.rotationsForTimestamps(when, config->interpolateHeadtrace);
+		samples.actual[l].resize(rotations.size());
+		for (size_t i = 0; i < rotations.size(); i++)
+			samples.actual[l].set(i, rotations[i]);
+	}
+}
+
+// csv rows of every prediction time and trace for one predictor fed with timeframe seconds of history
+static std::string evaluate(const std::string& predictorType, double timeframe)
+{
+	// as many poses as the players' buffer of head rotations keeps
+	const size_t window = CircularBuffer<std::pair<long long, Quaternion>>().capacity();
+	auto predictor = ViewportPredictor::create(predictorType, window);
+
+	int numSegments = mpd->numSegments();
+	double segmentDuration = mpd->segmentDuration();
+	size_t numPredictions = numSegments > firstSegment ? numSegments - firstSegment : 0;
+
+	std::vector<std::ostringstream> rows(predictionTimes.size());
+	std::vector<QuaternionBatch::Quaternions> predicted(predictionTimes.size(), QuaternionBatch::Quaternions(numPredictions));
+	std::vector<float> errors(numPredictions);
+	std::vector<double> historyTimestamps;
+	QuaternionBatch::Quaternions history;
+
+	for (auto& trace : traces)
+	{
+		if (trace.timestamps.empty())
+			continue;
+
+		for (size_t p = 0; p < numPredictions; p++)
+		{
+			double endTimestamp = (p + firstSegment) * segmentDuration;
+			size_t first = sampleIndex(trace.timestamps, endTimestamp - timeframe);
+			size_t last = sampleIndex(trace.timestamps, endTimestamp);
+			first = std::max(first, last + 1 - std::min(last + 1, window));
+
+			// the whole window oldest first, at the millisecond timestamps the players record
+			size_t n = last + 1 - first;
+			historyTimestamps.resize(n);
+			history.resize(n);
+			for (size_t i = 0; i < n; i++)
+			{
+				historyTimestamps[i] = (double)(long long)(trace.timestamps[first + i] * 1000.0);
+				history.w[i] = trace.rotations.w[first + i];
+				history.x[i] = trace.rotations.x[first + i];
+				history.y[i] = trace.rotations.y[first + i];
+				history.z[i] = trace.rotations.z[first + i];
+			}
+			predictor->reset();
+			predictor->pushAll(historyTimestamps.data(), history);
+
+			for (size_t l = 0; l < predictionTimes.size(); l++)
+				predicted[l].set(p, predictor->predict((double)(long long)((endTimestamp + predictionTimes[l]) * 1000)));
+		}
+
+		for (size_t l = 0; l < predictionTimes.size(); l++)
+		{
+			QuaternionBatch::orthodromicDistance(trace.actual[l], predicted[l], errors.data());
+			double errorAcc = 0;
+			for (float e : errors)
+				errorAcc += e;
+			double error = errorAcc / numPredictions * (180.0 / PI);
+			if (std::isnormal(error))
+				rows[l] << predictionTimes[l] << "," << timeframe << "," << error << "," << predictorType << "\n";
+		}
+	}
+
+	std::string csv;
+	for (auto& r : rows)
+		csv += r.str();
+	return csv;
+}
+
+int main(int argc, char* argv[])
 {
 	// Parse the command line
 	if (argc != 2)
@@ -49,75 +181,43 @@ int main(int argc, char* argv[])
 	auto config = Config::instance();
 	config->init(argv[1]);
 
+	INIReader ini(argv[1]);
+	predictors = parseList(ini.Get("PredictionError", "predictors", config->predictor));
+	timeframes = parseSeconds(ini.Get("PredictionError", "timeframes", "0.1,0.25,0.5,1.0"));
+	predictionTimes = parseSeconds(ini.Get("PredictionError", "predictionTimes", "0.5,1.0,1.5,2.0"));
+	// the grid is independent of server and cache, so it uses every core unless told otherwise
+	ExperimentRunner runner(ini.GetInteger("Config", "workers", 0));
+
 	httpClient = new httplib::Client(config->squidAddress.c_str(), config->squidPort);
 	httpClient->proxyServer = true;
 
-	auto res = httpClient->Get(config->mpdUri.c_str());
-	if (!res || res->status != 200)
+	auto mpdContent = fetchMpd(*httpClient, config->mpdUri);
+	if (mpdContent.empty())
 	{
-		std::cout << "MPD not found " << res->status << std::endl;
+		std::cout << "MPD not found" << std::endl;
 		return -1;
 	}
-	mpd = new DASH::MPD(res->body);
-	au = new AdaptionUnit(mpd, httpClient);
-
-	auto srd = mpd->period.adaptationSets[0].srd;
-	numTiles = srd.th * srd.tv;
-
-	double timeframes[4] = { 0.1, 0.25, 0.5, 1.0 };
-	double predictiontimes[4] = { 0.5, 1.0, 1.5, 2.0 };
-	std::cout << "Prediction Time (s),Timeframe (s),Error (Deg.)" << std::endl;
-	for (int l = 0; l < 4; l++)
-	{
-		double predictionTime = predictiontimes[l];
-		for (int k = 0; k < 4; k++)
-		{
-			double predictionTimeframe = timeframes[k];
-			int j = 0;
-			// iterate all trace files in folder
-			for (auto& f : std::experimental::filesystem::directory_iterator(config->headtracePath))
-			{
-				++j;
-
-				// parse trace file
-				headTrace = new HeadTrace(f.path().c_str());
-				au->resetCacheHitrateVars();
-
-				static CircularBuffer<std::pair<long long, Quaternion>> headRotations;
-
-				headRotations.push({ 0, headTrace->rotationForTimestampIt(0)->second });
-
-				int numSegments = mpd->period.adaptationSets[0].representations[0].segmentList.segmentUrls.size();
-				double frameRate = mpd->frameRate();
-				double segmentDuration = mpd->segmentDuration();
-				double segmentFrames = segmentDuration * frameRate;
-
-				double errorAcc = 0;
-				int numPredictions = 0;
-
-				for (int i = 2; i < numSegments; i++)
-				{
-					int firstSegmentFrame = i * segmentFrames;
-
-					headRotations.clear();
-					double startTimestamp = i * segmentDuration - predictionTimeframe;
-					double endTimestamp = i * segmentDuration;
-					auto it = headTrace->rotationForTimestampIt(startTimestamp);
-					auto itEnd = std::next(headTrace->rotationForTimestampIt(endTimestamp));
-					for (; it != itEnd; it++)
-						headRotations.push({ it->first * 1000.0, it->second });
-
-					auto when = endTimestamp + predictionTime;
-					auto predicted = au->predictHeadRotation(headRotations, when * 1000);
-					auto actual = headTrace->rotationForTimestampIt(when)->second;
-					errorAcc += Quaternion::OrthodromicDistance(actual, predicted);
-					numPredictions++;
-				}
-				if (std::isnormal(errorAcc / numPredictions * (180.0 / PI)))
-					std::cout << predictionTime << "," << predictionTimeframe << "," << errorAcc / numPredictions * (180.0 / PI) << std::endl;
-			}
-		}
-	}
+	mpd = new DASH::MPD(mpdContent);
+
+	// all trace files of the folder, mapped from its corpus where there is one
+	std::vector<std::experimental::filesystem::path> paths;
+	for (auto& f : std::experimental::filesystem::directory_iterator(config->headtracePath))
+		if (f.path().filename() != TraceCorpus::fileName)
+			paths.push_back(f.path());
+	std::sort(paths.begin(), paths.end());
+
+	traces.resize(paths.size());
+	std::ostringstream none;
+	runner.run(paths.size(), [&](size_t i) {
+		loadTrace(paths[i], traces[i]);
+		return std::string();
+	}, none);
+
+	ResultSink csv(std::cout, config->rawResults, "prediction_error.csv", { "Predictor", "Timeframe (s)", "Prediction Time (s)" }, { "Error (Deg.)" });
+	csv << "Prediction Time (s),Timeframe (s),Error (Deg.),Predictor\n";
+	runner.run(predictors.size() * timeframes.size(), [&](size_t job) {
+		return evaluate(predictors[job / timeframes.size()], timeframes[job % timeframes.size()]);
+	}, csv);
 
 	return 0;
 }
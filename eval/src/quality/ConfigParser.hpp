@@ -25,10 +25,16 @@ public:
 			squidAddress = ini.Get(playConfig, "squidAddress", "");
 			squidPort = ini.GetInteger(playConfig, "squidPort", 3128);
 			mpdUri = ini.Get(playConfig, "mpdUri", "");
+			simulation = ini.GetBoolean(playConfig, "simulation", false);
+			wwwDir = ini.Get(playConfig, "wwwDir", "");
+			traceDir = ini.Get(playConfig, "traceDir", ".");
 			viewportPrediction = ini.GetBoolean(playConfig, "viewportPrediction", true);
 			popularity = ini.GetBoolean(playConfig, "popularity", true);
 			transitions = ini.GetBoolean(playConfig, "transitions", true);
 			demo = ini.GetBoolean(playConfig, "demo", false);
+			estimator = ini.Get(playConfig, "estimator", "harmonic");
+			estimatorWindow = ini.GetInteger(playConfig, "estimatorWindow", 5);
+			estimatorAlpha = ini.GetReal(playConfig, "estimatorAlpha", 0.3);
 			bwAdaption = ini.GetBoolean(playConfig, "bwAdaption", true);
 		}
 		else if (typeStr == "picture")
@@ -39,8 +45,15 @@ public:
 		else
 			std::invalid_argument("Config::Config: invalid play type: " + typeStr);
 
+		seed = ini.GetInteger("Config", "seed", 0);
+		workers = ini.GetInteger("Config", "workers", 1);
+		rawResults = ini.GetBoolean("Config", "rawResults", true);
+		viewportResolution = ini.GetInteger("Config", "viewportResolution", 16);
+		psnrTable = ini.Get("Config", "psnrTable", "");
+
 		headtracePath = ini.Get("Headtrace", "path", "");
 		useHeadtrace = ini.GetBoolean("Headtrace", "useTrace", false);
+		interpolateHeadtrace = ini.GetBoolean("Headtrace", "interpolate", false);
 	}
 
 	PlayType playType;
@@ -48,26 +61,69 @@ public:
 	std::string squidAddress;
 	int squidPort;
 	std::string mpdUri;
+	// requests are answered by SimulatedClient on a virtual clock, from the files of wwwDir and the traces of traceDir
+	bool simulation;
+	std::string wwwDir;
+	std::string traceDir;
 	bool viewportPrediction;
 	bool popularity;
 	bool transitions;
 	bool demo;
+	std::string estimator;
+	int estimatorWindow;
+	double estimatorAlpha;
 	bool bwAdaption;
 
 	std::string imgPath;
 
+	// head traces are drawn from a generator seeded with seed, independent runs are spread over workers threads (0 for every core)
+	unsigned seed;
+	int workers;
+	// every row is written next to the summary of the results
+	bool rawResults;
+	// (viewportResolution + 1)^2 samples per frame score the viewport, psnrTable holds lines of tile,quality,psnr
+	int viewportResolution;
+	std::string psnrTable;
+
 	std::string headtracePath;
 	bool useHeadtrace;
+	// rotations between two samples of a trace are slerped instead of taken from the next sample
+	bool interpolateHeadtrace;
 
 	static Config* instance()
 	{
+		if (current())
+			return current();
 		if (!_instance)
 			_instance = new Config();
 		return _instance;
 	}
 
+	// makes config the instance of the calling thread while it exists, so parallel runs each change their own copy
+	class Scope
+	{
+	public:
+		Scope(Config& config) : previous(current())
+		{
+			current() = &config;
+		}
+		~Scope()
+		{
+			current() = previous;
+		}
+
+	private:
+		Config* previous;
+	};
+
 private:
 	Config(){}
 	
 	static Config* _instance;
+
+	static Config*& current()
+	{
+		static thread_local Config* config = nullptr;
+		return config;
+	}
 };
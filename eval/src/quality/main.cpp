@@ -31,6 +31,9 @@
 #include "mpd.h"
 #include "AdaptionUnit.hpp"
 #include "HeadTrace.hpp"
+#include "ExperimentRunner.hpp"
+#include "SimulatedClient.hpp"
+#include "ViewportQuality.hpp"
 
 using namespace IMT;
 namespace fs = std::experimental::filesystem;
@@ -41,43 +44,23 @@ httplib::Client* httpClient;
 DASH::MPD* mpd;
 int numTiles;
 AdaptionUnit* au;
+// draws the head traces, seeded from the config
+std::mt19937 rng;
 
 const std::string netTraces[3] = { "test_trace", "TMobile-LTE-driving", "Verizon-LTE-driving" };
 
 typedef std::string pathType;
 
-std::vector<pathType> tracePermutation(int numTraces)
+// the qualities a session played, scored against the viewport of its trace once all sessions ran
+struct Session
 {
-	std::vector<pathType> traces;
-
-	auto dirIt = fs::directory_iterator(Config::instance()->headtracePath);
-	auto dirItBegin = fs::begin(dirIt);
-	auto dirItEnd = fs::end(dirIt);
-	auto numFiles = std::distance(dirItBegin, dirItEnd);
-
-	std::set<int> traceIndices;
-	for (int i = 0; i < numTraces; i++)
-		while (!traceIndices.insert(std::rand() % numFiles).second);
-
-	int fi = 0;
-	for (auto& f : fs::directory_iterator(Config::instance()->headtracePath))
-	{
-		std::string p;
-#ifdef _WIN32
-		using convert_type = std::codecvt_utf8<wchar_t>;
-		std::wstring_convert<convert_type, wchar_t> converter;
-		p = converter.to_bytes(f.path());
-#else
-		p = f.path();
-#endif
-
-		if (traceIndices.find(fi) != traceIndices.end())
-			traces.push_back(p);
-		fi++;
-	}
-
-	return traces;
-}
+	pathType trace;
+	int iteration;
+	std::string netTrace;
+	std::string type;
+	std::vector<std::map<int, int>> qualities;
+};
+std::vector<Session> sessions;
 
 void downloadPopularTiles()
 {
@@ -107,7 +90,7 @@ void downloadTrace(pathType pathToTrace, std::function<void(int)> dlfun)
 
 	headRotations.push({ 0, headTrace->rotationForTimestampIt(0)->second });
 
-	int numSegments = mpd->period.adaptationSets[0].representations[0].segmentList.segmentUrls.size();
+	int numSegments = mpd->numSegments();
 	double frameRate = mpd->frameRate();
 	double segmentDuration = mpd->segmentDuration();
 	double segmentFrames = segmentDuration * frameRate;
@@ -142,22 +125,30 @@ int main(int argc, char* argv[])
 
 	auto config = Config::instance();
 	config->init(argv[1]);
+	rng.seed(config->seed);
 
-	httpClient = new httplib::Client(config->squidAddress.c_str(), config->squidPort);
+	if (config->simulation)
+	{
+		// sessions run on virtual time against the modelled server and cache
+		SimClock::setVirtual(true);
+		httpClient = new SimulatedClient(std::make_shared<SimulatedNetwork>(config->wwwDir, config->traceDir), true);
+	}
+	else
+		httpClient = new httplib::Client(config->squidAddress.c_str(), config->squidPort);
 	//httpClient->proxyServer = true;
 
-	auto res = httpClient->Get(config->mpdUri.c_str());
-	if (!res || res->status != 200)
+	auto mpdContent = fetchMpd(*httpClient, config->mpdUri);
+	if (mpdContent.empty())
 	{
-		std::cout << "MPD not found " << res->status << std::endl;
+		std::cout << "MPD not found" << std::endl;
 		return -1;
 	}
-	mpd = new DASH::MPD(res->body);
+	mpd = new DASH::MPD(mpdContent);
 	au = new AdaptionUnit(mpd, httpClient);
 
 	auto srd = mpd->period.adaptationSets[0].srd;
 	numTiles = srd.th * srd.tv;
-	int numSegments = mpd->period.adaptationSets[0].representations[0].segmentList.segmentUrls.size();
+	int numSegments = mpd->numSegments();
 
 	
 	std::map<int, int> highQuality;
@@ -165,7 +156,7 @@ int main(int argc, char* argv[])
 		highQuality[i] = 0;
 	
 	std::ofstream tracesUsed("tracesUsed.txt");
-	std::ofstream csv("test.csv");
+	ResultSink csv("test.csv", config->rawResults, { "Type", "NetTrace" }, { "Segment Quality" });
 	csv << "Iteration,NetTrace,Segment,Type,Segment Quality\n";
 
 	httpClient->Get("/bw/99999999");
@@ -174,11 +165,14 @@ int main(int argc, char* argv[])
 	Config::instance()->viewportPrediction = false;
 	Config::instance()->transitions = false;
 	Config::instance()->bwAdaption = false;
-	downloadTrace(tracePermutation(1)[0], [&](int segment)
+	auto popularityTrace = tracePermutation<pathType>(Config::instance()->headtracePath, 1, rng)[0];
+	sessions.push_back({ popularityTrace, 0, "-", "Popularity" });
+	downloadTrace(popularityTrace, [&](int segment)
 	{
 		csv << 0 << ",-," << segment << ",Popularity," << au->getAvgTileQuality() << "\n";
 		std::cout << "\r" << segment + 1 << "/" << numSegments << std::flush;
 		au->downloadPopularTiles(segment);
+		sessions.back().qualities.push_back(au->getCurrentTileQuality());
 	});
 	csv.flush();
 	std::cout << std::endl;
@@ -186,7 +180,7 @@ int main(int argc, char* argv[])
 	for (int i = 0; i < 30; i++)
 	{
 		std::cout << "It: " << i << "/" << 30 << std::endl;
-		auto trace = tracePermutation(1)[0];
+		auto trace = tracePermutation<pathType>(Config::instance()->headtracePath, 1, rng)[0];
 		tracesUsed << trace << std::endl;
 
 		httpClient->Get("/bw/99999999");
@@ -195,12 +189,14 @@ int main(int argc, char* argv[])
 		Config::instance()->viewportPrediction = true;
 		Config::instance()->transitions = false;
 		Config::instance()->bwAdaption = false;
+		sessions.push_back({ trace, i, "-", "Prediction" });
 		downloadTrace(trace, [&](int segment)
 		{
 			csv << i << ",-," << segment << ",Prediction," << au->getAvgTileQuality() << "\n";
 			std::cout << "\r" << segment + 1 << "/" << numSegments << std::flush;
 			for (int i = 0; i < numTiles; i++)
 				au->download(i, segment);
+			sessions.back().qualities.push_back(au->getCurrentTileQuality());
 		});
 		csv.flush();
 		std::cout << std::endl;
@@ -214,16 +210,18 @@ int main(int argc, char* argv[])
 			Config::instance()->viewportPrediction = true;
 			Config::instance()->transitions = true;
 			Config::instance()->bwAdaption = false;
+			sessions.push_back({ trace, i, netTrace, "Transition" });
 			downloadTrace(trace, [&](int segment)
 			{
 				csv << i << "," << netTrace << "," << segment << ",Transition," << au->getAvgTileQuality() << "\n";
 				std::cout << "\r" << segment + 1 << "/" << numSegments << std::flush;
 				for (int i = 0; i < numTiles; i++)
 					au->download(i, segment);
+				sessions.back().qualities.push_back(au->getCurrentTileQuality());
 				auto ts = TIME_NOW_EPOCH_MS - startTime;
 				int sleepDurMs = (segment + 1) * 1500 - ts;
 				if (sleepDurMs > 0)
-					std::this_thread::sleep_for(std::chrono::milliseconds(sleepDurMs));
+					SimClock::sleepFor(std::chrono::milliseconds(sleepDurMs));
 			});
 			csv.flush();
 			std::cout << std::endl;
@@ -234,16 +232,18 @@ int main(int argc, char* argv[])
 			Config::instance()->bwAdaption = true;
 			httpClient->Get("/tracereset");
 			startTime = TIME_NOW_EPOCH_MS;
+			sessions.push_back({ trace, i, netTrace, "PredictionBWA" });
 			downloadTrace(trace, [&](int segment)
 			{
 				csv << i << "," << netTrace << "," << segment << ",PredictionBWA," << au->getAvgTileQuality() << "\n";
 				std::cout << "\r" << segment + 1 << "/" << numSegments << std::flush;
 				for (int i = 0; i < numTiles; i++)
 					au->download(i, segment);
+				sessions.back().qualities.push_back(au->getCurrentTileQuality());
 				auto ts = TIME_NOW_EPOCH_MS - startTime;
 				int sleepDurMs = (segment + 1) * 1500 - ts;
 				if (sleepDurMs > 0)
-					std::this_thread::sleep_for(std::chrono::milliseconds(sleepDurMs));
+					SimClock::sleepFor(std::chrono::milliseconds(sleepDurMs));
 			});
 			csv.flush();
 			std::cout << std::endl;
@@ -253,5 +253,29 @@ int main(int argc, char* argv[])
 
 	csv.close();
 
+	// what each session showed in the viewport of its trace, frame by frame; the scoring only needs the CPU, so sessions run on every core
+	ViewportQuality viewportQuality(mpd, config->viewportResolution, maxHDist, maxVDist);
+	if (!config->psnrTable.empty() && !viewportQuality.loadPsnr(config->psnrTable))
+		std::cout << "PSNR table " << config->psnrTable << " not found" << std::endl;
+	std::vector<std::string> viewportMetrics = { "Viewport Quality", "Viewport Bitrate (Mbit/s)", "Viewport PSNR (dB)" };
+	ResultSink viewportCsv("viewport.csv", config->rawResults, { "Type", "NetTrace" }, viewportMetrics);
+	viewportCsv << "Iteration,NetTrace,Segment,Type,Viewport Quality,Viewport Bitrate (Mbit/s)" << (viewportQuality.psnrLoaded() ? ",Viewport PSNR (dB)" : "") << "\n";
+	ExperimentRunner scorer(0);
+	scorer.run(sessions.size(), [&](size_t j)
+	{
+		auto& session = sessions[j];
+		HeadTrace headTrace(session.trace.c_str());
+		auto metrics = viewportQuality.session(headTrace, session.qualities, config->interpolateHeadtrace);
+		std::ostringstream rows;
+		for (size_t s = 0; s < metrics.size(); s++)
+		{
+			rows << session.iteration << "," << session.netTrace << "," << s << "," << session.type << "," << metrics[s].quality << "," << metrics[s].bitrateMbit;
+			if (viewportQuality.psnrLoaded())
+				rows << "," << metrics[s].psnr;
+			rows << "\n";
+		}
+		return rows.str();
+	}, viewportCsv);
+
 	return 0;
 }
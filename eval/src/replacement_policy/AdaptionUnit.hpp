@@ -10,10 +10,14 @@
 #include <deque>
 #include <numeric>
 #include <algorithm>
+#include <sstream>
 #include <string>
 
 #include "Quaternion.hpp"
 #include "mpd.h"
+#include "Log.hpp"
+#include "TileGrid.hpp"
+#include "ViewportProjector.hpp"
 #include "httplib.h"
 
 #define TIME_NOW_EPOCH_MS std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count()
@@ -21,7 +25,7 @@
 #define SAMPLEPOINTS (SAMPLERES+1)*(SAMPLERES+1)
 
 #define TIMER auto ttt = TIME_NOW_EPOCH_MS
-#define TIMEROUT(s) auto ttt2 = TIME_NOW_EPOCH_MS; std::cout << s << " TIMER: " << ttt2 - ttt << std::endl
+#define TIMEROUT(s) auto ttt2 = TIME_NOW_EPOCH_MS; LOG_INFO(s << " TIMER: " << ttt2 - ttt)
 
  float PI = 3.141592653589793238462643383279502884L;
 
@@ -41,36 +45,33 @@ public:
 	AdaptionUnit(const DASH::MPD* mpd, httplib::Client* httpClient)
 		: mpd(mpd), httpClient(httpClient)
 	{
-		auto srd = mpd->period.adaptationSets[0].srd;
-
-		int frameWidth = srd.w * srd.th;
-		int frameHeight = srd.h * srd.tv;
-
-		for (int i = 0; i < mpd->period.adaptationSets.size(); i++)
-		{
-			srd = mpd->period.adaptationSets[i].srd;
-
-			double normalizedCoordX = (srd.x + srd.w) / (double)frameWidth;
-			double normalizedCoordY = (srd.y + srd.h) / (double)frameHeight;
-
-			normalizedCoordTileMapping[normalizedCoordX][normalizedCoordY] = i;
-		}
+		tileGrid.build(mpd);
 
 		for (int i = 0; i <= SAMPLERES; i++)
 			for (int j = 0; j <= SAMPLERES; j++)
 				samplePoints[i * (SAMPLERES + 1) + j] = { i * (1.0 / SAMPLERES), j * (1.0 / SAMPLERES) };
+
+		projector.init(samplePoints, SAMPLEPOINTS, maxHDist, maxVDist);
 	}
 
 	std::map<int, int> computeTileVisibility(const Quaternion& headRotation) const
 	{
 		std::map<int, int> tileVisibilityMap;
 
-		for (int j = 0; j < SAMPLEPOINTS; j++)
-			tileVisibilityMap[mapCoordToTile(fromViewportCoordToEquirectCoord(headRotation, samplePoints[j]))]++;
+		addVisibleSamples(headRotation, tileVisibilityMap);
 
 		return tileVisibilityMap;
 	}
 
+	// what computeTileVisibility depends on besides the tiling, part of the key of saved visibility matrices
+	std::string visibilityModel() const
+	{
+		std::ostringstream ss;
+		ss.precision(17);
+		ss << "projector " << SAMPLERES << " " << maxHDist << " " << maxVDist;
+		return ss.str();
+	}
+
 	auto download(int tile, int segment)
 	{
 		auto res = httpClient->Get(mpd->getUrl(segment, tile, tileQuality[tile]).c_str());
@@ -92,7 +93,7 @@ public:
 	{
 		tileQuality = mpd->tilePopularity(segment);
 
-		for (int i = 0; i < 16; i++)
+		for (int i = 0; i < mpd->period.adaptationSets.size(); i++)
 			download(i, segment);
 	}
 
@@ -117,7 +118,8 @@ public:
 private:
 	const DASH::MPD* mpd;
 	httplib::Client* httpClient;
-	std::map<double, std::map<double, int>> normalizedCoordTileMapping;
+	TileGrid tileGrid;
+	ViewportProjector projector;
 	std::map<int, int> tileQuality;
 	NormalizedCoordinate samplePoints[SAMPLEPOINTS];
 	int cacheHits = 0;
@@ -126,9 +128,18 @@ private:
 	size_t totalBytesDownloaded = 0;
 
 
+	// count the viewport sample points falling into each tile
+	void addVisibleSamples(const Quaternion& headRotation, std::map<int, int>& tileVisibilityMap) const
+	{
+		float x[SAMPLEPOINTS], y[SAMPLEPOINTS];
+		projector.project(headRotation, x, y);
+		for (int j = 0; j < SAMPLEPOINTS; j++)
+			tileVisibilityMap[tileGrid.tileAt(x[j], y[j])]++;
+	}
+
 	int mapCoordToTile(NormalizedCoordinate coord) const
 	{
-		return normalizedCoordTileMapping.lower_bound(coord.x)->second.lower_bound(coord.y)->second;
+		return tileGrid.tileAt(coord.x, coord.y);
 	}
 
 	static NormalizedCoordinate fromViewportCoordToEquirectCoord(const Quaternion& headRotation, const NormalizedCoordinate& viewportCoord)
@@ -5,7 +5,11 @@
 #include "mpd.h"
 #include "httplib.h"
 #include "HeadTrace.hpp"
+#include "VisibilityMatrix.hpp"
+#include "ExperimentRunner.hpp"
 #include "AdaptionUnit.hpp"
+#include "CacheSimulator.hpp"
+#include "CacheWarmer.hpp"
 #include <experimental/filesystem>
 #include "IniReader.hpp"
 #include <random>
@@ -17,10 +21,22 @@
 namespace fs = std::experimental::filesystem;
 
 std::string pathHeadtraces;
+// head rotations between two samples are slerped
+bool interpolateHeadtraces;
+// folder of saved visibility matrices, none are saved without
+std::string visibilityCache;
+// warms the cache with every distinct url once, by expected hits per byte over pipelined connections,
+// instead of each trace's requests in turn
+bool dedupWarmup;
+std::vector<httplib::Client*> warmupClients;
+int warmupDepth;
+double warmupRate;
 httplib::Client* httpClient;
 DASH::MPD* mpd;
 int numTiles;
 AdaptionUnit* au;
+// draws the head traces, seeded from the config
+std::mt19937 rng;
 
 #ifdef _WIN32
 typedef std::wstring pathType;
@@ -39,35 +55,14 @@ void resetSquidCache()
 	system("sudo service squid start");
 }
 
-std::vector<pathType> tracePermutation(int numTraces)
+// urls initCache requests, in order
+std::vector<std::string> cacheWarmupRequests(const std::vector<pathType>& traces)
 {
-	std::vector<pathType> traces;
+	std::vector<std::string> requests;
 
-	auto dirIt = fs::directory_iterator(pathHeadtraces);
-	auto dirItBegin = fs::begin(dirIt);
-	auto dirItEnd = fs::end(dirIt);
-	auto numFiles = std::distance(dirItBegin, dirItEnd);
-	
-	std::set<int> traceIndices;
-	for (int i = 0; i < numTraces; i++)
-		while (!traceIndices.insert(std::rand()%numFiles).second);
-	
-	int fi = 0;
-	for (auto& f : fs::directory_iterator(pathHeadtraces))
-	{
-		if (traceIndices.find(fi) != traceIndices.end())
-			traces.push_back(f.path());
-		fi++;
-	}
-	
-	return traces;
-}
-
-void initCache(const std::vector<pathType>& traces)
-{
-	// download init files
+	// init files
 	for (int i = 0; i < numTiles; i++)
-		auto initRes = httpClient->Get((mpd->getInitUrl(i)).c_str());
+		requests.push_back(mpd->getInitUrl(i));
 
 	double vidDurationMs = mpd->mediaPresentationDuration.count();
 	double segDurationS = mpd->segmentDuration();
@@ -77,31 +72,34 @@ void initCache(const std::vector<pathType>& traces)
 	std::map<int, std::map<int, double>> tileVisibility;
 	int i = 0;
 
+	// a couple of timestamps inside each segment, those of segment s start at segmentSamples[s]
+	std::vector<double> timestamps;
+	std::vector<size_t> segmentSamples;
+	for (int s = 0; s < numSegments; s++)
+	{
+		segmentSamples.push_back(timestamps.size());
+		double segStart = segDurationS * s;
+		for (double ts = segStart; ts < segStart + segDurationS; ts += 0.25)
+			timestamps.push_back(ts);
+	}
+	segmentSamples.push_back(timestamps.size());
+
 	for (auto trace : traces)
 	{
 		// parse trace file
 		HeadTrace headTrace(trace.c_str());
+		auto headRotations = headTrace.rotationsForTimestamps(timestamps, interpolateHeadtraces);
+		// visible samples per segment and tile, saved once per trace, video and tiling
+		auto visibility = VisibilityMatrix::get(visibilityCache, VisibilityMatrix::key(mpd, au->visibilityModel(), segmentSamples, headRotations),
+			numTiles, segmentSamples, headRotations, [&](const Quaternion& q) { return au->computeTileVisibility(q); });
 
 		// iterate over temporal segments
 		for (int s = 0; s < numSegments; s++)
 		{
-			double segStart = segDurationS * s;
+			// tiles no sample fell into count as 1
 			std::map<int, int> segTileVisibility;
-
-			// iterate over a couple of timestamps inside each segment
-			for (double ts = segStart; ts < segStart + segDurationS; ts += 0.25)
-			{
-				auto headRot = headTrace.rotationForTimestamp(ts);
-				// compute tile visibility for head rotation at given timestamp
-				auto tv = au->computeTileVisibility(headRot);
-
-				for (auto it = tv.begin(); it != tv.end(); it++)
-					segTileVisibility[it->first] += it->second;
-			}
-
 			for (int t = 0; t < numTiles; t++)
-				if (segTileVisibility.find(t) == segTileVisibility.end())
-					segTileVisibility[t] = 1;
+				segTileVisibility[t] = std::max(1, visibility->count(s, t));
 
 			// add segment tile visibility from this headtrace to overall visibility
 			for (auto it = segTileVisibility.begin(); it != segTileVisibility.end(); it++)
@@ -112,7 +110,7 @@ void initCache(const std::vector<pathType>& traces)
 			for (auto it = segTileVisibility.begin(); it != segTileVisibility.end(); it++)
 			{
 				it->second = (int)(numQualityLevels - (numQualityLevels * (it->second / max)));
-				httpClient->Get((mpd->getUrl(s, it->first, it->second)).c_str());
+				requests.push_back(mpd->getUrl(s, it->first, it->second));
 			}
 		}
 
@@ -120,6 +118,28 @@ void initCache(const std::vector<pathType>& traces)
 	}
 
 	std::cout << std::endl;
+	return requests;
+}
+
+// the urls of cacheWarmupRequests once each, every request of them counts as a hit
+CacheWarmer warmupUrls(const std::vector<pathType>& traces, SegmentSizes& sizes)
+{
+	CacheWarmer warmer;
+	for (auto& url : cacheWarmupRequests(traces))
+		warmer.add(url, 1, sizes.size(url));
+	return warmer;
+}
+
+void initCache(const std::vector<pathType>& traces, SegmentSizes& sizes)
+{
+	if (dedupWarmup)
+	{
+		auto result = warmupUrls(traces, sizes).run(warmupClients, warmupDepth, warmupRate);
+		std::cout << result.requests << " warm-up requests, " << result.failed << " failed" << std::endl;
+		return;
+	}
+	for (auto& url : cacheWarmupRequests(traces))
+		httpClient->Get(url.c_str());
 }
 
 void downloadPopularTiles()
@@ -141,6 +161,67 @@ void downloadPopularTiles()
 	}
 }
 
+// the requests of downloadPopularTiles, the adaption unit only counts the tile downloads
+void popularTileRequests(SegmentSizes& sizes, std::vector<CacheSimulator::Request>& initRequests, std::vector<CacheSimulator::Request>& tileRequests)
+{
+	for (int i = 0; i < numTiles; i++)
+		initRequests.push_back(sizes.request(mpd->getInitUrl(i)));
+
+	double vidDurationMs = mpd->mediaPresentationDuration.count();
+	double segDurationS = mpd->segmentDuration();
+	int numSegments = std::ceil(vidDurationMs / 1000.0 / segDurationS);
+
+	for (int s = 0; s < numSegments; s++)
+	{
+		auto& tileQuality = mpd->tilePopularity(s);
+		for (int i = 0; i < (int)mpd->period.adaptationSets.size(); i++)
+		{
+			auto q = tileQuality.find(i);
+			tileRequests.push_back(sizes.request(mpd->getUrl(s, i, q == tileQuality.end() ? 0 : q->second)));
+		}
+	}
+}
+
+// runs every policy and cache size of one stable state on the recorded requests instead of a cache, configurations in parallel
+void simulateStableState(int stableState, const std::vector<pathType>& traces, const std::vector<std::string>& rps, const int* cacheSizes, int numCacheSizes, SegmentSizes& sizes, std::ostream& csv)
+{
+	std::vector<CacheSimulator::Request> warmup, popularInit, popularTiles;
+	if (dedupWarmup)
+		for (auto& url : warmupUrls(traces, sizes).ordered())
+			warmup.push_back({ url.url, url.bytes });
+	else
+		for (auto& url : cacheWarmupRequests(traces))
+			warmup.push_back(sizes.request(url));
+	popularTileRequests(sizes, popularInit, popularTiles);
+
+	// urls 360cache seeds from the <Popularity> element of the MPD
+	std::vector<std::string> popularUrls;
+	for (auto& segment : mpd->period.segmentTilePopularity)
+		for (auto& tile : segment.second)
+			popularUrls.push_back(mpd->getUrl(segment.first, tile.first, tile.second));
+
+	int numRuns = (int)rps.size() * numCacheSizes;
+	std::vector<double> bhr(numRuns), chr(numRuns);
+#pragma omp parallel for schedule(dynamic)
+	for (int k = 0; k < numRuns; k++)
+	{
+		CacheSimulator cache((size_t)cacheSizes[k % numCacheSizes] << 20, rps[k / numCacheSizes]);
+		if (rps[k / numCacheSizes] == "popularity")
+			for (auto& url : popularUrls)
+				cache.setPopular(url);
+		cache.replay(warmup);
+		cache.replay(popularInit);
+		cache.resetHitrateVars();
+		cache.replay(popularTiles);
+		bhr[k] = cache.byteHitrate();
+		chr[k] = cache.cacheHitrate();
+	}
+
+	for (int k = 0; k < numRuns; k++)
+		csv << rps[k / numCacheSizes] << "," << cacheSizes[k % numCacheSizes] << "," << stableState << "," <<
+			std::to_string(bhr[k]) + "," + std::to_string(chr[k]) << "\n";
+}
+
 void editSquidConf(const std::string& replacement, int cacheSize)
 {
 	std::ifstream conf("/etc/squid/squid.conf", std::ios::binary);
@@ -164,6 +245,18 @@ void editSquidConf(const std::string& replacement, int cacheSize)
 	confi.close();
 }
 
+// empties the cache and sets its policy and size in MB, 360cache does so in place without a restart
+void resetCache(const std::string& replacement, int cacheSize, bool nativeCache)
+{
+	if (nativeCache)
+	{
+		httpClient->Get(("/_cache/reset/" + replacement + "/" + std::to_string(cacheSize)).c_str());
+		return;
+	}
+	editSquidConf(replacement, cacheSize);
+	resetSquidCache();
+}
+
 int main(int argc, char* argv[])
 {
 	if (argc != 2)
@@ -174,51 +267,91 @@ int main(int argc, char* argv[])
 	
 	// parse config
 	INIReader ini(argv[1]);
+	rng.seed(ini.GetInteger("Config", "seed", 0));
 	pathHeadtraces = ini.Get("Config", "pathHeadtraces", "");
+	interpolateHeadtraces = ini.GetBoolean("Config", "interpolateHeadtraces", false);
+	visibilityCache = ini.Get("Config", "visibilityCache", "");
+	dedupWarmup = ini.GetBoolean("Config", "dedupWarmup", false);
+	int warmupConnections = ini.GetInteger("Config", "warmupConnections", 4);
+	warmupDepth = ini.GetInteger("Config", "warmupDepth", 8);
+	warmupRate = ini.GetReal("Config", "warmupRate", 0);
 	std::string mpdUri = ini.Get("Config", "mpdUri", "");
 	std::string mpdOut = ini.Get("Config", "mpdOut", "");
 	std::string squidAddress = ini.Get("Config", "squidAddress", "");
 	int squidPort = ini.GetInteger("Config", "squidPort", 3128);
+	// 360cache also offers the popularity policy
+	bool nativeCache = ini.GetBoolean("Config", "nativeCache", false);
+	// replays the requests on simulated caches instead, segment sizes are taken from wwwDir or estimated from the MPD
+	bool simulate = ini.GetBoolean("Config", "simulate", false);
+	std::string wwwDir = ini.Get("Config", "wwwDir", "");
 
 	httpClient = new httplib::Client(squidAddress.c_str(), squidPort);
 	httpClient->proxyServer = true;
+	warmupClients.push_back(httpClient);
+	for (int i = 1; i < warmupConnections; i++)
+	{
+		warmupClients.push_back(new httplib::Client(squidAddress.c_str(), squidPort));
+		warmupClients.back()->proxyServer = true;
+	}
 
-	auto res = httpClient->Get(mpdUri.c_str());
-	if (!res || res->status != 200)
+	std::string mpdContent;
+	std::ifstream mpdFile(wwwDir + mpdUri);
+	if (simulate && !wwwDir.empty() && mpdFile)
 	{
-		std::cout << "MPD not found " << res->status << std::endl;
-		return -1;
+		std::stringstream ss;
+		ss << mpdFile.rdbuf();
+		mpdContent = ss.str();
 	}
-	mpd = new DASH::MPD(res->body);
+	else
+	{
+		mpdContent = fetchMpd(*httpClient, mpdUri);
+		if (mpdContent.empty())
+		{
+			std::cout << "MPD not found" << std::endl;
+			return -1;
+		}
+	}
+	mpd = new DASH::MPD(mpdContent);
 	auto srd = mpd->period.adaptationSets[0].srd;
 	numTiles = srd.th * srd.tv;
 	au = new AdaptionUnit(mpd, httpClient);
 	
 	const int numStableStates = 30;
 	const int numTracesPerInit = 30;
-	const char* rps[3] = { "LRU", "LFUDA", "GDSF" };
+	std::vector<std::string> rps = { "LRU", "LFUDA", "GDSF" };
+	if (nativeCache || simulate)
+		rps.push_back("popularity");
 	const int cacheSizes[4] = { 20, 40, 60, 80 };	
+	SegmentSizes segmentSizes(mpd, wwwDir);
 
-	std::ofstream csv("test.csv");
+	ResultSink csv("test.csv", ini.GetBoolean("Config", "rawResults", true), { "Replacement Policy", "Cache Size (MB)" }, { "BHR", "CHR" });
 	std::ofstream tracesUsed("tracesUsed.txt");
 	csv << "Replacement Policy,Cache Size (MB),Stable State,BHR,CHR\n";
 	for (int i = 0; i < numStableStates; i++)
 	{
-		auto traces = tracePermutation(numTracesPerInit);
+		auto traces = tracePermutation<pathType>(pathHeadtraces, numTracesPerInit, rng);
 		for (auto traceStr : traces)
 			tracesUsed << strrchr(traceStr.c_str(), '/') << " ";
 		tracesUsed << "\n";
 
-		for (int r = 0; r < 3; r++)
+		if (simulate)
+		{
+			std::cout << "Stable State: " << i << std::endl;
+			simulateStableState(i, traces, rps, cacheSizes, 4, segmentSizes, csv);
+			continue;
+		}
+
+		for (size_t r = 0; r < rps.size(); r++)
 		{
 			for (int c = 0; c < 4; c++)
 			{
 				std::string replacementPolicy = rps[r];
 				int cacheSize = cacheSizes[c];
 				std::cout << "Stable State: " << i << "; " << replacementPolicy << "; " << cacheSize << std::endl;
-				editSquidConf(replacementPolicy, cacheSize);
-				resetSquidCache();
-				initCache(traces);
+				resetCache(replacementPolicy, cacheSize, nativeCache);
+				if (replacementPolicy == "popularity")
+					httpClient->Get(("/_cache/popularity" + mpdUri).c_str());
+				initCache(traces, segmentSizes);
 				downloadPopularTiles();
 				csv << replacementPolicy << "," << cacheSize << "," << i << "," << 
 					std::to_string(au->byteHitrate()) + "," + std::to_string(au->cacheHitrate()) << "\n";
@@ -13,19 +13,26 @@
 #include <deque>
 #include <numeric>
 #include <algorithm>
+#include <sstream>
 
 #include "Quaternion.hpp"
 #include "mpd.h"
+#include "Log.hpp"
+#include "TileGrid.hpp"
+#include "ViewportProjector.hpp"
 #include "httplib.h"
 #include "CircularBuffer.hpp"
 #include "ConfigParser.hpp"
+#include "ThroughputEstimator.hpp"
+#include "AdaptionCore.hpp"
 
-#define TIME_NOW_EPOCH_MS std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count()
+#define TIME_NOW_EPOCH_MS SimClock::epochMs()
 #define SAMPLERES 8
+#define REQUEST_ATTEMPTS 3
 #define SAMPLEPOINTS (SAMPLERES+1)*(SAMPLERES+1)
 
 #define TIMER auto ttt = TIME_NOW_EPOCH_MS
-#define TIMEROUT(s) auto ttt2 = TIME_NOW_EPOCH_MS; std::cout << s << " TIMER: " << ttt2 - ttt << std::endl
+#define TIMEROUT(s) auto ttt2 = TIME_NOW_EPOCH_MS; LOG_INFO(s << " TIMER: " << ttt2 - ttt)
 
 constexpr float PI = 3.141592653589793238462643383279502884L;
 
@@ -43,40 +50,40 @@ public:
 	struct NormalizedCoordinate { double x, y; };
 
 	AdaptionUnit(const DASH::MPD* mpd, httplib::Client* httpClient, httplib::Client* httpClientDirect)
-		: mpd(mpd), httpClient(httpClient), httpClientDirect(httpClientDirect)
+		: mpd(mpd), core(mpd), httpClient(httpClient), httpClientDirect(httpClientDirect)
 		, bytesDownloaded(0), durationDownload(0)
 		, bandwidthEstimate(0)
 	{
-		auto srd = mpd->period.adaptationSets[0].srd;
-
-		int frameWidth = srd.w * srd.th;
-		int frameHeight = srd.h * srd.tv;
-
-		for (int i = 0; i < mpd->period.adaptationSets.size(); i++)
-		{
-			srd = mpd->period.adaptationSets[i].srd;
-
-			double normalizedCoordX = (srd.x + srd.w) / (double)frameWidth;
-			double normalizedCoordY = (srd.y + srd.h) / (double)frameHeight;
+		auto config = Config::instance();
+		estimator = ThroughputEstimator::create(config->estimator, config->estimatorWindow, config->estimatorAlpha);
 
-			normalizedCoordTileMapping[normalizedCoordX][normalizedCoordY] = i;
-		}
+		tileGrid.build(mpd);
 
 		for (int i = 0; i <= SAMPLERES; i++)
 			for (int j = 0; j <= SAMPLERES; j++)
 				samplePoints[i * (SAMPLERES + 1) + j] = { i * (1.0 / SAMPLERES), j * (1.0 / SAMPLERES) };
+
+		projector.init(samplePoints, SAMPLEPOINTS, maxHDist, maxVDist);
 	}
 
 	std::map<int, int> computeTileVisibility(const Quaternion& headRotation) const
 	{
 		std::map<int, int> tileVisibilityMap;
 
-		for (int j = 0; j < SAMPLEPOINTS; j++)
-			tileVisibilityMap[mapCoordToTile(fromViewportCoordToEquirectCoord(headRotation, samplePoints[j]))]++;
+		addVisibleSamples(headRotation, tileVisibilityMap);
 
 		return tileVisibilityMap;
 	}
 
+	// what computeTileVisibility depends on besides the tiling, part of the key of saved visibility matrices
+	std::string visibilityModel() const
+	{
+		std::ostringstream ss;
+		ss.precision(17);
+		ss << "projector " << SAMPLERES << " " << maxHDist << " " << maxVDist;
+		return ss.str();
+	}
+
 	void initAdaption(const std::pair<long long, Quaternion>& headRotation)
 	{
 		CircularBuffer<std::pair<long long, Quaternion>> cb;
@@ -86,21 +93,26 @@ public:
 
 	size_t bwEstimate() const
 	{
-		if (durationDownload != 0)
-			return bytesDownloaded * (1000.0 / durationDownload);
+		if (estimator->estimate() > 0)
+			return estimator->estimate();
 		else
 			return 2000000;
 	}
 
-	void setBandwidthEstimate(int bw)
+	// a segment the run downloaded over its network trace, the transfers to the server are no measure of the trace
+	void addSegmentDownload(size_t bytes, long long durationUs)
 	{
-		bandwidthEstimate = bw;
+		estimator->addSample(bytes, durationUs);
+		bandwidthEstimate = bwEstimate();
 	}
 
 	void startAdaption(const CircularBuffer<std::pair<long long, Quaternion>>& headRotations, int segment, bool init = false)
 	{
 		if (init)
-			bandwidthEstimate = 2000000;
+		{
+			estimator->reset();
+			bandwidthEstimate = bwEstimate();
+		}
 		
 		durationDownload = 0;
 		bytesDownloaded = 0;
@@ -122,38 +134,13 @@ public:
 		{
 			transition = true;
 		}
-		else if (bandwidthNeededForTileQualityMap(tileQuality) < bandwidthEstimate * .75)
+		else if (core.neededBandwidth(tileQuality) < bandwidthEstimate * config->safetyFactor)
 		{
 			auto tileVisibility = computeTileVisibility(headRotations);
 
-			auto highestPriorityTile = std::max_element(tileVisibility.begin(), tileVisibility.end(), [](auto p1, auto p2) { return p1.first < p2.first; });
-			auto maxVisibility =highestPriorityTile->first;
-			auto visibilityPerQualityLevel = int(maxVisibility / (double)numQualityLevels);
-
-			while (highestPriorityTile->first != 0)
-			{
-				// enhance quality of highest priority tile
-				tileQuality.at(highestPriorityTile->second) = std::max(0, tileQuality.at(highestPriorityTile->second) - 1);
-
-				// trigger transition if too much bandwidth is needed
-				if (bandwidthNeededForTileQualityMap(tileQuality) > bandwidthEstimate * .75)
-				{
-					if (config->popularity && config->transitions)
-					{
-						transition = true;
-						std::cout << " Transition to popularity" << std::flush;
-						break;
-					}
-					if (config->bwAdaption)
-						break;
-				}
-
-				// decrease visibility so highest priority tile differs after resort
-				highestPriorityTile->first = std::max(0, highestPriorityTile->first - visibilityPerQualityLevel);
-
-				// get most visible tile
-				highestPriorityTile = std::max_element(tileVisibility.begin(), tileVisibility.end(), [](auto p1, auto p2) { return p1.first < p2.first; });
-			}
+			transition = core.upgrade(config->popularity && config->transitions, config->bwAdaption, tileVisibility, bandwidthEstimate * config->safetyFactor, numQualityLevels, tileQuality);
+			if (transition)
+				LOG_INFO("Transition to popularity");
 		}
 
 		if (transition)
@@ -164,61 +151,62 @@ public:
 
 	void stopAdaption()
 	{
-		if (durationDownload < 200)
+		// the probe is only needed when no tile of the segment was transferred, e.g. all were cache hits
+		if (durationDownload == 0)
 		{
-			auto timer = TIME_NOW_EPOCH_MS;
+			auto timer = STEADY_NOW;
 			auto res = httpClient->Get("/cntrl");
-			auto duration = TIME_NOW_EPOCH_MS - timer;
+			auto duration = ELAPSED_US(timer);
 			bool cacheHit = res->get_header_value("X-Cache").compare(0, 3, "HIT") == 0;
 			if (!cacheHit)
 			{
 				//std::cout << "control cache miss!" << std::endl;
-				durationDownload += duration;
-				bytesDownloaded += res->body.size();
+				addTransfer(*res, duration);
 			}
 		}
 	}
 
+	// tiles the cache holds come from it in one request, the others from the server without caching them
 	std::shared_ptr<httplib::Response> download(int tile, int segment = -1)
 	{
 		if (segment != -1)
 			currentSegment = segment;
 
-		std::shared_ptr<httplib::Response> hitResponse;
-		while(!(hitResponse = httpClient->Head(mpd->getUrl(currentSegment, tile, tileQuality[tile]).c_str())));
-		bool cacheHit = hitResponse->get_header_value("X-Cache").compare(0, 3, "HIT") == 0;
-		if (cacheHit)
-			return hitResponse;
-
-		std::shared_ptr<httplib::Response> res;
-		long long duration;
-		while (!res)
-		{
-			auto timer = TIME_NOW_EPOCH_MS;
-			res = httpClientDirect->Get(mpd->getUrl(currentSegment, tile, tileQuality[tile]).c_str());
-			duration = TIME_NOW_EPOCH_MS - timer;
-		}
-		
-		if (!cacheHit)
+		auto url = mpd->getUrl(currentSegment, tile, tileQuality[tile]);
+		auto res = request([&]() { return httpClient->Get(url.c_str(), onlyIfCached()); });
+		if (res && res->status != 504)
 		{
-			durationDownload += duration;
-			bytesDownloaded += res->body.size();
+			cacheHitBytesDownloaded += res->body.size();
+			totalBytesDownloaded += res->body.size();
+			return res;
 		}
-		else
+
+		long long duration;
+		res = request([&]() {
+			auto timer = STEADY_NOW;
+			auto direct = httpClientDirect->Get(url.c_str());
+			duration = ELAPSED_US(timer);
+			return direct;
+		});
+		if (!res)
 		{
-			cacheHitBytesDownloaded += res->body.size();
+			LOG_WARNING("No answer for " << url);
+			return res;
 		}
+
+		addTransfer(*res, duration);
 		totalBytesDownloaded += res->body.size();
 
 		return res;
 	}
 
+	// the cache answers without asking the server, an unreachable cache counts as a miss
 	bool isCached(const std::string& url)
 	{
-		std::shared_ptr<httplib::Response> res;
-		while(!res)
-			res = httpClient->Head(url.c_str());
-		return res->get_header_value("X-Cache").compare(0, 3, "HIT") == 0;
+		auto res = request([&]() { return httpClient->Head(url.c_str(), onlyIfCached()); });
+		if (!res)
+			LOG_WARNING("No answer from the cache for " << url);
+		return res && res->status != 504 && res->get_header_value("X-Cache").compare(0, 3, "HIT") == 0;
 	}
 
 	double byteHitrate()
@@ -230,7 +218,7 @@ public:
 	{
 		tileQuality = mpd->tilePopularity(segment);
 
-		for (int i = 0; i < 16; i++)
+		for (int i = 0; i < (int)mpd->period.adaptationSets.size(); i++)
 			download(i, segment);
 	}
 
@@ -238,7 +226,7 @@ public:
 	{
 		tileQuality = qualities;
 
-		for (int i = 0; i < 16; i++)
+		for (int i = 0; i < (int)mpd->period.adaptationSets.size(); i++)
 			download(i, segment);
 
 	}
@@ -284,17 +272,14 @@ public:
 	void printTileVisibility(const Quaternion& headRotation)
 	{
 		std::map<int, int> tileVisibilityMap;
-		for (int i = 0; i < SAMPLEPOINTS; i++)
-			tileVisibilityMap[mapCoordToTile(fromViewportCoordToEquirectCoord(headRotation, samplePoints[i]))]++;
+		addVisibleSamples(headRotation, tileVisibilityMap);
 
-		for (int i = 0; i < 16; i++)
-			if (tileVisibilityMap.find(i) == tileVisibilityMap.end())
-				tileVisibilityMap[i] = 0;
-
-		for (int i = 0; i < 4; i++)
+		// tiles are numbered column by column
+		auto srd = mpd->period.adaptationSets[0].srd;
+		for (int i = 0; i < srd.tv; i++)
 		{
-			for (int j = 0; j < 4; j++)
-				std::cout << tileVisibilityMap.at(j * 4 + i) << "\t";
+			for (int j = 0; j < srd.th; j++)
+				std::cout << tileVisibilityMap[j * srd.tv + i] << "\t";
 			std::cout << std::endl;
 		}
 		std::cout << std::endl;
@@ -306,27 +291,54 @@ public:
 	}
 
 private:
+	// tries a request up to REQUEST_ATTEMPTS times with a growing pause in between, nullptr if none was answered
+	template <typename F>
+	static std::shared_ptr<httplib::Response> request(F send)
+	{
+		std::shared_ptr<httplib::Response> res;
+		for (int attempt = 1; !(res = send()) && attempt < REQUEST_ATTEMPTS; attempt++)
+			SimClock::sleepFor(std::chrono::milliseconds(100 * attempt));
+		return res;
+	}
+
+	static httplib::Headers onlyIfCached()
+	{
+		return { { "Cache-Control", "only-if-cached" } };
+	}
+
+	// the body after its first chunk over the time to its last chunk, which leaves out the wait for
+	// the server, a body that arrived in one read counts whole with the duration of its request
+	void addTransfer(const httplib::Response& res, long long duration)
+	{
+		if (res.transfer_us > 0)
+		{
+			durationDownload += res.transfer_us;
+			bytesDownloaded += res.transfer_bytes;
+		}
+		else
+		{
+			durationDownload += duration;
+			bytesDownloaded += res.body.size();
+		}
+	}
+
 	const DASH::MPD* mpd;
+	AdaptionCore core;
 	httplib::Client* httpClient;
 	httplib::Client* httpClientDirect;
-	std::map<double, std::map<double, int>> normalizedCoordTileMapping;
+	TileGrid tileGrid;
+	ViewportProjector projector;
 	std::map<int, int> tileQuality;
 	int currentSegment;	
 	size_t bandwidthEstimate;
 	size_t bytesDownloaded;
-	int durationDownload;
+	// microseconds
+	long long durationDownload;
+	std::unique_ptr<ThroughputEstimator> estimator;
 	NormalizedCoordinate samplePoints[SAMPLEPOINTS];
 	size_t totalBytesDownloaded = 0;
 	size_t cacheHitBytesDownloaded = 0;
 	
-	size_t bandwidthNeededForTileQualityMap(const std::map<int, int>& tileQualityMap)
-	{
-		size_t neededBandwidth = 0;
-		for (int i = 0; i < mpd->period.adaptationSets.size(); i++)
-			neededBandwidth += mpd->period.adaptationSets[i].representations[tileQualityMap.at(i)].bandwidth;
-		return neededBandwidth / 8;
-	}
-
 	std::function<double(double)> computeRegressionFunction(const std::vector<double>& x, const std::vector<double>& y) const
 	{
 		const auto n = x.size();
@@ -346,8 +358,7 @@ private:
 		if (headRotations.size() == 1 || !Config::instance()->viewportPrediction)
 		{
 			// find visible tiles depending on head position
-			for (int j = 0; j < SAMPLEPOINTS; j++)
-				tileVisibilityMap[mapCoordToTile(fromViewportCoordToEquirectCoord(headRotations[0].second, samplePoints[j]))]++;
+			addVisibleSamples(headRotations[0].second, tileVisibilityMap);
 		}
 		else
 		{
@@ -381,8 +392,7 @@ private:
 				auto rot = Quaternion::FromEuler(funRegressionYaw(ts), funRegressionPitch(ts), funRegressionRoll(ts));
 
 				// find visible tiles depending on head position
-				for (int j = 0; j < SAMPLEPOINTS; j++)
-					tileVisibilityMap[mapCoordToTile(fromViewportCoordToEquirectCoord(rot, samplePoints[j]))]++;
+				addVisibleSamples(rot, tileVisibilityMap);
 			}
 		}
 
@@ -394,9 +404,18 @@ private:
 		return tileVisibility;
 	}
 
+	// count the viewport sample points falling into each tile
+	void addVisibleSamples(const Quaternion& headRotation, std::map<int, int>& tileVisibilityMap) const
+	{
+		float x[SAMPLEPOINTS], y[SAMPLEPOINTS];
+		projector.project(headRotation, x, y);
+		for (int j = 0; j < SAMPLEPOINTS; j++)
+			tileVisibilityMap[tileGrid.tileAt(x[j], y[j])]++;
+	}
+
 	int mapCoordToTile(NormalizedCoordinate coord) const
 	{
-		return normalizedCoordTileMapping.lower_bound(coord.x)->second.lower_bound(coord.y)->second;
+		return tileGrid.tileAt(coord.x, coord.y);
 	}
 
 	static NormalizedCoordinate fromViewportCoordToEquirectCoord(const Quaternion& headRotation, const NormalizedCoordinate& viewportCoord)
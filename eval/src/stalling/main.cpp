@@ -29,16 +29,19 @@
 #include "mpd.h"
 #include "AdaptionUnit.hpp"
 #include "HeadTrace.hpp"
+#include "VisibilityMatrix.hpp"
+#include "ExperimentRunner.hpp"
+#include "SimulatedClient.hpp"
 
 using namespace IMT;
 namespace fs = std::experimental::filesystem;
 
 Config* Config::_instance = 0;
 
-httplib::Client* httpClient;
 DASH::MPD* mpd;
 int numTiles;
-AdaptionUnit* au;
+// draws the head traces, seeded from the config
+std::mt19937 rng;
 
 #ifdef _WIN32
 typedef std::wstring pathType;
@@ -46,30 +49,6 @@ typedef std::wstring pathType;
 typedef std::string pathType;
 #endif
 
-std::vector<pathType> tracePermutation(int numTraces)
-{
-	std::vector<pathType> traces;
-
-	auto dirIt = fs::directory_iterator(Config::instance()->headtracePath);
-	auto dirItBegin = fs::begin(dirIt);
-	auto dirItEnd = fs::end(dirIt);
-	auto numFiles = std::distance(dirItBegin, dirItEnd);
-
-	std::set<int> traceIndices;
-	for (int i = 0; i < numTraces; i++)
-		while (!traceIndices.insert(std::rand() % numFiles).second);
-
-	int fi = 0;
-	for (auto& f : fs::directory_iterator(Config::instance()->headtracePath))
-	{
-		if (traceIndices.find(fi) != traceIndices.end())
-			traces.push_back(f.path());
-		fi++;
-	}
-
-	return traces;
-}
-
 void editSquidConf(const std::string& replacement, int cacheSize)
 {
 	std::ifstream conf("/etc/squid/squid.conf", std::ios::binary);
@@ -105,7 +84,50 @@ void resetSquidCache()
 	std::this_thread::sleep_for(std::chrono::milliseconds(5000));
 }
 
-void downloadPopularTiles()
+// clients, adaption unit and config of one stable state, sessions on different workers only share the MPD and the network trace
+struct Session
+{
+	Session(const Config& config) : config(config) {}
+
+	Config config;
+	std::unique_ptr<httplib::Client> httpClient;
+	std::unique_ptr<httplib::Client> httpClientDirect;
+	std::unique_ptr<AdaptionUnit> au;
+};
+
+// the simulation gives every session its own modelled server, link and cache
+void connect(Session& session)
+{
+	auto& config = session.config;
+	if (config.simulation)
+	{
+		auto network = std::make_shared<SimulatedNetwork>(config.wwwDir, config.traceDir);
+		session.httpClient.reset(new SimulatedClient(network, true));
+		session.httpClientDirect.reset(new SimulatedClient(network, false));
+	}
+	else
+	{
+		session.httpClient.reset(new httplib::Client(config.squidAddress.c_str(), config.squidPort));
+		session.httpClient->proxyServer = true;
+
+		session.httpClientDirect.reset(new httplib::Client("localhost", 80));
+		session.httpClientDirect->proxyServer = false;
+	}
+}
+
+// empties the cache and sets its policy and size in MB, 360cache and the simulation do so in place without a restart
+void resetCache(Session& session, const std::string& replacement, int cacheSize)
+{
+	if (session.config.nativeCache || session.config.simulation)
+	{
+		session.httpClient->Get(("/_cache/reset/" + replacement + "/" + std::to_string(cacheSize)).c_str());
+		return;
+	}
+	editSquidConf(replacement, cacheSize);
+	resetSquidCache();
+}
+
+void downloadPopularTiles(Session& session)
 {
 	// download init files
 	//for (int i = 0; i < numTiles; i++)
@@ -118,15 +140,15 @@ void downloadPopularTiles()
 	// iterate over temporal segments
 	for (int s = 0; s < numSegments; s++)
 	{
-		au->downloadPopularTiles(s);
+		session.au->downloadPopularTiles(s);
 	}
 }
 
-void initCache(const std::vector<pathType>& traces)
+void initCache(Session& session, const std::vector<pathType>& traces)
 {
 	// download init files
 	for (int i = 0; i < numTiles; i++)
-		auto initRes = httpClient->Get((mpd->getInitUrl(i)).c_str());
+		auto initRes = session.httpClient->Get((mpd->getInitUrl(i)).c_str());
 
 	double vidDurationMs = mpd->mediaPresentationDuration.count();
 	double segDurationS = mpd->segmentDuration();
@@ -136,31 +158,34 @@ void initCache(const std::vector<pathType>& traces)
 	std::map<int, std::map<int, double>> tileVisibility;
 	int i = 0;
 
+	// a couple of timestamps inside each segment, those of segment s start at segmentSamples[s]
+	std::vector<double> timestamps;
+	std::vector<size_t> segmentSamples;
+	for (int s = 0; s < numSegments; s++)
+	{
+		segmentSamples.push_back(timestamps.size());
+		double segStart = segDurationS * s;
+		for (double ts = segStart; ts < segStart + segDurationS; ts += 0.25)
+			timestamps.push_back(ts);
+	}
+	segmentSamples.push_back(timestamps.size());
+
 	for (auto trace : traces)
 	{
 		// parse trace file
 		HeadTrace headTrace(trace.c_str());
+		auto headRotations = headTrace.rotationsForTimestamps(timestamps, session.config.interpolateHeadtrace);
+		// visible samples per segment and tile, saved once per trace, video and tiling
+		auto visibility = VisibilityMatrix::get(session.config.visibilityCache, VisibilityMatrix::key(mpd, session.au->visibilityModel(), segmentSamples, headRotations),
+			numTiles, segmentSamples, headRotations, [&](const Quaternion& q) { return session.au->computeTileVisibility(q); });
 
 		// iterate over temporal segments
 		for (int s = 0; s < numSegments; s++)
 		{
-			double segStart = segDurationS * s;
+			// tiles no sample fell into count as 1
 			std::map<int, int> segTileVisibility;
-
-			// iterate over a couple of timestamps inside each segment
-			for (double ts = segStart; ts < segStart + segDurationS; ts += 0.25)
-			{
-				auto headRot = headTrace.rotationForTimestamp(ts);
-				// compute tile visibility for head rotation at given timestamp
-				auto tv = au->computeTileVisibility(headRot);
-
-				for (auto it = tv.begin(); it != tv.end(); it++)
-					segTileVisibility[it->first] += it->second;
-			}
-
 			for (int t = 0; t < numTiles; t++)
-				if (segTileVisibility.find(t) == segTileVisibility.end())
-					segTileVisibility[t] = 1;
+				segTileVisibility[t] = std::max(1, visibility->count(s, t));
 
 			// add segment tile visibility from this headtrace to overall visibility
 			for (auto it = segTileVisibility.begin(); it != segTileVisibility.end(); it++)
@@ -171,7 +196,7 @@ void initCache(const std::vector<pathType>& traces)
 			for (auto it = segTileVisibility.begin(); it != segTileVisibility.end(); it++)
 			{
 				it->second = (int)(numQualityLevels - (numQualityLevels * (it->second / max)));
-				auto res = httpClient->Get((mpd->getUrl(s, it->first, it->second)).c_str());
+				auto res = session.httpClient->Get((mpd->getUrl(s, it->first, it->second)).c_str());
 				if (!res)
 				{
 					std::cout << "Alarm! " << mpd->getUrl(s,it->first,it->second) << std::endl;
@@ -181,32 +206,29 @@ void initCache(const std::vector<pathType>& traces)
 			}
 		}
 
-		std::cout << "\r" << ++i << "/" << traces.size() << std::flush;
+		++i;
 	}
 
 	for (int i = 0; i < 5; i++)
-		downloadPopularTiles();
-
-
-	std::cout << std::endl;
+		downloadPopularTiles(session);
 }
 
-void downloadTrace(pathType pathToTrace, std::function<void(int)> dlfun)
+void downloadTrace(Session& session, pathType pathToTrace, std::function<void(int)> dlfun)
 {
 	auto srd = mpd->period.adaptationSets[0].srd;
 	int numTiles = srd.th * srd.tv;
 
 	auto headTrace = new HeadTrace(pathToTrace.c_str());
 
-	static CircularBuffer<std::pair<long long, Quaternion>> headRotations;
+	CircularBuffer<std::pair<long long, Quaternion>> headRotations;
 
 	headRotations.push({ 0, headTrace->rotationForTimestampIt(0)->second });
 
-	au->initAdaption(headRotations[0]);
+	session.au->initAdaption(headRotations[0]);
 	dlfun(0);
-	au->stopAdaption();
+	session.au->stopAdaption();
 
-	int numSegments = mpd->period.adaptationSets[0].representations[0].segmentList.segmentUrls.size();
+	int numSegments = mpd->numSegments();
 	double frameRate = mpd->frameRate();
 	double segmentDuration = mpd->segmentDuration();
 	double segmentFrames = segmentDuration * frameRate;
@@ -220,9 +242,9 @@ void downloadTrace(pathType pathToTrace, std::function<void(int)> dlfun)
 		auto itEnd = std::next(headTrace->rotationForTimestampIt(endTimestamp));
 		for (; it != itEnd; it++)
 			headRotations.push({ it->first * 1000.0, it->second });
-		au->startAdaption(headRotations, i);
+		session.au->startAdaption(headRotations, i);
 		dlfun(i);
-		au->stopAdaption();
+		session.au->stopAdaption();
 	}
 
 	delete headTrace;
@@ -232,17 +254,17 @@ void downloadTrace(pathType pathToTrace, std::function<void(int)> dlfun)
 
 static std::map<int, int> netTrace;
 static int netTraceDur;
-int computeSegmentDownloadTime(int timestamp, std::map<int, int> tileQuality, int segment)
+int computeSegmentDownloadTime(Session& session, int timestamp, std::map<int, int> tileQuality, int segment)
 {
 	int dlTimeMs = 0;
 	int dlBytes = 0;
-	for (int i = 0; i < 16; i++)
+	for (int i = 0; i < mpd->period.adaptationSets.size(); i++)
 	{
 		auto url = mpd->getUrl(segment, i, tileQuality[i]);
-		if (au->isCached(url))
+		if (session.au->isCached(url))
 			continue;
 
-		url = WWWPATH + url;
+		url = (session.config.wwwDir.empty() ? WWWPATH : session.config.wwwDir) + url;
 		
 		struct stat statbuf;
 		stat(url.c_str(), &statbuf);
@@ -258,11 +280,42 @@ int computeSegmentDownloadTime(int timestamp, std::map<int, int> tileQuality, in
 		}
 		dlTimeMs += ms; 
 	}
-	auto bwEstimate = dlBytes * (1000.0 / dlTimeMs);
-	au->setBandwidthEstimate(bwEstimate);
+	session.au->addSegmentDownload(dlBytes, dlTimeMs * 1000ll);
 	return dlTimeMs;
 }
 
+// plays trace with the current config, returns a row per stall. Naive players request every tile in the highest quality
+std::string measureStalling(Session& session, const pathType& trace, int stableState, const std::string& netTrace, const std::string& type, int cacheSize, bool naive = false)
+{
+	std::ostringstream csv;
+	int playbackTime = 0;
+	int stallTime = 0;
+	downloadTrace(session, trace, [&](int segment)
+	{
+		auto tileQuality = naive ? std::map<int, int>() : session.au->getCurrentTileQuality();
+		playbackTime += computeSegmentDownloadTime(session, playbackTime, tileQuality, segment);
+		int stallTimeMs = playbackTime - ((segment + 1) * 1500 + stallTime);
+		if (stallTimeMs > 0)
+		{
+			stallTime += stallTimeMs;
+			csv << stableState << "," << netTrace << "," << type << "," << cacheSize << "," << playbackTime << "," << stallTimeMs << "\n";
+		}
+		else
+			playbackTime -= stallTimeMs;
+	});
+	std::cout << "SS: " << stableState << " " << netTrace << " " << cacheSize << " " << type << " BHR " << session.au->byteHitrate() << std::endl;
+	session.au->resetCacheHitrateVars();
+	return csv.str();
+}
+
+void setAdaption(bool popularity, bool viewportPrediction, bool transitions, bool bwAdaption)
+{
+	Config::instance()->popularity = popularity;
+	Config::instance()->viewportPrediction = viewportPrediction;
+	Config::instance()->transitions = transitions;
+	Config::instance()->bwAdaption = bwAdaption;
+}
+
 int main(int argc, char* argv[])
 {
 	// Parse the command line
@@ -274,28 +327,23 @@ int main(int argc, char* argv[])
 
 	auto config = Config::instance();
 	config->init(argv[1]);
+	rng.seed(config->seed);
 
-	httpClient = new httplib::Client(config->squidAddress.c_str(), config->squidPort);
-	httpClient->proxyServer = true;
-
-	auto httpClientDirect = new httplib::Client("localhost", 80);
-	httpClientDirect->proxyServer = false;
-
-	auto res = httpClientDirect->Get(config->mpdUri.c_str());
-	if (!res || res->status != 200)
+	Session bootstrap(*config);
+	connect(bootstrap);
+	auto mpdContent = fetchMpd(*bootstrap.httpClientDirect, config->mpdUri);
+	if (mpdContent.empty())
 	{
-		std::cout << "MPD not found " << res->status << std::endl;
+		std::cout << "MPD not found" << std::endl;
 		return -1;
 	}
-	mpd = new DASH::MPD(res->body);
-	au = new AdaptionUnit(mpd, httpClient, httpClientDirect);
+	mpd = new DASH::MPD(mpdContent);
 
 	auto srd = mpd->period.adaptationSets[0].srd;
 	numTiles = srd.th * srd.tv;
-	int numSegments = mpd->period.adaptationSets[0].representations[0].segmentList.segmentUrls.size();
 
-	auto cacheInitTraces = tracePermutation(15);
-	auto evalTraces = tracePermutation(30);
+	auto cacheInitTraces = tracePermutation<pathType>(Config::instance()->headtracePath, 15, rng);
+	auto evalTraces = tracePermutation<pathType>(Config::instance()->headtracePath, 30, rng);
 
 
 
@@ -306,17 +354,13 @@ int main(int argc, char* argv[])
 		tracesUsed << strrchr(traceStr.c_str(), '/') << " ";
 	tracesUsed << "\n== CACHE INIT ==\n";
 #endif
-	
-	std::map<int, int> highQuality;
-	for (int i = 0; i < numTiles; i++)
-		highQuality[i] = 0;
 
 	//const std::string netTraces[3] = { "Verizon-LTE-driving", "Verizon-LTE-short", "TMobile-LTE-driving" };
 	const int cacheSizes[4] = { 20, 40, 60, 80 };
 	const std::string netTraces[1] = { "mytrace" };
 	//const int cacheSizes[1] = { 50 };
 
-	std::ofstream csv("test.csv");
+	ResultSink csv("test.csv", config->rawResults, { "Network Trace", "Type", "Cache Size (MB)" }, { "Stalling Duration" });
 	csv << "Stable State,Network Trace,Type,Cache Size (MB),Stalling Start,Stalling Duration\n";
 
 
@@ -334,169 +378,52 @@ int main(int argc, char* argv[])
 	netTraceDur = ts;
 	file.close();
 
-	for (int i = 0; i < 30; i++)
+	// traces are drawn up front so the selection does not depend on the order jobs run in
+	const int numStableStates = 30;
+	std::vector<std::vector<pathType>> stableStateTraces;
+	for (int i = 0; i < numStableStates; i++)
 	{
-		cacheInitTraces = tracePermutation(15);
-		for (auto traceStr : cacheInitTraces)
+		stableStateTraces.push_back(tracePermutation<pathType>(Config::instance()->headtracePath, 15, rng));
+		for (auto traceStr : stableStateTraces.back())
 			tracesUsed << strrchr(traceStr.c_str(), '/') << " ";
 		tracesUsed << std::endl;
-
-		for (auto currentCacheSize : cacheSizes)
-		for (auto& currentTrace : netTraces)
-		{
-			httpClient->Get("/bw/99999999");
-			editSquidConf("LFUDA", currentCacheSize);
-			resetSquidCache();
-			initCache(cacheInitTraces);
-			
-
-			std::cout << "SS: " << i << " " << currentTrace << " " << currentCacheSize << std::endl;
-			//httpClient->Get(("/trace/traces/" + currentTrace + ".down").c_str());
-
-			au->resetCacheHitrateVars();
-
-
-			
-			Config::instance()->popularity = true;
-			Config::instance()->viewportPrediction = false;
-			Config::instance()->transitions = false;
-			Config::instance()->bwAdaption = false;
-			//httpClient->Get("/tracereset");
-			auto startTime = TIME_NOW_EPOCH_MS;
-			auto playbackTime = 0;
-			auto stallTime = 0;
-			downloadTrace(cacheInitTraces[0], [&](int segment)
-			{
-				std::cout << "\rPopular " << segment + 1 << "/" << numSegments << std::flush;
-				auto tileQuality = au->getCurrentTileQuality();
-				playbackTime += computeSegmentDownloadTime(playbackTime, tileQuality, segment);
-				int stallTimeMs = playbackTime - ((segment + 1) * 1500 + stallTime);
-				if (stallTimeMs > 0)
-				{
-					stallTime += stallTimeMs;
-					csv << i << "," << currentTrace << ",Popular," << currentCacheSize << "," << playbackTime << "," << stallTimeMs << "\n";
-				}
-				else
-					playbackTime -= stallTimeMs;
-			});
-			csv.flush();			
-			std::cout << "   BHR " << au->byteHitrate() << std::endl;
-			au->resetCacheHitrateVars();
-
-
-
-			Config::instance()->popularity = true;
-			Config::instance()->viewportPrediction = true;
-			Config::instance()->transitions = true;
-			Config::instance()->bwAdaption = false;
-			//httpClient->Get("/tracereset");
-			startTime = TIME_NOW_EPOCH_MS;
-			playbackTime = 0;
-			stallTime = 0;
-			downloadTrace(evalTraces[i], [&](int segment)
-			{
-				std::cout << "\rTransition " << segment + 1 << "/" << numSegments << std::flush;
-				auto tileQuality = au->getCurrentTileQuality();
-				playbackTime += computeSegmentDownloadTime(playbackTime, tileQuality, segment);
-				int stallTimeMs = playbackTime - ((segment + 1) * 1500 + stallTime);
-				if (stallTimeMs > 0)
-				{
-					stallTime += stallTimeMs;
-					csv << i << "," << currentTrace << ",Transition," << currentCacheSize << "," << playbackTime << "," << stallTimeMs << "\n";
-				}
-				else
-					playbackTime -= stallTimeMs;
-			});
-			csv.flush();
-			std::cout << "   BHR " << au->byteHitrate() << std::endl;
-			au->resetCacheHitrateVars();
-
-
-
-			Config::instance()->popularity = false;
-			Config::instance()->viewportPrediction = true;
-			Config::instance()->transitions = false;
-			Config::instance()->bwAdaption = false;
-			//httpClient->Get("/tracereset");
-			startTime = TIME_NOW_EPOCH_MS;
-			playbackTime = 0;
-			stallTime = 0;
-			downloadTrace(evalTraces[i], [&](int segment)
-			{
-				std::cout << "\rPrediction " << segment + 1 << "/" << numSegments << std::flush;
-				auto tileQuality = au->getCurrentTileQuality();
-				playbackTime += computeSegmentDownloadTime(playbackTime, tileQuality, segment);
-				int stallTimeMs = playbackTime - ((segment + 1) * 1500 + stallTime);
-				if (stallTimeMs > 0)
-				{
-					stallTime += stallTimeMs;
-					csv << i << "," << currentTrace << ",Prediction," << currentCacheSize << "," << playbackTime  << "," << stallTimeMs << "\n";
-				}
-				else
-					playbackTime -= stallTimeMs;
-			});
-			csv.flush();
-			std::cout << "   BHR " << au->byteHitrate() << std::endl;
-			au->resetCacheHitrateVars();
-
-
-			
-			Config::instance()->popularity = false;
-			Config::instance()->viewportPrediction = true;
-			Config::instance()->transitions = false;
-			Config::instance()->bwAdaption = true;
-			//httpClient->Get("/tracereset");
-			startTime = TIME_NOW_EPOCH_MS;
-			playbackTime = 0;
-			stallTime = 0;
-			downloadTrace(evalTraces[i], [&](int segment)
-			{
-				std::cout << "\rPredictionBWA " << segment + 1 << "/" << numSegments << std::flush;
-				auto tileQuality = au->getCurrentTileQuality();
-				playbackTime += computeSegmentDownloadTime(playbackTime, tileQuality, segment);
-				int stallTimeMs = playbackTime - ((segment + 1) * 1500 + stallTime);
-				if (stallTimeMs > 0)
-				{
-					stallTime += stallTimeMs;
-					csv << i << "," << currentTrace << ",PredictionBWA," << currentCacheSize << "," << playbackTime << "," << stallTimeMs << "\n";
-				}
-				else
-					playbackTime -= stallTimeMs;
-			});
-			csv.flush();
-			std::cout << "   BHR " << au->byteHitrate() << std::endl;
-			au->resetCacheHitrateVars();
-
-
-
-
-			Config::instance()->popularity = false;
-			Config::instance()->viewportPrediction = false;
-			Config::instance()->transitions = false;
-			Config::instance()->bwAdaption = false;
-			//httpClient->Get("/tracereset");
-			startTime = TIME_NOW_EPOCH_MS;
-			playbackTime = 0;
-			stallTime = 0;
-			downloadTrace(cacheInitTraces[0], [&](int segment)
-			{
-				std::cout << "\rNaive " << segment + 1 << "/" << numSegments << std::flush;
-				auto tileQuality = std::map<int,int>();
-				playbackTime += computeSegmentDownloadTime(playbackTime, tileQuality, segment);
-				int stallTimeMs = playbackTime - ((segment + 1) * 1500 + stallTime);
-				if (stallTimeMs > 0)
-				{
-					stallTime += stallTimeMs;
-					csv << i << "," << currentTrace << ",Naive," << currentCacheSize << "," << playbackTime << "," << stallTimeMs << "\n";
-				}
-				else
-					playbackTime -= stallTimeMs;
-			});
-			csv.flush();
-			std::cout << "   BHR " << au->byteHitrate() << std::endl;
-			au->resetCacheHitrateVars();
-		}
 	}
+
+	// one job per stable state, cache size and network trace; squid and the real server only serve one at a time
+	const int numJobs = numStableStates * 4 * 1;
+	ExperimentRunner runner(config->simulation ? config->workers : 1);
+	runner.run(numJobs, [&](size_t job)
+	{
+		int i = job / (4 * 1);
+		int currentCacheSize = cacheSizes[job / 1 % 4];
+		auto& currentTrace = netTraces[job % 1];
+		auto& cacheInitTraces = stableStateTraces[i];
+
+		Session session(*Config::instance());
+		Config::Scope scope(session.config);
+		SimClock::setVirtual(session.config.simulation);
+		connect(session);
+		session.au.reset(new AdaptionUnit(mpd, session.httpClient.get(), session.httpClientDirect.get()));
+
+		session.httpClient->Get("/bw/99999999");
+		resetCache(session, "LFUDA", currentCacheSize);
+		initCache(session, cacheInitTraces);
+		//httpClient->Get(("/trace/traces/" + currentTrace + ".down").c_str());
+		session.au->resetCacheHitrateVars();
+
+		std::string rows;
+		setAdaption(true, false, false, false);
+		rows += measureStalling(session, cacheInitTraces[0], i, currentTrace, "Popular", currentCacheSize);
+		setAdaption(true, true, true, false);
+		rows += measureStalling(session, evalTraces[i], i, currentTrace, "Transition", currentCacheSize);
+		setAdaption(false, true, false, false);
+		rows += measureStalling(session, evalTraces[i], i, currentTrace, "Prediction", currentCacheSize);
+		setAdaption(false, true, false, true);
+		rows += measureStalling(session, evalTraces[i], i, currentTrace, "PredictionBWA", currentCacheSize);
+		setAdaption(false, false, false, false);
+		rows += measureStalling(session, cacheInitTraces[0], i, currentTrace, "Naive", currentCacheSize, true);
+		return rows;
+	}, csv);
 	csv.close();
 
 	return 0;
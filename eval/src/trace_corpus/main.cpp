@@ -0,0 +1,51 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Converts the text head traces below a folder into the corpus
+	traces.htc in that folder, which HeadTrace then maps instead of
+	parsing the text files. Run it again after changing a trace.
+*/
+#include <chrono>
+#include <iostream>
+#include <experimental/filesystem>
+#include "TraceCorpus.hpp"
+
+namespace fs = std::experimental::filesystem;
+
+int main(int argc, char* argv[])
+{
+	if (argc != 2)
+	{
+		std::cout << "Usage: " << argv[0] << " pathToHeadtraces" << std::endl;
+		return -1;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	fs::path root(argv[1]);
+	std::map<std::string, TraceCorpus::Samples> traces;
+	size_t samples = 0;
+	for (auto& f : fs::recursive_directory_iterator(root))
+	{
+		if (!fs::is_regular_file(f.path()) || f.path().extension() != ".txt")
+			continue;
+		// names are relative to the corpus folder with '/' on every system
+		std::string name = f.path().string().substr(root.string().size());
+		std::replace(name.begin(), name.end(), '\\', '/');
+		name.erase(0, name.find_first_not_of('/'));
+
+		auto trace = TraceCorpus::parseText(f.path().c_str());
+		samples += trace.t.size();
+		traces[name] = std::move(trace);
+	}
+
+	auto path = (root / TraceCorpus::fileName).string();
+	if (!TraceCorpus::write(path, traces))
+	{
+		std::cout << "Could not write " << path << std::endl;
+		return -1;
+	}
+	std::cout << traces.size() << " traces, " << samples << " samples to " << path << " in "
+		<< std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count() << " ms" << std::endl;
+	return 0;
+}
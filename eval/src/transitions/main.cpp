@@ -31,6 +31,7 @@
 #include "mpd.h"
 #include "AdaptionUnit.hpp"
 #include "HeadTrace.hpp"
+#include "ExperimentRunner.hpp"
 
 using namespace IMT;
 namespace fs = std::experimental::filesystem;
@@ -41,44 +42,13 @@ httplib::Client* httpClient;
 DASH::MPD* mpd;
 int numTiles;
 AdaptionUnit* au;
+// draws the head traces, seeded from the config
+std::mt19937 rng;
 
 const std::string netTrace = "Verizon-LTE-driving";
 
 typedef std::string pathType;
 
-std::vector<pathType> tracePermutation(int numTraces)
-{
-	std::vector<pathType> traces;
-
-	auto dirIt = fs::directory_iterator(Config::instance()->headtracePath);
-	auto dirItBegin = fs::begin(dirIt);
-	auto dirItEnd = fs::end(dirIt);
-	auto numFiles = std::distance(dirItBegin, dirItEnd);
-
-	std::set<int> traceIndices;
-	for (int i = 0; i < numTraces; i++)
-		while (!traceIndices.insert(std::rand() % numFiles).second);
-
-	int fi = 0;
-	for (auto& f : fs::directory_iterator(Config::instance()->headtracePath))
-	{
-		std::string p;
-#ifdef _WIN32
-		using convert_type = std::codecvt_utf8<wchar_t>;
-		std::wstring_convert<convert_type, wchar_t> converter;
-		p = converter.to_bytes(f.path());
-#else
-		p = f.path();
-#endif
-
-		if (traceIndices.find(fi) != traceIndices.end())
-			traces.push_back(p);
-		fi++;
-	}
-
-	return traces;
-}
-
 void downloadPopularTiles()
 {
 	// download init files
@@ -111,7 +81,7 @@ void downloadTrace(pathType pathToTrace, std::function<void(int, bool)> dlfun)
 	dlfun(0, transition);
 	au->stopAdaption();
 
-	int numSegments = mpd->period.adaptationSets[0].representations[0].segmentList.segmentUrls.size();
+	int numSegments = mpd->numSegments();
 	double frameRate = mpd->frameRate();
 	double segmentDuration = mpd->segmentDuration();
 	double segmentFrames = segmentDuration * frameRate;
@@ -156,22 +126,23 @@ int main(int argc, char* argv[])
 
 	auto config = Config::instance();
 	config->init(argv[1]);
+	rng.seed(config->seed);
 
 	httpClient = new httplib::Client(config->squidAddress.c_str(), config->squidPort);
 	//httpClient->proxyServer = true;
 
-	auto res = httpClient->Get(config->mpdUri.c_str());
-	if (!res || res->status != 200)
+	auto mpdContent = fetchMpd(*httpClient, config->mpdUri);
+	if (mpdContent.empty())
 	{
-		std::cout << "MPD not found " << res->status << std::endl;
+		std::cout << "MPD not found" << std::endl;
 		return -1;
 	}
-	mpd = new DASH::MPD(res->body);
+	mpd = new DASH::MPD(mpdContent);
 	au = new AdaptionUnit(mpd, httpClient);
 
 	auto srd = mpd->period.adaptationSets[0].srd;
 	numTiles = srd.th * srd.tv;
-	int numSegments = mpd->period.adaptationSets[0].representations[0].segmentList.segmentUrls.size();
+	int numSegments = mpd->numSegments();
 
 	
 	std::map<int, int> highQuality;
@@ -183,7 +154,7 @@ int main(int argc, char* argv[])
 	std::cout << "Trace set." << std::endl;
 
 	std::ofstream tracesUsed("tracesUsed.txt");
-	std::ofstream csv(netTrace + ".csv");
+	ResultSink csv(netTrace + ".csv", config->rawResults, {}, { "Transition" });
 	csv << "Iteration,Time,Transition\n";
 
 	Config::instance()->popularity = true;
@@ -192,7 +163,7 @@ int main(int argc, char* argv[])
 	for (int i = 0; i < 30; i++)
 	{
 		std::cout << "It: " << i << "/" << 30 << std::endl;
-		auto trace = tracePermutation(1)[0];
+		auto trace = tracePermutation<pathType>(Config::instance()->headtracePath, 1, rng)[0];
 		tracesUsed << split(trace, '/').back() << " ";
 		tracesUsed << "\n";
 
@@ -0,0 +1,157 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Fragmented mp4 of one tile representation, muxed into memory by
+	libavformat and cut into DASH segments in place of MP4Box. The
+	moov without samples is the initialization segment, every segment
+	is the one moof and mdat written when it is cut, so its first
+	sample is the key frame it starts with.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavformat/avio.h>
+}
+
+namespace IMT {
+namespace LibAv {
+
+class Fragmenter
+{
+public:
+	// segments are written to segmentPrefix followed by their number from 1 and ".m4s"
+	Fragmenter(const std::string& initPath, const std::string& segmentPrefix)
+		: initPath(initPath), segmentPrefix(segmentPrefix)
+	{
+	}
+
+	Fragmenter(const Fragmenter&) = delete;
+	Fragmenter& operator=(const Fragmenter&) = delete;
+
+	~Fragmenter()
+	{
+		if (fmtCtx)
+		{
+			if (fmtCtx->pb)
+			{
+				av_free(fmtCtx->pb->buffer);
+				avio_context_free(&fmtCtx->pb);
+			}
+			avformat_free_context(fmtCtx);
+		}
+	}
+
+	// writes the initialization segment for the opened encoder, which needs global headers
+	bool Open(const AVCodecContext* encoder, std::string& error)
+	{
+		timeBase = encoder->time_base;
+		if (avformat_alloc_output_context2(&fmtCtx, nullptr, "mp4", nullptr) < 0 || fmtCtx == nullptr)
+		{
+			error = "no mp4 muxer";
+			return false;
+		}
+		stream = avformat_new_stream(fmtCtx, nullptr);
+		if (stream == nullptr || avcodec_parameters_from_context(stream->codecpar, encoder) < 0)
+		{
+			error = "cannot add the stream";
+			return false;
+		}
+		stream->time_base = encoder->time_base;
+		stream->avg_frame_rate = encoder->framerate;
+
+		const int bufferSize = 1 << 16;
+		fmtCtx->pb = avio_alloc_context((unsigned char*)av_malloc(bufferSize), bufferSize, 1, this, nullptr, &Fragmenter::Write, nullptr);
+
+		// fragments are cut by Cut only, the moov is written up front and empty, there is no index and no mfra
+		AVDictionary* options = nullptr;
+		av_dict_set(&options, "movflags", "+dash+frag_custom+empty_moov+default_base_moof+skip_sidx+skip_trailer", 0);
+		int ret = avformat_write_header(fmtCtx, &options);
+		av_dict_free(&options);
+		if (ret < 0)
+		{
+			error = "cannot write the mp4 header";
+			return false;
+		}
+		avio_flush(fmtCtx->pb);
+		if (!Save(initPath))
+		{
+			error = "cannot write " + initPath;
+			return false;
+		}
+		return true;
+	}
+
+	// packet in the time base of the encoder, segment counts from 0. A packet of a later segment cuts the current one
+	bool Add(AVPacket* packet, int segment)
+	{
+		if (segment != current && current >= 0 && !Cut())
+			return false;
+		current = segment;
+		av_packet_rescale_ts(packet, timeBase, stream->time_base);
+		packet->stream_index = stream->index;
+		return av_write_frame(fmtCtx, packet) >= 0;
+	}
+
+	// cuts the last segment
+	bool Finish(void)
+	{
+		bool ok = current < 0 || Cut();
+		av_write_trailer(fmtCtx);
+		return ok;
+	}
+
+	// bytes of every segment written, the first one at index 0
+	const std::vector<uint32_t>& SegmentBytes(void) const { return segmentBytes; }
+
+private:
+	std::string initPath;
+	std::string segmentPrefix;
+	AVFormatContext* fmtCtx = nullptr;
+	AVStream* stream = nullptr;
+	AVRational timeBase;
+	std::vector<uint8_t> pending;
+	std::vector<uint32_t> segmentBytes;
+	int current = -1;
+
+#if LIBAVFORMAT_VERSION_MAJOR >= 61
+	static int Write(void* opaque, const uint8_t* data, int size)
+#else
+	static int Write(void* opaque, uint8_t* data, int size)
+#endif
+	{
+		auto self = (Fragmenter*)opaque;
+		self->pending.insert(self->pending.end(), data, data + size);
+		return size;
+	}
+
+	bool Cut(void)
+	{
+		// a null packet writes the fragment of the packets so far
+		if (av_write_frame(fmtCtx, nullptr) < 0)
+			return false;
+		avio_flush(fmtCtx->pb);
+		segmentBytes.push_back((uint32_t)pending.size());
+		return Save(segmentPrefix + std::to_string(segmentBytes.size()) + ".m4s");
+	}
+
+	bool Save(const std::string& path)
+	{
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		file.write((const char*)pending.data(), pending.size());
+		pending.clear();
+		return (bool)file;
+	}
+};
+
+}
+}
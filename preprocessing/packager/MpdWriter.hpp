@@ -0,0 +1,112 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	The MPD of the packaged tiles and their segment size index, as
+	tile_and_dash.py writes them after merging the MPDs of MP4Box.
+	One adaptation set per tile with its SRD, one representation per
+	quality. Their segments are named by a <SegmentTemplate> of the
+	adaptation set. The Period refers to the size index and holds an
+	empty <Popularity> element that 360popularity fills in.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+namespace MpdWriter
+{
+	struct Representation
+	{
+		std::string id;
+		int width, height;
+		std::string codecs;
+		// bytes of every segment, from the first one on
+		std::vector<uint32_t> segmentBytes;
+	};
+
+	struct Tile
+	{
+		int x, y, width, height;
+		std::vector<Representation> representations;
+	};
+
+	// ISO 8601 duration of ms
+	inline std::string duration(long long ms)
+	{
+		char text[48];
+		snprintf(text, sizeof(text), "PT%lldH%lldM%lld.%03lldS", ms / 3600000, ms / 60000 % 60, ms / 1000 % 60, ms % 1000);
+		return text;
+	}
+
+	// layout of SegmentSizeIndex.hpp: magic, segments, tiles and qualities, then the bytes per segment, tile and quality
+	inline bool writeSizes(const std::string& path, const std::vector<Tile>& tiles)
+	{
+		uint32_t segments = 0, qualities = 0;
+		for (auto& tile : tiles)
+		{
+			qualities = std::max<uint32_t>(qualities, (uint32_t)tile.representations.size());
+			for (auto& rep : tile.representations)
+				segments = std::max<uint32_t>(segments, (uint32_t)rep.segmentBytes.size());
+		}
+
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		uint32_t header[3] = { segments, (uint32_t)tiles.size(), qualities };
+		file.write("SEGSIZE1", 8);
+		file.write((const char*)header, sizeof(header));
+		for (uint32_t s = 0; s < segments; s++)
+			for (auto& tile : tiles)
+				for (uint32_t q = 0; q < qualities; q++)
+				{
+					uint32_t bytes = q < tile.representations.size() && s < tile.representations[q].segmentBytes.size()
+						? tile.representations[q].segmentBytes[s] : 0;
+					file.write((const char*)&bytes, 4);
+				}
+		return (bool)file;
+	}
+
+	// media is the segment template relative to the MPD, with $RepresentationID$ and $Number$ and without extension
+	inline bool write(const std::string& path, const std::vector<Tile>& tiles, int columns, int rows, int frameRate,
+		int segmentMs, long long lengthMs, const std::string& media, const std::string& sizesUrl)
+	{
+		std::ostringstream xml;
+		xml << "<?xml version=\"1.0\" encoding=\"utf8\"?>\n"
+			<< "<MPD xmlns=\"urn:mpeg:dash:schema:mpd:2011\" minBufferTime=\"" << duration(segmentMs) << "\" type=\"static\""
+			<< " mediaPresentationDuration=\"" << duration(lengthMs) << "\" profiles=\"urn:mpeg:dash:profile:full:2011\">\n"
+			<< "\t<Period duration=\"" << duration(lengthMs) << "\">\n"
+			<< "\t\t<Popularity/>\n";
+		for (size_t i = 0; i < tiles.size(); i++)
+		{
+			auto& tile = tiles[i];
+			xml << "\t\t<AdaptationSet segmentAlignment=\"true\" maxWidth=\"" << tile.width << "\" maxHeight=\"" << tile.height
+				<< "\" maxFrameRate=\"" << frameRate << "\">\n"
+				<< "\t\t\t<SupplementalProperty schemeIdUri=\"urn:mpeg:dash:srd:2014\" value=\"" << i << "," << tile.x << "," << tile.y
+				<< "," << tile.width << "," << tile.height << "," << columns << "," << rows << "\"/>\n"
+				<< "\t\t\t<SegmentTemplate timescale=\"1000\" duration=\"" << segmentMs << "\" startNumber=\"1\" media=\"" << media
+				<< ".m4s\" initialization=\"" << media.substr(0, media.find("$Number$")) << "init.mp4\"/>\n";
+			for (auto& rep : tile.representations)
+			{
+				uint64_t bytes = 0;
+				for (auto b : rep.segmentBytes)
+					bytes += b;
+				xml << "\t\t\t<Representation id=\"" << rep.id << "\" mimeType=\"video/mp4\" codecs=\"" << rep.codecs
+					<< "\" width=\"" << rep.width << "\" height=\"" << rep.height << "\" frameRate=\"" << frameRate
+					<< "\" sar=\"1:1\" startWithSAP=\"1\" bandwidth=\"" << (lengthMs > 0 ? bytes * 8000 / lengthMs : 0) << "\"/>\n";
+			}
+			xml << "\t\t</AdaptationSet>\n";
+		}
+		xml << "\t\t<SupplementalProperty schemeIdUri=\"urn:360transitions:segmentsizes\" value=\"" << sizesUrl << "\"/>\n"
+			<< "\t</Period>\n"
+			<< "</MPD>\n";
+
+		std::ofstream file(path, std::ios::trunc);
+		file << xml.str();
+		return (bool)file;
+	}
+}
@@ -0,0 +1,261 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Encoder of one tile in one quality on a thread of its own. It is
+	handed references to the decoded pictures of the whole video,
+	crops its region out of them without copying, scales it if its
+	quality has a lower resolution and encodes it with libx264. Key
+	frames are forced at every segment start, the packets go straight
+	to the tile's Fragmenter.
+*/
+
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <thread>
+#include <cstdio>
+#include <condition_variable>
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+#include <libavutil/opt.h>
+#include <libswscale/swscale.h>
+}
+
+#include "Fragmenter.hpp"
+
+namespace IMT {
+namespace LibAv {
+
+class TileEncoder
+{
+public:
+	struct Settings
+	{
+		// region of the tile in the source picture, the size it is encoded in
+		int x, y, cropWidth, cropHeight;
+		int width, height;
+		// frames per second of the output and frames per segment, every segment starts with a key frame
+		int frameRate;
+		int segmentFrames;
+		// constant rate factor of libx264
+		double crf;
+		int threads;
+		std::string initPath;
+		std::string segmentPrefix;
+	};
+
+	// pictures the decoder may be ahead of this encoder
+	static const size_t queueSize = 8;
+
+	explicit TileEncoder(const Settings& settings) : settings(settings), fragmenter(settings.initPath, settings.segmentPrefix)
+	{
+	}
+
+	TileEncoder(const TileEncoder&) = delete;
+	TileEncoder& operator=(const TileEncoder&) = delete;
+
+	~TileEncoder()
+	{
+		Finish();
+		for (auto& entry : queue)
+			av_frame_free(&entry.first);
+		av_frame_free(&scaled);
+		av_packet_free(&packet);
+		sws_freeContext(swsCtx);
+		avcodec_free_context(&codecCtx);
+	}
+
+	// opens the encoder, writes the initialization segment and starts the thread
+	bool Open(std::string& error)
+	{
+		const AVCodec* codec = avcodec_find_encoder_by_name("libx264");
+		if (codec == nullptr)
+		{
+			error = "ffmpeg is built without libx264";
+			return false;
+		}
+		codecCtx = avcodec_alloc_context3(codec);
+		codecCtx->width = settings.width;
+		codecCtx->height = settings.height;
+		codecCtx->pix_fmt = AV_PIX_FMT_YUV420P;
+		codecCtx->time_base = { 1, settings.frameRate };
+		codecCtx->framerate = { settings.frameRate, 1 };
+		codecCtx->gop_size = settings.segmentFrames;
+		codecCtx->keyint_min = settings.segmentFrames;
+		codecCtx->thread_count = settings.threads;
+		// the parameter sets go into the moov instead of every key frame
+		codecCtx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+		av_opt_set_double(codecCtx->priv_data, "crf", settings.crf, 0);
+		av_opt_set_int(codecCtx->priv_data, "forced-idr", 1, 0);
+		std::string params = "keyint=" + std::to_string(settings.segmentFrames) + ":min-keyint=" + std::to_string(settings.segmentFrames) + ":scenecut=-1";
+		av_opt_set(codecCtx->priv_data, "x264-params", params.c_str(), 0);
+		if (avcodec_open2(codecCtx, codec, nullptr) < 0)
+		{
+			error = "cannot open libx264 for " + settings.initPath;
+			return false;
+		}
+
+		if (settings.width != settings.cropWidth || settings.height != settings.cropHeight)
+		{
+			swsCtx = sws_getContext(settings.cropWidth, settings.cropHeight, AV_PIX_FMT_YUV420P,
+				settings.width, settings.height, AV_PIX_FMT_YUV420P, SWS_BICUBIC, nullptr, nullptr, nullptr);
+			scaled = av_frame_alloc();
+			scaled->format = AV_PIX_FMT_YUV420P;
+			scaled->width = settings.width;
+			scaled->height = settings.height;
+			if (swsCtx == nullptr || av_frame_get_buffer(scaled, 0) < 0)
+			{
+				error = "cannot scale to " + std::to_string(settings.width) + "x" + std::to_string(settings.height);
+				return false;
+			}
+		}
+
+		packet = av_packet_alloc();
+		if (!fragmenter.Open(codecCtx, error))
+			return false;
+		worker = std::thread(&TileEncoder::Run, this);
+		return true;
+	}
+
+	// output frame index of a YUV 4:2:0 picture of the source, which stays owned by the caller. Blocks while the
+	// encoder is queueSize pictures behind
+	void Push(const AVFrame* picture, int64_t index)
+	{
+		AVFrame* ref = av_frame_clone(picture);
+		std::unique_lock<std::mutex> lock(mtx);
+		space.wait(lock, [this] { return queue.size() < queueSize; });
+		queue.emplace_back(ref, index);
+		ready.notify_one();
+	}
+
+	// encodes what is queued, flushes the encoder and cuts the last segment
+	void Finish(void)
+	{
+		if (!worker.joinable())
+			return;
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			queue.emplace_back(nullptr, -1);
+			ready.notify_one();
+		}
+		worker.join();
+	}
+
+	// empty unless encoding failed
+	const std::string& Error(void) const { return error; }
+	const std::vector<uint32_t>& SegmentBytes(void) const { return fragmenter.SegmentBytes(); }
+
+	// RFC 6381 codecs string from the SPS of the encoder
+	std::string Codecs(void) const
+	{
+		const uint8_t* data = codecCtx->extradata;
+		for (int i = 0; i + 6 < codecCtx->extradata_size; i++)
+			if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1 && (data[i + 3] & 0x1f) == 7)
+			{
+				char codecs[16];
+				snprintf(codecs, sizeof(codecs), "avc1.%02x%02x%02x", data[i + 4], data[i + 5], data[i + 6]);
+				return codecs;
+			}
+		return "avc1";
+	}
+
+private:
+	Settings settings;
+	Fragmenter fragmenter;
+	AVCodecContext* codecCtx = nullptr;
+	SwsContext* swsCtx = nullptr;
+	AVFrame* scaled = nullptr;
+	AVPacket* packet = nullptr;
+	std::thread worker;
+	std::mutex mtx;
+	std::condition_variable ready, space;
+	// references to source pictures with their output frame index, a null picture ends the stream
+	std::deque<std::pair<AVFrame*, int64_t>> queue;
+	std::string error;
+
+	void Run(void)
+	{
+		while (true)
+		{
+			std::pair<AVFrame*, int64_t> entry;
+			{
+				std::unique_lock<std::mutex> lock(mtx);
+				ready.wait(lock, [this] { return !queue.empty(); });
+				entry = queue.front();
+				queue.pop_front();
+				space.notify_one();
+			}
+			if (entry.first == nullptr)
+				break;
+			if (error.empty())
+				Encode(entry.first, entry.second);
+			av_frame_free(&entry.first);
+		}
+
+		if (error.empty())
+		{
+			avcodec_send_frame(codecCtx, nullptr);
+			Drain();
+		}
+		if (!fragmenter.Finish() && error.empty())
+			error = "cannot write the last segment of " + settings.segmentPrefix;
+	}
+
+	void Encode(AVFrame* picture, int64_t index)
+	{
+		// the crop only moves the plane pointers of the reference
+		picture->crop_left = settings.x;
+		picture->crop_top = settings.y;
+		picture->crop_right = picture->width - settings.x - settings.cropWidth;
+		picture->crop_bottom = picture->height - settings.y - settings.cropHeight;
+		if (av_frame_apply_cropping(picture, AV_FRAME_CROP_UNALIGNED) < 0)
+		{
+			error = "cannot crop " + settings.initPath;
+			return;
+		}
+
+		AVFrame* input = picture;
+		if (swsCtx)
+		{
+			// the encoder may still hold the last picture
+			if (av_frame_make_writable(scaled) < 0)
+			{
+				error = "out of memory";
+				return;
+			}
+			sws_scale(swsCtx, picture->data, picture->linesize, 0, settings.cropHeight, scaled->data, scaled->linesize);
+			input = scaled;
+		}
+
+		input->pts = index;
+		input->pict_type = index % settings.segmentFrames == 0 ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+		if (avcodec_send_frame(codecCtx, input) < 0)
+		{
+			error = "cannot encode " + settings.initPath;
+			return;
+		}
+		Drain();
+	}
+
+	void Drain(void)
+	{
+		while (avcodec_receive_packet(codecCtx, packet) == 0)
+		{
+			// packets come in decode order, the key frame of a segment is the first of it
+			int segment = (int)(packet->pts / settings.segmentFrames);
+			if (!fragmenter.Add(packet, segment))
+				error = "cannot write a segment of " + settings.segmentPrefix;
+			av_packet_unref(packet);
+		}
+	}
+};
+
+}
+}
@@ -0,0 +1,290 @@
+/*
+	Author: Arne-Tobias Rak
+	TU Darmstadt
+
+	Tiles an equirectangular video and packages it for DASH in one
+	process, in place of the ffmpeg and MP4Box runs of tile_and_dash.py.
+	The source is decoded once; every decoded picture is handed to one
+	encoder per tile and quality, which run in parallel and fragment
+	their segments in memory. The MPD with the SRD of every tile, the
+	segment size index and a popularity placeholder are written at the
+	end.
+*/
+
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+#include <thread>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <experimental/filesystem>
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libswscale/swscale.h>
+}
+
+#include "TileEncoder.hpp"
+#include "MpdWriter.hpp"
+
+using namespace IMT::LibAv;
+namespace fs = std::experimental::filesystem;
+
+// the defaults of tile_and_dash.py
+struct Options
+{
+	std::string video;
+	int htiles = 4;
+	int vtiles = 4;
+	int segmentMs = 1500;
+	std::vector<double> bitrateLevels = { 1, 0.25, 0.0625 };
+	std::vector<double> resolutionLevels = { 1, 1, 0.5 };
+	double startFrom = 40;
+	double outLength = 30;
+	// rate factor of the first bitrate level
+	double crf = 23;
+};
+
+std::vector<double> parseList(const std::string& text)
+{
+	std::vector<double> values;
+	std::istringstream ss(text);
+	std::string value;
+	while (std::getline(ss, value, ','))
+		values.push_back(std::stod(value));
+	return values;
+}
+
+bool parseOptions(int argc, char* argv[], Options& options)
+{
+	if (argc < 2)
+		return false;
+	options.video = argv[1];
+	for (int i = 2; i + 1 < argc; i += 2)
+	{
+		std::string name = argv[i], value = argv[i + 1];
+		if (name == "--tiles")
+		{
+			char x;
+			std::istringstream(value) >> options.htiles >> x >> options.vtiles;
+		}
+		else if (name == "--segment")
+			options.segmentMs = std::stoi(value);
+		else if (name == "--bitrates")
+			options.bitrateLevels = parseList(value);
+		else if (name == "--resolutions")
+			options.resolutionLevels = parseList(value);
+		else if (name == "--start")
+			options.startFrom = std::stod(value);
+		else if (name == "--length")
+			options.outLength = std::stod(value);
+		else if (name == "--crf")
+			options.crf = std::stod(value);
+		else
+			return false;
+	}
+	return options.htiles > 0 && options.vtiles > 0 && options.segmentMs > 0 && !options.bitrateLevels.empty()
+		&& options.resolutionLevels.size() == options.bitrateLevels.size();
+}
+
+// the rate factor of a bitrate level, libx264 halves the rate about every 6 steps
+double levelCrf(double crf, double level)
+{
+	return std::min(51.0, std::max(0.0, crf - 6 * std::log2(level)));
+}
+
+int main(int argc, char* argv[])
+{
+	Options options;
+	if (!parseOptions(argc, argv, options))
+	{
+		std::cout << "Start with the path of the video, optionally followed by --tiles 4x4, --segment [ms], --bitrates 1,0.25,0.0625, "
+			"--resolutions 1,1,0.5, --start [s], --length [s] and --crf [rate factor of the first bitrate]" << std::endl;
+		return -1;
+	}
+
+	AVFormatContext* fmtCtx = nullptr;
+	if (avformat_open_input(&fmtCtx, options.video.c_str(), nullptr, nullptr) < 0 || avformat_find_stream_info(fmtCtx, nullptr) < 0)
+	{
+		std::cout << "cannot open " << options.video << std::endl;
+		return -1;
+	}
+	int streamId = av_find_best_stream(fmtCtx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+	if (streamId < 0)
+	{
+		std::cout << options.video << " has no video" << std::endl;
+		return -1;
+	}
+	AVStream* stream = fmtCtx->streams[streamId];
+	const AVCodec* decoder = avcodec_find_decoder(stream->codecpar->codec_id);
+	AVCodecContext* decodeCtx = avcodec_alloc_context3(decoder);
+	avcodec_parameters_to_context(decodeCtx, stream->codecpar);
+	decodeCtx->thread_count = 0;
+	if (avcodec_open2(decodeCtx, decoder, nullptr) < 0)
+	{
+		std::cout << "cannot decode " << options.video << std::endl;
+		return -1;
+	}
+
+	int width = decodeCtx->width;
+	int height = decodeCtx->height;
+	AVRational rate = av_guess_frame_rate(fmtCtx, stream, nullptr);
+	double fps = av_q2d(rate);
+	int frameRate = (int)std::ceil(fps);
+	int keyint = (int)(frameRate * (options.segmentMs / 1000.0));
+	int64_t frames = (int64_t)(options.outLength * frameRate);
+	std::cout << "Video resolution: " << width << "x" << height << std::endl;
+	std::cout << "Video fps: " << fps << std::endl;
+	if (keyint <= 0 || frames <= 0)
+	{
+		std::cout << "segments and video must be at least a frame long" << std::endl;
+		return -1;
+	}
+
+	// the chroma planes of a tile start and end on full samples
+	int twidth = width / options.htiles / 2 * 2;
+	int theight = height / options.vtiles / 2 * 2;
+	std::cout << "Tile resolution: " << twidth << "x" << theight << std::endl;
+
+	fs::path video(options.video);
+	std::string vidname = (video.parent_path() / video.stem()).string();
+	std::string foldername = vidname + "_dash";
+	fs::create_directories(foldername);
+
+	// tiles are numbered column by column like the SRDs of the script
+	std::vector<MpdWriter::Tile> tiles;
+	std::vector<std::unique_ptr<TileEncoder>> encoders;
+	size_t numEncoders = options.htiles * options.vtiles * options.bitrateLevels.size();
+	int threads = std::max(1, (int)(std::thread::hardware_concurrency() / numEncoders));
+	for (int x = 0; x < options.htiles; x++)
+		for (int y = 0; y < options.vtiles; y++)
+		{
+			int i = (int)tiles.size();
+			tiles.push_back({ x * twidth, y * theight, twidth, theight, {} });
+			for (size_t b = 0; b < options.bitrateLevels.size(); b++)
+			{
+				MpdWriter::Representation rep;
+				rep.id = "t" + std::to_string(i) + "q" + std::to_string(b);
+				rep.width = std::max(2, (int)(twidth * options.resolutionLevels[b]) / 2 * 2);
+				rep.height = std::max(2, (int)(theight * options.resolutionLevels[b]) / 2 * 2);
+				tiles.back().representations.push_back(rep);
+
+				TileEncoder::Settings settings;
+				settings.x = x * twidth;
+				settings.y = y * theight;
+				settings.cropWidth = twidth;
+				settings.cropHeight = theight;
+				settings.width = rep.width;
+				settings.height = rep.height;
+				settings.frameRate = frameRate;
+				settings.segmentFrames = keyint;
+				settings.crf = levelCrf(options.crf, options.bitrateLevels[b] / options.bitrateLevels[0]);
+				settings.threads = threads;
+				settings.initPath = foldername + "/" + rep.id + "_init.mp4";
+				settings.segmentPrefix = foldername + "/" + rep.id + "_";
+				encoders.emplace_back(new TileEncoder(settings));
+				std::string error;
+				if (!encoders.back()->Open(error))
+				{
+					std::cout << error << std::endl;
+					return -1;
+				}
+			}
+		}
+
+	// the encoders take 4:2:0 pictures of the full size
+	SwsContext* swsCtx = nullptr;
+	if (decodeCtx->pix_fmt != AV_PIX_FMT_YUV420P && decodeCtx->pix_fmt != AV_PIX_FMT_YUVJ420P)
+		swsCtx = sws_getContext(width, height, decodeCtx->pix_fmt, width, height, AV_PIX_FMT_YUV420P, SWS_BICUBIC, nullptr, nullptr, nullptr);
+
+	int64_t streamStart = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+	av_seek_frame(fmtCtx, streamId, av_rescale_q((int64_t)(options.startFrom * AV_TIME_BASE), AV_TIME_BASE_Q, stream->time_base) + streamStart, AVSEEK_FLAG_BACKWARD);
+
+	AVPacket* packet = av_packet_alloc();
+	AVFrame* frame = av_frame_alloc();
+	int64_t next = 0;
+	bool flushed = false;
+	while (next < frames && !flushed)
+	{
+		int ret = av_read_frame(fmtCtx, packet);
+		if (ret < 0)
+		{
+			avcodec_send_packet(decodeCtx, nullptr);
+			flushed = true;
+		}
+		else
+		{
+			if (packet->stream_index == streamId)
+				avcodec_send_packet(decodeCtx, packet);
+			av_packet_unref(packet);
+		}
+
+		while (next < frames && avcodec_receive_frame(decodeCtx, frame) == 0)
+		{
+			// constant frames per second like the fps filter: an output frame shows the picture nearest to its time
+			double t = (frame->best_effort_timestamp - streamStart) * av_q2d(stream->time_base) - options.startFrom;
+			AVFrame* picture = frame;
+			AVFrame* converted = nullptr;
+			if (swsCtx && next / (double)frameRate < t + 0.5 / fps)
+			{
+				converted = av_frame_alloc();
+				converted->format = AV_PIX_FMT_YUV420P;
+				converted->width = width;
+				converted->height = height;
+				av_frame_get_buffer(converted, 0);
+				sws_scale(swsCtx, frame->data, frame->linesize, 0, height, converted->data, converted->linesize);
+				picture = converted;
+			}
+			for (; next < frames && next / (double)frameRate < t + 0.5 / fps; next++)
+				for (auto& encoder : encoders)
+					encoder->Push(picture, next);
+			av_frame_free(&converted);
+			av_frame_unref(frame);
+
+			if (next % keyint == 0 && next > 0)
+				std::cout << "\r" << next << "/" << frames << " frames" << std::flush;
+		}
+	}
+	std::cout << std::endl;
+
+	bool failed = false;
+	for (size_t e = 0; e < encoders.size(); e++)
+	{
+		encoders[e]->Finish();
+		if (!encoders[e]->Error().empty())
+		{
+			std::cout << encoders[e]->Error() << std::endl;
+			failed = true;
+		}
+		auto& rep = tiles[e / options.bitrateLevels.size()].representations[e % options.bitrateLevels.size()];
+		rep.segmentBytes = encoders[e]->SegmentBytes();
+		rep.codecs = encoders[e]->Codecs();
+	}
+
+	av_frame_free(&frame);
+	av_packet_free(&packet);
+	sws_freeContext(swsCtx);
+	avcodec_free_context(&decodeCtx);
+	avformat_close_input(&fmtCtx);
+	if (failed)
+		return -1;
+
+	// the MPD and the index sit next to the folder of the segments, the urls are relative to them
+	std::string sizesFile = vidname + ".sizes";
+	long long lengthMs = next * 1000 / frameRate;
+	std::string base = video.stem().string();
+	if (!MpdWriter::writeSizes(sizesFile, tiles)
+		|| !MpdWriter::write(vidname + ".mpd", tiles, options.htiles, options.vtiles, frameRate, options.segmentMs, lengthMs,
+			base + "_dash/$RepresentationID$_$Number$", base + ".sizes"))
+	{
+		std::cout << "cannot write " << vidname << ".mpd" << std::endl;
+		return -1;
+	}
+
+	std::cout << "done" << std::endl;
+	return 0;
+}
@@ -5,14 +5,18 @@ htiles = 4
 vtiles = 4
 segmentDuration = 1500 # ms
 bitrateLevels = [ 1, 0.25, 0.0625 ]
+resolutionLevels = [ 1, 1, 0.5 ] # tile resolution of each bitrate level (# times tile resolution)
 startFrom = 40
 outLength = 30
+mcts = False # every quality as one HEVC picture of motion constrained tiles (libkvazaar), the player decodes them merged
 #############################################################
 
 import subprocess
 import sys
 import re
 import os
+import math
+import struct
 import xml.etree.ElementTree as ET
 from shutil import copyfile
 
@@ -23,6 +27,13 @@ def probeFile(file, properties):
     out = out.decode("utf-8")
     return list(map(int, re.findall(r'\d+', out))),err
 
+# crops tile x,y and scales it to the resolution of level b, even sizes for the chroma planes
+def tileFilter(b, x, y):
+    swidth = int(twidth * resolutionLevels[b]) // 2 * 2
+    sheight = int(theight * resolutionLevels[b]) // 2 * 2
+    scale = "" if resolutionLevels[b] == 1 else ",scale=%d:%d" % (swidth, sheight)
+    return "crop=%d:%d:%d:%d%s,fps=%d" % (twidth, theight, x * twidth, y * theight, scale, math.ceil(fps))
+
 def runProc(query):
     FNULL = open(os.devnull, 'w')
     proc = subprocess.Popen(query, stdout=FNULL, stderr=subprocess.STDOUT)
@@ -43,6 +54,13 @@ print("Video fps: " + str(fps))
 
 twidth = int(width / htiles)
 theight = int(height / vtiles)
+if mcts:
+    # the tiles of the picture end at coding tree blocks, kvazaar codes them 64x64
+    twidth = twidth // 64 * 64
+    theight = theight // 64 * 64
+    if any(r != 1 for r in resolutionLevels) or twidth == 0 or theight == 0:
+        print("mcts needs resolutionLevels of 1 and tiles of at least 64x64")
+        sys.exit()
 print("Tile resolution: " + str(twidth) + "x" + str(theight))
 
 if not os.path.isdir("tmp"):
@@ -70,9 +88,84 @@ for i in range(0, len(bitrateLevels)):
     # print("\r%d/%d encoded" % (i+1, len(bitrateLevels)), end='')
 # print("")
 
+# NAL units of an Annex B stream, without their start codes
+def nalUnits(data):
+    starts = [m.end() for m in re.finditer(b'\x00\x00\x01', data)]
+    for i in range(0, len(starts)):
+        end = starts[i + 1] - 3 if i + 1 < len(starts) else len(data)
+        # zeros before the next start code are its four byte form, a NAL unit ends with its stop bit
+        yield data[starts[i]:end].rstrip(b'\x00')
+
+# access units of an HEVC stream, each as its parameter sets and prefix SEI and its slices in tile order
+def accessUnits(data):
+    prefix, slices = [], []
+    for nal in nalUnits(data):
+        nalType = (nal[0] >> 1) & 0x3f
+        if nalType < 32:
+            # first_slice_segment_in_pic_flag
+            if nal[2] & 0x80 and slices:
+                yield prefix, slices
+                prefix, slices = [], []
+            slices.append(nal)
+        elif nalType == 38 or nalType == 40:
+            # filler data and suffix SEI describe the whole picture, the tile streams go without them
+            continue
+        else:
+            if slices:
+                yield prefix, slices
+                prefix, slices = [], []
+            prefix.append(nal)
+    if slices:
+        yield prefix, slices
+
+# writes every motion constrained tile of hevcfile to its IVF file in ivffiles, each frame of a tile holds the
+# parameter sets of the picture and the slices of that tile with their addresses in the picture. IVF keeps the frames
+# apart, a raw stream would be cut into pictures at first_slice_segment_in_pic_flag, which only the first tile has
+def splitTiles(hevcfile, ivffiles):
+    with open(hevcfile, 'rb') as f:
+        units = list(accessUnits(f.read()))
+    rate = math.ceil(fps)
+    for t in range(0, len(ivffiles)):
+        with open(ivffiles[t], 'wb') as ivf:
+            ivf.write(b'DKIF' + struct.pack('<HH4sHHIIII', 0, 32, b'HEVC', htiles * twidth, vtiles * theight, rate, 1, len(units), 0))
+            for pts in range(0, len(units)):
+                prefix, slices = units[pts]
+                if len(slices) != len(ivffiles):
+                    print("frame %d of %s has %d slices instead of one per tile" % (pts, hevcfile, len(slices)))
+                    sys.exit()
+                frame = b''.join(b'\x00\x00\x00\x01' + nal for nal in prefix + [slices[t]])
+                ivf.write(struct.pack('<IQ', len(frame), pts) + frame)
+
+# encodes the whole picture at bitrate, 0 for the default QP, with one HEVC tile per tile and motion vectors that stay
+# inside their tile.
+# All qualities are rate controlled with the same settings so they share their parameter sets, intra frames repeat them
+def encodeMcts(hevcfile, bitrate):
+    params = "tiles=%dx%d:slices=tiles:mv-constraint=frametilemargin:wpp=0:period=%d:open-gop=0:gop=lp-g4d3t1:vps-period=1:hash=none:bitrate=%d" % \
+        (htiles, vtiles, keyint, keyint, bitrate)
+    runProc("ffmpeg -i %s -filter:v \"crop=%d:%d:0:0,fps=%d\" -codec:v libkvazaar -kvazaar-params %s -an -ss %d -t %d -f hevc -y %s" % \
+        (vidfile, htiles * twidth, vtiles * theight, math.ceil(fps), params, startFrom, outLength, hevcfile))
+
+# the rate of the full quality is what kvazaar spends at its default QP
+referencefile = "tmp\\%s_qp.hevc" % (vidname)
+if mcts and not os.path.isfile(referencefile):
+    encodeMcts(referencefile, 0)
+picturebr = os.path.getsize(referencefile) * 8 // outLength if mcts else 0
+
 print("Cropping...")
 counter = 0
-for x in range(0, htiles):
+for b in range(0, len(bitrateLevels) if mcts else 0):
+    croppedfiles = ["tmp\\%s_%d_%d_%d.mp4" % (vidname, b, t % htiles, t // htiles) for t in range(0, htiles * vtiles)]
+    counter = counter + len(croppedfiles)
+    if all(os.path.isfile(f) for f in croppedfiles):
+        continue
+    hevcfile = "tmp\\%s_%d.hevc" % (vidname, b)
+    encodeMcts(hevcfile, int(picturebr * bitrateLevels[b]))
+    ivffiles = [f[:-4] + ".ivf" for f in croppedfiles]
+    splitTiles(hevcfile, ivffiles)
+    for t in range(0, len(croppedfiles)):
+        runProc("ffmpeg -i %s -codec:v copy -y %s" % (ivffiles[t], croppedfiles[t]))
+    print("\r%d/%d cropped" % (counter, htiles * vtiles * len(bitrateLevels)), end='')
+for x in range(0, htiles if not mcts else 0):
     for y in range(0, vtiles):
         tilebr = -1
         for b in range(0, len(bitrateLevels)):
@@ -84,15 +177,15 @@ for x in range(0, htiles):
                 print("\r%d/%d cropped" % (counter, htiles * vtiles * len(bitrateLevels)), end='')
                 continue
             if tilebr == -1:
-                runProc("ffmpeg -i %s -filter:v \"crop=%d:%d:%d:%d,fps=%d\" -codec:v libx264 -x264opts keyint=%d:min-keyint=%d:scenecut=-1 -an -ss %d -t %d -y %s" % \
-                    (tmpvidfile, twidth, theight, x * twidth, y * theight, math.ceil(fps), keyint, keyint, startFrom, outLength, croppedfile))
+                runProc("ffmpeg -i %s -filter:v \"%s\" -codec:v libx264 -x264opts keyint=%d:min-keyint=%d:scenecut=-1 -an -ss %d -t %d -y %s" % \
+                    (tmpvidfile, tileFilter(b, x, y), keyint, keyint, startFrom, outLength, croppedfile))
                 tilebr = probeFile(croppedfile, "bit_rate")[0][0]
                 if not bitrateLevels[b] == 1:
-                    runProc("ffmpeg -i %s -b %d -filter:v \"crop=%d:%d:%d:%d,fps=%d\" -codec:v libx264 -x264opts keyint=%d:min-keyint=%d:scenecut=-1 -an -ss %d -t %d -y %s" % \
-                        (tmpvidfile, tilebr * bitrateLevels[b], twidth, theight, x * twidth, y * theight, math.ceil(fps), keyint, keyint, startFrom, outLength, croppedfile))
+                    runProc("ffmpeg -i %s -b %d -filter:v \"%s\" -codec:v libx264 -x264opts keyint=%d:min-keyint=%d:scenecut=-1 -an -ss %d -t %d -y %s" % \
+                        (tmpvidfile, tilebr * bitrateLevels[b], tileFilter(b, x, y), keyint, keyint, startFrom, outLength, croppedfile))
             else:
-                runProc("ffmpeg -i %s -b %d -filter:v \"crop=%d:%d:%d:%d,fps=%d\" -codec:v libx264 -x264opts keyint=%d:min-keyint=%d:scenecut=-1 -an -ss %d -t %d -y %s" % \
-                    (tmpvidfile, tilebr * bitrateLevels[b], twidth, theight, x * twidth, y * theight, math.ceil(fps), keyint, keyint, startFrom, outLength, croppedfile))
+                runProc("ffmpeg -i %s -b %d -filter:v \"%s\" -codec:v libx264 -x264opts keyint=%d:min-keyint=%d:scenecut=-1 -an -ss %d -t %d -y %s" % \
+                    (tmpvidfile, tilebr * bitrateLevels[b], tileFilter(b, x, y), keyint, keyint, startFrom, outLength, croppedfile))
 
             print("\r%d/%d cropped" % (counter, htiles * vtiles * len(bitrateLevels)), end='')
 print("")
@@ -129,7 +222,40 @@ for i in range(1, len(mpds)):
 
 for mpd in mpds:
     os.remove(mpd)
-        
+
+# media files of a representation in segment order, from its SegmentList or a $Number$ template
+def segmentFiles(adaptionSet, representation):
+    segmentList = representation.find(ns + 'SegmentList')
+    if segmentList is not None:
+        return [url.get('media') for url in segmentList.findall(ns + 'SegmentURL')]
+    template = representation.find(ns + 'SegmentTemplate')
+    if template is None:
+        template = adaptionSet.find(ns + 'SegmentTemplate')
+    if template is None:
+        return []
+    media = template.get('media').replace('$RepresentationID$', representation.get('id'))
+    number = int(template.get('startNumber', '1'))
+    files = []
+    while True:
+        file = re.sub(r'\$Number(%0(\d+)d)?\$', lambda m: str(number).zfill(int(m.group(2) or 0)), media)
+        if not os.path.isfile(file):
+            return files
+        files.append(file)
+        number = number + 1
+
+# exact bytes of every tile segment, the adaption budgets with them instead of the average bandwidths
+# layout of SegmentSizeIndex.hpp: magic, segments, tiles, qualities, then uint32 bytes per segment, tile and quality
+files = [[segmentFiles(a, r) for r in a.findall(ns + 'Representation')] for a in adaptionSets]
+numSegments = max(len(f) for tile in files for f in tile)
+sizes = bytearray()
+for s in range(0, numSegments):
+    for tile in files:
+        for f in tile:
+            sizes += struct.pack('<I', os.path.getsize(f[s]) if s < len(f) and os.path.isfile(f[s]) else 0)
+with open('%s.sizes' % (vidname), 'wb') as index:
+    index.write(b'SEGSIZE1' + struct.pack('<III', numSegments, len(files), len(files[0])) + sizes)
+ET.SubElement(period, ns + 'SupplementalProperty', { 'schemeIdUri': 'urn:360transitions:segmentsizes', 'value': '%s.sizes' % (vidname) })
+
 mpd1.write('%s.mpd' % (vidname), encoding='utf8')
     
 print("done")